@@ -22,6 +22,7 @@
 #include "move-fd.h"
 #include "proc.h"
 #include "proc-map.h"
+#include "relay.h"
 
 #include <guacamole/client.h>
 #include <guacamole/error.h>
@@ -46,146 +47,14 @@
 #include <sys/wait.h>
 
 /**
- * Behaves exactly as write(), but writes as much as possible, returning
- * successfully only if the entire buffer was written. If the write fails for
- * any reason, a negative value is returned.
- *
- * @param fd
- *     The file descriptor to write to.
- *
- * @param buffer
- *     The buffer containing the data to be written.
- *
- * @param length
- *     The number of bytes in the buffer to write.
- *
- * @return
- *     The number of bytes written, or -1 if an error occurs. As this function
- *     is guaranteed to write ALL bytes, this will always be the number of
- *     bytes specified by length unless an error occurs.
- */
-static int __write_all(int fd, char* buffer, int length) {
-
-    /* Repeatedly write() until all data is written */
-    int remaining_length = length;
-    while (remaining_length > 0) {
-
-        int written;
-        GUAC_RETRY_EINTR(written, write(fd, buffer, remaining_length));
-        if (written < 0)
-            return -1;
-
-        remaining_length -= written;
-        buffer += written;
-
-    }
-
-    return length;
-
-}
-
-/**
- * Continuously reads from a guac_socket, writing all data read to a file
- * descriptor. Any data already buffered from that guac_socket by a given
- * guac_parser is read first, prior to reading further data from the
- * guac_socket. The provided guac_parser will be freed once its buffers have
- * been emptied, but the guac_socket will not.
- *
- * This thread ultimately terminates when no further data can be read from the
- * guac_socket.
- *
- * @param data
- *     A pointer to a guacd_connection_io_thread_params structure containing
- *     the guac_socket to read from, the file descriptor to write the read data
- *     to, and the guac_parser associated with the guac_socket which may have
- *     unhandled data in its parsing buffers.
- *
- * @return
- *     Always NULL.
- */
-static void* guacd_connection_write_thread(void* data) {
-
-    /* Thread name conn-write: forwards data from the connected user to the
-     * connection's child process. */
-    guac_thread_name_set("conn-write");
-
-    guacd_connection_io_thread_params* params = (guacd_connection_io_thread_params*) data;
-    char buffer[8192];
-
-    int length;
-
-    /* Read all buffered data from parser first */
-    while ((length = guac_parser_shift(params->parser, buffer, sizeof(buffer))) > 0) {
-        if (__write_all(params->fd, buffer, length) < 0)
-            break;
-    }
-
-    /* Parser is no longer needed */
-    guac_parser_free(params->parser);
-
-    /* Transfer data from file descriptor to socket */
-    while ((length = guac_socket_read(params->socket, buffer, sizeof(buffer))) > 0) {
-        if (__write_all(params->fd, buffer, length) < 0)
-            break;
-    }
-
-    /* Signal end of input to the connection process. Without this, a user
-     * which vanishes without sending "disconnect" leaves that process blocked
-     * awaiting input indefinitely, as nothing further will inform it that its
-     * last user has left. */
-    if (shutdown(params->fd, SHUT_WR))
-        guacd_log(GUAC_LOG_ERROR, "Unable to signal end of user input to "
-                "connection process: %s. That process may remain running but "
-                "inactive, retaining the memory of its connection until guacd "
-                "is restarted.", strerror(errno));
-
-    return NULL;
-
-}
-
-void* guacd_connection_io_thread(void* data) {
-
-    /* Thread name conn-read: forwards data from the connection's child
-     * process back to the connected user. */
-    guac_thread_name_set("conn-read");
-
-    guacd_connection_io_thread_params* params = (guacd_connection_io_thread_params*) data;
-    char buffer[8192];
-
-    int length;
-
-    pthread_t write_thread;
-    pthread_create(&write_thread, NULL, guacd_connection_write_thread, params);
-
-    /* Transfer data from file descriptor to socket */
-    while (1) {
-        GUAC_RETRY_EINTR(length, read(params->fd, buffer, sizeof(buffer)));
-
-        if (length <= 0)
-            break;
-
-        if (guac_socket_write(params->socket, buffer, length))
-            break;
-        guac_socket_flush(params->socket);
-    }
-
-    /* Wait for write thread to die */
-    pthread_join(write_thread, NULL);
-
-    /* Clean up */
-    guac_socket_free(params->socket);
-    close(params->fd);
-    guac_mem_free(params);
-
-    return NULL;
-
-}
-
-/**
- * Adds the given socket as a new user to the given process, automatically
- * reading/writing from the socket via read/write threads. The given socket,
- * parser, and any associated resources will be freed unless the user is not
- * added successfully.
+ * Adds the given socket as a new user to the given process. If the user's
+ * connection is not encrypted and no data beyond the handshake has yet been
+ * received, the file descriptor of that connection is given to the process
+ * directly, such that guacd is no longer involved in the user's I/O at all.
+ * Otherwise, data is relayed between the socket and the process by the
+ * shared relay threads (see guacd_relay_add()). The given socket, parser, and
+ * any associated resources will be freed unless the user is not added
+ * successfully.
  *
  * If adding the user fails for any reason, non-zero is returned. Zero is
  * returned upon success.
@@ -201,10 +70,41 @@ void* guacd_connection_io_thread(void* data) {
  *     The socket associated with the user to be added to the existing
  *     process.
  *
+ * @param socket_fd
+ *     The file descriptor underlying the given socket.
+ *
+ * @param encrypted
+ *     Non-zero if the given socket was created with
+ *     guac_socket_open_secure(), and thus all I/O must pass through its TLS
+ *     session, zero otherwise.
+ *
  * @return
  *     Zero if the user was added successfully, non-zero if an error occurred.
  */
-static int guacd_add_user(guacd_proc* proc, guac_parser* parser, guac_socket* socket) {
+static int guacd_add_user(guacd_proc* proc, guac_parser* parser,
+        guac_socket* socket, int socket_fd, int encrypted) {
+
+    /* Hand the user's connection directly to the process if nothing has been
+     * received that the process would not otherwise see */
+    if (!encrypted && guac_parser_length(parser) == 0) {
+
+        /* Anything already written must reach the user before output from
+         * the process */
+        guac_socket_flush(socket);
+
+        if (!guacd_send_fd(proc->fd_socket, socket_fd)) {
+            guacd_log(GUAC_LOG_ERROR, "Unable to add user.");
+            return 1;
+        }
+
+        /* The process now has its own copy of the file descriptor, thus our
+         * copy can be closed */
+        guac_parser_free(parser);
+        guac_socket_free(socket);
+
+        return 0;
+
+    }
 
     int sockets[2];
 
@@ -220,21 +120,26 @@ static int guacd_add_user(guacd_proc* proc, guac_parser* parser, guac_socket* so
     /* Send user file descriptor to process */
     if (!guacd_send_fd(proc->fd_socket, proc_fd)) {
         guacd_log(GUAC_LOG_ERROR, "Unable to add user.");
+        close(user_fd);
+        close(proc_fd);
         return 1;
     }
 
     /* Close our end of the process file descriptor */
     close(proc_fd);
 
-    guacd_connection_io_thread_params* params = guac_mem_alloc(sizeof(guacd_connection_io_thread_params));
-    params->parser = parser;
-    params->socket = socket;
-    params->fd = user_fd;
+    /* Relay data between the user and the process. If this fails, the
+     * process will see the user leave immediately. */
+    if (guacd_relay_add(socket, socket_fd, encrypted, parser, user_fd)) {
+        close(user_fd);
+        return 1;
+    }
 
-    /* Start I/O thread */
-    pthread_t io_thread;
-    pthread_create(&io_thread,  NULL, guacd_connection_io_thread,  params);
-    pthread_detach(io_thread);
+    guacd_relay_stats stats;
+    guacd_relay_get_stats(&stats);
+    guacd_log(GUAC_LOG_DEBUG, "Relaying %i user connection(s) (%zu bytes "
+            "per idle connection, %zu bytes awaiting delivery).",
+            stats.connections, stats.idle_connection_size, stats.held_bytes);
 
     return 0;
 
@@ -256,11 +161,20 @@ static int guacd_add_user(guacd_proc* proc, guac_parser* parser, guac_socket* so
  *     The socket associated with the new connection that must be routed to
  *     a new or existing process within the given map.
  *
+ * @param socket_fd
+ *     The file descriptor underlying the given socket.
+ *
+ * @param encrypted
+ *     Non-zero if the given socket was created with
+ *     guac_socket_open_secure(), and thus all I/O must pass through its TLS
+ *     session, zero otherwise.
+ *
  * @return
  *     Zero if the connection was successfully routed, non-zero if routing has
  *     failed.
  */
-static int guacd_route_connection(guacd_proc_map* map, guac_socket* socket) {
+static int guacd_route_connection(guacd_proc_map* map, guac_socket* socket,
+        int socket_fd, int encrypted) {
 
     guac_parser* parser = guac_parser_alloc();
 
@@ -336,7 +250,8 @@ static int guacd_route_connection(guacd_proc_map* map, guac_socket* socket) {
     }
 
     /* Add new user (in the case of a new process, this will be the owner */
-    int add_user_failed = guacd_add_user(proc, parser, socket);
+    int add_user_failed = guacd_add_user(proc, parser, socket, socket_fd,
+            encrypted);
 
     /* If new process was created, manage that process */
     if (new_process) {
@@ -400,6 +315,8 @@ void* guacd_connection_thread(void* data) {
 
     guac_socket* socket;
 
+    int encrypted = 0;
+
 #ifdef ENABLE_SSL
 
     SSL_CTX* ssl_context = params->ssl_context;
@@ -407,6 +324,7 @@ void* guacd_connection_thread(void* data) {
     /* If SSL chosen, use it */
     if (ssl_context != NULL) {
         socket = guac_socket_open_secure(ssl_context, connected_socket_fd);
+        encrypted = 1;
         if (socket == NULL) {
             guacd_log_guac_error(GUAC_LOG_ERROR, "Unable to set up SSL/TLS");
             close(connected_socket_fd);
@@ -423,7 +341,7 @@ void* guacd_connection_thread(void* data) {
 #endif
 
     /* Route connection according to Guacamole, creating a new process if needed */
-    if (guacd_route_connection(map, socket))
+    if (guacd_route_connection(map, socket, connected_socket_fd, encrypted))
         guac_socket_free(socket);
 
     guac_mem_free(params);
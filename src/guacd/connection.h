@@ -72,49 +72,5 @@ typedef struct guacd_connection_thread_params {
  */
 void* guacd_connection_thread(void* data);
 
-/**
- * Parameters required by the per-connection I/O transfer thread.
- */
-typedef struct guacd_connection_io_thread_params {
-
-    /**
-     * The guac_parser which may contain buffered, but unparsed, data from the
-     * original guac_socket which must be transferred to the
-     * connection-specific process.
-     */
-    guac_parser* parser;
-
-    /**
-     * The guac_socket which is directly handling I/O from a user's connection
-     * to guacd.
-     */
-    guac_socket* socket;
-
-    /**
-     * The file descriptor which is being handled by a guac_socket within the
-     * connection-specific process.
-     */
-    int fd;
-
-} guacd_connection_io_thread_params;
-
-/**
- * Transfers data back and forth between the guacd-side guac_socket and the
- * file descriptor used by the process-side guac_socket. Note that both the
- * provided guac_parser and the guac_socket will be freed once this thread
- * terminates, which will occur when no further data can be read from the
- * guac_socket.
- *
- * @param data
- *     A pointer to a guacd_connection_io_thread_params structure containing
- *     the guac_socket and file descriptor to transfer data between
- *     (bidirectionally), as well as the guac_parser associated with the
- *     guac_socket (which may have unhandled data in its parsing buffers).
- *
- * @return
- *     Always NULL.
- */
-void* guacd_connection_io_thread(void* data);
-
 #endif
 
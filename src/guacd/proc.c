@@ -479,8 +479,10 @@ static int guacd_close_fd_range(unsigned int first, unsigned int last) {
  * be called only from within a newly-forked connection process.
  *
  * The descriptors closed here belong to unrelated connections: the parent's
- * end of every other connection's user socketpair, the parent's end of every
- * other connection process' socketpair, and the socket guacd listens on.
+ * end of every other connection's user socketpair (or the user's own
+ * connection, until handed to its process), the parent's end of every other
+ * connection process' socketpair, the epoll instances of the relay threads,
+ * and the socket guacd listens on.
  * Retaining them keeps those sockets referenced after the parent has closed
  * them, such that their peers never observe EOF, writes to those peers block
  * indefinitely rather than failing, and the processes owning them can never
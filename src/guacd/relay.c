@@ -0,0 +1,1365 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "log.h"
+#include "relay.h"
+
+#include <guacamole/error.h>
+#include <guacamole/mem.h>
+#include <guacamole/parser.h>
+#include <guacamole/proctitle.h>
+#include <guacamole/socket.h>
+
+#ifdef ENABLE_SSL
+#include <openssl/ssl.h>
+#include <guacamole/socket-ssl.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * The event awaited on a file descriptor that must become readable.
+ */
+#define GUACD_RELAY_EVENT_READ EPOLLIN
+
+/**
+ * The event awaited on a file descriptor that must become writable.
+ */
+#define GUACD_RELAY_EVENT_WRITE EPOLLOUT
+#else
+#define GUACD_RELAY_EVENT_READ POLLIN
+#define GUACD_RELAY_EVENT_WRITE POLLOUT
+
+/**
+ * The number of file descriptors that each relay thread initially has space
+ * to monitor when using poll(). This space grows as needed.
+ */
+#define GUACD_RELAY_INITIAL_FDS 64
+#endif
+
+/**
+ * Returned by the read and write functions of the relay if the operation
+ * cannot proceed without blocking.
+ */
+#define GUACD_RELAY_WOULD_BLOCK -1
+
+/**
+ * Returned by the read and write functions of the relay if the operation
+ * failed.
+ */
+#define GUACD_RELAY_ERROR -2
+
+/**
+ * The state of data being relayed in one direction, either from a user to
+ * their connection process or vice versa.
+ */
+typedef struct guacd_relay_direction {
+
+    /**
+     * Non-zero if this direction reads from the user and writes to the
+     * process, zero if this direction reads from the process and writes to
+     * the user.
+     */
+    int from_user;
+
+    /**
+     * Data that has been read but could not yet be written, or NULL if no
+     * data is held. This buffer is allocated only while data is held, such
+     * that idle connections require no buffer space.
+     */
+    char* held;
+
+    /**
+     * The offset of the first byte within the held buffer that has not yet
+     * been written.
+     */
+    size_t held_offset;
+
+    /**
+     * The number of bytes within the held buffer that have not yet been
+     * written.
+     */
+    size_t held_length;
+
+    /**
+     * Non-zero if no further data can be read from the source of this
+     * direction.
+     */
+    int eof;
+
+    /**
+     * Non-zero if relaying in this direction has finished.
+     */
+    int done;
+
+    /**
+     * Non-zero if this direction is waiting for an event on the user's file
+     * descriptor, zero if waiting on the process' file descriptor. This is
+     * meaningful only if wait_events is non-zero.
+     */
+    int wait_user;
+
+    /**
+     * The events that this direction is waiting for before it can make
+     * further progress, or zero if it is not waiting.
+     */
+    uint32_t wait_events;
+
+} guacd_relay_direction;
+
+/**
+ * A user's connection and the file descriptor of its connection process,
+ * between which data is being relayed.
+ */
+typedef struct guacd_relay_connection {
+
+    /**
+     * The guac_socket of the user's connection to guacd.
+     */
+    guac_socket* socket;
+
+    /**
+     * The file descriptor underlying the user's guac_socket.
+     */
+    int user_fd;
+
+#ifdef ENABLE_SSL
+    /**
+     * The TLS session of the user's connection, or NULL if the connection is
+     * not encrypted.
+     */
+    SSL* ssl;
+#endif
+
+    /**
+     * The file descriptor handled by a guac_socket within the connection
+     * process.
+     */
+    int proc_fd;
+
+    /**
+     * The events currently registered for the user's file descriptor,
+     * or zero if that file descriptor is not registered.
+     */
+    uint32_t user_events;
+
+    /**
+     * The events currently registered for the process' file
+     * descriptor, or zero if that file descriptor is not registered.
+     */
+    uint32_t proc_events;
+
+    /**
+     * Data being relayed from the user to the process.
+     */
+    guacd_relay_direction to_proc;
+
+    /**
+     * Data being relayed from the process to the user.
+     */
+    guacd_relay_direction to_user;
+
+    /**
+     * Non-zero if relaying has stopped and the connection has been closed,
+     * such that it only awaits being freed.
+     */
+    int closed;
+
+    /**
+     * The next connection within the list of closed connections awaiting
+     * being freed by the relay thread.
+     */
+    struct guacd_relay_connection* next_closed;
+
+#ifndef HAVE_SYS_EPOLL_H
+    /**
+     * The index of the user's file descriptor within the pollfd array of the
+     * relay thread. This is meaningful only if user_events is non-zero.
+     */
+    int user_slot;
+
+    /**
+     * The index of the process' file descriptor within the pollfd array of
+     * the relay thread. This is meaningful only if proc_events is non-zero.
+     */
+    int proc_slot;
+
+    /**
+     * The next connection within the list of connections awaiting
+     * registration by the relay thread.
+     */
+    struct guacd_relay_connection* next_pending;
+#endif
+
+} guacd_relay_connection;
+
+/**
+ * A thread which relays data for any number of connections.
+ */
+typedef struct guacd_relay_thread {
+
+#ifdef HAVE_SYS_EPOLL_H
+    /**
+     * The epoll instance monitoring the file descriptors of all connections
+     * serviced by this thread.
+     */
+    int epoll_fd;
+
+    /**
+     * Storage for the events returned by each call to epoll_wait().
+     */
+    struct epoll_event events[GUACD_RELAY_MAX_EVENTS];
+#else
+    /**
+     * The file descriptors of all connections serviced by this thread, as
+     * passed to poll(). The first element is always the read end of
+     * wake_fds.
+     */
+    struct pollfd* fds;
+
+    /**
+     * The connection owning each file descriptor within fds. The first
+     * element is always NULL.
+     */
+    guacd_relay_connection** owners;
+
+    /**
+     * The number of elements within fds and owners that are in use.
+     */
+    int fd_count;
+
+    /**
+     * The number of elements that fds and owners have space for.
+     */
+    int fd_capacity;
+
+    /**
+     * The index, relative to the first connection's file descriptor, at which
+     * the next search for ready file descriptors begins, such that no
+     * connection is starved if more than GUACD_RELAY_MAX_EVENTS file
+     * descriptors are ready at once.
+     */
+    int next_slot;
+
+    /**
+     * A pipe whose read end is monitored alongside all connections, written
+     * to by guacd_relay_add() to wake the thread once a new connection is
+     * pending.
+     */
+    int wake_fds[2];
+
+    /**
+     * Connections which have been added but not yet registered by this
+     * thread. Only the thread itself may modify fds and owners, as poll()
+     * may be reading those arrays.
+     */
+    guacd_relay_connection* pending;
+
+    /**
+     * Lock which guards pending.
+     */
+    pthread_mutex_t pending_lock;
+#endif
+
+    /**
+     * The buffer used to transfer data for all connections serviced by this
+     * thread.
+     */
+    char buffer[GUACD_RELAY_BUFFER_SIZE];
+
+    /**
+     * Connections which have been closed while handling the current batch of
+     * events, and which will be freed once that batch has been handled.
+     */
+    guacd_relay_connection* closed;
+
+} guacd_relay_thread;
+
+/**
+ * All threads which relay data, as started by guacd_relay_init().
+ */
+static guacd_relay_thread* guacd_relay_threads[GUACD_RELAY_MAX_THREADS];
+
+/**
+ * The number of threads within guacd_relay_threads.
+ */
+static int guacd_relay_thread_count = 0;
+
+/**
+ * The index of the thread that will be assigned the next connection.
+ */
+static int guacd_relay_next_thread = 0;
+
+/**
+ * Statistics describing all relayed connections. Only the connections and
+ * held_bytes members are maintained here.
+ */
+static guacd_relay_stats guacd_relay_current_stats;
+
+/**
+ * Lock which guards guacd_relay_next_thread and guacd_relay_current_stats.
+ */
+static pthread_mutex_t guacd_relay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Initialization control for the relay threads.
+ */
+static pthread_once_t guacd_relay_init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Adjusts the number of bytes held by all relayed connections.
+ *
+ * @param delta
+ *     The number of bytes newly held (positive) or released (negative).
+ */
+static void guacd_relay_update_held_bytes(ssize_t delta) {
+    pthread_mutex_lock(&guacd_relay_lock);
+    guacd_relay_current_stats.held_bytes += delta;
+    pthread_mutex_unlock(&guacd_relay_lock);
+}
+
+/**
+ * Reads data from the given file descriptor without blocking.
+ *
+ * @param fd
+ *     The file descriptor to read from.
+ *
+ * @param buffer
+ *     The buffer to read data into.
+ *
+ * @param length
+ *     The maximum number of bytes to read.
+ *
+ * @param events
+ *     Storage for the events that must be awaited on the file
+ *     descriptor if GUACD_RELAY_WOULD_BLOCK is returned.
+ *
+ * @return
+ *     The number of bytes read, zero on end-of-file, GUACD_RELAY_WOULD_BLOCK
+ *     if no data is available, or GUACD_RELAY_ERROR if the read failed.
+ */
+static ssize_t guacd_relay_fd_read(int fd, char* buffer, size_t length,
+        uint32_t* events) {
+
+    ssize_t result;
+    GUAC_RETRY_EINTR(result, read(fd, buffer, length));
+
+    if (result >= 0)
+        return result;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        *events = GUACD_RELAY_EVENT_READ;
+        return GUACD_RELAY_WOULD_BLOCK;
+    }
+
+    return GUACD_RELAY_ERROR;
+
+}
+
+/**
+ * Writes data to the given file descriptor without blocking.
+ *
+ * @param fd
+ *     The file descriptor to write to.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @param events
+ *     Storage for the events that must be awaited on the file
+ *     descriptor if GUACD_RELAY_WOULD_BLOCK is returned.
+ *
+ * @return
+ *     The number of bytes written, GUACD_RELAY_WOULD_BLOCK if no data can be
+ *     written, or GUACD_RELAY_ERROR if the write failed.
+ */
+static ssize_t guacd_relay_fd_write(int fd, const char* buffer, size_t length,
+        uint32_t* events) {
+
+    ssize_t result;
+    GUAC_RETRY_EINTR(result, write(fd, buffer, length));
+
+    if (result > 0)
+        return result;
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        *events = GUACD_RELAY_EVENT_WRITE;
+        return GUACD_RELAY_WOULD_BLOCK;
+    }
+
+    return GUACD_RELAY_ERROR;
+
+}
+
+#ifdef ENABLE_SSL
+/**
+ * Translates the result of a failed SSL_read() or SSL_write() into the
+ * return value expected of the read and write functions of the relay.
+ *
+ * @param ssl
+ *     The TLS session of the failed operation.
+ *
+ * @param result
+ *     The value returned by the failed operation.
+ *
+ * @param events
+ *     Storage for the events that must be awaited on the user's file
+ *     descriptor if GUACD_RELAY_WOULD_BLOCK is returned.
+ *
+ * @return
+ *     Zero if the TLS session was closed cleanly, GUACD_RELAY_WOULD_BLOCK if
+ *     the operation must be retried once the user's file descriptor is ready,
+ *     or GUACD_RELAY_ERROR if the operation failed.
+ */
+static ssize_t guacd_relay_ssl_result(SSL* ssl, int result, uint32_t* events) {
+
+    switch (SSL_get_error(ssl, result)) {
+
+        /* TLS may need to read or write regardless of the direction of the
+         * operation, such as during renegotiation */
+        case SSL_ERROR_WANT_READ:
+            *events = GUACD_RELAY_EVENT_READ;
+            return GUACD_RELAY_WOULD_BLOCK;
+
+        case SSL_ERROR_WANT_WRITE:
+            *events = GUACD_RELAY_EVENT_WRITE;
+            return GUACD_RELAY_WOULD_BLOCK;
+
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+
+        default:
+            return GUACD_RELAY_ERROR;
+
+    }
+
+}
+#endif
+
+/**
+ * Reads data from the source of the given direction without blocking.
+ *
+ * @param connection
+ *     The connection being relayed.
+ *
+ * @param direction
+ *     The direction whose source should be read.
+ *
+ * @param buffer
+ *     The buffer to read data into.
+ *
+ * @param length
+ *     The maximum number of bytes to read.
+ *
+ * @return
+ *     The number of bytes read, zero on end-of-file, GUACD_RELAY_WOULD_BLOCK
+ *     if no data is available (in which case the events awaited by the
+ *     direction are updated), or GUACD_RELAY_ERROR if the read failed.
+ */
+static ssize_t guacd_relay_read(guacd_relay_connection* connection,
+        guacd_relay_direction* direction, char* buffer, size_t length) {
+
+    direction->wait_user = direction->from_user;
+
+    if (!direction->from_user)
+        return guacd_relay_fd_read(connection->proc_fd, buffer, length,
+                &direction->wait_events);
+
+#ifdef ENABLE_SSL
+    if (connection->ssl != NULL) {
+        int result = SSL_read(connection->ssl, buffer, length);
+        if (result > 0)
+            return result;
+        return guacd_relay_ssl_result(connection->ssl, result,
+                &direction->wait_events);
+    }
+#endif
+
+    return guacd_relay_fd_read(connection->user_fd, buffer, length,
+            &direction->wait_events);
+
+}
+
+/**
+ * Writes data to the destination of the given direction without blocking.
+ *
+ * @param connection
+ *     The connection being relayed.
+ *
+ * @param direction
+ *     The direction whose destination should be written.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @return
+ *     The number of bytes written, GUACD_RELAY_WOULD_BLOCK if no data can be
+ *     written (in which case the events awaited by the direction are
+ *     updated), or GUACD_RELAY_ERROR if the write failed.
+ */
+static ssize_t guacd_relay_write(guacd_relay_connection* connection,
+        guacd_relay_direction* direction, const char* buffer, size_t length) {
+
+    direction->wait_user = !direction->from_user;
+
+    if (direction->from_user)
+        return guacd_relay_fd_write(connection->proc_fd, buffer, length,
+                &direction->wait_events);
+
+#ifdef ENABLE_SSL
+    if (connection->ssl != NULL) {
+        int result = SSL_write(connection->ssl, buffer, length);
+        if (result > 0)
+            return result;
+        result = guacd_relay_ssl_result(connection->ssl, result,
+                &direction->wait_events);
+        return result == GUACD_RELAY_WOULD_BLOCK ? result : GUACD_RELAY_ERROR;
+    }
+#endif
+
+    return guacd_relay_fd_write(connection->user_fd, buffer, length,
+            &direction->wait_events);
+
+}
+
+/**
+ * Discards any data held by the given direction, freeing its buffer.
+ *
+ * @param direction
+ *     The direction whose held data should be discarded.
+ */
+static void guacd_relay_release(guacd_relay_direction* direction) {
+
+    if (direction->held == NULL)
+        return;
+
+    guacd_relay_update_held_bytes(-(ssize_t) direction->held_length);
+
+    guac_mem_free(direction->held);
+    direction->held = NULL;
+    direction->held_offset = 0;
+    direction->held_length = 0;
+
+}
+
+/**
+ * Writes as much of the given data to the destination of the given direction
+ * as possible without blocking. Any data that cannot be written is copied
+ * into the held buffer of the direction. If the direction already holds data,
+ * the given data must be exactly the data held.
+ *
+ * Because a write that must be retried is always retried with exactly the
+ * same (remaining) data, this satisfies the requirements of SSL_write() for
+ * non-blocking operation.
+ *
+ * @param connection
+ *     The connection being relayed.
+ *
+ * @param direction
+ *     The direction whose destination should be written.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Zero if all data was written, GUACD_RELAY_WOULD_BLOCK if some data is
+ *     now held, or GUACD_RELAY_ERROR if the write failed.
+ */
+static int guacd_relay_deliver(guacd_relay_connection* connection,
+        guacd_relay_direction* direction, const char* buffer, size_t length) {
+
+    /* Data is only ever read while no data is held, thus any data given
+     * while data is held must be that held data */
+    int held = (direction->held != NULL);
+
+    while (length > 0) {
+
+        ssize_t written = guacd_relay_write(connection, direction, buffer, length);
+
+        if (written == GUACD_RELAY_ERROR)
+            return GUACD_RELAY_ERROR;
+
+        /* Retain whatever could not be written until the destination is
+         * ready */
+        if (written == GUACD_RELAY_WOULD_BLOCK) {
+
+            if (!held) {
+                direction->held = guac_mem_alloc(length);
+                memcpy(direction->held, buffer, length);
+                direction->held_offset = 0;
+                direction->held_length = length;
+                guacd_relay_update_held_bytes(length);
+            }
+
+            return GUACD_RELAY_WOULD_BLOCK;
+
+        }
+
+        buffer += written;
+        length -= written;
+
+        if (held) {
+            direction->held_offset += written;
+            direction->held_length -= written;
+            guacd_relay_update_held_bytes(-written);
+        }
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Relays data in the given direction until doing so would block or no
+ * further data can be relayed, updating the events awaited by the
+ * direction accordingly. If no further data can be relayed, the direction is
+ * marked as done.
+ *
+ * @param connection
+ *     The connection being relayed.
+ *
+ * @param direction
+ *     The direction to relay.
+ *
+ * @param buffer
+ *     A buffer of GUACD_RELAY_BUFFER_SIZE bytes which may be used to transfer
+ *     data.
+ */
+static void guacd_relay_pump(guacd_relay_connection* connection,
+        guacd_relay_direction* direction, char* buffer) {
+
+    direction->wait_events = 0;
+
+    while (!direction->done) {
+
+        /* Data held from a previous attempt must be written first */
+        if (direction->held != NULL) {
+
+            int result = guacd_relay_deliver(connection, direction,
+                    direction->held + direction->held_offset,
+                    direction->held_length);
+
+            if (result == GUACD_RELAY_WOULD_BLOCK)
+                return;
+
+            /* Data that cannot be written is dropped */
+            guacd_relay_release(direction);
+            if (result == GUACD_RELAY_ERROR) {
+                direction->done = 1;
+                break;
+            }
+
+        }
+
+        if (direction->eof) {
+            direction->done = 1;
+            break;
+        }
+
+        ssize_t length = guacd_relay_read(connection, direction, buffer,
+                GUACD_RELAY_BUFFER_SIZE);
+
+        if (length == GUACD_RELAY_WOULD_BLOCK)
+            return;
+
+        /* Relay ends upon end-of-file or error */
+        if (length <= 0) {
+            direction->eof = 1;
+            continue;
+        }
+
+        int result = guacd_relay_deliver(connection, direction, buffer, length);
+        if (result == GUACD_RELAY_WOULD_BLOCK)
+            return;
+
+        if (result == GUACD_RELAY_ERROR)
+            direction->done = 1;
+
+    }
+
+    direction->wait_events = 0;
+
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Creates the epoll instance used by the given relay thread to wait for
+ * activity on its connections.
+ *
+ * @param thread
+ *     The relay thread to initialize.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_monitor_init(guacd_relay_thread* thread) {
+    thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return thread->epoll_fd < 0;
+}
+
+/**
+ * Registers, modifies, or removes the epoll registration of the given file
+ * descriptor such that exactly the given events are awaited. A file
+ * descriptor awaiting no events is removed entirely, as epoll would
+ * otherwise continue to report hangups and errors for that descriptor.
+ *
+ * @param thread
+ *     The thread servicing the connection.
+ *
+ * @param fd
+ *     The file descriptor whose registration should be updated.
+ *
+ * @param current
+ *     Storage containing the events currently registered for the file
+ *     descriptor, or zero if the file descriptor is not registered. This is
+ *     updated to the given events.
+ *
+ * @param events
+ *     The events that should be awaited, or zero if none.
+ *
+ * @param connection
+ *     The connection that the file descriptor belongs to.
+ */
+static void guacd_relay_update_interest(guacd_relay_thread* thread, int fd,
+        uint32_t* current, uint32_t events,
+        guacd_relay_connection* connection) {
+
+    if (*current == events)
+        return;
+
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = connection
+    };
+
+    int op = EPOLL_CTL_MOD;
+    if (*current == 0)
+        op = EPOLL_CTL_ADD;
+    else if (events == 0)
+        op = EPOLL_CTL_DEL;
+
+    if (epoll_ctl(thread->epoll_fd, op, fd, &event))
+        guacd_log(GUAC_LOG_ERROR, "Unable to monitor user connection for "
+                "activity: %s", strerror(errno));
+
+    *current = events;
+
+}
+
+/**
+ * Waits for activity on any connection serviced by the given thread.
+ *
+ * @param thread
+ *     The thread whose connections should be waited on.
+ *
+ * @param ready
+ *     Storage for up to GUACD_RELAY_MAX_EVENTS connections which have
+ *     activity. A connection may be listed more than once.
+ *
+ * @return
+ *     The number of connections stored within ready, or a negative value if
+ *     an error occurred.
+ */
+static int guacd_relay_monitor_wait(guacd_relay_thread* thread,
+        guacd_relay_connection** ready) {
+
+    int count;
+    GUAC_RETRY_EINTR(count, epoll_wait(thread->epoll_fd, thread->events,
+                GUACD_RELAY_MAX_EVENTS, -1));
+
+    for (int i = 0; i < count; i++)
+        ready[i] = thread->events[i].data.ptr;
+
+    return count;
+
+}
+
+/**
+ * Assigns the given new connection to the given thread, which will begin
+ * relaying its data promptly.
+ *
+ * @param thread
+ *     The thread that should service the connection.
+ *
+ * @param connection
+ *     The connection to add.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_monitor_add(guacd_relay_thread* thread,
+        guacd_relay_connection* connection) {
+
+    /* Only the user's file descriptor is registered here, as the connection
+     * belongs to the relay thread as soon as it is registered. The user's
+     * connection is immediately writable, and so the relay thread handles
+     * the connection promptly, registering the process' file descriptor
+     * itself. */
+    connection->user_events = GUACD_RELAY_EVENT_READ | GUACD_RELAY_EVENT_WRITE;
+    struct epoll_event event = {
+        .events = connection->user_events,
+        .data.ptr = connection
+    };
+
+    return epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, connection->user_fd,
+            &event) != 0;
+
+}
+#else
+/**
+ * Switches the given end of a pipe to non-blocking, close-on-exec mode.
+ *
+ * @param fd
+ *     The file descriptor to modify.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_set_pipe_flags(int fd) {
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+        return 1;
+
+    return fcntl(fd, F_SETFD, FD_CLOEXEC) != 0;
+
+}
+
+/**
+ * Allocates the pollfd array and wake pipe used by the given relay thread to
+ * wait for activity on its connections.
+ *
+ * @param thread
+ *     The relay thread to initialize.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_monitor_init(guacd_relay_thread* thread) {
+
+    if (pipe(thread->wake_fds))
+        return 1;
+
+    if (guacd_relay_set_pipe_flags(thread->wake_fds[0])
+            || guacd_relay_set_pipe_flags(thread->wake_fds[1])) {
+        close(thread->wake_fds[0]);
+        close(thread->wake_fds[1]);
+        return 1;
+    }
+
+    thread->fd_capacity = GUACD_RELAY_INITIAL_FDS;
+    thread->fds = guac_mem_alloc(sizeof(struct pollfd), thread->fd_capacity);
+    thread->owners = guac_mem_alloc(sizeof(guacd_relay_connection*),
+            thread->fd_capacity);
+
+    thread->fds[0].fd = thread->wake_fds[0];
+    thread->fds[0].events = POLLIN;
+    thread->owners[0] = NULL;
+    thread->fd_count = 1;
+
+    pthread_mutex_init(&thread->pending_lock, NULL);
+    return 0;
+
+}
+
+/**
+ * Adds, modifies, or removes the entry of the given file descriptor within
+ * the pollfd array of the given thread such that exactly the given events
+ * are awaited. A file descriptor awaiting no events is removed entirely, as
+ * poll() would otherwise continue to report hangups and errors for that
+ * descriptor. This function may only be invoked by the relay thread itself.
+ *
+ * @param thread
+ *     The thread servicing the connection.
+ *
+ * @param fd
+ *     The file descriptor whose entry should be updated.
+ *
+ * @param current
+ *     Storage containing the events currently awaited for the file
+ *     descriptor, or zero if the file descriptor has no entry. This is
+ *     updated to the given events.
+ *
+ * @param events
+ *     The events that should be awaited, or zero if none.
+ *
+ * @param connection
+ *     The connection that the file descriptor belongs to.
+ */
+static void guacd_relay_update_interest(guacd_relay_thread* thread, int fd,
+        uint32_t* current, uint32_t events,
+        guacd_relay_connection* connection) {
+
+    if (*current == events)
+        return;
+
+    int* slot = (fd == connection->user_fd)
+        ? &connection->user_slot : &connection->proc_slot;
+
+    /* Append new entries, growing the arrays if necessary */
+    if (*current == 0) {
+
+        if (thread->fd_count == thread->fd_capacity) {
+            thread->fd_capacity *= 2;
+            thread->fds = guac_mem_realloc(thread->fds,
+                    sizeof(struct pollfd), thread->fd_capacity);
+            thread->owners = guac_mem_realloc(thread->owners,
+                    sizeof(guacd_relay_connection*), thread->fd_capacity);
+        }
+
+        *slot = thread->fd_count++;
+        thread->fds[*slot].fd = fd;
+        thread->owners[*slot] = connection;
+
+    }
+
+    /* Remove entries by moving the last entry into their place */
+    else if (events == 0) {
+
+        int last = --thread->fd_count;
+        if (*slot != last) {
+
+            thread->fds[*slot] = thread->fds[last];
+            thread->owners[*slot] = thread->owners[last];
+
+            guacd_relay_connection* moved = thread->owners[*slot];
+            if (thread->fds[*slot].fd == moved->user_fd)
+                moved->user_slot = *slot;
+            else
+                moved->proc_slot = *slot;
+
+        }
+
+        *current = 0;
+        return;
+
+    }
+
+    thread->fds[*slot].events = events;
+    thread->fds[*slot].revents = 0;
+    *current = events;
+
+}
+
+/**
+ * Waits for activity on any connection serviced by the given thread,
+ * registering any connections that were added to the thread since the
+ * previous wait.
+ *
+ * @param thread
+ *     The thread whose connections should be waited on.
+ *
+ * @param ready
+ *     Storage for up to GUACD_RELAY_MAX_EVENTS connections which have
+ *     activity. A connection may be listed more than once.
+ *
+ * @return
+ *     The number of connections stored within ready, or a negative value if
+ *     an error occurred.
+ */
+static int guacd_relay_monitor_wait(guacd_relay_thread* thread,
+        guacd_relay_connection** ready) {
+
+    int count;
+    GUAC_RETRY_EINTR(count, poll(thread->fds, thread->fd_count, -1));
+    if (count < 0)
+        return count;
+
+    /* New connections are immediately writable, and will be reported by the
+     * next wait once registered */
+    if (thread->fds[0].revents) {
+
+        char discard[64];
+        while (read(thread->wake_fds[0], discard, sizeof(discard)) > 0);
+
+        pthread_mutex_lock(&thread->pending_lock);
+        guacd_relay_connection* connection = thread->pending;
+        thread->pending = NULL;
+        pthread_mutex_unlock(&thread->pending_lock);
+
+        while (connection != NULL) {
+            guacd_relay_connection* next = connection->next_pending;
+            guacd_relay_update_interest(thread, connection->user_fd,
+                    &connection->user_events,
+                    GUACD_RELAY_EVENT_READ | GUACD_RELAY_EVENT_WRITE,
+                    connection);
+            connection = next;
+        }
+
+    }
+
+    /* Continue searching from where the previous search stopped */
+    int ready_count = 0;
+    int connection_fds = thread->fd_count - 1;
+    int searched = 0;
+
+    for (; searched < connection_fds && ready_count < GUACD_RELAY_MAX_EVENTS;
+            searched++) {
+        int slot = 1 + (thread->next_slot + searched) % connection_fds;
+        if (thread->fds[slot].revents)
+            ready[ready_count++] = thread->owners[slot];
+    }
+
+    if (connection_fds > 0)
+        thread->next_slot = (thread->next_slot + searched) % connection_fds;
+
+    return ready_count;
+
+}
+
+/**
+ * Assigns the given new connection to the given thread, which will begin
+ * relaying its data promptly. The connection is registered by the thread
+ * itself, as poll() may be reading the thread's pollfd array.
+ *
+ * @param thread
+ *     The thread that should service the connection.
+ *
+ * @param connection
+ *     The connection to add.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_monitor_add(guacd_relay_thread* thread,
+        guacd_relay_connection* connection) {
+
+    pthread_mutex_lock(&thread->pending_lock);
+    connection->next_pending = thread->pending;
+    thread->pending = connection;
+    pthread_mutex_unlock(&thread->pending_lock);
+
+    /* A full pipe already guarantees that the thread will wake */
+    ssize_t result;
+    GUAC_RETRY_EINTR(result, write(thread->wake_fds[1], "", 1));
+    if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        guacd_log(GUAC_LOG_ERROR, "Unable to wake relay thread: %s",
+                strerror(errno));
+
+    return 0;
+
+}
+#endif
+
+/**
+ * Stops relaying data for the given connection, closing the process' file
+ * descriptor and freeing the user's guac_socket. The connection itself is
+ * added to the list of closed connections of the given thread, as further
+ * events for the connection may remain within the batch currently being
+ * handled.
+ *
+ * @param thread
+ *     The thread servicing the connection.
+ *
+ * @param connection
+ *     The connection to close.
+ */
+static void guacd_relay_close(guacd_relay_thread* thread,
+        guacd_relay_connection* connection) {
+
+    guacd_relay_update_interest(thread, connection->user_fd,
+            &connection->user_events, 0, connection);
+    guacd_relay_update_interest(thread, connection->proc_fd,
+            &connection->proc_events, 0, connection);
+
+    guacd_relay_release(&connection->to_proc);
+    guacd_relay_release(&connection->to_user);
+
+    guac_socket_free(connection->socket);
+    close(connection->proc_fd);
+
+    connection->closed = 1;
+    connection->next_closed = thread->closed;
+    thread->closed = connection;
+
+    pthread_mutex_lock(&guacd_relay_lock);
+    guacd_relay_current_stats.connections--;
+    pthread_mutex_unlock(&guacd_relay_lock);
+
+}
+
+/**
+ * Relays as much data as possible for the given connection in both
+ * directions, updating the events awaited for the connection's file
+ * descriptors, and closing the connection if relaying has finished.
+ *
+ * @param thread
+ *     The thread servicing the connection.
+ *
+ * @param connection
+ *     The connection to relay data for.
+ */
+static void guacd_relay_handle(guacd_relay_thread* thread,
+        guacd_relay_connection* connection) {
+
+    guacd_relay_direction* to_proc = &connection->to_proc;
+    guacd_relay_direction* to_user = &connection->to_user;
+
+    int to_proc_done = to_proc->done;
+
+    guacd_relay_pump(connection, to_proc, thread->buffer);
+    guacd_relay_pump(connection, to_user, thread->buffer);
+
+    /* The process no longer requires the user's connection once it has
+     * stopped sending data */
+    if (to_user->done) {
+        guacd_relay_close(thread, connection);
+        return;
+    }
+
+    /* Signal end of input to the connection process. Without this, a user
+     * which vanishes without sending "disconnect" leaves that process blocked
+     * awaiting input indefinitely, as nothing further will inform it that its
+     * last user has left. */
+    if (to_proc->done && !to_proc_done) {
+        if (shutdown(connection->proc_fd, SHUT_WR))
+            guacd_log(GUAC_LOG_ERROR, "Unable to signal end of user input to "
+                    "connection process: %s. That process may remain running "
+                    "but inactive, retaining the memory of its connection "
+                    "until guacd is restarted.", strerror(errno));
+    }
+
+    uint32_t user_events = 0;
+    uint32_t proc_events = 0;
+
+    guacd_relay_direction* directions[] = { to_proc, to_user };
+    for (int i = 0; i < 2; i++) {
+        if (directions[i]->wait_user)
+            user_events |= directions[i]->wait_events;
+        else
+            proc_events |= directions[i]->wait_events;
+    }
+
+    guacd_relay_update_interest(thread, connection->user_fd,
+            &connection->user_events, user_events, connection);
+    guacd_relay_update_interest(thread, connection->proc_fd,
+            &connection->proc_events, proc_events, connection);
+
+}
+
+/**
+ * Relays data for all connections assigned to the given thread, handling
+ * each connection as its file descriptors become ready. This function never
+ * returns.
+ *
+ * @param data
+ *     The guacd_relay_thread being run.
+ *
+ * @return
+ *     Never returns.
+ */
+static void* guacd_relay_thread_run(void* data) {
+
+    /* Thread name conn-relay: forwards data between connected users and their
+     * connections' child processes. */
+    guac_thread_name_set("conn-relay");
+
+    guacd_relay_thread* thread = (guacd_relay_thread*) data;
+    guacd_relay_connection* ready[GUACD_RELAY_MAX_EVENTS];
+
+    while (1) {
+
+        int count = guacd_relay_monitor_wait(thread, ready);
+        if (count < 0) {
+            guacd_log(GUAC_LOG_ERROR, "Unable to wait for activity on user "
+                    "connections: %s", strerror(errno));
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            guacd_relay_connection* connection = ready[i];
+            if (!connection->closed)
+                guacd_relay_handle(thread, connection);
+        }
+
+        /* No further events can refer to connections closed so far */
+        while (thread->closed != NULL) {
+            guacd_relay_connection* connection = thread->closed;
+            thread->closed = connection->next_closed;
+            guac_mem_free(connection);
+        }
+
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Starts the threads that relay data for all connections, one per available
+ * processor up to GUACD_RELAY_MAX_THREADS. This function is invoked only
+ * once, via pthread_once().
+ */
+static void guacd_relay_init(void) {
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors > GUACD_RELAY_MAX_THREADS)
+        processors = GUACD_RELAY_MAX_THREADS;
+
+    for (int i = 0; i < processors || i == 0; i++) {
+
+        guacd_relay_thread* thread = guac_mem_zalloc(sizeof(guacd_relay_thread));
+        if (guacd_relay_monitor_init(thread)) {
+            guacd_log(GUAC_LOG_ERROR, "Unable to create relay thread: %s",
+                    strerror(errno));
+            guac_mem_free(thread);
+            break;
+        }
+
+        pthread_t relay_thread;
+        pthread_create(&relay_thread, NULL, guacd_relay_thread_run, thread);
+        pthread_detach(relay_thread);
+
+        guacd_relay_threads[guacd_relay_thread_count++] = thread;
+
+    }
+
+}
+
+/**
+ * Switches the given file descriptor to non-blocking mode.
+ *
+ * @param fd
+ *     The file descriptor to modify.
+ *
+ * @return
+ *     Zero on success, non-zero on error.
+ */
+static int guacd_relay_set_nonblocking(int fd) {
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return 1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0;
+
+}
+
+int guacd_relay_add(guac_socket* socket, int socket_fd, int encrypted,
+        guac_parser* parser, int proc_fd) {
+
+    pthread_once(&guacd_relay_init_once, guacd_relay_init);
+
+    /* Anything already written must reach the user before output from the
+     * process, and must be sent while the socket still blocks */
+    guac_socket_flush(socket);
+
+    if (guacd_relay_thread_count == 0
+            || guacd_relay_set_nonblocking(socket_fd)
+            || guacd_relay_set_nonblocking(proc_fd)) {
+        guacd_log(GUAC_LOG_ERROR, "Unable to relay user connection: %s",
+                strerror(errno));
+        return 1;
+    }
+
+    guacd_relay_connection* connection = guac_mem_zalloc(sizeof(guacd_relay_connection));
+    connection->socket = socket;
+    connection->user_fd = socket_fd;
+    connection->proc_fd = proc_fd;
+    connection->to_proc.from_user = 1;
+
+#ifdef ENABLE_SSL
+    if (encrypted) {
+
+        guac_socket_ssl_data* ssl_data = (guac_socket_ssl_data*) socket->data;
+        connection->ssl = ssl_data->ssl;
+
+        /* Writes are retried with the same data once the user is ready, but
+         * that data may have been moved into a different buffer */
+        SSL_set_mode(connection->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE
+                | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    }
+#endif
+
+    /* Any data received from the user beyond the handshake is sent to the
+     * process first */
+    if (parser != NULL) {
+
+        int length = guac_parser_length(parser);
+        if (length > 0) {
+            connection->to_proc.held = guac_mem_alloc(length);
+            connection->to_proc.held_length =
+                guac_parser_shift(parser, connection->to_proc.held, length);
+            guacd_relay_update_held_bytes(connection->to_proc.held_length);
+        }
+
+    }
+
+    pthread_mutex_lock(&guacd_relay_lock);
+    guacd_relay_thread* thread = guacd_relay_threads[guacd_relay_next_thread];
+    guacd_relay_next_thread = (guacd_relay_next_thread + 1) % guacd_relay_thread_count;
+    guacd_relay_current_stats.connections++;
+    pthread_mutex_unlock(&guacd_relay_lock);
+
+    if (guacd_relay_monitor_add(thread, connection)) {
+
+        guacd_log(GUAC_LOG_ERROR, "Unable to relay user connection: %s",
+                strerror(errno));
+
+        pthread_mutex_lock(&guacd_relay_lock);
+        guacd_relay_current_stats.connections--;
+        pthread_mutex_unlock(&guacd_relay_lock);
+
+        guacd_relay_release(&connection->to_proc);
+        guac_mem_free(connection);
+        return 1;
+
+    }
+
+    if (parser != NULL)
+        guac_parser_free(parser);
+
+    return 0;
+
+}
+
+void guacd_relay_get_stats(guacd_relay_stats* stats) {
+
+    pthread_mutex_lock(&guacd_relay_lock);
+    *stats = guacd_relay_current_stats;
+    pthread_mutex_unlock(&guacd_relay_lock);
+
+    stats->idle_connection_size = sizeof(guacd_relay_connection);
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUACD_RELAY_H
+#define GUACD_RELAY_H
+
+#include <guacamole/parser.h>
+#include <guacamole/socket.h>
+
+#include <stddef.h>
+
+/**
+ * The maximum number of threads that will be used to relay data between all
+ * users and connection processes, regardless of the number of processors
+ * available.
+ */
+#define GUACD_RELAY_MAX_THREADS 4
+
+/**
+ * The size of the buffer used by each relay thread to transfer data, in
+ * bytes. This buffer is shared by all connections serviced by that thread.
+ */
+#define GUACD_RELAY_BUFFER_SIZE 65536
+
+/**
+ * The maximum number of events that each relay thread will handle per wait
+ * for activity.
+ */
+#define GUACD_RELAY_MAX_EVENTS 64
+
+/**
+ * Statistics describing all connections currently being relayed.
+ */
+typedef struct guacd_relay_stats {
+
+    /**
+     * The number of connections currently being relayed.
+     */
+    int connections;
+
+    /**
+     * The number of bytes of memory allocated by the relay for each
+     * connection that is not currently transferring data. This excludes
+     * memory owned by the connection's guac_socket (and its TLS session, if
+     * any), which exists regardless of how the connection is relayed.
+     */
+    size_t idle_connection_size;
+
+    /**
+     * The total number of bytes of data currently held by the relay awaiting
+     * transmission, across all connections. Data is held only while its
+     * recipient cannot accept it immediately.
+     */
+    size_t held_bytes;
+
+} guacd_relay_stats;
+
+/**
+ * Begins relaying data between the given user's socket and the given file
+ * descriptor of a connection process. Rather than dedicating threads to each
+ * user, data for all users is relayed by a small, fixed pool of threads which
+ * wait for activity on every connection at once, started automatically upon
+ * first use. Both the user's socket and the process' file descriptor are
+ * switched to non-blocking mode.
+ *
+ * Relaying continues in each direction until end-of-file or an error. Once
+ * the user can no longer send data, the process is notified with
+ * shutdown(). Once the process can no longer send data, the relay stops, and
+ * the given guac_socket and file descriptor are freed and closed.
+ *
+ * @param socket
+ *     The guac_socket of the user's connection to guacd, which will be freed
+ *     once relaying stops. Data buffered for writing on this socket is sent
+ *     before any data from the process. The socket must not be used by the
+ *     caller after this function succeeds.
+ *
+ * @param socket_fd
+ *     The file descriptor underlying the given guac_socket.
+ *
+ * @param encrypted
+ *     Non-zero if the given guac_socket was created with
+ *     guac_socket_open_secure(), and thus all data must be encrypted and
+ *     decrypted using its TLS session, zero otherwise.
+ *
+ * @param parser
+ *     The guac_parser used to handle the user's handshake thus far, which may
+ *     contain buffered data that must be sent to the process before anything
+ *     else, or NULL if there is no such parser. The parser is freed if
+ *     relaying begins successfully.
+ *
+ * @param proc_fd
+ *     The file descriptor which is being handled by a guac_socket within the
+ *     connection process, which will be closed once relaying stops.
+ *
+ * @return
+ *     Zero if relaying has begun, non-zero if relaying could not begin. If
+ *     relaying could not begin, none of the guac_socket, parser, or process'
+ *     file descriptor is freed or closed.
+ */
+int guacd_relay_add(guac_socket* socket, int socket_fd, int encrypted,
+        guac_parser* parser, int proc_fd);
+
+/**
+ * Retrieves statistics describing all connections currently being relayed.
+ *
+ * @param stats
+ *     The guacd_relay_stats structure to populate.
+ */
+void guacd_relay_get_stats(guacd_relay_stats* stats);
+
+#endif
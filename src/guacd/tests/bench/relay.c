@@ -0,0 +1,656 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Benchmark of the ways guacd may carry data between connected users and
+ * their connection processes, measuring both throughput and the memory
+ * required by each idle connection. Three arrangements are compared:
+ *
+ *     threads  The relay used by guacd prior to the shared relay threads: an
+ *              I/O thread and a write thread per user, each copying through
+ *              an 8 KB buffer via guac_socket.
+ *
+ *     epoll    The shared relay threads of guacd_relay_add(), used for
+ *              encrypted connections and for connections whose handshake left
+ *              buffered data.
+ *
+ *     direct   The user's TCP connection handed to the process, as is done for
+ *              all other unencrypted connections. guacd is not involved at
+ *              all.
+ *
+ * Throughput is measured by a producer thread writing a fixed amount of data
+ * as a connection process would, while a consumer thread reads it from the
+ * far end of a loopback TCP connection as a user would. Memory per idle
+ * connection is measured as the growth in resident and virtual memory of
+ * this process while a number of connections are being relayed without any
+ * data being sent.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_relay [MEGABYTES [IDLE_CONNECTIONS]]
+ */
+
+#include "log.h"
+#include "proc-map.h"
+#include "relay.h"
+
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+#include <guacamole/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The number of megabytes to transfer with each arrangement if no amount is
+ * given on the command line.
+ */
+#define BENCH_DEFAULT_MEGABYTES 1024
+
+/**
+ * The number of idle connections to relay with each arrangement if no number
+ * is given on the command line.
+ */
+#define BENCH_DEFAULT_IDLE_CONNECTIONS 1000
+
+/**
+ * The number of bytes written by the producer and read by the consumer with
+ * each call to write() or read().
+ */
+#define BENCH_CHUNK_SIZE 65536
+
+/**
+ * The number of milliseconds to wait for relay threads to settle before
+ * measuring memory usage.
+ */
+#define BENCH_SETTLE_TIME 200
+
+/**
+ * The arrangements of producer, relay, and consumer being compared.
+ */
+typedef enum bench_mode {
+
+    /**
+     * Data is relayed by two threads per user, as guacd did prior to the
+     * shared relay threads.
+     */
+    BENCH_MODE_THREADS,
+
+    /**
+     * Data is relayed by guacd_relay_add().
+     */
+    BENCH_MODE_EPOLL,
+
+    /**
+     * Data is written directly to the user's connection.
+     */
+    BENCH_MODE_DIRECT,
+
+    /**
+     * The number of values in this enum. This is not a valid mode.
+     */
+    BENCH_MODE_COUNT
+
+} bench_mode;
+
+/**
+ * Human-readable names of each bench_mode.
+ */
+static const char* bench_mode_names[BENCH_MODE_COUNT] = {
+    "threads", "epoll", "direct"
+};
+
+/**
+ * The file descriptor and amount of data handled by a producer or consumer
+ * thread.
+ */
+typedef struct bench_endpoint {
+
+    /**
+     * The file descriptor to write to (producer) or read from (consumer).
+     * This file descriptor is closed by the thread once it has finished.
+     */
+    int fd;
+
+    /**
+     * The number of bytes to write (producer) or that were read (consumer).
+     */
+    size_t bytes;
+
+} bench_endpoint;
+
+/**
+ * The file descriptors of a single relayed connection, as would exist within
+ * guacd.
+ */
+typedef struct bench_connection {
+
+    /**
+     * Both ends of the user's TCP connection. The first is the end accepted
+     * by guacd, and the second is the user's end.
+     */
+    int tcp_fds[2];
+
+    /**
+     * Both ends of the socketpair between guacd and the connection process.
+     * The first is guacd's end, and the second is the process' end. These
+     * are -1 for BENCH_MODE_DIRECT.
+     */
+    int unix_fds[2];
+
+} bench_connection;
+
+/**
+ * The state of a relay using two threads per user, as used by guacd prior to
+ * the shared relay threads.
+ */
+typedef struct bench_thread_relay {
+
+    /**
+     * The guac_socket of the user's connection.
+     */
+    guac_socket* socket;
+
+    /**
+     * The file descriptor underlying the user's guac_socket.
+     */
+    int user_fd;
+
+    /**
+     * guacd's end of the socketpair with the connection process.
+     */
+    int fd;
+
+} bench_thread_relay;
+
+/**
+ * Attributes of all relay threads created by this benchmark, which use the
+ * same stack size as guacd uses for all threads.
+ */
+static pthread_attr_t bench_thread_attr;
+
+/**
+ * Returns the current value of the given clock, in nanoseconds.
+ *
+ * @param clock
+ *     The clock to read.
+ *
+ * @return
+ *     The current value of the given clock, in nanoseconds.
+ */
+static uint64_t bench_now(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Returns the value of the given field of /proc/self/status, in kilobytes.
+ *
+ * @param field
+ *     The name of the field to read, including the trailing colon, such as
+ *     "VmRSS:".
+ *
+ * @return
+ *     The value of the given field in kilobytes, or zero if the field cannot
+ *     be read.
+ */
+static long bench_status_kb(const char* field) {
+
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return 0;
+
+    char line[256];
+    long value = 0;
+
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            value = atol(line + strlen(field));
+            break;
+        }
+    }
+
+    fclose(status);
+    return value;
+
+}
+
+/**
+ * Writes the number of bytes requested by the given bench_endpoint to its
+ * file descriptor, closing that file descriptor once done.
+ *
+ * @param data
+ *     The bench_endpoint describing the file descriptor and amount of data to
+ *     write.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* bench_producer_thread(void* data) {
+
+    bench_endpoint* producer = (bench_endpoint*) data;
+
+    char* buffer = calloc(1, BENCH_CHUNK_SIZE);
+    size_t remaining = producer->bytes;
+
+    while (remaining > 0) {
+
+        size_t length = remaining;
+        if (length > BENCH_CHUNK_SIZE)
+            length = BENCH_CHUNK_SIZE;
+
+        ssize_t written;
+        GUAC_RETRY_EINTR(written, write(producer->fd, buffer, length));
+        if (written <= 0)
+            break;
+
+        remaining -= written;
+
+    }
+
+    free(buffer);
+    close(producer->fd);
+    return NULL;
+
+}
+
+/**
+ * Reads from the file descriptor of the given bench_endpoint until
+ * end-of-file, storing the number of bytes read, and closing that file
+ * descriptor once done.
+ *
+ * @param data
+ *     The bench_endpoint describing the file descriptor to read from.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* bench_consumer_thread(void* data) {
+
+    bench_endpoint* consumer = (bench_endpoint*) data;
+
+    char* buffer = malloc(BENCH_CHUNK_SIZE);
+    consumer->bytes = 0;
+
+    while (1) {
+
+        ssize_t length;
+        GUAC_RETRY_EINTR(length, read(consumer->fd, buffer, BENCH_CHUNK_SIZE));
+        if (length <= 0)
+            break;
+
+        consumer->bytes += length;
+
+    }
+
+    free(buffer);
+    close(consumer->fd);
+    return NULL;
+
+}
+
+/**
+ * Forwards all data from the user's guac_socket to the connection process,
+ * as the write thread of guacd did prior to the shared relay threads.
+ *
+ * @param data
+ *     The bench_thread_relay describing the connection.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* bench_thread_relay_write_thread(void* data) {
+
+    bench_thread_relay* relay = (bench_thread_relay*) data;
+    char buffer[8192];
+
+    int length;
+    while ((length = guac_socket_read(relay->socket, buffer, sizeof(buffer))) > 0) {
+        if (write(relay->fd, buffer, length) != length)
+            break;
+    }
+
+    shutdown(relay->fd, SHUT_WR);
+    return NULL;
+
+}
+
+/**
+ * Forwards all data from the connection process to the user's guac_socket,
+ * as the I/O thread of guacd did prior to the shared relay threads. Unlike
+ * guacd, the user's connection is shut down once the process closes its end,
+ * such that the write thread and the consumer need not wait for the user to
+ * disconnect.
+ *
+ * @param data
+ *     The bench_thread_relay describing the connection, which is freed once
+ *     the relay stops.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* bench_thread_relay_io_thread(void* data) {
+
+    bench_thread_relay* relay = (bench_thread_relay*) data;
+    char buffer[8192];
+
+    pthread_t write_thread;
+    pthread_create(&write_thread, &bench_thread_attr,
+            bench_thread_relay_write_thread, relay);
+
+    while (1) {
+
+        int length;
+        GUAC_RETRY_EINTR(length, read(relay->fd, buffer, sizeof(buffer)));
+
+        if (length <= 0)
+            break;
+
+        if (guac_socket_write(relay->socket, buffer, length))
+            break;
+        guac_socket_flush(relay->socket);
+
+    }
+
+    guac_socket_flush(relay->socket);
+    shutdown(relay->user_fd, SHUT_RDWR);
+
+    pthread_join(write_thread, NULL);
+
+    guac_socket_free(relay->socket);
+    close(relay->fd);
+    free(relay);
+
+    return NULL;
+
+}
+
+/**
+ * Establishes a TCP connection over the loopback interface, storing the
+ * accepted (guacd) end and the connecting (user) end within the given array,
+ * in that order.
+ *
+ * @param fds
+ *     The array that should receive the file descriptors of both ends of the
+ *     connection.
+ *
+ * @return
+ *     Zero on success, non-zero if the connection could not be established.
+ */
+static int bench_tcp_pair(int fds[2]) {
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+
+    socklen_t addr_len = sizeof(addr);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return 1;
+
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr))
+            || listen(listen_fd, 1)
+            || getsockname(listen_fd, (struct sockaddr*) &addr, &addr_len)) {
+        close(listen_fd);
+        return 1;
+    }
+
+    fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[1] < 0 || connect(fds[1], (struct sockaddr*) &addr, sizeof(addr))) {
+        close(listen_fd);
+        return 1;
+    }
+
+    fds[0] = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+
+    return fds[0] < 0;
+
+}
+
+/**
+ * Establishes the file descriptors of a single connection and begins
+ * relaying data between the user and the process using the given
+ * arrangement.
+ *
+ * @param mode
+ *     The arrangement to use.
+ *
+ * @param connection
+ *     The bench_connection to populate.
+ *
+ * @return
+ *     Zero on success, non-zero if the connection could not be established.
+ */
+static int bench_connect(bench_mode mode, bench_connection* connection) {
+
+    connection->unix_fds[0] = connection->unix_fds[1] = -1;
+
+    if (bench_tcp_pair(connection->tcp_fds))
+        return 1;
+
+    if (mode == BENCH_MODE_DIRECT)
+        return 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, connection->unix_fds))
+        return 1;
+
+    guac_socket* socket = guac_socket_open(connection->tcp_fds[0]);
+
+    if (mode == BENCH_MODE_EPOLL)
+        return guacd_relay_add(socket, connection->tcp_fds[0], 0, NULL,
+                connection->unix_fds[0]);
+
+    bench_thread_relay* relay = malloc(sizeof(bench_thread_relay));
+    relay->socket = socket;
+    relay->user_fd = connection->tcp_fds[0];
+    relay->fd = connection->unix_fds[0];
+
+    pthread_t io_thread;
+    pthread_create(&io_thread, &bench_thread_attr,
+            bench_thread_relay_io_thread, relay);
+    pthread_detach(io_thread);
+
+    return 0;
+
+}
+
+/**
+ * Transfers the given number of bytes from a producer to a consumer using
+ * the given arrangement, returning the time taken.
+ *
+ * @param mode
+ *     The arrangement of producer, relay, and consumer to use.
+ *
+ * @param bytes
+ *     The number of bytes to transfer.
+ *
+ * @param cpu
+ *     Storage for the CPU time consumed by this process during the
+ *     transfer, in nanoseconds.
+ *
+ * @return
+ *     The wall-clock time taken for the consumer to receive all data, in
+ *     nanoseconds, or zero if the benchmark could not be run.
+ */
+static uint64_t bench_throughput(bench_mode mode, size_t bytes, uint64_t* cpu) {
+
+    bench_connection connection;
+
+    uint64_t start = bench_now(CLOCK_MONOTONIC);
+    uint64_t cpu_start = bench_now(CLOCK_PROCESS_CPUTIME_ID);
+
+    if (bench_connect(mode, &connection))
+        return 0;
+
+    bench_endpoint producer = { .bytes = bytes };
+    bench_endpoint consumer = { .fd = connection.tcp_fds[1] };
+
+    producer.fd = (mode == BENCH_MODE_DIRECT)
+        ? connection.tcp_fds[0] : connection.unix_fds[1];
+
+    pthread_t producer_thread;
+    pthread_t consumer_thread;
+    pthread_create(&producer_thread, NULL, bench_producer_thread, &producer);
+    pthread_create(&consumer_thread, NULL, bench_consumer_thread, &consumer);
+
+    pthread_join(producer_thread, NULL);
+    pthread_join(consumer_thread, NULL);
+
+    uint64_t elapsed = bench_now(CLOCK_MONOTONIC) - start;
+    *cpu = bench_now(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+    if (consumer.bytes != bytes) {
+        fprintf(stderr, "%s: received %zu of %zu bytes\n",
+                bench_mode_names[mode], consumer.bytes, bytes);
+        return 0;
+    }
+
+    return elapsed;
+
+}
+
+/**
+ * Relays the given number of idle connections using the given arrangement,
+ * measuring the growth in memory usage of this process.
+ *
+ * @param mode
+ *     The arrangement of relay to use.
+ *
+ * @param count
+ *     The number of idle connections to relay.
+ *
+ * @param rss
+ *     Storage for the growth in resident memory per connection, in bytes.
+ *
+ * @param virtual
+ *     Storage for the growth in virtual memory per connection, in bytes.
+ *
+ * @return
+ *     Zero on success, non-zero if the connections could not be established.
+ */
+static int bench_idle(bench_mode mode, int count, double* rss, double* virtual) {
+
+    bench_connection* connections = calloc(count, sizeof(bench_connection));
+
+    long rss_start = bench_status_kb("VmRSS:");
+    long virtual_start = bench_status_kb("VmSize:");
+
+    int established;
+    for (established = 0; established < count; established++) {
+        if (bench_connect(mode, &connections[established]))
+            break;
+    }
+
+    usleep(BENCH_SETTLE_TIME * 1000);
+
+    *rss = (bench_status_kb("VmRSS:") - rss_start) * 1024.0 / count;
+    *virtual = (bench_status_kb("VmSize:") - virtual_start) * 1024.0 / count;
+
+    /* Disconnect both the users and the processes, allowing the relays to
+     * stop */
+    for (int i = 0; i < established; i++) {
+
+        bench_connection* connection = &connections[i];
+        close(connection->tcp_fds[1]);
+
+        if (mode == BENCH_MODE_DIRECT)
+            close(connection->tcp_fds[0]);
+        else
+            close(connection->unix_fds[1]);
+
+    }
+
+    usleep(BENCH_SETTLE_TIME * 1000);
+    free(connections);
+
+    if (established != count) {
+        fprintf(stderr, "%s: established %i of %i connections\n",
+                bench_mode_names[mode], established, count);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+int main(int argc, char** argv) {
+
+    int megabytes = BENCH_DEFAULT_MEGABYTES;
+    if (argc > 1)
+        megabytes = atoi(argv[1]);
+
+    int idle_connections = BENCH_DEFAULT_IDLE_CONNECTIONS;
+    if (argc > 2)
+        idle_connections = atoi(argv[2]);
+
+    if (megabytes <= 0 || idle_connections <= 0) {
+        fprintf(stderr, "Usage: %s [MEGABYTES [IDLE_CONNECTIONS]]\n", argv[0]);
+        return 1;
+    }
+
+    pthread_attr_init(&bench_thread_attr);
+    pthread_attr_setstacksize(&bench_thread_attr, GUACD_THREAD_STACK_SIZE);
+
+    /* Each idle connection requires four file descriptors */
+    struct rlimit limit;
+    if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    size_t bytes = (size_t) megabytes * 1048576;
+
+    printf("%-8s %10s %14s %16s %16s\n", "Relay", "MB/s", "CPU (ms/GB)",
+            "Idle RSS (B)", "Idle virt. (B)");
+
+    for (int mode = 0; mode < BENCH_MODE_COUNT; mode++) {
+
+        uint64_t cpu = 0;
+        uint64_t elapsed = bench_throughput(mode, bytes, &cpu);
+        if (elapsed == 0)
+            return 1;
+
+        double rss = 0;
+        double virtual = 0;
+        if (bench_idle(mode, idle_connections, &rss, &virtual))
+            return 1;
+
+        printf("%-8s %10.1f %14.1f %16.0f %16.0f\n", bench_mode_names[mode],
+                (double) megabytes / (elapsed / 1000000000.0),
+                cpu / 1000000.0 / (megabytes / 1024.0), rss, virtual);
+
+    }
+
+    return 0;
+
+}
@@ -21,6 +21,7 @@
 
 #include <cairo/cairo.h>
 #include <guacamole/mem.h>
+#include <guacamole/rect.h>
 
 #include <assert.h>
 #include <stdlib.h>
@@ -81,6 +82,7 @@ int guacenc_buffer_resize(guacenc_buffer* buffer, int width, int height) {
         buffer->width = width;
         buffer->height = height;
         buffer->stride = 0;
+        buffer->dirty = (guac_rect) { 0 };
         return 0;
     }
 
@@ -114,6 +116,9 @@ int guacenc_buffer_resize(guacenc_buffer* buffer, int width, int height) {
     buffer->surface = surface;
     buffer->cairo = cairo;
 
+    /* Everything must be redrawn at the new size */
+    guac_rect_init(&buffer->dirty, 0, 0, width, height);
+
     return 0;
 
 }
@@ -139,6 +144,34 @@ int guacenc_buffer_fit(guacenc_buffer* buffer, int x, int y) {
 
 }
 
+void guacenc_buffer_mark_dirty(guacenc_buffer* buffer, cairo_operator_t op,
+        int x, int y, int width, int height) {
+
+    guac_rect bounds;
+    guac_rect_init(&bounds, 0, 0, buffer->width, buffer->height);
+
+    /* Operators which are not bounded by the area drawn may affect any part
+     * of the buffer */
+    switch (op) {
+        case CAIRO_OPERATOR_IN:
+        case CAIRO_OPERATOR_OUT:
+        case CAIRO_OPERATOR_DEST_IN:
+        case CAIRO_OPERATOR_DEST_ATOP:
+            buffer->dirty = bounds;
+            return;
+        default:
+            break;
+    }
+
+    guac_rect rect;
+    guac_rect_init(&rect, x, y, width, height);
+    guac_rect_constrain(&rect, &bounds);
+
+    if (!guac_rect_is_empty(&rect))
+        guac_rect_extend(&buffer->dirty, &rect);
+
+}
+
 int guacenc_buffer_copy(guacenc_buffer* dst, guacenc_buffer* src) {
 
     /* Resize destination to exactly fit source */
@@ -21,6 +21,7 @@
 #define GUACENC_BUFFER_H
 
 #include <cairo/cairo.h>
+#include <guacamole/rect.h>
 
 #include <stdbool.h>
 
@@ -69,6 +70,14 @@ typedef struct guacenc_buffer {
      */
     cairo_t* cairo;
 
+    /**
+     * The region of this buffer that has been modified since the dirty region
+     * was last reset. For the buffers of layers, the dirty region is reset
+     * each time the display is flattened by guacenc_display_flatten(). If
+     * nothing has been modified, this rectangle is empty.
+     */
+    guac_rect dirty;
+
 } guacenc_buffer;
 
 /**
@@ -94,7 +103,8 @@ void guacenc_buffer_free(guacenc_buffer* buffer);
 /**
  * Resizes the given buffer to the given dimensions, allocating or freeing
  * memory as necessary, and updating the buffer's width, height, and stride
- * properties.
+ * properties. If the size of the buffer changes, the entire buffer is marked
+ * as modified.
  *
  * @param buffer
  *     The buffer to resize.
@@ -131,6 +141,34 @@ int guacenc_buffer_resize(guacenc_buffer* buffer, int width, int height);
  */
 int guacenc_buffer_fit(guacenc_buffer* buffer, int x, int y);
 
+/**
+ * Marks the given rectangle of the given buffer as modified, extending the
+ * buffer's dirty region as necessary to contain that rectangle. If the given
+ * Cairo operator is unbounded (it affects the destination even outside the
+ * area drawn, such as CAIRO_OPERATOR_IN), the entire buffer is marked as
+ * modified.
+ *
+ * @param buffer
+ *     The buffer to mark as modified.
+ *
+ * @param op
+ *     The Cairo operator used to draw within the given rectangle.
+ *
+ * @param x
+ *     The X coordinate of the upper-left corner of the modified rectangle.
+ *
+ * @param y
+ *     The Y coordinate of the upper-left corner of the modified rectangle.
+ *
+ * @param width
+ *     The width of the modified rectangle, in pixels.
+ *
+ * @param height
+ *     The height of the modified rectangle, in pixels.
+ */
+void guacenc_buffer_mark_dirty(guacenc_buffer* buffer, cairo_operator_t op,
+        int x, int y, int width, int height);
+
 /**
  * Copies the entire contents of the given source buffer to the destination
  * buffer, ignoring the current contents of the destination. The destination
@@ -23,50 +23,49 @@
 
 #include <cairo/cairo.h>
 #include <guacamole/client.h>
+#include <guacamole/rect.h>
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
-#include <string.h>
 
 /**
- * The Guacamole video encoder display related to the current qsort()
- * operation. As qsort() does not provide a means of passing arbitrary data to
- * the comparator, this value must be set prior to invoking qsort() with
- * guacenc_display_layer_comparator.
+ * A layer being sorted by guacenc_display_sort_layers(), along with its
+ * depth. The depth of each layer is calculated before sorting, as qsort()
+ * does not provide a means of passing the display to the comparator.
  */
-guacenc_display* __qsort_display;
+typedef struct guacenc_display_sort_entry {
+
+    /**
+     * The layer being sorted.
+     */
+    guacenc_layer* layer;
+
+    /**
+     * The depth of the layer, as returned by guacenc_display_get_depth().
+     */
+    int depth;
+
+} guacenc_display_sort_entry;
 
 /**
- * Comparator which orders layer pointers such that (1) NULL pointers are last,
- * (2) layers with the same parent_index are adjacent, and (3) layers with the
- * same parent_index are ordered by Z.
+ * Comparator which orders guacenc_display_sort_entry structures such that
+ * (1) the deepest layers are first, (2) layers with the same parent_index
+ * are adjacent, and (3) layers with the same parent_index are ordered by Z.
  *
  * @see qsort()
  */
 static int guacenc_display_layer_comparator(const void* a, const void* b) {
 
-    guacenc_layer* layer_a = *((guacenc_layer**) a);
-    guacenc_layer* layer_b = *((guacenc_layer**) b);
-
-    /* If a is NULL, sort it to bottom */
-    if (layer_a == NULL) {
-
-        /* ... unless b is also NULL, in which case they are equal */
-        if (layer_b == NULL)
-            return 0;
-
-        return 1;
-    }
+    const guacenc_display_sort_entry* entry_a = (const guacenc_display_sort_entry*) a;
+    const guacenc_display_sort_entry* entry_b = (const guacenc_display_sort_entry*) b;
 
-    /* If b is NULL (and a is not NULL), sort it to bottom */
-    if (layer_b == NULL)
-        return -1;
+    guacenc_layer* layer_a = entry_a->layer;
+    guacenc_layer* layer_b = entry_b->layer;
 
     /* Order such that the deepest layers are first */
-    int a_depth = guacenc_display_get_depth(__qsort_display, layer_a);
-    int b_depth = guacenc_display_get_depth(__qsort_display, layer_b);
-    if (b_depth != a_depth)
-        return b_depth - a_depth;
+    if (entry_b->depth != entry_a->depth)
+        return entry_b->depth - entry_a->depth;
 
     /* Order such that sibling layers are adjacent */
     if (layer_b->parent_index != layer_a->parent_index)
@@ -78,127 +77,368 @@ static int guacenc_display_layer_comparator(const void* a, const void* b) {
 }
 
 /**
- * Renders the mouse cursor on top of the frame buffer of the default layer of
- * the given display.
+ * Calculates the region of the frame buffer of the given default layer that
+ * the mouse cursor of the given display would cover if rendered.
  *
  * @param display
- *     The display whose mouse cursor should be rendered to the frame buffer
- *     of its default layer.
+ *     The display whose mouse cursor is being rendered.
  *
- * @return
- *     Zero if rendering succeeds, non-zero otherwise.
+ * @param def_layer
+ *     The default layer of the given display.
+ *
+ * @param rect
+ *     The rectangle to populate with the region covered by the mouse cursor.
+ *     If the mouse cursor would not be rendered, this rectangle will be
+ *     empty.
  */
-static int guacenc_display_render_cursor(guacenc_display* display) {
+static void guacenc_display_get_cursor_rect(guacenc_display* display,
+        guacenc_layer* def_layer, guac_rect* rect) {
 
     guacenc_cursor* cursor = display->cursor;
+    guacenc_buffer* src = cursor->buffer;
+
+    *rect = (guac_rect) { 0 };
 
     /* Do not render cursor if coordinates are negative */
     if (cursor->x < 0 || cursor->y < 0)
-        return 0;
+        return;
 
-    /* Retrieve default layer (guaranteed to not be NULL) */
-    guacenc_layer* def_layer = guacenc_display_get_layer(display, 0);
-    assert(def_layer != NULL);
+    /* Do not render cursor if there is nothing to render, or nothing to
+     * render onto */
+    if (src->width <= 0 || src->height <= 0 || def_layer->frame->cairo == NULL)
+        return;
+
+    guac_rect_init(rect,
+            cursor->x - cursor->hotspot_x,
+            cursor->y - cursor->hotspot_y,
+            src->width, src->height);
+
+}
+
+/**
+ * Renders the mouse cursor on top of the frame buffer of the given default
+ * layer, within the region recorded in the cursor_rect of the display.
+ *
+ * @param display
+ *     The display whose mouse cursor should be rendered to the frame buffer
+ *     of its default layer.
+ *
+ * @param def_layer
+ *     The default layer of the given display.
+ *
+ * @return
+ *     Zero if rendering succeeds, non-zero otherwise.
+ */
+static int guacenc_display_render_cursor(guacenc_display* display,
+        guacenc_layer* def_layer) {
+
+    guac_rect* rect = &display->cursor_rect;
+    if (guac_rect_is_empty(rect))
+        return 0;
 
     /* Get source and destination buffers */
-    guacenc_buffer* src = cursor->buffer;
+    guacenc_buffer* src = display->cursor->buffer;
     guacenc_buffer* dst = def_layer->frame;
 
     /* Render cursor to layer */
-    if (src->width > 0 && src->height > 0) {
-        cairo_set_source_surface(dst->cairo, src->surface,
-                cursor->x - cursor->hotspot_x,
-                cursor->y - cursor->hotspot_y);
-        cairo_rectangle(dst->cairo,
-                cursor->x - cursor->hotspot_x,
-                cursor->y - cursor->hotspot_y,
-                src->width, src->height);
-        cairo_fill(dst->cairo);
-    }
+    cairo_reset_clip(dst->cairo);
+    cairo_set_operator(dst->cairo, CAIRO_OPERATOR_OVER);
+    cairo_set_source_surface(dst->cairo, src->surface, rect->left, rect->top);
+    cairo_rectangle(dst->cairo, rect->left, rect->top,
+            guac_rect_width(rect), guac_rect_height(rect));
+    cairo_fill(dst->cairo);
 
     /* Always succeeds */
     return 0;
 
 }
 
-int guacenc_display_flatten(guacenc_display* display) {
+/**
+ * Recalculates the order that the layers of the given display must be
+ * composited, storing that order within the render_order of the display. Each
+ * layer is ordered after all layers that must first be composited onto it.
+ *
+ * @param display
+ *     The display whose render order should be recalculated.
+ */
+static void guacenc_display_sort_layers(guacenc_display* display) {
 
     int i;
-    guacenc_layer* render_order[GUACENC_DISPLAY_MAX_LAYERS];
+    int length = 0;
+    guacenc_display_sort_entry entries[GUACENC_DISPLAY_MAX_LAYERS];
 
-    /* Copy list of layers within display */
-    memcpy(render_order, display->layers, sizeof(render_order));
+    /* Any layers allocated while sorting (calculating depth may allocate
+     * missing parents) will invalidate the order again for the next flatten
+     * operation */
+    display->render_order_valid = true;
 
-    /* Sort layers by depth, parent, and Z */
-    __qsort_display = display;
-    qsort(render_order, GUACENC_DISPLAY_MAX_LAYERS, sizeof(guacenc_layer*),
-            guacenc_display_layer_comparator);
-
-    /* Reset layer frame buffers */
+    /* Gather all allocated layers and their depths */
     for (i = 0; i < GUACENC_DISPLAY_MAX_LAYERS; i++) {
 
-        /* Pull current layer, ignoring unallocated layers */
-        guacenc_layer* layer = render_order[i];
+        guacenc_layer* layer = display->layers[i];
         if (layer == NULL)
             continue;
 
-        /* Get source buffer and destination frame buffer */
-        guacenc_buffer* buffer = layer->buffer;
-        guacenc_buffer* frame = layer->frame;
+        entries[length].layer = layer;
+        entries[length].depth = guacenc_display_get_depth(display, layer);
+        length++;
+
+    }
+
+    /* Sort layers by depth, parent, and Z */
+    qsort(entries, length, sizeof(guacenc_display_sort_entry),
+            guacenc_display_layer_comparator);
+
+    for (i = 0; i < length; i++)
+        display->render_order[i] = entries[i].layer;
+
+    display->render_order_length = length;
+
+}
+
+/**
+ * Brings the frame buffer of the given layer up to date with the size of the
+ * layer's buffer, gathers any regions of that buffer that have been modified
+ * since the last flatten operation, and damages the parent layers of the given
+ * layer if its position, stacking order, opacity, or parent have changed.
+ *
+ * @param display
+ *     The display containing the given layer.
+ *
+ * @param layer
+ *     The layer to update.
+ */
+static void guacenc_display_update_layer(guacenc_display* display,
+        guacenc_layer* layer) {
 
-        /* Reset frame contents */
-        guacenc_buffer_copy(frame, buffer);
+    guacenc_buffer* buffer = layer->buffer;
+    guacenc_buffer* frame = layer->frame;
 
+    /* Frame buffer must always be the same size as the layer, and must be
+     * entirely redrawn if resized */
+    if (frame->width != buffer->width || frame->height != buffer->height) {
+        guacenc_buffer_resize(frame, buffer->width, buffer->height);
+        guac_rect_init(&layer->frame_dirty, 0, 0, frame->width, frame->height);
     }
 
-    /* Render each layer, in order */
-    for (i = 0; i < GUACENC_DISPLAY_MAX_LAYERS; i++) {
+    /* Regions modified within the layer itself must be recomposited */
+    guacenc_layer_mark_frame_dirty(layer, &buffer->dirty);
+    buffer->dirty = (guac_rect) { 0 };
+
+    /* Determine where (and whether) the layer is now composited, ignoring
+     * fully-transparent layers, layers without a parent, layers with invalid
+     * parents, and layers with empty buffers */
+    int parent_index = GUACENC_LAYER_NO_PARENT;
+    guac_rect rect = { 0 };
+
+    if (layer->opacity != 0 && layer->parent_index != GUACENC_LAYER_NO_PARENT
+            && buffer->width > 0 && buffer->height > 0
+            && guacenc_display_get_layer(display, layer->parent_index) != NULL) {
+        parent_index = layer->parent_index;
+        guac_rect_init(&rect, layer->x, layer->y, buffer->width, buffer->height);
+    }
 
-        /* Pull current layer, ignoring unallocated layers */
-        guacenc_layer* layer = render_order[i];
-        if (layer == NULL)
-            continue;
+    /* Nothing further to do if the layer is composited exactly as before */
+    if (parent_index == layer->flattened_parent_index
+            && rect.left   == layer->flattened_rect.left
+            && rect.top    == layer->flattened_rect.top
+            && rect.right  == layer->flattened_rect.right
+            && rect.bottom == layer->flattened_rect.bottom
+            && layer->z == layer->flattened_z
+            && layer->opacity == layer->flattened_opacity)
+        return;
+
+    /* Repair the region previously covered by the layer */
+    if (layer->flattened_parent_index != GUACENC_LAYER_NO_PARENT) {
+        guacenc_layer* old_parent = display->layers[layer->flattened_parent_index];
+        if (old_parent != NULL)
+            guacenc_layer_mark_frame_dirty(old_parent, &layer->flattened_rect);
+    }
 
-        /* Skip fully-transparent layers */
-        if (layer->opacity == 0)
-            continue;
+    /* Draw the region now covered by the layer */
+    if (parent_index != GUACENC_LAYER_NO_PARENT)
+        guacenc_layer_mark_frame_dirty(display->layers[parent_index], &rect);
 
-        /* Ignore layers without a parent */
-        int parent_index = layer->parent_index;
-        if (parent_index == GUACENC_LAYER_NO_PARENT)
-            continue;
+    layer->flattened_parent_index = parent_index;
+    layer->flattened_rect = rect;
+    layer->flattened_z = layer->z;
+    layer->flattened_opacity = layer->opacity;
 
-        /* Retrieve parent layer, ignoring layers with invalid parents */
-        guacenc_layer* parent = guacenc_display_get_layer(display, parent_index);
-        if (parent == NULL)
-            continue;
+}
+
+/**
+ * Resets the damaged region of the frame buffer of the given layer to the
+ * contents of the layer's buffer, such that child layers can be composited
+ * on top of that region.
+ *
+ * @param layer
+ *     The layer whose frame buffer should be reset.
+ */
+static void guacenc_display_reset_frame(guacenc_layer* layer) {
+
+    guacenc_buffer* buffer = layer->buffer;
+    guacenc_buffer* frame = layer->frame;
 
-        /* Get source and destination frame buffer */
-        guacenc_buffer* src = layer->frame;
-        guacenc_buffer* dst = parent->frame;
+    /* Damage outside the bounds of the frame is meaningless */
+    guac_rect bounds;
+    guac_rect_init(&bounds, 0, 0, frame->width, frame->height);
+    guac_rect_constrain(&layer->frame_dirty, &bounds);
 
-        /* Ignore layers with empty buffers */
-        cairo_surface_t* surface = src->surface;
-        if (surface == NULL)
+    guac_rect* dirty = &layer->frame_dirty;
+    if (guac_rect_is_empty(dirty))
+        return;
+
+    cairo_t* cairo = frame->cairo;
+
+    /* Reset frame contents within damaged region */
+    cairo_reset_clip(cairo);
+    cairo_rectangle(cairo, dirty->left, dirty->top,
+            guac_rect_width(dirty), guac_rect_height(dirty));
+    cairo_clip(cairo);
+
+    cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(cairo, buffer->surface, 0, 0);
+    cairo_paint(cairo);
+
+}
+
+/**
+ * Composites the frame buffer of the given layer onto the frame buffer of its
+ * parent, limited to the region of the parent that was damaged.
+ *
+ * @param display
+ *     The display containing the given layer.
+ *
+ * @param layer
+ *     The layer to composite onto its parent.
+ */
+static void guacenc_display_composite_layer(guacenc_display* display,
+        guacenc_layer* layer) {
+
+    /* Ignore layers which are not composited */
+    if (layer->flattened_parent_index == GUACENC_LAYER_NO_PARENT)
+        return;
+
+    guacenc_layer* parent = display->layers[layer->flattened_parent_index];
+    if (parent == NULL)
+        return;
+
+    /* Only the damaged portion of the parent needs to be redrawn */
+    guac_rect region = parent->frame_dirty;
+    guac_rect_constrain(&region, &layer->flattened_rect);
+    if (guac_rect_is_empty(&region))
+        return;
+
+    /* Get source and destination frame buffer */
+    guacenc_buffer* src = layer->frame;
+    guacenc_buffer* dst = parent->frame;
+    cairo_t* cairo = dst->cairo;
+
+    /* Render buffer to layer */
+    cairo_reset_clip(cairo);
+    cairo_rectangle(cairo, region.left, region.top,
+            guac_rect_width(&region), guac_rect_height(&region));
+    cairo_clip(cairo);
+
+    cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+    cairo_set_source_surface(cairo, src->surface,
+            layer->flattened_rect.left, layer->flattened_rect.top);
+    cairo_paint_with_alpha(cairo, layer->flattened_opacity / 255.0);
+
+}
+
+int guacenc_display_flatten(guacenc_display* display) {
+
+    int i;
+
+    /* Sort layers by depth, parent, and Z only if layers have been added,
+     * removed, or moved since the last flatten operation */
+    if (!display->render_order_valid)
+        guacenc_display_sort_layers(display);
+
+    guacenc_layer** render_order = display->render_order;
+    int length = display->render_order_length;
+
+    /* Gather damage from each layer's buffer and from any changes in the way
+     * each layer is composited */
+    for (i = 0; i < length; i++)
+        guacenc_display_update_layer(display, render_order[i]);
+
+    /* Propagate damage from the deepest layers upward, such that each parent
+     * redraws everything covered by damaged children */
+    for (i = 0; i < length; i++) {
+
+        guacenc_layer* layer = render_order[i];
+        if (layer->flattened_parent_index == GUACENC_LAYER_NO_PARENT)
             continue;
 
-        /* Ignore if parent has no pixels */
-        cairo_t* cairo = dst->cairo;
-        if (cairo == NULL)
+        guac_rect dirty = layer->frame_dirty;
+        guac_rect bounds;
+        guac_rect_init(&bounds, 0, 0, layer->frame->width, layer->frame->height);
+        guac_rect_constrain(&dirty, &bounds);
+        if (guac_rect_is_empty(&dirty))
             continue;
 
-        /* Render buffer to layer */
-        cairo_reset_clip(cairo);
-        cairo_rectangle(cairo, layer->x, layer->y, src->width, src->height);
-        cairo_clip(cairo);
+        /* Translate into coordinates of parent */
+        guac_rect_init(&dirty,
+                dirty.left + layer->flattened_rect.left,
+                dirty.top  + layer->flattened_rect.top,
+                guac_rect_width(&dirty), guac_rect_height(&dirty));
 
-        cairo_set_source_surface(cairo, surface, layer->x, layer->y);
-        cairo_paint_with_alpha(cairo, layer->opacity / 255.0);
+        guacenc_layer_mark_frame_dirty(
+                display->layers[layer->flattened_parent_index], &dirty);
 
     }
 
+    /* Retrieve default layer (guaranteed to not be NULL) */
+    guacenc_layer* def_layer = guacenc_display_get_layer(display, 0);
+    assert(def_layer != NULL);
+
+    /* Determine whether the cursor has moved or changed */
+    guac_rect cursor_rect;
+    guacenc_display_get_cursor_rect(display, def_layer, &cursor_rect);
+    guacenc_buffer* cursor_buffer = display->cursor->buffer;
+    bool cursor_changed = !guac_rect_is_empty(&cursor_buffer->dirty)
+        || cursor_rect.left   != display->cursor_rect.left
+        || cursor_rect.top    != display->cursor_rect.top
+        || cursor_rect.right  != display->cursor_rect.right
+        || cursor_rect.bottom != display->cursor_rect.bottom;
+
+    cursor_buffer->dirty = (guac_rect) { 0 };
+
+    /* Determine whether anything visible has changed */
+    guac_rect def_dirty = def_layer->frame_dirty;
+    guac_rect def_bounds;
+    guac_rect_init(&def_bounds, 0, 0, def_layer->frame->width,
+            def_layer->frame->height);
+    guac_rect_constrain(&def_dirty, &def_bounds);
+
+    display->frame_modified = cursor_changed
+        || !guac_rect_is_empty(&def_dirty);
+
+    /* The region previously covered by the mouse cursor must be repaired if
+     * the cursor or anything beneath it may have changed */
+    if (display->frame_modified)
+        guacenc_layer_mark_frame_dirty(def_layer, &display->cursor_rect);
+
+    /* Reset damaged regions of layer frame buffers */
+    for (i = 0; i < length; i++)
+        guacenc_display_reset_frame(render_order[i]);
+
+    /* Render each layer, in order */
+    for (i = 0; i < length; i++)
+        guacenc_display_composite_layer(display, render_order[i]);
+
+    /* All damage has now been repaired */
+    for (i = 0; i < length; i++)
+        render_order[i]->frame_dirty = (guac_rect) { 0 };
+
+    /* Nothing further to do if the cursor is already rendered correctly */
+    if (!display->frame_modified)
+        return 0;
+
     /* Render cursor on top of everything else */
-    return guacenc_display_render_cursor(display);
+    display->cursor_rect = cursor_rect;
+    return guacenc_display_render_cursor(display, def_layer);
 
 }
-
@@ -78,3 +78,38 @@ int guacenc_display_free_image_stream(guacenc_display* display, int index) {
 
 }
 
+int guacenc_display_end_image_stream(guacenc_display* display, int index) {
+
+    /* Retrieve image stream */
+    guacenc_image_stream* stream =
+        guacenc_display_get_image_stream(display, index);
+    if (stream == NULL)
+        return 1;
+
+    /* Retrieve destination buffer */
+    guacenc_buffer* buffer =
+        guacenc_display_get_related_buffer(display, stream->index);
+    if (buffer == NULL)
+        return 1;
+
+    /* Decode and draw immediately if not decoding in the background (or if
+     * there is nothing to decode) */
+    if (display->image_queue == NULL || stream->decoder == NULL)
+        return guacenc_image_stream_end(stream, buffer);
+
+    /* Otherwise, hand the stream to the queue, which frees it once drawn */
+    display->image_streams[index] = NULL;
+    return guacenc_image_queue_submit(display->image_queue, stream, buffer);
+
+}
+
+int guacenc_display_draw_images(guacenc_display* display) {
+
+    /* Nothing to draw if images are not decoded in the background */
+    if (display->image_queue == NULL)
+        return 0;
+
+    return guacenc_image_queue_draw(display->image_queue);
+
+}
+
@@ -51,6 +51,7 @@ guacenc_layer* guacenc_display_get_layer(guacenc_display* display,
 
         /* Store layer within display for future retrieval / management */
         display->layers[index] = layer;
+        display->render_order_valid = false;
 
     }
 
@@ -86,11 +87,24 @@ int guacenc_display_free_layer(guacenc_display* display,
         return 1;
     }
 
-    /* Free layer (if allocated) */
-    guacenc_layer_free(display->layers[index]);
+    /* Nothing to do if layer is not allocated */
+    guacenc_layer* layer = display->layers[index];
+    if (layer == NULL)
+        return 0;
+
+    /* Recomposite whatever the layer previously covered within its parent */
+    int parent_index = layer->flattened_parent_index;
+    if (parent_index != GUACENC_LAYER_NO_PARENT
+            && display->layers[parent_index] != NULL)
+        guacenc_layer_mark_frame_dirty(display->layers[parent_index],
+                &layer->flattened_rect);
+
+    /* Free layer */
+    guacenc_layer_free(layer);
 
     /* Mark layer as freed */
     display->layers[index] = NULL;
+    display->render_order_valid = false;
 
     return 0;
 
@@ -0,0 +1,249 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "buffer.h"
+#include "cursor.h"
+#include "display.h"
+#include "layer.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/layer.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/stream.h>
+#include <guacamole/timestamp.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * The index of the stream used for all images within a snapshot. As each
+ * image is sent in its entirety before the next begins, a single stream
+ * suffices.
+ */
+#define GUACENC_DISPLAY_SNAPSHOT_STREAM 0
+
+/**
+ * Cairo write callback which sends PNG data produced by Cairo as blobs along
+ * the snapshot image stream.
+ *
+ * @param closure
+ *     The guac_socket that the blobs should be written to.
+ *
+ * @param data
+ *     The PNG data to write.
+ *
+ * @param length
+ *     The number of bytes of PNG data to write.
+ *
+ * @return
+ *     CAIRO_STATUS_SUCCESS if the data was written successfully,
+ *     CAIRO_STATUS_WRITE_ERROR otherwise.
+ */
+static cairo_status_t guacenc_display_snapshot_write_png(void* closure,
+        const unsigned char* data, unsigned int length) {
+
+    guac_socket* socket = (guac_socket*) closure;
+    guac_stream stream = { .index = GUACENC_DISPLAY_SNAPSHOT_STREAM };
+
+    if (guac_protocol_send_blobs(socket, &stream, data, length))
+        return CAIRO_STATUS_WRITE_ERROR;
+
+    return CAIRO_STATUS_SUCCESS;
+
+}
+
+/**
+ * Writes instructions which resize the layer or buffer having the given index
+ * to match the given buffer, and which replace its contents with the contents
+ * of that buffer.
+ *
+ * @param socket
+ *     The socket to write instructions to.
+ *
+ * @param index
+ *     The index of the layer or buffer being restored.
+ *
+ * @param buffer
+ *     The buffer whose size and contents should be restored.
+ *
+ * @return
+ *     Zero if the instructions were written successfully, non-zero
+ *     otherwise.
+ */
+static int guacenc_display_snapshot_buffer(guac_socket* socket, int index,
+        guacenc_buffer* buffer) {
+
+    guac_layer layer = { .index = index };
+    guac_stream stream = { .index = GUACENC_DISPLAY_SNAPSHOT_STREAM };
+
+    if (guac_protocol_send_size(socket, &layer, buffer->width, buffer->height))
+        return 1;
+
+    /* Empty buffers have no contents to restore */
+    if (buffer->surface == NULL)
+        return 0;
+
+    cairo_surface_flush(buffer->surface);
+
+    return guac_protocol_send_img(socket, &stream, GUAC_COMP_SRC, &layer,
+                "image/png", 0, 0)
+        || cairo_surface_write_to_png_stream(buffer->surface,
+                guacenc_display_snapshot_write_png, socket) != CAIRO_STATUS_SUCCESS
+        || guac_protocol_send_end(socket, &stream);
+
+}
+
+/**
+ * Writes a "mouse" instruction which restores the position of the mouse
+ * cursor without including a timestamp, as a timestamp would cause the
+ * instruction to be handled as the end of a frame.
+ *
+ * @param socket
+ *     The socket to write the instruction to.
+ *
+ * @param x
+ *     The X coordinate of the mouse cursor.
+ *
+ * @param y
+ *     The Y coordinate of the mouse cursor.
+ *
+ * @return
+ *     Zero if the instruction was written successfully, non-zero otherwise.
+ */
+static int guacenc_display_snapshot_mouse(guac_socket* socket, int x, int y) {
+
+    char x_str[16];
+    char y_str[16];
+
+    snprintf(x_str, sizeof(x_str), "%i", x);
+    snprintf(y_str, sizeof(y_str), "%i", y);
+
+    guac_socket_instruction_begin(socket);
+
+    int retval =
+           guac_socket_write_string(socket, "5.mouse,")
+        || guac_socket_write_int(socket, strlen(x_str))
+        || guac_socket_write_string(socket, ".")
+        || guac_socket_write_string(socket, x_str)
+        || guac_socket_write_string(socket, ",")
+        || guac_socket_write_int(socket, strlen(y_str))
+        || guac_socket_write_string(socket, ".")
+        || guac_socket_write_string(socket, y_str)
+        || guac_socket_write_string(socket, ";");
+
+    guac_socket_instruction_end(socket);
+    return retval;
+
+}
+
+/**
+ * Writes instructions which restore the image, hotspot, and position of the
+ * mouse cursor of the given display. The cursor image is restored via a
+ * temporary buffer, which is disposed once the cursor has been set.
+ *
+ * @param display
+ *     The display whose mouse cursor should be restored.
+ *
+ * @param socket
+ *     The socket to write instructions to.
+ *
+ * @return
+ *     Zero if the instructions were written successfully, non-zero
+ *     otherwise.
+ */
+static int guacenc_display_snapshot_cursor(guacenc_display* display,
+        guac_socket* socket) {
+
+    guacenc_cursor* cursor = display->cursor;
+    guacenc_buffer* buffer = cursor->buffer;
+
+    if (buffer->width > 0 && buffer->height > 0) {
+
+        /* Locate any unused buffer to hold the cursor image */
+        int i;
+        for (i = 0; i < GUACENC_DISPLAY_MAX_BUFFERS; i++) {
+            if (display->buffers[i] == NULL)
+                break;
+        }
+
+        if (i < GUACENC_DISPLAY_MAX_BUFFERS) {
+
+            guac_layer temp = { .index = -1 - i };
+
+            if (guacenc_display_snapshot_buffer(socket, temp.index, buffer)
+                    || guac_protocol_send_cursor(socket, cursor->hotspot_x,
+                        cursor->hotspot_y, &temp, 0, 0, buffer->width,
+                        buffer->height)
+                    || guac_protocol_send_dispose(socket, &temp))
+                return 1;
+
+        }
+
+    }
+
+    return guacenc_display_snapshot_mouse(socket, cursor->x, cursor->y);
+
+}
+
+int guacenc_display_write_snapshot(guacenc_display* display,
+        guac_socket* socket, guac_timestamp timestamp) {
+
+    int i;
+
+    /* Restore all buffers */
+    for (i = 0; i < GUACENC_DISPLAY_MAX_BUFFERS; i++) {
+        guacenc_buffer* buffer = display->buffers[i];
+        if (buffer != NULL
+                && guacenc_display_snapshot_buffer(socket, -1 - i, buffer))
+            return 1;
+    }
+
+    /* Restore the contents of all layers before restoring the layer tree,
+     * such that every parent exists before any layer is moved within it */
+    for (i = 0; i < GUACENC_DISPLAY_MAX_LAYERS; i++) {
+        guacenc_layer* layer = display->layers[i];
+        if (layer != NULL
+                && guacenc_display_snapshot_buffer(socket, i, layer->buffer))
+            return 1;
+    }
+
+    for (i = 1; i < GUACENC_DISPLAY_MAX_LAYERS; i++) {
+
+        guacenc_layer* layer = display->layers[i];
+        if (layer == NULL || layer->parent_index == GUACENC_LAYER_NO_PARENT)
+            continue;
+
+        guac_layer current = { .index = i };
+        guac_layer parent = { .index = layer->parent_index };
+
+        if (guac_protocol_send_move(socket, &current, &parent,
+                    layer->x, layer->y, layer->z)
+                || guac_protocol_send_shade(socket, &current, layer->opacity))
+            return 1;
+
+    }
+
+    if (guacenc_display_snapshot_cursor(display, socket))
+        return 1;
+
+    return guac_protocol_send_sync(socket, timestamp, 1)
+        || guac_socket_flush(socket);
+
+}
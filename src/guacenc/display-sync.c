@@ -26,6 +26,7 @@
 #include <guacamole/timestamp.h>
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 int guacenc_display_sync(guacenc_display* display, guac_timestamp timestamp) {
@@ -38,6 +39,19 @@ int guacenc_display_sync(guacenc_display* display, guac_timestamp timestamp) {
 
     /* Update timestamp of display */
     display->last_sync = timestamp;
+    if (display->first_sync == 0)
+        display->first_sync = timestamp;
+
+    /* Frames are only rendered if written to the video */
+    if (display->output == NULL)
+        return 0;
+
+    /* Skip frames outside the requested range (the changes within those
+     * frames remain pending, and are rendered within the next frame
+     * written) */
+    guac_timestamp position = timestamp - display->first_sync;
+    if (position < display->range_start || guacenc_display_range_ended(display))
+        return 0;
 
     /* Flatten display to default layer */
     if (guacenc_display_flatten(display))
@@ -51,9 +65,18 @@ int guacenc_display_sync(guacenc_display* display, guac_timestamp timestamp) {
     if (guacenc_video_advance_timeline(display->output, timestamp))
         return 1;
 
-    /* Prepare frame for write upon next flush */
-    guacenc_video_prepare_frame(display->output, def_layer->frame);
+    /* Prepare frame for write upon next flush, unless identical to the
+     * frame already prepared (in which case that frame is simply written
+     * again) */
+    if (display->frame_modified)
+        guacenc_video_prepare_frame(display->output, def_layer->frame);
+
     return 0;
 
 }
 
+bool guacenc_display_range_ended(guacenc_display* display) {
+    return display->range_end != 0 && display->last_sync != 0
+        && display->last_sync - display->first_sync > display->range_end;
+}
+
@@ -84,12 +84,16 @@ cairo_operator_t guacenc_display_cairo_operator(guac_composite_mode mask) {
 }
 
 guacenc_display* guacenc_display_alloc(const char* path, const char* codec,
-        int width, int height, int bitrate) {
-
-    /* Prepare video encoding */
-    guacenc_video* video = guacenc_video_alloc(path, codec, width, height, bitrate);
-    if (video == NULL)
-        return NULL;
+        int width, int height, int bitrate, int threads) {
+
+    /* Prepare video encoding, if any */
+    guacenc_video* video = NULL;
+    if (path != NULL) {
+        video = guacenc_video_alloc(path, codec, width, height, bitrate,
+                threads);
+        if (video == NULL)
+            return NULL;
+    }
 
     /* Allocate display */
     guacenc_display* display =
@@ -101,6 +105,10 @@ guacenc_display* guacenc_display_alloc(const char* path, const char* codec,
     /* Allocate special-purpose cursor layer */
     display->cursor = guacenc_cursor_alloc();
 
+    /* Decode images in the background if multiple threads are available */
+    if (threads > 1)
+        display->image_queue = guacenc_image_queue_alloc(threads);
+
     return display;
 
 }
@@ -116,6 +124,10 @@ int guacenc_display_free(guacenc_display* display) {
     /* Finalize video */
     int retval = guacenc_video_free(display->output);
 
+    /* Discard any images not yet drawn (the frames that would have contained
+     * them can no longer be written) */
+    guacenc_image_queue_free(display->image_queue);
+
     /* Free all buffers */
     for (i = 0; i < GUACENC_DISPLAY_MAX_BUFFERS; i++)
         guacenc_buffer_free(display->buffers[i]);
@@ -22,14 +22,19 @@
 
 #include "buffer.h"
 #include "cursor.h"
+#include "image-queue.h"
 #include "image-stream.h"
 #include "layer.h"
 #include "video.h"
 
 #include <cairo/cairo.h>
 #include <guacamole/protocol.h>
+#include <guacamole/rect.h>
+#include <guacamole/socket.h>
 #include <guacamole/timestamp.h>
 
+#include <stdbool.h>
+
 /**
  * The maximum number of buffers that the Guacamole video encoder will handle
  * within a single Guacamole protocol dump.
@@ -82,6 +87,46 @@ typedef struct guacenc_display {
      */
     guacenc_image_stream* image_streams[GUACENC_DISPLAY_MAX_STREAMS];
 
+    /**
+     * The queue of ended image streams whose images are being decoded in the
+     * background, or NULL if images are decoded as each image stream ends.
+     */
+    guacenc_image_queue* image_queue;
+
+    /**
+     * All currently-allocated layers, sorted such that each layer is preceded
+     * by all layers which must be composited onto their parents before it,
+     * as required by guacenc_display_flatten(). This ordering is only
+     * recalculated when render_order_valid is false.
+     */
+    guacenc_layer* render_order[GUACENC_DISPLAY_MAX_LAYERS];
+
+    /**
+     * The number of layers currently stored within render_order.
+     */
+    int render_order_length;
+
+    /**
+     * Whether render_order currently reflects the allocated layers and their
+     * stacking order. This is set to false whenever a layer is allocated,
+     * freed, reparented, or restacked.
+     */
+    bool render_order_valid;
+
+    /**
+     * The region of the frame buffer of the default layer that the mouse
+     * cursor was drawn over when the display was last flattened, or an empty
+     * rectangle if the cursor was not drawn.
+     */
+    guac_rect cursor_rect;
+
+    /**
+     * Whether the frame buffer of the default layer changed in any way
+     * during the most recent flatten operation. If false, the flattened
+     * display is identical to that of the previous flatten operation.
+     */
+    bool frame_modified;
+
     /**
      * The timestamp of the last sync instruction handled, or 0 if no sync has
      * yet been read.
@@ -89,7 +134,29 @@ typedef struct guacenc_display {
     guac_timestamp last_sync;
 
     /**
-     * The video that this display is recording to.
+     * The timestamp of the first frame of the recording, or 0 if no sync has
+     * yet been read and the timestamp of the first frame is not otherwise
+     * known (from the index of the recording).
+     */
+    guac_timestamp first_sync;
+
+    /**
+     * The number of milliseconds after the first frame of the recording at
+     * which frames should begin being written to the video. Frames before
+     * this point update the state of the display but are not encoded.
+     */
+    guac_timestamp range_start;
+
+    /**
+     * The number of milliseconds after the first frame of the recording after
+     * which no further frames should be written to the video, or 0 if all
+     * frames through the end of the recording should be written.
+     */
+    guac_timestamp range_end;
+
+    /**
+     * The video that this display is recording to, or NULL if the display is
+     * only tracking the state of the recording and no video is being written.
      */
     guacenc_video* output;
 
@@ -97,7 +164,9 @@ typedef struct guacenc_display {
 
 /**
  * Handles a received "sync" instruction having the given timestamp, flushing
- * the current display to the in-progress video encoding.
+ * the current display to the in-progress video encoding. Frames outside the
+ * range of the recording being encoded, and all frames of a display that is
+ * not writing video, are not flushed.
  *
  * @param display
  *     The display to flush to the video encoding as a new frame.
@@ -111,12 +180,52 @@ typedef struct guacenc_display {
  */
 int guacenc_display_sync(guacenc_display* display, guac_timestamp timestamp);
 
+/**
+ * Returns whether the most recent frame handled by the given display follows
+ * the end of the range of the recording being encoded, such that no further
+ * frames need be read.
+ *
+ * @param display
+ *     The display to check.
+ *
+ * @return
+ *     true if no further frames will be written to the video, false
+ *     otherwise.
+ */
+bool guacenc_display_range_ended(guacenc_display* display);
+
+/**
+ * Writes Guacamole instructions to the given socket which, when handled by a
+ * newly-allocated display, restore the current state of all layers, buffers,
+ * and the mouse cursor of the given display. The instructions are terminated
+ * by a "sync" instruction having the given timestamp. Any images still being
+ * decoded must be drawn with guacenc_display_draw_images() before invoking
+ * this function.
+ *
+ * @param display
+ *     The display whose state should be written.
+ *
+ * @param socket
+ *     The socket to write instructions to.
+ *
+ * @param timestamp
+ *     The timestamp to include within the terminating "sync" instruction.
+ *
+ * @return
+ *     Zero if the state of the display was written successfully, non-zero
+ *     otherwise.
+ */
+int guacenc_display_write_snapshot(guacenc_display* display,
+        guac_socket* socket, guac_timestamp timestamp);
+
 /**
  * Flattens the given display, rendering all child layers to the frame buffers
  * of their parent layers. The frame buffer of the default layer of the display
  * will thus contain the flattened, composited rendering of the entire display
- * state after this function succeeds. The contents of the frame buffers of
- * each layer are replaced by this function.
+ * state after this function succeeds. Only the regions of each frame buffer
+ * affected by changes since the previous flatten operation are redrawn, and
+ * the frame_modified flag of the display is updated to reflect whether the
+ * flattened result differs from that of the previous flatten operation.
  *
  * @param display
  *     The display to flatten.
@@ -133,7 +242,10 @@ int guacenc_display_flatten(guacenc_display* display);
  * display as instructions are read and handled.
  *
  * @param path
- *     The full path to the file in which encoded video should be written.
+ *     The full path to the file in which encoded video should be written, or
+ *     NULL if the display should only track the state of the recording
+ *     without writing video (in which case the codec, width, height, and
+ *     bitrate are ignored).
  *
  * @param codec
  *     The name of the codec to use for the video encoding, as defined by
@@ -149,12 +261,17 @@ int guacenc_display_flatten(guacenc_display* display);
  *     The desired overall bitrate of the resulting encoded video, in bits per
  *     second.
  *
+ * @param threads
+ *     The number of threads that may be used to decode images and encode
+ *     video in parallel with the handling of instructions. If this is 1,
+ *     images are decoded as each image stream ends.
+ *
  * @return
  *     The newly-allocated Guacamole video encoder display, or NULL if the
  *     display could not be allocated.
  */
 guacenc_display* guacenc_display_alloc(const char* path, const char* codec,
-        int width, int height, int bitrate);
+        int width, int height, int bitrate, int threads);
 
 /**
  * Frees all memory associated with the given Guacamole video encoder display,
@@ -351,6 +468,40 @@ guacenc_image_stream* guacenc_display_get_image_stream(
  */
 int guacenc_display_free_image_stream(guacenc_display* display, int index);
 
+/**
+ * Ends the image stream having the given index, drawing its image to the
+ * related layer or buffer. If the display decodes images in the background,
+ * the image stream is instead removed from the display and queued, and its
+ * image will be drawn by the next call to guacenc_display_draw_images().
+ *
+ * @param display
+ *     The Guacamole video encoder display associated with the image stream
+ *     that has ended.
+ *
+ * @param index
+ *     The index of the image stream that has ended.
+ *
+ * @return
+ *     Zero if the image stream was successfully ended, non-zero otherwise.
+ */
+int guacenc_display_end_image_stream(guacenc_display* display, int index);
+
+/**
+ * Draws any images which have been decoded in the background but not yet
+ * drawn to their destination layers or buffers, waiting for decoding to
+ * complete as necessary. This must be invoked prior to handling any
+ * instruction that may depend on the contents of layers or buffers.
+ *
+ * @param display
+ *     The Guacamole video encoder display whose queued images should be
+ *     drawn.
+ *
+ * @return
+ *     Zero if all images were decoded and drawn successfully, non-zero
+ *     otherwise.
+ */
+int guacenc_display_draw_images(guacenc_display* display);
+
 /**
  * Translates the given Guacamole protocol compositing mode (channel mask) to
  * the corresponding Cairo composition operator. If no such operator exists,
@@ -18,25 +18,33 @@
  */
 
 #include "display.h"
+#include "encode.h"
+#include "index.h"
 #include "instructions.h"
 #include "log.h"
 
 #include <guacamole/client.h>
 #include <guacamole/error.h>
+#include <guacamole/opcode-types.h>
 #include <guacamole/parser.h>
+#include <guacamole/recording.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 /**
  * Reads and handles all Guacamole instructions from the given guac_socket
- * until end-of-stream is reached.
+ * until end-of-stream is reached, or until the end of the range of the
+ * recording being encoded has been passed.
  *
  * @param display
  *     The current internal display of the Guacamole video encoder.
@@ -62,11 +70,19 @@ static int guacenc_read_instructions(guacenc_display* display,
 
     /* Continuously read and handle all instructions */
     while (!guac_parser_read(parser, socket, -1)) {
-        if (guacenc_handle_instruction(display, parser->opcode,
+
+        if (guacenc_handle_instruction(display, parser->opcode_id,
                 parser->argc, parser->argv)) {
             guacenc_log(GUAC_LOG_DEBUG, "Handling of \"%s\" instruction "
                     "failed.", parser->opcode);
         }
+
+        /* Stop once the requested portion of the recording has been read */
+        if (guacenc_display_range_ended(display)) {
+            guac_parser_free(parser);
+            return 0;
+        }
+
     }
 
     /* Fail on read/parse error */
@@ -83,14 +99,206 @@ static int guacenc_read_instructions(guacenc_display* display,
 
 }
 
-int guacenc_encode(const char* path, const char* out_path, const char* codec,
-        int width, int height, int bitrate, bool force) {
+/**
+ * Restores the display state described by the given keyframe, reading the
+ * instructions of that keyframe from the keyframes file of the recording at
+ * the given path.
+ *
+ * @param display
+ *     The current internal display of the Guacamole video encoder.
+ *
+ * @param path
+ *     The path to the recording containing the keyframe.
+ *
+ * @param keyframe
+ *     The keyframe to restore.
+ *
+ * @return
+ *     Zero if the keyframe was restored successfully, non-zero otherwise.
+ */
+static int guacenc_restore_keyframe(guacenc_display* display,
+        const char* path, const guacenc_index_keyframe* keyframe) {
+
+    char keyframes_path[4096];
+    int len = snprintf(keyframes_path, sizeof(keyframes_path), "%s%s", path,
+            GUACENC_INDEX_KEYFRAMES_SUFFIX);
+    if (len >= sizeof(keyframes_path))
+        return 1;
+
+    int fd = open(keyframes_path, O_RDONLY);
+    if (fd < 0) {
+        guacenc_log(GUAC_LOG_WARNING, "%s: %s", keyframes_path,
+                strerror(errno));
+        return 1;
+    }
+
+    if (lseek(fd, keyframe->keyframe_offset, SEEK_SET) == -1) {
+        guacenc_log(GUAC_LOG_WARNING, "%s: %s", keyframes_path,
+                strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    guac_socket* socket = guac_socket_open(fd);
+    guac_parser* parser = guac_parser_alloc();
+
+    /* Handle all instructions up to the "sync" which ends the keyframe */
+    int retval = 1;
+    while (!guac_parser_read(parser, socket, -1)) {
+
+        if (parser->opcode_id == GUAC_OPCODE_SYNC) {
+            retval = 0;
+            break;
+        }
+
+        if (guacenc_handle_instruction(display, parser->opcode_id,
+                parser->argc, parser->argv)) {
+            guacenc_log(GUAC_LOG_DEBUG, "Handling of \"%s\" instruction "
+                    "within keyframe failed.", parser->opcode);
+        }
+
+    }
+
+    if (retval)
+        guacenc_log(GUAC_LOG_WARNING, "%s: Keyframe is truncated.",
+                keyframes_path);
+
+    guacenc_display_draw_images(display);
+
+    guac_parser_free(parser);
+    guac_socket_free(socket);
+    return retval;
+
+}
+
+/**
+ * Reads and discards the given number of bytes from the given socket.
+ *
+ * @param socket
+ *     The socket to read from.
+ *
+ * @param length
+ *     The number of bytes to discard.
+ *
+ * @return
+ *     Zero if the requested number of bytes were discarded, non-zero if the
+ *     end of the socket was reached first or an error occurred.
+ */
+static int guacenc_skip(guac_socket* socket, off_t length) {
+
+    char buffer[GUACENC_SKIP_BUFFER_SIZE];
+
+    while (length > 0) {
+
+        size_t count = sizeof(buffer);
+        if (count > length)
+            count = length;
+
+        ssize_t result = guac_socket_read(socket, buffer, count);
+        if (result <= 0)
+            return 1;
+
+        length -= result;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Prepares the given display and the socket of the recording being encoded
+ * such that encoding begins at the start of the given display's range. If
+ * the recording has an index, the timestamp of the first frame of the
+ * recording is taken from the index and, if a suitable keyframe exists,
+ * that keyframe is restored and the recording repositioned to the frame
+ * following that keyframe. Otherwise, the recording is left at its
+ * beginning.
+ *
+ * Index offsets always refer to the uncompressed recording. Uncompressed
+ * recordings are repositioned by seeking the underlying file descriptor
+ * directly, while compressed recordings must be decompressed and discarded
+ * up to the offset of the keyframe.
+ *
+ * @param display
+ *     The current internal display of the Guacamole video encoder.
+ *
+ * @param path
+ *     The path to the recording being encoded.
+ *
+ * @param fd
+ *     The file descriptor of the open recording.
+ *
+ * @param socket
+ *     The guac_socket reading from the given file descriptor, which must not
+ *     yet have been read.
+ *
+ * @param compressed
+ *     Non-zero if the recording is compressed, zero otherwise.
+ *
+ * @return
+ *     Zero if the display and recording are ready for encoding to proceed,
+ *     non-zero if seeking failed after the display was modified.
+ */
+static int guacenc_seek(guacenc_display* display, const char* path, int fd,
+        guac_socket* socket, int compressed) {
+
+    /* Nothing to skip if encoding from the beginning */
+    if (display->range_start == 0)
+        return 0;
+
+    guacenc_index* index = guacenc_index_load(path);
+    if (index == NULL) {
+        guacenc_log(GUAC_LOG_INFO, "%s: Recording has no index. The "
+                "recording will be read from the beginning.", path);
+        return 0;
+    }
+
+    display->first_sync = index->first_sync;
+
+    const guacenc_index_keyframe* keyframe = guacenc_index_find_keyframe(
+            index, display->first_sync + display->range_start);
+
+    if (keyframe == NULL) {
+        guacenc_index_free(index);
+        return 0;
+    }
+
+    guacenc_log(GUAC_LOG_INFO, "%s: Seeking to keyframe at %" PRId64 " ms.",
+            path, (int64_t) (keyframe->timestamp - display->first_sync));
+
+    int retval = guacenc_restore_keyframe(display, path, keyframe);
+    if (!retval) {
+
+        if (compressed) {
+            if (guacenc_skip(socket, keyframe->offset)) {
+                guacenc_log(GUAC_LOG_ERROR, "%s: Recording ends before "
+                        "indexed keyframe.", path);
+                retval = 1;
+            }
+        }
+
+        else if (lseek(fd, keyframe->offset, SEEK_SET) == -1) {
+            guacenc_log(GUAC_LOG_ERROR, "%s: %s", path, strerror(errno));
+            retval = 1;
+        }
+
+        display->last_sync = keyframe->timestamp;
+
+    }
+
+    guacenc_index_free(index);
+    return retval;
+
+}
+
+int guacenc_open_recording(const char* path, bool force) {
 
     /* Open input file */
     int fd = open(path, O_RDONLY);
     if (fd < 0) {
         guacenc_log(GUAC_LOG_ERROR, "%s: %s", path, strerror(errno));
-        return 1;
+        return -1;
     }
 
     /* Lock entire input file for reading by the current process */
@@ -117,23 +325,45 @@ int guacenc_encode(const char* path, const char* out_path, const char* codec,
                     path, strerror(errno));
 
         close(fd);
-        return 1;
+        return -1;
     }
 
+    return fd;
+
+}
+
+int guacenc_encode(const char* path, const char* out_path, const char* codec,
+        int width, int height, int bitrate, bool force, int threads,
+        guac_timestamp start, guac_timestamp end) {
+
+    /* Open and lock input file */
+    int fd = guacenc_open_recording(path, force);
+    if (fd < 0)
+        return 1;
+
     /* Allocate display for encoding process */
     guacenc_display* display = guacenc_display_alloc(out_path, codec,
-            width, height, bitrate);
+            width, height, bitrate, threads);
     if (display == NULL) {
         close(fd);
         return 1;
     }
 
-    /* Obtain guac_socket wrapping file descriptor */
-    guac_socket* socket = guac_socket_open(fd);
+    /* Obtain guac_socket reading the recording, decompressing if needed */
+    int compressed = guac_recording_is_compressed(fd);
+    guac_socket* socket = guac_recording_open_read(fd);
     if (socket == NULL) {
         guacenc_log(GUAC_LOG_ERROR, "%s: %s", path,
                 guac_status_string(guac_error));
-        close(fd);
+        guacenc_display_free(display);
+        return 1;
+    }
+
+    /* Skip directly to the requested portion of the recording, if possible */
+    display->range_start = start;
+    display->range_end = end;
+    if (guacenc_seek(display, path, fd, socket, compressed)) {
+        guac_socket_free(socket);
         guacenc_display_free(display);
         return 1;
     }
@@ -152,4 +382,3 @@ int guacenc_encode(const char* path, const char* out_path, const char* codec,
     return guacenc_display_free(display);
 
 }
-
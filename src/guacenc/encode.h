@@ -20,8 +20,35 @@
 #ifndef GUACENC_ENCODE_H
 #define GUACENC_ENCODE_H
 
+#include <guacamole/timestamp.h>
+
 #include <stdbool.h>
 
+/**
+ * The size of the buffer used to read and discard the decompressed contents
+ * of a compressed recording when seeking, in bytes.
+ */
+#define GUACENC_SKIP_BUFFER_SIZE 65536
+
+/**
+ * Opens the Guacamole protocol dump at the given path for reading. A read
+ * lock will be acquired on the file to ensure that in-progress recordings are
+ * not read. This behavior can be overridden by specifying true for the force
+ * parameter. Errors are logged automatically.
+ *
+ * @param path
+ *     The path to the file containing the raw Guacamole protocol dump.
+ *
+ * @param force
+ *     Open the file, even if it appears to be an in-progress recording (has
+ *     an associated lock).
+ *
+ * @return
+ *     The file descriptor of the opened file, or -1 if the file could not be
+ *     opened or locked.
+ */
+int guacenc_open_recording(const char* path, bool force);
+
 /**
  * Encodes the given Guacamole protocol dump as video. A read lock will be
  * acquired on the input file to ensure that in-progress recordings are not
@@ -52,12 +79,26 @@
  *     Perform the encoding, even if the input file appears to be an
  *     in-progress recording (has an associated lock).
  *
+ * @param threads
+ *     The number of threads that may be used to decode images and encode
+ *     video in parallel with the handling of instructions.
+ *
+ * @param start
+ *     The number of milliseconds from the beginning of the recording at which
+ *     the encoded video should begin.
+ *
+ * @param end
+ *     The number of milliseconds from the beginning of the recording at which
+ *     the encoded video should end, or zero if the video should continue
+ *     through the end of the recording.
+ *
  * @return
  *     Zero on success, non-zero if an error prevented successful encoding of
  *     the video.
  */
 int guacenc_encode(const char* path, const char* out_path, const char* codec,
-        int width, int height, int bitrate, bool force);
+        int width, int height, int bitrate, bool force, int threads,
+        guac_timestamp start, guac_timestamp end);
 
 #endif
 
@@ -19,15 +19,181 @@
 
 #include "encode.h"
 #include "guacenc.h"
+#include "index.h"
 #include "log.h"
 #include "parse.h"
 
+#include <guacamole/mem.h>
+#include <guacamole/timestamp.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <unistd.h>
+
+/**
+ * The set of recordings being encoded by one or more concurrent jobs, along
+ * with the options that apply to all recordings.
+ */
+typedef struct guacenc_batch {
+
+    /**
+     * Lock which guards access to next_path and failures.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * The paths of all recordings to encode.
+     */
+    char** paths;
+
+    /**
+     * The number of paths within the paths array.
+     */
+    int path_count;
+
+    /**
+     * The index of the next path within the paths array that has not yet
+     * been claimed by any job.
+     */
+    int next_path;
+
+    /**
+     * The number of recordings which could not be encoded.
+     */
+    int failures;
+
+    /**
+     * The width of the output videos, in pixels.
+     */
+    int width;
+
+    /**
+     * The height of the output videos, in pixels.
+     */
+    int height;
+
+    /**
+     * The desired bitrate of the output videos, in bits per second.
+     */
+    int bitrate;
+
+    /**
+     * Whether recordings should be encoded even if they appear to be
+     * in-progress.
+     */
+    bool force;
+
+    /**
+     * The number of threads that each job may use to decode images and
+     * encode video.
+     */
+    int threads;
+
+    /**
+     * Whether each recording should be indexed (see guacenc_index_build())
+     * rather than encoded.
+     */
+    bool index;
+
+    /**
+     * The number of milliseconds from the beginning of each recording at
+     * which the encoded video should begin.
+     */
+    guac_timestamp start;
+
+    /**
+     * The number of milliseconds from the beginning of each recording at
+     * which the encoded video should end, or zero if the video should
+     * continue through the end of the recording.
+     */
+    guac_timestamp end;
+
+} guacenc_batch;
+
+/**
+ * Encodes recordings from the given batch until all recordings have been
+ * claimed by this or any other concurrent job.
+ *
+ * @param data
+ *     The guacenc_batch containing the recordings to encode.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guacenc_batch_job(void* data) {
+
+    guacenc_batch* batch = (guacenc_batch*) data;
+
+    for (;;) {
+
+        /* Claim next recording, if any */
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next_path;
+        if (index < batch->path_count)
+            batch->next_path++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (index >= batch->path_count)
+            break;
+
+        /* Get current filename */
+        const char* path = batch->paths[index];
+
+        /* Index recording instead of encoding, if requested */
+        if (batch->index) {
+
+            if (guacenc_index_build(path, batch->force, batch->threads)) {
+
+                pthread_mutex_lock(&batch->lock);
+                batch->failures++;
+                pthread_mutex_unlock(&batch->lock);
+
+                guacenc_log(GUAC_LOG_DEBUG,
+                        "%s was NOT successfully indexed.", path);
+            }
+            else
+                guacenc_log(GUAC_LOG_DEBUG, "%s was successfully indexed.",
+                        path);
+
+            continue;
+
+        }
+
+        /* Generate output filename */
+        char out_path[4096];
+        int len = snprintf(out_path, sizeof(out_path), "%s.m4v", path);
+
+        /* Do not write if filename exceeds maximum length */
+        if (len >= sizeof(out_path)) {
+            guacenc_log(GUAC_LOG_ERROR, "Cannot write output file for \"%s\": "
+                    "Name too long", path);
+            continue;
+        }
+
+        /* Attempt encoding, log granular success/failure at debug level */
+        if (guacenc_encode(path, out_path, "mpeg4", batch->width,
+                    batch->height, batch->bitrate, batch->force,
+                    batch->threads, batch->start, batch->end)) {
+
+            pthread_mutex_lock(&batch->lock);
+            batch->failures++;
+            pthread_mutex_unlock(&batch->lock);
+
+            guacenc_log(GUAC_LOG_DEBUG,
+                    "%s was NOT successfully encoded.", path);
+        }
+        else
+            guacenc_log(GUAC_LOG_DEBUG, "%s was successfully encoded.", path);
+
+    }
+
+    return NULL;
+
+}
 
 int main(int argc, char* argv[]) {
 
@@ -38,10 +204,14 @@ int main(int argc, char* argv[]) {
     int width = GUACENC_DEFAULT_WIDTH;
     int height = GUACENC_DEFAULT_HEIGHT;
     int bitrate = GUACENC_DEFAULT_BITRATE;
+    int jobs = GUACENC_DEFAULT_JOBS;
+    bool index = false;
+    int start = 0;
+    int end = 0;
 
     /* Parse arguments */
     int opt;
-    while ((opt = getopt(argc, argv, "s:r:f")) != -1) {
+    while ((opt = getopt(argc, argv, "s:r:fj:ib:e:")) != -1) {
 
         /* -s: Dimensions (WIDTHxHEIGHT) */
         if (opt == 's') {
@@ -63,6 +233,34 @@ int main(int argc, char* argv[]) {
         else if (opt == 'f')
             force = true;
 
+        /* -j: Number of recordings to encode concurrently */
+        else if (opt == 'j') {
+            if (guacenc_parse_int(optarg, &jobs) || jobs <= 0) {
+                guacenc_log(GUAC_LOG_ERROR, "Invalid number of jobs.");
+                goto invalid_options;
+            }
+        }
+
+        /* -i: Index recordings rather than encoding */
+        else if (opt == 'i')
+            index = true;
+
+        /* -b: Beginning of encoded portion (seconds) */
+        else if (opt == 'b') {
+            if (guacenc_parse_int(optarg, &start)) {
+                guacenc_log(GUAC_LOG_ERROR, "Invalid start time.");
+                goto invalid_options;
+            }
+        }
+
+        /* -e: End of encoded portion (seconds) */
+        else if (opt == 'e') {
+            if (guacenc_parse_int(optarg, &end)) {
+                guacenc_log(GUAC_LOG_ERROR, "Invalid end time.");
+                goto invalid_options;
+            }
+        }
+
         /* Invalid option */
         else {
             goto invalid_options;
@@ -70,6 +268,12 @@ int main(int argc, char* argv[]) {
 
     }
 
+    /* The encoded portion of each recording must not be empty */
+    if (end != 0 && end <= start) {
+        guacenc_log(GUAC_LOG_ERROR, "End time must follow start time.");
+        goto invalid_options;
+    }
+
     /* Log start */
     guacenc_log(GUAC_LOG_INFO, "Guacamole video encoder (guacenc) "
             "version " VERSION);
@@ -83,9 +287,7 @@ int main(int argc, char* argv[]) {
     av_register_all();
 #endif
 
-    /* Track number of overall failures */
     int total_files = argc - optind;
-    int failures = 0;
 
     /* Abort if no files given */
     if (total_files <= 0) {
@@ -95,37 +297,60 @@ int main(int argc, char* argv[]) {
 
     guacenc_log(GUAC_LOG_INFO, "%i input file(s) provided.", total_files);
 
-    guacenc_log(GUAC_LOG_INFO, "Video will be encoded at %ix%i "
-            "and %i bps.", width, height, bitrate);
-
-    /* Encode all input files */
-    for (i = optind; i < argc; i++) {
-
-        /* Get current filename */
-        const char* path = argv[i];
+    if (index)
+        guacenc_log(GUAC_LOG_INFO, "Recordings will be indexed, not "
+                "encoded.");
+    else
+        guacenc_log(GUAC_LOG_INFO, "Video will be encoded at %ix%i "
+                "and %i bps.", width, height, bitrate);
+
+    /* There is no benefit to more jobs than files */
+    if (jobs > total_files)
+        jobs = total_files;
+
+    /* Divide available processors between all concurrent jobs */
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = (processors > jobs) ? processors / jobs : 1;
+
+    guacenc_batch batch = {
+        .paths = argv + optind,
+        .path_count = total_files,
+        .width = width,
+        .height = height,
+        .bitrate = bitrate,
+        .force = force,
+        .threads = threads,
+        .index = index,
+        .start = (guac_timestamp) start * 1000,
+        .end = (guac_timestamp) end * 1000
+    };
+
+    pthread_mutex_init(&batch.lock, NULL);
+
+    /* Encode all input files, running additional jobs in their own threads
+     * if requested */
+    pthread_t* job_threads = guac_mem_alloc(sizeof(pthread_t), jobs);
+    int job_thread_count = 0;
+    for (i = 1; i < jobs; i++) {
+        if (pthread_create(&job_threads[job_thread_count], NULL,
+                    guacenc_batch_job, &batch)) {
+            guacenc_log(GUAC_LOG_WARNING, "Unable to start all requested "
+                    "jobs. Fewer recordings will be encoded concurrently.");
+            break;
+        }
+        job_thread_count++;
+    }
 
-        /* Generate output filename */
-        char out_path[4096];
-        int len = snprintf(out_path, sizeof(out_path), "%s.m4v", path);
+    guacenc_batch_job(&batch);
 
-        /* Do not write if filename exceeds maximum length */
-        if (len >= sizeof(out_path)) {
-            guacenc_log(GUAC_LOG_ERROR, "Cannot write output file for \"%s\": "
-                    "Name too long", path);
-            continue;
-        }
+    for (i = 0; i < job_thread_count; i++)
+        pthread_join(job_threads[i], NULL);
 
-        /* Attempt encoding, log granular success/failure at debug level */
-        if (guacenc_encode(path, out_path, "mpeg4",
-                    width, height, bitrate, force)) {
-            failures++;
-            guacenc_log(GUAC_LOG_DEBUG,
-                    "%s was NOT successfully encoded.", path);
-        }
-        else
-            guacenc_log(GUAC_LOG_DEBUG, "%s was successfully encoded.", path);
+    guac_mem_free(job_threads);
+    pthread_mutex_destroy(&batch.lock);
 
-    }
+    /* Track number of overall failures */
+    int failures = batch.failures;
 
     /* Warn if at least one file failed */
     if (failures != 0)
@@ -146,6 +371,10 @@ invalid_options:
             " [-s WIDTHxHEIGHT]"
             " [-r BITRATE]"
             " [-f]"
+            " [-j JOBS]"
+            " [-b START]"
+            " [-e END]"
+            " [-i]"
             " [FILE]...\n", argv[0]);
 
     return 1;
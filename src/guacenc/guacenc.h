@@ -42,6 +42,12 @@
  */
 #define GUACENC_DEFAULT_BITRATE 2000000
 
+/**
+ * The number of recordings to encode concurrently, if no other number is
+ * given on the command line.
+ */
+#define GUACENC_DEFAULT_JOBS 1
+
 /**
  * The default log level below which no messages should be logged.
  */
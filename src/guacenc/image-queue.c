@@ -0,0 +1,207 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "image-queue.h"
+#include "image-stream.h"
+#include "log.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/client.h>
+#include <guacamole/mem.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * Decodes queued images until the given queue is freed. Each image is
+ * decoded by exactly one thread.
+ *
+ * @param data
+ *     The guacenc_image_queue whose images should be decoded.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guacenc_image_queue_decode_thread(void* data) {
+
+    guacenc_image_queue* queue = (guacenc_image_queue*) data;
+
+    pthread_mutex_lock(&queue->lock);
+
+    for (;;) {
+
+        /* Wait for an image that has not yet been claimed by any thread */
+        while (queue->claimed == queue->submitted && !queue->stopping)
+            pthread_cond_wait(&queue->modified, &queue->lock);
+
+        if (queue->stopping)
+            break;
+
+        guacenc_image_queue_entry* entry =
+            &queue->entries[queue->claimed++ % GUACENC_IMAGE_QUEUE_SIZE];
+
+        /* Decode without holding the lock, as the claimed entry is not
+         * otherwise accessed until marked as decoded */
+        pthread_mutex_unlock(&queue->lock);
+        cairo_surface_t* surface = guacenc_image_stream_decode(entry->stream);
+        pthread_mutex_lock(&queue->lock);
+
+        entry->surface = surface;
+        entry->decoded = true;
+        pthread_cond_broadcast(&queue->modified);
+
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+
+}
+
+guacenc_image_queue* guacenc_image_queue_alloc(int thread_count) {
+
+    if (thread_count > GUACENC_IMAGE_QUEUE_MAX_THREADS)
+        thread_count = GUACENC_IMAGE_QUEUE_MAX_THREADS;
+
+    guacenc_image_queue* queue = guac_mem_zalloc(sizeof(guacenc_image_queue));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->modified, NULL);
+
+    /* Start all decoding threads */
+    for (int i = 0; i < thread_count; i++) {
+
+        if (pthread_create(&queue->threads[i], NULL,
+                    guacenc_image_queue_decode_thread, queue)) {
+            guacenc_log(GUAC_LOG_WARNING, "Unable to start image decoding "
+                    "thread. Images will be decoded serially.");
+            guacenc_image_queue_free(queue);
+            return NULL;
+        }
+
+        queue->thread_count++;
+
+    }
+
+    return queue;
+
+}
+
+int guacenc_image_queue_submit(guacenc_image_queue* queue,
+        guacenc_image_stream* stream, guacenc_buffer* buffer) {
+
+    int retval = 0;
+
+    /* Make room for the new entry if necessary. Only the thread submitting
+     * images removes entries, so the queue cannot fill again before the new
+     * entry is added. */
+    pthread_mutex_lock(&queue->lock);
+    bool full = (queue->submitted - queue->drawn == GUACENC_IMAGE_QUEUE_SIZE);
+    pthread_mutex_unlock(&queue->lock);
+
+    if (full)
+        retval = guacenc_image_queue_draw(queue);
+
+    pthread_mutex_lock(&queue->lock);
+
+    guacenc_image_queue_entry* entry =
+        &queue->entries[queue->submitted++ % GUACENC_IMAGE_QUEUE_SIZE];
+
+    entry->stream = stream;
+    entry->buffer = buffer;
+    entry->surface = NULL;
+    entry->decoded = false;
+
+    pthread_cond_signal(&queue->modified);
+    pthread_mutex_unlock(&queue->lock);
+
+    return retval;
+
+}
+
+int guacenc_image_queue_draw(guacenc_image_queue* queue) {
+
+    int retval = 0;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->drawn != queue->submitted) {
+
+        guacenc_image_queue_entry* entry =
+            &queue->entries[queue->drawn % GUACENC_IMAGE_QUEUE_SIZE];
+
+        /* Images must be drawn in order, regardless of the order in which
+         * they finish decoding */
+        while (!entry->decoded)
+            pthread_cond_wait(&queue->modified, &queue->lock);
+
+        /* Draw without holding the lock, as the decoded entry is no longer
+         * accessed by any decoding thread */
+        pthread_mutex_unlock(&queue->lock);
+
+        if (entry->surface != NULL)
+            guacenc_image_stream_draw(entry->stream, entry->buffer,
+                    entry->surface);
+        else
+            retval = 1;
+
+        guacenc_image_stream_free(entry->stream);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->drawn++;
+
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return retval;
+
+}
+
+void guacenc_image_queue_free(guacenc_image_queue* queue) {
+
+    /* Ignore NULL queue */
+    if (queue == NULL)
+        return;
+
+    /* Stop and wait for all decoding threads */
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    pthread_cond_broadcast(&queue->modified);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (int i = 0; i < queue->thread_count; i++)
+        pthread_join(queue->threads[i], NULL);
+
+    /* Discard any images which were never drawn */
+    for (; queue->drawn != queue->submitted; queue->drawn++) {
+
+        guacenc_image_queue_entry* entry =
+            &queue->entries[queue->drawn % GUACENC_IMAGE_QUEUE_SIZE];
+
+        if (entry->surface != NULL)
+            cairo_surface_destroy(entry->surface);
+
+        guacenc_image_stream_free(entry->stream);
+
+    }
+
+    pthread_cond_destroy(&queue->modified);
+    pthread_mutex_destroy(&queue->lock);
+    guac_mem_free(queue);
+
+}
+
@@ -0,0 +1,197 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUACENC_IMAGE_QUEUE_H
+#define GUACENC_IMAGE_QUEUE_H
+
+#include "buffer.h"
+#include "image-stream.h"
+
+#include <cairo/cairo.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * The maximum number of ended image streams that may be awaiting decoding or
+ * drawing at any one time. If the queue is full when another image stream
+ * ends, all queued images are drawn before the new image stream is queued.
+ */
+#define GUACENC_IMAGE_QUEUE_SIZE 64
+
+/**
+ * The maximum number of threads that a guacenc_image_queue will use to decode
+ * images.
+ */
+#define GUACENC_IMAGE_QUEUE_MAX_THREADS 16
+
+/**
+ * An image stream which has ended and which is awaiting decoding and/or
+ * drawing.
+ */
+typedef struct guacenc_image_queue_entry {
+
+    /**
+     * The image stream that has ended. The queue takes ownership of this
+     * stream, freeing it once its image has been drawn.
+     */
+    guacenc_image_stream* stream;
+
+    /**
+     * The buffer that the decoded image should be drawn to.
+     */
+    guacenc_buffer* buffer;
+
+    /**
+     * The decoded image, or NULL if decoding failed or has not yet completed.
+     */
+    cairo_surface_t* surface;
+
+    /**
+     * Whether decoding of this entry's image stream has completed.
+     */
+    bool decoded;
+
+} guacenc_image_queue_entry;
+
+/**
+ * A queue of ended image streams whose images are decoded in parallel by a
+ * pool of threads, while still being drawn strictly in the order that the
+ * image streams ended. Only the thread handling instructions may add entries
+ * to the queue or draw the decoded images.
+ */
+typedef struct guacenc_image_queue {
+
+    /**
+     * Lock which guards access to all members of this structure other than
+     * the threads array.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled whenever an entry is added to the queue,
+     * an entry finishes decoding, or the queue is being freed.
+     */
+    pthread_cond_t modified;
+
+    /**
+     * The threads which decode queued images.
+     */
+    pthread_t threads[GUACENC_IMAGE_QUEUE_MAX_THREADS];
+
+    /**
+     * The number of threads within the threads array.
+     */
+    int thread_count;
+
+    /**
+     * Circular buffer of all queued entries. The entry having sequence number
+     * N is stored at index N % GUACENC_IMAGE_QUEUE_SIZE.
+     */
+    guacenc_image_queue_entry entries[GUACENC_IMAGE_QUEUE_SIZE];
+
+    /**
+     * The sequence number of the next entry to be drawn. All entries prior
+     * to this entry have been drawn and removed from the queue.
+     */
+    unsigned int drawn;
+
+    /**
+     * The sequence number of the next entry to be decoded by a decoding
+     * thread.
+     */
+    unsigned int claimed;
+
+    /**
+     * The sequence number that will be assigned to the next entry added to
+     * the queue.
+     */
+    unsigned int submitted;
+
+    /**
+     * Whether the queue is being freed, and all decoding threads should stop.
+     */
+    bool stopping;
+
+} guacenc_image_queue;
+
+/**
+ * Allocates a new image queue which decodes images using the given number of
+ * threads.
+ *
+ * @param thread_count
+ *     The number of threads that should decode images. If this exceeds
+ *     GUACENC_IMAGE_QUEUE_MAX_THREADS, only GUACENC_IMAGE_QUEUE_MAX_THREADS
+ *     threads will be used.
+ *
+ * @return
+ *     A newly-allocated image queue, or NULL if the queue or its threads
+ *     could not be created.
+ */
+guacenc_image_queue* guacenc_image_queue_alloc(int thread_count);
+
+/**
+ * Adds the given ended image stream to the given queue, such that its image
+ * will be decoded in the background and later drawn to the given buffer by
+ * guacenc_image_queue_draw(). The queue takes ownership of the image stream,
+ * which must have a decoder. If the queue is full, all queued images are first
+ * drawn.
+ *
+ * @param queue
+ *     The queue to add the image stream to.
+ *
+ * @param stream
+ *     The image stream that has ended.
+ *
+ * @param buffer
+ *     The buffer that the decoded image should be drawn to.
+ *
+ * @return
+ *     Zero if all images drawn to make room for the image stream were
+ *     decoded successfully, non-zero otherwise.
+ */
+int guacenc_image_queue_submit(guacenc_image_queue* queue,
+        guacenc_image_stream* stream, guacenc_buffer* buffer);
+
+/**
+ * Draws all images within the given queue, in the order that they were added,
+ * waiting for each image to finish decoding as necessary. The image streams
+ * of all drawn images are freed. This function must be invoked before
+ * handling any instruction that may read from or write to the buffers that
+ * queued images will be drawn to.
+ *
+ * @param queue
+ *     The queue whose images should be drawn.
+ *
+ * @return
+ *     Zero if all images were decoded successfully, non-zero otherwise.
+ */
+int guacenc_image_queue_draw(guacenc_image_queue* queue);
+
+/**
+ * Stops all threads of the given image queue and frees the queue, discarding
+ * any images which have not yet been drawn.
+ *
+ * @param queue
+ *     The queue to free. If NULL, this function has no effect.
+ */
+void guacenc_image_queue_free(guacenc_image_queue* queue);
+
+#endif
+
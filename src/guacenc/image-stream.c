@@ -118,18 +118,15 @@ int guacenc_image_stream_receive(guacenc_image_stream* stream,
 
 }
 
-int guacenc_image_stream_end(guacenc_image_stream* stream,
-        guacenc_buffer* buffer) {
-
-    /* If there is no decoder, simply return success */
-    guacenc_decoder* decoder = stream->decoder;
-    if (decoder == NULL)
-        return 0;
+cairo_surface_t* guacenc_image_stream_decode(guacenc_image_stream* stream) {
 
     /* Decode received data to a Cairo surface */
-    cairo_surface_t* surface = stream->decoder(stream->buffer, stream->length);
-    if (surface == NULL)
-        return 1;
+    return stream->decoder(stream->buffer, stream->length);
+
+}
+
+void guacenc_image_stream_draw(guacenc_image_stream* stream,
+        guacenc_buffer* buffer, cairo_surface_t* surface) {
 
     /* Get surface dimensions */
     int width = cairo_image_surface_get_width(surface);
@@ -141,13 +138,31 @@ int guacenc_image_stream_end(guacenc_image_stream* stream,
 
     /* Draw surface to buffer */
     if (buffer->cairo != NULL) {
-        cairo_set_operator(buffer->cairo, guacenc_display_cairo_operator(stream->mask));
+        cairo_operator_t op = guacenc_display_cairo_operator(stream->mask);
+        guacenc_buffer_mark_dirty(buffer, op, stream->x, stream->y, width, height);
+        cairo_set_operator(buffer->cairo, op);
         cairo_set_source_surface(buffer->cairo, surface, stream->x, stream->y);
         cairo_rectangle(buffer->cairo, stream->x, stream->y, width, height);
         cairo_fill(buffer->cairo);
     }
 
     cairo_surface_destroy(surface);
+
+}
+
+int guacenc_image_stream_end(guacenc_image_stream* stream,
+        guacenc_buffer* buffer) {
+
+    /* If there is no decoder, simply return success */
+    if (stream->decoder == NULL)
+        return 0;
+
+    /* Decode received data to a Cairo surface */
+    cairo_surface_t* surface = guacenc_image_stream_decode(stream);
+    if (surface == NULL)
+        return 1;
+
+    guacenc_image_stream_draw(stream, buffer, surface);
     return 0;
 
 }
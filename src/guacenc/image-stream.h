@@ -193,6 +193,39 @@ guacenc_image_stream* guacenc_image_stream_alloc(int mask, int index,
 int guacenc_image_stream_receive(guacenc_image_stream* stream,
         unsigned char* data, int length);
 
+/**
+ * Decodes the image data received along the given image stream using the
+ * associated decoder, which must not be NULL. This function does not modify
+ * the image stream and does not access any buffers, and thus may safely be
+ * invoked from a thread other than the one handling instructions.
+ *
+ * @param stream
+ *     The image stream whose data should be decoded.
+ *
+ * @return
+ *     A newly-allocated Cairo surface containing the decoded image, or NULL
+ *     if decoding fails.
+ */
+cairo_surface_t* guacenc_image_stream_decode(guacenc_image_stream* stream);
+
+/**
+ * Draws the given decoded image to the given buffer, using the position and
+ * compositing operation of the given image stream. The given surface is
+ * destroyed once drawn.
+ *
+ * @param stream
+ *     The image stream that the surface was decoded from.
+ *
+ * @param buffer
+ *     The buffer that the decoded image should be written to.
+ *
+ * @param surface
+ *     The surface returned by guacenc_image_stream_decode() for the given
+ *     image stream.
+ */
+void guacenc_image_stream_draw(guacenc_image_stream* stream,
+        guacenc_buffer* buffer, cairo_surface_t* surface);
+
 /**
  * Marks the end of the given image stream (no more data will be received) and
  * invokes the associated decoder. The decoded image will be written to the
@@ -0,0 +1,388 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display.h"
+#include "encode.h"
+#include "index.h"
+#include "instructions.h"
+#include "log.h"
+#include "parse.h"
+
+#include <guacamole/client.h>
+#include <guacamole/error.h>
+#include <guacamole/mem.h>
+#include <guacamole/opcode-types.h>
+#include <guacamole/parser.h>
+#include <guacamole/recording.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The maximum length of a single line within an index, including newline
+ * and null terminator. Longer lines are not written by libguac or guacenc,
+ * and are ignored.
+ */
+#define GUACENC_INDEX_MAX_LINE_LENGTH 256
+
+/**
+ * Stores the path of the file having the given suffix alongside the recording
+ * at the given path within the given buffer.
+ *
+ * @param buffer
+ *     The buffer that should receive the path.
+ *
+ * @param size
+ *     The number of bytes available within the buffer.
+ *
+ * @param path
+ *     The path to the recording.
+ *
+ * @param suffix
+ *     The suffix to append to the path of the recording.
+ *
+ * @return
+ *     Zero if the path was stored successfully, non-zero if the path is too
+ *     long for the given buffer.
+ */
+static int guacenc_index_path(char* buffer, size_t size, const char* path,
+        const char* suffix) {
+
+    int len = snprintf(buffer, size, "%s%s", path, suffix);
+    if (len >= size) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: Name too long", path);
+        return 1;
+    }
+
+    return 0;
+
+}
+
+guacenc_index* guacenc_index_load(const char* path) {
+
+    char index_path[4096];
+    if (guacenc_index_path(index_path, sizeof(index_path), path,
+                GUAC_RECORDING_INDEX_SUFFIX))
+        return NULL;
+
+    FILE* file = fopen(index_path, "r");
+    if (file == NULL)
+        return NULL;
+
+    guacenc_index* index = guac_mem_zalloc(sizeof(guacenc_index));
+
+    char line[GUACENC_INDEX_MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), file) != NULL) {
+
+        int64_t timestamp;
+        int64_t offset;
+        int64_t keyframe_offset;
+
+        /* Keyframes (written only by guacenc_index_build()) */
+        if (sscanf(line, "keyframe %" SCNd64 " %" SCNd64 " %" SCNd64,
+                    &timestamp, &offset, &keyframe_offset) == 3) {
+
+            /* Keyframes are only usable if in order */
+            if (index->keyframe_count > 0 && timestamp <
+                    index->keyframes[index->keyframe_count - 1].timestamp)
+                continue;
+
+            index->keyframes = guac_mem_realloc(index->keyframes,
+                    sizeof(guacenc_index_keyframe), index->keyframe_count + 1);
+
+            index->keyframes[index->keyframe_count++] = (guacenc_index_keyframe) {
+                .timestamp = timestamp,
+                .offset = offset,
+                .keyframe_offset = keyframe_offset
+            };
+
+        }
+
+        /* Frame offsets (only the first frame is relevant to guacenc) */
+        else if (sscanf(line, "sync %" SCNd64 " %" SCNd64,
+                    &timestamp, &offset) == 2) {
+            if (index->first_sync == 0)
+                index->first_sync = timestamp;
+        }
+
+    }
+
+    fclose(file);
+    return index;
+
+}
+
+const guacenc_index_keyframe* guacenc_index_find_keyframe(
+        const guacenc_index* index, guac_timestamp timestamp) {
+
+    /* Binary search for the first keyframe after the given timestamp */
+    int low = 0;
+    int high = index->keyframe_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (index->keyframes[mid].timestamp <= timestamp)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    /* The keyframe preceding that keyframe, if any, is the desired
+     * keyframe */
+    if (low == 0)
+        return NULL;
+
+    return &index->keyframes[low - 1];
+
+}
+
+void guacenc_index_free(guacenc_index* index) {
+
+    if (index == NULL)
+        return;
+
+    guac_mem_free(index->keyframes);
+    guac_mem_free(index);
+
+}
+
+/**
+ * The state of a guac_socket which reads the Guacamole protocol data of a
+ * recording while counting the number of bytes read. As libguac may compress
+ * recordings as they are written, this count (rather than the position of
+ * the underlying file descriptor) is the offset of the data read within the
+ * uncompressed recording.
+ */
+typedef struct guacenc_index_reader {
+
+    /**
+     * The socket reading the Guacamole protocol data of the recording.
+     */
+    guac_socket* socket;
+
+    /**
+     * The total number of bytes read from the socket.
+     */
+    int64_t position;
+
+} guacenc_index_reader;
+
+/**
+ * Callback function which reads data from the socket of the recording being
+ * indexed, updating the position of the associated guacenc_index_reader.
+ *
+ * @param socket
+ *     The guac_socket being read from, whose data is a guacenc_index_reader.
+ *
+ * @param buf
+ *     The buffer to read data into.
+ *
+ * @param count
+ *     The maximum number of bytes to read into the given buffer.
+ *
+ * @return
+ *     The number of bytes read, zero if the end of the recording has been
+ *     reached, or -1 if an error occurs.
+ */
+static ssize_t guacenc_index_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    guacenc_index_reader* reader = (guacenc_index_reader*) socket->data;
+
+    ssize_t length = guac_socket_read(reader->socket, buf, count);
+    if (length > 0)
+        reader->position += length;
+
+    return length;
+
+}
+
+/**
+ * Reads and handles all Guacamole instructions from the given recording,
+ * writing the offsets of frames and keyframes of the display state to the
+ * given index and keyframes file as the recording is read.
+ *
+ * @param display
+ *     A newly-allocated display which does not write video.
+ *
+ * @param path
+ *     The name of the recording being indexed (for logging purposes).
+ *
+ * @param recording
+ *     The guac_socket reading the Guacamole protocol data of the recording
+ *     being indexed.
+ *
+ * @param index
+ *     The file that the index should be written to.
+ *
+ * @param keyframes_fd
+ *     The file descriptor of the file that keyframes should be written to.
+ *
+ * @return
+ *     Zero if the entire recording was indexed successfully, non-zero
+ *     otherwise.
+ */
+static int guacenc_index_write(guacenc_display* display, const char* path,
+        guac_socket* recording, FILE* index, int keyframes_fd) {
+
+    guacenc_index_reader reader = { .socket = recording };
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &reader;
+    socket->read_handler = guacenc_index_read_handler;
+
+    guac_socket* keyframes = guac_socket_open(keyframes_fd);
+    guac_parser* parser = guac_parser_alloc();
+
+    bool indexed = false;
+    bool keyframed = false;
+    guac_timestamp last_indexed = 0;
+    guac_timestamp last_keyframe = 0;
+
+    int retval = 0;
+    while (!guac_parser_read(parser, socket, -1)) {
+
+        int failed = guacenc_handle_instruction(display, parser->opcode_id,
+                parser->argc, parser->argv);
+
+        /* Only successfully-handled "sync" instructions are indexed */
+        if (parser->opcode_id != GUAC_OPCODE_SYNC || failed)
+            continue;
+
+        guac_timestamp timestamp = display->last_sync;
+        if (indexed && timestamp - last_indexed < GUAC_RECORDING_INDEX_INTERVAL)
+            continue;
+
+        /* The parser may have read beyond the end of the "sync" instruction,
+         * but will not have read anything beyond its own buffer */
+        int64_t offset = reader.position - guac_parser_length(parser);
+
+        fprintf(index, "sync %" PRId64 " %" PRId64 "\n",
+                (int64_t) timestamp, offset);
+
+        indexed = true;
+        last_indexed = timestamp;
+
+        if (keyframed && timestamp - last_keyframe < GUACENC_INDEX_KEYFRAME_INTERVAL)
+            continue;
+
+        /* Write the full state of the display as of this frame */
+        guac_socket_flush(keyframes);
+        off_t keyframe_offset = lseek(keyframes_fd, 0, SEEK_CUR);
+
+        guacenc_display_draw_images(display);
+        if (keyframe_offset == -1 || guacenc_display_write_snapshot(display,
+                    keyframes, timestamp)) {
+            guacenc_log(GUAC_LOG_ERROR, "%s: Unable to write keyframe.", path);
+            retval = 1;
+            break;
+        }
+
+        fprintf(index, "keyframe %" PRId64 " %" PRId64 " %" PRId64 "\n",
+                (int64_t) timestamp, offset, (int64_t) keyframe_offset);
+
+        keyframed = true;
+        last_keyframe = timestamp;
+
+    }
+
+    /* Fail on read/parse error */
+    if (!retval && guac_error != GUAC_STATUS_CLOSED) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: %s",
+                path, guac_status_string(guac_error));
+        retval = 1;
+    }
+
+    guac_parser_free(parser);
+    guac_socket_free(keyframes);
+    guac_socket_free(socket);
+    return retval;
+
+}
+
+int guacenc_index_build(const char* path, bool force, int threads) {
+
+    char index_path[4096];
+    char keyframes_path[4096];
+
+    if (guacenc_index_path(index_path, sizeof(index_path), path,
+                GUAC_RECORDING_INDEX_SUFFIX)
+            || guacenc_index_path(keyframes_path, sizeof(keyframes_path), path,
+                GUACENC_INDEX_KEYFRAMES_SUFFIX))
+        return 1;
+
+    /* Open and lock input file */
+    int fd = guacenc_open_recording(path, force);
+    if (fd < 0)
+        return 1;
+
+    /* Obtain guac_socket reading the recording, decompressing if needed */
+    guac_socket* recording = guac_recording_open_read(fd);
+    if (recording == NULL) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: %s", path,
+                guac_status_string(guac_error));
+        return 1;
+    }
+
+    FILE* index = fopen(index_path, "w");
+    if (index == NULL) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: %s", index_path, strerror(errno));
+        guac_socket_free(recording);
+        return 1;
+    }
+
+    int keyframes_fd = open(keyframes_path, O_CREAT | O_WRONLY | O_TRUNC,
+            S_IRUSR | S_IWUSR | S_IRGRP);
+    if (keyframes_fd < 0) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: %s", keyframes_path,
+                strerror(errno));
+        fclose(index);
+        guac_socket_free(recording);
+        return 1;
+    }
+
+    /* Track the state of the display without writing video */
+    guacenc_display* display = guacenc_display_alloc(NULL, NULL, 0, 0, 0,
+            threads);
+
+    guacenc_log(GUAC_LOG_INFO, "Indexing \"%s\" ...", path);
+
+    int retval = guacenc_index_write(display, path, recording,
+            index, keyframes_fd);
+
+    guacenc_display_free(display);
+    guac_socket_free(recording);
+
+    if (fclose(index)) {
+        guacenc_log(GUAC_LOG_ERROR, "%s: %s", index_path, strerror(errno));
+        retval = 1;
+    }
+
+    return retval;
+
+}
@@ -0,0 +1,153 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUACENC_INDEX_H
+#define GUACENC_INDEX_H
+
+#include <guacamole/timestamp.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The suffix appended to the filename of a recording to produce the filename
+ * of the file containing the keyframes referenced by its index.
+ */
+#define GUACENC_INDEX_KEYFRAMES_SUFFIX ".keyframes"
+
+/**
+ * The minimum number of milliseconds between keyframes written by
+ * guacenc_index_build(). Seeking within a recording must replay, on average,
+ * half this amount of the recording after restoring the nearest keyframe.
+ */
+#define GUACENC_INDEX_KEYFRAME_INTERVAL 60000
+
+/**
+ * A single keyframe within the index of a recording, describing the complete
+ * state of the display at a particular frame of that recording.
+ */
+typedef struct guacenc_index_keyframe {
+
+    /**
+     * The timestamp of the "sync" instruction ending the frame described by
+     * this keyframe.
+     */
+    guac_timestamp timestamp;
+
+    /**
+     * The byte offset within the recording immediately following the "sync"
+     * instruction ending the frame described by this keyframe.
+     */
+    int64_t offset;
+
+    /**
+     * The byte offset within the keyframes file of the Guacamole
+     * instructions which restore the display state of this keyframe. These
+     * instructions are terminated by a "sync" instruction.
+     */
+    int64_t keyframe_offset;
+
+} guacenc_index_keyframe;
+
+/**
+ * The index of a recording, as written by libguac alongside the recording
+ * and/or by guacenc_index_build().
+ */
+typedef struct guacenc_index {
+
+    /**
+     * The timestamp of the first frame of the recording.
+     */
+    guac_timestamp first_sync;
+
+    /**
+     * All keyframes within the index, in order of increasing timestamp.
+     */
+    guacenc_index_keyframe* keyframes;
+
+    /**
+     * The number of keyframes within the keyframes array.
+     */
+    int keyframe_count;
+
+} guacenc_index;
+
+/**
+ * Loads the index of the recording at the given path, if such an index
+ * exists. Malformed or unrecognized lines within the index are ignored.
+ *
+ * @param path
+ *     The path to the recording whose index should be loaded (NOT the path
+ *     to the index itself).
+ *
+ * @return
+ *     A newly-allocated guacenc_index, which must eventually be freed with
+ *     guacenc_index_free(), or NULL if the recording has no index.
+ */
+guacenc_index* guacenc_index_load(const char* path);
+
+/**
+ * Returns the latest keyframe within the given index having a timestamp no
+ * later than the given timestamp.
+ *
+ * @param index
+ *     The index to search.
+ *
+ * @param timestamp
+ *     The timestamp of the frame that the returned keyframe must not follow.
+ *
+ * @return
+ *     The latest keyframe no later than the given timestamp, or NULL if there
+ *     is no such keyframe.
+ */
+const guacenc_index_keyframe* guacenc_index_find_keyframe(
+        const guacenc_index* index, guac_timestamp timestamp);
+
+/**
+ * Frees the given index. If the index is NULL, this function has no effect.
+ *
+ * @param index
+ *     The index to free, which may be NULL.
+ */
+void guacenc_index_free(guacenc_index* index);
+
+/**
+ * Reads the entire recording at the given path, writing a new index for that
+ * recording containing the offsets of frames at least
+ * GUAC_RECORDING_INDEX_INTERVAL milliseconds apart and keyframes at least
+ * GUACENC_INDEX_KEYFRAME_INTERVAL milliseconds apart. Any existing index or
+ * keyframes for the recording are replaced.
+ *
+ * @param path
+ *     The path to the recording to index.
+ *
+ * @param force
+ *     Whether the recording should be indexed even if it appears to be
+ *     in-progress.
+ *
+ * @param threads
+ *     The number of threads that may be used to decode images.
+ *
+ * @return
+ *     Zero if the index was written successfully, non-zero otherwise.
+ */
+int guacenc_index_build(const char* path, bool force, int threads);
+
+#endif
+
@@ -47,9 +47,18 @@ int guacenc_handle_cfill(guacenc_display* display, int argc, char** argv) {
 
     /* Fill with RGBA color */
     if (buffer->cairo != NULL) {
-        cairo_set_operator(buffer->cairo, guacenc_display_cairo_operator(mask));
+
+        /* Note the region affected by the fill prior to filling (the current
+         * path is consumed by the fill) */
+        double x1, y1, x2, y2;
+        cairo_operator_t op = guacenc_display_cairo_operator(mask);
+        cairo_fill_extents(buffer->cairo, &x1, &y1, &x2, &y2);
+        guacenc_buffer_mark_dirty(buffer, op, x1, y1, x2 - x1, y2 - y1);
+
+        cairo_set_operator(buffer->cairo, op);
         cairo_set_source_rgba(buffer->cairo, r, g, b, a);
         cairo_fill(buffer->cairo);
+
     }
 
     return 0;
@@ -85,7 +85,9 @@ int guacenc_handle_copy(guacenc_display* display, int argc, char** argv) {
         }
 
         /* Perform copy */
-        cairo_set_operator(dst->cairo, guacenc_display_cairo_operator(mask));
+        cairo_operator_t op = guacenc_display_cairo_operator(mask);
+        guacenc_buffer_mark_dirty(dst, op, dx, dy, width, height);
+        cairo_set_operator(dst->cairo, op);
         cairo_set_source_surface(dst->cairo, surface, dx - sx, dy - sy);
         cairo_rectangle(dst->cairo, dx, dy, width, height);
         cairo_fill(dst->cairo);
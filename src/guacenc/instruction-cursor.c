@@ -59,6 +59,8 @@ int guacenc_handle_cursor(guacenc_display* display, int argc, char** argv) {
     /* Copy rectangle from source to cursor */
     guacenc_buffer* dst = cursor->buffer;
     if (src->surface != NULL && dst->cairo != NULL) {
+        guacenc_buffer_mark_dirty(dst, CAIRO_OPERATOR_SOURCE, 0, 0,
+                width, height);
         cairo_set_operator(dst->cairo, CAIRO_OPERATOR_SOURCE);
         cairo_set_source_surface(dst->cairo, src->surface, sx, sy);
         cairo_paint(dst->cairo);
@@ -54,6 +54,9 @@ int guacenc_handle_move(guacenc_display* display, int argc, char** argv) {
     layer->y = y;
     layer->z = z;
 
+    /* Changes in parent or Z may change the order that layers are composited */
+    display->render_order_valid = false;
+
     return 0;
 
 }
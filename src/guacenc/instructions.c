@@ -23,53 +23,43 @@
 
 #include <guacamole/client.h>
 
-#include <string.h>
-
-guacenc_instruction_handler_mapping guacenc_instruction_handler_map[] = {
-    {"blob",     guacenc_handle_blob},
-    {"img",      guacenc_handle_img},
-    {"end",      guacenc_handle_end},
-    {"mouse",    guacenc_handle_mouse},
-    {"sync",     guacenc_handle_sync},
-    {"cursor",   guacenc_handle_cursor},
-    {"copy",     guacenc_handle_copy},
-    {"transfer", guacenc_handle_transfer},
-    {"size",     guacenc_handle_size},
-    {"rect",     guacenc_handle_rect},
-    {"cfill",    guacenc_handle_cfill},
-    {"move",     guacenc_handle_move},
-    {"shade",    guacenc_handle_shade},
-    {"dispose",  guacenc_handle_dispose},
-    {NULL,       NULL}
+guacenc_instruction_handler* guacenc_instruction_handler_map[GUAC_OPCODE_COUNT] = {
+    [GUAC_OPCODE_BLOB]     = guacenc_handle_blob,
+    [GUAC_OPCODE_IMG]      = guacenc_handle_img,
+    [GUAC_OPCODE_END]      = guacenc_handle_end,
+    [GUAC_OPCODE_MOUSE]    = guacenc_handle_mouse,
+    [GUAC_OPCODE_SYNC]     = guacenc_handle_sync,
+    [GUAC_OPCODE_CURSOR]   = guacenc_handle_cursor,
+    [GUAC_OPCODE_COPY]     = guacenc_handle_copy,
+    [GUAC_OPCODE_TRANSFER] = guacenc_handle_transfer,
+    [GUAC_OPCODE_SIZE]     = guacenc_handle_size,
+    [GUAC_OPCODE_RECT]     = guacenc_handle_rect,
+    [GUAC_OPCODE_CFILL]    = guacenc_handle_cfill,
+    [GUAC_OPCODE_MOVE]     = guacenc_handle_move,
+    [GUAC_OPCODE_SHADE]    = guacenc_handle_shade,
+    [GUAC_OPCODE_DISPOSE]  = guacenc_handle_dispose
 };
 
-int guacenc_handle_instruction(guacenc_display* display, const char* opcode,
+int guacenc_handle_instruction(guacenc_display* display, guac_opcode opcode,
         int argc, char** argv) {
 
-    /* Search through mapping for instruction handler having given opcode */
-    guacenc_instruction_handler_mapping* current = guacenc_instruction_handler_map;
-    while (current->opcode != NULL) {
-
-        /* Invoke handler if opcode matches (if defined) */
-        if (strcmp(current->opcode, opcode) == 0) {
-
-            /* Invoke defined handler */
-            guacenc_instruction_handler* handler = current->handler;
-            if (handler != NULL)
-                return handler(display, argc, argv);
-
-            /* Log defined but unimplemented instructions */
-            guacenc_log(GUAC_LOG_DEBUG, "\"%s\" not implemented", opcode);
-            return 0;
+    /* Invoke handler for given opcode (if defined) */
+    guacenc_instruction_handler* handler = guacenc_instruction_handler_map[opcode];
+    if (handler != NULL) {
 
-        }
+        /* Images still being decoded in the background must be drawn before
+         * any instruction other than those which stream images */
+        if (opcode != GUAC_OPCODE_IMG && opcode != GUAC_OPCODE_BLOB
+                && opcode != GUAC_OPCODE_END
+                && guacenc_display_draw_images(display))
+            guacenc_log(GUAC_LOG_DEBUG, "Decoding of one or more images "
+                    "failed.");
 
-        /* Next candidate handler */
-        current++;
+        return handler(display, argc, argv);
 
-    } /* end opcode search */
+    }
 
-    /* Ignore any unknown instructions */
+    /* Ignore any unknown or unimplemented instructions */
     return 0;
 
 }
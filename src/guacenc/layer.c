@@ -21,6 +21,7 @@
 #include "layer.h"
 
 #include <guacamole/mem.h>
+#include <guacamole/rect.h>
 
 #include <stdlib.h>
 
@@ -52,10 +53,18 @@ guacenc_layer* guacenc_layer_alloc(void) {
     /* Default parented to default layer */
     layer->parent_index = 0;
 
+    /* Not yet composited onto anything */
+    layer->flattened_parent_index = GUACENC_LAYER_NO_PARENT;
+
     return layer;
 
 }
 
+void guacenc_layer_mark_frame_dirty(guacenc_layer* layer, const guac_rect* rect) {
+    if (!guac_rect_is_empty(rect))
+        guac_rect_extend(&layer->frame_dirty, rect);
+}
+
 void guacenc_layer_free(guacenc_layer* layer) {
 
     /* Ignore NULL layers */
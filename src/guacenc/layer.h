@@ -22,6 +22,8 @@
 
 #include "buffer.h"
 
+#include <guacamole/rect.h>
+
 /**
  * The value assigned to the parent_index property of a guacenc_layer if it has
  * no parent.
@@ -76,6 +78,40 @@ typedef struct guacenc_layer {
      */
     guacenc_buffer* frame;
 
+    /**
+     * The region of the frame buffer of this layer that must be recomposited
+     * when the display is next flattened, in addition to any regions that
+     * have been modified within the layer's own buffer. This is used to
+     * track regions of a layer that are affected by changes to its child
+     * layers. If no such region exists, this rectangle is empty.
+     */
+    guac_rect frame_dirty;
+
+    /**
+     * The index of the layer that this layer was composited onto when the
+     * display was last flattened, or GUACENC_LAYER_NO_PARENT if this layer
+     * was not composited onto any layer.
+     */
+    int flattened_parent_index;
+
+    /**
+     * The region of the parent layer that this layer covered when the display
+     * was last flattened. If this layer was not composited onto any layer,
+     * this rectangle is empty.
+     */
+    guac_rect flattened_rect;
+
+    /**
+     * The relative stacking order of this layer at the time the display was
+     * last flattened.
+     */
+    int flattened_z;
+
+    /**
+     * The opacity of this layer at the time the display was last flattened.
+     */
+    int flattened_opacity;
+
 } guacenc_layer;
 
 /**
@@ -89,6 +125,19 @@ typedef struct guacenc_layer {
  */
 guacenc_layer* guacenc_layer_alloc(void);
 
+/**
+ * Marks the given rectangle of the frame buffer of the given layer as
+ * requiring recompositing the next time the display is flattened. Empty
+ * rectangles are ignored.
+ *
+ * @param layer
+ *     The layer whose frame buffer should be marked.
+ *
+ * @param rect
+ *     The region of the frame buffer that must be recomposited.
+ */
+void guacenc_layer_mark_frame_dirty(guacenc_layer* layer, const guac_rect* rect);
+
 /**
  * Frees all memory associated with the given layer object. If the layer
  * provided is NULL, this function has no effect.
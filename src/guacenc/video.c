@@ -32,11 +32,11 @@
 #include <libswscale/swscale.h>
 #include <guacamole/client.h>
 #include <guacamole/mem.h>
+#include <guacamole/rect.h>
 #include <guacamole/timestamp.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -44,8 +44,362 @@
 #include <string.h>
 #include <unistd.h>
 
+/**
+ * Flushes the specified frame as a new frame of video, updating the internal
+ * video timestamp by one frame's worth of time. The pts member of the given
+ * frame structure will be updated with the current presentation timestamp of
+ * the video. If pending frames of the video are being flushed, the given frame
+ * may be NULL (as required by avcodec_encode_video2()).
+ *
+ * @param video
+ *     The video to write the given frame to.
+ *
+ * @param frame
+ *     The frame to write to the video, or NULL if previously-written frames
+ *     are being flushed.
+ *
+ * @return
+ *     A positive value if the frame was successfully written, zero if the
+ *     frame has been saved for later writing / reordering, negative if an
+ *     error occurs.
+ */
+static int guacenc_video_write_frame(guacenc_video* video, AVFrame* frame) {
+
+    /* Set timestamp of frame, if frame given */
+    if (frame != NULL)
+        frame->pts = video->next_pts;
+
+    /* Write frame to video */
+    int got_data = guacenc_avcodec_encode_video(video, frame);
+    if (got_data < 0)
+        return -1;
+
+    /* Update presentation timestamp for next frame */
+    video->next_pts++;
+
+    /* Write was successful */
+    return got_data;
+
+}
+
+/**
+ * Flushes the frame previously specified by guacenc_video_prepare_frame() as a
+ * new frame of video, updating the internal video timestamp by one frame's
+ * worth of time.
+ *
+ * @param video
+ *     The video to flush.
+ *
+ * @return
+ *     Zero if flushing was successful, non-zero if an error occurs.
+ */
+static int guacenc_video_flush_frame(guacenc_video* video) {
+
+    /* Write frame to video */
+    return guacenc_video_write_frame(video, video->next_frame) < 0;
+
+}
+
+/**
+ * Adds the given operation to the queue of the encoding thread of the given
+ * video, waiting for space within the queue if necessary.
+ *
+ * @param video
+ *     The video whose encoding thread should process the given operation.
+ *
+ * @param operation
+ *     The operation to queue.
+ *
+ * @return
+ *     Zero if the encoding thread has not failed, non-zero if any frame
+ *     previously processed by the encoding thread could not be written.
+ */
+static int guacenc_video_enqueue(guacenc_video* video,
+        guacenc_video_operation operation) {
+
+    pthread_mutex_lock(&video->lock);
+
+    /* Wait for the encoding thread to catch up if necessary */
+    while (video->queue_length == GUACENC_VIDEO_QUEUE_SIZE)
+        pthread_cond_wait(&video->modified, &video->lock);
+
+    video->queue[(video->queue_head + video->queue_length)
+        % GUACENC_VIDEO_QUEUE_SIZE] = operation;
+    video->queue_length++;
+
+    pthread_cond_broadcast(&video->modified);
+
+    int failed = video->failed;
+    pthread_mutex_unlock(&video->lock);
+
+    return failed;
+
+}
+
+/**
+ * Frees the given frame and its image data, as allocated by
+ * guacenc_video_acquire_frame().
+ *
+ * @param frame
+ *     The frame to free.
+ */
+static void guacenc_video_frame_free(AVFrame* frame) {
+    av_freep(&frame->data[0]);
+    av_frame_free(&frame);
+}
+
+/**
+ * Returns an RGB32 frame of the given dimensions which may receive a copy of
+ * the image data of a prepared frame, reusing a frame from the pool of the
+ * given video if possible.
+ *
+ * @param video
+ *     The video whose pool of frames should be used.
+ *
+ * @param width
+ *     The width of the required frame, in pixels.
+ *
+ * @param height
+ *     The height of the required frame, in pixels.
+ *
+ * @return
+ *     An RGB32 frame having the given dimensions, or NULL if no such frame
+ *     could be allocated. The frame must eventually be returned to the pool
+ *     with guacenc_video_release_frame().
+ */
+static AVFrame* guacenc_video_acquire_frame(guacenc_video* video, int width,
+        int height) {
+
+    AVFrame* frame = NULL;
+
+    pthread_mutex_lock(&video->lock);
+    if (video->frame_pool_size > 0)
+        frame = video->frame_pool[--video->frame_pool_size];
+    pthread_mutex_unlock(&video->lock);
+
+    /* Reuse pooled frame only if it is the right size (the size of the
+     * display changes rarely) */
+    if (frame != NULL) {
+
+        if (frame->width == width && frame->height == height)
+            return frame;
+
+        guacenc_video_frame_free(frame);
+
+    }
+
+    frame = av_frame_alloc();
+    if (frame == NULL)
+        return NULL;
+
+    frame->format = AV_PIX_FMT_RGB32;
+    frame->width = width;
+    frame->height = height;
+
+    /* Allocate actual backing data for frame */
+    if (av_image_alloc(frame->data, frame->linesize, frame->width,
+                frame->height, frame->format, 32) < 0) {
+        av_frame_free(&frame);
+        return NULL;
+    }
+
+    return frame;
+
+}
+
+/**
+ * Returns the given frame, previously returned by
+ * guacenc_video_acquire_frame(), to the pool of the given video. If the pool
+ * is full, the frame is freed.
+ *
+ * @param video
+ *     The video whose pool should receive the frame.
+ *
+ * @param frame
+ *     The frame to return to the pool.
+ */
+static void guacenc_video_release_frame(guacenc_video* video, AVFrame* frame) {
+
+    pthread_mutex_lock(&video->lock);
+
+    if (video->frame_pool_size < GUACENC_VIDEO_FRAME_POOL_SIZE) {
+        video->frame_pool[video->frame_pool_size++] = frame;
+        frame = NULL;
+    }
+
+    pthread_mutex_unlock(&video->lock);
+
+    if (frame != NULL)
+        guacenc_video_frame_free(frame);
+
+}
+
+/**
+ * Fills the given YUV420P frame entirely with black.
+ *
+ * @param frame
+ *     The frame to fill.
+ */
+static void guacenc_video_fill_black(AVFrame* frame) {
+
+    int chroma_width = (frame->width + 1) / 2;
+    int chroma_height = (frame->height + 1) / 2;
+
+    for (int y = 0; y < frame->height; y++)
+        memset(frame->data[0] + y * frame->linesize[0], 16, frame->width);
+
+    for (int y = 0; y < chroma_height; y++) {
+        memset(frame->data[1] + y * frame->linesize[1], 128, chroma_width);
+        memset(frame->data[2] + y * frame->linesize[2], 128, chroma_width);
+    }
+
+}
+
+/**
+ * Scales and converts the given prepared frame directly into the next_frame
+ * of the given video, in a single pass performed by libswscale, returning the
+ * prepared frame to the pool once done. The image is scaled to fit the video
+ * while preserving its aspect ratio, with black letterboxes or pillarboxes
+ * filling the remainder of next_frame. This function must only be invoked by
+ * the encoding thread.
+ *
+ * @param video
+ *     The video whose next frame should be replaced.
+ *
+ * @param src
+ *     The frame prepared by guacenc_video_prepare_frame().
+ */
+static void guacenc_video_convert_frame(guacenc_video* video, AVFrame* src) {
+
+    AVFrame* dst = video->next_frame;
+
+    /* Determine width of image if height is scaled to match destination */
+    int scaled_width = src->width * dst->height / src->height;
+
+    /* Determine height of image if width is scaled to match destination */
+    int scaled_height = src->height * dst->width / src->width;
+
+    /* Center the image, aligning its upper-left corner with the chroma
+     * subsampling of the destination */
+    guac_rect region;
+
+    /* If height-based scaling results in a fit width, add pillarboxes */
+    if (scaled_width <= dst->width)
+        guac_rect_init(&region, ((dst->width - scaled_width) / 2) & ~1, 0,
+                scaled_width, dst->height);
+
+    /* If width-based scaling results in a fit width, add letterboxes */
+    else
+        guac_rect_init(&region, 0, ((dst->height - scaled_height) / 2) & ~1,
+                dst->width, scaled_height);
+
+    /* Drop frames which scale to nothing */
+    if (guac_rect_is_empty(&region)) {
+        guacenc_video_release_frame(video, src);
+        return;
+    }
+
+    /* Redraw the boxes around the image only if their size has changed */
+    if (region.left   != video->region.left
+     || region.top    != video->region.top
+     || region.right  != video->region.right
+     || region.bottom != video->region.bottom) {
+        guacenc_video_fill_black(dst);
+        video->region = region;
+    }
+
+    /* Prepare scaling context, reusing the previous context if possible */
+    video->sws = sws_getCachedContext(video->sws, src->width, src->height,
+            AV_PIX_FMT_RGB32, guac_rect_width(&region),
+            guac_rect_height(&region), AV_PIX_FMT_YUV420P, SWS_BICUBIC,
+            NULL, NULL, NULL);
+
+    /* Apply scaling, copying the source frame into the region of the
+     * destination that it occupies */
+    if (video->sws != NULL) {
+
+        uint8_t* planes[] = {
+            dst->data[0] + region.top * dst->linesize[0] + region.left,
+            dst->data[1] + region.top / 2 * dst->linesize[1] + region.left / 2,
+            dst->data[2] + region.top / 2 * dst->linesize[2] + region.left / 2
+        };
+
+        sws_scale(video->sws, (const uint8_t* const*) src->data, src->linesize,
+                0, src->height, planes, dst->linesize);
+
+    }
+
+    /* Drop frame if scaling context could not be created */
+    else
+        guacenc_log(GUAC_LOG_WARNING, "Failed to allocate software scaling "
+                "context. Frame dropped.");
+
+    guacenc_video_release_frame(video, src);
+
+}
+
+/**
+ * Processes all operations queued for the given video until the video is
+ * freed, converting and encoding frames in parallel with the handling of
+ * instructions.
+ *
+ * @param data
+ *     The guacenc_video whose queued operations should be processed.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guacenc_video_encode_thread(void* data) {
+
+    guacenc_video* video = (guacenc_video*) data;
+
+    pthread_mutex_lock(&video->lock);
+
+    for (;;) {
+
+        /* Wait for work, stopping only once all queued work is done */
+        while (video->queue_length == 0 && !video->stopping)
+            pthread_cond_wait(&video->modified, &video->lock);
+
+        if (video->queue_length == 0)
+            break;
+
+        guacenc_video_operation operation = video->queue[video->queue_head];
+        video->queue_head = (video->queue_head + 1) % GUACENC_VIDEO_QUEUE_SIZE;
+        video->queue_length--;
+
+        pthread_cond_broadcast(&video->modified);
+        pthread_mutex_unlock(&video->lock);
+
+        /* Flush frames to bring timeline in sync, duplicating if necessary */
+        bool failed = false;
+        for (; operation.flushes > 0; operation.flushes--) {
+            if (guacenc_video_flush_frame(video)) {
+                guacenc_log(GUAC_LOG_ERROR, "Unable to flush frame to video "
+                        "stream.");
+                failed = true;
+                break;
+            }
+        }
+
+        /* Replace the frame written by future flushes */
+        if (operation.source != NULL)
+            guacenc_video_convert_frame(video, operation.source);
+
+        pthread_mutex_lock(&video->lock);
+
+        if (failed)
+            video->failed = true;
+
+    }
+
+    pthread_mutex_unlock(&video->lock);
+    return NULL;
+
+}
+
 guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
-        int width, int height, int bitrate) {
+        int width, int height, int bitrate, int threads) {
 
     const AVOutputFormat *container_format;
     AVFormatContext *container_format_context;
@@ -92,6 +446,11 @@ guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
         goto fail_context;
     }
 
+    /* Allow libavcodec to encode using multiple threads, using whichever
+     * types of threading the codec supports */
+    avcodec_context->thread_count = threads;
+    avcodec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
     /* If format needs global headers, write them */
     if (container_format_context->oformat->flags & AVFMT_GLOBALHEADER) {
         avcodec_context->flags |= GUACENC_FLAG_GLOBAL_HEADER;
@@ -120,6 +479,9 @@ guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
         goto fail_frame_data;
     }
 
+    /* Frame is black until the first frame is prepared */
+    guacenc_video_fill_black(frame);
+
     /* Open output file, if the container needs it */
     if (!(container_format->flags & AVFMT_NOFILE)) {
         ret = avio_open(&container_format_context->pb, path, AVIO_FLAG_WRITE);
@@ -155,6 +517,28 @@ guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
     video->last_timestamp = 0;
     video->next_pts = 0;
 
+    /* Nothing has yet been queued for the encoding thread */
+    video->queue_head = 0;
+    video->queue_length = 0;
+    video->stopping = false;
+    video->failed = false;
+    video->sws = NULL;
+    video->region = (guac_rect) { 0 };
+    video->frame_pool_size = 0;
+
+    pthread_mutex_init(&video->lock, NULL);
+    pthread_cond_init(&video->modified, NULL);
+
+    /* Convert and encode frames in parallel with rendering */
+    if (pthread_create(&video->encode_thread, NULL,
+                guacenc_video_encode_thread, video)) {
+        guacenc_log(GUAC_LOG_ERROR, "Unable to start encoding thread.");
+        pthread_cond_destroy(&video->modified);
+        pthread_mutex_destroy(&video->lock);
+        guac_mem_free(video);
+        goto fail_alloc_video;
+    }
+
     return video;
 
     /* Free all allocated data in case of failure */
@@ -189,62 +573,6 @@ fail_codec:
 
 }
 
-/**
- * Flushes the specified frame as a new frame of video, updating the internal
- * video timestamp by one frame's worth of time. The pts member of the given
- * frame structure will be updated with the current presentation timestamp of
- * the video. If pending frames of the video are being flushed, the given frame
- * may be NULL (as required by avcodec_encode_video2()).
- *
- * @param video
- *     The video to write the given frame to.
- *
- * @param frame
- *     The frame to write to the video, or NULL if previously-written frames
- *     are being flushed.
- *
- * @return
- *     A positive value if the frame was successfully written, zero if the
- *     frame has been saved for later writing / reordering, negative if an
- *     error occurs.
- */
-static int guacenc_video_write_frame(guacenc_video* video, AVFrame* frame) {
-
-    /* Set timestamp of frame, if frame given */
-    if (frame != NULL)
-        frame->pts = video->next_pts;
-
-    /* Write frame to video */
-    int got_data = guacenc_avcodec_encode_video(video, frame);
-    if (got_data < 0)
-        return -1;
-
-    /* Update presentation timestamp for next frame */
-    video->next_pts++;
-
-    /* Write was successful */
-    return got_data;
-
-}
-
-/**
- * Flushes the frame previously specified by guacenc_video_prepare_frame() as a
- * new frame of video, updating the internal video timestamp by one frame's
- * worth of time.
- *
- * @param video
- *     The video to flush.
- *
- * @return
- *     Zero if flushing was successful, non-zero if an error occurs.
- */
-static int guacenc_video_flush_frame(guacenc_video* video) {
-
-    /* Write frame to video */
-    return guacenc_video_write_frame(video, video->next_frame) < 0;
-
-}
-
 int guacenc_video_advance_timeline(guacenc_video* video,
         guac_timestamp timestamp) {
 
@@ -266,13 +594,12 @@ int guacenc_video_advance_timeline(guacenc_video* video,
                         + elapsed * 1000 / GUACENC_VIDEO_FRAMERATE;
 
         /* Flush frames to bring timeline in sync, duplicating if necessary */
-        do {
-            if (guacenc_video_flush_frame(video)) {
-                guacenc_log(GUAC_LOG_ERROR, "Unable to flush frame to video "
-                        "stream.");
-                return 1;
-            }
-        } while (--elapsed != 0);
+        if (guacenc_video_enqueue(video, (guacenc_video_operation) {
+                    .flushes = elapsed })) {
+            guacenc_log(GUAC_LOG_ERROR, "Unable to flush frame to video "
+                    "stream.");
+            return 1;
+        }
 
     }
 
@@ -282,186 +609,32 @@ int guacenc_video_advance_timeline(guacenc_video* video,
 
 }
 
-/**
- * Converts the given Guacamole video encoder buffer to a frame in the format
- * required by libavcodec / libswscale. Black margins of the specified sizes
- * will be added. No scaling is performed; the image data is copied verbatim.
- *
- * @param buffer
- *     The guacenc_buffer to copy as a new AVFrame.
- *
- * @param lsize
- *     The size of the letterboxes to add, in pixels. Letterboxes are the
- *     horizontal black boxes added to images which are scaled down to fit the
- *     destination because they are too wide (the width is scaled to exactly
- *     fit the destination, resulting in extra space at the top and bottom).
- *
- * @param psize
- *     The size of the pillarboxes to add, in pixels. Pillarboxes are the
- *     vertical black boxes added to images which are scaled down to fit the
- *     destination because they are too tall (the height is scaled to exactly
- *     fit the destination, resulting in extra space on the sides).
- *
- * @return
- *     A pointer to a newly-allocated AVFrame containing exactly the same image
- *     data as the given buffer. The image data within the frame and the frame
- *     itself must be manually freed later.
- */
-static AVFrame* guacenc_video_frame_convert(guacenc_buffer* buffer, int lsize,
-        int psize) {
-
-    /* Init size of left/right pillarboxes */
-    int left = psize;
-    int right = psize;
-
-    /* Init size of top/bottom letterboxes */
-    int top = lsize;
-    int bottom = lsize;
-
-    /* Prepare source frame for buffer */
-    AVFrame* frame = av_frame_alloc();
-    if (frame == NULL)
-        return NULL;
-
-    /* Copy buffer properties to frame */
-    frame->format = AV_PIX_FMT_RGB32;
-    frame->width = buffer->width + left + right;
-    frame->height = buffer->height + top + bottom;
-
-    /* Allocate actual backing data for frame */
-    if (av_image_alloc(frame->data, frame->linesize, frame->width,
-                frame->height, frame->format, 32) < 0) {
-        av_frame_free(&frame);
-        return NULL;
-    }
-
-    /* Flush any pending operations */
-    cairo_surface_flush(buffer->surface);
-
-    /* Get pointer to source image data */
-    unsigned char* src_data = buffer->image;
-    int src_stride = buffer->stride;
-
-    /* Get pointer to destination image data */
-    unsigned char* dst_data = frame->data[0];
-    int dst_stride = frame->linesize[0];
-
-    /* Get source/destination dimensions */
-    int width = buffer->width;
-    int height = buffer->height;
-
-    /* Source buffer is guaranteed to fit within destination buffer */
-    assert(width <= frame->width);
-    assert(height <= frame->height);
-
-    /* Add top margin */
-    while (top > 0) {
-        memset(dst_data, 0, frame->width * 4);
-        dst_data += dst_stride;
-        top--;
-    }
-
-    /* Copy all data from source buffer to destination frame */
-    while (height > 0) {
-
-        /* Calculate size of margin and data regions */
-        int left_size = left * 4;
-        int data_size = width * 4;
-        int right_size = right * 4;
-
-        /* Add left margin */
-        memset(dst_data, 0, left_size);
-
-        /* Copy data */
-        memcpy(dst_data + left_size, src_data, data_size);
-
-        /* Add right margin */
-        memset(dst_data + left_size + data_size, 0, right_size);
-
-        dst_data += dst_stride;
-        src_data += src_stride;
-
-        height--;
-
-    }
-
-    /* Add bottom margin */
-    while (bottom > 0) {
-        memset(dst_data, 0, frame->width * 4);
-        dst_data += dst_stride;
-        bottom--;
-    }
-
-    /* Frame converted */
-    return frame;
-
-}
-
 void guacenc_video_prepare_frame(guacenc_video* video, guacenc_buffer* buffer) {
 
-    int lsize;
-    int psize;
-
     /* Ignore NULL buffers */
     if (buffer == NULL || buffer->surface == NULL)
         return;
 
-    /* Obtain destination frame */
-    AVFrame* dst = video->next_frame;
-
-    /* Determine width of image if height is scaled to match destination */
-    int scaled_width = buffer->width * dst->height / buffer->height;
-
-    /* Determine height of image if width is scaled to match destination */
-    int scaled_height = buffer->height * dst->width / buffer->width;
-
-    /* If height-based scaling results in a fit width, add pillarboxes */
-    if (scaled_width <= dst->width) {
-        lsize = 0;
-        psize = (dst->width - scaled_width)
-               * buffer->height / dst->height / 2;
-    }
-
-    /* If width-based scaling results in a fit width, add letterboxes */
-    else {
-        assert(scaled_height <= dst->height);
-        psize = 0;
-        lsize = (dst->height - scaled_height)
-               * buffer->width / dst->width / 2;
-    }
-
     /* Prepare source frame for buffer */
-    AVFrame* src = guacenc_video_frame_convert(buffer, lsize, psize);
+    AVFrame* src = guacenc_video_acquire_frame(video, buffer->width,
+            buffer->height);
     if (src == NULL) {
         guacenc_log(GUAC_LOG_WARNING, "Failed to allocate source frame. "
                 "Frame dropped.");
         return;
     }
 
-    /* Prepare scaling context */
-    struct SwsContext* sws = sws_getContext(src->width, src->height,
-            AV_PIX_FMT_RGB32, dst->width, dst->height, AV_PIX_FMT_YUV420P,
-            SWS_BICUBIC, NULL, NULL, NULL);
-
-    /* Abort if scaling context could not be created */
-    if (sws == NULL) {
-        guacenc_log(GUAC_LOG_WARNING, "Failed to allocate software scaling "
-                "context. Frame dropped.");
-        av_freep(&src->data[0]);
-        av_frame_free(&src);
-        return;
-    }
-
-    /* Apply scaling, copying the source frame to the destination */
-    sws_scale(sws, (const uint8_t* const*) src->data, src->linesize,
-            0, src->height, dst->data, dst->linesize);
+    /* Flush any pending operations */
+    cairo_surface_flush(buffer->surface);
 
-    /* Free scaling context */
-    sws_freeContext(sws);
+    /* Copy image data verbatim, as the buffer will continue to be modified
+     * while the copy is converted and encoded */
+    av_image_copy_plane(src->data[0], src->linesize[0], buffer->image,
+            buffer->stride, buffer->width * 4, buffer->height);
 
-    /* Free source frame */
-    av_freep(&src->data[0]);
-    av_frame_free(&src);
+    /* Convert and encode the copied frame in the background */
+    guacenc_video_enqueue(video, (guacenc_video_operation) {
+            .source = src });
 
 }
 
@@ -471,6 +644,14 @@ int guacenc_video_free(guacenc_video* video) {
     if (video == NULL)
         return 0;
 
+    /* Wait for all queued frames to be encoded */
+    pthread_mutex_lock(&video->lock);
+    video->stopping = true;
+    pthread_cond_broadcast(&video->modified);
+    pthread_mutex_unlock(&video->lock);
+
+    pthread_join(video->encode_thread, NULL);
+
     /* Write final frame */
     guacenc_video_flush_frame(video);
 
@@ -505,6 +686,14 @@ int guacenc_video_free(guacenc_video* video) {
         avcodec_free_context(&(video->context));
     }
 
+    /* Free all pooled frames */
+    for (int i = 0; i < video->frame_pool_size; i++)
+        guacenc_video_frame_free(video->frame_pool[i]);
+
+    sws_freeContext(video->sws);
+    pthread_cond_destroy(&video->modified);
+    pthread_mutex_destroy(&video->lock);
+
     guac_mem_free(video);
     return 0;
 
@@ -22,6 +22,7 @@
 
 #include "buffer.h"
 
+#include <guacamole/rect.h>
 #include <guacamole/timestamp.h>
 #include <libavcodec/avcodec.h>
 
@@ -33,6 +34,10 @@
 #include <libavformat/avformat.h>
 #endif
 
+#include <libswscale/swscale.h>
+
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -41,6 +46,44 @@
  */
 #define GUACENC_VIDEO_FRAMERATE 25
 
+/**
+ * The maximum number of operations that may be awaiting processing by the
+ * encoding thread of a guacenc_video. Once this many operations are queued,
+ * the thread handling instructions will block until the encoding thread
+ * catches up.
+ */
+#define GUACENC_VIDEO_QUEUE_SIZE 4
+
+/**
+ * The maximum number of copies of prepared frames that a guacenc_video will
+ * retain for reuse. This is sufficient for every queued operation to hold a
+ * frame while the encoding thread converts another and the thread handling
+ * instructions prepares another.
+ */
+#define GUACENC_VIDEO_FRAME_POOL_SIZE (GUACENC_VIDEO_QUEUE_SIZE + 2)
+
+/**
+ * An operation awaiting processing by the encoding thread of a guacenc_video.
+ */
+typedef struct guacenc_video_operation {
+
+    /**
+     * The number of times that the current contents of next_frame should be
+     * written to the video before the source frame (if any) is converted.
+     */
+    int flushes;
+
+    /**
+     * A copy of the image data of a newly-prepared frame, in the format
+     * produced by guacenc_video_prepare_frame(), which should be converted
+     * and stored within next_frame once all flushes are written, or NULL if
+     * next_frame should be left unchanged. This frame is freed by the
+     * encoding thread once converted.
+     */
+    AVFrame* source;
+
+} guacenc_video_operation;
+
 /**
  * A video which is actively being encoded. Frames can be added to the video
  * as they are generated, along with their associated timestamps, and the
@@ -101,6 +144,79 @@ typedef struct guacenc_video {
      */
     guac_timestamp last_timestamp;
 
+    /**
+     * The thread which converts prepared frames to the colorspace required by
+     * the codec and encodes/writes those frames, in parallel with the
+     * rendering of subsequent frames.
+     */
+    pthread_t encode_thread;
+
+    /**
+     * Lock which guards access to the operation queue, as well as the
+     * stopping and failed flags.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled whenever an operation is added to or
+     * removed from the queue, or when the encoding thread must stop.
+     */
+    pthread_cond_t modified;
+
+    /**
+     * Circular buffer of all operations awaiting processing by the encoding
+     * thread, beginning at queue_head.
+     */
+    guacenc_video_operation queue[GUACENC_VIDEO_QUEUE_SIZE];
+
+    /**
+     * The index of the oldest operation within the queue.
+     */
+    int queue_head;
+
+    /**
+     * The number of operations within the queue.
+     */
+    int queue_length;
+
+    /**
+     * Whether the encoding thread should stop once the queue is empty.
+     */
+    bool stopping;
+
+    /**
+     * Whether the encoding thread has failed to write any frame.
+     */
+    bool failed;
+
+    /**
+     * The scaling context most recently used to convert prepared frames, or
+     * NULL if no frames have yet been converted. This context is reused for
+     * as long as the dimensions of prepared frames do not change, and is
+     * accessed only by the encoding thread.
+     */
+    struct SwsContext* sws;
+
+    /**
+     * The region of next_frame that the most recently converted frame was
+     * scaled into, with the remainder of next_frame filled with black. This
+     * region is empty if no frame has yet been converted. This is accessed
+     * only by the encoding thread.
+     */
+    guac_rect region;
+
+    /**
+     * Copies of previously-prepared frames which are no longer in use and
+     * may be reused by guacenc_video_prepare_frame(). Access to this pool is
+     * guarded by the lock.
+     */
+    AVFrame* frame_pool[GUACENC_VIDEO_FRAME_POOL_SIZE];
+
+    /**
+     * The number of frames currently within frame_pool.
+     */
+    int frame_pool_size;
+
 } guacenc_video;
 
 /**
@@ -126,9 +242,12 @@ typedef struct guacenc_video {
  * @param bitrate
  *     The desired overall bitrate of the resulting encoded video, in bits per
  *     second.
+ *
+ * @param threads
+ *     The number of threads that libavcodec may use to encode the video.
  */
 guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
-        int width, int height, int bitrate);
+        int width, int height, int bitrate, int threads);
 
 /**
  * Advances the timeline of the encoding process to the given timestamp, such
@@ -150,9 +269,13 @@ guacenc_video* guacenc_video_alloc(const char* path, const char* codec_name,
  *     timeline should be advanced to, as dictated by a parsed "sync"
  *     instruction.
  *
+ * Frames are encoded by a separate thread, and this function returns once
+ * any duplicate frames have been queued for encoding. Failures of that thread
+ * are thus reported by later calls to this function.
+ *
  * @return
  *     Zero if the timeline was adjusted successfully, non-zero if an error
- *     occurs (such as during the encoding of duplicate frames).
+ *     has occurred (such as during the encoding of duplicate frames).
  */
 int guacenc_video_advance_timeline(guacenc_video* video,
         guac_timestamp timestamp);
@@ -166,7 +289,9 @@ int guacenc_video_advance_timeline(guacenc_video* video,
  * prepared within the same pair of frame boundaries). The prepared frame will
  * not be written until it is implicitly flushed through updates to the video
  * timeline or through reaching the end of the encoding process
- * (guacenc_video_free()).
+ * (guacenc_video_free()). The image data of the buffer is copied before this
+ * function returns, with conversion and encoding of that copy performed by a
+ * separate thread.
  *
  * @param video
  *     The video in which the given buffer should be queued for possible
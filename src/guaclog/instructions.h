@@ -22,6 +22,8 @@
 
 #include "state.h"
 
+#include <guacamole/opcode-types.h>
+
 /**
  * A callback function which, when invoked, handles a particular Guacamole
  * instruction. The opcode of the instruction is implied (as it is expected
@@ -48,30 +50,11 @@ typedef int guaclog_instruction_handler(guaclog_state* state,
         int argc, char** argv);
 
 /**
- * Mapping of instruction opcode to corresponding handler function.
- */
-typedef struct guaclog_instruction_handler_mapping {
-
-    /**
-     * The opcode of the instruction that the associated handler function
-     * should be invoked for.
-     */
-    const char* opcode;
-
-    /**
-     * The handler function to invoke whenever an instruction having the
-     * associated opcode is parsed.
-     */
-    guaclog_instruction_handler* handler;
-
-} guaclog_instruction_handler_mapping;
-
-/**
- * Array of all opcode/handler mappings for all supported opcodes, terminated
- * by an entry with a NULL opcode. All opcodes not listed here can be safely
- * ignored.
+ * Array of all handlers for all supported opcodes, indexed by the numeric
+ * opcode ID assigned by the Guacamole parser. All opcodes whose elements are
+ * NULL can be safely ignored.
  */
-extern guaclog_instruction_handler_mapping guaclog_instruction_handler_map[];
+extern guaclog_instruction_handler* guaclog_instruction_handler_map[GUAC_OPCODE_COUNT];
 
 /**
  * Handles the instruction having the given opcode and arguments, updating
@@ -81,7 +64,8 @@ extern guaclog_instruction_handler_mapping guaclog_instruction_handler_map[];
  *     The current state of the Guacamole input log interpreter.
  *
  * @param opcode
- *     The opcode of the instruction being handled.
+ *     The numeric ID of the opcode of the instruction being handled, as
+ *     assigned by the Guacamole parser.
  *
  * @param argc
  *     The number of arguments (excluding opcode) passed to the instruction
@@ -96,7 +80,7 @@ extern guaclog_instruction_handler_mapping guaclog_instruction_handler_map[];
  *     occurs.
  */
 int guaclog_handle_instruction(guaclog_state* state,
-        const char* opcode, int argc, char** argv);
+        guac_opcode opcode, int argc, char** argv);
 
 /**
  * Handler for the Guacamole "key" instruction.
@@ -24,6 +24,7 @@
 #include <guacamole/client.h>
 #include <guacamole/error.h>
 #include <guacamole/parser.h>
+#include <guacamole/recording.h>
 #include <guacamole/socket.h>
 
 #include <sys/stat.h>
@@ -62,7 +63,7 @@ static int guaclog_read_instructions(guaclog_state* state,
 
     /* Continuously read and handle all instructions */
     while (!guac_parser_read(parser, socket, -1)) {
-        guaclog_handle_instruction(state, parser->opcode,
+        guaclog_handle_instruction(state, parser->opcode_id,
                 parser->argc, parser->argv);
     }
 
@@ -123,12 +124,11 @@ int guaclog_interpret(const char* path, const char* out_path, bool force) {
         return 1;
     }
 
-    /* Obtain guac_socket wrapping file descriptor */
-    guac_socket* socket = guac_socket_open(fd);
+    /* Obtain guac_socket reading the recording, decompressing if needed */
+    guac_socket* socket = guac_recording_open_read(fd);
     if (socket == NULL) {
         guaclog_log(GUAC_LOG_ERROR, "%s: %s", path,
                 guac_status_string(guac_error));
-        close(fd);
         guaclog_state_free(state);
         return 1;
     }
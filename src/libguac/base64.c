@@ -0,0 +1,293 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "base64.h"
+#include "guacamole/cpu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * All characters of the base64 alphabet, indexed by the 6-bit values that
+ * they represent.
+ */
+static const char guac_base64_characters[64] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+    'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd',
+    'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's',
+    't', 'u', 'v', 'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', '+', '/'
+};
+
+/**
+ * Signature shared by all implementations of the bulk encoding performed by
+ * guac_base64_encode(). Each implementation encodes only complete groups of
+ * three bytes, never producing padding.
+ *
+ * @param data
+ *     The data to encode.
+ *
+ * @param groups
+ *     The number of complete three-byte groups to encode.
+ *
+ * @param encoded
+ *     The buffer that should receive exactly four characters for each group
+ *     encoded.
+ */
+typedef void guac_base64_encode_function(const unsigned char* restrict data,
+        size_t groups, char* restrict encoded);
+
+/**
+ * Portable implementation of the bulk encoding performed by
+ * guac_base64_encode(), which encodes one group of three bytes at a time.
+ */
+static void guac_base64_encode_scalar(const unsigned char* restrict data,
+        size_t groups, char* restrict encoded) {
+
+    for (; groups > 0; groups--) {
+
+        /* AAAAAAAA BBBBBBBB CCCCCCCC -> AAAAAA AABBBB BBBBCC CCCCCC */
+        uint32_t value = (data[0] << 16) | (data[1] << 8) | data[2];
+
+        encoded[0] = guac_base64_characters[(value >> 18) & 0x3F];
+        encoded[1] = guac_base64_characters[(value >> 12) & 0x3F];
+        encoded[2] = guac_base64_characters[(value >>  6) & 0x3F];
+        encoded[3] = guac_base64_characters[ value        & 0x3F];
+
+        data += 3;
+        encoded += 4;
+
+    }
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSSE3 implementation of the bulk encoding performed by
+ * guac_base64_encode(), which encodes four groups of three bytes at a time.
+ * As each iteration reads 16 bytes of input, the final groups that are not
+ * followed by at least four bytes of readable input are encoded by the scalar
+ * implementation.
+ */
+__attribute__((target("ssse3")))
+static void guac_base64_encode_ssse3(const unsigned char* restrict data,
+        size_t groups, char* restrict encoded) {
+
+    /* Places the bytes of each group within a 32-bit quantity in the order
+     * [B A C B], such that each 6-bit value can be moved into its own byte
+     * using 16-bit multiplications in place of variable shifts */
+    const __m128i shuffle = _mm_set_epi8(
+            10, 11,  9, 10,
+             7,  8,  6,  7,
+             4,  5,  3,  4,
+             1,  2,  0,  1);
+
+    /* Offsets added to each 6-bit value to produce the corresponding
+     * character, indexed by the range of the alphabet containing that value
+     * (see below) */
+    const __m128i offsets = _mm_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+    for (; groups >= 6; groups -= 4) {
+
+        __m128i in = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i*) data), shuffle);
+
+        /* Split into four 6-bit values per group, one per byte */
+        __m128i values = _mm_or_si128(
+                _mm_mulhi_epu16(
+                    _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                    _mm_set1_epi32(0x04000040)),
+                _mm_mullo_epi16(
+                    _mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                    _mm_set1_epi32(0x01000010)));
+
+        /* Classify each value by range: 0-25 become 13, 26-51 become 0, and
+         * 52-63 become 1-12 */
+        __m128i ranges = _mm_or_si128(
+                _mm_subs_epu8(values, _mm_set1_epi8(51)),
+                _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), values),
+                    _mm_set1_epi8(13)));
+
+        _mm_storeu_si128((__m128i*) encoded, _mm_add_epi8(values,
+                    _mm_shuffle_epi8(offsets, ranges)));
+
+        data += 12;
+        encoded += 16;
+
+    }
+
+    guac_base64_encode_scalar(data, groups, encoded);
+
+}
+
+/**
+ * AVX2 implementation of the bulk encoding performed by guac_base64_encode(),
+ * which encodes eight groups of three bytes at a time using the same approach
+ * as guac_base64_encode_ssse3(). Each 128-bit lane is loaded separately from
+ * consecutive 12-byte blocks, as AVX2 byte shuffles cannot move bytes between
+ * lanes. As each iteration reads 28 bytes of input, the final groups that are
+ * not followed by at least four bytes of readable input are encoded by the
+ * SSSE3 implementation.
+ */
+__attribute__((target("avx2")))
+static void guac_base64_encode_avx2(const unsigned char* restrict data,
+        size_t groups, char* restrict encoded) {
+
+    const __m256i shuffle = _mm256_set_epi8(
+            10, 11,  9, 10,
+             7,  8,  6,  7,
+             4,  5,  3,  4,
+             1,  2,  0,  1,
+            10, 11,  9, 10,
+             7,  8,  6,  7,
+             4,  5,  3,  4,
+             1,  2,  0,  1);
+
+    const __m256i offsets = _mm256_setr_epi8(
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+            '/' - 63, 'A', 0, 0);
+
+    for (; groups >= 10; groups -= 8) {
+
+        __m256i in = _mm256_shuffle_epi8(_mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) data)),
+                _mm_loadu_si128((const __m128i*) (data + 12)), 1), shuffle);
+
+        __m256i values = _mm256_or_si256(
+                _mm256_mulhi_epu16(
+                    _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)),
+                    _mm256_set1_epi32(0x04000040)),
+                _mm256_mullo_epi16(
+                    _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)),
+                    _mm256_set1_epi32(0x01000010)));
+
+        __m256i ranges = _mm256_or_si256(
+                _mm256_subs_epu8(values, _mm256_set1_epi8(51)),
+                _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), values),
+                    _mm256_set1_epi8(13)));
+
+        _mm256_storeu_si256((__m256i*) encoded, _mm256_add_epi8(values,
+                    _mm256_shuffle_epi8(offsets, ranges)));
+
+        data += 24;
+        encoded += 32;
+
+    }
+
+    guac_base64_encode_ssse3(data, groups, encoded);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of the bulk encoding performed by
+ * guac_base64_encode() that is supported by the current CPU.
+ *
+ * @return
+ *     The implementation of the bulk encoding performed by
+ *     guac_base64_encode() that should be used.
+ */
+static guac_base64_encode_function* guac_base64_encode_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_base64_encode_avx2;
+
+    if (guac_cpu_supports(GUAC_CPU_SSSE3))
+        return guac_base64_encode_ssse3;
+#endif
+
+    return guac_base64_encode_scalar;
+
+}
+
+/**
+ * Encodes the final one or two bytes of data which do not form a complete
+ * group of three bytes, padding the result with '=' characters.
+ *
+ * @param data
+ *     The remaining data to encode.
+ *
+ * @param remaining
+ *     The number of bytes remaining, which must be 1 or 2.
+ *
+ * @param encoded
+ *     The buffer that should receive exactly four characters.
+ */
+static void guac_base64_encode_remainder(const unsigned char* data,
+        size_t remaining, char* encoded) {
+
+    /* AAAAAAAA BBBBBBBB -> AAAAAA AABBBB BBBB-- ------ */
+    uint32_t value = data[0] << 16;
+    if (remaining == 2)
+        value |= data[1] << 8;
+
+    encoded[0] = guac_base64_characters[(value >> 18) & 0x3F];
+    encoded[1] = guac_base64_characters[(value >> 12) & 0x3F];
+    encoded[2] = (remaining == 2) ? guac_base64_characters[(value >> 6) & 0x3F] : '=';
+    encoded[3] = '=';
+
+}
+
+size_t guac_base64_encode(const void* restrict data, size_t length,
+        char* restrict encoded) {
+
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t groups = length / 3;
+
+    guac_base64_encode_function* impl = guac_base64_encode_select_impl();
+    impl(bytes, groups, encoded);
+
+    if (length % 3)
+        guac_base64_encode_remainder(bytes + groups * 3, length % 3,
+                encoded + groups * 4);
+
+    return GUAC_BASE64_ENCODED_LENGTH(length);
+
+}
+
+size_t guac_base64_encode_portable(const void* restrict data, size_t length,
+        char* restrict encoded) {
+
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t groups = length / 3;
+
+    guac_base64_encode_scalar(bytes, groups, encoded);
+
+    if (length % 3)
+        guac_base64_encode_remainder(bytes + groups * 3, length % 3,
+                encoded + groups * 4);
+
+    return GUAC_BASE64_ENCODED_LENGTH(length);
+
+}
+
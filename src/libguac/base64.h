@@ -0,0 +1,83 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_BASE64_H
+#define GUAC_BASE64_H
+
+/**
+ * Internal functions for encoding arbitrary binary data as base64.
+ *
+ * @file base64.h
+ */
+
+#include <stddef.h>
+
+/**
+ * Returns the number of characters required to represent the given number of
+ * bytes as base64, including any padding.
+ *
+ * @param length
+ *     The number of bytes of data to be encoded.
+ *
+ * @return
+ *     The number of base64 characters that the given number of bytes will
+ *     encode to.
+ */
+#define GUAC_BASE64_ENCODED_LENGTH(length) (((length) + 2) / 3 * 4)
+
+/**
+ * Encodes the given data as base64, padding the result with '=' characters
+ * if the length of the data is not a multiple of three. The encoded result
+ * is NOT null-terminated.
+ *
+ * Where supported by the current CPU, the bulk of the data is encoded using
+ * SSSE3 or AVX2 instructions. The implementation used is selected once, at
+ * runtime, with a portable scalar implementation used otherwise.
+ *
+ * @param data
+ *     The data to encode.
+ *
+ * @param length
+ *     The number of bytes of data to encode.
+ *
+ * @param encoded
+ *     The buffer that should receive the encoded data. This buffer must be
+ *     at least GUAC_BASE64_ENCODED_LENGTH(length) bytes long and must not
+ *     overlap the data being encoded.
+ *
+ * @return
+ *     The number of characters written to the encoded buffer, which will
+ *     always be exactly GUAC_BASE64_ENCODED_LENGTH(length).
+ */
+size_t guac_base64_encode(const void* restrict data, size_t length,
+        char* restrict encoded);
+
+/**
+ * Portable, scalar implementation of guac_base64_encode() that never uses
+ * SIMD instructions, regardless of what the current CPU supports. This
+ * function produces identical results to guac_base64_encode() and is exposed
+ * primarily for the sake of testing and benchmarking.
+ *
+ * @see guac_base64_encode()
+ */
+size_t guac_base64_encode_portable(const void* restrict data, size_t length,
+        char* restrict encoded);
+
+#endif
+
@@ -35,6 +35,7 @@
 #include "guacamole/timestamp.h"
 #include "guacamole/user.h"
 #include "id.h"
+#include "socket-queue.h"
 
 #include <dlfcn.h>
 #include <errno.h>
@@ -154,9 +155,63 @@ void guac_client_free_stream(guac_client* client, guac_stream* stream) {
 
 }
 
+/**
+ * Returns all users that have fallen too far behind the stream of frames to
+ * the list of pending users, such that they are resynchronized with the
+ * current state of the connection along with any newly-joined users. The
+ * write lock for the list of pending users must be held.
+ *
+ * @param client
+ *     The client whose lagging users should be returned to the list of
+ *     pending users.
+ */
+static void guac_client_demote_lagging_users(guac_client* client) {
+
+    guac_rwlock_acquire_write_lock(&(client->__users_lock));
+
+    guac_user* user = client->__users;
+    while (user != NULL) {
+
+        guac_user* next = user->__next;
+
+        if (guac_socket_queue_resync(user->socket)) {
+
+            guac_client_log(client, GUAC_LOG_DEBUG, "User \"%s\" has fallen "
+                    "too far behind and has skipped to the current frame.",
+                    user->user_id);
+
+            /* Remove from list of full users */
+            if (user->__prev != NULL)
+                user->__prev->__next = user->__next;
+            else
+                client->__users = user->__next;
+
+            if (user->__next != NULL)
+                user->__next->__prev = user->__prev;
+
+            /* Add to list of pending users */
+            user->__prev = NULL;
+            user->__next = client->__pending_users;
+
+            if (client->__pending_users != NULL)
+                client->__pending_users->__prev = user;
+
+            client->__pending_users = user;
+
+        }
+
+        user = next;
+
+    }
+
+    guac_rwlock_release_lock(&(client->__users_lock));
+
+}
+
 /**
  * Promote all pending users to full users, calling the join pending handler
- * before, if any.
+ * before, if any. Users that have fallen too far behind are first returned to
+ * the list of pending users so that they are resynchronized, as well.
  *
  * @param client
  *     The client for which all pending users should be promoted.
@@ -166,6 +221,9 @@ static void guac_client_promote_pending_users(guac_client* client) {
     /* Acquire the lock for reading and modifying the list of pending users */
     guac_rwlock_acquire_write_lock(&(client->__pending_users_lock));
 
+    /* Resynchronize any users that are skipping frames */
+    guac_client_demote_lagging_users(client);
+
     /* Skip user promotion entirely if there's no pending users */
     if (client->__pending_users == NULL)
         goto promotion_complete;
@@ -191,9 +249,11 @@ static void guac_client_promote_pending_users(guac_client* client) {
     /* The final user in the list, if any */
     guac_user* last_user = first_user;
 
-    /* Iterate through the pending users to find the final user */
+    /* Iterate through the pending users to find the final user, noting that
+     * any resynchronization of those users by the join handler is complete */
     guac_user* user = first_user;
     while (user != NULL) {
+        guac_socket_queue_resync_complete(user->socket);
         last_user = user;
         user = user->__next;
     }
@@ -798,8 +858,9 @@ void guac_client_stream_png(guac_client* client, guac_socket* socket,
     /* Declare stream as containing image data */
     guac_protocol_send_img(socket, stream, mode, layer, "image/png", x, y);
 
-    /* Write PNG data */
-    guac_png_write(socket, stream, surface);
+    /* Write PNG data, compressing more heavily as users fall behind */
+    guac_png_write(socket, stream, surface,
+            guac_png_suggest_level(guac_client_get_processing_lag(client)));
 
     /* Terminate stream */
     guac_protocol_send_end(socket, stream);
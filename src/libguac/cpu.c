@@ -0,0 +1,61 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "guacamole/cpu.h"
+
+#include <pthread.h>
+
+/**
+ * All guac_cpu_feature values supported by the current CPU, combined with
+ * bitwise OR. This is populated exactly once by guac_cpu_detect().
+ */
+static int guac_cpu_features = 0;
+
+/**
+ * Guard which ensures guac_cpu_detect() is invoked only once, via
+ * pthread_once.
+ */
+static pthread_once_t guac_cpu_features_init = PTHREAD_ONCE_INIT;
+
+/**
+ * Queries the current CPU for the instruction set extensions it supports,
+ * storing the result within guac_cpu_features. This function is invoked via
+ * pthread_once.
+ */
+static void guac_cpu_detect(void) {
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2"))
+        guac_cpu_features |= GUAC_CPU_SSE2;
+
+    if (__builtin_cpu_supports("ssse3"))
+        guac_cpu_features |= GUAC_CPU_SSSE3;
+
+    if (__builtin_cpu_supports("avx2"))
+        guac_cpu_features |= GUAC_CPU_AVX2;
+#endif
+
+}
+
+int guac_cpu_supports(guac_cpu_feature feature) {
+    pthread_once(&guac_cpu_features_init, guac_cpu_detect);
+    return (guac_cpu_features & feature) != 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-cache.h"
+#include "guacamole/client.h"
+#include "guacamole/mem.h"
+#include "guacamole/protocol.h"
+#include "guacamole/rect.h"
+
+#include <cairo/cairo.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The number of bytes in each pixel of the server-side copy of the cache.
+ */
+#define GUAC_DISPLAY_CACHE_BPP 4
+
+/**
+ * The width of the client-side buffer of the cache, in pixels.
+ */
+#define GUAC_DISPLAY_CACHE_WIDTH \
+    (GUAC_DISPLAY_CACHE_COLUMNS * GUAC_DISPLAY_CACHE_TILE_SIZE)
+
+/**
+ * The height of the client-side buffer of the cache, in pixels.
+ */
+#define GUAC_DISPLAY_CACHE_HEIGHT \
+    (GUAC_DISPLAY_CACHE_ROWS * GUAC_DISPLAY_CACHE_TILE_SIZE)
+
+/**
+ * The number of bytes in each row of the server-side copy of the cache.
+ */
+#define GUAC_DISPLAY_CACHE_STRIDE \
+    (GUAC_DISPLAY_CACHE_WIDTH * GUAC_DISPLAY_CACHE_BPP)
+
+/**
+ * The number of bytes in each row of a single tile.
+ */
+#define GUAC_DISPLAY_CACHE_TILE_STRIDE \
+    (GUAC_DISPLAY_CACHE_TILE_SIZE * GUAC_DISPLAY_CACHE_BPP)
+
+/**
+ * Returns a pointer to the first byte of the server-side copy of the given
+ * tile.
+ *
+ * @param cache
+ *     The cache containing the tile.
+ *
+ * @param entry
+ *     The tile to locate.
+ *
+ * @return
+ *     A pointer to the first byte of the image data of the given tile.
+ */
+static unsigned char* guac_display_cache_entry_data(guac_display_cache* cache,
+        const guac_display_cache_entry* entry) {
+
+    ptrdiff_t index = entry - cache->entries;
+    int column = index % GUAC_DISPLAY_CACHE_COLUMNS;
+    int row = index / GUAC_DISPLAY_CACHE_COLUMNS;
+
+    return cache->atlas
+        + (size_t) row * GUAC_DISPLAY_CACHE_TILE_SIZE * GUAC_DISPLAY_CACHE_STRIDE
+        + (size_t) column * GUAC_DISPLAY_CACHE_TILE_STRIDE;
+
+}
+
+/**
+ * Returns the hash table bucket that would contain the tile having the given
+ * hash.
+ *
+ * @param cache
+ *     The cache containing the hash table.
+ *
+ * @param hash
+ *     The hash of the tile.
+ *
+ * @return
+ *     A pointer to the head pointer of the relevant bucket.
+ */
+static guac_display_cache_entry** guac_display_cache_bucket(
+        guac_display_cache* cache, uint64_t hash) {
+
+    /* The hashes provided are polynomial hashes of the image data whose
+     * low-order bits are dominated by the final pixels hashed, so mix all
+     * bits into the bucket index */
+    hash ^= hash >> 32;
+    hash *= UINT64_C(0x9E3779B97F4A7C15);
+
+    return &cache->buckets[hash >> 54 & (GUAC_DISPLAY_CACHE_BUCKETS - 1)];
+
+}
+
+/**
+ * Marks the given tile as the most recently used tile within the cache,
+ * having been used during the current frame.
+ *
+ * @param cache
+ *     The cache containing the tile.
+ *
+ * @param entry
+ *     The tile to mark as used.
+ */
+static void guac_display_cache_touch(guac_display_cache* cache,
+        guac_display_cache_entry* entry) {
+
+    entry->last_used = cache->frame;
+
+    if (cache->most_recent == entry)
+        return;
+
+    /* Unlink from current position (the entry cannot be the most recently
+     * used, and so must have a more recently used neighbor) */
+    entry->more_recent->less_recent = entry->less_recent;
+    if (entry->less_recent != NULL)
+        entry->less_recent->more_recent = entry->more_recent;
+    else
+        cache->least_recent = entry->more_recent;
+
+    /* Relink as most recently used */
+    entry->more_recent = NULL;
+    entry->less_recent = cache->most_recent;
+    cache->most_recent->more_recent = entry;
+    cache->most_recent = entry;
+
+}
+
+/**
+ * Compares the given 64x64 region of image data with the server-side copy of
+ * the given tile.
+ *
+ * @param cache
+ *     The cache containing the tile.
+ *
+ * @param entry
+ *     The tile to compare against.
+ *
+ * @param data
+ *     A pointer to the first byte of the 64x64 region of 32-bit image data
+ *     to compare.
+ *
+ * @param stride
+ *     The number of bytes in each row of the given image data.
+ *
+ * @return
+ *     Non-zero if the image data is identical to that of the tile, zero
+ *     otherwise.
+ */
+static int guac_display_cache_entry_matches(guac_display_cache* cache,
+        const guac_display_cache_entry* entry, const unsigned char* data,
+        size_t stride) {
+
+    const unsigned char* cached = guac_display_cache_entry_data(cache, entry);
+
+    for (int y = 0; y < GUAC_DISPLAY_CACHE_TILE_SIZE; y++) {
+
+        if (memcmp(cached, data, GUAC_DISPLAY_CACHE_TILE_STRIDE))
+            return 0;
+
+        cached += GUAC_DISPLAY_CACHE_STRIDE;
+        data += stride;
+
+    }
+
+    return 1;
+
+}
+
+/**
+ * Searches the given cache for a tile identical to the given image data,
+ * without affecting the order in which tiles are replaced.
+ *
+ * @param cache
+ *     The cache to search.
+ *
+ * @param hash
+ *     The hash of the given image data.
+ *
+ * @param data
+ *     A pointer to the first byte of the 64x64 region of 32-bit image data
+ *     being searched for.
+ *
+ * @param stride
+ *     The number of bytes in each row of the given image data.
+ *
+ * @return
+ *     The matching tile, or NULL if there is no such tile.
+ */
+static guac_display_cache_entry* guac_display_cache_find(
+        guac_display_cache* cache, uint64_t hash,
+        const unsigned char* data, size_t stride) {
+
+    guac_display_cache_entry* entry = *guac_display_cache_bucket(cache, hash);
+    while (entry != NULL) {
+
+        if (entry->hash == hash
+                && guac_display_cache_entry_matches(cache, entry, data, stride))
+            return entry;
+
+        entry = entry->next_in_bucket;
+
+    }
+
+    return NULL;
+
+}
+
+void guac_display_cache_init(guac_display_cache* cache, guac_layer* buffer) {
+
+    memset(cache, 0, sizeof(guac_display_cache));
+    cache->buffer = buffer;
+    cache->atlas = guac_mem_zalloc(GUAC_DISPLAY_CACHE_STRIDE,
+            GUAC_DISPLAY_CACHE_HEIGHT);
+
+    /* Initially order all tiles such that they are filled in the same order
+     * as they are arranged within the client-side buffer, keeping the portion
+     * of the buffer in use as compact as possible */
+    for (int i = 0; i < GUAC_DISPLAY_CACHE_SIZE; i++) {
+        guac_display_cache_entry* entry = &cache->entries[i];
+        entry->more_recent = (i + 1 < GUAC_DISPLAY_CACHE_SIZE) ? entry + 1 : NULL;
+        entry->less_recent = (i > 0) ? entry - 1 : NULL;
+    }
+
+    cache->least_recent = &cache->entries[0];
+    cache->most_recent = &cache->entries[GUAC_DISPLAY_CACHE_SIZE - 1];
+
+}
+
+void guac_display_cache_destroy(guac_display_cache* cache) {
+    guac_mem_free(cache->atlas);
+}
+
+void guac_display_cache_begin_frame(guac_display_cache* cache) {
+
+    /* Tiles of the previous frame must never appear to have been used during
+     * the current frame, even once the counter wraps */
+    cache->frame++;
+    if (cache->frame == 0) {
+        for (int i = 0; i < GUAC_DISPLAY_CACHE_SIZE; i++)
+            cache->entries[i].last_used = 0;
+        cache->frame = 1;
+    }
+
+}
+
+const guac_display_cache_entry* guac_display_cache_lookup(
+        guac_display_cache* cache, uint64_t hash,
+        const unsigned char* data, size_t stride) {
+
+    cache->lookups++;
+
+    guac_display_cache_entry* entry = guac_display_cache_find(cache, hash,
+            data, stride);
+
+    if (entry == NULL)
+        return NULL;
+
+    guac_display_cache_touch(cache, entry);
+    cache->hits++;
+
+    return entry;
+
+}
+
+const guac_display_cache_entry* guac_display_cache_store(
+        guac_display_cache* cache, uint64_t hash,
+        const unsigned char* data, size_t stride) {
+
+    /* Refresh rather than duplicate any identical tile */
+    guac_display_cache_entry* entry = guac_display_cache_find(cache, hash,
+            data, stride);
+
+    if (entry != NULL) {
+        guac_display_cache_touch(cache, entry);
+        return NULL;
+    }
+
+    /* Never replace a tile that the current frame may depend upon */
+    entry = cache->least_recent;
+    if (entry->occupied && entry->last_used == cache->frame)
+        return NULL;
+
+    /* Remove the tile being replaced from the hash table */
+    if (entry->occupied) {
+        guac_display_cache_entry** current = guac_display_cache_bucket(cache, entry->hash);
+        while (*current != entry)
+            current = &(*current)->next_in_bucket;
+        *current = entry->next_in_bucket;
+    }
+
+    /* Copy image data into place */
+    unsigned char* cached = guac_display_cache_entry_data(cache, entry);
+    for (int y = 0; y < GUAC_DISPLAY_CACHE_TILE_SIZE; y++) {
+        memcpy(cached, data, GUAC_DISPLAY_CACHE_TILE_STRIDE);
+        cached += GUAC_DISPLAY_CACHE_STRIDE;
+        data += stride;
+    }
+
+    /* Add the new tile to the hash table */
+    guac_display_cache_entry** bucket = guac_display_cache_bucket(cache, hash);
+    entry->hash = hash;
+    entry->occupied = 1;
+    entry->next_in_bucket = *bucket;
+    *bucket = entry;
+
+    guac_display_cache_touch(cache, entry);
+    cache->stores++;
+
+    return entry;
+
+}
+
+void guac_display_cache_entry_rect(const guac_display_cache* cache,
+        const guac_display_cache_entry* entry, guac_rect* rect) {
+
+    ptrdiff_t index = entry - cache->entries;
+    int column = index % GUAC_DISPLAY_CACHE_COLUMNS;
+    int row = index / GUAC_DISPLAY_CACHE_COLUMNS;
+
+    guac_rect_init(rect,
+            column * GUAC_DISPLAY_CACHE_TILE_SIZE,
+            row * GUAC_DISPLAY_CACHE_TILE_SIZE,
+            GUAC_DISPLAY_CACHE_TILE_SIZE, GUAC_DISPLAY_CACHE_TILE_SIZE);
+
+}
+
+void guac_display_cache_dup(guac_display_cache* cache, guac_client* client,
+        guac_socket* socket) {
+
+    /* Determine the number of rows of tiles actually in use */
+    int rows = 0;
+    for (int i = 0; i < GUAC_DISPLAY_CACHE_SIZE; i++) {
+        if (cache->entries[i].occupied)
+            rows = i / GUAC_DISPLAY_CACHE_COLUMNS + 1;
+    }
+
+    if (!rows)
+        return;
+
+    cairo_surface_t* atlas = cairo_image_surface_create_for_data(cache->atlas,
+            CAIRO_FORMAT_RGB24, GUAC_DISPLAY_CACHE_WIDTH,
+            rows * GUAC_DISPLAY_CACHE_TILE_SIZE, GUAC_DISPLAY_CACHE_STRIDE);
+
+    guac_client_stream_png(client, socket, GUAC_COMP_OVER, cache->buffer,
+            0, 0, atlas);
+
+    cairo_surface_destroy(atlas);
+
+}
@@ -0,0 +1,316 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_DISPLAY_CACHE_H
+#define GUAC_DISPLAY_CACHE_H
+
+#include "guacamole/client-types.h"
+#include "guacamole/layer-types.h"
+#include "guacamole/rect.h"
+#include "guacamole/socket-types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The width and height of each tile stored within a guac_display_cache, in
+ * pixels. This MUST match GUAC_DISPLAY_CELL_SIZE, as the tiles cached are
+ * the cells of display layers.
+ */
+#define GUAC_DISPLAY_CACHE_TILE_SIZE 64
+
+/**
+ * The number of columns of tiles within the client-side buffer backing a
+ * guac_display_cache.
+ */
+#define GUAC_DISPLAY_CACHE_COLUMNS 32
+
+/**
+ * The number of rows of tiles within the client-side buffer backing a
+ * guac_display_cache.
+ */
+#define GUAC_DISPLAY_CACHE_ROWS 16
+
+/**
+ * The total number of tiles that a guac_display_cache can hold. With 64x64
+ * tiles, the current value of 512 tiles is enough to hold roughly the entire
+ * contents of a 1920x1080 display, requiring 8 MB of memory both on the
+ * server and within each connected client.
+ */
+#define GUAC_DISPLAY_CACHE_SIZE \
+    (GUAC_DISPLAY_CACHE_COLUMNS * GUAC_DISPLAY_CACHE_ROWS)
+
+/**
+ * The number of buckets within the hash table used to locate cached tiles by
+ * hash. This MUST be a power of two.
+ */
+#define GUAC_DISPLAY_CACHE_BUCKETS 1024
+
+/**
+ * The minimum amount of time that the contents of a cell must have remained
+ * unchanged before those contents are considered worth caching once they are
+ * replaced, in milliseconds. Contents that are replaced more quickly than
+ * this (such as the frames of a video) are unlikely to be seen again and
+ * would only evict more useful tiles.
+ */
+#define GUAC_DISPLAY_CACHE_MIN_AGE 250
+
+/**
+ * A single tile within a guac_display_cache. The location of the tile within
+ * the cache is determined by the position of the entry within the entries
+ * array of the cache.
+ */
+typedef struct guac_display_cache_entry {
+
+    /**
+     * The hash of the contents of this tile, as produced by the same hashing
+     * algorithm used to search for copies within a display plan.
+     */
+    uint64_t hash;
+
+    /**
+     * Non-zero if this tile currently contains cached image data, zero if
+     * the tile is unused.
+     */
+    int occupied;
+
+    /**
+     * The value of the frame counter of the cache at the time this tile was
+     * last stored or matched by a lookup.
+     */
+    unsigned int last_used;
+
+    /**
+     * The next entry within the same hash table bucket, or NULL if this is
+     * the last such entry.
+     */
+    struct guac_display_cache_entry* next_in_bucket;
+
+    /**
+     * The entry that was used more recently than this entry, or NULL if this
+     * is the most recently used entry.
+     */
+    struct guac_display_cache_entry* more_recent;
+
+    /**
+     * The entry that was used less recently than this entry, or NULL if this
+     * is the least recently used entry.
+     */
+    struct guac_display_cache_entry* less_recent;
+
+} guac_display_cache_entry;
+
+/**
+ * A bounded, least-recently-used cache of 64x64 tiles of image data that
+ * have previously been sent to connected clients, keyed by the hash of their
+ * contents. The tiles are stored client-side within a single off-screen
+ * buffer, arranged in a grid of GUAC_DISPLAY_CACHE_COLUMNS by
+ * GUAC_DISPLAY_CACHE_ROWS tiles, such that any cached tile can be redrawn
+ * with a simple copy rather than being encoded and sent again. An identical
+ * copy of that buffer is maintained server-side to guard against hash
+ * collisions and to allow newly-joined users to be synchronized.
+ *
+ * The cache is not internally synchronized. It is modified only while
+ * planning a frame, while the display's last_frame.lock is held for writing.
+ */
+typedef struct guac_display_cache {
+
+    /**
+     * The client-side buffer containing all cached tiles.
+     */
+    guac_layer* buffer;
+
+    /**
+     * Server-side copy of the contents of the client-side buffer, in 32-bit
+     * RGB format, with GUAC_DISPLAY_CACHE_COLUMNS * GUAC_DISPLAY_CACHE_TILE_SIZE
+     * pixels in each row.
+     */
+    unsigned char* atlas;
+
+    /**
+     * All tiles within the cache, in the order they are arranged within the
+     * client-side buffer (left-to-right, top-to-bottom).
+     */
+    guac_display_cache_entry entries[GUAC_DISPLAY_CACHE_SIZE];
+
+    /**
+     * Hash table of all occupied entries, indexed by the low-order bits of
+     * their hashes. Each bucket is a list chained through the next_in_bucket
+     * member of each entry.
+     */
+    guac_display_cache_entry* buckets[GUAC_DISPLAY_CACHE_BUCKETS];
+
+    /**
+     * The most recently used entry.
+     */
+    guac_display_cache_entry* most_recent;
+
+    /**
+     * The least recently used entry. This is the next entry that will be
+     * replaced when a new tile is stored.
+     */
+    guac_display_cache_entry* least_recent;
+
+    /**
+     * The number of frames that have begun since the cache was initialized,
+     * as counted by guac_display_cache_begin_frame().
+     */
+    unsigned int frame;
+
+    /**
+     * The total number of lookups performed by guac_display_cache_lookup().
+     */
+    uint64_t lookups;
+
+    /**
+     * The total number of lookups performed by guac_display_cache_lookup()
+     * that located a matching tile.
+     */
+    uint64_t hits;
+
+    /**
+     * The total number of tiles newly stored by guac_display_cache_store().
+     */
+    uint64_t stores;
+
+} guac_display_cache;
+
+/**
+ * Initializes the given cache such that it contains no tiles. The cache must
+ * eventually be destroyed with guac_display_cache_destroy().
+ *
+ * @param cache
+ *     The cache to initialize.
+ *
+ * @param buffer
+ *     The client-side buffer that should contain the cached tiles.
+ */
+void guac_display_cache_init(guac_display_cache* cache, guac_layer* buffer);
+
+/**
+ * Releases all server-side resources associated with the given cache. The
+ * client-side buffer of the cache is not freed.
+ *
+ * @param cache
+ *     The cache to destroy.
+ */
+void guac_display_cache_destroy(guac_display_cache* cache);
+
+/**
+ * Notifies the given cache that a new frame is being planned. Tiles that are
+ * stored or matched during a frame are not replaced by further tiles stored
+ * during that same frame, as operations of that frame may depend on them.
+ *
+ * @param cache
+ *     The cache to update.
+ */
+void guac_display_cache_begin_frame(guac_display_cache* cache);
+
+/**
+ * Searches the given cache for a tile identical to the given 64x64 region of
+ * image data, marking that tile as the most recently used if found.
+ *
+ * @param cache
+ *     The cache to search.
+ *
+ * @param hash
+ *     The hash of the given image data.
+ *
+ * @param data
+ *     A pointer to the first byte of the 64x64 region of 32-bit image data
+ *     being searched for.
+ *
+ * @param stride
+ *     The number of bytes in each row of the given image data.
+ *
+ * @return
+ *     The matching tile, or NULL if no tile within the cache contains
+ *     identical image data.
+ */
+const guac_display_cache_entry* guac_display_cache_lookup(
+        guac_display_cache* cache, uint64_t hash,
+        const unsigned char* data, size_t stride);
+
+/**
+ * Stores the given 64x64 region of image data within the server-side copy of
+ * the given cache, replacing the least recently used tile. If an identical
+ * tile is already cached, that tile is marked as most recently used and
+ * nothing is stored. If the least recently used tile has itself been used
+ * during the current frame, the cache is considered full for the remainder
+ * of the frame and nothing is stored.
+ *
+ * If a tile is returned, the caller is responsible for copying the same
+ * image data into the corresponding region of the client-side buffer, as
+ * given by guac_display_cache_entry_rect().
+ *
+ * @param cache
+ *     The cache to store the image data within.
+ *
+ * @param hash
+ *     The hash of the given image data.
+ *
+ * @param data
+ *     A pointer to the first byte of the 64x64 region of 32-bit image data
+ *     to store.
+ *
+ * @param stride
+ *     The number of bytes in each row of the given image data.
+ *
+ * @return
+ *     The tile that now contains the given image data and must be updated
+ *     client-side, or NULL if nothing was stored.
+ */
+const guac_display_cache_entry* guac_display_cache_store(
+        guac_display_cache* cache, uint64_t hash,
+        const unsigned char* data, size_t stride);
+
+/**
+ * Initializes the given rectangle with the bounds of the given tile within
+ * the client-side buffer of the given cache.
+ *
+ * @param cache
+ *     The cache containing the tile.
+ *
+ * @param entry
+ *     The tile whose bounds should be determined.
+ *
+ * @param rect
+ *     The rectangle to initialize.
+ */
+void guac_display_cache_entry_rect(const guac_display_cache* cache,
+        const guac_display_cache_entry* entry, guac_rect* rect);
+
+/**
+ * Sends the contents of all cached tiles to the given socket, such that a
+ * newly-joined user's copy of the client-side buffer matches that of all
+ * other users. Nothing is sent if the cache is empty.
+ *
+ * @param cache
+ *     The cache to synchronize.
+ *
+ * @param client
+ *     The client that the cache belongs to.
+ *
+ * @param socket
+ *     The socket of the newly-joined user(s).
+ */
+void guac_display_cache_dup(guac_display_cache* cache, guac_client* client,
+        guac_socket* socket);
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-encoder.h"
+#include "guacamole/timestamp.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * The number of nanoseconds in each millisecond.
+ */
+#define GUAC_DISPLAY_ENCODER_NANOS_PER_MILLI 1000000
+
+/**
+ * The initial estimates of the cost of encoding a single pixel with each
+ * encoder and for each content class, in nanoseconds, used until real
+ * timings have been observed. These values are deliberately rough; they need
+ * only order the encoders sensibly until the model has learned actual costs.
+ */
+static const double GUAC_DISPLAY_ENCODER_DEFAULT_COST
+        [GUAC_DISPLAY_ENCODER_COUNT][GUAC_DISPLAY_CONTENT_CLASS_COUNT] = {
+    [GUAC_DISPLAY_ENCODER_PNG]  = { [GUAC_DISPLAY_CONTENT_FLAT] = 15.0, [GUAC_DISPLAY_CONTENT_PHOTO] = 60.0 },
+    [GUAC_DISPLAY_ENCODER_JPEG] = { [GUAC_DISPLAY_CONTENT_FLAT] =  8.0, [GUAC_DISPLAY_CONTENT_PHOTO] = 10.0 },
+    [GUAC_DISPLAY_ENCODER_WEBP] = { [GUAC_DISPLAY_CONTENT_FLAT] = 30.0, [GUAC_DISPLAY_CONTENT_PHOTO] = 45.0 }
+};
+
+/**
+ * The order in which encoders are considered when lossless encoding is
+ * preferred.
+ */
+static const guac_display_encoder GUAC_DISPLAY_ENCODER_LOSSLESS_ORDER[] = {
+    GUAC_DISPLAY_ENCODER_PNG,
+    GUAC_DISPLAY_ENCODER_WEBP,
+    GUAC_DISPLAY_ENCODER_JPEG
+};
+
+/**
+ * The order in which encoders are considered when lossy encoding is
+ * preferred. This matches the order in which the display worker considered
+ * each format prior to the introduction of the encoder model: WebP whenever
+ * supported, followed by JPEG, followed by PNG.
+ */
+static const guac_display_encoder GUAC_DISPLAY_ENCODER_LOSSY_ORDER[] = {
+    GUAC_DISPLAY_ENCODER_WEBP,
+    GUAC_DISPLAY_ENCODER_JPEG,
+    GUAC_DISPLAY_ENCODER_PNG
+};
+
+/**
+ * Returns the order in which encoders should be considered, from most
+ * preferred to least preferred, for content of the given class.
+ *
+ * @param prefer_lossless
+ *     Non-zero if lossless encoding should be preferred regardless of the
+ *     content class, zero otherwise.
+ *
+ * @param content_class
+ *     The class of the image contents being encoded.
+ *
+ * @return
+ *     An array of all GUAC_DISPLAY_ENCODER_COUNT encoders, ordered from most
+ *     preferred to least preferred.
+ */
+static const guac_display_encoder* guac_display_encoder_order(int prefer_lossless,
+        guac_display_content_class content_class) {
+
+    if (prefer_lossless || content_class == GUAC_DISPLAY_CONTENT_FLAT)
+        return GUAC_DISPLAY_ENCODER_LOSSLESS_ORDER;
+
+    return GUAC_DISPLAY_ENCODER_LOSSY_ORDER;
+
+}
+
+void guac_display_encoder_model_init(guac_display_encoder_model* model) {
+
+    pthread_mutex_init(&model->lock, NULL);
+
+    for (int encoder = 0; encoder < GUAC_DISPLAY_ENCODER_COUNT; encoder++) {
+        for (int content_class = 0; content_class < GUAC_DISPLAY_CONTENT_CLASS_COUNT; content_class++) {
+            model->cost[encoder][content_class] = GUAC_DISPLAY_ENCODER_DEFAULT_COST[encoder][content_class];
+            model->samples[encoder][content_class] = 0;
+        }
+    }
+
+    model->last_frame_end = 0;
+    model->frame_budget = GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET;
+    model->frame_dirty_size = 0;
+    model->frame_parallelism = 1;
+
+}
+
+void guac_display_encoder_model_destroy(guac_display_encoder_model* model) {
+    pthread_mutex_destroy(&model->lock);
+}
+
+void guac_display_encoder_model_begin_frame(guac_display_encoder_model* model,
+        guac_timestamp frame_end, size_t dirty_size, unsigned int parallelism) {
+
+    pthread_mutex_lock(&model->lock);
+
+    /* Assume the next frame will follow this one after the same interval
+     * that this frame followed the last */
+    uint64_t budget = GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET;
+    if (model->last_frame_end && frame_end > model->last_frame_end)
+        budget = (uint64_t) (frame_end - model->last_frame_end)
+            * GUAC_DISPLAY_ENCODER_NANOS_PER_MILLI;
+
+    if (budget < GUAC_DISPLAY_ENCODER_MIN_FRAME_BUDGET)
+        budget = GUAC_DISPLAY_ENCODER_MIN_FRAME_BUDGET;
+    else if (budget > GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET)
+        budget = GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET;
+
+    model->last_frame_end = frame_end;
+    model->frame_budget = budget;
+    model->frame_dirty_size = dirty_size;
+    model->frame_parallelism = parallelism ? parallelism : 1;
+
+    pthread_mutex_unlock(&model->lock);
+
+}
+
+void guac_display_encoder_model_select(guac_display_encoder_model* model,
+        int candidates, int lossless_candidates, int prefer_lossless,
+        guac_display_content_class content_class, size_t pixels,
+        size_t dirty_size, int quality, guac_display_encoder_choice* choice) {
+
+    /* PNG can encode anything, and always does so losslessly */
+    candidates |= 1 << GUAC_DISPLAY_ENCODER_PNG;
+    lossless_candidates = (lossless_candidates & candidates)
+        | (1 << GUAC_DISPLAY_ENCODER_PNG);
+
+    choice->content_class = content_class;
+    choice->pixels = pixels;
+
+    pthread_mutex_lock(&model->lock);
+
+    /* Each operation receives a share of the frame budget proportional to
+     * its number of changed pixels, scaled by the number of operations that
+     * may be encoded concurrently. No single operation can use more than the
+     * entire frame budget, as it is encoded by a single thread. */
+    uint64_t budget = model->frame_budget;
+    if (model->frame_dirty_size > dirty_size) {
+        double share = (double) model->frame_parallelism * dirty_size
+            / model->frame_dirty_size;
+        if (share < 1.0)
+            budget = (uint64_t) (budget * share);
+    }
+
+    choice->budget = budget;
+
+    for (int encoder = 0; encoder < GUAC_DISPLAY_ENCODER_COUNT; encoder++) {
+        if (candidates & (1 << encoder))
+            choice->predicted[encoder] = (uint64_t) (model->cost[encoder][content_class] * pixels);
+        else
+            choice->predicted[encoder] = 0;
+    }
+
+    pthread_mutex_unlock(&model->lock);
+
+    const guac_display_encoder* order = guac_display_encoder_order(
+            prefer_lossless, content_class);
+
+    /* If no encoder is expected to finish in time, content that should be
+     * lossless must still be encoded losslessly, as nothing will later
+     * replace any lossy artifacts within regions that rarely change */
+    int fallback_candidates = candidates;
+    if (prefer_lossless || content_class == GUAC_DISPLAY_CONTENT_FLAT)
+        fallback_candidates = lossless_candidates;
+
+    /* Use the most preferred encoder that is expected to finish in time,
+     * tracking the fastest acceptable encoder in case none will */
+    int fastest = -1;
+    for (int i = 0; i < GUAC_DISPLAY_ENCODER_COUNT; i++) {
+
+        guac_display_encoder encoder = order[i];
+        if (!(candidates & (1 << encoder)))
+            continue;
+
+        if (choice->predicted[encoder] <= budget) {
+            choice->encoder = encoder;
+            choice->quality = quality;
+            return;
+        }
+
+        if (!(fallback_candidates & (1 << encoder)))
+            continue;
+
+        if (fastest == -1 || choice->predicted[encoder] < choice->predicted[fastest])
+            fastest = encoder;
+
+    }
+
+    choice->encoder = fastest;
+    choice->quality = quality;
+
+    /* Trade away quality in proportion to the expected overrun, reducing the
+     * amount of data that must be produced and transmitted */
+    if (!(lossless_candidates & (1 << fastest))) {
+
+        choice->quality = (int) ((double) quality * budget / choice->predicted[fastest]);
+
+        if (choice->quality < GUAC_DISPLAY_ENCODER_MIN_QUALITY)
+            choice->quality = GUAC_DISPLAY_ENCODER_MIN_QUALITY;
+
+        if (choice->quality > quality)
+            choice->quality = quality;
+
+    }
+
+}
+
+guac_display_encoder guac_display_encoder_preferred(int candidates,
+        int prefer_lossless, guac_display_content_class content_class) {
+
+    const guac_display_encoder* order = guac_display_encoder_order(
+            prefer_lossless, content_class);
+
+    for (int i = 0; i < GUAC_DISPLAY_ENCODER_COUNT; i++) {
+        if (candidates & (1 << order[i]))
+            return order[i];
+    }
+
+    /* PNG can encode anything */
+    return GUAC_DISPLAY_ENCODER_PNG;
+
+}
+
+void guac_display_encoder_model_record(guac_display_encoder_model* model,
+        const guac_display_encoder_choice* choice, uint64_t elapsed) {
+
+    if (!choice->pixels)
+        return;
+
+    double sample = (double) elapsed / choice->pixels;
+
+    pthread_mutex_lock(&model->lock);
+
+    double* cost = &model->cost[choice->encoder][choice->content_class];
+    unsigned int* samples = &model->samples[choice->encoder][choice->content_class];
+
+    /* Weigh early samples more heavily, such that the default costs are
+     * quickly replaced with real measurements, then settle into a moving
+     * average that tolerates outliers */
+    unsigned int weight = *samples + 1;
+    if (weight > GUAC_DISPLAY_ENCODER_SAMPLE_WEIGHT)
+        weight = GUAC_DISPLAY_ENCODER_SAMPLE_WEIGHT;
+
+    *cost += (sample - *cost) / weight;
+    if (*samples < UINT_MAX)
+        (*samples)++;
+
+    pthread_mutex_unlock(&model->lock);
+
+}
+
+uint64_t guac_display_encoder_clock(void) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+}
+
+const char* guac_display_encoder_name(guac_display_encoder encoder) {
+
+    switch (encoder) {
+
+        case GUAC_DISPLAY_ENCODER_PNG:
+            return "PNG";
+
+        case GUAC_DISPLAY_ENCODER_JPEG:
+            return "JPEG";
+
+        case GUAC_DISPLAY_ENCODER_WEBP:
+            return "WebP";
+
+        default:
+            return "unknown";
+
+    }
+
+}
@@ -0,0 +1,353 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_DISPLAY_ENCODER_H
+#define GUAC_DISPLAY_ENCODER_H
+
+#include "guacamole/timestamp.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The shortest time that will be assumed to be available for encoding a
+ * single frame, in nanoseconds, regardless of how quickly frames are
+ * arriving. This prevents bursts of closely-spaced frames from starving the
+ * encoder of any budget at all.
+ */
+#define GUAC_DISPLAY_ENCODER_MIN_FRAME_BUDGET 5000000
+
+/**
+ * The longest time that will be assumed to be available for encoding a
+ * single frame, in nanoseconds. Frames that follow a long period of
+ * inactivity are given this budget rather than the entire idle period.
+ */
+#define GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET 250000000
+
+/**
+ * The weight given to each new timing sample when updating the learned cost
+ * of an encoder, expressed as the reciprocal of that weight. A value of 8
+ * means each new sample contributes 1/8 of the updated estimate.
+ */
+#define GUAC_DISPLAY_ENCODER_SAMPLE_WEIGHT 8
+
+/**
+ * The lowest quality that will be requested of any lossy encoder.
+ */
+#define GUAC_DISPLAY_ENCODER_MIN_QUALITY 30
+
+/**
+ * The image encoders that may be used to send image data to connected
+ * clients.
+ */
+typedef enum guac_display_encoder {
+
+    /**
+     * Lossless PNG encoding.
+     */
+    GUAC_DISPLAY_ENCODER_PNG,
+
+    /**
+     * Lossy JPEG encoding.
+     */
+    GUAC_DISPLAY_ENCODER_JPEG,
+
+    /**
+     * WebP encoding, which is lossy unless lossless encoding is specifically
+     * required.
+     */
+    GUAC_DISPLAY_ENCODER_WEBP,
+
+    /**
+     * The number of values in this enum. This is not a valid encoder.
+     */
+    GUAC_DISPLAY_ENCODER_COUNT
+
+} guac_display_encoder;
+
+/**
+ * Broad classification of image contents that significantly affects the
+ * relative cost and efficiency of each encoder.
+ */
+typedef enum guac_display_content_class {
+
+    /**
+     * Content dominated by runs of identical pixels, such as text, window
+     * decorations, and other typical user interface elements.
+     */
+    GUAC_DISPLAY_CONTENT_FLAT,
+
+    /**
+     * Content with little repetition between adjacent pixels, such as
+     * photographs and video.
+     */
+    GUAC_DISPLAY_CONTENT_PHOTO,
+
+    /**
+     * The number of values in this enum. This is not a valid content class.
+     */
+    GUAC_DISPLAY_CONTENT_CLASS_COUNT
+
+} guac_display_content_class;
+
+/**
+ * The encoder and quality chosen for a single image operation by
+ * guac_display_encoder_model_select(), along with the estimates that led to
+ * that choice.
+ */
+typedef struct guac_display_encoder_choice {
+
+    /**
+     * The encoder that should be used.
+     */
+    guac_display_encoder encoder;
+
+    /**
+     * The quality that should be requested of the encoder, between 0 and 100
+     * inclusive. This value is meaningful only for lossy encoders.
+     */
+    int quality;
+
+    /**
+     * The content class of the image being encoded.
+     */
+    guac_display_content_class content_class;
+
+    /**
+     * The number of pixels that will be encoded.
+     */
+    size_t pixels;
+
+    /**
+     * The portion of the current frame's time budget allotted to this
+     * operation, in nanoseconds.
+     */
+    uint64_t budget;
+
+    /**
+     * The predicted time required by each encoder to encode this operation,
+     * in nanoseconds, indexed by guac_display_encoder. Encoders that were
+     * not candidates for this operation have a predicted time of zero.
+     */
+    uint64_t predicted[GUAC_DISPLAY_ENCODER_COUNT];
+
+} guac_display_encoder_choice;
+
+/**
+ * Adaptive model of the time taken by each encoder to encode each class of
+ * content, learned from the actual encoding times of previous operations,
+ * along with the time budget of the frame currently being encoded.
+ */
+typedef struct guac_display_encoder_model {
+
+    /**
+     * Lock which guards all other members of this structure.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * The learned average cost of encoding a single pixel with each encoder
+     * and for each content class, in nanoseconds.
+     */
+    double cost[GUAC_DISPLAY_ENCODER_COUNT][GUAC_DISPLAY_CONTENT_CLASS_COUNT];
+
+    /**
+     * The number of timing samples that have contributed to each value in
+     * the cost array.
+     */
+    unsigned int samples[GUAC_DISPLAY_ENCODER_COUNT][GUAC_DISPLAY_CONTENT_CLASS_COUNT];
+
+    /**
+     * The time that the previous frame ended, or zero if no frame has yet
+     * been encoded.
+     */
+    guac_timestamp last_frame_end;
+
+    /**
+     * The total time available for encoding the current frame, in
+     * nanoseconds.
+     */
+    uint64_t frame_budget;
+
+    /**
+     * The total number of changed pixels within all image operations of the
+     * current frame.
+     */
+    size_t frame_dirty_size;
+
+    /**
+     * The number of image operations of the current frame that may be
+     * encoded concurrently.
+     */
+    unsigned int frame_parallelism;
+
+} guac_display_encoder_model;
+
+/**
+ * Initializes the given encoder model with conservative default costs. The
+ * model must eventually be destroyed with guac_display_encoder_model_destroy().
+ *
+ * @param model
+ *     The model to initialize.
+ */
+void guac_display_encoder_model_init(guac_display_encoder_model* model);
+
+/**
+ * Releases any resources associated with the given encoder model.
+ *
+ * @param model
+ *     The model to destroy.
+ */
+void guac_display_encoder_model_destroy(guac_display_encoder_model* model);
+
+/**
+ * Notifies the given encoder model that a new frame is about to be encoded,
+ * establishing the time budget of that frame. The budget is the time elapsed
+ * since the previous frame ended, as that is the best available estimate of
+ * when the next frame will be due.
+ *
+ * @param model
+ *     The model to update.
+ *
+ * @param frame_end
+ *     The time that the new frame ended.
+ *
+ * @param dirty_size
+ *     The total number of changed pixels within all image operations of the
+ *     new frame.
+ *
+ * @param parallelism
+ *     The number of image operations of the new frame that may be encoded
+ *     concurrently.
+ */
+void guac_display_encoder_model_begin_frame(guac_display_encoder_model* model,
+        guac_timestamp frame_end, size_t dirty_size, unsigned int parallelism);
+
+/**
+ * Chooses the encoder and quality for a single image operation of the
+ * current frame. The operation is allotted a share of the frame's time
+ * budget in proportion to its number of changed pixels. The first encoder
+ * in order of preference that is predicted to finish within that share is
+ * chosen. If no encoder fits, the encoder predicted to be fastest is chosen,
+ * and the quality of any lossy encoder is reduced in proportion to the
+ * overrun. If lossless encoding is preferred, or the content is
+ * GUAC_DISPLAY_CONTENT_FLAT, that fallback is restricted to lossless
+ * encoders, as lossy artifacts within such content would never be replaced.
+ *
+ * @param model
+ *     The model to consult.
+ *
+ * @param candidates
+ *     A bitwise OR of (1 << encoder) for each guac_display_encoder that may
+ *     be used for this operation. PNG is always considered a candidate.
+ *
+ * @param lossless_candidates
+ *     A bitwise OR of (1 << encoder) for each candidate that will encode
+ *     this operation losslessly. PNG is always considered lossless.
+ *
+ * @param prefer_lossless
+ *     Non-zero if lossless encoding should be preferred where the budget
+ *     allows, zero if lossy encoding should be preferred. Regardless of this
+ *     value, lossless encoding is preferred for GUAC_DISPLAY_CONTENT_FLAT
+ *     content.
+ *
+ * @param content_class
+ *     The class of the image contents being encoded.
+ *
+ * @param pixels
+ *     The number of pixels that will be encoded.
+ *
+ * @param dirty_size
+ *     The number of those pixels that have actually changed.
+ *
+ * @param quality
+ *     The quality that would be requested of lossy encoders if budget were
+ *     not a concern, between 0 and 100 inclusive.
+ *
+ * @param choice
+ *     The structure that should receive the chosen encoder and quality.
+ */
+void guac_display_encoder_model_select(guac_display_encoder_model* model,
+        int candidates, int lossless_candidates, int prefer_lossless,
+        guac_display_content_class content_class, size_t pixels,
+        size_t dirty_size, int quality, guac_display_encoder_choice* choice);
+
+/**
+ * Returns the encoder that guac_display_encoder_model_select() would choose
+ * for the given content if the frame budget were not a concern.
+ *
+ * @param candidates
+ *     A bitwise OR of (1 << encoder) for each guac_display_encoder that may
+ *     be used. PNG is used if no other encoder is a candidate.
+ *
+ * @param prefer_lossless
+ *     Non-zero if lossless encoding should be preferred, zero if lossy
+ *     encoding should be preferred. Regardless of this value, lossless
+ *     encoding is preferred for GUAC_DISPLAY_CONTENT_FLAT content.
+ *
+ * @param content_class
+ *     The class of the image contents being encoded.
+ *
+ * @return
+ *     The most preferred encoder among the given candidates.
+ */
+guac_display_encoder guac_display_encoder_preferred(int candidates,
+        int prefer_lossless, guac_display_content_class content_class);
+
+/**
+ * Updates the learned cost of the encoder and content class of the given
+ * choice using the time actually taken to encode the corresponding
+ * operation.
+ *
+ * @param model
+ *     The model to update.
+ *
+ * @param choice
+ *     The choice previously returned by guac_display_encoder_model_select()
+ *     for the operation that was encoded.
+ *
+ * @param elapsed
+ *     The time actually taken to encode the operation, in nanoseconds.
+ */
+void guac_display_encoder_model_record(guac_display_encoder_model* model,
+        const guac_display_encoder_choice* choice, uint64_t elapsed);
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds, suitable
+ * for timing encoding operations.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+uint64_t guac_display_encoder_clock(void);
+
+/**
+ * Returns a human-readable name for the given encoder, for use in log
+ * messages.
+ *
+ * @param encoder
+ *     The encoder to name.
+ *
+ * @return
+ *     A human-readable name for the given encoder.
+ */
+const char* guac_display_encoder_name(guac_display_encoder encoder);
+
+#endif
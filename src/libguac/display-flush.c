@@ -153,6 +153,10 @@ static int PFW_LFW_guac_display_frame_complete(guac_display* display) {
             current->last_frame.buffer_width = current->pending_frame.buffer_width;
             current->last_frame.buffer_height = current->pending_frame.buffer_height;
 
+            /* All cached row hashes are now invalid */
+            guac_mem_free(current->last_frame_row_hashes);
+            current->last_frame_row_hashes = NULL;
+
             current->last_frame.dirty = current->pending_frame.dirty;
             current->pending_frame.dirty = (guac_rect) { 0 };
 
@@ -179,6 +183,11 @@ static int PFW_LFW_guac_display_frame_complete(guac_display* display) {
             current->last_frame.dirty = current->pending_frame.dirty;
             current->pending_frame.dirty = (guac_rect) { 0 };
 
+            /* Cached row hashes within the changed region must be recalculated
+             * before they are next used */
+            guac_rect_extend(&current->last_frame_row_hashes_stale,
+                    &current->last_frame.dirty);
+
             retval = 1;
 
         }
@@ -348,10 +357,14 @@ void guac_display_end_multiple_frames(guac_display* display, int frames) {
         /* PASS 2 (and 3): Index all modified cells by their graphical contents and
          * search the previous frame for occurrences of the same content. Where any
          * draws could instead be represented as copies from the previous frame, do
-         * so instead of sending new image data. */
+         * so instead of sending new image data. Any remaining draws of content
+         * that was replaced during an earlier frame are then rewritten as
+         * copies from the tile cache, and the contents being replaced by this
+         * frame are cached in turn. */
         GUAC_DISPLAY_PLAN_BEGIN_PHASE();
         PFR_guac_display_plan_index_dirty_cells(plan);
-        PFR_LFR_guac_display_plan_rewrite_as_copies(plan);
+        PFR_LFW_guac_display_plan_rewrite_as_copies(plan);
+        PFR_LFW_guac_display_plan_rewrite_as_cached(plan);
         GUAC_DISPLAY_PLAN_END_PHASE(display, "search", 3, 5);
 
         /* PASS 4 (and 5): Combine adjacent updates in horizontal and vertical
@@ -366,6 +379,14 @@ void guac_display_end_multiple_frames(guac_display* display, int frames) {
 
     }
 
+    /* Any full-resolution refinements of previous progressive updates that
+     * this frame would overwrite are no longer needed */
+    PFR_LFW_guac_display_preempt_refinements(display, plan);
+
+    /* Divide users into quality tiers for the frame about to be encoded,
+     * such that all workers encode the frame consistently */
+    guac_display_quality_tiers_compute(display->client, &display->quality_tiers);
+
     /*
      * With all optimizations now performed, finalize the pending frame. This
      * sets the worker threads in motion and frees up the pending frame
@@ -408,7 +429,10 @@ void guac_display_end_multiple_frames(guac_display* display, int frames) {
         guac_display_plan_operation end_frame_op = {
             .type = GUAC_DISPLAY_PLAN_OPERATION_NOP
         };
-        guac_fifo_enqueue(&display->ops, &end_frame_op);
+        if (guac_fifo_enqueue_and_lock(&display->ops, &end_frame_op)) {
+            guac_display_worker_pool_notify(display);
+            guac_fifo_unlock(&display->ops);
+        }
     }
 
 finished_with_pending_frame_lock:
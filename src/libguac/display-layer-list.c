@@ -361,6 +361,7 @@ void guac_display_free_removed_layers(guac_display* display,
             guac_mem_free(current->pending_frame.buffer);
 
         guac_mem_free(current->last_frame.buffer);
+        guac_mem_free(current->last_frame_row_hashes);
         guac_mem_free(current->pending_frame_cells);
 
         pthread_mutex_destroy(&current->path_lock);
@@ -0,0 +1,253 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-plan.h"
+#include "guacamole/cpu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Signature shared by all implementations of guac_display_memcmp(). See
+ * guac_display_memcmp() for the meaning of each parameter and the return
+ * value.
+ */
+typedef size_t guac_display_memcmp_function(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos);
+
+/**
+ * Portable implementation of guac_display_memcmp() which compares one 32-bit
+ * quantity at a time. The first difference is located by scanning forward
+ * from the start of the buffers, while the last difference is located by
+ * scanning backward from the end of the buffers, such that identical data
+ * between the two differences need never be read.
+ */
+static size_t guac_display_memcmp_scalar(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
+
+    /* Locate first difference between the buffers, if any */
+    size_t first = 0;
+    while (first < count && buffer_a[first] == buffer_b[first])
+        first++;
+
+    /* If we reached the end without finding any differences, no need to search
+     * further - the buffers are identical */
+    if (first >= count)
+        return 0;
+
+    /* Search backward from the end of the buffers for the last difference
+     * (which may be identical to the first) */
+    size_t last = count - 1;
+    while (last > first && buffer_a[last] == buffer_b[last])
+        last--;
+
+    /* Final difference found - provide caller with the starting offset and
+     * length (in 32-bit quantities) of differences */
+    *pos = first;
+    return last - first + 1;
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSE2 implementation of guac_display_memcmp() which compares four 32-bit
+ * quantities at a time. Any trailing quantities that do not fill an entire
+ * 128-bit vector are compared one at a time.
+ */
+__attribute__((target("sse2")))
+static size_t guac_display_memcmp_sse2(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
+
+    size_t vector_end = count & ~((size_t) 3);
+    size_t first = 0;
+
+    /* Locate first difference four quantities at a time, where each bit of
+     * the mask produced by _mm_movemask_ps() is set for each quantity that is
+     * identical between the buffers */
+    for (; first < vector_end; first += 4) {
+
+        __m128i a = _mm_loadu_si128((const __m128i*) (buffer_a + first));
+        __m128i b = _mm_loadu_si128((const __m128i*) (buffer_b + first));
+        int diff = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) & 0xF;
+
+        if (diff) {
+            first += __builtin_ctz(diff);
+            goto find_last;
+        }
+
+    }
+
+    /* Check any remaining quantities individually */
+    while (first < count && buffer_a[first] == buffer_b[first])
+        first++;
+
+    if (first >= count)
+        return 0;
+
+find_last:
+
+    /* Quantities that do not fill a vector at the end of the buffers are
+     * checked individually */
+    for (size_t end = count; end > vector_end; end--) {
+        if (buffer_a[end - 1] != buffer_b[end - 1]) {
+            *pos = first;
+            return end - first;
+        }
+    }
+
+    /* Locate last difference four quantities at a time, moving backward from
+     * the end. This search must succeed at or before the vector containing
+     * the first difference. */
+    for (size_t offset = vector_end; offset > first; offset -= 4) {
+
+        __m128i a = _mm_loadu_si128((const __m128i*) (buffer_a + offset - 4));
+        __m128i b = _mm_loadu_si128((const __m128i*) (buffer_b + offset - 4));
+        int diff = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) & 0xF;
+
+        if (diff) {
+            size_t last = offset - 4 + (31 - __builtin_clz(diff));
+            *pos = first;
+            return last - first + 1;
+        }
+
+    }
+
+    /* Unreachable unless the buffers changed during comparison */
+    *pos = first;
+    return 1;
+
+}
+
+/**
+ * AVX2 implementation of guac_display_memcmp() which compares eight 32-bit
+ * quantities at a time. Any trailing quantities that do not fill an entire
+ * 256-bit vector are compared one at a time.
+ */
+__attribute__((target("avx2")))
+static size_t guac_display_memcmp_avx2(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
+
+    size_t vector_end = count & ~((size_t) 7);
+    size_t first = 0;
+
+    /* Locate first difference eight quantities at a time, where each bit of
+     * the mask produced by _mm256_movemask_ps() is set for each quantity that
+     * is identical between the buffers */
+    for (; first < vector_end; first += 8) {
+
+        __m256i a = _mm256_loadu_si256((const __m256i*) (buffer_a + first));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (buffer_b + first));
+        int diff = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))) & 0xFF;
+
+        if (diff) {
+            first += __builtin_ctz(diff);
+            goto find_last;
+        }
+
+    }
+
+    /* Check any remaining quantities individually */
+    while (first < count && buffer_a[first] == buffer_b[first])
+        first++;
+
+    if (first >= count)
+        return 0;
+
+find_last:
+
+    /* Quantities that do not fill a vector at the end of the buffers are
+     * checked individually */
+    for (size_t end = count; end > vector_end; end--) {
+        if (buffer_a[end - 1] != buffer_b[end - 1]) {
+            *pos = first;
+            return end - first;
+        }
+    }
+
+    /* Locate last difference eight quantities at a time, moving backward from
+     * the end. This search must succeed at or before the vector containing
+     * the first difference. */
+    for (size_t offset = vector_end; offset > first; offset -= 8) {
+
+        __m256i a = _mm256_loadu_si256((const __m256i*) (buffer_a + offset - 8));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (buffer_b + offset - 8));
+        int diff = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))) & 0xFF;
+
+        if (diff) {
+            size_t last = offset - 8 + (31 - __builtin_clz(diff));
+            *pos = first;
+            return last - first + 1;
+        }
+
+    }
+
+    /* Unreachable unless the buffers changed during comparison */
+    *pos = first;
+    return 1;
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of guac_display_memcmp() supported by
+ * the current CPU.
+ *
+ * @return
+ *     The implementation of guac_display_memcmp() that should be used.
+ */
+static guac_display_memcmp_function* guac_display_memcmp_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_display_memcmp_avx2;
+
+    if (guac_cpu_supports(GUAC_CPU_SSE2))
+        return guac_display_memcmp_sse2;
+#endif
+
+    return guac_display_memcmp_scalar;
+
+}
+
+size_t guac_display_memcmp(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
+
+    /* Rows that have changed entirely (video, full repaints) differ at both
+     * ends, in which case there is no need to search further */
+    if (count && buffer_a[0] != buffer_b[0]
+            && buffer_a[count - 1] != buffer_b[count - 1]) {
+        *pos = 0;
+        return count;
+    }
+
+    guac_display_memcmp_function* impl = guac_display_memcmp_select_impl();
+    return impl(buffer_a, buffer_b, count, pos);
+
+}
+
+size_t guac_display_memcmp_portable(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
+    return guac_display_memcmp_scalar(buffer_a, buffer_b, count, pos);
+}
@@ -19,12 +19,157 @@
 
 #include "display-plan.h"
 #include "display-priv.h"
+#include "guacamole/client.h"
+#include "guacamole/cpu.h"
 #include "guacamole/display.h"
+#include "guacamole/fifo.h"
+#include "guacamole/mem.h"
 #include "guacamole/rect.h"
 
 #include <string.h>
 #include <stdint.h>
 
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Signature shared by all implementations of
+ * guac_display_hash_update_columns().
+ *
+ * @param column_hash
+ *     The column hashes to update.
+ *
+ * @param row_hash
+ *     The row hashes to incorporate into each corresponding column hash.
+ *
+ * @param length
+ *     The number of entries in both the column_hash and row_hash arrays.
+ */
+typedef void guac_hash_update_columns_function(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length);
+
+/**
+ * Portable implementation of guac_display_hash_update_columns().
+ */
+static void guac_hash_update_columns_scalar(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length) {
+
+    for (int i = 0; i < length; i++)
+        column_hash[i] = GUAC_DISPLAY_HASH_STEP(column_hash[i], row_hash[i]);
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * AVX2 implementation of guac_display_hash_update_columns() which updates
+ * four column hashes at a time. AVX2 lacks a 64-bit multiply, so the multiplication by 62
+ * performed by GUAC_DISPLAY_HASH_STEP() is instead performed as
+ * (hash << 6) - (hash << 1).
+ */
+__attribute__((target("avx2")))
+static void guac_hash_update_columns_avx2(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length) {
+
+    int i = 0;
+    for (; i + 4 <= length; i += 4) {
+
+        __m256i column = _mm256_loadu_si256((const __m256i*) (column_hash + i));
+        __m256i row = _mm256_loadu_si256((const __m256i*) (row_hash + i));
+
+        column = _mm256_sub_epi64(_mm256_slli_epi64(column, 6),
+                _mm256_slli_epi64(column, 1));
+
+        _mm256_storeu_si256((__m256i*) (column_hash + i),
+                _mm256_add_epi64(column, row));
+
+    }
+
+    /* Update any remaining column hashes individually */
+    guac_hash_update_columns_scalar(column_hash + i, row_hash + i, length - i);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of guac_display_hash_update_columns()
+ * supported by the current CPU.
+ *
+ * @return
+ *     The implementation of guac_display_hash_update_columns() that should be
+ *     used.
+ */
+static guac_hash_update_columns_function* guac_hash_update_columns_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_hash_update_columns_avx2;
+#endif
+
+    return guac_hash_update_columns_scalar;
+
+}
+
+void guac_display_hash_update_columns(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length) {
+
+    guac_hash_update_columns_function* impl =
+        guac_hash_update_columns_select_impl();
+
+    impl(column_hash, row_hash, length);
+
+}
+
+void guac_display_hash_update_columns_portable(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length) {
+    guac_hash_update_columns_scalar(column_hash, row_hash, length);
+}
+
+/**
+ * Returns the hash of the 64-pixel row segment starting at the given pixel.
+ * The value returned is identical to the value that would be produced by
+ * applying GUAC_DISPLAY_HASH_STEP() to each pixel in order, but is computed
+ * as four independent runs of 16 pixels such that the runs can be evaluated
+ * in parallel by the CPU.
+ *
+ * @param row
+ *     The first of the 64 pixels to hash.
+ *
+ * @return
+ *     The hash of the given 64-pixel row segment.
+ */
+static uint64_t guac_hash_row_segment(const uint32_t* row) {
+
+    uint64_t a = 0, b = 0, c = 0, d = 0;
+
+    for (int i = 0; i < 16; i++) {
+        a = GUAC_DISPLAY_HASH_STEP(a, row[i]);
+        b = GUAC_DISPLAY_HASH_STEP(b, row[i + 16]);
+        c = GUAC_DISPLAY_HASH_STEP(c, row[i + 32]);
+        d = GUAC_DISPLAY_HASH_STEP(d, row[i + 48]);
+    }
+
+    return ((a * GUAC_DISPLAY_HASH_FACTOR_16 + b)
+                * GUAC_DISPLAY_HASH_FACTOR_16 + c)
+                * GUAC_DISPLAY_HASH_FACTOR_16 + d;
+
+}
+
+uint64_t guac_display_hash_cell(const unsigned char* data, size_t stride) {
+
+    uint64_t hash = 0;
+
+    for (int y = 0; y < GUAC_DISPLAY_CELL_SIZE; y++) {
+        hash = GUAC_DISPLAY_HASH_STEP(hash, guac_hash_row_segment((const uint32_t*) data));
+        data += stride;
+    }
+
+    return hash;
+
+}
+
 /**
  * Stores the given operation within the ops_by_hash table of the given display
  * plan based on the given hash value. The hash function applied for storing
@@ -91,11 +236,12 @@ static guac_display_plan_operation* guac_display_plan_remove_indexed_op(guac_dis
 }
 
 /**
- * Callback invoked by guac_hash_foreach_image_rect() for each 64x64 rectangle
- * of image data.
+ * Callback invoked by guac_hash_foreach_image_rect() and
+ * guac_hash_foreach_aligned_rect() for each 64x64 rectangle of image data.
  *
  * @param plan
- *     The display plan related to the call to guac_hash_foreach_image_rect().
+ *     The display plan related to the call to guac_hash_foreach_image_rect()
+ *     or guac_hash_foreach_aligned_rect().
  *
  * @param x
  *     The X coordinate of the upper-left corner of the current 64x64 rectangle
@@ -139,64 +285,197 @@ typedef void guac_hash_callback(guac_display_plan* plan, int x, int y, uint64_t
  *     The arbitrary value to pass the given callback each time it is invoked
  *     through this function call.
  */
-static int guac_hash_foreach_image_rect(guac_display_plan* plan,
+static void guac_hash_foreach_image_rect(guac_display_plan* plan,
         const guac_display_layer_state* layer_state, const guac_rect* rect,
         guac_hash_callback* callback, void* closure) {
 
-    size_t stride = layer_state->buffer_stride;
-    const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(*layer_state, *rect);
+    int width = guac_rect_width(rect);
+    int height = guac_rect_height(rect);
 
-    int x, y;
-    uint64_t cell_hash[GUAC_DISPLAY_MAX_WIDTH] = { 0 };
+    /* Nothing to hash if the region cannot contain a single 64x64 window */
+    if (width < GUAC_DISPLAY_CELL_SIZE || height < GUAC_DISPLAY_CELL_SIZE)
+        return;
 
-    /* NOTE: Because the hash value of the sliding 64x64 window is available
-     * only upon reaching the bottom-right corner of that window, we offset the
-     * coordinates here by the relative location of the bottom-right corner
-     * (GUAC_DISPLAY_CELL_SIZE - 1) so that we have easy access to the
-     * coordinates of the upper-left corner of the sliding window, as required
-     * by the callback being invoked.
-     *
-     * This also allows us to easily determine when the hash is valid and it's
-     * safe to invoke the callback. Once the coordinates are within the given
-     * rect, we have evaluated a full 64x64 rectangle and have a valid hash. */
+    size_t stride = layer_state->buffer_stride;
+    const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(*layer_state, *rect);
 
-    int start_x = rect->left   - GUAC_DISPLAY_CELL_SIZE + 1;
-    int end_x   = rect->right  - GUAC_DISPLAY_CELL_SIZE + 1;
-    int start_y = rect->top    - GUAC_DISPLAY_CELL_SIZE + 1;
-    int end_y   = rect->bottom - GUAC_DISPLAY_CELL_SIZE + 1;
+    /* The number of horizontal positions of the sliding window (the number of
+     * 64-pixel row segments ending within each row of the region) */
+    int windows = width - GUAC_DISPLAY_CELL_SIZE + 1;
 
-    for (y = start_y; y < end_y; y++) {
+    /* Storage for the hash of each row segment in the current row, as well as
+     * the hash of each 64-row column of row segments ending at the current
+     * row. The size of these arrays depends only on the width of the search
+     * region, not the maximum possible width of a layer. */
+    uint64_t* row_hash = guac_mem_alloc(windows, sizeof(uint64_t));
+    uint64_t* column_hash = guac_mem_zalloc(windows, sizeof(uint64_t));
 
-        uint64_t* current_cell_hash = cell_hash;
+    for (int y = 0; y < height; y++) {
 
         /* Get current row */
-        uint32_t* row = (uint32_t*) data;
+        const uint32_t* row = (const uint32_t*) data;
         data += stride;
 
-        /* Calculate row segment hashes for entire row */
-        uint64_t row_hash = 0;
-        for (x = start_x; x < end_x; x++) {
+        /* Calculate row segment hashes for entire row, noting that a row
+         * segment hash becomes valid only after a full 64 pixels have been
+         * incorporated */
+        uint64_t hash = 0;
+        for (int x = 0; x < GUAC_DISPLAY_CELL_SIZE - 1; x++)
+            hash = GUAC_DISPLAY_HASH_STEP(hash, row[x]);
+
+        for (int x = 0; x < windows; x++) {
+            hash = GUAC_DISPLAY_HASH_STEP(hash, row[x + GUAC_DISPLAY_CELL_SIZE - 1]);
+            row_hash[x] = hash;
+        }
+
+        /* Incorporate row hash values into overall column hashes */
+        guac_display_hash_update_columns(column_hash, row_hash, windows);
+
+        /* Invoke callback for every hash generated once the sliding window
+         * covers a full 64 rows */
+        if (y >= GUAC_DISPLAY_CELL_SIZE - 1) {
+            int window_y = rect->top + y - GUAC_DISPLAY_CELL_SIZE + 1;
+            for (int x = 0; x < windows; x++)
+                callback(plan, rect->left + x, window_y, column_hash[x], closure);
+        }
 
-            /* Get current pixel */
-            uint32_t pixel = *(row++);
+    } /* end for each row */
 
-            /* Update hash value for current row segment */
-            row_hash = ((row_hash * 31) << 1) + pixel;
+    guac_mem_free(row_hash);
+    guac_mem_free(column_hash);
 
-            /* Incorporate row hash value into overall cell hash */
-            uint64_t cell_hash = ((*current_cell_hash * 31) << 1) + row_hash;
-            *(current_cell_hash++) = cell_hash;
+}
 
-            /* Invoke callback for every hash generated, breaking out early if
-             * requested */
-            if (y >= rect->top && x >= rect->left)
-                callback(plan, x, y, cell_hash, closure);
+void LFW_guac_display_layer_update_row_hashes(guac_display_layer* layer) {
 
+    guac_display_layer_state* last_frame = &layer->last_frame;
+
+    int cells_width = last_frame->buffer_width / GUAC_DISPLAY_CELL_SIZE;
+    int height = last_frame->buffer_height;
+
+    /* (Re)allocate cache if it does not match the current buffer dimensions,
+     * rehashing everything */
+    if (layer->last_frame_row_hashes == NULL
+            || layer->last_frame_row_hashes_width != cells_width
+            || layer->last_frame_row_hashes_height != height) {
+
+        guac_mem_free(layer->last_frame_row_hashes);
+        layer->last_frame_row_hashes = guac_mem_alloc(sizeof(uint64_t),
+                cells_width, height);
+
+        layer->last_frame_row_hashes_width = cells_width;
+        layer->last_frame_row_hashes_height = height;
+
+        guac_rect_init(&layer->last_frame_row_hashes_stale, 0, 0,
+                cells_width * GUAC_DISPLAY_CELL_SIZE, height);
+
+    }
+
+    guac_rect stale = layer->last_frame_row_hashes_stale;
+    layer->last_frame_row_hashes_stale = (guac_rect) { 0 };
+
+    /* Rehash only the full row segments touched by the stale region */
+    guac_rect bounds;
+    guac_rect_init(&bounds, 0, 0, cells_width * GUAC_DISPLAY_CELL_SIZE, height);
+    guac_rect_align(&stale, GUAC_DISPLAY_CELL_SIZE_EXPONENT);
+    guac_rect_constrain(&stale, &bounds);
+
+    if (guac_rect_is_empty(&stale))
+        return;
+
+    int first_cell = stale.left / GUAC_DISPLAY_CELL_SIZE;
+    int last_cell = stale.right / GUAC_DISPLAY_CELL_SIZE;
+
+    const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(*last_frame, stale);
+    uint64_t* hashes = layer->last_frame_row_hashes
+        + guac_mem_ckd_mul_or_die(stale.top, cells_width);
+
+    for (int y = stale.top; y < stale.bottom; y++) {
+
+        const uint32_t* segment = (const uint32_t*) data;
+        for (int cell = first_cell; cell < last_cell; cell++) {
+            hashes[cell] = guac_hash_row_segment(segment);
+            segment += GUAC_DISPLAY_CELL_SIZE;
         }
 
-    } /* end for each row */
+        data += last_frame->buffer_stride;
+        hashes += cells_width;
 
-    return 0;
+    }
+
+}
+
+/**
+ * Iterates through each 64x64 subrectangle within the given rectangular region
+ * of the last frame of the given layer whose left edge is aligned with a cell
+ * boundary, invoking the given callback for each such subrectangle. Unlike
+ * guac_hash_foreach_image_rect(), only the vertical position of the window
+ * slides freely. The hashes provided are identical to those that
+ * guac_hash_foreach_image_rect() would provide for the same subrectangles.
+ *
+ * Rather than hashing each pixel, this function combines the cached row
+ * segment hashes of the layer, rehashing only those row segments which have
+ * changed since they were last hashed. This is sufficient to detect vertical
+ * scrolling (where content moves only vertically and hence remains aligned
+ * with the cells of the destination) at a cost proportional to the number of
+ * changed rows.
+ *
+ * @param plan
+ *     The display plan related to the search operation being performed.
+ *
+ * @param layer
+ *     The layer whose last frame should be searched.
+ *
+ * @param rect
+ *     The rectangular region within the last frame that should be hashed.
+ *
+ * @param callback
+ *     The callback to invoke for each 64x64 subrectangle of the given region.
+ *
+ * @param closure
+ *     The arbitrary value to pass the given callback each time it is invoked
+ *     through this function call.
+ */
+static void LFW_guac_hash_foreach_aligned_rect(guac_display_plan* plan,
+        guac_display_layer* layer, const guac_rect* rect,
+        guac_hash_callback* callback, void* closure) {
+
+    LFW_guac_display_layer_update_row_hashes(layer);
+
+    /* Consider only the cell columns that lie entirely within the region */
+    int first_cell = (rect->left + GUAC_DISPLAY_CELL_SIZE - 1) / GUAC_DISPLAY_CELL_SIZE;
+    int last_cell = rect->right / GUAC_DISPLAY_CELL_SIZE;
+    if (last_cell > layer->last_frame_row_hashes_width)
+        last_cell = layer->last_frame_row_hashes_width;
+
+    int bottom = rect->bottom;
+    if (bottom > layer->last_frame_row_hashes_height)
+        bottom = layer->last_frame_row_hashes_height;
+
+    int columns = last_cell - first_cell;
+    if (columns <= 0 || bottom - rect->top < GUAC_DISPLAY_CELL_SIZE)
+        return;
+
+    uint64_t column_hash[GUAC_DISPLAY_MAX_WIDTH / GUAC_DISPLAY_CELL_SIZE] = { 0 };
+    const uint64_t* row_hash = layer->last_frame_row_hashes
+        + guac_mem_ckd_mul_or_die(rect->top, layer->last_frame_row_hashes_width)
+        + first_cell;
+
+    for (int y = rect->top; y < bottom; y++) {
+
+        guac_display_hash_update_columns(column_hash, row_hash, columns);
+        row_hash += layer->last_frame_row_hashes_width;
+
+        /* Invoke callback for every hash generated once the sliding window
+         * covers a full 64 rows */
+        if (y - rect->top >= GUAC_DISPLAY_CELL_SIZE - 1) {
+            int window_y = y - GUAC_DISPLAY_CELL_SIZE + 1;
+            for (int i = 0; i < columns; i++)
+                callback(plan, (first_cell + i) * GUAC_DISPLAY_CELL_SIZE,
+                        window_y, column_hash[i], closure);
+        }
+
+    }
 
 }
 
@@ -219,33 +498,6 @@ static void guac_display_cell_init_rect(guac_rect* rect, int x, int y) {
     guac_rect_init(rect, x, y, GUAC_DISPLAY_CELL_SIZE, GUAC_DISPLAY_CELL_SIZE);
 }
 
-/**
- * Callback for guac_hash_foreach_image_rect() which stores the given operation
- * in the ops_by_hash table of the given display plan.
- *
- * @param plan
- *     The display plan to store the given operation in.
- *
- * @param x
- *     The X coordinate of the upper-left corner of the 64x64 rectangle
- *     modified by the given operation.
- *
- * @param y
- *     The Y coordinate of the upper-left corner of the 64x64 rectangle
- *     modified by the given operation.
- *
- * @param hash
- *     The hash value that applies to the 64x64 rectangle at the given
- *     coordinates.
- *
- * @param closure
- *     A pointer to the guac_display_plan_operation that should be stored
- *     within the ops_by_hash table of the given display plan.
- */
-static void guac_display_plan_index_op_for_cell(guac_display_plan* plan, int x, int y, uint64_t hash, void* closure) {
-    guac_display_plan_store_indexed_op(plan, hash, (guac_display_plan_operation*) closure);
-}
-
 void PFR_guac_display_plan_index_dirty_cells(guac_display_plan* plan) {
 
     memset(plan->ops_by_hash, 0, sizeof(plan->ops_by_hash));
@@ -266,8 +518,9 @@ void PFR_guac_display_plan_index_dirty_cells(guac_display_plan* plan) {
             guac_rect_constrain(&cell, &layer_bounds);
             if (guac_rect_width(&cell) == GUAC_DISPLAY_CELL_SIZE
                     && guac_rect_height(&cell) == GUAC_DISPLAY_CELL_SIZE) {
-                guac_hash_foreach_image_rect(plan, &layer->pending_frame,
-                        &cell, guac_display_plan_index_op_for_cell, op);
+                const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(layer->pending_frame, cell);
+                guac_display_plan_store_indexed_op(plan,
+                        guac_display_hash_cell(data, layer->pending_frame.buffer_stride), op);
             }
 
         }
@@ -343,7 +596,26 @@ static int guac_image_cmp(const unsigned char* restrict data_a, int width_a, int
 }
 
 /**
- * Callback for guac_hash_foreach_image_rect() which searches the ops_by_hash
+ * The state of a search for copies within the last frame of a single layer.
+ */
+typedef struct guac_display_plan_copy_search {
+
+    /**
+     * The layer being searched.
+     */
+    guac_display_layer* layer;
+
+    /**
+     * The number of operations that have been rewritten as copies from the
+     * layer being searched.
+     */
+    int copies;
+
+} guac_display_plan_copy_search;
+
+/**
+ * Callback for guac_hash_foreach_image_rect() and
+ * guac_hash_foreach_aligned_rect() which searches the ops_by_hash
  * table of the given display plan for occurrences of the given hash, replacing
  * the matching operation with a copy operation if a match is found.
  *
@@ -369,12 +641,14 @@ static int guac_image_cmp(const unsigned char* restrict data_a, int width_a, int
  *     coordinates.
  *
  * @param closure
- *     A pointer to the guac_display_layer that is being searched.
+ *     A pointer to the guac_display_plan_copy_search describing the layer
+ *     that is being searched.
  */
 static void PFR_LFR_guac_display_plan_find_copies(guac_display_plan* plan,
         int x, int y, uint64_t hash, void* closure) {
 
-    guac_display_layer* copy_from_layer = (guac_display_layer*) closure;
+    guac_display_plan_copy_search* search = (guac_display_plan_copy_search*) closure;
+    guac_display_layer* copy_from_layer = search->layer;
 
     /* Transform the matching operation into a copy of the current region if
      * any operations match, banning the underlying hash from further checks if
@@ -400,13 +674,14 @@ static void PFR_LFR_guac_display_plan_find_copies(guac_display_plan* plan,
             op->src.layer_rect.layer = copy_from_layer->last_frame_buffer;
             op->src.layer_rect.rect = src_rect;
             op->dest = dst_rect;
+            search->copies++;
         }
 
     }
 
 }
 
-void PFR_LFR_guac_display_plan_rewrite_as_copies(guac_display_plan* plan) {
+void PFR_LFW_guac_display_plan_rewrite_as_copies(guac_display_plan* plan) {
 
     guac_display* display = plan->display;
     guac_display_layer* current = display->last_frame.layers;
@@ -425,8 +700,21 @@ void PFR_LFR_guac_display_plan_rewrite_as_copies(guac_display_plan* plan) {
              * modified) */
             guac_rect_constrain(&search_region, &current->pending_frame.dirty);
 
-            guac_hash_foreach_image_rect(plan, &current->last_frame, &search_region,
-                    PFR_LFR_guac_display_plan_find_copies, current);
+            guac_display_plan_copy_search search = {
+                .layer = current
+            };
+
+            /* Search first for content that has moved only vertically, which
+             * can be done cheaply using cached row hashes */
+            LFW_guac_hash_foreach_aligned_rect(plan, current, &search_region,
+                    PFR_LFR_guac_display_plan_find_copies, &search);
+
+            /* Fall back to an exhaustive, per-pixel search only if the content
+             * has not simply scrolled vertically */
+            if (!search.copies)
+                guac_hash_foreach_image_rect(plan, &current->last_frame, &search_region,
+                        PFR_LFR_guac_display_plan_find_copies, &search);
+
         }
 
         current = current->last_frame.next;
@@ -434,3 +722,142 @@ void PFR_LFR_guac_display_plan_rewrite_as_copies(guac_display_plan* plan) {
     }
 
 }
+
+/**
+ * Returns whether a full-resolution refinement is still pending for any part
+ * of the given region of the given layer, in which case the client-side copy
+ * of the previous frame contains only reduced-resolution image data within
+ * that region. The ops FIFO of the display MUST be locked.
+ *
+ * @param display
+ *     The display whose pending refinements should be checked.
+ *
+ * @param layer
+ *     The layer containing the region.
+ *
+ * @param rect
+ *     The region to check.
+ *
+ * @return
+ *     Non-zero if a refinement is pending for any part of the given region,
+ *     zero otherwise.
+ */
+static int guac_display_plan_is_refining(guac_display* display,
+        guac_display_layer* layer, const guac_rect* rect) {
+
+    for (unsigned int i = 0; i < display->refinement_count; i++) {
+        const guac_display_plan_operation* refinement = &display->refinements[i];
+        if (refinement->layer == layer && guac_rect_intersects(&refinement->dest, rect))
+            return 1;
+    }
+
+    return 0;
+
+}
+
+void PFR_LFW_guac_display_plan_rewrite_as_cached(guac_display_plan* plan) {
+
+    guac_display* display = plan->display;
+    guac_display_cache* cache = &display->cache;
+
+    size_t lookups = 0;
+    size_t hits = 0;
+
+    guac_display_cache_begin_frame(cache);
+
+    /* Replace any draws of entire cells with copies from the cache if the new
+     * contents of those cells were cached during a previous frame. Only
+     * opaque layers are considered, as copies would otherwise need to first
+     * clear the destination. */
+    guac_display_plan_operation* op = plan->ops;
+    for (int i = 0; i < plan->length; i++, op++) {
+
+        guac_display_layer* layer = op->layer;
+        if (op->type != GUAC_DISPLAY_PLAN_OPERATION_IMG || !layer->opaque)
+            continue;
+
+        guac_rect layer_bounds;
+        guac_display_layer_get_bounds(layer, &layer_bounds);
+
+        guac_rect cell;
+        guac_display_cell_init_rect(&cell, op->dest.left, op->dest.top);
+
+        guac_rect_constrain(&cell, &layer_bounds);
+        if (guac_rect_width(&cell) != GUAC_DISPLAY_CELL_SIZE
+                || guac_rect_height(&cell) != GUAC_DISPLAY_CELL_SIZE)
+            continue;
+
+        size_t stride = layer->pending_frame.buffer_stride;
+        const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(layer->pending_frame, cell);
+        const guac_display_cache_entry* entry = guac_display_cache_lookup(cache,
+                guac_display_hash_cell(data, stride), data, stride);
+
+        lookups++;
+
+        if (entry != NULL) {
+            op->type = GUAC_DISPLAY_PLAN_OPERATION_COPY;
+            op->src.layer_rect.layer = cache->buffer;
+            guac_display_cache_entry_rect(cache, entry, &op->src.layer_rect.rect);
+            op->dest = cell;
+            hits++;
+        }
+
+    }
+
+    /* NOTE: The ops FIFO must remain locked while checking for pending
+     * refinements, as refinements are modified by the worker threads */
+    guac_fifo_lock(&display->ops);
+
+    /* Cache the outgoing contents of any entire cells that are being
+     * replaced, unless those contents are short-lived or were sent only at
+     * reduced resolution */
+    op = plan->ops;
+    for (int i = 0; i < plan->length; i++, op++) {
+
+        guac_display_layer* layer = op->layer;
+        if (op->type == GUAC_DISPLAY_PLAN_OPERATION_NOP || !layer->opaque
+                || op->current_frame - op->last_frame < GUAC_DISPLAY_CACHE_MIN_AGE)
+            continue;
+
+        guac_rect last_frame_bounds;
+        guac_rect_init(&last_frame_bounds, 0, 0, layer->last_frame.width,
+                layer->last_frame.height);
+
+        guac_rect cell;
+        guac_display_cell_init_rect(&cell, op->dest.left, op->dest.top);
+
+        guac_rect_constrain(&cell, &last_frame_bounds);
+        if (guac_rect_width(&cell) != GUAC_DISPLAY_CELL_SIZE
+                || guac_rect_height(&cell) != GUAC_DISPLAY_CELL_SIZE
+                || guac_display_plan_is_refining(display, layer, &cell))
+            continue;
+
+        size_t stride = layer->last_frame.buffer_stride;
+        const unsigned char* data = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(layer->last_frame, cell);
+        const guac_display_cache_entry* entry = guac_display_cache_store(cache,
+                guac_display_hash_cell(data, stride), data, stride);
+
+        if (entry == NULL)
+            continue;
+
+        /* Each operation stores at most one tile */
+        if (plan->cache_stores == NULL)
+            plan->cache_stores = guac_mem_alloc(plan->length,
+                    sizeof(guac_display_plan_cache_store));
+
+        guac_display_plan_cache_store* store = &plan->cache_stores[plan->cache_store_count++];
+        store->layer = layer->last_frame_buffer;
+        store->src = cell;
+        guac_display_cache_entry_rect(cache, entry, &store->dest);
+
+    }
+
+    guac_fifo_unlock(&display->ops);
+
+    if (lookups || plan->cache_store_count)
+        guac_client_log(display->client, GUAC_LOG_TRACE, "Tile cache: %zu of "
+                "%zu cells drawn from cache, %zu cells stored (overall hit "
+                "rate %.1f%%).", hits, lookups, plan->cache_store_count,
+                cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0);
+
+}
@@ -75,71 +75,6 @@ static void guac_display_plan_mark_dirty(guac_display_layer* layer,
 
 }
 
-/**
- * Variant of memcmp() which specifically compares series of 32-bit quantities
- * and determines the overall location and length of the differences in the two
- * provided buffers. The length and location determined are the length and
- * location of the smallest contiguous series of 32-bit quantities that differ
- * between the buffers.
- *
- * @param buffer_a
- *     The first buffer to compare.
- *
- * @param buffer_b
- *     The buffer to compare with buffer_a.
- *
- * @param count
- *     The number of 32-bit quantities in each buffer.
- *
- * @param pos
- *     A pointer to a size_t that should receive the offset of the difference,
- *     if the two buffers turn out to contain different data. The value of the
- *     size_t will only be modified if at least one difference is found.
- *
- * @return
- *     The number of 32-bit quantities after and including the offset returned
- *     via pos that are different between buffer_a and buffer_b, or zero if
- *     there are no such differences.
- */
-static size_t guac_display_memcmp(const uint32_t* restrict buffer_a,
-        const uint32_t* restrict buffer_b, size_t count, size_t* pos) {
-
-    /* Locate first difference between the buffers, if any */
-    size_t first = 0;
-    while (first < count) {
-
-        if (*(buffer_a++) != *(buffer_b++))
-            break;
-
-        first++;
-
-    }
-
-    /* If we reached the end without finding any differences, no need to search
-     * further - the buffers are identical */
-    if (first >= count)
-        return 0;
-
-    /* Search through all remaining values in the buffers for the last
-     * difference (which may be identical to the first) */
-    size_t last = first;
-    size_t offset = first + 1;
-    while (offset < count) {
-
-        if (*(buffer_a++) != *(buffer_b++))
-            last = offset;
-
-        offset++;
-
-    }
-
-    /* Final difference found - provide caller with the starting offset and
-     * length (in 32-bit quantities) of differences */
-    *pos = first;
-    return last - first + 1;
-
-}
-
 guac_display_plan* PFW_LFR_guac_display_plan_create(guac_display* display) {
 
     guac_display_layer* current;
@@ -308,6 +243,8 @@ guac_display_plan* PFW_LFR_guac_display_plan_create(guac_display* display) {
     plan->frame_end = frame_end;
     plan->length = op_count;
     plan->ops = guac_mem_alloc(plan->length, sizeof(guac_display_plan_operation));
+    plan->cache_stores = NULL;
+    plan->cache_store_count = 0;
 
     /* Convert the dirty rectangles stored in each layer's cells to individual
      * image operations for later optimization */
@@ -365,6 +302,7 @@ guac_display_plan* PFW_LFR_guac_display_plan_create(guac_display* display) {
 }
 
 void guac_display_plan_free(guac_display_plan* plan) {
+    guac_mem_free(plan->cache_stores);
     guac_mem_free(plan->ops);
     guac_mem_free(plan);
 }
@@ -375,10 +313,26 @@ void guac_display_plan_apply(guac_display_plan* plan) {
     guac_client* client = display->client;
     guac_display_plan_operation* op = plan->ops;
 
+    size_t image_ops = 0;
+    size_t image_dirty_size = 0;
+
     /* Do not allow worker threads to move forward with image encoding until
      * AFTER the non-image instructions have finished being written */
     guac_fifo_lock(&display->ops);
 
+    /* Populate the client-side tile cache with any tiles stored while
+     * planning. This must happen before any other operation, as the tiles
+     * are copied from the client-side copies of the previous frame, and as
+     * a tile may replace a tile that is no longer needed. */
+    for (size_t i = 0; i < plan->cache_store_count; i++) {
+        guac_display_plan_cache_store* store = &plan->cache_stores[i];
+        guac_protocol_send_copy(client->socket, store->layer,
+                store->src.left, store->src.top,
+                guac_rect_width(&store->src), guac_rect_height(&store->src),
+                GUAC_COMP_OVER, display->cache.buffer,
+                store->dest.left, store->dest.top);
+    }
+
     /* Immediately send instructions for all updates that do not involve
      * significant processing (do not involve encoding anything). This allows
      * us to use the worker threads solely for encoding, reducing contention
@@ -422,6 +376,8 @@ void guac_display_plan_apply(guac_display_plan* plan) {
 
             /* All other operations should be handled by the workers */
             default:
+                image_ops++;
+                image_dirty_size += op->dirty_size;
                 guac_fifo_enqueue(&display->ops, op);
                 break;
 
@@ -431,6 +387,25 @@ void guac_display_plan_apply(guac_display_plan* plan) {
 
     }
 
+    /* Divide the time available until the next frame among the image
+     * operations of this frame, accounting for the number of those operations
+     * that the worker pool can encode at the same time */
+    if (image_ops) {
+
+        guac_display_worker_pool_stats stats;
+        guac_display_worker_pool_get_stats(&stats);
+
+        unsigned int parallelism = stats.thread_count;
+        if (image_ops < parallelism)
+            parallelism = image_ops;
+
+        guac_display_encoder_model_begin_frame(&display->encoder_model,
+                plan->frame_end, image_dirty_size, parallelism);
+
+    }
+
+    /* Awaken the shared worker pool to process any enqueued operations */
+    guac_display_worker_pool_notify(display);
     guac_fifo_unlock(&display->ops);
 
 }
@@ -246,6 +246,33 @@ typedef struct guac_display_plan_indexed_operation {
 
 } guac_display_plan_indexed_operation;
 
+/**
+ * A tile of image data that should be copied into the client-side buffer of
+ * the display's tile cache before any other operations of a plan are
+ * applied, as the tile has been stored within that cache by
+ * guac_display_plan_rewrite_as_cached().
+ */
+typedef struct guac_display_plan_cache_store {
+
+    /**
+     * The client-side buffer containing the tile.
+     */
+    const guac_layer* layer;
+
+    /**
+     * The region of the tile within the client-side buffer containing the
+     * tile.
+     */
+    guac_rect src;
+
+    /**
+     * The region of the client-side buffer of the tile cache that should
+     * receive the tile.
+     */
+    guac_rect dest;
+
+} guac_display_plan_cache_store;
+
 /**
  * The set of operations required to transform the display state from what each
  * user currently sees (the previous frame) to the current state of the
@@ -284,6 +311,18 @@ typedef struct guac_display_plan {
      */
     guac_display_plan_indexed_operation ops_by_hash[GUAC_DISPLAY_PLAN_OPERATION_INDEX_SIZE];
 
+    /**
+     * Array of all tiles that must be copied into the client-side buffer of
+     * the display's tile cache before any operations in the ops array are
+     * applied, or NULL if no tiles were stored within the cache.
+     */
+    guac_display_plan_cache_store* cache_stores;
+
+    /**
+     * The number of tiles stored in the cache_stores array.
+     */
+    size_t cache_store_count;
+
 } guac_display_plan;
 
 /**
@@ -318,6 +357,126 @@ typedef struct guac_display_plan {
  */
 guac_display_plan* PFW_LFR_guac_display_plan_create(guac_display* display);
 
+/**
+ * Variant of memcmp() which specifically compares series of 32-bit quantities
+ * and determines the overall location and length of the differences in the two
+ * provided buffers. The length and location determined are the length and
+ * location of the smallest contiguous series of 32-bit quantities that differ
+ * between the buffers.
+ *
+ * Where supported by the current CPU, this comparison is performed using
+ * SSE2 or AVX2 instructions. The implementation used is selected once, at
+ * runtime, with a portable scalar implementation used otherwise.
+ *
+ * @param buffer_a
+ *     The first buffer to compare.
+ *
+ * @param buffer_b
+ *     The buffer to compare with buffer_a.
+ *
+ * @param count
+ *     The number of 32-bit quantities in each buffer.
+ *
+ * @param pos
+ *     A pointer to a size_t that should receive the offset of the difference,
+ *     if the two buffers turn out to contain different data. The value of the
+ *     size_t will only be modified if at least one difference is found.
+ *
+ * @return
+ *     The number of 32-bit quantities after and including the offset returned
+ *     via pos that are different between buffer_a and buffer_b, or zero if
+ *     there are no such differences.
+ */
+size_t guac_display_memcmp(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos);
+
+/**
+ * Portable, scalar implementation of guac_display_memcmp() that never uses
+ * SIMD instructions, regardless of what the current CPU supports. This
+ * function produces identical results to guac_display_memcmp() and is
+ * exposed primarily for the sake of testing and benchmarking.
+ *
+ * @see guac_display_memcmp()
+ */
+size_t guac_display_memcmp_portable(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos);
+
+/**
+ * Incorporates the given value into the given polynomial hash, returning the
+ * new hash value. Each step multiplies the existing hash by 62, and 62^64
+ * is evenly divisible by 2^64, so the influence of any value on a 64-bit hash
+ * vanishes after exactly 64 further steps. This is what allows the hash of a
+ * 64x64 window to be computed incrementally as that window slides over an
+ * image, and why the hashing algorithm depends on GUAC_DISPLAY_CELL_SIZE
+ * being 64.
+ *
+ * @param hash
+ *     The current hash value.
+ *
+ * @param value
+ *     The value to incorporate into the hash.
+ *
+ * @return
+ *     The new hash value.
+ */
+#define GUAC_DISPLAY_HASH_STEP(hash, value) ((((hash) * 31) << 1) + (value))
+
+/**
+ * The value 62^16 modulo 2^64, which is the factor that the hash of a run of
+ * 16 pixels must be multiplied by when those pixels are followed by another
+ * 16 pixels within the same row segment.
+ */
+#define GUAC_DISPLAY_HASH_FACTOR_16 UINT64_C(0xE83050A9DE010000)
+
+/**
+ * Returns the hash of the 64x64 region of image data starting at the given
+ * location. The value returned is identical to the value that would be
+ * produced by hashing each of the 64 pixels of each row with
+ * GUAC_DISPLAY_HASH_STEP(), and then each of the 64 resulting row hashes in
+ * the same manner, and thus to the hash that any sliding 64x64 window would
+ * have over the same image data.
+ *
+ * @param data
+ *     A pointer to the upper-left pixel of the region to hash.
+ *
+ * @param stride
+ *     The number of bytes in each row of image data.
+ *
+ * @return
+ *     The hash of the given 64x64 region.
+ */
+uint64_t guac_display_hash_cell(const unsigned char* data, size_t stride);
+
+/**
+ * Incorporates each of the given row hashes into the corresponding column
+ * hash, as if by GUAC_DISPLAY_HASH_STEP(). The column hashes are independent
+ * of each other and are updated using AVX2 instructions where supported by
+ * the current CPU.
+ *
+ * @param column_hash
+ *     The column hashes to update.
+ *
+ * @param row_hash
+ *     The row hashes to incorporate into each corresponding column hash.
+ *
+ * @param length
+ *     The number of entries in both the column_hash and row_hash arrays.
+ */
+void guac_display_hash_update_columns(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length);
+
+/**
+ * Portable, scalar implementation of guac_display_hash_update_columns() that
+ * never uses SIMD instructions, regardless of what the current CPU supports.
+ * This function produces identical results to
+ * guac_display_hash_update_columns() and is exposed primarily for the sake of
+ * testing.
+ *
+ * @see guac_display_hash_update_columns()
+ */
+void guac_display_hash_update_columns_portable(uint64_t* restrict column_hash,
+        const uint64_t* restrict row_hash, int length);
+
 /**
  * Frees all memory associated with the given guac_display_plan.
  *
@@ -354,10 +513,33 @@ void PFR_guac_display_plan_index_dirty_cells(guac_display_plan* plan);
  * must first be indexed by guac_display_plan_index_dirty_cells() before this
  * function can be used.
  *
+ * Content that has moved only vertically (scrolling) is located using the
+ * cached row segment hashes of each layer's last frame, which are updated by
+ * this function as needed. An exhaustive search of every possible source
+ * location is performed only if no such vertical moves are found.
+ *
+ * @param plan
+ *     The guac_display_plan to modify.
+ */
+void PFR_LFW_guac_display_plan_rewrite_as_copies(guac_display_plan* plan);
+
+/**
+ * Walks through all operations currently in the given guac_display_plan,
+ * replacing draws of entire cells with copies from the display's tile cache
+ * wherever identical image data was cached from a previous frame. The
+ * outgoing contents of any cells that this plan replaces are then stored in
+ * that cache, provided those contents remained unchanged for at least
+ * GUAC_DISPLAY_CACHE_MIN_AGE milliseconds, with the client-side copies of
+ * those contents listed in the cache_stores array of the plan.
+ *
+ * This function must be invoked after guac_display_plan_rewrite_as_copies(),
+ * such that copies within the previous frame are preferred, and before
+ * operations are combined.
+ *
  * @param plan
  *     The guac_display_plan to modify.
  */
-void PFR_LFR_guac_display_plan_rewrite_as_copies(guac_display_plan* plan);
+void PFR_LFW_guac_display_plan_rewrite_as_cached(guac_display_plan* plan);
 
 /**
  * Walks through all operations currently in the given guac_display_plan,
@@ -20,6 +20,8 @@
 #ifndef GUAC_DISPLAY_PRIV_H
 #define GUAC_DISPLAY_PRIV_H
 
+#include "display-cache.h"
+#include "display-encoder.h"
 #include "display-plan.h"
 #include "guacamole/client.h"
 #include "guacamole/display.h"
@@ -28,6 +30,8 @@
 #include "guacamole/socket.h"
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * The maximum amount of time to wait after flushing a frame when compensating
@@ -151,6 +155,104 @@
                 / GUAC_DISPLAY_CELL_SIZE                                      \
                 * 8)
 
+/**
+ * The maximum number of image operations that may be awaiting refinement
+ * following a progressive, reduced-resolution pass. Once this many operations
+ * are awaiting refinement, further image operations are sent at full
+ * resolution.
+ */
+#define GUAC_DISPLAY_MAX_REFINEMENTS 256
+
+/**
+ * The minimum width and height of an image operation, in pixels, for that
+ * operation to be sent progressively. Smaller updates are always sent at full
+ * resolution, as the overhead of an additional pass would outweigh any
+ * benefit.
+ */
+#define GUAC_DISPLAY_PROGRESSIVE_MIN_SIZE 128
+
+/**
+ * The lossy quality that will be used for users experiencing no processing
+ * lag at all, and for any frame sent while no users are connected.
+ */
+#define GUAC_DISPLAY_MAX_QUALITY 90
+
+/**
+ * The lowest lossy quality that will be used regardless of processing lag.
+ */
+#define GUAC_DISPLAY_MIN_QUALITY 30
+
+/**
+ * The maximum number of quality tiers that connected users may be divided
+ * into. Users within each tier receive lossy image data encoded at a quality
+ * appropriate for the slowest user of that tier. The first tier contains the
+ * fastest users.
+ */
+#define GUAC_DISPLAY_QUALITY_TIERS 2
+
+/**
+ * The minimum difference between the lossy quality suggested for the fastest
+ * and slowest connected users before those users are divided into separate
+ * quality tiers. Users whose suggested qualities are closer than this share
+ * a single encoding of each update.
+ */
+#define GUAC_DISPLAY_QUALITY_TIER_SPLIT 25
+
+/**
+ * The maximum number of users that may be placed in any quality tier other
+ * than the first. If more users than this would be degraded, all users share
+ * a single quality tier.
+ */
+#define GUAC_DISPLAY_MAX_DEGRADED_USERS 64
+
+/**
+ * The size of the buffer used to store the ID of each user placed in a
+ * quality tier other than the first, including null terminator. The IDs
+ * generated for users by guac_user_alloc() are 37 characters long.
+ */
+#define GUAC_DISPLAY_USER_ID_SIZE 64
+
+/**
+ * The division of connected users into quality tiers, based on the processing
+ * lag of each user.
+ */
+typedef struct guac_display_quality_tiers {
+
+    /**
+     * The number of quality tiers in use, between 1 and
+     * GUAC_DISPLAY_QUALITY_TIERS inclusive.
+     */
+    int count;
+
+    /**
+     * The quality that should be requested of lossy encoders for the users
+     * of each tier, between 0 and 100 inclusive.
+     */
+    int quality[GUAC_DISPLAY_QUALITY_TIERS];
+
+    /**
+     * The greatest processing lag of any user in the first tier, in
+     * milliseconds. This is the lag that frame timing should compensate for,
+     * as users in other tiers are instead compensated for with lower-quality
+     * image data and, failing that, by skipping frames.
+     */
+    int lag;
+
+    /**
+     * The IDs of the users in the second quality tier. Users are identified
+     * by ID rather than by pointer, as users may have since left the
+     * connection, and the memory of a departed user may be reused for a
+     * different user that joins later.
+     */
+    char degraded_users[GUAC_DISPLAY_MAX_DEGRADED_USERS][GUAC_DISPLAY_USER_ID_SIZE];
+
+    /**
+     * The number of users within the degraded_users array.
+     */
+    int degraded_user_count;
+
+} guac_display_quality_tiers;
+
 /**
  * Returns the memory address of the given rectangle within the mutable image
  * buffer of the given guac_display_layer_state, where the upper-left corner of
@@ -221,8 +323,8 @@
 
 /**
  * Bitwise flag set on the render_state flag in guac_display when the
- * guac_display has been stopped and all worker threads have terminated (no
- * further frames will render). This flag is set when guac_display_stop() has
+ * guac_display has been stopped and all worker pool tokens for that display
+ * have been released (no further frames will render). This flag is set when guac_display_stop() has
  * been invoked, including as part of guac_display_free().
  */
 #define GUAC_DISPLAY_RENDER_STATE_STOPPED 4
@@ -549,6 +651,48 @@ struct guac_display_layer {
      */
     guac_layer* last_frame_buffer;
 
+    /**
+     * Cached hashes of each cell-aligned, 64-pixel segment of each row of the
+     * image data in the last frame, used to search for scrolled content
+     * without rehashing rows that have not changed. The hash of the segment
+     * within row Y and cell column X is stored at index
+     * (Y * last_frame_row_hashes_width + X). Only segments that lie entirely
+     * within the last frame buffer are hashed. This will be NULL if no
+     * hashes have yet been calculated.
+     *
+     * IMPORTANT: The display-level last_frame.lock MUST be acquired for
+     * writing before modifying or reading this member.
+     */
+    uint64_t* last_frame_row_hashes;
+
+    /**
+     * The number of row segment hashes stored in last_frame_row_hashes for
+     * each row (the number of full cells in each row of the last frame
+     * buffer at the time the hashes were allocated).
+     *
+     * IMPORTANT: The display-level last_frame.lock MUST be acquired for
+     * writing before modifying or reading this member.
+     */
+    int last_frame_row_hashes_width;
+
+    /**
+     * The number of rows represented within last_frame_row_hashes.
+     *
+     * IMPORTANT: The display-level last_frame.lock MUST be acquired for
+     * writing before modifying or reading this member.
+     */
+    int last_frame_row_hashes_height;
+
+    /**
+     * The region of the last frame that has changed since the hashes within
+     * last_frame_row_hashes were last updated. If no such changes have been
+     * made, this will be an empty rect.
+     *
+     * IMPORTANT: The display-level last_frame.lock MUST be acquired for
+     * writing before modifying or reading this member.
+     */
+    guac_rect last_frame_row_hashes_stale;
+
     /* ---------------- LAYER PENDING FRAME STATE ---------------- */
 
     /**
@@ -777,21 +921,28 @@ struct guac_display {
     /* ---------------- FRAME ENCODING WORKER THREADS ---------------- */
 
     /**
-     * The number of worker threads in the worker_threads array.
+     * The index of the deque within the shared worker pool that receives
+     * tokens for this display. Tokens may later migrate to the deques of other
+     * workers as those workers steal or requeue them.
      */
-    int worker_thread_count;
+    int worker_home;
 
     /**
-     * Pool of worker threads that automatically pull from the ops FIFO,
-     * sending corresponding Guacamole instructions to all connected clients.
+     * The number of tokens for this display that currently exist within the
+     * shared worker pool, including tokens held by workers that are currently
+     * processing an operation from this display. The display is not stopped
+     * until this value reaches zero.
+     *
+     * IMPORTANT: This member must only be accessed or modified while the ops
+     * FIFO is locked.
      */
-    pthread_t* worker_threads;
+    size_t worker_tokens;
 
     /**
      * FIFO of all graphical operations required to transform the remote
      * display state from the previous frame to the next frame. Operations
-     * added to this FIFO will automatically be pulled and processed by a
-     * worker thread.
+     * added to this FIFO will be pulled and processed by the shared worker
+     * pool once guac_display_worker_pool_notify() has been invoked.
      */
     guac_fifo ops;
 
@@ -818,6 +969,73 @@ struct guac_display {
      */
     int frame_deferred;
 
+    /**
+     * Image operations whose reduced-resolution pass has already been sent and
+     * which are awaiting a full-resolution refinement. Refinements are sent
+     * by the worker pool only while no frame is being encoded, and are
+     * discarded if a newer frame modifies the same region of the same layer.
+     *
+     * IMPORTANT: This member must only be accessed or modified while the ops
+     * FIFO is locked.
+     */
+    guac_display_plan_operation refinements[GUAC_DISPLAY_MAX_REFINEMENTS];
+
+    /**
+     * The number of operations currently stored within the refinements
+     * array.
+     *
+     * IMPORTANT: This member must only be accessed or modified while the ops
+     * FIFO is locked.
+     */
+    unsigned int refinement_count;
+
+    /**
+     * The number of refinements that have been removed from the refinements
+     * array and are currently being sent by a worker.
+     *
+     * IMPORTANT: This member must only be accessed or modified while the ops
+     * FIFO is locked.
+     */
+    unsigned int active_refinements;
+
+    /**
+     * Model of the time taken by each image encoder, learned from previous
+     * operations, which is used by the worker pool to choose the encoder and
+     * quality of each image operation such that the current frame completes
+     * before the next frame is due.
+     */
+    guac_display_encoder_model encoder_model;
+
+    /**
+     * Cache of tiles of image data that were recently replaced, stored
+     * within an off-screen buffer on each connected client, such that those
+     * tiles can be redrawn with copies if they reappear.
+     *
+     * IMPORTANT: This member must only be modified while last_frame.lock is
+     * held for writing, and must only be read while last_frame.lock is held.
+     */
+    guac_display_cache cache;
+
+    /**
+     * The quality tiers that connected users were divided into when the
+     * current frame was flushed.
+     *
+     * IMPORTANT: This member must only be modified while last_frame.lock is
+     * held for writing, and must only be read while last_frame.lock is held.
+     */
+    guac_display_quality_tiers quality_tiers;
+
+    /**
+     * Broadcast socket used to send output that only connected users should
+     * receive: lossy image data for users outside the first quality tier,
+     * and the reduced-resolution passes of progressive updates. Unlike the
+     * socket of the client, output written to this socket is never included
+     * within session recordings, which receive only the image data sent to
+     * the first quality tier and only the full-resolution refinements of
+     * progressive updates.
+     */
+    guac_socket* unrecorded_socket;
+
     /**
      * The current state of the rendering process. Code that needs to be aware
      * of whether a frame is currently in the process of being rendered can
@@ -896,16 +1114,207 @@ void PFW_guac_display_layer_resize(guac_display_layer* layer,
         int width, int height);
 
 /**
- * Worker thread that continuously pulls operations from the operation FIFO of
- * the given guac_display, applying those operations by seding corresponding
- * instructions to connected clients.
+ * Updates the cached row segment hashes of the given layer such that they
+ * accurately reflect the current contents of the layer's last frame. Only the
+ * row segments that have changed since the hashes were last updated (as
+ * tracked by last_frame_row_hashes_stale) are rehashed. If the dimensions of
+ * the last frame buffer have changed, the cache is reallocated and all row
+ * segments are rehashed.
+ *
+ * @param layer
+ *     The layer whose cached row segment hashes should be updated.
+ */
+void LFW_guac_display_layer_update_row_hashes(guac_display_layer* layer);
+
+/**
+ * Divides the portion of the given rectangle that lies outside the given
+ * hole into at most four non-overlapping rectangles: the full-width bands
+ * above and below the hole, and the parts to the left and right of the hole
+ * between those bands.
+ *
+ * @param rect
+ *     The rectangle to divide.
+ *
+ * @param hole
+ *     The rectangle to remove from the given rectangle.
+ *
+ * @param remaining
+ *     An array of four rectangles that should receive the parts of the given
+ *     rectangle that do not intersect the hole.
+ *
+ * @return
+ *     The number of rectangles stored within the remaining array, which will
+ *     be zero if the hole covers the given rectangle entirely.
+ */
+int guac_display_rect_subtract(const guac_rect* rect,
+        const guac_rect* hole, guac_rect remaining[4]);
+
+/**
+ * Discards the parts of any pending refinements that would be made obsolete
+ * by the given display plan, as well as any refinements that refer to layers
+ * which have been removed. The parts of a refinement that the plan does not
+ * replace remain pending as separate refinements. Any copy
+ * operations in the plan whose source region has not yet been refined are
+ * converted back into image operations, such that reduced-resolution image
+ * data is never copied elsewhere.
+ *
+ * IMPORTANT: The calling thread must already hold the write lock for the
+ * display's pending_frame.lock and last_frame.lock. Holding last_frame.lock
+ * guarantees that no refinement is currently being sent.
+ *
+ * @param display
+ *     The display whose pending refinements should be checked.
+ *
+ * @param plan
+ *     The plan for the frame about to be sent, or NULL if the frame involves
+ *     no graphical changes.
+ */
+void PFR_LFW_guac_display_preempt_refinements(guac_display* display,
+        guac_display_plan* plan);
+
+/**
+ * Divides the users of the given client into quality tiers according to the
+ * processing lag of each user. If the lossy quality appropriate for the
+ * fastest and slowest users differs by less than
+ * GUAC_DISPLAY_QUALITY_TIER_SPLIT, all users are placed in a single tier
+ * using the quality appropriate for the slowest user.
+ *
+ * @param client
+ *     The client whose users should be divided into tiers.
+ *
+ * @param tiers
+ *     The structure that should receive the resulting quality tiers.
+ */
+void guac_display_quality_tiers_compute(guac_client* client,
+        guac_display_quality_tiers* tiers);
+
+/**
+ * Returns the index of the quality tier containing the given user.
+ *
+ * @param tiers
+ *     The quality tiers to search.
  *
- * @param data
- *     A pointer to the guac_display.
+ * @param user
+ *     The user to locate.
+ *
+ * @return
+ *     The index of the quality tier containing the given user. Users that
+ *     joined after the tiers were computed are in the first tier.
+ */
+int guac_display_quality_tier_of(const guac_display_quality_tiers* tiers,
+        const guac_user* user);
+
+/**
+ * Statistics describing the activity of the process-wide display worker pool.
+ */
+typedef struct guac_display_worker_pool_stats {
+
+    /**
+     * The number of worker threads within the pool.
+     */
+    int thread_count;
+
+    /**
+     * The number of guac_display instances currently using the pool.
+     */
+    int display_count;
+
+    /**
+     * The total number of tokens currently awaiting a worker across all
+     * worker deques.
+     */
+    unsigned int queue_depth;
+
+    /**
+     * The highest value of queue_depth observed since the pool was started.
+     */
+    unsigned int max_queue_depth;
+
+    /**
+     * The total number of tokens added to worker deques since the pool was
+     * started, including tokens returned to a deque after processing.
+     */
+    uint64_t tokens_queued;
+
+    /**
+     * The total number of tokens taken from worker deques by workers since
+     * the pool was started.
+     */
+    uint64_t tokens_taken;
+
+    /**
+     * The number of tokens within tokens_taken that were stolen from the
+     * deque of a different worker.
+     */
+    uint64_t tokens_stolen;
+
+    /**
+     * The number of times a worker with an empty deque searched the deques of
+     * all other workers without finding any token to steal.
+     */
+    uint64_t failed_steals;
+
+} guac_display_worker_pool_stats;
+
+/**
+ * Registers the given display with the process-wide worker pool shared by
+ * all guac_display instances, starting the worker threads of that pool if
+ * this is the first such display. The number of worker threads is bounded
+ * by the number of available processors, regardless of how many displays
+ * are registered.
+ *
+ * @param display
+ *     The display to register.
+ */
+void guac_display_worker_pool_register(guac_display* display);
+
+/**
+ * Unregisters the given display from the process-wide worker pool, stopping
+ * the worker threads of that pool if no other displays remain registered.
+ * The display must already have been stopped with guac_display_stop(), such
+ * that no tokens for the display remain within the pool.
+ *
+ * @param display
+ *     The display to unregister.
+ */
+void guac_display_worker_pool_unregister(guac_display* display);
+
+/**
+ * Notifies the process-wide worker pool that operations have been added to
+ * the ops FIFO of the given display, adding tokens for that display to the
+ * pool such that those operations will be processed. At most one token per
+ * worker thread will exist for any one display. The ops FIFO of the display
+ * MUST be locked.
+ *
+ * @param display
+ *     The display whose ops FIFO has received new operations.
+ */
+void guac_display_worker_pool_notify(guac_display* display);
+
+/**
+ * Retrieves a snapshot of the statistics describing the activity of the
+ * process-wide worker pool.
+ *
+ * @param stats
+ *     The structure that should receive the current statistics.
+ */
+void guac_display_worker_pool_get_stats(guac_display_worker_pool_stats* stats);
+
+/**
+ * Processes a single operation from the operation FIFO of the given
+ * guac_display on behalf of a token that was taken from the shared worker
+ * pool, applying that operation by sending corresponding instructions to
+ * connected clients. If this operation completes the current frame, the end
+ * of that frame is also sent.
+ *
+ * @param display
+ *     The display whose token was taken from the worker pool.
  *
  * @return
- *     Always NULL.
+ *     Non-zero if the display has further operations pending and the token
+ *     should be returned to the worker pool, zero if the token has been
+ *     released.
  */
-void* guac_display_worker_thread(void* data);
+int guac_display_worker_process(guac_display* display);
 
 #endif
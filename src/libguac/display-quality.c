@@ -0,0 +1,236 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-priv.h"
+#include "guacamole/client.h"
+#include "guacamole/string.h"
+#include "guacamole/user.h"
+
+#include <limits.h>
+#include <string.h>
+
+/**
+ * The processing lags and suggested qualities of the users of a client, as
+ * gathered by guac_display_quality_tiers_compute().
+ */
+typedef struct guac_display_quality_survey {
+
+    /**
+     * The tiers being computed. Users are added to the degraded_users array
+     * only during the second pass over all users.
+     */
+    guac_display_quality_tiers* tiers;
+
+    /**
+     * The suggested quality of the fastest user, or INT_MIN if no users have
+     * yet been surveyed.
+     */
+    int max_quality;
+
+    /**
+     * The suggested quality of the slowest user, or INT_MAX if no users have
+     * yet been surveyed.
+     */
+    int min_quality;
+
+    /**
+     * The suggested quality at or above which users are placed in the first
+     * tier.
+     */
+    int threshold;
+
+    /**
+     * The number of users assigned to the first tier.
+     */
+    int fast_user_count;
+
+} guac_display_quality_survey;
+
+/**
+ * Returns an appropriate quality between 0 and 100 for lossy encoding
+ * depending on the given processing lag.
+ *
+ * @param lag
+ *     The processing lag of the user receiving the image data, in
+ *     milliseconds.
+ *
+ * @return
+ *     A value between 0 and 100 inclusive which seems appropriate for the
+ *     user based on lag measurements.
+ */
+static int guac_display_suggest_quality(int lag) {
+
+    /* Scale quality linearly from 90 to 30 as lag varies from 20ms to 80ms */
+    int quality = 90 - (lag - 20);
+
+    /* Do not exceed 90 for quality */
+    if (quality > GUAC_DISPLAY_MAX_QUALITY)
+        return GUAC_DISPLAY_MAX_QUALITY;
+
+    /* Do not go below 30 for quality */
+    if (quality < GUAC_DISPLAY_MIN_QUALITY)
+        return GUAC_DISPLAY_MIN_QUALITY;
+
+    return quality;
+
+}
+
+/**
+ * Callback for guac_client_foreach_user() which records the range of
+ * qualities suggested for all users.
+ *
+ * @param user
+ *     The user being surveyed.
+ *
+ * @param data
+ *     A pointer to the guac_display_quality_survey being gathered.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guac_display_quality_survey_range(guac_user* user, void* data) {
+
+    guac_display_quality_survey* survey = (guac_display_quality_survey*) data;
+    int quality = guac_display_suggest_quality(user->processing_lag);
+
+    if (quality > survey->max_quality)
+        survey->max_quality = quality;
+
+    if (quality < survey->min_quality)
+        survey->min_quality = quality;
+
+    return NULL;
+
+}
+
+/**
+ * Callback for guac_client_foreach_user() which assigns each user to a
+ * quality tier based on the threshold of the given survey, updating the
+ * quality and lag of each tier accordingly.
+ *
+ * @param user
+ *     The user being assigned to a tier.
+ *
+ * @param data
+ *     A pointer to the guac_display_quality_survey being gathered.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guac_display_quality_survey_assign(guac_user* user, void* data) {
+
+    guac_display_quality_survey* survey = (guac_display_quality_survey*) data;
+    guac_display_quality_tiers* tiers = survey->tiers;
+
+    int lag = user->processing_lag;
+    int quality = guac_display_suggest_quality(lag);
+
+    /* Users at or above the threshold form the first tier, which determines
+     * frame timing */
+    if (quality >= survey->threshold) {
+
+        if (quality < tiers->quality[0])
+            tiers->quality[0] = quality;
+
+        if (lag > tiers->lag)
+            tiers->lag = lag;
+
+        survey->fast_user_count++;
+
+    }
+
+    /* All other users are degraded, unless there are too many to track
+     * (which is handled by the caller) */
+    else {
+
+        if (quality < tiers->quality[1])
+            tiers->quality[1] = quality;
+
+        if (tiers->degraded_user_count < GUAC_DISPLAY_MAX_DEGRADED_USERS)
+            guac_strlcpy(tiers->degraded_users[tiers->degraded_user_count],
+                    user->user_id, GUAC_DISPLAY_USER_ID_SIZE);
+
+        tiers->degraded_user_count++;
+
+    }
+
+    return NULL;
+
+}
+
+void guac_display_quality_tiers_compute(guac_client* client,
+        guac_display_quality_tiers* tiers) {
+
+    guac_display_quality_survey survey = {
+        .tiers = tiers,
+        .max_quality = INT_MIN,
+        .min_quality = INT_MAX
+    };
+
+    tiers->count = 1;
+    tiers->quality[0] = GUAC_DISPLAY_MAX_QUALITY;
+    tiers->quality[1] = GUAC_DISPLAY_MAX_QUALITY;
+    tiers->lag = 0;
+    tiers->degraded_user_count = 0;
+
+    guac_client_foreach_user(client, guac_display_quality_survey_range, &survey);
+
+    /* No users, or users whose needs are similar enough to share the same
+     * encodings (using the quality suitable for the slowest of them) */
+    if (survey.max_quality == INT_MIN
+            || survey.max_quality - survey.min_quality < GUAC_DISPLAY_QUALITY_TIER_SPLIT) {
+        tiers->quality[0] = (survey.max_quality == INT_MIN)
+            ? GUAC_DISPLAY_MAX_QUALITY : survey.min_quality;
+        tiers->lag = guac_client_get_processing_lag(client);
+        return;
+    }
+
+    /* Split users halfway between the extremes. Users may have changed
+     * since the range was surveyed, so the assignment pass recomputes the
+     * quality and lag of each tier from scratch. */
+    survey.threshold = (survey.max_quality + survey.min_quality + 1) / 2;
+    guac_client_foreach_user(client, guac_display_quality_survey_assign, &survey);
+
+    /* Fall back to a single, shared tier if either tier ended up empty or
+     * there are too many degraded users to track */
+    if (tiers->degraded_user_count == 0
+            || tiers->degraded_user_count > GUAC_DISPLAY_MAX_DEGRADED_USERS
+            || survey.fast_user_count == 0) {
+        tiers->count = 1;
+        tiers->quality[0] = survey.min_quality;
+        tiers->lag = guac_client_get_processing_lag(client);
+        tiers->degraded_user_count = 0;
+        return;
+    }
+
+    tiers->count = 2;
+
+}
+
+int guac_display_quality_tier_of(const guac_display_quality_tiers* tiers,
+        const guac_user* user) {
+
+    for (int i = 0; i < tiers->degraded_user_count; i++) {
+        if (strcmp(tiers->degraded_users[i], user->user_id) == 0)
+            return 1;
+    }
+
+    return 0;
+
+}
@@ -118,11 +118,15 @@ static void* guac_display_render_loop(void* data) {
              * for a frame vs. the amount of time that it took the
              * client to process the most recently acknowledged frame
              * to calculate the amount of additional delay required to
-             * allow the client to catch up. This value is used later,
-             * after everything else related to the frame has been
-             * finalized. */
+             * allow the client to catch up. Only the lag of the fastest
+             * tier of users is considered, as slower users instead receive
+             * degraded image data. This value is used later, after
+             * everything else related to the frame has been finalized. */
+            guac_display_quality_tiers tiers;
+            guac_display_quality_tiers_compute(client, &tiers);
+
             int time_since_last_frame = guac_timestamp_current() - client->last_sent_timestamp;
-            int processing_lag = guac_client_get_processing_lag(client);
+            int processing_lag = tiers.lag;
             int required_wait = processing_lag - time_since_last_frame;
 
             /* Do not exceed a reasonable maximum framerate without an
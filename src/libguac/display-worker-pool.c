@@ -0,0 +1,634 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-priv.h"
+#include "guacamole/client.h"
+#include "guacamole/fifo.h"
+#include "guacamole/mem.h"
+#include "guacamole/proctitle.h"
+
+#ifdef __MINGW32__
+#include <winbase.h>
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * The number of worker threads to create per processor.
+ */
+#define GUAC_DISPLAY_CPU_THREAD_FACTOR 1
+
+/**
+ * The maximum number of worker threads that may exist within the shared
+ * worker pool, regardless of the number of available processors.
+ */
+#define GUAC_DISPLAY_WORKER_POOL_MAX_THREADS 32
+
+/**
+ * The number of tokens that each worker deque can store before its storage
+ * must be grown.
+ */
+#define GUAC_DISPLAY_WORKER_DEQUE_INITIAL_CAPACITY 64
+
+/**
+ * Ring buffer of display tokens owned by a single worker thread. Each token
+ * is a pointer to a guac_display that may have operations awaiting
+ * processing. The owning worker takes tokens from the front of its deque,
+ * while idle workers steal tokens from the back.
+ */
+typedef struct guac_display_worker_deque {
+
+    /**
+     * Lock which guards all other members of this structure.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Storage for all tokens within the deque.
+     */
+    guac_display** tokens;
+
+    /**
+     * The number of tokens that can be stored in the tokens array.
+     */
+    size_t capacity;
+
+    /**
+     * The index of the token at the front of the deque.
+     */
+    size_t head;
+
+    /**
+     * The number of tokens currently in the deque.
+     */
+    size_t length;
+
+} guac_display_worker_deque;
+
+/**
+ * Process-wide pool of worker threads that encode and send graphical updates
+ * on behalf of all guac_display instances within the current process.
+ */
+typedef struct guac_display_worker_pool {
+
+    /**
+     * Lock which must be held while starting or stopping the pool, or while
+     * reading or modifying display_count. This lock is held while waiting
+     * for worker threads to terminate, and so is distinct from lock.
+     */
+    pthread_mutex_t registry_lock;
+
+    /**
+     * The number of guac_display instances currently making use of the pool.
+     * The pool is started when this value becomes non-zero and is stopped
+     * when this value returns to zero.
+     */
+    int display_count;
+
+    /**
+     * The index (modulo thread_count) of the home deque to assign to the next
+     * registered display, such that displays are spread evenly across the
+     * worker deques.
+     */
+    unsigned int next_home;
+
+    /**
+     * The number of worker threads (and worker deques) within the pool. This
+     * value does not change while any display is registered.
+     */
+    int thread_count;
+
+    /**
+     * All worker threads within the pool.
+     */
+    pthread_t* threads;
+
+    /**
+     * The deques owned by each worker thread, where the deque at index N is
+     * owned by the worker thread at index N.
+     */
+    guac_display_worker_deque* deques;
+
+    /**
+     * Lock which guards the members below, including the statistics
+     * counters, and which is used with tokens_available to wait for work.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition that is signalled whenever a token is added to any deque, or
+     * when the pool is stopping.
+     */
+    pthread_cond_t tokens_available;
+
+    /**
+     * Non-zero if the worker threads should continue running, zero if they
+     * should terminate once no tokens remain.
+     */
+    int running;
+
+    /**
+     * The number of worker threads currently waiting on tokens_available.
+     */
+    int idle_threads;
+
+    /**
+     * Statistics describing the activity of the pool since it was last
+     * started.
+     */
+    guac_display_worker_pool_stats stats;
+
+} guac_display_worker_pool;
+
+/**
+ * The single worker pool shared by all guac_display instances within the
+ * current process.
+ */
+static guac_display_worker_pool guac_display_worker_pool_instance = {
+    .registry_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .tokens_available = PTHREAD_COND_INITIALIZER
+};
+
+/**
+ * Returns the number of processors available to this process. If possible,
+ * limits on otherwise available processors like CPU affinity will be taken
+ * into account. If the number of available processors cannot be determined,
+ * zero is returned.
+ *
+ * @return
+ *     The number of available processors, or zero if this value cannot be
+ *     determined for any reason.
+ */
+static unsigned long guac_display_nproc(void) {
+
+#if defined(HAVE_SCHED_GETAFFINITY)
+
+    /* Linux, etc. implementation leveraging sched_getaffinity() (this is
+     * specific to glibc and MUSL libc and is non-portable) */
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        long cpu_count = CPU_COUNT(&cpu_set);
+        if (cpu_count > 0)
+            return cpu_count;
+    }
+
+#elif defined(_SC_NPROCESSORS_ONLN)
+
+    /* Linux, etc. implementation leveraging sysconf() and _SC_NPROCESSORS_ONLN
+     * (which is also non-portable) */
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count > 0)
+        return cpu_count;
+
+#elif defined(__MINGW32__)
+
+    /* Windows-specific implementation (clearly also non-portable) */
+
+    unsigned long cpu_count = 0;
+    DWORD_PTR process_mask, system_mask;
+    for (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+            process_mask != 0; process_mask >>= 1) {
+
+        if (process_mask & 1)
+                cpu_count++;
+
+    }
+
+    if (cpu_count > 0)
+        return cpu_count;
+
+#else
+
+    /* Fallback implementation that does not query the number of CPUs available
+     * at all, returning an error code (as portable as it gets) */
+
+    long cpu_count = 0;
+
+#endif
+
+    return 0;
+
+}
+
+/**
+ * Adds the given display token to the back of the given deque, growing the
+ * deque's storage if necessary.
+ *
+ * @param deque
+ *     The deque that should receive the token.
+ *
+ * @param display
+ *     The display that the token represents.
+ */
+static void guac_display_worker_deque_push(guac_display_worker_deque* deque,
+        guac_display* display) {
+
+    pthread_mutex_lock(&deque->lock);
+
+    /* Double available storage if the deque is full, unwrapping any tokens
+     * that wrapped around the end of the old ring buffer */
+    if (deque->length == deque->capacity) {
+
+        size_t old_capacity = deque->capacity;
+        deque->capacity = guac_mem_ckd_mul_or_die(old_capacity, 2);
+        deque->tokens = guac_mem_realloc_or_die(deque->tokens,
+                deque->capacity, sizeof(guac_display*));
+
+        for (size_t i = 0; i < deque->head; i++)
+            deque->tokens[old_capacity + i] = deque->tokens[i];
+
+    }
+
+    size_t tail = (deque->head + deque->length) % deque->capacity;
+    deque->tokens[tail] = display;
+    deque->length++;
+
+    pthread_mutex_unlock(&deque->lock);
+
+}
+
+/**
+ * Removes and returns the token at the front of the given deque. This is how
+ * the owning worker thread takes tokens from its own deque, such that the
+ * tokens of different displays are processed in round-robin order.
+ *
+ * @param deque
+ *     The deque to take a token from.
+ *
+ * @return
+ *     The display that the removed token represents, or NULL if the deque is
+ *     empty.
+ */
+static guac_display* guac_display_worker_deque_pop_front(guac_display_worker_deque* deque) {
+
+    guac_display* display = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->length) {
+        display = deque->tokens[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->length--;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return display;
+
+}
+
+/**
+ * Removes and returns the token at the back of the given deque. This is how
+ * idle worker threads steal tokens from the deques of other workers, taking
+ * the most recently added token so that the owner continues to work through
+ * older tokens undisturbed.
+ *
+ * @param deque
+ *     The deque to steal a token from.
+ *
+ * @return
+ *     The display that the removed token represents, or NULL if the deque is
+ *     empty.
+ */
+static guac_display* guac_display_worker_deque_pop_back(guac_display_worker_deque* deque) {
+
+    guac_display* display = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->length) {
+        deque->length--;
+        display = deque->tokens[(deque->head + deque->length) % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return display;
+
+}
+
+/**
+ * Adds a token for the given display to the back of the deque at the given
+ * index, waking an idle worker thread if any are waiting.
+ *
+ * @param pool
+ *     The worker pool containing the deque.
+ *
+ * @param index
+ *     The index of the deque that should receive the token.
+ *
+ * @param display
+ *     The display that the token represents.
+ */
+static void guac_display_worker_pool_push(guac_display_worker_pool* pool,
+        int index, guac_display* display) {
+
+    guac_display_worker_deque_push(&pool->deques[index], display);
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool->stats.tokens_queued++;
+    pool->stats.queue_depth++;
+    if (pool->stats.queue_depth > pool->stats.max_queue_depth)
+        pool->stats.max_queue_depth = pool->stats.queue_depth;
+
+    if (pool->idle_threads)
+        pthread_cond_signal(&pool->tokens_available);
+
+    pthread_mutex_unlock(&pool->lock);
+
+}
+
+/**
+ * Takes the next token to be processed by the worker thread at the given
+ * index, first from that worker's own deque and then, if that deque is
+ * empty, by stealing from the deques of other workers. If no tokens are
+ * available anywhere, this function blocks until a token is added or the
+ * pool is stopped.
+ *
+ * @param pool
+ *     The worker pool containing the worker thread.
+ *
+ * @param index
+ *     The index of the worker thread requesting a token.
+ *
+ * @return
+ *     The display that the taken token represents, or NULL if the pool is
+ *     stopping and the worker thread should terminate.
+ */
+static guac_display* guac_display_worker_pool_take(guac_display_worker_pool* pool,
+        int index) {
+
+    for (;;) {
+
+        int stolen = 0;
+        guac_display* display = guac_display_worker_deque_pop_front(&pool->deques[index]);
+
+        /* Attempt to steal from other workers, starting with the next worker
+         * in sequence such that victims are spread evenly */
+        for (int i = 1; display == NULL && i < pool->thread_count; i++) {
+            int victim = (index + i) % pool->thread_count;
+            display = guac_display_worker_deque_pop_back(&pool->deques[victim]);
+            stolen = (display != NULL);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (display != NULL) {
+
+            pool->stats.queue_depth--;
+            pool->stats.tokens_taken++;
+            if (stolen)
+                pool->stats.tokens_stolen++;
+
+            pthread_mutex_unlock(&pool->lock);
+            return display;
+
+        }
+
+        if (pool->thread_count > 1)
+            pool->stats.failed_steals++;
+
+        /* Wait for further tokens only if none were added while searching
+         * (queue_depth is updated only after a token has been added to a
+         * deque, and so may be briefly lower than the true number of
+         * tokens, but never higher) */
+        if (!pool->stats.queue_depth) {
+
+            if (!pool->running) {
+                pthread_mutex_unlock(&pool->lock);
+                return NULL;
+            }
+
+            pool->idle_threads++;
+            pthread_cond_wait(&pool->tokens_available, &pool->lock);
+            pool->idle_threads--;
+
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+
+    }
+
+}
+
+/**
+ * Worker thread that continuously takes display tokens from the shared
+ * worker pool, processing one operation from the corresponding display for
+ * each token taken. Tokens for displays that still have pending operations
+ * are returned to the back of this worker's own deque, behind the tokens of
+ * any other displays, such that no single display can starve the others.
+ *
+ * @param data
+ *     The index of the worker thread within the pool, cast to a pointer.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guac_display_worker_pool_thread(void* data) {
+
+    /* Thread name display-wrk: one worker in the shared display pool; encodes
+     * and sends graphical updates for dirty layer regions of any display. */
+    guac_thread_name_set("display-wrk");
+
+    guac_display_worker_pool* pool = &guac_display_worker_pool_instance;
+    int index = (int) (intptr_t) data;
+
+    guac_display* display;
+    while ((display = guac_display_worker_pool_take(pool, index)) != NULL) {
+        if (guac_display_worker_process(display))
+            guac_display_worker_pool_push(pool, index, display);
+    }
+
+    return NULL;
+
+}
+
+/**
+ * Starts all worker threads of the shared worker pool, logging the number of
+ * threads started using the client of the given display. The registry_lock
+ * of the pool must be held.
+ *
+ * @param pool
+ *     The worker pool to start.
+ *
+ * @param display
+ *     The display whose client should be used for logging.
+ */
+static void guac_display_worker_pool_start(guac_display_worker_pool* pool,
+        guac_display* display) {
+
+    guac_client* client = display->client;
+
+    int cpu_count = guac_display_nproc();
+    if (cpu_count <= 0) {
+        guac_client_log(client, GUAC_LOG_WARNING, "Number of available "
+                "processors could not be determined. Assuming single-processor.");
+        cpu_count = 1;
+    }
+    else {
+        guac_client_log(client, GUAC_LOG_INFO, "Local system reports %i "
+                "processor(s) are available.", cpu_count);
+    }
+
+    pool->thread_count = cpu_count * GUAC_DISPLAY_CPU_THREAD_FACTOR;
+    if (pool->thread_count > GUAC_DISPLAY_WORKER_POOL_MAX_THREADS)
+        pool->thread_count = GUAC_DISPLAY_WORKER_POOL_MAX_THREADS;
+
+    pool->deques = guac_mem_zalloc(pool->thread_count, sizeof(guac_display_worker_deque));
+    for (int i = 0; i < pool->thread_count; i++) {
+        guac_display_worker_deque* deque = &pool->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->capacity = GUAC_DISPLAY_WORKER_DEQUE_INITIAL_CAPACITY;
+        deque->tokens = guac_mem_alloc(deque->capacity, sizeof(guac_display*));
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = 1;
+    pool->stats = (guac_display_worker_pool_stats) {
+        .thread_count = pool->thread_count
+    };
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->threads = guac_mem_alloc(pool->thread_count, sizeof(pthread_t));
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_create(&(pool->threads[i]), NULL,
+                guac_display_worker_pool_thread, (void*) (intptr_t) i);
+
+    guac_client_log(client, GUAC_LOG_INFO, "Graphical updates will be encoded "
+            "using a shared pool of %i worker thread(s).", pool->thread_count);
+
+}
+
+/**
+ * Stops and waits for all worker threads of the shared worker pool, freeing
+ * any associated storage. The registry_lock of the pool must be held, and
+ * no displays may be registered with the pool.
+ *
+ * @param pool
+ *     The worker pool to stop.
+ */
+static void guac_display_worker_pool_stop(guac_display_worker_pool* pool) {
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = 0;
+    pthread_cond_broadcast(&pool->tokens_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        guac_display_worker_deque* deque = &pool->deques[i];
+        pthread_mutex_destroy(&deque->lock);
+        guac_mem_free(deque->tokens);
+    }
+
+    guac_mem_free(pool->deques);
+    guac_mem_free(pool->threads);
+    pool->thread_count = 0;
+
+}
+
+void guac_display_worker_pool_register(guac_display* display) {
+
+    guac_display_worker_pool* pool = &guac_display_worker_pool_instance;
+
+    pthread_mutex_lock(&pool->registry_lock);
+
+    if (pool->display_count++ == 0)
+        guac_display_worker_pool_start(pool, display);
+
+    display->worker_home = pool->next_home++ % pool->thread_count;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.display_count = pool->display_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->registry_lock);
+
+}
+
+void guac_display_worker_pool_unregister(guac_display* display) {
+
+    guac_display_worker_pool* pool = &guac_display_worker_pool_instance;
+
+    pthread_mutex_lock(&pool->registry_lock);
+
+    guac_display_worker_pool_stats stats;
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.display_count = --pool->display_count;
+    stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+
+    guac_client_log(display->client, GUAC_LOG_DEBUG, "Display worker pool: "
+            "%i thread(s) serving %i display(s), queue depth %u (max %u), "
+            "%" PRIu64 " of %" PRIu64 " token(s) stolen, %" PRIu64 " failed "
+            "steal attempt(s).", stats.thread_count, stats.display_count,
+            stats.queue_depth, stats.max_queue_depth, stats.tokens_stolen,
+            stats.tokens_taken, stats.failed_steals);
+
+    if (pool->display_count == 0)
+        guac_display_worker_pool_stop(pool);
+
+    pthread_mutex_unlock(&pool->registry_lock);
+
+}
+
+void guac_display_worker_pool_notify(guac_display* display) {
+
+    guac_display_worker_pool* pool = &guac_display_worker_pool_instance;
+
+    /* Tokens are pointless if no further operations can be dequeued */
+    if (!guac_fifo_is_valid(&display->ops))
+        return;
+
+    /* Provide exactly enough tokens for each pending operation (including
+     * refinements) to be handled concurrently, up to the number of worker
+     * threads. Limiting the number of tokens per display ensures that a
+     * display with a large backlog cannot monopolize the deques at the
+     * expense of other displays. */
+    size_t wanted = display->ops.item_count + display->refinement_count;
+    if (wanted > (size_t) pool->thread_count)
+        wanted = pool->thread_count;
+
+    while (display->worker_tokens < wanted) {
+        guac_display_worker_pool_push(pool, display->worker_home, display);
+        display->worker_tokens++;
+    }
+
+}
+
+void guac_display_worker_pool_get_stats(guac_display_worker_pool_stats* stats) {
+
+    guac_display_worker_pool* pool = &guac_display_worker_pool_instance;
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+
+}
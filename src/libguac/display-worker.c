@@ -19,11 +19,11 @@
 
 #include "display-plan.h"
 #include "display-priv.h"
+#include "socket-broadcast.h"
 #include "guacamole/client.h"
 #include "guacamole/display.h"
 #include "guacamole/fifo.h"
 #include "guacamole/layer.h"
-#include "guacamole/proctitle.h"
 #include "guacamole/protocol-types.h"
 #include "guacamole/protocol.h"
 #include "guacamole/rect.h"
@@ -57,7 +57,7 @@
  *     eventually be freed with a call to cairo_surface_destroy().
  */
 static cairo_surface_t* LFR_guac_display_layer_cairo_rect(guac_display_layer* display_layer,
-        guac_rect* dirty) {
+        const guac_rect* dirty) {
 
     /* Get Cairo surface covering dirty rect */
     unsigned char* buffer = GUAC_DISPLAY_LAYER_STATE_MUTABLE_BUFFER(display_layer->last_frame, *dirty);
@@ -93,7 +93,7 @@ static cairo_surface_t* LFR_guac_display_layer_cairo_rect(guac_display_layer* di
  *     The rectangular region of the drawing operation.
  */
 static void guac_display_layer_clear_non_opaque(guac_display_layer* display_layer,
-        guac_rect* dirty) {
+        const guac_rect* dirty) {
 
     guac_display* display = display_layer->display;
     const guac_layer* layer = display_layer->layer;
@@ -121,36 +121,6 @@ static void guac_display_layer_clear_non_opaque(guac_display_layer* display_laye
 
 }
 
-/**
- * Returns an appropriate quality between 0 and 100 for lossy encoding
- * depending on the current processing lag calculated for the given client.
- *
- * @param client
- *     The client for which the lossy quality is being calculated.
- *
- * @return
- *     A value between 0 and 100 inclusive which seems appropriate for the
- *     client based on lag measurements.
- */
-static int guac_display_suggest_quality(guac_client* client) {
-
-    int lag = guac_client_get_processing_lag(client);
-
-    /* Scale quality linearly from 90 to 30 as lag varies from 20ms to 80ms */
-    int quality = 90 - (lag - 20);
-
-    /* Do not exceed 90 for quality */
-    if (quality > 90)
-        return 90;
-
-    /* Do not go below 30 for quality */
-    if (quality < 30)
-        return 30;
-
-    return quality;
-
-}
-
 /**
  * Guesses whether a rectangle within a particular layer would be better
  * compressed as PNG or using a lossy format like JPEG. Positive values
@@ -221,260 +191,929 @@ static int LFR_guac_display_layer_png_optimality(guac_display_layer* layer,
 }
 
 /**
- * Returns whether the given rectangle would be optimally encoded as JPEG
- * rather than PNG.
+ * Chooses the encoder and quality that should be used to send the image data
+ * of the given operation, based on the content of the image, the
+ * capabilities of connected clients, whether lossless encoding is required,
+ * and the share of the current frame's time budget allotted to the
+ * operation.
  *
  * @param layer
- *     The layer to be queried.
+ *     The layer receiving the image data.
  *
- * @param rect
- *     The rectangle to check.
+ * @param op
+ *     The image operation being encoded.
  *
  * @param framerate
- *     The rate that the region covered by the given rectangle has historically
+ *     The rate that the region covered by the operation has historically
  *     been being updated within the given layer, in frames per second.
  *
+ * @param refinement
+ *     Non-zero if the operation is the refinement of an operation that was
+ *     previously sent progressively. Refinements are sent between frames,
+ *     and so always use the preferred encoder at the preferred quality
+ *     regardless of the frame budget.
+ *
+ * @param choice
+ *     The structure that should receive the chosen encoder and quality.
+ */
+static void LFR_guac_display_layer_select_encoder(guac_display_layer* layer,
+        const guac_display_plan_operation* op, int framerate, int refinement,
+        guac_display_encoder_choice* choice) {
+
+    guac_display* display = layer->display;
+    guac_client* client = display->client;
+    const guac_rect* rect = &op->dest;
+
+    int lossless = layer->last_frame.lossless;
+    size_t rect_size = (size_t) guac_rect_width(rect) * guac_rect_height(rect);
+
+    guac_display_content_class content_class = GUAC_DISPLAY_CONTENT_FLAT;
+    if (LFR_guac_display_layer_png_optimality(layer, rect) < 0)
+        content_class = GUAC_DISPLAY_CONTENT_PHOTO;
+
+    /* PNG is always available. WebP is available if supported (and is
+     * encoded losslessly if lossless quality is required). JPEG requires
+     * that lossy encoding is acceptable, that the layer be opaque, and that
+     * the image be large enough to benefit. */
+    int candidates = 1 << GUAC_DISPLAY_ENCODER_PNG;
+
+    int lossless_candidates = 1 << GUAC_DISPLAY_ENCODER_PNG;
+
+    if (guac_client_supports_webp(client)) {
+        candidates |= 1 << GUAC_DISPLAY_ENCODER_WEBP;
+        if (lossless)
+            lossless_candidates |= 1 << GUAC_DISPLAY_ENCODER_WEBP;
+    }
+
+    if (!lossless && layer->opaque && rect_size > GUAC_DISPLAY_JPEG_MIN_BITMAP_SIZE)
+        candidates |= 1 << GUAC_DISPLAY_ENCODER_JPEG;
+
+    /* Lossy encoding is preferred only for regions that are updated
+     * frequently, where any artifacts will quickly be replaced */
+    int prefer_lossless = lossless || framerate < GUAC_DISPLAY_JPEG_FRAMERATE;
+
+    /* Choose the encoder for the first quality tier, which contains the
+     * fastest users. Any other tier receives the same encoder at a lower
+     * quality. */
+    int quality = display->quality_tiers.quality[0];
+    guac_display_encoder_model_select(&display->encoder_model, candidates,
+            lossless_candidates, prefer_lossless, content_class, rect_size, op->dirty_size,
+            quality, choice);
+
+    if (refinement) {
+        choice->encoder = guac_display_encoder_preferred(candidates,
+                prefer_lossless, content_class);
+        choice->quality = quality;
+    }
+
+}
+
+/**
+ * Releases the worker pool token held by the current thread for the given
+ * display, unless the display has further operations pending, in which case
+ * the token is retained so that it may be returned to the worker pool. If
+ * the display has been stopped and this was its last token, the
+ * GUAC_DISPLAY_RENDER_STATE_STOPPED flag is set, after which the display
+ * MUST NOT be referenced further by the current thread.
+ *
+ * @param display
+ *     The display whose token is held by the current thread.
+ *
  * @return
- *     Non-zero if the rectangle would be optimally encoded as JPEG, zero
- *     otherwise.
+ *     Non-zero if the display has further operations pending and the token
+ *     has been retained, zero if the token has been released.
  */
-static int LFR_guac_display_layer_should_use_jpeg(guac_display_layer* layer,
-        const guac_rect* rect, int framerate) {
+static int guac_display_worker_release_token(guac_display* display) {
 
-    /* Do not use JPEG if lossless quality is required */
-    if (layer->last_frame.lossless)
-        return 0;
+    guac_fifo_lock(&display->ops);
 
-    int rect_width = rect->right - rect->left;
-    int rect_height = rect->bottom - rect->top;
-    int rect_size = rect_width * rect_height;
+    /* Keep the token if there is more work to be done (refinements count
+     * only once the current frame has been fully sent, as they cannot be
+     * processed until then) */
+    if (guac_fifo_is_valid(&display->ops)
+            && ((display->ops.state.value & GUAC_FIFO_STATE_NONEMPTY)
+                || (display->refinement_count && !display->active_workers))) {
+        guac_fifo_unlock(&display->ops);
+        return 1;
+    }
+
+    int stopped = --display->worker_tokens == 0
+        && !guac_fifo_is_valid(&display->ops);
+
+    guac_fifo_unlock(&display->ops);
+
+    /* The display may be freed as soon as this flag is set */
+    if (stopped)
+        guac_flag_set(&display->render_state, GUAC_DISPLAY_RENDER_STATE_STOPPED);
 
-    /* JPEG is preferred if:
-     * - frame rate is high enough
-     * - image size is large enough
-     * - PNG is not more optimal based on image contents */
-    return framerate >= GUAC_DISPLAY_JPEG_FRAMERATE
-        && rect_size > GUAC_DISPLAY_JPEG_MIN_BITMAP_SIZE
-        && LFR_guac_display_layer_png_optimality(layer, rect) < 0;
+    return 0;
 
 }
 
 /**
- * Returns whether the given rectangle would be optimally encoded as WebP
- * rather than PNG.
+ * Returns a new Cairo surface containing the contents of the given rectangle
+ * of the given layer at half its original width and height (one quarter of
+ * its original number of pixels), with each pixel of the new surface being
+ * the average of the corresponding 2x2 block of pixels within the layer. The
+ * layer must be opaque, and the contents of the rectangle are read from the
+ * layer's last_frame buffer. The returned surface must eventually be freed
+ * with a call to cairo_surface_destroy().
  *
- * @param layer
- *     The layer to be queried.
+ * @param display_layer
+ *     The opaque layer containing the image data to downscale.
  *
  * @param rect
- *     The rectangle to check.
+ *     The region of the layer that should be downscaled.
  *
- * @param framerate
- *     The rate that the region covered by the given rectangle has historically
- *     been being updated within the given layer, in frames per second.
+ * @return
+ *     A new Cairo surface containing a reduced-resolution copy of the given
+ *     rectangle. This surface must eventually be freed with a call to
+ *     cairo_surface_destroy().
+ */
+static cairo_surface_t* LFR_guac_display_layer_downscale(guac_display_layer* display_layer,
+        const guac_rect* rect) {
+
+    int width = guac_rect_width(rect);
+    int height = guac_rect_height(rect);
+
+    int half_width = (width + 1) / 2;
+    int half_height = (height + 1) / 2;
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            half_width, half_height);
+
+    unsigned char* dst = cairo_image_surface_get_data(surface);
+    int dst_stride = cairo_image_surface_get_stride(surface);
+
+    size_t src_stride = display_layer->last_frame.buffer_stride;
+    const unsigned char* src = GUAC_DISPLAY_LAYER_STATE_CONST_BUFFER(display_layer->last_frame, *rect);
+
+    for (int y = 0; y < half_height; y++) {
+
+        /* Repeat the final row/column of odd dimensions rather than reading
+         * beyond the rectangle */
+        const uint32_t* row_a = (const uint32_t*) (src + (size_t) (y * 2) * src_stride);
+        const uint32_t* row_b = (y * 2 + 1 < height) ? (const uint32_t*) ((const unsigned char*) row_a + src_stride) : row_a;
+
+        uint32_t* out = (uint32_t*) (dst + (size_t) y * dst_stride);
+
+        for (int x = 0; x < half_width; x++) {
+
+            int left = x * 2;
+            int right = (left + 1 < width) ? left + 1 : left;
+
+            uint32_t a = row_a[left], b = row_a[right];
+            uint32_t c = row_b[left], d = row_b[right];
+
+            /* Average red and blue together, and green separately, such
+             * that the sum of each channel cannot overflow into another */
+            uint32_t red_blue = ((a & 0xFF00FF) + (b & 0xFF00FF)
+                    + (c & 0xFF00FF) + (d & 0xFF00FF) + 0x020002) >> 2;
+
+            uint32_t green = ((a & 0x00FF00) + (b & 0x00FF00)
+                    + (c & 0x00FF00) + (d & 0x00FF00) + 0x000200) >> 2;
+
+            out[x] = 0xFF000000 | (red_blue & 0xFF00FF) | (green & 0x00FF00);
+
+        }
+
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+
+}
+
+/**
+ * The state of a broadcast filter which restricts broadcast output to the
+ * users of a single quality tier.
+ */
+typedef struct guac_display_quality_tier_filter {
+
+    /**
+     * The quality tiers that users have been divided into.
+     */
+    const guac_display_quality_tiers* tiers;
+
+    /**
+     * The index of the quality tier whose users should receive output.
+     */
+    int tier;
+
+} guac_display_quality_tier_filter;
+
+/**
+ * Broadcast filter callback which accepts only the users of the quality tier
+ * described by the given guac_display_quality_tier_filter.
+ *
+ * @param user
+ *     The user that would receive broadcast output.
+ *
+ * @param data
+ *     The guac_display_quality_tier_filter describing the tier whose users
+ *     should receive broadcast output.
  *
  * @return
- *     Non-zero if the rectangle would be optimally encoded as WebP, zero
- *     otherwise.
+ *     Non-zero if the user is within the relevant tier, zero otherwise.
+ */
+static int guac_display_quality_tier_filter_callback(guac_user* user, void* data) {
+    guac_display_quality_tier_filter* filter = (guac_display_quality_tier_filter*) data;
+    return guac_display_quality_tier_of(filter->tiers, user) == filter->tier;
+}
+
+/**
+ * Streams the given Cairo surface to the given layer along the given socket
+ * using the encoder of the given choice at the given quality.
+ *
+ * @param display_layer
+ *     The display layer that the image data originates from.
+ *
+ * @param socket
+ *     The socket that the image data should be sent along.
+ *
+ * @param layer
+ *     The Guacamole layer that should receive the image data.
+ *
+ * @param x
+ *     The X coordinate of the upper-left corner of the destination within
+ *     the receiving layer.
+ *
+ * @param y
+ *     The Y coordinate of the upper-left corner of the destination within
+ *     the receiving layer.
+ *
+ * @param surface
+ *     The image data to send.
+ *
+ * @param encoder
+ *     The encoder to use.
+ *
+ * @param quality
+ *     The quality to request of the encoder, if lossy.
+ */
+static void guac_display_layer_stream_encoded(guac_display_layer* display_layer,
+        guac_socket* socket, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface, guac_display_encoder encoder, int quality) {
+
+    guac_client* client = display_layer->display->client;
+
+    switch (encoder) {
+
+        case GUAC_DISPLAY_ENCODER_WEBP:
+            guac_client_stream_webp(client, socket, GUAC_COMP_OVER, layer,
+                    x, y, surface, quality,
+                    display_layer->last_frame.lossless ? 1 : 0);
+            break;
+
+        case GUAC_DISPLAY_ENCODER_JPEG:
+            guac_client_stream_jpeg(client, socket, GUAC_COMP_OVER, layer,
+                    x, y, surface, quality);
+            break;
+
+        default:
+            guac_client_stream_png(client, socket, GUAC_COMP_OVER,
+                    layer, x, y, surface);
+            break;
+
+    }
+
+}
+
+/**
+ * Streams the given Cairo surface to the given layer using the encoder and
+ * quality of the given choice, returning the time taken. If connected users
+ * have been divided into multiple quality tiers and the chosen encoder is
+ * lossy, users outside the first tier receive a separate, lower-quality
+ * encoding of the same image. Lossless image data is always shared by all
+ * users. The time taken by any such separate encoding is recorded within the
+ * encoder model of the display as a sample of its own, and is not included
+ * in the returned time.
+ *
+ * @param display_layer
+ *     The display layer that the image data originates from.
+ *
+ * @param socket
+ *     The socket that should receive the image data sent to the first
+ *     quality tier (or to all users, if the image data is shared). This
+ *     must be either the socket of the client or the unrecorded_socket of
+ *     the display.
+ *
+ * @param layer
+ *     The Guacamole layer that should receive the image data.
+ *
+ * @param x
+ *     The X coordinate of the upper-left corner of the destination within
+ *     the receiving layer.
+ *
+ * @param y
+ *     The Y coordinate of the upper-left corner of the destination within
+ *     the receiving layer.
+ *
+ * @param surface
+ *     The image data to send.
+ *
+ * @param choice
+ *     The encoder and quality to use for the first quality tier.
+ *
+ * @return
+ *     The time taken to encode and send the image to the first quality tier
+ *     (or to all users, if the image data is shared), in nanoseconds.
+ */
+static uint64_t LFR_guac_display_layer_stream(guac_display_layer* display_layer,
+        guac_socket* socket, const guac_layer* layer, int x, int y,
+        cairo_surface_t* surface, const guac_display_encoder_choice* choice) {
+
+    guac_display* display = display_layer->display;
+    const guac_display_quality_tiers* tiers = &display->quality_tiers;
+
+    int lossy = choice->encoder == GUAC_DISPLAY_ENCODER_JPEG
+        || (choice->encoder == GUAC_DISPLAY_ENCODER_WEBP
+                && !display_layer->last_frame.lossless);
+
+    /* NOTE: The time measured here includes writing the encoded image to the
+     * socket, which is part of the cost of each encoder as far as meeting the
+     * frame budget is concerned */
+    uint64_t encode_start = guac_display_encoder_clock();
+
+    /* Share a single encoding with all users unless the users of the other
+     * tier actually need something different */
+    if (!lossy || tiers->count < 2 || tiers->quality[1] >= choice->quality) {
+        guac_display_layer_stream_encoded(display_layer, socket,
+                layer, x, y, surface, choice->encoder, choice->quality);
+        return guac_display_encoder_clock() - encode_start;
+    }
+
+    guac_display_quality_tier_filter tier_filter = { .tiers = tiers };
+    guac_socket_broadcast_filter filter = {
+        .callback = guac_display_quality_tier_filter_callback,
+        .data = &tier_filter
+    };
+
+    guac_socket_broadcast_set_filter(&filter);
+
+    /* The first tier receives the chosen quality via the given socket, such
+     * that any session recording receives the same */
+    tier_filter.tier = 0;
+    guac_display_layer_stream_encoded(display_layer, socket,
+            layer, x, y, surface, choice->encoder, choice->quality);
+
+    uint64_t encode_time = guac_display_encoder_clock() - encode_start;
+
+    /* The users of the second tier receive a degraded encoding that is not
+     * recorded */
+    uint64_t degraded_start = guac_display_encoder_clock();
+
+    tier_filter.tier = 1;
+    guac_display_layer_stream_encoded(display_layer, display->unrecorded_socket,
+            layer, x, y, surface, choice->encoder, tiers->quality[1]);
+
+    guac_socket_broadcast_set_filter(NULL);
+
+    /* The degraded encoding is a separate encode of the same pixels, and
+     * must not inflate the cost learned for the first tier */
+    guac_display_encoder_choice degraded = *choice;
+    degraded.quality = tiers->quality[1];
+    guac_display_encoder_model_record(&display->encoder_model, &degraded,
+            guac_display_encoder_clock() - degraded_start);
+
+    return encode_time;
+
+}
+
+/**
+ * Records a progressive refinement for the given image operation, if the
+ * operation is suitable for progressive encoding and there is room for
+ * another refinement. An operation is suitable only if its layer is opaque
+ * and not required to be lossless, it is large enough to benefit, and the
+ * chosen encoder is not expected to finish within the operation's share of
+ * the frame budget.
+ *
+ * @param display_layer
+ *     The layer receiving the image operation.
+ *
+ * @param op
+ *     The image operation being sent.
+ *
+ * @param choice
+ *     The encoder chosen for the operation at full resolution.
+ *
+ * @return
+ *     Non-zero if a refinement was recorded and the operation should now be
+ *     sent at reduced resolution, zero if the operation should be sent at
+ *     full resolution.
  */
-static int LFR_guac_display_layer_should_use_webp(guac_display_layer* layer,
-        const guac_rect* rect, int framerate) {
+static int LFR_guac_display_layer_defer_refinement(guac_display_layer* display_layer,
+        const guac_display_plan_operation* op,
+        const guac_display_encoder_choice* choice) {
 
-    /* Do not use WebP if not supported */
-    if (!guac_client_supports_webp(layer->display->client))
+    guac_display* display = display_layer->display;
+
+    if (!display_layer->opaque || display_layer->last_frame.lossless
+            || guac_rect_width(&op->dest) < GUAC_DISPLAY_PROGRESSIVE_MIN_SIZE
+            || guac_rect_height(&op->dest) < GUAC_DISPLAY_PROGRESSIVE_MIN_SIZE
+            || choice->predicted[choice->encoder] <= choice->budget)
         return 0;
 
-    /* WebP is preferred if:
-     * - frame rate is high enough
-     * - PNG is not more optimal based on image contents */
-    return framerate >= GUAC_DISPLAY_JPEG_FRAMERATE
-        && LFR_guac_display_layer_png_optimality(layer, rect) < 0;
+    int deferred = 0;
+
+    guac_fifo_lock(&display->ops);
+
+    if (display->refinement_count < GUAC_DISPLAY_MAX_REFINEMENTS) {
+        display->refinements[display->refinement_count++] = *op;
+        deferred = 1;
+    }
+
+    guac_fifo_unlock(&display->ops);
+
+    return deferred;
 
 }
 
-void* guac_display_worker_thread(void* data) {
+/**
+ * Sends the given image operation to all connected clients, choosing the
+ * encoder and quality using the encoder model of the layer's display. If
+ * allowed and appropriate, the operation is sent progressively: only a
+ * quarter-resolution pass is sent now, scaled to the full size of the
+ * operation through a temporary buffer, and a refinement is recorded such
+ * that the full-resolution image is sent after the frame has completed.
+ *
+ * The quarter-resolution pass relies on the "transform" instruction, which
+ * is not implemented by guacenc, and so is sent only to connected users via
+ * the unrecorded_socket of the display. Session recordings receive only the
+ * full-resolution refinement.
+ *
+ * @param display_layer
+ *     The layer receiving the image operation.
+ *
+ * @param op
+ *     The image operation to send.
+ *
+ * @param refinement
+ *     Non-zero if the operation is the refinement of an operation that was
+ *     previously sent progressively, and so must be sent at full resolution,
+ *     zero otherwise.
+ */
+static void LFR_guac_display_layer_send_image(guac_display_layer* display_layer,
+        const guac_display_plan_operation* op, int refinement) {
+
+    guac_display* display = display_layer->display;
+    guac_client* client = display->client;
+    const guac_layer* layer = display_layer->layer;
+    const guac_rect* dirty = &op->dest;
 
-    /* Thread name display-wrk: one worker in the display pool; encodes and
-     * sends graphical updates for dirty layer regions. */
-    guac_thread_name_set("display-wrk");
+    int framerate = INT_MAX;
+    if (op->current_frame > op->last_frame)
+        framerate = 1000 / (op->current_frame - op->last_frame);
 
-    int framerate;
-    int has_outstanding_frames = 0;
+    guac_display_encoder_choice choice;
+    LFR_guac_display_layer_select_encoder(display_layer, op, framerate,
+            refinement, &choice);
+
+    const char* pass = refinement ? "refined" : "full-resolution";
+    uint64_t encode_time;
+
+    if (!refinement && LFR_guac_display_layer_defer_refinement(display_layer, op, &choice)) {
+
+        int width = guac_rect_width(dirty);
+        int height = guac_rect_height(dirty);
+
+        cairo_surface_t* preview = LFR_guac_display_layer_downscale(display_layer, dirty);
+        choice.pixels = (size_t) cairo_image_surface_get_width(preview)
+            * cairo_image_surface_get_height(preview);
+
+        /* Draw the preview into a temporary buffer at double scale, such
+         * that the transform never affects drawing to the destination layer
+         * by other workers, and then copy the upscaled result into place.
+         * Session recordings continue to show the previous contents of the
+         * region until the refinement is sent, as guacenc cannot render the
+         * preview. */
+        guac_socket* socket = display->unrecorded_socket;
+        guac_layer* buffer = guac_client_alloc_buffer(client);
+        guac_protocol_send_size(socket, buffer, width + 1, height + 1);
+        guac_protocol_send_transform(socket, buffer, 2, 0, 0, 2, 0, 0);
+
+        encode_time = LFR_guac_display_layer_stream(display_layer, socket,
+                buffer, 0, 0, preview, &choice);
+
+        guac_protocol_send_copy(socket, buffer, 0, 0, width, height,
+                GUAC_COMP_OVER, layer, dirty->left, dirty->top);
+
+        guac_protocol_send_dispose(socket, buffer);
+        guac_client_free_buffer(client, buffer);
+
+        cairo_surface_destroy(preview);
+        pass = "quarter-resolution";
+
+    }
+
+    else {
+
+        cairo_surface_t* rect = LFR_guac_display_layer_cairo_rect(display_layer, dirty);
+
+        /* Clear relevant rect of destination layer if necessary to ensure
+         * fresh data is not drawn on top of old data for layers with alpha
+         * transparency */
+        guac_display_layer_clear_non_opaque(display_layer, dirty);
+
+        encode_time = LFR_guac_display_layer_stream(display_layer,
+                client->socket, layer, dirty->left, dirty->top, rect, &choice);
+
+        cairo_surface_destroy(rect);
+
+    }
+
+    guac_display_encoder_model_record(&display->encoder_model, &choice, encode_time);
+
+    guac_client_log(client, GUAC_LOG_TRACE, "Encoded %ix%i %s update "
+            "(%zu pixels changed) as %s %s (quality %i) in %.2fms of %.2fms "
+            "budget (predicted: PNG %.2fms, JPEG %.2fms, WebP %.2fms).",
+            guac_rect_width(dirty), guac_rect_height(dirty),
+            choice.content_class == GUAC_DISPLAY_CONTENT_FLAT ? "flat" : "photo",
+            op->dirty_size, pass, guac_display_encoder_name(choice.encoder),
+            choice.quality, encode_time / 1000000.0,
+            choice.budget / 1000000.0,
+            choice.predicted[GUAC_DISPLAY_ENCODER_PNG] / 1000000.0,
+            choice.predicted[GUAC_DISPLAY_ENCODER_JPEG] / 1000000.0,
+            choice.predicted[GUAC_DISPLAY_ENCODER_WEBP] / 1000000.0);
+
+}
+
+/**
+ * Returns whether a refinement may currently be sent for the given display.
+ * Refinements may only be sent while the display is running and no frame is
+ * being encoded. The ops FIFO of the display MUST be locked.
+ *
+ * @param display
+ *     The display to check.
+ *
+ * @return
+ *     Non-zero if a refinement is pending and may be sent now, zero
+ *     otherwise.
+ */
+static int guac_display_worker_can_refine(guac_display* display) {
+    return guac_fifo_is_valid(&display->ops)
+        && !(display->ops.state.value & GUAC_FIFO_STATE_NONEMPTY)
+        && !display->active_workers
+        && display->refinement_count;
+}
+
+/**
+ * Sends the full-resolution refinement of a single image operation that was
+ * previously sent progressively, if any such refinement is pending and no
+ * frame is currently being encoded, and then releases or retains the worker
+ * pool token held by the current thread for the given display. If this is
+ * the last pending refinement, a frame boundary is sent so that connected
+ * clients render the refined images.
+ *
+ * @param display
+ *     The display whose token is held by the current thread.
+ *
+ * @return
+ *     Non-zero if the display has further work pending and the token has
+ *     been retained, zero if the token has been released.
+ */
+static int guac_display_worker_refine(guac_display* display) {
 
-    guac_display* display = (guac_display*) data;
     guac_client* client = display->client;
     guac_socket* socket = client->socket;
 
-    guac_display_plan_operation op;
-    while (guac_fifo_dequeue_and_lock(&display->ops, &op)) {
+    /* Avoid waiting on the last_frame.lock (which may be held for writing
+     * while the next frame is being planned) unless there is actually a
+     * refinement to send */
+    guac_fifo_lock(&display->ops);
+    int refinable = guac_display_worker_can_refine(display);
+    guac_fifo_unlock(&display->ops);
 
-        /* Notify any watchers of render_state that a frame is now in progress */
-        guac_flag_set_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_IN_PROGRESS);
-        guac_flag_clear(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_NOT_IN_PROGRESS);
-        guac_flag_unlock(&display->render_state);
+    if (!refinable)
+        return guac_display_worker_release_token(display);
 
-        /* NOTE: Any thread that locks the operation queue can know that there
-         * are no pending operations in progress if the queue is empty and
-         * there are no active workers */
-        display->active_workers++;
+    /* NOTE: The last_frame.lock is acquired BEFORE taking a refinement, such
+     * that PFR_LFW_guac_display_preempt_refinements() (which requires the
+     * write lock) can know that no refinement is in progress */
+    guac_rwlock_acquire_read_lock(&display->last_frame.lock);
+    guac_fifo_lock(&display->ops);
+
+    if (!guac_display_worker_can_refine(display)) {
         guac_fifo_unlock(&display->ops);
+        guac_rwlock_release_lock(&display->last_frame.lock);
+        return guac_display_worker_release_token(display);
+    }
 
-        guac_rwlock_acquire_read_lock(&display->last_frame.lock);
-        guac_display_layer* display_layer = op.layer;
-        switch (op.type) {
-
-            case GUAC_DISPLAY_PLAN_OPERATION_IMG:
-
-                framerate = INT_MAX;
-                if (op.current_frame > op.last_frame)
-                    framerate = 1000 / (op.current_frame - op.last_frame);
-
-                guac_rect* dirty = &op.dest;
-
-                /* TODO: Determine whether to use PNG/WebP/JPEG purely
-                 * based on whether lossless encoding is required, the
-                 * expected time until another frame is received (time
-                 * since last frame), and estimated encoding times. The
-                 * time allowed per update should be divided up
-                 * proportionately based on the dirty_size of the update. */
-
-                /* TODO: Stream PNG/WebP/JPEG using progressive encoding such
-                 * that a frame that is currently being encoded can be
-                 * preempted by the next frame, with the connected client then
-                 * simply receiving a lower-quality intermediate frame. If
-                 * necessary, progressive encoding can be achieved by manually
-                 * dividing images into multiple reduced-resolution stages,
-                 * such that each image streamed is actually only one quarter
-                 * the size of the original image. Compositing via Guacamole
-                 * protocol instructions can reassemble those stages. */
-
-                cairo_surface_t* rect = LFR_guac_display_layer_cairo_rect(display_layer, dirty);
-                const guac_layer* layer = display_layer->layer;
-
-                /* Clear relevant rect of destination layer if necessary to
-                 * ensure fresh data is not drawn on top of old data for layers
-                 * with alpha transparency */
-                guac_display_layer_clear_non_opaque(display_layer, dirty);
-
-                /* Prefer WebP when reasonable */
-                if (LFR_guac_display_layer_should_use_webp(display_layer, dirty, framerate))
-                    guac_client_stream_webp(client, socket, GUAC_COMP_OVER, layer,
-                            dirty->left, dirty->top, rect,
-                            guac_display_suggest_quality(client),
-                            display_layer->last_frame.lossless ? 1 : 0);
-
-                /* If not WebP, JPEG is the next best (lossy) choice */
-                else if (display_layer->opaque && LFR_guac_display_layer_should_use_jpeg(display_layer, dirty, framerate))
-                    guac_client_stream_jpeg(client, socket, GUAC_COMP_OVER, layer,
-                            dirty->left, dirty->top, rect,
-                            guac_display_suggest_quality(client));
-
-                /* Use PNG if no lossy formats are appropriate */
-                else
-                    guac_client_stream_png(client, socket, GUAC_COMP_OVER,
-                            layer, dirty->left, dirty->top, rect);
-
-                cairo_surface_destroy(rect);
-                break;
+    guac_display_plan_operation op = display->refinements[--display->refinement_count];
+    display->active_refinements++;
+    guac_fifo_unlock(&display->ops);
 
-            case GUAC_DISPLAY_PLAN_OPERATION_COPY:
-            case GUAC_DISPLAY_PLAN_OPERATION_RECT:
-                guac_client_log(client, GUAC_LOG_DEBUG, "Operation type %i "
-                        "should NOT be present in the set of operations given "
-                        "to guac_display worker thread. All operations except "
-                        "IMG and NOP are handled during the initial, "
-                        "single-threaded flush step. This is likely a bug.",
-                        op.type);
-                break;
+    /* The layer may have been resized since the reduced-resolution pass was
+     * sent */
+    guac_display_layer* display_layer = op.layer;
+    guac_rect bounds;
+    guac_rect_init(&bounds, 0, 0, display_layer->last_frame.width,
+            display_layer->last_frame.height);
+    guac_rect_constrain(&op.dest, &bounds);
+
+    if (!guac_rect_is_empty(&op.dest)) {
 
-            case GUAC_DISPLAY_PLAN_OPERATION_NOP:
-                /* Do nothing */
+        LFR_guac_display_layer_send_image(display_layer, &op, 1);
+
+        /* Keep the client-side copy of the last frame up-to-date, as future
+         * copy operations may use it as their source */
+        guac_protocol_send_copy(socket, display_layer->layer,
+                op.dest.left, op.dest.top,
+                guac_rect_width(&op.dest), guac_rect_height(&op.dest),
+                GUAC_COMP_OVER, display_layer->last_frame_buffer,
+                op.dest.left, op.dest.top);
+
+    }
+
+    guac_fifo_lock(&display->ops);
+    display->active_refinements--;
+    int finished = !display->refinement_count && !display->active_refinements
+        && !(display->ops.state.value & GUAC_FIFO_STATE_NONEMPTY)
+        && !display->active_workers;
+    guac_fifo_unlock(&display->ops);
+
+    /* Allow connected clients to render all refinements */
+    if (finished) {
+        guac_client_end_multiple_frames(client, 0);
+        guac_socket_flush(socket);
+    }
+
+    guac_rwlock_release_lock(&display->last_frame.lock);
+    return guac_display_worker_release_token(display);
+
+}
+
+int guac_display_rect_subtract(const guac_rect* rect,
+        const guac_rect* hole, guac_rect remaining[4]) {
+
+    guac_rect overlap = *hole;
+    guac_rect_constrain(&overlap, rect);
+
+    if (guac_rect_is_empty(&overlap)) {
+        remaining[0] = *rect;
+        return 1;
+    }
+
+    int count = 0;
+
+    if (overlap.top > rect->top)
+        remaining[count++] = (guac_rect) {
+            .left = rect->left, .top = rect->top,
+            .right = rect->right, .bottom = overlap.top
+        };
+
+    if (overlap.bottom < rect->bottom)
+        remaining[count++] = (guac_rect) {
+            .left = rect->left, .top = overlap.bottom,
+            .right = rect->right, .bottom = rect->bottom
+        };
+
+    if (overlap.left > rect->left)
+        remaining[count++] = (guac_rect) {
+            .left = rect->left, .top = overlap.top,
+            .right = overlap.left, .bottom = overlap.bottom
+        };
+
+    if (overlap.right < rect->right)
+        remaining[count++] = (guac_rect) {
+            .left = overlap.right, .top = overlap.top,
+            .right = rect->right, .bottom = overlap.bottom
+        };
+
+    return count;
+
+}
+
+void PFR_LFW_guac_display_preempt_refinements(guac_display* display,
+        guac_display_plan* plan) {
+
+    guac_fifo_lock(&display->ops);
+
+    if (!display->refinement_count) {
+        guac_fifo_unlock(&display->ops);
+        return;
+    }
+
+    /* Copies from a region that has not yet been refined would spread
+     * reduced-resolution image data elsewhere, so send those as images */
+    for (size_t i = 0; plan != NULL && i < plan->length; i++) {
+
+        guac_display_plan_operation* op = &plan->ops[i];
+        if (op->type != GUAC_DISPLAY_PLAN_OPERATION_COPY)
+            continue;
+
+        for (unsigned int j = 0; j < display->refinement_count; j++) {
+
+            guac_display_plan_operation* refinement = &display->refinements[j];
+            if (op->src.layer_rect.layer == refinement->layer->last_frame_buffer
+                    && guac_rect_intersects(&op->src.layer_rect.rect, &refinement->dest)) {
+                op->type = GUAC_DISPLAY_PLAN_OPERATION_IMG;
+                op->dirty_size = (size_t) guac_rect_width(&op->dest) * guac_rect_height(&op->dest);
                 break;
+            }
 
         }
 
-        guac_fifo_lock(&display->ops);
-
-        /* If we're the only active worker and there are no further operations
-         * pending, we've reached the end of the frame, and this is the worker
-         * that will be sending that boundary to connected users */
-        if (!(display->ops.state.value & GUAC_FIFO_STATE_NONEMPTY) && display->active_workers == 1) {
-
-            /* Update the mouse cursor if it's been changed since the
-             * last frame */
-            guac_display_layer* cursor = display->cursor_buffer;
-            if (!guac_rect_is_empty(&cursor->last_frame.dirty)) {
-                guac_protocol_send_cursor(client->socket,
-                        display->last_frame.cursor_hotspot_x,
-                        display->last_frame.cursor_hotspot_y,
-                        cursor->layer, 0, 0,
-                        cursor->last_frame.width,
-                        cursor->last_frame.height);
-            }
+    }
 
-            /* Allow connected clients to move forward with rendering */
-            guac_client_end_multiple_frames(client, display->last_frame.frames);
+    /* Discard refinements of layers that no longer exist, as well as the
+     * parts of any refinement that this frame is about to replace. Parts
+     * that this frame does not replace are retained as separate refinements,
+     * as nothing else would ever restore those parts to full resolution. */
+    unsigned int i = 0;
+    while (i < display->refinement_count) {
 
-            /* While connected clients moves forward with rendering,
-             * commit any changed contents to client-side backing buffer */
-            guac_display_layer* current = display->last_frame.layers;
-            while (current != NULL) {
+        guac_display_plan_operation* refinement = &display->refinements[i];
+        int obsolete = 0;
 
-                /* Save a copy of the changed region if the layer has
-                 * been modified since the last frame */
-                guac_rect* dirty = &current->last_frame.dirty;
-                if (!guac_rect_is_empty(dirty)) {
+        for (guac_display_layer* removed = display->pending_frame_removed_layers;
+                removed != NULL && !obsolete; removed = removed->next_removed) {
+            obsolete = (refinement->layer == removed);
+        }
 
-                    int x = dirty->left;
-                    int y = dirty->top;
-                    int width = guac_rect_width(dirty);
-                    int height = guac_rect_height(dirty);
+        for (size_t j = 0; plan != NULL && j < plan->length && !obsolete; j++) {
 
-                    /* Ensure destination region is cleared out first if the alpha channel need be considered,
-                     * as GUAC_COMP_OVER is significantly faster than GUAC_COMP_SRC on the browser side */
-                    if (!current->opaque) {
-                        guac_protocol_send_rect(client->socket, current->last_frame_buffer, x, y, width, height);
-                        guac_protocol_send_cfill(client->socket, GUAC_COMP_RATOP, current->last_frame_buffer,
-                                0x00, 0x00, 0x00, 0x00);
-                    }
+            guac_display_plan_operation* op = &plan->ops[j];
+            if (op->type == GUAC_DISPLAY_PLAN_OPERATION_NOP
+                    || op->layer != refinement->layer
+                    || !guac_rect_intersects(&op->dest, &refinement->dest))
+                continue;
 
-                    guac_protocol_send_copy(client->socket,
-                            current->layer, x, y, width, height,
-                            GUAC_COMP_OVER, current->last_frame_buffer, x, y);
+            guac_rect remaining[4];
+            int count = guac_display_rect_subtract(&refinement->dest,
+                    &op->dest, remaining);
 
-                }
+            if (count == 0) {
+                obsolete = 1;
+                break;
+            }
 
-                current = current->last_frame.next;
+            /* If there is no room to split the refinement, simply retain it
+             * in its entirety. Refinements are read from the last frame when
+             * sent, so refining a region that has since been replaced is
+             * redundant but harmless. */
+            if (display->refinement_count + count - 1 > GUAC_DISPLAY_MAX_REFINEMENTS)
+                break;
 
+            /* Each additional part is appended to the list and will be
+             * checked against this frame in turn */
+            for (int k = 1; k < count; k++) {
+                guac_display_plan_operation* part = &display->refinements[display->refinement_count++];
+                *part = *refinement;
+                part->dest = remaining[k];
+                part->dirty_size = (size_t) guac_rect_width(&remaining[k])
+                    * guac_rect_height(&remaining[k]);
             }
 
-            /* This is now absolutely everything for the current frame,
-             * and it's safe to flush any outstanding data */
-            guac_socket_flush(client->socket);
+            refinement->dest = remaining[0];
+            refinement->dirty_size = (size_t) guac_rect_width(&remaining[0])
+                * guac_rect_height(&remaining[0]);
+
+        }
 
-            /* Notify any watchers of render_state that a frame is no longer in progress */
-            guac_flag_set_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_NOT_IN_PROGRESS);
-            guac_flag_clear(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_IN_PROGRESS);
-            guac_flag_unlock(&display->render_state);
+        if (obsolete)
+            *refinement = display->refinements[--display->refinement_count];
+        else
+            i++;
 
-            has_outstanding_frames = display->frame_deferred;
+    }
+
+    guac_fifo_unlock(&display->ops);
+
+}
 
+int guac_display_worker_process(guac_display* display) {
+
+    int has_outstanding_frames = 0;
+
+    guac_client* client = display->client;
+
+    /* Multiple tokens may exist for a single display, and so the operation
+     * this token was issued for may already have been handled by another
+     * worker */
+    guac_display_plan_operation op;
+    if (!guac_fifo_timed_dequeue_and_lock(&display->ops, &op, 0))
+        return guac_display_worker_refine(display);
+
+    /* Notify any watchers of render_state that a frame is now in progress */
+    guac_flag_set_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_IN_PROGRESS);
+    guac_flag_clear(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_NOT_IN_PROGRESS);
+    guac_flag_unlock(&display->render_state);
+
+    /* NOTE: Any thread that locks the operation queue can know that there
+     * are no pending operations in progress if the queue is empty and
+     * there are no active workers */
+    display->active_workers++;
+    guac_fifo_unlock(&display->ops);
+
+    guac_rwlock_acquire_read_lock(&display->last_frame.lock);
+    guac_display_layer* display_layer = op.layer;
+    switch (op.type) {
+
+        case GUAC_DISPLAY_PLAN_OPERATION_IMG:
+            LFR_guac_display_layer_send_image(display_layer, &op, 0);
+            break;
+
+        case GUAC_DISPLAY_PLAN_OPERATION_COPY:
+        case GUAC_DISPLAY_PLAN_OPERATION_RECT:
+            guac_client_log(client, GUAC_LOG_DEBUG, "Operation type %i "
+                    "should NOT be present in the set of operations given "
+                    "to guac_display worker thread. All operations except "
+                    "IMG and NOP are handled during the initial, "
+                    "single-threaded flush step. This is likely a bug.",
+                    op.type);
+            break;
+
+        case GUAC_DISPLAY_PLAN_OPERATION_NOP:
+            /* Do nothing */
+            break;
+
+    }
+
+    guac_fifo_lock(&display->ops);
+
+    /* If we're the only active worker and there are no further operations
+     * pending, we've reached the end of the frame, and this is the worker
+     * that will be sending that boundary to connected users */
+    if (!(display->ops.state.value & GUAC_FIFO_STATE_NONEMPTY) && display->active_workers == 1) {
+
+        /* Update the mouse cursor if it's been changed since the
+         * last frame */
+        guac_display_layer* cursor = display->cursor_buffer;
+        if (!guac_rect_is_empty(&cursor->last_frame.dirty)) {
+            guac_protocol_send_cursor(client->socket,
+                    display->last_frame.cursor_hotspot_x,
+                    display->last_frame.cursor_hotspot_y,
+                    cursor->layer, 0, 0,
+                    cursor->last_frame.width,
+                    cursor->last_frame.height);
         }
 
-        display->active_workers--;
-        guac_fifo_unlock(&display->ops);
+        /* Allow connected clients to move forward with rendering */
+        guac_client_end_multiple_frames(client, display->last_frame.frames);
+
+        /* While connected clients moves forward with rendering,
+         * commit any changed contents to client-side backing buffer */
+        guac_display_layer* current = display->last_frame.layers;
+        while (current != NULL) {
+
+            /* Save a copy of the changed region if the layer has
+             * been modified since the last frame */
+            guac_rect* dirty = &current->last_frame.dirty;
+            if (!guac_rect_is_empty(dirty)) {
+
+                int x = dirty->left;
+                int y = dirty->top;
+                int width = guac_rect_width(dirty);
+                int height = guac_rect_height(dirty);
+
+                /* Ensure destination region is cleared out first if the alpha channel need be considered,
+                 * as GUAC_COMP_OVER is significantly faster than GUAC_COMP_SRC on the browser side */
+                if (!current->opaque) {
+                    guac_protocol_send_rect(client->socket, current->last_frame_buffer, x, y, width, height);
+                    guac_protocol_send_cfill(client->socket, GUAC_COMP_RATOP, current->last_frame_buffer,
+                            0x00, 0x00, 0x00, 0x00);
+                }
 
-        guac_rwlock_release_lock(&display->last_frame.lock);
+                guac_protocol_send_copy(client->socket,
+                        current->layer, x, y, width, height,
+                        GUAC_COMP_OVER, current->last_frame_buffer, x, y);
+
+            }
+
+            current = current->last_frame.next;
 
-        /* Trigger additional flush if frames were completed while we were
-         * still processing the previous frame */
-        if (has_outstanding_frames) {
-            guac_display_end_multiple_frames(display, 0);
-            has_outstanding_frames = 0;
         }
 
+        /* This is now absolutely everything for the current frame,
+         * and it's safe to flush any outstanding data */
+        guac_socket_flush(client->socket);
+
+        /* Notify any watchers of render_state that a frame is no longer in progress */
+        guac_flag_set_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_NOT_IN_PROGRESS);
+        guac_flag_clear(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_IN_PROGRESS);
+        guac_flag_unlock(&display->render_state);
+
+        has_outstanding_frames = display->frame_deferred;
+
     }
 
-    return NULL;
+    display->active_workers--;
+
+    /* Refinements may be sent only now that the frame has been sent in its
+     * entirety, so make sure the worker pool knows about them */
+    if (!display->active_workers && display->refinement_count)
+        guac_display_worker_pool_notify(display);
+
+    guac_fifo_unlock(&display->ops);
+
+    guac_rwlock_release_lock(&display->last_frame.lock);
+
+    /* Trigger additional flush if frames were completed while we were
+     * still processing the previous frame */
+    if (has_outstanding_frames)
+        guac_display_end_multiple_frames(display, 0);
+
+    return guac_display_worker_release_token(display);
 
 }
@@ -31,84 +31,9 @@
 #include "guacamole/timestamp.h"
 #include "guacamole/user.h"
 
-#ifdef __MINGW32__
-#include <winbase.h>
-#endif
-
 #include <cairo/cairo.h>
+#include <inttypes.h>
 #include <pthread.h>
-#include <sched.h>
-#include <unistd.h>
-
-/**
- * The number of worker threads to create per processor.
- */
-#define GUAC_DISPLAY_CPU_THREAD_FACTOR 1
-
-/**
- * Returns the number of processors available to this process. If possible,
- * limits on otherwise available processors like CPU affinity will be taken
- * into account. If the number of available processors cannot be determined,
- * zero is returned.
- *
- * @return
- *     The number of available processors, or zero if this value cannot be
- *     determined for any reason.
- */
-static unsigned long guac_display_nproc(void) {
-
-#if defined(HAVE_SCHED_GETAFFINITY)
-
-    /* Linux, etc. implementation leveraging sched_getaffinity() (this is
-     * specific to glibc and MUSL libc and is non-portable) */
-
-    cpu_set_t cpu_set;
-    CPU_ZERO(&cpu_set);
-
-    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
-        long cpu_count = CPU_COUNT(&cpu_set);
-        if (cpu_count > 0)
-            return cpu_count;
-    }
-
-#elif defined(_SC_NPROCESSORS_ONLN)
-
-    /* Linux, etc. implementation leveraging sysconf() and _SC_NPROCESSORS_ONLN
-     * (which is also non-portable) */
-
-    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
-    if (cpu_count > 0)
-        return cpu_count;
-
-#elif defined(__MINGW32__)
-
-    /* Windows-specific implementation (clearly also non-portable) */
-
-    unsigned long cpu_count = 0;
-    DWORD_PTR process_mask, system_mask;
-    for (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
-            process_mask != 0; process_mask >>= 1) {
-
-        if (process_mask & 1)
-                cpu_count++;
-
-    }
-
-    if (cpu_count > 0)
-        return cpu_count;
-
-#else
-
-    /* Fallback implementation that does not query the number of CPUs available
-     * at all, returning an error code (as portable as it gets) */
-
-    long cpu_count = 0;
-
-#endif
-
-    return 0;
-
-}
 
 guac_display* guac_display_alloc(guac_client* client) {
 
@@ -136,26 +61,21 @@ guac_display* guac_display_alloc(guac_client* client) {
     guac_flag_init(&display->render_state);
     guac_flag_set(&display->render_state, GUAC_DISPLAY_RENDER_STATE_FRAME_NOT_IN_PROGRESS);
 
-    int cpu_count = guac_display_nproc();
-    if (cpu_count <= 0) {
-        guac_client_log(client, GUAC_LOG_WARNING, "Number of available "
-                "processors could not be determined. Assuming single-processor.");
-        cpu_count = 1;
-    }
-    else {
-        guac_client_log(client, GUAC_LOG_INFO, "Local system reports %i "
-                "processor(s) are available.", cpu_count);
-    }
+    /* Init model used to select image encoders within the frame budget */
+    guac_display_encoder_model_init(&display->encoder_model);
+
+    /* Init cache of recently-replaced tiles */
+    guac_display_cache_init(&display->cache, guac_client_alloc_buffer(client));
 
-    display->worker_thread_count = cpu_count * GUAC_DISPLAY_CPU_THREAD_FACTOR;
-    display->worker_threads = guac_mem_alloc(display->worker_thread_count, sizeof(pthread_t));
-    guac_client_log(client, GUAC_LOG_INFO, "Graphical updates will be encoded "
-            "using %i worker thread(s).", display->worker_thread_count);
+    /* Until users are surveyed at the first flush, all users share a single
+     * quality tier */
+    display->quality_tiers.count = 1;
+    display->quality_tiers.quality[0] = GUAC_DISPLAY_MAX_QUALITY;
+    display->unrecorded_socket = guac_socket_broadcast(client);
 
     /* Now that the core of the display has been fully initialized, it's safe
-     * to start the worker threads */
-    for (int i = 0; i < display->worker_thread_count; i++)
-        pthread_create(&(display->worker_threads[i]), NULL, guac_display_worker_thread, display);
+     * for the shared worker pool to begin processing its operations */
+    guac_display_worker_pool_register(display);
 
     return display;
 
@@ -164,59 +84,59 @@ guac_display* guac_display_alloc(guac_client* client) {
 void guac_display_stop(guac_display* display) {
 
     /* Ensure only one of any number of concurrent calls to guac_display_stop()
-     * will actually start terminating the worker threads */
+     * will actually stop the display */
     guac_fifo_lock(&display->ops);
 
-    /* Stop and clean up worker threads if the display is not already being
-     * stopped (we don't use the GUAC_DISPLAY_RENDER_STATE_STOPPED flag here,
-     * as we must consider the case that guac_display_stop() has already been
-     * called in a different thread but has not yet finished) */
+    /* Stop further processing of operations if the display is not already
+     * being stopped (we don't use the GUAC_DISPLAY_RENDER_STATE_STOPPED flag
+     * here, as we must consider the case that guac_display_stop() has already
+     * been called in a different thread but has not yet finished) */
     if (guac_fifo_is_valid(&display->ops)) {
 
-        /* Stop further use of the operation FIFO */
+        /* Stop further use of the operation FIFO. Any tokens for this display
+         * that remain in the shared worker pool will be released as soon as
+         * a worker takes them. */
         guac_fifo_invalidate(&display->ops);
-        guac_fifo_unlock(&display->ops);
 
-        /* Wait for all worker threads to terminate (they should nearly immediately
-         * terminate following invalidation of the FIFO) */
-        for (int i = 0; i < display->worker_thread_count; i++)
-            pthread_join(display->worker_threads[i], NULL);
-
-        /* All worker threads are now terminated and may be safely cleaned up */
-        guac_mem_free(display->worker_threads);
-        display->worker_thread_count = 0;
-
-        /* NOTE: The only other reference to the worker_threads AT ALL is in
-         * guac_display_create(). Nothing outside of guac_display_create() and
-         * guac_display_stop() references worker_threads or worker_thread_count. */
-
-        /* Notify other calls to guac_display_stop() that the display is now
-         * officially stopped */
-        guac_flag_set(&display->render_state, GUAC_DISPLAY_RENDER_STATE_STOPPED);
+        /* If no tokens remain at all, there is no worker that will be
+         * notifying us that the display has stopped, so we must do so
+         * ourselves */
+        if (!display->worker_tokens)
+            guac_flag_set(&display->render_state, GUAC_DISPLAY_RENDER_STATE_STOPPED);
 
     }
 
-    /* Even if it isn't this particular call to guac_display_stop() that
-     * terminates and waits on all the worker threads, ensure that we only
-     * return after all threads are known to have been stopped */
-    else {
-
-        guac_fifo_unlock(&display->ops);
-
-        guac_flag_wait_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_STOPPED);
-        guac_flag_unlock(&display->render_state);
+    guac_fifo_unlock(&display->ops);
 
-    }
+    /* Regardless of which call to guac_display_stop() stopped the display,
+     * ensure that we only return after the last worker to hold a token for
+     * this display has released it */
+    guac_flag_wait_and_lock(&display->render_state, GUAC_DISPLAY_RENDER_STATE_STOPPED);
+    guac_flag_unlock(&display->render_state);
 
 }
 
 void guac_display_free(guac_display* display) {
 
     guac_display_stop(display);
+    guac_display_worker_pool_unregister(display);
 
     /* All locks, FIFOs, etc. are now unused and can be safely destroyed */
     guac_flag_destroy(&display->render_state);
     guac_fifo_destroy(&display->ops);
+    guac_display_encoder_model_destroy(&display->encoder_model);
+    guac_socket_free(display->unrecorded_socket);
+
+    /* Report the effectiveness of the tile cache before freeing it */
+    guac_display_cache* cache = &display->cache;
+    guac_client_log(display->client, GUAC_LOG_DEBUG, "Tile cache hit rate: "
+            "%.1f%% (%" PRIu64 " hits of %" PRIu64 " lookups, %" PRIu64
+            " tiles stored).", cache->lookups ? 100.0 * cache->hits / cache->lookups : 0.0,
+            cache->hits, cache->lookups, cache->stores);
+
+    guac_protocol_send_dispose(display->client->socket, cache->buffer);
+    guac_client_free_buffer(display->client, cache->buffer);
+    guac_display_cache_destroy(cache);
 
     /* Remove any layers remaining in the pending frame (by definition, all other
      * layers must already have been marked for removal) */
@@ -315,6 +235,10 @@ void guac_display_dup(guac_display* display, guac_socket* socket) {
 
     }
 
+    /* Resync the tile cache, as copies from the cache will otherwise draw
+     * tiles that the new users never received */
+    guac_display_cache_dup(&display->cache, client, socket);
+
     /* Avoid sending a zero-size cursor instruction if no cursor has been set */
     guac_display_layer* cursor = display->cursor_buffer;
     if (cursor->last_frame.width > 0 && cursor->last_frame.height > 0)
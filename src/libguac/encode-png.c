@@ -27,6 +27,10 @@
 #include <png.h>
 #include <cairo/cairo.h>
 
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef HAVE_PNGSTRUCT_H
 #include <pngstruct.h>
 #endif
@@ -264,15 +268,107 @@ static void guac_png_flush_handler(png_structp png) {
 
 }
 
+/**
+ * Converts the given row of pixels from an RGB24 Cairo surface into the
+ * 8-bit RGB format expected by libpng.
+ *
+ * @param pixels
+ *     The row of pixels to convert.
+ *
+ * @param row
+ *     The buffer that should receive the converted pixels, which must be at
+ *     least three bytes per pixel.
+ *
+ * @param width
+ *     The number of pixels in the row.
+ */
+static void guac_png_convert_rgb(const uint32_t* pixels, png_byte* row,
+        int width) {
+
+    for (int x = 0; x < width; x++) {
+
+        uint32_t color = pixels[x];
+
+        *(row++) = (color >> 16) & 0xFF;
+        *(row++) = (color >> 8)  & 0xFF;
+        *(row++) =  color        & 0xFF;
+
+    }
+
+}
+
+/**
+ * Converts the given row of pixels from an ARGB32 Cairo surface, in which
+ * each color component is premultiplied by alpha, into the 8-bit RGBA format
+ * expected by libpng, in which color components are not premultiplied.
+ *
+ * @param pixels
+ *     The row of pixels to convert.
+ *
+ * @param row
+ *     The buffer that should receive the converted pixels, which must be at
+ *     least four bytes per pixel.
+ *
+ * @param width
+ *     The number of pixels in the row.
+ */
+static void guac_png_convert_rgba(const uint32_t* pixels, png_byte* row,
+        int width) {
+
+    for (int x = 0; x < width; x++) {
+
+        uint32_t color = pixels[x];
+        uint32_t alpha = color >> 24;
+
+        /* Fully transparent pixels have no meaningful color */
+        if (alpha == 0) {
+            memset(row, 0, 4);
+        }
+
+        /* Fully opaque pixels need not be unpremultiplied */
+        else if (alpha == 0xFF) {
+            row[0] = (color >> 16) & 0xFF;
+            row[1] = (color >> 8)  & 0xFF;
+            row[2] =  color        & 0xFF;
+            row[3] = 0xFF;
+        }
+
+        /* Unpremultiply all other pixels, rounding to nearest */
+        else {
+            row[0] = (((color >> 16) & 0xFF) * 0xFF + alpha / 2) / alpha;
+            row[1] = (((color >> 8)  & 0xFF) * 0xFF + alpha / 2) / alpha;
+            row[2] = (( color        & 0xFF) * 0xFF + alpha / 2) / alpha;
+            row[3] = alpha;
+        }
+
+        row += 4;
+
+    }
+
+}
+
+int guac_png_suggest_level(int lag) {
+
+    /* Scale level linearly from 1 to 6 as lag varies from 20ms to 80ms */
+    int level = GUAC_PNG_MIN_LEVEL + (lag - 20) / 12;
+
+    /* Do not exceed maximum level */
+    if (level > GUAC_PNG_MAX_LEVEL)
+        return GUAC_PNG_MAX_LEVEL;
+
+    /* Do not go below minimum level */
+    if (level < GUAC_PNG_MIN_LEVEL)
+        return GUAC_PNG_MIN_LEVEL;
+
+    return level;
+
+}
+
 int guac_png_write(guac_socket* socket, guac_stream* stream,
-        cairo_surface_t* surface) {
+        cairo_surface_t* surface, int level) {
 
     png_structp png;
     png_infop png_info;
-    png_byte** png_rows;
-    int bpp;
-
-    int x, y;
 
     guac_png_write_state write_state;
 
@@ -283,30 +379,43 @@ int guac_png_write(guac_socket* socket, guac_stream* stream,
     int stride = cairo_image_surface_get_stride(surface);
     unsigned char* data = cairo_image_surface_get_data(surface);
 
-    /* If not RGB24, use Cairo PNG writer */
-    if (format != CAIRO_FORMAT_RGB24 || data == NULL)
+    /* If neither RGB24 nor ARGB32, use Cairo PNG writer */
+    if ((format != CAIRO_FORMAT_RGB24 && format != CAIRO_FORMAT_ARGB32)
+            || data == NULL)
         return guac_png_cairo_write(socket, stream, surface);
 
     /* Flush pending operations to surface */
     cairo_surface_flush(surface);
 
-    /* Attempt to build palette */
-    guac_palette* palette = guac_palette_alloc(surface);
+    /* Attempt to build palette for opaque surfaces, producing indexed image
+     * data at the same time */
+    guac_palette* palette = NULL;
+    png_byte* indices = NULL;
+    if (format == CAIRO_FORMAT_RGB24) {
 
-    /* If not possible, resort to Cairo PNG writer */
-    if (palette == NULL)
-        return guac_png_cairo_write(socket, stream, surface);
+        indices = guac_mem_alloc(width, height);
+        palette = guac_palette_alloc(surface, indices);
+
+        /* If not possible, resort to truecolor */
+        if (palette == NULL) {
+            guac_mem_free(indices);
+            indices = NULL;
+        }
+
+    }
 
-    /* Calculate BPP from palette size */
-    if      (palette->size <= 2)  bpp = 1;
-    else if (palette->size <= 4)  bpp = 2;
-    else if (palette->size <= 16) bpp = 4;
-    else                          bpp = 8;
+    /* Truecolor image data must be converted row by row */
+    int channels = (format == CAIRO_FORMAT_ARGB32) ? 4 : 3;
+    png_byte* row = NULL;
+    if (palette == NULL)
+        row = guac_mem_alloc(width, channels);
 
     /* Set up PNG writer */
     png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
         guac_palette_free(palette);
+        guac_mem_free(indices);
+        guac_mem_free(row);
         guac_error = GUAC_STATUS_INTERNAL_ERROR;
         guac_error_message = "libpng failed to create write structure";
         return -1;
@@ -316,6 +425,8 @@ int guac_png_write(guac_socket* socket, guac_stream* stream,
     if (!png_info) {
         png_destroy_write_struct(&png, NULL);
         guac_palette_free(palette);
+        guac_mem_free(indices);
+        guac_mem_free(row);
         guac_error = GUAC_STATUS_INTERNAL_ERROR;
         guac_error_message = "libpng failed to create info structure";
         return -1;
@@ -325,6 +436,8 @@ int guac_png_write(guac_socket* socket, guac_stream* stream,
     if (setjmp(png_jmpbuf(png))) {
         png_destroy_write_struct(&png, &png_info);
         guac_palette_free(palette);
+        guac_mem_free(indices);
+        guac_mem_free(row);
         guac_error = GUAC_STATUS_IO_ERROR;
         guac_error_message = "libpng output error";
         return -1;
@@ -340,60 +453,89 @@ int guac_png_write(guac_socket* socket, guac_stream* stream,
             guac_png_write_handler,
             guac_png_flush_handler);
 
-    /* Copy data from surface into PNG data */
-    png_rows = (png_byte**) guac_mem_alloc(sizeof(png_byte*), height);
-    for (y=0; y<height; y++) {
+    /* Run-length encoding alone is sufficient for most remote desktop
+     * content and is far faster than the full deflate search performed at
+     * all other levels. The strategy constant is defined by zlib, and so the
+     * default strategy is used at the minimum level if zlib is unavailable
+     * at build time. */
+    png_set_compression_level(png, level);
+#ifdef ENABLE_ZLIB
+    if (level <= GUAC_PNG_MIN_LEVEL)
+        png_set_compression_strategy(png, Z_RLE);
+#endif
 
-        /* Allocate new PNG row */
-        png_byte* row = (png_byte*) guac_mem_alloc(sizeof(png_byte), width);
-        png_rows[y] = row;
+    if (palette != NULL) {
 
-        /* Copy data from surface into current row */
-        for (x=0; x<width; x++) {
+        /* Calculate BPP from palette size */
+        int bpp;
+        if      (palette->size <= 2)  bpp = 1;
+        else if (palette->size <= 4)  bpp = 2;
+        else if (palette->size <= 16) bpp = 4;
+        else                          bpp = 8;
 
-            /* Get pixel color */
-            int color = ((uint32_t*) data)[x] & 0xFFFFFF;
+        png_set_IHDR(png, png_info, width, height, bpp,
+                PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
-            /* Set index in row */
-            row[x] = guac_palette_find(palette, color);
+        png_set_PLTE(png, png_info, palette->colors, palette->size);
 
-        }
+        /* Filtering palette indices only obscures the repetition within
+         * them, and is not recommended by the PNG specification */
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+
+    }
 
-        /* Advance to next data row */
-        data += stride;
+    else {
+
+        png_set_IHDR(png, png_info, width, height, 8,
+                (format == CAIRO_FORMAT_ARGB32)
+                    ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB,
+                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                PNG_FILTER_TYPE_DEFAULT);
+
+        /* Flat regions, gradients and repeated rows are well served by the
+         * "Sub" and "Up" filters alone, and considering only these is
+         * cheaper than trying all five filters for each row */
+        png_set_filter(png, PNG_FILTER_TYPE_BASE,
+                PNG_FILTER_SUB | PNG_FILTER_UP);
 
     }
 
     /* Write image info */
-    png_set_IHDR(
-        png,
-        png_info,
-        width,
-        height,
-        bpp,
-        PNG_COLOR_TYPE_PALETTE,
-        PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT,
-        PNG_FILTER_TYPE_DEFAULT
-    );
-
-    /* Write palette */
-    png_set_PLTE(png, png_info, palette->colors, palette->size);
-
-    /* Write image */
-    png_set_rows(png, png_info, png_rows);
-    png_write_png(png, png_info, PNG_TRANSFORM_PACKING, NULL);
+    png_write_info(png, png_info);
+
+    /* Pack palette indices into the bit depth chosen above */
+    if (palette != NULL) {
+        png_set_packing(png);
+        for (int y = 0; y < height; y++)
+            png_write_row(png, indices + (size_t) y * width);
+    }
+
+    /* Convert and write truecolor data row by row */
+    else {
+        for (int y = 0; y < height; y++) {
+
+            const uint32_t* pixels =
+                (const uint32_t*) (data + (size_t) y * stride);
+
+            if (channels == 4)
+                guac_png_convert_rgba(pixels, row, width);
+            else
+                guac_png_convert_rgb(pixels, row, width);
+
+            png_write_row(png, row);
+
+        }
+    }
 
     /* Finish write */
+    png_write_end(png, png_info);
     png_destroy_write_struct(&png, &png_info);
 
-    /* Free palette */
+    /* Free palette and image data */
     guac_palette_free(palette);
-
-    /* Free PNG data */
-    for (y=0; y<height; y++)
-        guac_mem_free(png_rows[y]);
-    guac_mem_free(png_rows);
+    guac_mem_free(indices);
+    guac_mem_free(row);
 
     /* Ensure all data is written */
     guac_png_flush_data(&write_state);
@@ -25,9 +25,43 @@
 
 #include <cairo/cairo.h>
 
+/**
+ * The lowest zlib compression level that will be used for PNG images. At
+ * this level, PNG data is compressed using run-length encoding alone, which
+ * is far faster than a full deflate search and remains effective for
+ * typical remote desktop content.
+ */
+#define GUAC_PNG_MIN_LEVEL 1
+
+/**
+ * The highest zlib compression level that will be used for PNG images,
+ * regardless of processing lag. Higher levels cost considerably more time
+ * for little reduction in size.
+ */
+#define GUAC_PNG_MAX_LEVEL 6
+
+/**
+ * Returns the zlib compression level that should be used for PNG images sent
+ * to users experiencing the given processing lag. Users that are keeping up
+ * receive quickly-encoded images, while users that are falling behind
+ * receive images that are smaller but take longer to encode.
+ *
+ * @param lag
+ *     The processing lag of the user(s) receiving the image, in milliseconds.
+ *
+ * @return
+ *     A zlib compression level between GUAC_PNG_MIN_LEVEL and
+ *     GUAC_PNG_MAX_LEVEL inclusive.
+ */
+int guac_png_suggest_level(int lag);
+
 /**
  * Encodes the given surface as a PNG, and sends the resulting data over the
- * given stream and socket as blobs.
+ * given stream and socket as blobs. RGB24 surfaces containing no more than
+ * 256 distinct colors are encoded as palette images, with each row left
+ * unfiltered. All other RGB24 and ARGB32 surfaces are encoded as truecolor
+ * images, with each row filtered using whichever of the "Sub" or "Up"
+ * filters best suits that row.
  *
  * @param socket
  *     The socket to send PNG blobs over.
@@ -38,11 +72,15 @@
  * @param surface
  *     The Cairo surface to write to the given stream and socket as PNG blobs.
  *
+ * @param level
+ *     The zlib compression level to use, between GUAC_PNG_MIN_LEVEL and
+ *     GUAC_PNG_MAX_LEVEL inclusive, as returned by guac_png_suggest_level().
+ *
  * @return
  *     Zero if the encoding operation is successful, non-zero otherwise.
  */
 int guac_png_write(guac_socket* socket, guac_stream* stream,
-        cairo_surface_t* surface);
+        cairo_surface_t* surface, int level);
 
 #endif
 
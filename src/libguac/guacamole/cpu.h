@@ -0,0 +1,70 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_CPU_H
+#define GUAC_CPU_H
+
+/**
+ * Provides functions for determining which optional instruction set
+ * extensions are supported by the current CPU, such that code paths using
+ * those extensions may be selected at runtime.
+ *
+ * @file cpu.h
+ */
+
+/**
+ * Optional instruction set extensions that may be supported by the current
+ * CPU. Each value is a distinct bit.
+ */
+typedef enum guac_cpu_feature {
+
+    /**
+     * SSE2 (128-bit integer SIMD) instructions.
+     */
+    GUAC_CPU_SSE2 = 1,
+
+    /**
+     * SSSE3 instructions, including PSHUFB.
+     */
+    GUAC_CPU_SSSE3 = 2,
+
+    /**
+     * AVX2 (256-bit integer SIMD) instructions.
+     */
+    GUAC_CPU_AVX2 = 4
+
+} guac_cpu_feature;
+
+/**
+ * Returns whether the given instruction set extension is supported by the
+ * current CPU and may be used by code that selects its implementation at
+ * runtime. The CPU is queried only once, with the result cached for all
+ * subsequent calls. If libguac was built without support for such runtime
+ * selection, no extension is reported as supported.
+ *
+ * @param feature
+ *     The instruction set extension to test for.
+ *
+ * @return
+ *     Non-zero if the given extension is supported and may be used, zero
+ *     otherwise.
+ */
+int guac_cpu_supports(guac_cpu_feature feature);
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _GUAC_OPCODE_TYPES_H
+#define _GUAC_OPCODE_TYPES_H
+
+/**
+ * Type definitions related to the opcodes of Guacamole protocol instructions.
+ *
+ * @file opcode-types.h
+ */
+
+/**
+ * Numeric identifiers for all opcodes defined by the Guacamole protocol. The
+ * opcode of each instruction read by a guac_parser is automatically
+ * translated into its identifier, such that instructions can be dispatched by
+ * indexing an array of handlers rather than by comparing strings.
+ *
+ * The string form of each opcode is the lowercase form of the name of its
+ * identifier, without the "GUAC_OPCODE_" prefix. The table used to translate
+ * opcodes into identifiers is generated from this enum when libguac is built,
+ * and so adding a new opcode requires only a new value here.
+ */
+typedef enum guac_opcode {
+
+    /**
+     * Any opcode which is not defined by the Guacamole protocol.
+     */
+    GUAC_OPCODE_UNKNOWN = 0,
+
+    /**
+     * The "ack" instruction. Acknowledges receipt of data on a stream.
+     */
+    GUAC_OPCODE_ACK,
+
+    /**
+     * The "arc" instruction. Adds an arc to the current path of a layer.
+     */
+    GUAC_OPCODE_ARC,
+
+    /**
+     * The "args" instruction. Lists the connection parameters accepted by the
+     * protocol in use.
+     */
+    GUAC_OPCODE_ARGS,
+
+    /**
+     * The "argv" instruction. Begins a stream containing the new value of a
+     * connection parameter.
+     */
+    GUAC_OPCODE_ARGV,
+
+    /**
+     * The "audio" instruction. Begins an audio stream, or declares supported
+     * audio mimetypes during the handshake.
+     */
+    GUAC_OPCODE_AUDIO,
+
+    /**
+     * The "blob" instruction. Sends a block of data along a stream.
+     */
+    GUAC_OPCODE_BLOB,
+
+    /**
+     * The "body" instruction. Begins a stream containing the body of an
+     * object.
+     */
+    GUAC_OPCODE_BODY,
+
+    /**
+     * The "cfill" instruction. Fills the current path of a layer with a color.
+     */
+    GUAC_OPCODE_CFILL,
+
+    /**
+     * The "clip" instruction. Restricts drawing within a layer to the current
+     * path.
+     */
+    GUAC_OPCODE_CLIP,
+
+    /**
+     * The "clipboard" instruction. Begins a stream containing clipboard data.
+     */
+    GUAC_OPCODE_CLIPBOARD,
+
+    /**
+     * The "close" instruction. Closes the current path of a layer.
+     */
+    GUAC_OPCODE_CLOSE,
+
+    /**
+     * The "connect" instruction. Completes the handshake, providing the values
+     * of all parameters.
+     */
+    GUAC_OPCODE_CONNECT,
+
+    /**
+     * The "copy" instruction. Copies image data from one layer to another.
+     */
+    GUAC_OPCODE_COPY,
+
+    /**
+     * The "cstroke" instruction. Strokes the current path of a layer with a
+     * color.
+     */
+    GUAC_OPCODE_CSTROKE,
+
+    /**
+     * The "cursor" instruction. Sets the mouse cursor image.
+     */
+    GUAC_OPCODE_CURSOR,
+
+    /**
+     * The "curve" instruction. Adds a cubic Bezier curve to the current path
+     * of a layer.
+     */
+    GUAC_OPCODE_CURVE,
+
+    /**
+     * The "disconnect" instruction. Notifies the other side of the connection
+     * that it is closing.
+     */
+    GUAC_OPCODE_DISCONNECT,
+
+    /**
+     * The "dispose" instruction. Removes a layer or buffer.
+     */
+    GUAC_OPCODE_DISPOSE,
+
+    /**
+     * The "distort" instruction. Applies an affine transformation to a layer.
+     */
+    GUAC_OPCODE_DISTORT,
+
+    /**
+     * The "end" instruction. Ends a stream.
+     */
+    GUAC_OPCODE_END,
+
+    /**
+     * The "error" instruction. Reports an error which has caused the
+     * connection to close.
+     */
+    GUAC_OPCODE_ERROR,
+
+    /**
+     * The "file" instruction. Begins a stream containing a file.
+     */
+    GUAC_OPCODE_FILE,
+
+    /**
+     * The "filesystem" instruction. Exposes a filesystem object.
+     */
+    GUAC_OPCODE_FILESYSTEM,
+
+    /**
+     * The "get" instruction. Requests the stream associated with a name within
+     * an object.
+     */
+    GUAC_OPCODE_GET,
+
+    /**
+     * The "identity" instruction. Resets the transformation matrix of a layer.
+     */
+    GUAC_OPCODE_IDENTITY,
+
+    /**
+     * The "image" instruction. Declares supported image mimetypes during the
+     * handshake.
+     */
+    GUAC_OPCODE_IMAGE,
+
+    /**
+     * The "img" instruction. Begins a stream containing image data to be drawn
+     * to a layer.
+     */
+    GUAC_OPCODE_IMG,
+
+    /**
+     * The "key" instruction. Reports the pressing or releasing of a key.
+     */
+    GUAC_OPCODE_KEY,
+
+    /**
+     * The "lfill" instruction. Fills the current path of a layer with the
+     * contents of another layer.
+     */
+    GUAC_OPCODE_LFILL,
+
+    /**
+     * The "line" instruction. Adds a line segment to the current path of a
+     * layer.
+     */
+    GUAC_OPCODE_LINE,
+
+    /**
+     * The "log" instruction. Sends an arbitrary log message.
+     */
+    GUAC_OPCODE_LOG,
+
+    /**
+     * The "lstroke" instruction. Strokes the current path of a layer with the
+     * contents of another layer.
+     */
+    GUAC_OPCODE_LSTROKE,
+
+    /**
+     * The "mouse" instruction. Reports or sets the position and button state
+     * of the mouse.
+     */
+    GUAC_OPCODE_MOUSE,
+
+    /**
+     * The "move" instruction. Moves a layer relative to another layer.
+     */
+    GUAC_OPCODE_MOVE,
+
+    /**
+     * The "msg" instruction. Sends a status message for display to the user.
+     */
+    GUAC_OPCODE_MSG,
+
+    /**
+     * The "name" instruction. Sets the name of the connection, or declares the
+     * name of the user during the handshake.
+     */
+    GUAC_OPCODE_NAME,
+
+    /**
+     * The "nest" instruction. Sends an instruction nested within another
+     * instruction. Deprecated.
+     */
+    GUAC_OPCODE_NEST,
+
+    /**
+     * The "nop" instruction. Does nothing, serving only to keep the connection
+     * alive.
+     */
+    GUAC_OPCODE_NOP,
+
+    /**
+     * The "pipe" instruction. Begins a stream associated with a named pipe.
+     */
+    GUAC_OPCODE_PIPE,
+
+    /**
+     * The "pop" instruction. Restores the most recently pushed state of a
+     * layer.
+     */
+    GUAC_OPCODE_POP,
+
+    /**
+     * The "push" instruction. Saves the current state of a layer.
+     */
+    GUAC_OPCODE_PUSH,
+
+    /**
+     * The "put" instruction. Begins a stream to be written to a name within an
+     * object.
+     */
+    GUAC_OPCODE_PUT,
+
+    /**
+     * The "ready" instruction. Notifies the client that the connection is
+     * ready, providing its ID.
+     */
+    GUAC_OPCODE_READY,
+
+    /**
+     * The "rect" instruction. Adds a rectangle to the current path of a layer.
+     */
+    GUAC_OPCODE_RECT,
+
+    /**
+     * The "required" instruction. Requests the values of parameters that were
+     * not provided.
+     */
+    GUAC_OPCODE_REQUIRED,
+
+    /**
+     * The "reset" instruction. Resets the clipping and state stack of a layer.
+     */
+    GUAC_OPCODE_RESET,
+
+    /**
+     * The "select" instruction. Begins the handshake by selecting a protocol
+     * or connection.
+     */
+    GUAC_OPCODE_SELECT,
+
+    /**
+     * The "set" instruction. Sets a property of a layer.
+     */
+    GUAC_OPCODE_SET,
+
+    /**
+     * The "shade" instruction. Sets the opacity of a layer.
+     */
+    GUAC_OPCODE_SHADE,
+
+    /**
+     * The "size" instruction. Reports or sets the size of the display or a
+     * layer.
+     */
+    GUAC_OPCODE_SIZE,
+
+    /**
+     * The "start" instruction. Adds a point to the current path of a layer,
+     * starting a new subpath.
+     */
+    GUAC_OPCODE_START,
+
+    /**
+     * The "sync" instruction. Marks the end of a frame.
+     */
+    GUAC_OPCODE_SYNC,
+
+    /**
+     * The "timezone" instruction. Declares the timezone of the user during the
+     * handshake.
+     */
+    GUAC_OPCODE_TIMEZONE,
+
+    /**
+     * The "touch" instruction. Reports the state of a touch.
+     */
+    GUAC_OPCODE_TOUCH,
+
+    /**
+     * The "transfer" instruction. Transfers image data from one layer to
+     * another using a binary operation.
+     */
+    GUAC_OPCODE_TRANSFER,
+
+    /**
+     * The "transform" instruction. Applies a relative transformation to a
+     * layer.
+     */
+    GUAC_OPCODE_TRANSFORM,
+
+    /**
+     * The "undefine" instruction. Removes an object.
+     */
+    GUAC_OPCODE_UNDEFINE,
+
+    /**
+     * The "usbconnect" instruction. Reports that a USB device has been
+     * connected.
+     */
+    GUAC_OPCODE_USBCONNECT,
+
+    /**
+     * The "usbdata" instruction. Sends data from a USB device.
+     */
+    GUAC_OPCODE_USBDATA,
+
+    /**
+     * The "usbdisconnect" instruction. Reports that a USB device has been
+     * disconnected.
+     */
+    GUAC_OPCODE_USBDISCONNECT,
+
+    /**
+     * The "video" instruction. Begins a video stream, or declares supported
+     * video mimetypes during the handshake.
+     */
+    GUAC_OPCODE_VIDEO,
+
+    /**
+     * The number of values in this enum, including GUAC_OPCODE_UNKNOWN. This
+     * is not an opcode, and is intended for sizing arrays of handlers.
+     */
+    GUAC_OPCODE_COUNT
+
+} guac_opcode;
+
+#endif
+
@@ -0,0 +1,60 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _GUAC_OPCODE_H
+#define _GUAC_OPCODE_H
+
+/**
+ * Provides functions for translating between the opcodes of Guacamole
+ * protocol instructions and their numeric identifiers.
+ *
+ * @file opcode.h
+ */
+
+#include "opcode-types.h"
+
+/**
+ * Returns the numeric identifier of the given opcode. The identifier is
+ * located using a perfect hash of all opcodes defined by the Guacamole
+ * protocol, and thus in constant time with respect to the number of opcodes.
+ *
+ * @param opcode
+ *     The opcode to look up, as a null-terminated string.
+ *
+ * @return
+ *     The numeric identifier of the given opcode, or GUAC_OPCODE_UNKNOWN if
+ *     the opcode is not defined by the Guacamole protocol.
+ */
+guac_opcode guac_opcode_lookup(const char* opcode);
+
+/**
+ * Returns the string form of the opcode having the given numeric identifier.
+ *
+ * @param opcode
+ *     The numeric identifier of the opcode.
+ *
+ * @return
+ *     The opcode having the given identifier, as a null-terminated string, or
+ *     NULL if the identifier is GUAC_OPCODE_UNKNOWN or is otherwise not the
+ *     identifier of any opcode.
+ */
+const char* guac_opcode_name(guac_opcode opcode);
+
+#endif
+
@@ -27,19 +27,37 @@
  */
 
 /**
- * The maximum number of characters per instruction.
+ * The maximum number of characters per element of an instruction. Elements
+ * up to this length, such as large blobs of file, clipboard, or audio data,
+ * are accepted by guac_parser_read(), which will grow its buffer as needed,
+ * up to GUAC_PARSER_MAX_BUFFER_SIZE bytes.
  */
-#define GUAC_INSTRUCTION_MAX_LENGTH 8192
+#define GUAC_INSTRUCTION_MAX_LENGTH 1048576
 
 /**
  * The maximum number of digits to allow per length prefix.
  */
-#define GUAC_INSTRUCTION_MAX_DIGITS 5
+#define GUAC_INSTRUCTION_MAX_DIGITS 7
 
 /**
  * The maximum number of elements per instruction, including the opcode.
  */
 #define GUAC_INSTRUCTION_MAX_ELEMENTS 128
 
+/**
+ * The size of the buffer that guac_parser_read() initially uses to hold
+ * received data, in bytes. This buffer is part of the guac_parser itself, and
+ * is replaced by a larger, dynamically-allocated buffer only if an instruction
+ * does not fit.
+ */
+#define GUAC_PARSER_BUFFER_SIZE 32768
+
+/**
+ * The maximum size that the buffer used by guac_parser_read() may grow to, in
+ * bytes. Any instruction which does not fit within a buffer of this size is
+ * rejected.
+ */
+#define GUAC_PARSER_MAX_BUFFER_SIZE 4194304
+
 #endif
 
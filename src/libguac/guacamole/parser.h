@@ -26,6 +26,7 @@
  * @file parser.h
  */
 
+#include "opcode-types.h"
 #include "parser-types.h"
 #include "parser-constants.h"
 #include "socket-types.h"
@@ -52,11 +53,25 @@ struct guac_parser {
      */
     guac_parse_state state;
 
+    /**
+     * The numeric identifier of the opcode of the instruction, or
+     * GUAC_OPCODE_UNKNOWN if the opcode is not defined by the Guacamole
+     * protocol. This is set only once the instruction has been fully parsed,
+     * and allows the instruction to be dispatched without comparing strings.
+     */
+    guac_opcode opcode_id;
+
     /**
      * The length of the current element, if known.
      */
     int __element_length;
 
+    /**
+     * The number of digits of the length prefix of the current element that
+     * have been parsed so far.
+     */
+    int __element_digits;
+
     /**
      * The number of elements currently parsed.
      */
@@ -83,7 +98,20 @@ struct guac_parser {
      * provided as a convenience to be used to buffer instructions until
      * those instructions are complete and ready to be parsed.
      */
-    char __instructionbuf[32768];
+    char __instructionbuf[GUAC_PARSER_BUFFER_SIZE];
+
+    /**
+     * The buffer currently being used to buffer instructions. This is
+     * __instructionbuf unless an instruction has been received that does not
+     * fit, in which case this is a larger, dynamically-allocated buffer.
+     */
+    char* __buffer;
+
+    /**
+     * The size of the buffer currently being used to buffer instructions, in
+     * bytes.
+     */
+    int __buffer_size;
 
 };
 
@@ -42,10 +42,13 @@
 
 /**
  * The maximum number of bytes that should be sent in any one blob instruction
- * to ensure the instruction does not exceed the maximum allowed instruction
- * size.
+ * to ensure the instruction can be parsed by any Guacamole client, including
+ * older clients which limit each instruction to 8192 characters. Elements
+ * received by guac_parser may be far longer (up to
+ * GUAC_INSTRUCTION_MAX_LENGTH characters each), but this limit applies to
+ * blobs sent by the server.
  *
- * @see GUAC_INSTRUCTION_MAX_LENGTH 
+ * @see GUAC_INSTRUCTION_MAX_LENGTH
  */
 #define GUAC_PROTOCOL_BLOB_MAX_LENGTH 6048
 
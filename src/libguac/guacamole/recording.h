@@ -53,6 +53,28 @@
  */
 #define GUAC_RECORDING_CLIPBOARD_BLOCK_SIZE 4096
 
+/**
+ * The suffix appended to the filename of a session recording to produce the
+ * filename of its index. See guac_recording_create() for the format of the
+ * index.
+ */
+#define GUAC_RECORDING_INDEX_SUFFIX ".index"
+
+/**
+ * The minimum number of milliseconds between the frames noted within the
+ * index of a session recording as it is being written.
+ */
+#define GUAC_RECORDING_INDEX_INTERVAL 1000
+
+/**
+ * The maximum number of bytes of recording data that may be buffered in
+ * memory awaiting a write to storage. Recording data is written to storage by
+ * a dedicated thread, such that slow storage does not directly stall the
+ * session being recorded. If storage falls behind by this many bytes, threads
+ * producing further output for the session block until storage catches up.
+ */
+#define GUAC_RECORDING_BUFFER_SIZE 16777216
+
 /**
  * An in-progress session recording, attached to a guac_client instance such
  * that output Guacamole instructions may be dynamically intercepted and
@@ -115,6 +137,18 @@ typedef struct guac_recording {
      */
     int include_clipboard;
 
+    /**
+     * Non-zero if an index of the session recording is being written
+     * alongside the recording, zero otherwise.
+     */
+    int create_index;
+
+    /**
+     * Non-zero if the session recording is being compressed as it is
+     * written, zero otherwise.
+     */
+    int compress;
+
 } guac_recording;
 
 /**
@@ -179,6 +213,28 @@ typedef struct guac_recording {
  *     caution. Clipboard can easily contain sensitive information, such as
  *     passwords, credit card numbers, etc.
  *
+ * @param create_index
+ *     Non-zero if an index of the recording should be written alongside the
+ *     recording, zero otherwise. The index is written to a file having the
+ *     same name as the recording plus GUAC_RECORDING_INDEX_SUFFIX, and
+ *     consists of one line per indexed frame, at most one frame per
+ *     GUAC_RECORDING_INDEX_INTERVAL milliseconds, of the form:
+ *
+ *         sync TIMESTAMP OFFSET
+ *
+ *     where TIMESTAMP is the timestamp of the "sync" instruction ending that
+ *     frame and OFFSET is the byte offset within the (uncompressed) recording
+ *     immediately following that instruction. Tools processing the recording
+ *     may append further lines beginning with other keywords (such as the
+ *     "keyframe" lines written by guacenc), and any lines not understood
+ *     should be ignored.
+ *
+ * @param compress
+ *     Non-zero if the recording should be compressed using the gzip format
+ *     as it is written, zero otherwise. Compressed recordings can be read
+ *     with guac_recording_open_read(). If libguac was built without zlib,
+ *     a warning is logged and the recording is written uncompressed.
+ *
  * @return
  *     A new guac_recording structure representing the in-progress
  *     recording if the recording file has been successfully created and a
@@ -187,7 +243,8 @@ typedef struct guac_recording {
 guac_recording* guac_recording_create(guac_client* client,
         const char* path, const char* name, int create_path,
         int include_output, int include_mouse, int include_touch,
-        int include_keys, int allow_write_existing, int include_clipboard);
+        int include_keys, int allow_write_existing, int include_clipboard,
+        int create_index, int compress);
 
 /**
  * Frees the resources associated with the given in-progress recording. Note
@@ -200,6 +257,37 @@ guac_recording* guac_recording_create(guac_client* client,
  */
 void guac_recording_free(guac_recording* recording);
 
+/**
+ * Returns whether the session recording open at the given file descriptor
+ * was compressed as it was written. The current position of the file
+ * descriptor is not changed.
+ *
+ * @param fd
+ *     The file descriptor of a session recording that is open for reading.
+ *
+ * @return
+ *     Non-zero if the recording is compressed, zero otherwise.
+ */
+int guac_recording_is_compressed(int fd);
+
+/**
+ * Allocates a new guac_socket which reads the Guacamole protocol data of the
+ * session recording open at the given file descriptor, transparently
+ * decompressing that data if the recording was compressed as it was written.
+ * The file descriptor is closed when the returned socket is freed, or
+ * immediately if the recording cannot be read.
+ *
+ * @param fd
+ *     The file descriptor of a session recording that is open for reading.
+ *
+ * @return
+ *     A newly-allocated guac_socket which reads the contents of the given
+ *     recording, or NULL if the recording cannot be read (such as a
+ *     compressed recording when libguac was built without zlib), in which
+ *     case guac_error is set appropriately.
+ */
+guac_socket* guac_recording_open_read(int fd);
+
 /**
  * Reports the current mouse position and button state within the recording.
  *
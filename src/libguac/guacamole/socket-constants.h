@@ -39,14 +39,17 @@
 
 /**
  * The number of bytes of data to buffer prior to bulk conversion to base64.
+ * This must be a multiple of three, such that data which fills the buffer
+ * encodes without padding, and is chosen such that the encoded result exactly
+ * fills an output buffer of GUAC_SOCKET_OUTPUT_BUFFER_SIZE bytes.
  */
-#define GUAC_SOCKET_BASE64_READY_BUFFER_SIZE 768
+#define GUAC_SOCKET_BASE64_READY_BUFFER_SIZE 6144
 
 /**
  * The size of the buffer required to hold GUAC_SOCKET_BASE64_READY_BUFFER_SIZE
  * bytes encoded as base64.
  */
-#define GUAC_SOCKET_BASE64_ENCODED_BUFFER_SIZE 1024
+#define GUAC_SOCKET_BASE64_ENCODED_BUFFER_SIZE 8192
 
 #endif
 
@@ -17,6 +17,7 @@
  * under the License.
  */
 
+#include "guacamole/cpu.h"
 #include "guacamole/mem.h"
 #include "palette.h"
 
@@ -27,70 +28,273 @@
 #include <stdlib.h>
 #include <string.h>
 
-guac_palette* guac_palette_alloc(cairo_surface_t* surface) {
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
 
-    int x, y;
+/**
+ * Mask which isolates the 24-bit RGB color of a pixel within an RGB24 or
+ * ARGB32 Cairo surface.
+ */
+#define GUAC_PALETTE_RGB_MASK 0xFFFFFF
 
-    int width = cairo_image_surface_get_width(surface);
-    int height = cairo_image_surface_get_height(surface);
-    int stride = cairo_image_surface_get_stride(surface);
-    unsigned char* data = cairo_image_surface_get_data(surface);
+/**
+ * Mask which, when applied to a hash code, produces a valid index within the
+ * hash table of a guac_palette.
+ */
+#define GUAC_PALETTE_HASH_MASK ((1 << GUAC_PALETTE_HASH_BITS) - 1)
 
-    /* Allocate palette */
-    guac_palette* palette = (guac_palette*) guac_mem_zalloc(sizeof(guac_palette));
+/**
+ * Returns the location within the hash table of a guac_palette at which the
+ * search for the given color should begin.
+ *
+ * @param color
+ *     The 24-bit RGB color to hash.
+ *
+ * @return
+ *     The hash code of the given color, which is a valid index within the
+ *     hash table of a guac_palette.
+ */
+static int guac_palette_hash(int color) {
+    return ((uint32_t) color * 0x9E3779B1u) >> (32 - GUAC_PALETTE_HASH_BITS);
+}
+
+/**
+ * Returns the number of pixels at the beginning of the given array which are
+ * the given color, ignoring any alpha channel. Implementations of this
+ * function may check multiple pixels at once using SSE2 or AVX2
+ * instructions, with the implementation used selected at runtime by
+ * guac_palette_run_length_select_impl().
+ *
+ * @param pixels
+ *     The pixels to check, each in the format used by RGB24 and ARGB32 Cairo
+ *     surfaces.
+ *
+ * @param count
+ *     The number of pixels in the array.
+ *
+ * @param color
+ *     The 24-bit RGB color to compare each pixel against.
+ *
+ * @return
+ *     The number of consecutive pixels at the beginning of the array which
+ *     are the given color, which will be no greater than the given count.
+ */
+typedef int guac_palette_run_length_function(const uint32_t* pixels,
+        int count, uint32_t color);
+
+/**
+ * Portable implementation of guac_palette_run_length_function which checks
+ * one pixel at a time.
+ */
+static int guac_palette_run_length_scalar(const uint32_t* pixels,
+        int count, uint32_t color) {
+
+    int length = 0;
+    while (length < count && (pixels[length] & GUAC_PALETTE_RGB_MASK) == color)
+        length++;
+
+    return length;
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSE2 implementation of guac_palette_run_length_function which checks four
+ * pixels at a time. Any trailing pixels that do not fill an entire 128-bit
+ * vector are checked by the scalar implementation.
+ */
+__attribute__((target("sse2")))
+static int guac_palette_run_length_sse2(const uint32_t* pixels,
+        int count, uint32_t color) {
+
+    const __m128i mask = _mm_set1_epi32(GUAC_PALETTE_RGB_MASK);
+    const __m128i expected = _mm_set1_epi32(color);
+
+    int length = 0;
 
-    for (y=0; y<height; y++) {
-        for (x=0; x<width; x++) {
+    /* The mask produced by _mm_movemask_ps() has a bit set for each pixel
+     * that matches the expected color */
+    for (; length + 4 <= count; length += 4) {
 
-            /* Get pixel color */
-            int color = ((uint32_t*) data)[x] & 0xFFFFFF;
+        __m128i block = _mm_and_si128(mask,
+                _mm_loadu_si128((const __m128i*) (pixels + length)));
 
-            /* Calculate hash code */
-            int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+        int matches = _mm_movemask_ps(_mm_castsi128_ps(
+                    _mm_cmpeq_epi32(block, expected)));
 
-            guac_palette_entry* entry;
+        if (matches != 0xF)
+            return length + __builtin_ctz(~matches);
 
-            /* Search for open palette entry */
-            for (;;) {
-                
-                entry = &(palette->entries[hash]);
+    }
+
+    return length + guac_palette_run_length_scalar(pixels + length,
+            count - length, color);
+
+}
 
-                /* If we've found a free space, use it */
-                if (entry->index == 0) {
+/**
+ * AVX2 implementation of guac_palette_run_length_function which checks eight
+ * pixels at a time. Any trailing pixels that do not fill an entire 256-bit
+ * vector are checked by the scalar implementation.
+ */
+__attribute__((target("avx2")))
+static int guac_palette_run_length_avx2(const uint32_t* pixels,
+        int count, uint32_t color) {
 
-                    png_color* c;
+    const __m256i mask = _mm256_set1_epi32(GUAC_PALETTE_RGB_MASK);
+    const __m256i expected = _mm256_set1_epi32(color);
 
-                    /* Stop if already at capacity */
-                    if (palette->size == 256) {
-                        guac_palette_free(palette);
-                        return NULL;
-                    }
+    int length = 0;
 
-                    /* Store in palette */
-                    c = &(palette->colors[palette->size]);
-                    c->blue  = (color      ) & 0xFF;
-                    c->green = (color >> 8 ) & 0xFF;
-                    c->red   = (color >> 16) & 0xFF;
+    for (; length + 8 <= count; length += 8) {
 
-                    /* Add color to map */
-                    entry->index = ++palette->size;
-                    entry->color = color;
+        __m256i block = _mm256_and_si256(mask,
+                _mm256_loadu_si256((const __m256i*) (pixels + length)));
 
-                    break;
+        int matches = _mm256_movemask_ps(_mm256_castsi256_ps(
+                    _mm256_cmpeq_epi32(block, expected)));
 
-                }
+        if (matches != 0xFF)
+            return length + __builtin_ctz(~matches);
 
-                /* Otherwise, if already stored here, done */
-                if (entry->color == color)
-                    break;
+    }
 
-                /* Otherwise, collision. Move on to another bucket */
-                hash = (hash+1) & 0xFFF;
+    return length + guac_palette_run_length_scalar(pixels + length,
+            count - length, color);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of guac_palette_run_length_function
+ * supported by the current CPU.
+ *
+ * @return
+ *     The implementation of guac_palette_run_length_function that should be
+ *     used.
+ */
+static guac_palette_run_length_function* guac_palette_run_length_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_palette_run_length_avx2;
+
+    if (guac_cpu_supports(GUAC_CPU_SSE2))
+        return guac_palette_run_length_sse2;
+#endif
+
+    return guac_palette_run_length_scalar;
+
+}
 
+/**
+ * Returns the index of the given color within the given palette, adding
+ * that color to the palette if it is not already present.
+ *
+ * @param palette
+ *     The palette to search and, if necessary, add the color to.
+ *
+ * @param color
+ *     The 24-bit RGB color to locate or add.
+ *
+ * @return
+ *     The index of the given color within the palette, or -1 if the color is
+ *     not present and the palette is already full.
+ */
+static int guac_palette_insert(guac_palette* palette, int color) {
+
+    int hash = guac_palette_hash(color);
+
+    /* Search for either the color or an open palette entry */
+    for (;;) {
+
+        guac_palette_entry* entry = &(palette->entries[hash]);
+
+        /* If we've found a free space, use it */
+        if (entry->index == 0) {
+
+            /* Stop if already at capacity */
+            if (palette->size == GUAC_PALETTE_MAX_SIZE)
+                return -1;
+
+            /* Store in palette */
+            png_color* c = &(palette->colors[palette->size]);
+            c->blue  = (color      ) & 0xFF;
+            c->green = (color >> 8 ) & 0xFF;
+            c->red   = (color >> 16) & 0xFF;
+
+            /* Add color to map */
+            entry->index = ++palette->size;
+            entry->color = color;
+
+            return entry->index - 1;
+
+        }
+
+        /* Otherwise, if already stored here, done */
+        if (entry->color == color)
+            return entry->index - 1;
+
+        /* Otherwise, collision. Move on to another bucket */
+        hash = (hash + 1) & GUAC_PALETTE_HASH_MASK;
+
+    }
+
+}
+
+guac_palette* guac_palette_alloc(cairo_surface_t* surface,
+        unsigned char* indices) {
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char* data = cairo_image_surface_get_data(surface);
+
+    guac_palette_run_length_function* run_length =
+        guac_palette_run_length_select_impl();
+
+    /* Allocate palette */
+    guac_palette* palette = (guac_palette*) guac_mem_zalloc(sizeof(guac_palette));
+
+    for (int y = 0; y < height; y++) {
+
+        const uint32_t* row = (const uint32_t*) data;
+
+        int x = 0;
+        while (x < width) {
+
+            /* Get pixel color, adding it to the palette if new */
+            int color = row[x] & GUAC_PALETTE_RGB_MASK;
+            int index = guac_palette_insert(palette, color);
+
+            /* Abandon the palette as soon as it would be too large */
+            if (index < 0) {
+                guac_palette_free(palette);
+                return NULL;
             }
+
+            /* Skip past the remainder of any run of the same color, which
+             * is checked here for the following pixel before searching
+             * further to avoid the overhead of doing so for isolated
+             * pixels */
+            int length = 1;
+            if (x + 1 < width && (row[x + 1] & GUAC_PALETTE_RGB_MASK) == color)
+                length += run_length(row + x + 1, width - x - 1, color);
+
+            if (indices != NULL)
+                memset(indices + x, index, length);
+
+            x += length;
+
         }
 
         /* Advance to next data row */
+        if (indices != NULL)
+            indices += width;
+
         data += stride;
 
     }
@@ -102,7 +306,7 @@ guac_palette* guac_palette_alloc(cairo_surface_t* surface) {
 int guac_palette_find(guac_palette* palette, int color) {
 
     /* Calculate hash code */
-    int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+    int hash = guac_palette_hash(color);
 
     guac_palette_entry* entry;
 
@@ -120,7 +324,7 @@ int guac_palette_find(guac_palette* palette, int color) {
             return entry->index - 1;
 
         /* Otherwise, collision. Move on to another bucket */
-        hash = (hash+1) & 0xFFF;
+        hash = (hash + 1) & GUAC_PALETTE_HASH_MASK;
 
     }
 
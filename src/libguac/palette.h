@@ -23,23 +23,111 @@
 #include <cairo/cairo.h>
 #include <png.h>
 
+/**
+ * The maximum number of colors that may be stored within a guac_palette.
+ */
+#define GUAC_PALETTE_MAX_SIZE 256
+
+/**
+ * The number of bits of each color hash used to index the entries of a
+ * guac_palette. The resulting hash table is kept at least four times larger
+ * than the maximum number of colors, such that collisions remain rare.
+ */
+#define GUAC_PALETTE_HASH_BITS 10
+
+/**
+ * A single entry within the hash table of a guac_palette, mapping a color to
+ * its location within the palette.
+ */
 typedef struct guac_palette_entry {
 
+    /**
+     * The index of the color within the palette, plus one. If zero, this
+     * entry is unused.
+     */
     int index;
+
+    /**
+     * The 24-bit RGB color stored within this entry.
+     */
     int color;
 
 } guac_palette_entry;
 
+/**
+ * The set of all distinct colors within an image, provided that image
+ * contains no more than GUAC_PALETTE_MAX_SIZE distinct colors.
+ */
 typedef struct guac_palette {
 
-    guac_palette_entry entries[0x1000];
-    png_color colors[256];
+    /**
+     * Hash table mapping each color to its index within the palette.
+     */
+    guac_palette_entry entries[1 << GUAC_PALETTE_HASH_BITS];
+
+    /**
+     * All colors within the palette, in order of first appearance.
+     */
+    png_color colors[GUAC_PALETTE_MAX_SIZE];
+
+    /**
+     * The number of colors within the palette.
+     */
     int size;
 
 } guac_palette;
 
-guac_palette* guac_palette_alloc(cairo_surface_t* surface);
+/**
+ * Builds a palette of all distinct colors within the given RGB24 or ARGB32
+ * surface, ignoring any alpha channel. Building of the palette is abandoned
+ * as soon as more than GUAC_PALETTE_MAX_SIZE distinct colors are
+ * encountered. As the palette is built, the index of each pixel's color
+ * within the palette may optionally be stored, such that the image need not
+ * be scanned again to produce indexed image data.
+ *
+ * Runs of identical pixels are detected using SSE2 or AVX2 instructions
+ * where supported by the current CPU, with only the first pixel of each run
+ * needing to be located within the palette.
+ *
+ * @param surface
+ *     The surface to build the palette from.
+ *
+ * @param indices
+ *     A buffer of at least width * height bytes that should receive the
+ *     palette index of each pixel, row by row without padding, or NULL if
+ *     these indices are not needed. If building the palette is abandoned, the
+ *     contents of this buffer are undefined.
+ *
+ * @return
+ *     A newly-allocated palette containing all colors within the given
+ *     surface, which must eventually be freed with guac_palette_free(), or
+ *     NULL if the surface contains too many distinct colors.
+ */
+guac_palette* guac_palette_alloc(cairo_surface_t* surface,
+        unsigned char* indices);
+
+/**
+ * Returns the index of the given color within the given palette.
+ *
+ * @param palette
+ *     The palette to search.
+ *
+ * @param color
+ *     The 24-bit RGB color to locate.
+ *
+ * @return
+ *     The index of the given color within the palette, or -1 if the color is
+ *     not present.
+ */
 int guac_palette_find(guac_palette* palette, int color);
+
+/**
+ * Frees the given palette, which must have been allocated with
+ * guac_palette_alloc().
+ *
+ * @param palette
+ *     The palette to free.
+ */
 void guac_palette_free(guac_palette* palette);
 
 #endif
@@ -17,22 +17,156 @@
  * under the License.
  */
 
+#include "guacamole/cpu.h"
 #include "guacamole/mem.h"
 #include "guacamole/error.h"
+#include "guacamole/opcode.h"
 #include "guacamole/parser.h"
 #include "guacamole/socket.h"
 #include "guacamole/unicode.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Signature shared by all implementations of guac_parser_ascii_length(). See
+ * guac_parser_ascii_length() for the meaning of each parameter and the return
+ * value.
+ */
+typedef int guac_parser_ascii_length_function(const char* buffer, int length);
+
+/**
+ * Portable implementation of guac_parser_ascii_length() which checks eight
+ * bytes at a time.
+ */
+static int guac_parser_ascii_length_scalar(const char* buffer, int length) {
+
+    int ascii = 0;
+
+    /* Check whole 64-bit words for any bytes with the high bit set */
+    for (; ascii + 8 <= length; ascii += 8) {
+        uint64_t word;
+        memcpy(&word, buffer + ascii, sizeof(word));
+        if (word & 0x8080808080808080ull)
+            break;
+    }
+
+    /* Locate the exact end of the run within the final word */
+    while (ascii < length && !(buffer[ascii] & 0x80))
+        ascii++;
+
+    return ascii;
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSE2 implementation of guac_parser_ascii_length() which checks 16 bytes at
+ * a time. Any trailing bytes that do not fill an entire 128-bit vector are
+ * checked by the scalar implementation.
+ */
+__attribute__((target("sse2")))
+static int guac_parser_ascii_length_sse2(const char* buffer, int length) {
+
+    int ascii = 0;
+
+    /* The mask produced by _mm_movemask_epi8() has a bit set for each byte
+     * having its high bit set, and thus for each non-ASCII byte */
+    for (; ascii + 16 <= length; ascii += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (buffer + ascii));
+        int non_ascii = _mm_movemask_epi8(bytes);
+        if (non_ascii)
+            return ascii + __builtin_ctz(non_ascii);
+    }
+
+    return ascii + guac_parser_ascii_length_scalar(buffer + ascii,
+            length - ascii);
+
+}
+
+/**
+ * AVX2 implementation of guac_parser_ascii_length() which checks 32 bytes at
+ * a time. Any trailing bytes that do not fill an entire 256-bit vector are
+ * checked by the scalar implementation.
+ */
+__attribute__((target("avx2")))
+static int guac_parser_ascii_length_avx2(const char* buffer, int length) {
+
+    int ascii = 0;
+
+    for (; ascii + 32 <= length; ascii += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (buffer + ascii));
+        unsigned int non_ascii = _mm256_movemask_epi8(bytes);
+        if (non_ascii)
+            return ascii + __builtin_ctz(non_ascii);
+    }
+
+    return ascii + guac_parser_ascii_length_scalar(buffer + ascii,
+            length - ascii);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of guac_parser_ascii_length() supported
+ * by the current CPU.
+ *
+ * @return
+ *     The implementation of guac_parser_ascii_length() that should be used.
+ */
+static guac_parser_ascii_length_function* guac_parser_ascii_length_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_parser_ascii_length_avx2;
+
+    if (guac_cpu_supports(GUAC_CPU_SSE2))
+        return guac_parser_ascii_length_sse2;
+#endif
+
+    return guac_parser_ascii_length_scalar;
+
+}
+
+/**
+ * Returns the number of bytes at the beginning of the given buffer which are
+ * ASCII characters. As each ASCII character is exactly one byte in UTF-8,
+ * this is also the number of characters that may be skipped without
+ * decoding. Where supported by the current CPU, the buffer is checked using
+ * SSE2 or AVX2 instructions.
+ *
+ * @param buffer
+ *     The buffer to check.
+ *
+ * @param length
+ *     The number of bytes in the buffer.
+ *
+ * @return
+ *     The number of consecutive ASCII characters at the beginning of the
+ *     buffer, which will be no greater than the given length.
+ */
+static int guac_parser_ascii_length(const char* buffer, int length) {
+    guac_parser_ascii_length_function* impl =
+        guac_parser_ascii_length_select_impl();
+    return impl(buffer, length);
+}
+
 static void guac_parser_reset(guac_parser* parser) {
     parser->opcode = NULL;
+    parser->opcode_id = GUAC_OPCODE_UNKNOWN;
     parser->argc = 0;
     parser->state = GUAC_PARSE_LENGTH;
     parser->__elementc = 0;
     parser->__element_length = 0;
+    parser->__element_digits = 0;
 }
 
 guac_parser* guac_parser_alloc(void) {
@@ -45,9 +179,14 @@ guac_parser* guac_parser_alloc(void) {
         return NULL;
     }
 
+    /* Buffer data within the parser itself until an instruction does not
+     * fit */
+    parser->__buffer = parser->__instructionbuf;
+    parser->__buffer_size = sizeof(parser->__instructionbuf);
+
     /* Init parse start/end markers */
-    parser->__instructionbuf_unparsed_start = parser->__instructionbuf;
-    parser->__instructionbuf_unparsed_end = parser->__instructionbuf;
+    parser->__instructionbuf_unparsed_start = parser->__buffer;
+    parser->__instructionbuf_unparsed_end = parser->__buffer;
 
     guac_parser_reset(parser);
     return parser;
@@ -77,9 +216,20 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
             bytes_parsed++;
 
             /* If digit, add to length */
-            if (c >= '0' && c <= '9')
+            if (c >= '0' && c <= '9') {
+
                 parsed_length = parsed_length*10 + c - '0';
 
+                /* If too long, parse error (checked for each digit such that
+                 * the length can never overflow, even given leading zeroes) */
+                if (++parser->__element_digits > GUAC_INSTRUCTION_MAX_DIGITS
+                        || parsed_length > GUAC_INSTRUCTION_MAX_LENGTH) {
+                    parser->state = GUAC_PARSE_ERROR;
+                    return 0;
+                }
+
+            }
+
             /* If period, switch to parsing content */
             else if (c == '.') {
                 parser->__elementv[parser->__elementc++] = char_buffer;
@@ -95,12 +245,6 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
 
         }
 
-        /* If too long, parse error */
-        if (parsed_length > GUAC_INSTRUCTION_MAX_LENGTH) {
-            parser->state = GUAC_PARSE_ERROR;
-            return 0;
-        }
-
         /* Save length */
         parser->__element_length = parsed_length;
 
@@ -111,6 +255,24 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
 
         while (bytes_parsed < length && parser->__element_length >= 0) {
 
+            /* Skip any run of ASCII characters within the element all at
+             * once, as each such character is exactly one byte */
+            if (parser->__element_length > 0) {
+
+                int available = length - bytes_parsed;
+                if (available > parser->__element_length)
+                    available = parser->__element_length;
+
+                int ascii = guac_parser_ascii_length(char_buffer, available);
+                parser->__element_length -= ascii;
+                char_buffer += ascii;
+                bytes_parsed += ascii;
+
+                if (bytes_parsed == length)
+                    break;
+
+            }
+
             /* Get length of current character */
             char c = *char_buffer;
             int char_length = guac_utf8_charsize((unsigned char) c);
@@ -131,6 +293,7 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
                 if (c == ';') {
                     parser->state = GUAC_PARSE_COMPLETE;
                     parser->opcode = parser->__elementv[0];
+                    parser->opcode_id = guac_opcode_lookup(parser->opcode);
                     parser->argv = &(parser->__elementv[1]);
                     parser->argc = parser->__elementc - 1;
                     break;
@@ -139,6 +302,7 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
                 /* If comma, move on to next element */
                 else if (c == ',') {
                     parser->state = GUAC_PARSE_LENGTH;
+                    parser->__element_digits = 0;
                     break;
                 }
 
@@ -162,12 +326,154 @@ int guac_parser_append(guac_parser* parser, void* buffer, int length) {
 
 }
 
-int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout) {
+/**
+ * Moves all data within the given parser's current buffer that is still
+ * needed (the elements parsed so far for the in-progress instruction and any
+ * data not yet parsed) to the beginning of the given buffer, updating all
+ * pointers into that data. The given buffer may be the parser's current
+ * buffer, in which case space is simply reclaimed from data that is no
+ * longer needed. If the given buffer is a different buffer, it replaces the
+ * parser's current buffer, and the current buffer is freed if it was
+ * dynamically allocated.
+ *
+ * @param parser
+ *     The parser whose data should be moved.
+ *
+ * @param buffer
+ *     The buffer to move the parser's data into.
+ *
+ * @param size
+ *     The size of the given buffer, in bytes. This must be large enough to
+ *     hold all data being moved.
+ */
+static void guac_parser_move(guac_parser* parser, char* buffer, int size) {
 
-    char* unparsed_end   = parser->__instructionbuf_unparsed_end;
-    char* unparsed_start = parser->__instructionbuf_unparsed_start;
-    char* instr_start    = parser->__instructionbuf_unparsed_start;
-    char* buffer_end     = parser->__instructionbuf + sizeof(parser->__instructionbuf);
+    char* old_buffer = parser->__buffer;
+    char* start = parser->__instructionbuf_unparsed_start;
+
+    /* Data preceding the first element of the in-progress instruction (or,
+     * if there are no elements yet, preceding the first unparsed byte) is no
+     * longer needed */
+    if (parser->__elementc > 0)
+        start = parser->__elementv[0];
+
+    int length = parser->__instructionbuf_unparsed_end - start;
+    memmove(buffer, start, length);
+
+    /* Update parsed elements, if any */
+    for (int i = 0; i < parser->__elementc; i++)
+        parser->__elementv[i] = buffer + (parser->__elementv[i] - start);
+
+    /* Update tracking pointers */
+    parser->__instructionbuf_unparsed_start = buffer
+        + (parser->__instructionbuf_unparsed_start - start);
+    parser->__instructionbuf_unparsed_end = buffer + length;
+
+    if (buffer != old_buffer) {
+
+        if (old_buffer != parser->__instructionbuf)
+            guac_mem_free(old_buffer);
+
+        parser->__buffer = buffer;
+        parser->__buffer_size = size;
+
+    }
+
+}
+
+/**
+ * Returns the number of bytes within the given parser's buffer that are
+ * still needed: the elements parsed so far for the in-progress instruction
+ * and any data not yet parsed.
+ *
+ * @param parser
+ *     The parser to inspect.
+ *
+ * @return
+ *     The number of bytes of buffered data that are still needed.
+ */
+static int guac_parser_retained_length(guac_parser* parser) {
+
+    char* start = parser->__instructionbuf_unparsed_start;
+    if (parser->__elementc > 0)
+        start = parser->__elementv[0];
+
+    return parser->__instructionbuf_unparsed_end - start;
+
+}
+
+/**
+ * Ensures that at least the given number of bytes are available at the end
+ * of the given parser's buffer for receiving further data. Space is first
+ * reclaimed from data that is no longer needed. If this is not sufficient,
+ * the buffer is replaced with a buffer of double the size (or more, if
+ * doubling is not enough), up to a maximum of GUAC_PARSER_MAX_BUFFER_SIZE
+ * bytes. Once an instruction that required a larger buffer has been read,
+ * data is moved back into the parser's own buffer (freeing the larger
+ * buffer) when next space is needed and that data fits.
+ *
+ * @param parser
+ *     The parser whose buffer should have space available.
+ *
+ * @param required
+ *     The number of bytes that must be available at the end of the buffer.
+ *
+ * @return
+ *     Zero if the required space is available, non-zero if an error occurs,
+ *     in which case guac_error will be set appropriately.
+ */
+static int guac_parser_reserve(guac_parser* parser, int required) {
+
+    char* buffer_end = parser->__buffer + parser->__buffer_size;
+    if (buffer_end - parser->__instructionbuf_unparsed_end >= required)
+        return 0;
+
+    /* Determine amount of space needed for the data that is still needed,
+     * plus the data that is yet to be received */
+    int needed = guac_parser_retained_length(parser) + required;
+
+    /* Move back into the parser's own buffer if possible */
+    if (needed <= sizeof(parser->__instructionbuf)) {
+        guac_parser_move(parser, parser->__instructionbuf,
+                sizeof(parser->__instructionbuf));
+        return 0;
+    }
+
+    /* Otherwise reclaim space within the current buffer, if sufficient */
+    if (needed <= parser->__buffer_size) {
+        guac_parser_move(parser, parser->__buffer, parser->__buffer_size);
+        return 0;
+    }
+
+    /* Fail if the in-progress instruction cannot possibly fit */
+    if (needed > GUAC_PARSER_MAX_BUFFER_SIZE) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Instruction too long";
+        return 1;
+    }
+
+    /* Grow to the next power of two multiple of the current size that is
+     * large enough */
+    int size = parser->__buffer_size;
+    while (size < needed)
+        size *= 2;
+
+    if (size > GUAC_PARSER_MAX_BUFFER_SIZE)
+        size = GUAC_PARSER_MAX_BUFFER_SIZE;
+
+    char* buffer = guac_mem_alloc(size);
+    if (buffer == NULL) {
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "Insufficient memory to buffer instruction";
+        return 1;
+    }
+
+    guac_parser_move(parser, buffer, size);
+    return 0;
+
+}
+
+int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout) {
 
     /* Begin next instruction if previous was ended */
     if (parser->state == GUAC_PARSE_COMPLETE)
@@ -176,6 +482,9 @@ int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout)
     while (parser->state != GUAC_PARSE_COMPLETE
         && parser->state != GUAC_PARSE_ERROR) {
 
+        char* unparsed_start = parser->__instructionbuf_unparsed_start;
+        char* unparsed_end = parser->__instructionbuf_unparsed_end;
+
         /* Add any available data to buffer */
         int parsed = guac_parser_append(parser, unparsed_start, unparsed_end - unparsed_start);
 
@@ -184,38 +493,27 @@ int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout)
 
             int retval;
 
-            /* If no space left to read, fail */
-            if (unparsed_end == buffer_end) {
-
-                /* Shift backward if possible */
-                if (instr_start != parser->__instructionbuf) {
-
-                    int i;
-
-                    /* Shift buffer */
-                    int offset = instr_start - parser->__instructionbuf;
-                    memmove(parser->__instructionbuf, instr_start,
-                            unparsed_end - instr_start);
-
-                    /* Update tracking pointers */
-                    unparsed_end -= offset;
-                    unparsed_start -= offset;
-                    instr_start = parser->__instructionbuf;
-
-                    /* Update parsed elements, if any */
-                    for (i=0; i < parser->__elementc; i++)
-                        parser->__elementv[i] -= offset;
-
-                }
+            /* The length prefix of the current element, if known, is a
+             * lower bound for the amount of data that must be read (at
+             * least one byte per character, plus the terminator), allowing
+             * instructions that cannot possibly fit to be rejected before
+             * they are read. Space is otherwise only made available as data
+             * actually arrives, such that merely declaring a long element
+             * does not cause a large buffer to be allocated. */
+            if (parser->state == GUAC_PARSE_CONTENT
+                    && guac_parser_retained_length(parser)
+                        + parser->__element_length + 1
+                        - (unparsed_end - unparsed_start)
+                        > GUAC_PARSER_MAX_BUFFER_SIZE) {
+                guac_error = GUAC_STATUS_NO_MEMORY;
+                guac_error_message = "Instruction too long";
+                return -1;
+            }
 
-                /* Otherwise, no memory to read */
-                else {
-                    guac_error = GUAC_STATUS_NO_MEMORY;
-                    guac_error_message = "Instruction too long";
-                    return -1;
-                }
+            if (guac_parser_reserve(parser, 1))
+                return -1;
 
-            }
+            unparsed_end = parser->__instructionbuf_unparsed_end;
 
             /* No instruction yet? Get more data ... */
             retval = guac_socket_select(socket, usec_timeout);
@@ -224,7 +522,7 @@ int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout)
            
             /* Attempt to fill buffer */
             retval = guac_socket_read(socket, unparsed_end,
-                    buffer_end - unparsed_end);
+                    parser->__buffer + parser->__buffer_size - unparsed_end);
 
             /* Set guac_error if read unsuccessful */
             if (retval < 0) {
@@ -242,13 +540,13 @@ int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout)
             }
 
             /* Update internal buffer */
-            unparsed_end += retval;
+            parser->__instructionbuf_unparsed_end += retval;
 
         }
 
         /* If data was parsed, advance buffer */
         else
-            unparsed_start += parsed;
+            parser->__instructionbuf_unparsed_start += parsed;
 
     } /* end while parsing data */
 
@@ -259,8 +557,6 @@ int guac_parser_read(guac_parser* parser, guac_socket* socket, int usec_timeout)
         return -1;
     }
 
-    parser->__instructionbuf_unparsed_start = unparsed_start;
-    parser->__instructionbuf_unparsed_end = unparsed_end;
     return 0;
 
 }
@@ -312,6 +608,13 @@ int guac_parser_shift(guac_parser* parser, void* buffer, int length) {
 }
 
 void guac_parser_free(guac_parser* parser) {
+
+    /* Free any buffer allocated for instructions that did not fit within
+     * the parser itself */
+    if (parser->__buffer != parser->__instructionbuf)
+        guac_mem_free(parser->__buffer);
+
     guac_mem_free(parser);
+
 }
 
@@ -24,7 +24,14 @@
 #include "guacamole/protocol.h"
 #include "guacamole/recording.h"
 #include "guacamole/socket.h"
+#include "guacamole/string.h"
 #include "guacamole/timestamp.h"
+#include "socket-index.h"
+#include "socket-queue.h"
+
+#ifdef ENABLE_ZLIB
+#include "socket-gzip.h"
+#endif
 
 #ifdef __MINGW32__
 #include <direct.h>
@@ -39,10 +46,58 @@
 #include <string.h>
 #include <unistd.h>
 
+/**
+ * Opens the index of the recording having the given filename within the given
+ * path, truncating any existing index. If the index cannot be opened, a
+ * warning is logged and the recording proceeds without an index.
+ *
+ * @param client
+ *     The client being recorded.
+ *
+ * @param path
+ *     The full absolute path to the directory containing the recording.
+ *
+ * @param filename
+ *     The filename of the recording within the given path, as ultimately used
+ *     to open the recording.
+ *
+ * @return
+ *     The file descriptor of the opened index, or -1 if the index could not
+ *     be opened.
+ */
+static int guac_recording_open_index(guac_client* client, const char* path,
+        const char* filename) {
+
+    char index_filename[GUAC_COMMON_RECORDING_MAX_NAME_LENGTH];
+
+    guac_strlcpy(index_filename, filename, sizeof(index_filename));
+    if (guac_strlcat(index_filename, GUAC_RECORDING_INDEX_SUFFIX,
+                sizeof(index_filename)) >= sizeof(index_filename)) {
+        guac_client_log(client, GUAC_LOG_WARNING, "Filename of recording "
+                "is too long for an index to be written.");
+        return -1;
+    }
+
+    guac_open_how how = {
+        .oflags = O_CREAT | O_WRONLY | O_TRUNC,
+        .mode = S_IRUSR | S_IWUSR | S_IRGRP
+    };
+
+    int fd = guac_openat(path, index_filename, &how);
+    if (fd == -1)
+        guac_client_log(client, GUAC_LOG_WARNING, "Creation of recording "
+                "index failed: %s: %s", guac_error_message,
+                guac_status_string(guac_error));
+
+    return fd;
+
+}
+
 guac_recording* guac_recording_create(guac_client* client,
         const char* path, const char* name, int create_path,
         int include_output, int include_mouse, int include_touch,
-        int include_keys, int allow_write_existing, int include_clipboard) {
+        int include_keys, int allow_write_existing, int include_clipboard,
+        int create_index, int compress) {
 
     char filename[GUAC_COMMON_RECORDING_MAX_NAME_LENGTH];
 
@@ -71,12 +126,47 @@ guac_recording* guac_recording_create(guac_client* client,
 
     /* Create recording structure with reference to underlying socket */
     guac_recording* recording = guac_mem_alloc(sizeof(guac_recording));
-    recording->socket = guac_socket_open(fd);
+    guac_socket* socket = guac_socket_open(fd);
     recording->include_output = include_output;
     recording->include_mouse = include_mouse;
     recording->include_touch = include_touch;
     recording->include_keys = include_keys;
     recording->include_clipboard = include_clipboard;
+    recording->create_index = 0;
+    recording->compress = 0;
+
+    /* Compress the recording as it is written, if requested and possible */
+    if (compress) {
+#ifdef ENABLE_ZLIB
+        guac_socket* gzip = guac_socket_gzip(socket, GUAC_SOCKET_GZIP_LEVEL);
+        if (gzip != NULL) {
+            socket = gzip;
+            recording->compress = 1;
+        }
+        else
+            guac_client_log(client, GUAC_LOG_WARNING, "Recording will not "
+                    "be compressed: %s", guac_error_message);
+#else
+        guac_client_log(client, GUAC_LOG_WARNING, "Recording will not be "
+                "compressed, as guacamole-server was built without zlib.");
+#endif
+    }
+
+    /* Note the offsets of frames within the recording as it is written, if
+     * requested, such that playback can later seek directly to those frames */
+    if (create_index) {
+        int index_fd = guac_recording_open_index(client, path, filename);
+        if (index_fd != -1) {
+            socket = guac_socket_index(socket, guac_socket_open(index_fd),
+                    GUAC_RECORDING_INDEX_INTERVAL);
+            recording->create_index = 1;
+        }
+    }
+
+    /* Write to storage from a dedicated thread, such that sessions are not
+     * stalled by slow storage unless storage falls far behind */
+    recording->socket = guac_socket_queue_bounded(socket,
+            GUAC_RECORDING_BUFFER_SIZE);
 
     if (include_clipboard)
         recording->clipboard_stream = guac_client_alloc_stream(client);
@@ -188,3 +278,46 @@ void guac_recording_report_clipboard(guac_recording* recording,
     guac_protocol_send_end(socket, stream);
 
 }
+
+int guac_recording_is_compressed(int fd) {
+
+    unsigned char magic[2];
+
+    /* Check for the magic number of the gzip format, restoring the file
+     * position afterwards */
+    off_t position = lseek(fd, 0, SEEK_CUR);
+    if (position == -1 || lseek(fd, 0, SEEK_SET) == -1)
+        return 0;
+
+    int compressed = read(fd, magic, sizeof(magic)) == sizeof(magic)
+        && magic[0] == 0x1F && magic[1] == 0x8B;
+
+    lseek(fd, position, SEEK_SET);
+    return compressed;
+
+}
+
+guac_socket* guac_recording_open_read(int fd) {
+
+    /* Uncompressed recordings are read directly */
+    if (!guac_recording_is_compressed(fd))
+        return guac_socket_open(fd);
+
+#ifdef ENABLE_ZLIB
+    guac_socket* socket = guac_socket_open(fd);
+    guac_socket* gunzip = guac_socket_gunzip(socket);
+
+    /* Freeing the underlying socket also closes the file descriptor */
+    if (gunzip == NULL)
+        guac_socket_free(socket);
+
+    return gunzip;
+#else
+    close(fd);
+    guac_error = GUAC_STATUS_NOT_SUPPORTED;
+    guac_error_message = "Recording is compressed, but guacamole-server was "
+        "built without zlib";
+    return NULL;
+#endif
+
+}
@@ -22,9 +22,12 @@
 #include "guacamole/error.h"
 #include "guacamole/socket.h"
 #include "guacamole/user.h"
+#include "socket-broadcast.h"
+#include "socket-queue.h"
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 /**
  * A function that will broadcast arbitrary data to a subset of users for
@@ -61,11 +64,46 @@ typedef struct guac_socket_broadcast_data {
      */
     pthread_mutex_t socket_lock;
 
+    /**
+     * Lock which protects access to the instruction buffer of this socket.
+     */
+    pthread_mutex_t buffer_lock;
+
     /**
      * The function to broadcast
      */
     guac_socket_broadcast_handler* broadcast_handler;
 
+    /**
+     * Non-zero if instructions written to this socket may be skipped by users
+     * that have fallen too far behind, zero otherwise. Instructions may only
+     * be skipped if those users will later be resynchronized with the
+     * current state of the connection, as done for all pending users.
+     */
+    int skippable;
+
+    /**
+     * Non-zero if an instruction is currently being written, zero otherwise.
+     */
+    int instruction_open;
+
+    /**
+     * The instruction currently being written, which is broadcast to all
+     * users only once complete, such that each user receives either the
+     * entire instruction or none of it.
+     */
+    char* buffer;
+
+    /**
+     * The number of bytes currently stored within the instruction buffer.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for the instruction buffer.
+     */
+    size_t capacity;
+
 } guac_socket_broadcast_data;
 
 /**
@@ -74,17 +112,68 @@ typedef struct guac_socket_broadcast_data {
 typedef struct __write_chunk {
 
     /**
-     * The buffer to write.
+     * The instruction to write, parsed only once for all users.
      */
-    const void* buffer;
+    guac_socket_queue_instruction instruction;
 
     /**
-     * The number of bytes in the buffer.
+     * Non-zero if users that have fallen too far behind may skip this chunk,
+     * zero otherwise.
      */
-    size_t length;
+    int skippable;
+
+    /**
+     * The filter restricting which users receive this chunk, or NULL if all
+     * users should receive this chunk.
+     */
+    const guac_socket_broadcast_filter* filter;
 
 } __write_chunk;
 
+/**
+ * Key used to store the broadcast filter of each thread, as set by
+ * guac_socket_broadcast_set_filter().
+ */
+static pthread_key_t __guac_socket_broadcast_filter_key;
+
+/**
+ * Initialization control for __guac_socket_broadcast_filter_key.
+ */
+static pthread_once_t __guac_socket_broadcast_filter_key_init = PTHREAD_ONCE_INIT;
+
+/**
+ * Creates the key used to store the broadcast filter of each thread. This
+ * function is invoked only once, via pthread_once().
+ */
+static void __guac_socket_broadcast_alloc_filter_key(void) {
+    pthread_key_create(&__guac_socket_broadcast_filter_key, NULL);
+}
+
+/**
+ * Returns the broadcast filter set by the current thread, if any.
+ *
+ * @return
+ *     The broadcast filter set by the current thread via
+ *     guac_socket_broadcast_set_filter(), or NULL if no filter is set.
+ */
+static const guac_socket_broadcast_filter* __guac_socket_broadcast_get_filter(void) {
+
+    pthread_once(&__guac_socket_broadcast_filter_key_init,
+            __guac_socket_broadcast_alloc_filter_key);
+
+    return pthread_getspecific(__guac_socket_broadcast_filter_key);
+
+}
+
+void guac_socket_broadcast_set_filter(const guac_socket_broadcast_filter* filter) {
+
+    pthread_once(&__guac_socket_broadcast_filter_key_init,
+            __guac_socket_broadcast_alloc_filter_key);
+
+    pthread_setspecific(__guac_socket_broadcast_filter_key, filter);
+
+}
+
 /**
  * Callback which handles read requests on the broadcast socket. This callback
  * always fails, as the broadcast socket is write-only; it cannot be read.
@@ -112,9 +201,11 @@ static ssize_t __guac_socket_broadcast_read_handler(guac_socket* socket,
 }
 
 /**
- * Callback invoked by the broadcast handler which write a given chunk of
- * data to that user's socket. If the write attempt fails, the user is
- * signalled to stop with guac_user_stop().
+ * Callback invoked by the broadcast handler which writes a given chunk of
+ * data to that user's socket as a single instruction. If the user's socket
+ * queues its output, the chunk is queued without waiting for that user. Users
+ * excluded by the filter of the chunk, if any, are skipped. If the write
+ * attempt fails, the user is signalled to stop with guac_user_stop().
  *
  * @param user
  *     The user that the chunk of data should be written to.
@@ -129,18 +220,70 @@ static void* __write_chunk_callback(guac_user* user, void* data) {
 
     __write_chunk* chunk = (__write_chunk*) data;
 
+    /* Skip users that are excluded from this chunk */
+    const guac_socket_broadcast_filter* filter = chunk->filter;
+    if (filter != NULL && !filter->callback(user, filter->data))
+        return NULL;
+
     /* Attempt write, disconnect on failure */
-    if (guac_socket_write(user->socket, chunk->buffer, chunk->length))
+    if (guac_socket_queue_write_parsed_instruction(user->socket,
+                &chunk->instruction, chunk->skippable))
         guac_user_stop(user);
 
     return NULL;
 
 }
 
+/**
+ * Broadcasts the contents of the instruction buffer of the given broadcast
+ * socket to all applicable users, emptying the buffer. The buffer lock of the
+ * broadcast socket must be held.
+ *
+ * @param data
+ *     The data associated with the broadcast socket.
+ *
+ * @param skippable
+ *     Non-zero if the contents of the buffer are a complete instruction that
+ *     users which have fallen too far behind may skip, zero otherwise.
+ */
+static void __guac_socket_broadcast_deliver(guac_socket_broadcast_data* data,
+        int skippable) {
+
+    if (data->length == 0)
+        return;
+
+    /* Build chunk */
+    __write_chunk chunk;
+    /* Parse the instruction only once for all users. Data written outside
+     * of any instruction may be only part of an instruction and is never
+     * dropped. */
+    if (data->instruction_open)
+        guac_socket_queue_instruction_init(&chunk.instruction, data->buffer,
+                data->length);
+
+    else {
+        chunk.instruction.data = data->buffer;
+        chunk.instruction.length = data->length;
+        chunk.instruction.type = GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER;
+        chunk.instruction.stream = -1;
+    }
+    chunk.skippable = skippable;
+    chunk.filter = __guac_socket_broadcast_get_filter();
+
+    /* Broadcast chunk to the users */
+    data->broadcast_handler(data->client, __write_chunk_callback, &chunk);
+
+    data->length = 0;
+
+}
+
 /**
  * Socket write handler which operates on each of the sockets of all connected
- * users. This write handler will always succeed, but any failing user-specific
- * writes will invoke guac_user_stop() on the failing user.
+ * users. Data written as part of an instruction is buffered until that
+ * instruction is complete, while data written outside of an instruction is
+ * broadcast immediately. This write handler will always succeed, but any
+ * failing user-specific writes will invoke guac_user_stop() on the failing
+ * user.
  *
  * @param socket
  *     The socket to which the given data must be written.
@@ -162,13 +305,30 @@ static ssize_t __guac_socket_broadcast_write_handler(guac_socket* socket,
     guac_socket_broadcast_data* data =
         (guac_socket_broadcast_data*) socket->data;
 
-    /* Build chunk */
-    __write_chunk chunk;
-    chunk.buffer = buf;
-    chunk.length = count;
+    pthread_mutex_lock(&(data->buffer_lock));
 
-    /* Broadcast chunk to the users */
-    data->broadcast_handler(data->client, __write_chunk_callback, &chunk);
+    /* Grow buffer geometrically as necessary */
+    size_t required = guac_mem_ckd_add_or_die(data->length, count);
+    if (required > data->capacity) {
+
+        size_t capacity = data->capacity ? data->capacity : 1024;
+        while (capacity < required)
+            capacity = guac_mem_ckd_mul_or_die(capacity, 2);
+
+        data->buffer = guac_mem_realloc_or_die(data->buffer, capacity);
+        data->capacity = capacity;
+
+    }
+
+    memcpy(data->buffer + data->length, buf, count);
+    data->length = required;
+
+    /* Data written outside of any instruction cannot be buffered until the
+     * end of that instruction */
+    if (!data->instruction_open)
+        __guac_socket_broadcast_deliver(data, 0);
+
+    pthread_mutex_unlock(&(data->buffer_lock));
 
     return count;
 
@@ -224,34 +384,12 @@ static ssize_t __guac_socket_broadcast_flush_handler(guac_socket* socket) {
 }
 
 /**
- * Callback which is invoked by the broadcast handler to lock the given
- * user's socket in preparation for the beginning of a Guacamole protocol
- * instruction.
- *
- * @param user
- *     The user whose socket should be locked.
- *
- * @param data
- *     Arbitrary data passed to the broadcast handler. This is not needed
- *     by this callback, and should be left as NULL.
- *
- * @return
- *     Always NULL.
- */
-static void* __lock_callback(guac_user* user, void* data) {
-
-    /* Lock socket */
-    guac_socket_instruction_begin(user->socket);
-
-    return NULL;
-
-}
-
-/**
- * Socket lock handler which acquires the socket locks of all connected users.
- * Socket-level locks are acquired in preparation for the beginning of a new
- * Guacamole instruction to ensure that parallel writes are only interleaved at
- * instruction boundaries.
+ * Socket lock handler which acquires exclusive access to the broadcast socket
+ * in preparation for the beginning of a new Guacamole instruction. The
+ * instruction is buffered and written to each user only once complete, thus
+ * the sockets of individual users need not be locked for the duration of the
+ * instruction, and parallel writes are only interleaved at instruction
+ * boundaries.
  *
  * @param socket
  *     The broadcast socket to lock.
@@ -264,38 +402,16 @@ static void __guac_socket_broadcast_lock_handler(guac_socket* socket) {
     /* Acquire exclusive access to socket */
     pthread_mutex_lock(&(data->socket_lock));
 
-    /* Lock sockets of the users */
-    data->broadcast_handler(data->client, __lock_callback, NULL);
+    pthread_mutex_lock(&(data->buffer_lock));
+    data->instruction_open = 1;
+    pthread_mutex_unlock(&(data->buffer_lock));
 
 }
 
 /**
- * Callback which is invoked by the broadcast handler to unlock the given
- * user's socket at the end of a Guacamole protocol instruction.
- *
- * @param user
- *     The user whose socket should be unlocked.
- *
- * @param data
- *     Arbitrary data passed to the broadcast handler. This is not needed
- *     by this callback, and should be left as NULL.
- *
- * @return
- *     Always NULL.
- */
-static void* __unlock_callback(guac_user* user, void* data) {
-
-    /* Unlock socket */
-    guac_socket_instruction_end(user->socket);
-
-    return NULL;
-
-}
-
-/**
- * Socket unlock handler which releases the socket locks of all connected users.
- * Socket-level locks are released after a Guacamole instruction has finished
- * being written.
+ * Socket unlock handler which broadcasts the instruction that has just
+ * finished being written to all applicable users, and relinquishes exclusive
+ * access to the broadcast socket.
  *
  * @param socket
  *     The broadcast socket to unlock.
@@ -305,8 +421,11 @@ static void __guac_socket_broadcast_unlock_handler(guac_socket* socket) {
     guac_socket_broadcast_data* data =
         (guac_socket_broadcast_data*) socket->data;
 
-    /* Unlock sockets of all users */
-    data->broadcast_handler(data->client, __unlock_callback, NULL);
+    /* Write completed instruction to all users */
+    pthread_mutex_lock(&(data->buffer_lock));
+    __guac_socket_broadcast_deliver(data, data->skippable);
+    data->instruction_open = 0;
+    pthread_mutex_unlock(&(data->buffer_lock));
 
     /* Relinquish exclusive access to socket */
     pthread_mutex_unlock(&(data->socket_lock));
@@ -358,7 +477,9 @@ static int __guac_socket_broadcast_free_handler(guac_socket* socket) {
 
     /* Destroy locks */
     pthread_mutex_destroy(&(data->socket_lock));
+    pthread_mutex_destroy(&(data->buffer_lock));
 
+    guac_mem_free(data->buffer);
     guac_mem_free(data);
     return 0;
 
@@ -375,21 +496,27 @@ static int __guac_socket_broadcast_free_handler(guac_socket* socket) {
  *     The handler that will perform the broadcast against a subset of users
  *     of the provided client.
  *
+ * @param skippable
+ *     Non-zero if users that have fallen too far behind may skip instructions
+ *     written to the socket, as those users will be resynchronized with the
+ *     current state of the connection, zero otherwise.
+ *
  * @return
  *     The newly constructed broadcast socket
  */
-static guac_socket* __guac_socket_init(
-        guac_client* client, guac_socket_broadcast_handler* broadcast_handler) {
+static guac_socket* __guac_socket_init(guac_client* client,
+        guac_socket_broadcast_handler* broadcast_handler, int skippable) {
 
     pthread_mutexattr_t lock_attributes;
 
     /* Allocate socket and associated data */
     guac_socket* socket = guac_socket_alloc();
     guac_socket_broadcast_data* data =
-        guac_mem_alloc(sizeof(guac_socket_broadcast_data));
+        guac_mem_zalloc(sizeof(guac_socket_broadcast_data));
 
     /* Set the provided broadcast handler */
     data->broadcast_handler = broadcast_handler;
+    data->skippable = skippable;
 
     /* Store client as socket data */
     data->client = client;
@@ -398,8 +525,9 @@ static guac_socket* __guac_socket_init(
     pthread_mutexattr_init(&lock_attributes);
     pthread_mutexattr_setpshared(&lock_attributes, PTHREAD_PROCESS_SHARED);
 
-    /* Init lock */
+    /* Init locks */
     pthread_mutex_init(&(data->socket_lock), &lock_attributes);
+    pthread_mutex_init(&(data->buffer_lock), &lock_attributes);
 
     /* Set read/write handlers */
     socket->read_handler   = __guac_socket_broadcast_read_handler;
@@ -416,15 +544,17 @@ static guac_socket* __guac_socket_init(
 
 guac_socket* guac_socket_broadcast(guac_client* client) {
 
-    /* Broadcast to all connected non-pending users*/
-    return __guac_socket_init(client, guac_client_foreach_user);
+    /* Broadcast to all connected non-pending users. Users that fall behind
+     * may skip frames, as they will be resynchronized as pending users. */
+    return __guac_socket_init(client, guac_client_foreach_user, 1);
 
 }
 
 guac_socket* guac_socket_broadcast_pending(guac_client* client) {
 
-    /* Broadcast to all connected pending users*/
-    return __guac_socket_init(client, guac_client_foreach_pending_user);
+    /* Broadcast to all connected pending users. Pending users must receive
+     * everything, as this is how they are synchronized. */
+    return __guac_socket_init(client, guac_client_foreach_pending_user, 0);
 
 }
 
@@ -0,0 +1,82 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_SOCKET_BROADCAST_H
+#define GUAC_SOCKET_BROADCAST_H
+
+/**
+ * Internal functions for restricting the users that receive data written to
+ * broadcast sockets created with guac_socket_broadcast() or
+ * guac_socket_broadcast_pending().
+ *
+ * @file socket-broadcast.h
+ */
+
+#include "guacamole/user-types.h"
+
+/**
+ * Callback which determines whether a particular user should receive data
+ * written to a broadcast socket.
+ *
+ * @param user
+ *     The user that would receive the data.
+ *
+ * @param data
+ *     The arbitrary data associated with the filter.
+ *
+ * @return
+ *     Non-zero if the user should receive the data, zero otherwise.
+ */
+typedef int guac_socket_broadcast_filter_callback(guac_user* user, void* data);
+
+/**
+ * A restriction on the users that receive data written to broadcast sockets.
+ */
+typedef struct guac_socket_broadcast_filter {
+
+    /**
+     * The callback which determines whether each user should receive data.
+     */
+    guac_socket_broadcast_filter_callback* callback;
+
+    /**
+     * Arbitrary data to pass to the callback.
+     */
+    void* data;
+
+} guac_socket_broadcast_filter;
+
+/**
+ * Restricts the users that receive data written to any broadcast socket by
+ * the current thread to those accepted by the given filter, replacing any
+ * previous filter. Data written to broadcast sockets by other threads is not
+ * affected. As broadcast sockets deliver each instruction only once complete,
+ * each user receives all or none of any instruction written while a filter
+ * is in effect. A filter is typically set around the entirety of a stream,
+ * such that each user receives all or none of that stream. Output written to
+ * any other kind of socket, including the other side of a guac_socket_tee()
+ * wrapping a broadcast socket, is not filtered.
+ *
+ * @param filter
+ *     The filter to apply, or NULL to remove any filter. The filter must
+ *     remain valid until it is removed or replaced.
+ */
+void guac_socket_broadcast_set_filter(const guac_socket_broadcast_filter* filter);
+
+#endif
@@ -256,6 +256,17 @@ static ssize_t guac_socket_fd_write_buffered(guac_socket* socket,
         int chunk_size;
         int remaining = sizeof(data->out_buf) - data->written;
 
+        /* Write directly to the file descriptor if the buffer is empty and
+         * would only be filled and flushed again anyway */
+        if (data->written == 0 && count >= sizeof(data->out_buf)) {
+
+            if (guac_socket_fd_write(socket, current, count))
+                return -1;
+
+            break;
+
+        }
+
         /* If no space left in buffer, flush and retry */
         if (remaining == 0) {
 
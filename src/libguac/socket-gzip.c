@@ -0,0 +1,422 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "guacamole/error.h"
+#include "guacamole/mem.h"
+#include "guacamole/socket.h"
+#include "guacamole/timestamp.h"
+#include "socket-gzip.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <zlib.h>
+
+/**
+ * The value to add to the zlib window size to select the gzip format rather
+ * than the raw zlib format, as documented for deflateInit2() and
+ * inflateInit2().
+ */
+#define GUAC_SOCKET_GZIP_WINDOW_BITS (15 + 16)
+
+/**
+ * Data specific to the compressing (gzip) implementation of guac_socket.
+ */
+typedef struct guac_socket_gzip_data {
+
+    /**
+     * The socket that compressed data is written to.
+     */
+    guac_socket* socket;
+
+    /**
+     * The state of the zlib compressor.
+     */
+    z_stream stream;
+
+    /**
+     * Buffer receiving compressed data prior to that data being written to
+     * the underlying socket.
+     */
+    unsigned char out[GUAC_SOCKET_GZIP_BUFFER_SIZE];
+
+    /**
+     * The time that compressed data was last flushed to the underlying
+     * socket.
+     */
+    guac_timestamp last_flush;
+
+} guac_socket_gzip_data;
+
+/**
+ * Data specific to the decompressing (gunzip) implementation of guac_socket.
+ */
+typedef struct guac_socket_gunzip_data {
+
+    /**
+     * The socket that compressed data is read from.
+     */
+    guac_socket* socket;
+
+    /**
+     * The state of the zlib decompressor.
+     */
+    z_stream stream;
+
+    /**
+     * Buffer containing compressed data read from the underlying socket that
+     * has not yet been decompressed.
+     */
+    unsigned char in[GUAC_SOCKET_GZIP_BUFFER_SIZE];
+
+} guac_socket_gunzip_data;
+
+/**
+ * Compresses the given data, writing all compressed output produced to the
+ * underlying socket.
+ *
+ * @param data
+ *     The data associated with the compressing socket.
+ *
+ * @param buf
+ *     The data to compress.
+ *
+ * @param count
+ *     The number of bytes to compress. This must not exceed UINT_MAX.
+ *
+ * @param flush
+ *     The zlib flush mode to use, such as Z_NO_FLUSH, Z_SYNC_FLUSH, or
+ *     Z_FINISH.
+ *
+ * @return
+ *     Zero if the data was compressed and written successfully, non-zero
+ *     otherwise.
+ */
+static int guac_socket_gzip_deflate(guac_socket_gzip_data* data,
+        const void* buf, size_t count, int flush) {
+
+    z_stream* stream = &data->stream;
+    stream->next_in = (Bytef*) buf;
+    stream->avail_in = count;
+
+    for (;;) {
+
+        stream->next_out = data->out;
+        stream->avail_out = sizeof(data->out);
+
+        int result = deflate(stream, flush);
+        if (result == Z_STREAM_ERROR)
+            return 1;
+
+        size_t length = sizeof(data->out) - stream->avail_out;
+        if (length > 0 && guac_socket_write(data->socket, data->out, length))
+            return 1;
+
+        /* Finishing is complete only once the end of the stream is written,
+         * while all other modes are complete once output space remains */
+        if (flush == Z_FINISH) {
+            if (result == Z_STREAM_END)
+                break;
+        }
+        else if (stream->avail_out != 0)
+            break;
+
+    }
+
+    return 0;
+
+}
+
+/**
+ * Callback function which compresses the given data, writing the compressed
+ * result to the underlying socket.
+ *
+ * @param socket
+ *     The compressing socket being written to.
+ *
+ * @param buf
+ *     The buffer of data to write.
+ *
+ * @param count
+ *     The number of bytes in the buffer to be written.
+ *
+ * @return
+ *     The number of bytes written if the write was successful, or -1 if an
+ *     error occurs.
+ */
+static ssize_t guac_socket_gzip_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    guac_socket_gzip_data* data = (guac_socket_gzip_data*) socket->data;
+
+    if (count > UINT_MAX)
+        count = UINT_MAX;
+
+    if (guac_socket_gzip_deflate(data, buf, count, Z_NO_FLUSH)) {
+        guac_error = GUAC_STATUS_IO_ERROR;
+        guac_error_message = "Unable to write compressed data";
+        return -1;
+    }
+
+    return count;
+
+}
+
+/**
+ * Callback function which flushes the underlying socket, first flushing the
+ * compressor if GUAC_SOCKET_GZIP_FLUSH_INTERVAL has elapsed since the
+ * compressor was last flushed.
+ *
+ * @param socket
+ *     The compressing socket being flushed.
+ *
+ * @return
+ *     Zero if the flush succeeded, non-zero otherwise.
+ */
+static ssize_t guac_socket_gzip_flush_handler(guac_socket* socket) {
+
+    guac_socket_gzip_data* data = (guac_socket_gzip_data*) socket->data;
+
+    guac_timestamp now = guac_timestamp_current();
+    if (now - data->last_flush >= GUAC_SOCKET_GZIP_FLUSH_INTERVAL) {
+
+        if (guac_socket_gzip_deflate(data, NULL, 0, Z_SYNC_FLUSH))
+            return 1;
+
+        data->last_flush = now;
+
+    }
+
+    return guac_socket_flush(data->socket);
+
+}
+
+/**
+ * Callback function which delegates the lock operation to the underlying
+ * socket.
+ *
+ * @param socket
+ *     The compressing socket on which guac_socket_instruction_begin() was
+ *     invoked.
+ */
+static void guac_socket_gzip_lock_handler(guac_socket* socket) {
+    guac_socket_gzip_data* data = (guac_socket_gzip_data*) socket->data;
+    guac_socket_instruction_begin(data->socket);
+}
+
+/**
+ * Callback function which delegates the unlock operation to the underlying
+ * socket.
+ *
+ * @param socket
+ *     The compressing socket on which guac_socket_instruction_end() was
+ *     invoked.
+ */
+static void guac_socket_gzip_unlock_handler(guac_socket* socket) {
+    guac_socket_gzip_data* data = (guac_socket_gzip_data*) socket->data;
+    guac_socket_instruction_end(data->socket);
+}
+
+/**
+ * Callback function which finishes the compressed stream and frees the
+ * underlying socket.
+ *
+ * @param socket
+ *     The compressing socket being freed.
+ *
+ * @return
+ *     Zero if the compressed stream was finished successfully, non-zero
+ *     otherwise.
+ */
+static int guac_socket_gzip_free_handler(guac_socket* socket) {
+
+    guac_socket_gzip_data* data = (guac_socket_gzip_data*) socket->data;
+
+    int retval = guac_socket_gzip_deflate(data, NULL, 0, Z_FINISH);
+    deflateEnd(&data->stream);
+
+    guac_socket_free(data->socket);
+    guac_mem_free(data);
+    return retval;
+
+}
+
+guac_socket* guac_socket_gzip(guac_socket* socket, int level) {
+
+    guac_socket_gzip_data* data = guac_mem_zalloc(sizeof(guac_socket_gzip_data));
+
+    if (deflateInit2(&data->stream, level, Z_DEFLATED,
+                GUAC_SOCKET_GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        guac_mem_free(data);
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "Unable to initialize compressor";
+        return NULL;
+    }
+
+    data->socket = socket;
+    data->last_flush = guac_timestamp_current();
+
+    guac_socket* gzip = guac_socket_alloc();
+    gzip->data = data;
+
+    gzip->write_handler  = guac_socket_gzip_write_handler;
+    gzip->flush_handler  = guac_socket_gzip_flush_handler;
+    gzip->lock_handler   = guac_socket_gzip_lock_handler;
+    gzip->unlock_handler = guac_socket_gzip_unlock_handler;
+    gzip->free_handler   = guac_socket_gzip_free_handler;
+
+    return gzip;
+
+}
+
+/**
+ * Callback function which reads and decompresses data from the underlying
+ * socket, blocking until at least one byte of decompressed data is
+ * available or the end of the underlying socket is reached.
+ *
+ * @param socket
+ *     The decompressing socket being read from.
+ *
+ * @param buf
+ *     The buffer to read decompressed data into.
+ *
+ * @param count
+ *     The maximum number of bytes to read into the given buffer.
+ *
+ * @return
+ *     The number of bytes read, zero if the end of the underlying socket has
+ *     been reached, or -1 if an error occurs.
+ */
+static ssize_t guac_socket_gunzip_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    guac_socket_gunzip_data* data = (guac_socket_gunzip_data*) socket->data;
+    z_stream* stream = &data->stream;
+
+    if (count > UINT_MAX)
+        count = UINT_MAX;
+
+    stream->next_out = (Bytef*) buf;
+    stream->avail_out = count;
+
+    while (stream->avail_out == count) {
+
+        /* Read more compressed data if all has been consumed */
+        if (stream->avail_in == 0) {
+
+            ssize_t length = guac_socket_read(data->socket, data->in,
+                    sizeof(data->in));
+
+            if (length <= 0)
+                return length;
+
+            stream->next_in = data->in;
+            stream->avail_in = length;
+
+        }
+
+        int result = inflate(stream, Z_NO_FLUSH);
+
+        /* Continue with any concatenated stream */
+        if (result == Z_STREAM_END)
+            inflateReset(stream);
+
+        else if (result != Z_OK && result != Z_BUF_ERROR) {
+            guac_error = GUAC_STATUS_PROTOCOL_ERROR;
+            guac_error_message = "Compressed data is corrupt";
+            return -1;
+        }
+
+    }
+
+    return count - stream->avail_out;
+
+}
+
+/**
+ * Callback function which waits for compressed data to become available,
+ * returning immediately if compressed data has already been read but not yet
+ * decompressed.
+ *
+ * @param socket
+ *     The decompressing socket to wait for.
+ *
+ * @param usec_timeout
+ *     The maximum amount of time to wait, in microseconds, or -1 to
+ *     potentially wait forever.
+ *
+ * @return
+ *     A positive value if data is available, zero if the timeout elapsed
+ *     and no data is available, or a negative value if an error occurs.
+ */
+static int guac_socket_gunzip_select_handler(guac_socket* socket,
+        int usec_timeout) {
+
+    guac_socket_gunzip_data* data = (guac_socket_gunzip_data*) socket->data;
+
+    if (data->stream.avail_in > 0)
+        return 1;
+
+    return guac_socket_select(data->socket, usec_timeout);
+
+}
+
+/**
+ * Callback function which frees the decompressor and the underlying socket.
+ *
+ * @param socket
+ *     The decompressing socket being freed.
+ *
+ * @return
+ *     Always zero.
+ */
+static int guac_socket_gunzip_free_handler(guac_socket* socket) {
+
+    guac_socket_gunzip_data* data = (guac_socket_gunzip_data*) socket->data;
+
+    inflateEnd(&data->stream);
+
+    guac_socket_free(data->socket);
+    guac_mem_free(data);
+    return 0;
+
+}
+
+guac_socket* guac_socket_gunzip(guac_socket* socket) {
+
+    guac_socket_gunzip_data* data = guac_mem_zalloc(sizeof(guac_socket_gunzip_data));
+
+    if (inflateInit2(&data->stream, GUAC_SOCKET_GZIP_WINDOW_BITS) != Z_OK) {
+        guac_mem_free(data);
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "Unable to initialize decompressor";
+        return NULL;
+    }
+
+    data->socket = socket;
+
+    guac_socket* gunzip = guac_socket_alloc();
+    gunzip->data = data;
+
+    gunzip->read_handler   = guac_socket_gunzip_read_handler;
+    gunzip->select_handler = guac_socket_gunzip_select_handler;
+    gunzip->free_handler   = guac_socket_gunzip_free_handler;
+
+    return gunzip;
+
+}
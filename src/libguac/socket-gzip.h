@@ -0,0 +1,90 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_SOCKET_GZIP_H
+#define GUAC_SOCKET_GZIP_H
+
+/**
+ * Provides guac_socket implementations which transparently compress data
+ * written to, or decompress data read from, another guac_socket using the
+ * gzip format. These implementations are available only if libguac was built
+ * with zlib.
+ *
+ * @file socket-gzip.h
+ */
+
+#include "guacamole/socket.h"
+
+/**
+ * The zlib compression level used for session recordings. Level 1 already
+ * reduces the highly-repetitive base64 image data and drawing instructions
+ * of a recording several fold, while costing far less CPU than the default
+ * level.
+ */
+#define GUAC_SOCKET_GZIP_LEVEL 1
+
+/**
+ * The size of the buffers used to hold compressed data, in bytes.
+ */
+#define GUAC_SOCKET_GZIP_BUFFER_SIZE 65536
+
+/**
+ * The minimum number of milliseconds between flushes of compressed data to
+ * the underlying socket. Flushing the compressor at the end of every frame
+ * would greatly reduce the effectiveness of compression, while never
+ * flushing would leave an in-progress recording unreadable beyond its first
+ * few frames.
+ */
+#define GUAC_SOCKET_GZIP_FLUSH_INTERVAL 1000
+
+/**
+ * Allocates a new guac_socket which compresses all data written to it using
+ * the gzip format, writing the compressed result to the given socket. The
+ * compressed stream is finished and the given socket freed when the returned
+ * socket is freed.
+ *
+ * @param socket
+ *     The socket that compressed data should be written to.
+ *
+ * @param level
+ *     The zlib compression level to use, from 1 (fastest) to 9 (smallest).
+ *
+ * @return
+ *     A newly-allocated guac_socket which compresses all data written to it,
+ *     or NULL if the compressor could not be initialized.
+ */
+guac_socket* guac_socket_gzip(guac_socket* socket, int level);
+
+/**
+ * Allocates a new guac_socket which reads gzip-compressed data from the given
+ * socket, returning the decompressed result. Concatenated gzip streams are
+ * decompressed as a single stream. The given socket is freed when the
+ * returned socket is freed.
+ *
+ * @param socket
+ *     The socket that compressed data should be read from.
+ *
+ * @return
+ *     A newly-allocated guac_socket which decompresses all data read from the
+ *     given socket, or NULL if the decompressor could not be initialized.
+ */
+guac_socket* guac_socket_gunzip(guac_socket* socket);
+
+#endif
+
@@ -0,0 +1,365 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "guacamole/mem.h"
+#include "guacamole/socket.h"
+#include "guacamole/timestamp.h"
+#include "socket-index.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The portion of an instruction that an index socket expects to receive
+ * next.
+ */
+typedef enum guac_socket_index_state {
+
+    /**
+     * The decimal length prefix of an element, up to and including the "."
+     * which separates the length from the element value.
+     */
+    GUAC_SOCKET_INDEX_LENGTH,
+
+    /**
+     * The value of an element, followed by the "," or ";" which terminates
+     * that element.
+     */
+    GUAC_SOCKET_INDEX_VALUE
+
+} guac_socket_index_state;
+
+/**
+ * Data specific to the index implementation of guac_socket.
+ */
+typedef struct guac_socket_index_data {
+
+    /**
+     * The socket receiving the recording itself.
+     */
+    guac_socket* recording;
+
+    /**
+     * The socket receiving the index of the recording.
+     */
+    guac_socket* index;
+
+    /**
+     * The minimum number of milliseconds between indexed frames.
+     */
+    guac_timestamp interval;
+
+    /**
+     * The total number of bytes written to the recording.
+     */
+    int64_t offset;
+
+    /**
+     * The portion of an instruction expected next.
+     */
+    guac_socket_index_state state;
+
+    /**
+     * The length of the element currently being scanned, in Unicode
+     * codepoints, as parsed from its length prefix.
+     */
+    int length;
+
+    /**
+     * The number of codepoints of the current element value that have not
+     * yet been scanned.
+     */
+    int remaining;
+
+    /**
+     * The zero-based index of the element currently being scanned within
+     * its instruction, where element 0 is the opcode.
+     */
+    int element;
+
+    /**
+     * The first GUAC_SOCKET_INDEX_MAX_OPCODE_LENGTH bytes of the opcode of
+     * the current instruction.
+     */
+    char opcode[GUAC_SOCKET_INDEX_MAX_OPCODE_LENGTH];
+
+    /**
+     * The total length of the opcode of the current instruction, in bytes.
+     */
+    int opcode_length;
+
+    /**
+     * The timestamp parsed from the first argument of the current
+     * instruction, if that instruction is a "sync" instruction.
+     */
+    guac_timestamp timestamp;
+
+    /**
+     * The timestamp of the most recently indexed frame, or zero if no frames
+     * have yet been indexed.
+     */
+    guac_timestamp last_indexed;
+
+} guac_socket_index_data;
+
+/**
+ * Returns whether the instruction currently being scanned by the given index
+ * socket is a "sync" instruction.
+ *
+ * @param data
+ *     The data of the index socket scanning the instruction.
+ *
+ * @return
+ *     Non-zero if the current instruction is a "sync" instruction, zero
+ *     otherwise.
+ */
+static int guac_socket_index_is_sync(guac_socket_index_data* data) {
+    return data->opcode_length == 4 && memcmp(data->opcode, "sync", 4) == 0;
+}
+
+/**
+ * Handles the end of the instruction currently being scanned by the given
+ * index socket, writing an index entry if that instruction is a "sync"
+ * instruction and the index interval has elapsed.
+ *
+ * @param data
+ *     The data of the index socket scanning the instruction.
+ */
+static void guac_socket_index_end_instruction(guac_socket_index_data* data) {
+
+    if (data->element >= 1 && guac_socket_index_is_sync(data)
+            && (data->last_indexed == 0
+                || data->timestamp - data->last_indexed >= data->interval)) {
+
+        guac_socket* index = data->index;
+        guac_socket_write_string(index, "sync ");
+        guac_socket_write_int(index, data->timestamp);
+        guac_socket_write_string(index, " ");
+        guac_socket_write_int(index, data->offset);
+        guac_socket_write_string(index, "\n");
+
+        data->last_indexed = data->timestamp;
+
+    }
+
+    data->element = 0;
+    data->opcode_length = 0;
+    data->timestamp = 0;
+
+}
+
+/**
+ * Scans the given data for instruction boundaries, updating the state of the
+ * given index socket and writing index entries as "sync" instructions are
+ * encountered. Instructions may be split across any number of calls.
+ *
+ * @param data
+ *     The data of the index socket receiving the written data.
+ *
+ * @param buf
+ *     The data written.
+ *
+ * @param count
+ *     The number of bytes written.
+ */
+static void guac_socket_index_scan(guac_socket_index_data* data,
+        const unsigned char* buf, size_t count) {
+
+    for (size_t i = 0; i < count; i++) {
+
+        unsigned char c = buf[i];
+        data->offset++;
+
+        if (data->state == GUAC_SOCKET_INDEX_LENGTH) {
+
+            if (c >= '0' && c <= '9')
+                data->length = data->length * 10 + c - '0';
+
+            else if (c == '.') {
+                data->remaining = data->length;
+                data->state = GUAC_SOCKET_INDEX_VALUE;
+            }
+
+            /* Anything else cannot be part of a valid instruction, and is
+             * ignored (the recording itself will be malformed at this point,
+             * and there is no well-defined way to recover) */
+            else
+                data->length = 0;
+
+            continue;
+
+        }
+
+        /* Bytes continuing a multibyte UTF-8 character never begin a new
+         * codepoint */
+        if ((c & 0xC0) == 0x80)
+            continue;
+
+        /* Store the beginning of the opcode and the timestamp of "sync"
+         * instructions while the value of each is scanned */
+        if (data->remaining > 0) {
+
+            if (data->element == 0) {
+                if (data->opcode_length < sizeof(data->opcode))
+                    data->opcode[data->opcode_length] = c;
+                data->opcode_length++;
+            }
+
+            else if (data->element == 1 && guac_socket_index_is_sync(data)
+                    && c >= '0' && c <= '9')
+                data->timestamp = data->timestamp * 10 + c - '0';
+
+            data->remaining--;
+            continue;
+
+        }
+
+        /* The value has been completely scanned, thus this must be the
+         * terminator of the element */
+        data->length = 0;
+        data->state = GUAC_SOCKET_INDEX_LENGTH;
+
+        if (c == ',')
+            data->element++;
+        else if (c == ';')
+            guac_socket_index_end_instruction(data);
+
+    }
+
+}
+
+/**
+ * Callback function which writes the given data to the recording socket,
+ * scanning that data to maintain the index.
+ *
+ * @param socket
+ *     The index socket to write through.
+ *
+ * @param buf
+ *     The buffer of data to write.
+ *
+ * @param count
+ *     The number of bytes in the buffer to be written.
+ *
+ * @return
+ *     The number of bytes written if the write was successful, or -1 if an
+ *     error occurs.
+ */
+static ssize_t guac_socket_index_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    guac_socket_index_data* data = (guac_socket_index_data*) socket->data;
+
+    /* Offsets within the index refer to the recording as written, thus the
+     * data must be written before being scanned */
+    if (guac_socket_write(data->recording, buf, count))
+        return -1;
+
+    guac_socket_index_scan(data, (const unsigned char*) buf, count);
+    return count;
+
+}
+
+/**
+ * Callback function which flushes both the recording and the index.
+ *
+ * @param socket
+ *     The index socket to flush.
+ *
+ * @return
+ *     The value returned by guac_socket_flush() when invoked on the
+ *     recording socket.
+ */
+static ssize_t guac_socket_index_flush_handler(guac_socket* socket) {
+
+    guac_socket_index_data* data = (guac_socket_index_data*) socket->data;
+
+    guac_socket_flush(data->index);
+    return guac_socket_flush(data->recording);
+
+}
+
+/**
+ * Callback function which delegates the lock operation to the recording
+ * socket. As all writes to the index occur while writing to the recording,
+ * this also serializes all writes to the index.
+ *
+ * @param socket
+ *     The index socket on which guac_socket_instruction_begin() was invoked.
+ */
+static void guac_socket_index_lock_handler(guac_socket* socket) {
+    guac_socket_index_data* data = (guac_socket_index_data*) socket->data;
+    guac_socket_instruction_begin(data->recording);
+}
+
+/**
+ * Callback function which delegates the unlock operation to the recording
+ * socket.
+ *
+ * @param socket
+ *     The index socket on which guac_socket_instruction_end() was invoked.
+ */
+static void guac_socket_index_unlock_handler(guac_socket* socket) {
+    guac_socket_index_data* data = (guac_socket_index_data*) socket->data;
+    guac_socket_instruction_end(data->recording);
+}
+
+/**
+ * Callback function which frees all underlying data associated with the
+ * given index socket, including both the recording and index sockets.
+ *
+ * @param socket
+ *     The index socket being freed.
+ *
+ * @return
+ *     Always zero.
+ */
+static int guac_socket_index_free_handler(guac_socket* socket) {
+
+    guac_socket_index_data* data = (guac_socket_index_data*) socket->data;
+
+    guac_socket_free(data->recording);
+    guac_socket_free(data->index);
+
+    guac_mem_free(data);
+    return 0;
+
+}
+
+guac_socket* guac_socket_index(guac_socket* recording, guac_socket* index,
+        guac_timestamp interval) {
+
+    guac_socket_index_data* data = guac_mem_zalloc(sizeof(guac_socket_index_data));
+    data->recording = recording;
+    data->index = index;
+    data->interval = interval;
+    data->state = GUAC_SOCKET_INDEX_LENGTH;
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = data;
+
+    socket->write_handler  = guac_socket_index_write_handler;
+    socket->flush_handler  = guac_socket_index_flush_handler;
+    socket->lock_handler   = guac_socket_index_lock_handler;
+    socket->unlock_handler = guac_socket_index_unlock_handler;
+    socket->free_handler   = guac_socket_index_free_handler;
+
+    return socket;
+
+}
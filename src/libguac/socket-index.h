@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_SOCKET_INDEX_H
+#define GUAC_SOCKET_INDEX_H
+
+/**
+ * Provides a guac_socket implementation which passes all written data
+ * through to a session recording while noting the byte offset of each "sync"
+ * instruction within a separate index.
+ *
+ * @file socket-index.h
+ */
+
+#include "guacamole/socket.h"
+#include "guacamole/timestamp.h"
+
+/**
+ * The maximum number of bytes of the opcode of an instruction that an index
+ * socket will retain while scanning. Only "sync" instructions are of
+ * interest, so longer opcodes need not be stored in their entirety.
+ */
+#define GUAC_SOCKET_INDEX_MAX_OPCODE_LENGTH 8
+
+/**
+ * Allocates a new guac_socket which writes all data written to it to the
+ * given recording socket, scanning that data for instruction boundaries. Each
+ * time a complete "sync" instruction is written and at least the given
+ * interval has elapsed (according to the timestamps within the "sync"
+ * instructions themselves) since the last indexed frame, a line of the form:
+ *
+ *     sync TIMESTAMP OFFSET
+ *
+ * is written to the given index socket, where OFFSET is the number of bytes
+ * written to the recording up to and including that "sync" instruction. See
+ * guac_recording_create() for the overall format of the index.
+ *
+ * All data written to the returned socket must consist of complete Guacamole
+ * instructions written within guac_socket_instruction_begin() and
+ * guac_socket_instruction_end(), as is already required for the recording
+ * itself to be well-formed. Both the recording socket and the index socket
+ * are freed when the returned socket is freed.
+ *
+ * @param recording
+ *     The socket that all data written to the returned socket should be
+ *     written to.
+ *
+ * @param index
+ *     The socket that the index of the recording should be written to.
+ *
+ * @param interval
+ *     The minimum number of milliseconds between indexed frames.
+ *
+ * @return
+ *     A newly-allocated guac_socket which writes all data to the given
+ *     recording socket while writing its index to the given index socket.
+ */
+guac_socket* guac_socket_index(guac_socket* recording, guac_socket* index,
+        guac_timestamp interval);
+
+#endif
+
@@ -0,0 +1,1273 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "guacamole/client-constants.h"
+#include "guacamole/mem.h"
+#include "guacamole/parser-constants.h"
+#include "guacamole/error.h"
+#include "guacamole/proctitle.h"
+#include "guacamole/socket.h"
+#include "socket-queue.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The number of distinct stream indices that a queue socket tracks. Streams
+ * allocated by the client have odd indices and streams allocated by
+ * individual users have even indices, each drawn from a pool of
+ * GUAC_CLIENT_MAX_STREAMS.
+ */
+#define GUAC_SOCKET_QUEUE_MAX_STREAMS (GUAC_CLIENT_MAX_STREAMS * 2)
+
+/**
+ * The type of instruction associated with a particular opcode.
+ */
+typedef struct guac_socket_queue_opcode_mapping {
+
+    /**
+     * The opcode of the instruction.
+     */
+    const char* opcode;
+
+    /**
+     * The type of all instructions having the opcode.
+     */
+    guac_socket_queue_instruction_type type;
+
+} guac_socket_queue_opcode_mapping;
+
+/**
+ * The types of all instructions that a queue socket treats specially when
+ * the recipient has fallen behind. Instructions having any other opcode are
+ * of type GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER and are never dropped.
+ *
+ * Instructions that only draw to a layer may be dropped while skipping
+ * frames, as the affected layers are redrawn in their entirety when the
+ * recipient is resynchronized. Instructions that build a path are dropped
+ * along with the instructions that consume that path, such that a partial
+ * path is never left behind.
+ */
+static const guac_socket_queue_opcode_mapping GUAC_SOCKET_QUEUE_OPCODE_TYPES[] = {
+    { "arc",      GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "argv",     GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN },
+    { "audio",    GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN },
+    { "blob",     GUAC_SOCKET_QUEUE_INSTRUCTION_BLOB },
+    { "cfill",    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "clip",     GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "close",    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "copy",     GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "cstroke",  GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "curve",    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "end",      GUAC_SOCKET_QUEUE_INSTRUCTION_END  },
+    { "file",     GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN },
+    { "img",      GUAC_SOCKET_QUEUE_INSTRUCTION_IMG  },
+    { "lfill",    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "line",     GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "lstroke",  GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "pipe",     GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN },
+    { "rect",     GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "start",    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "sync",     GUAC_SOCKET_QUEUE_INSTRUCTION_SYNC },
+    { "transfer", GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW },
+    { "video",    GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN },
+    { NULL,       GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER }
+};
+
+/**
+ * The states that a queue socket may be in with respect to skippable
+ * instructions.
+ */
+typedef enum guac_socket_queue_state {
+
+    /**
+     * All instructions are being queued. This is the normal state of a queue
+     * socket.
+     */
+    GUAC_SOCKET_QUEUE_SENDING,
+
+    /**
+     * The recipient has fallen too far behind. Skippable instructions are
+     * being dropped while the frames already queued are transmitted.
+     */
+    GUAC_SOCKET_QUEUE_SKIPPING,
+
+    /**
+     * The queued frames have been transmitted, and the recipient now needs to
+     * be resynchronized via guac_socket_queue_resync(). Skippable
+     * instructions continue to be dropped until that happens.
+     */
+    GUAC_SOCKET_QUEUE_RESYNC
+
+} guac_socket_queue_state;
+
+/**
+ * A growable buffer of bytes awaiting transmission.
+ */
+typedef struct guac_socket_queue_buffer {
+
+    /**
+     * The contents of this buffer, or NULL if no space has yet been
+     * allocated.
+     */
+    char* data;
+
+    /**
+     * The number of bytes currently stored within this buffer.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for this buffer.
+     */
+    size_t capacity;
+
+} guac_socket_queue_buffer;
+
+/**
+ * Data associated with an open socket which queues all written data for
+ * transmission along another socket by a dedicated writer thread.
+ */
+typedef struct guac_socket_queue_data {
+
+    /**
+     * The socket that all queued data is ultimately written to.
+     */
+    guac_socket* socket;
+
+    /**
+     * Lock which is acquired when an instruction is being written, and
+     * released when the instruction is finished being written.
+     */
+    pthread_mutex_t socket_lock;
+
+    /**
+     * Lock which guards all members of this structure that are not
+     * documented otherwise.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled whenever data is added to the queue, a
+     * flush is requested, or the writer thread is being stopped.
+     */
+    pthread_cond_t modified;
+
+    /**
+     * The instruction currently being written by the thread holding
+     * socket_lock. This instruction is moved to the end of the queue once
+     * fully written.
+     */
+    guac_socket_queue_buffer instruction;
+
+    /**
+     * All data that has been queued but not yet taken by the writer thread.
+     */
+    guac_socket_queue_buffer pending;
+
+    /**
+     * The data most recently taken by the writer thread. This buffer is
+     * accessed only by the writer thread and is not guarded by the lock.
+     */
+    guac_socket_queue_buffer sending;
+
+    /**
+     * The number of bytes taken by the writer thread that have not yet been
+     * fully written to the underlying socket.
+     */
+    size_t in_flight;
+
+    /**
+     * Non-zero if the underlying socket should be flushed once all currently
+     * queued data has been written, zero otherwise.
+     */
+    int flush_requested;
+
+    /**
+     * Whether skippable instructions are currently being queued or dropped.
+     */
+    guac_socket_queue_state state;
+
+    /**
+     * Non-zero if the recipient is currently being resynchronized, having
+     * skipped frames, zero otherwise. While resynchronizing, instructions
+     * opening streams that the recipient already has open are dropped.
+     */
+    int resyncing;
+
+    /**
+     * Bitmap of the indices of all streams opened by an instruction of type
+     * GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN which have not yet been closed by an
+     * "end" instruction.
+     */
+    unsigned char open_streams[GUAC_SOCKET_QUEUE_MAX_STREAMS / 8];
+
+    /**
+     * Bitmap of the indices of all image streams whose "img" instruction was
+     * dropped while skipping frames, and whose "blob" and "end" instructions
+     * must therefore also be dropped.
+     */
+    unsigned char skipped_streams[GUAC_SOCKET_QUEUE_MAX_STREAMS / 8];
+
+    /**
+     * Non-zero if writing to the underlying socket has failed, or if more
+     * than GUAC_SOCKET_QUEUE_MAX_LENGTH bytes would have awaited
+     * transmission. Once set, all further writes fail and all queued data is
+     * discarded.
+     */
+    int failed;
+
+    /**
+     * Non-zero if the writer thread should stop once all queued data has
+     * been written, zero otherwise.
+     */
+    int stopping;
+
+    /**
+     * The maximum number of bytes that may await transmission before further
+     * instructions are blocked, or zero if the queue is unbounded.
+     */
+    size_t capacity;
+
+    /**
+     * Condition which is signalled whenever the writer thread finishes
+     * writing a batch of queued data or the queue socket fails, allowing any
+     * instructions blocked by the capacity of the queue to proceed, and
+     * allowing the queue socket to be freed once drained.
+     */
+    pthread_cond_t drained;
+
+    /**
+     * Non-zero if the underlying socket should be freed when the queue
+     * socket is freed, zero otherwise.
+     */
+    int owns_socket;
+
+    /**
+     * The name to assign to the writer thread.
+     */
+    const char* thread_name;
+
+    /**
+     * The thread which writes all queued data to the underlying socket.
+     */
+    pthread_t writer;
+
+} guac_socket_queue_data;
+
+/**
+ * Appends the given bytes to the end of the given buffer, growing the buffer
+ * as necessary.
+ *
+ * @param buffer
+ *     The buffer to append to.
+ *
+ * @param buf
+ *     The bytes to append.
+ *
+ * @param count
+ *     The number of bytes to append.
+ */
+static void guac_socket_queue_buffer_append(guac_socket_queue_buffer* buffer,
+        const void* buf, size_t count) {
+
+    size_t required = guac_mem_ckd_add_or_die(buffer->length, count);
+
+    /* Grow geometrically such that appending is amortized constant time */
+    if (required > buffer->capacity) {
+
+        size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+        while (capacity < required)
+            capacity = guac_mem_ckd_mul_or_die(capacity, 2);
+
+        buffer->data = guac_mem_realloc_or_die(buffer->data, capacity);
+        buffer->capacity = capacity;
+
+    }
+
+    memcpy(buffer->data + buffer->length, buf, count);
+    buffer->length = required;
+
+}
+
+/**
+ * Skips the given number of UTF-8 characters, returning a pointer to the
+ * first byte following those characters. Characters are not decoded
+ * individually. As every character occupies at least one byte, the given
+ * number of bytes is skipped first, followed by one further byte for each
+ * continuation byte skipped, until no further continuation bytes are
+ * encountered. For element values which are entirely ASCII, such as base64
+ * data, this is a single pass over the value.
+ *
+ * @param current
+ *     The first byte of the characters to skip.
+ *
+ * @param end
+ *     The first byte beyond the end of the available data.
+ *
+ * @param length
+ *     The number of characters to skip.
+ *
+ * @return
+ *     A pointer to the first byte following the skipped characters, or NULL
+ *     if the available data ends first.
+ */
+static const char* guac_socket_queue_skip_chars(const char* current,
+        const char* end, size_t length) {
+
+    size_t remaining = length;
+    while (remaining > 0) {
+
+        if (remaining > (size_t) (end - current))
+            return NULL;
+
+        const char* next = current + remaining;
+
+        remaining = 0;
+        for (; current < next; current++) {
+            if ((*current & 0xC0) == 0x80)
+                remaining++;
+        }
+
+    }
+
+    /* Include any continuation bytes of the final character */
+    while (current < end && (*current & 0xC0) == 0x80)
+        current++;
+
+    return current;
+
+}
+
+/**
+ * Parses the element of a Guacamole instruction which begins at the given
+ * byte, storing the location of its value.
+ *
+ * @param current
+ *     The first byte of the element (the first digit of its length prefix).
+ *
+ * @param end
+ *     The first byte beyond the end of the available data.
+ *
+ * @param value
+ *     Receives a pointer to the first byte of the value of the element.
+ *
+ * @param length
+ *     Receives the length of the value of the element, in characters.
+ *
+ * @return
+ *     A pointer to the terminator of the element (either a comma or a
+ *     semicolon), or NULL if the data does not begin with a complete,
+ *     well-formed element.
+ */
+static const char* guac_socket_queue_parse_element(const char* current,
+        const char* end, const char** value, size_t* length) {
+
+    /* Read element length, in characters */
+    *length = 0;
+    int digits = 0;
+    while (current < end && *current >= '0' && *current <= '9') {
+        if (++digits > GUAC_INSTRUCTION_MAX_DIGITS)
+            return NULL;
+        *length = *length * 10 + (*current - '0');
+        current++;
+    }
+
+    if (current == end || *(current++) != '.')
+        return NULL;
+
+    *value = current;
+    current = guac_socket_queue_skip_chars(current, end, *length);
+
+    /* Element must be terminated */
+    if (current == NULL || current == end
+            || (*current != ',' && *current != ';'))
+        return NULL;
+
+    return current;
+
+}
+
+/**
+ * Returns the type of all instructions having the given opcode.
+ *
+ * @param opcode
+ *     The opcode of the instruction. This need not be null-terminated.
+ *
+ * @param length
+ *     The length of the opcode, in bytes.
+ *
+ * @return
+ *     The type of all instructions having the given opcode.
+ */
+static guac_socket_queue_instruction_type guac_socket_queue_opcode_type(
+        const char* opcode, size_t length) {
+
+    const guac_socket_queue_opcode_mapping* mapping;
+    for (mapping = GUAC_SOCKET_QUEUE_OPCODE_TYPES; mapping->opcode != NULL;
+            mapping++) {
+        if (strlen(mapping->opcode) == length
+                && memcmp(mapping->opcode, opcode, length) == 0)
+            break;
+    }
+
+    return mapping->type;
+
+}
+
+/**
+ * Parses the opcode and, if relevant to the type of instruction, the leading
+ * stream index of the Guacamole instruction at the start of the given
+ * buffer. Only the opcode and the first argument are parsed. The data and
+ * length of the instruction are not modified.
+ *
+ * @param buf
+ *     The buffer containing the instruction.
+ *
+ * @param count
+ *     The number of bytes in the buffer.
+ *
+ * @param instruction
+ *     The structure that should receive the type and stream index of the
+ *     instruction.
+ *
+ * @return
+ *     A pointer to the terminator of the last element parsed, or NULL if the
+ *     buffer does not begin with a well-formed instruction.
+ */
+static const char* guac_socket_queue_parse_head(const char* buf, size_t count,
+        guac_socket_queue_instruction* instruction) {
+
+    const char* end = buf + count;
+    const char* value;
+    size_t length;
+
+    instruction->type = GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER;
+    instruction->stream = -1;
+
+    const char* current = guac_socket_queue_parse_element(buf, end,
+            &value, &length);
+    if (current == NULL)
+        return NULL;
+
+    instruction->type = guac_socket_queue_opcode_type(value, current - value);
+
+    /* Only instructions involving streams require further parsing */
+    if (instruction->type == GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER
+            || instruction->type == GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW
+            || instruction->type == GUAC_SOCKET_QUEUE_INSTRUCTION_SYNC
+            || *current == ';')
+        return current;
+
+    current = guac_socket_queue_parse_element(current + 1, end,
+            &value, &length);
+    if (current == NULL)
+        return NULL;
+
+    /* The first argument is the stream index */
+    if (length > 0 && length <= 4) {
+        int stream = 0;
+        for (const char* digit = value; digit < current; digit++) {
+            if (*digit < '0' || *digit > '9')
+                return current;
+            stream = stream * 10 + (*digit - '0');
+        }
+        if (stream < GUAC_SOCKET_QUEUE_MAX_STREAMS)
+            instruction->stream = stream;
+    }
+
+    return current;
+
+}
+
+void guac_socket_queue_instruction_init(
+        guac_socket_queue_instruction* instruction,
+        const void* buf, size_t count) {
+
+    instruction->data = buf;
+    instruction->length = count;
+    guac_socket_queue_parse_head(buf, count, instruction);
+
+}
+
+/**
+ * Parses the Guacamole instruction at the start of the given buffer, which
+ * may contain any number of instructions, locating the end of that
+ * instruction. Elements beyond the first argument are skipped using their
+ * length prefixes.
+ *
+ * @param buf
+ *     The buffer containing the instruction.
+ *
+ * @param count
+ *     The number of bytes in the buffer.
+ *
+ * @param instruction
+ *     The structure that should receive the parsed instruction.
+ *
+ * @return
+ *     Zero if a complete instruction was parsed, non-zero if the buffer does
+ *     not begin with a complete, well-formed instruction.
+ */
+static int guac_socket_queue_parse_instruction(const char* buf, size_t count,
+        guac_socket_queue_instruction* instruction) {
+
+    const char* end = buf + count;
+    const char* value;
+    size_t length;
+
+    const char* current = guac_socket_queue_parse_head(buf, count,
+            instruction);
+
+    while (current != NULL && *current == ',')
+        current = guac_socket_queue_parse_element(current + 1, end,
+                &value, &length);
+
+    if (current == NULL)
+        return 1;
+
+    instruction->data = buf;
+    instruction->length = current + 1 - buf;
+    return 0;
+
+}
+
+/**
+ * Returns whether the bit corresponding to the given stream index is set
+ * within the given bitmap.
+ */
+static int guac_socket_queue_stream_test(const unsigned char* bitmap,
+        int stream) {
+    return bitmap[stream / 8] & (1 << (stream % 8));
+}
+
+/**
+ * Sets the bit corresponding to the given stream index within the given
+ * bitmap.
+ */
+static void guac_socket_queue_stream_set(unsigned char* bitmap, int stream) {
+    bitmap[stream / 8] |= 1 << (stream % 8);
+}
+
+/**
+ * Clears the bit corresponding to the given stream index within the given
+ * bitmap.
+ */
+static void guac_socket_queue_stream_clear(unsigned char* bitmap,
+        int stream) {
+    bitmap[stream / 8] &= ~(1 << (stream % 8));
+}
+
+/**
+ * Returns the total number of bytes which have been queued for the given
+ * queue socket but have not yet been written to the underlying socket. The
+ * lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ *
+ * @return
+ *     The total number of bytes awaiting transmission.
+ */
+static size_t guac_socket_queue_length(guac_socket_queue_data* data) {
+    return data->pending.length + data->in_flight;
+}
+
+/**
+ * Waits until the given bounded queue socket has room for further data,
+ * returning immediately if the queue is unbounded, has failed, or is being
+ * freed. The lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ */
+static void guac_socket_queue_wait_capacity(guac_socket_queue_data* data) {
+
+    if (data->capacity == 0)
+        return;
+
+    while (guac_socket_queue_length(data) >= data->capacity
+            && !data->failed && !data->stopping)
+        pthread_cond_wait(&data->drained, &data->lock);
+
+}
+
+/**
+ * Returns whether the given instruction should be dropped rather than
+ * queued, updating the streams and skipping state tracked for the recipient
+ * accordingly. Only instructions that draw to layers (and the remainder of
+ * any image stream whose "img" was dropped) are dropped while skipping
+ * frames, along with frame boundaries, such that any other instructions are
+ * applied together with the state sent during resynchronization. While
+ * resynchronizing, instructions that would open a stream that the recipient
+ * already has open are dropped. The lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ *
+ * @param instruction
+ *     The instruction being queued.
+ *
+ * @param skippable
+ *     Non-zero if the instruction may be dropped while the recipient is
+ *     skipping frames, zero otherwise.
+ *
+ * @return
+ *     Non-zero if the instruction should be dropped, zero if the instruction
+ *     should be queued.
+ */
+static int guac_socket_queue_should_drop(guac_socket_queue_data* data,
+        const guac_socket_queue_instruction* instruction, int skippable) {
+
+    int stream = instruction->stream;
+
+    switch (instruction->type) {
+
+        /* Drop the remainder of any image stream that was dropped */
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_BLOB:
+            return stream != -1
+                && guac_socket_queue_stream_test(data->skipped_streams, stream);
+
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_END:
+
+            if (stream == -1)
+                return 0;
+
+            if (guac_socket_queue_stream_test(data->skipped_streams, stream)) {
+                guac_socket_queue_stream_clear(data->skipped_streams, stream);
+                return 1;
+            }
+
+            guac_socket_queue_stream_clear(data->open_streams, stream);
+            return 0;
+
+        /* The recipient must not receive a second copy of any stream that
+         * remained open while it was skipping frames */
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN:
+
+            if (stream == -1)
+                return 0;
+
+            if (data->resyncing
+                    && guac_socket_queue_stream_test(data->open_streams, stream))
+                return 1;
+
+            guac_socket_queue_stream_set(data->open_streams, stream);
+            return 0;
+
+        /* Drop drawing instructions and frame boundaries that the recipient
+         * will receive again when resynchronized */
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_IMG:
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW:
+        case GUAC_SOCKET_QUEUE_INSTRUCTION_SYNC:
+
+            if (!skippable)
+                return 0;
+
+            if (data->state != GUAC_SOCKET_QUEUE_SENDING) {
+                if (instruction->type == GUAC_SOCKET_QUEUE_INSTRUCTION_IMG
+                        && stream != -1)
+                    guac_socket_queue_stream_set(data->skipped_streams, stream);
+                return 1;
+            }
+
+            /* Begin skipping frames once a complete frame has been queued
+             * while the recipient is too far behind */
+            if (instruction->type == GUAC_SOCKET_QUEUE_INSTRUCTION_SYNC
+                    && guac_socket_queue_length(data) > GUAC_SOCKET_QUEUE_HIGH_WATER_MARK)
+                data->state = GUAC_SOCKET_QUEUE_SKIPPING;
+
+            return 0;
+
+        /* All other instructions are always sent */
+        default:
+            return 0;
+
+    }
+
+}
+
+/**
+ * Marks the given queue socket as failed, discarding all queued data. All
+ * further writes to the queue socket will fail. The lock of the queue socket
+ * must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ */
+static void guac_socket_queue_fail(guac_socket_queue_data* data) {
+    data->failed = 1;
+    data->pending.length = 0;
+    pthread_cond_broadcast(&data->drained);
+    pthread_cond_signal(&data->modified);
+}
+
+/**
+ * Adds the given instruction to the end of the queue, waking the writer
+ * thread. Unless the queue is bounded, the instruction is first checked with
+ * guac_socket_queue_should_drop() and dropped if appropriate, and the queue
+ * socket fails if the instruction would exceed GUAC_SOCKET_QUEUE_MAX_LENGTH.
+ * If the queue is bounded and full, this function first blocks until the
+ * writer thread has made room. The lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ *
+ * @param instruction
+ *     The instruction to queue.
+ *
+ * @param skippable
+ *     Non-zero if the instruction may be dropped while the recipient is
+ *     skipping frames, zero otherwise.
+ *
+ * @return
+ *     Zero if the instruction was queued or dropped, non-zero if the queue
+ *     socket has failed, in which case guac_error will be set appropriately.
+ */
+static int guac_socket_queue_enqueue(guac_socket_queue_data* data,
+        const guac_socket_queue_instruction* instruction, int skippable) {
+
+    guac_socket_queue_wait_capacity(data);
+
+    if (data->failed) {
+        guac_error = GUAC_STATUS_CLOSED;
+        guac_error_message = "Queued socket has been closed due to an error";
+        return 1;
+    }
+
+    /* Bounded queues apply backpressure instead of skipping */
+    if (data->capacity == 0) {
+
+        if (guac_socket_queue_should_drop(data, instruction, skippable))
+            return 0;
+
+        /* Give up on recipients that cannot keep up even with the
+         * instructions that are never skipped */
+        if (guac_socket_queue_length(data) + instruction->length
+                > GUAC_SOCKET_QUEUE_MAX_LENGTH) {
+            guac_socket_queue_fail(data);
+            guac_error = GUAC_STATUS_NO_SPACE;
+            guac_error_message = "Too much output is queued for recipient";
+            return 1;
+        }
+
+    }
+
+    guac_socket_queue_buffer_append(&data->pending, instruction->data,
+            instruction->length);
+    pthread_cond_signal(&data->modified);
+
+    return 0;
+
+}
+
+/**
+ * Moves any partially- or fully-written instructions to the end of the
+ * queue, waking the writer thread. Each complete instruction is queued
+ * individually with guac_socket_queue_enqueue(), while any data which cannot
+ * be parsed as instructions is queued as-is. If the queue is bounded and
+ * full, this function first blocks until the writer thread has made room.
+ * The lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ */
+static void guac_socket_queue_commit(guac_socket_queue_data* data) {
+
+    const char* buf = data->instruction.data;
+    size_t count = data->instruction.length;
+
+    while (count > 0) {
+
+        guac_socket_queue_instruction instruction;
+        if (data->capacity != 0
+                || guac_socket_queue_parse_instruction(buf, count, &instruction)) {
+            instruction.data = buf;
+            instruction.length = count;
+            instruction.type = GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER;
+            instruction.stream = -1;
+        }
+
+        if (guac_socket_queue_enqueue(data, &instruction, 0))
+            break;
+
+        buf += instruction.length;
+        count -= instruction.length;
+
+    }
+
+    data->instruction.length = 0;
+
+}
+
+/**
+ * Thread which writes all data queued for a queue socket to the underlying
+ * socket, taking all data that has accumulated since the previous write as a
+ * single batch.
+ *
+ * @param arg
+ *     The queue socket whose queued data should be written.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guac_socket_queue_writer_thread(void* arg) {
+
+    guac_socket* socket = (guac_socket*) arg;
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    guac_thread_name_set(data->thread_name);
+
+    pthread_mutex_lock(&data->lock);
+
+    for (;;) {
+
+        /* Wait for something to do */
+        while (data->pending.length == 0 && !data->flush_requested
+                && !data->stopping)
+            pthread_cond_wait(&data->modified, &data->lock);
+
+        if (data->pending.length == 0 && !data->flush_requested)
+            break;
+
+        /* Take everything queued so far, leaving an empty buffer in its
+         * place for further writes */
+        guac_socket_queue_buffer batch = data->pending;
+        data->pending = data->sending;
+        data->sending = batch;
+
+        data->in_flight = batch.length;
+
+        int flush = data->flush_requested;
+        data->flush_requested = 0;
+
+        pthread_mutex_unlock(&data->lock);
+
+        /* Write batch without blocking further writes to the queue */
+        int failed = guac_socket_write(data->socket, batch.data, batch.length)
+            || (flush && guac_socket_flush(data->socket));
+
+        /* Release memory used only for bursts of output */
+        data->sending.length = 0;
+        if (data->sending.capacity > GUAC_SOCKET_QUEUE_RETAINED_CAPACITY) {
+            guac_mem_free(data->sending.data);
+            data->sending.capacity = 0;
+        }
+
+        pthread_mutex_lock(&data->lock);
+
+        data->in_flight = 0;
+        pthread_cond_broadcast(&data->drained);
+
+        /* Further writes are pointless if the connection has failed */
+        if (failed) {
+            guac_socket_queue_fail(data);
+            break;
+        }
+
+        /* The recipient has caught up with all frames that were queued
+         * before skipping began and may now be resynchronized */
+        if (data->state == GUAC_SOCKET_QUEUE_SKIPPING
+                && guac_socket_queue_length(data) <= GUAC_SOCKET_QUEUE_LOW_WATER_MARK)
+            data->state = GUAC_SOCKET_QUEUE_RESYNC;
+
+    }
+
+    pthread_mutex_unlock(&data->lock);
+    return NULL;
+
+}
+
+/**
+ * Callback which handles read requests on the queue socket, passing the read
+ * through directly to the underlying socket.
+ *
+ * @param socket
+ *     The queue socket to read from.
+ *
+ * @param buf
+ *     The buffer into which data should be read.
+ *
+ * @param count
+ *     The number of bytes to attempt to read.
+ *
+ * @return
+ *     The number of bytes read, or -1 if an error occurs.
+ */
+static ssize_t guac_socket_queue_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+    return guac_socket_read(data->socket, buf, count);
+
+}
+
+/**
+ * Callback which handles select operations on the queue socket, passing the
+ * operation through directly to the underlying socket.
+ *
+ * @param socket
+ *     The queue socket to wait for.
+ *
+ * @param usec_timeout
+ *     The maximum amount of time to wait for data, in microseconds, or -1 to
+ *     potentially wait forever.
+ *
+ * @return
+ *     A positive value on success, zero if the timeout elapsed and no data is
+ *     available, or a negative value if an error occurs.
+ */
+static int guac_socket_queue_select_handler(guac_socket* socket,
+        int usec_timeout) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+    return guac_socket_select(data->socket, usec_timeout);
+
+}
+
+/**
+ * Callback which handles write requests on the queue socket. Written data is
+ * appended to the instruction currently being written, which is queued in
+ * its entirety once complete.
+ *
+ * @param socket
+ *     The queue socket to write to.
+ *
+ * @param buf
+ *     The buffer containing the data to write.
+ *
+ * @param count
+ *     The number of bytes to attempt to write from the given buffer.
+ *
+ * @return
+ *     The number of bytes written, or -1 if writing to the underlying socket
+ *     has failed.
+ */
+static ssize_t guac_socket_queue_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+
+    if (data->failed) {
+        pthread_mutex_unlock(&data->lock);
+        guac_error = GUAC_STATUS_CLOSED;
+        guac_error_message = "Queued socket has been closed due to an error";
+        return -1;
+    }
+
+    guac_socket_queue_buffer_append(&data->instruction, buf, count);
+
+    pthread_mutex_unlock(&data->lock);
+    return count;
+
+}
+
+/**
+ * Callback which handles flush requests on the queue socket. The underlying
+ * socket is flushed by the writer thread once all data written so far has
+ * been transmitted. This function does not block.
+ *
+ * @param socket
+ *     The queue socket to flush.
+ *
+ * @return
+ *     Zero if the flush was requested successfully, non-zero if writing to
+ *     the underlying socket has failed.
+ */
+static ssize_t guac_socket_queue_flush_handler(guac_socket* socket) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+
+    /* Queue any data that was written outside an instruction */
+    guac_socket_queue_commit(data);
+
+    data->flush_requested = 1;
+    pthread_cond_signal(&data->modified);
+
+    int retval = data->failed;
+
+    pthread_mutex_unlock(&data->lock);
+    return retval;
+
+}
+
+/**
+ * Socket lock handler which acquires exclusive access to the queue socket in
+ * preparation for the beginning of a new Guacamole instruction.
+ *
+ * @param socket
+ *     The queue socket to lock.
+ */
+static void guac_socket_queue_lock_handler(guac_socket* socket) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    /* Acquire exclusive access to socket */
+    pthread_mutex_lock(&(data->socket_lock));
+
+}
+
+/**
+ * Socket unlock handler which queues the instruction that has just finished
+ * being written and relinquishes exclusive access to the queue socket.
+ *
+ * @param socket
+ *     The queue socket to unlock.
+ */
+static void guac_socket_queue_unlock_handler(guac_socket* socket) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+    guac_socket_queue_commit(data);
+    pthread_mutex_unlock(&data->lock);
+
+    /* Relinquish exclusive access to socket */
+    pthread_mutex_unlock(&(data->socket_lock));
+
+}
+
+/**
+ * Waits up to GUAC_SOCKET_QUEUE_FREE_TIMEOUT milliseconds for all data
+ * queued for the given queue socket to be written, and then discards any
+ * data that remains. The lock of the queue socket must be held.
+ *
+ * @param data
+ *     The data associated with the queue socket.
+ */
+static void guac_socket_queue_drain_or_discard(guac_socket_queue_data* data) {
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    uint64_t nsec = (uint64_t) GUAC_SOCKET_QUEUE_FREE_TIMEOUT * 1000000
+        + deadline.tv_nsec;
+    deadline.tv_sec += nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+
+    while (guac_socket_queue_length(data) > 0 && !data->failed) {
+        if (pthread_cond_timedwait(&data->drained, &data->lock, &deadline))
+            break;
+    }
+
+    data->pending.length = 0;
+
+}
+
+/**
+ * Frees all implementation-specific data associated with the given socket.
+ * Bounded queue sockets first wait for all queued data to be written, while
+ * other queue sockets wait only up to GUAC_SOCKET_QUEUE_FREE_TIMEOUT
+ * milliseconds, discarding anything not yet taken by the writer thread, such
+ * that a recipient which has stopped reading cannot hold up its removal. The
+ * underlying socket is freed only if owned by the queue socket.
+ *
+ * @param socket
+ *     The guac_socket whose associated data should be freed.
+ *
+ * @return
+ *     Zero if the data was successfully freed, non-zero otherwise. This
+ *     implementation always succeeds, and will always return zero.
+ */
+static int guac_socket_queue_free_handler(guac_socket* socket) {
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    /* Wait for writer to finish with all queued data, giving up on
+     * recipients that are not reading */
+    pthread_mutex_lock(&data->lock);
+    guac_socket_queue_commit(data);
+
+    if (data->capacity == 0)
+        guac_socket_queue_drain_or_discard(data);
+
+    data->stopping = 1;
+    pthread_cond_signal(&data->modified);
+    pthread_mutex_unlock(&data->lock);
+
+    pthread_join(data->writer, NULL);
+
+    if (data->owns_socket)
+        guac_socket_free(data->socket);
+
+    guac_mem_free(data->instruction.data);
+    guac_mem_free(data->pending.data);
+    guac_mem_free(data->sending.data);
+
+    pthread_cond_destroy(&data->drained);
+    pthread_cond_destroy(&data->modified);
+    pthread_mutex_destroy(&data->lock);
+    pthread_mutex_destroy(&data->socket_lock);
+
+    guac_mem_free(data);
+    return 0;
+
+}
+
+/**
+ * Allocates a new queue socket which writes all queued data to the given
+ * socket using a dedicated writer thread.
+ *
+ * @param socket
+ *     The socket that all queued data should be written to.
+ *
+ * @param capacity
+ *     The maximum number of bytes that may await transmission before further
+ *     instructions are blocked, or zero if the queue should be unbounded.
+ *
+ * @param owns_socket
+ *     Non-zero if the given socket should be freed when the queue socket is
+ *     freed, zero otherwise.
+ *
+ * @param thread_name
+ *     The name to assign to the writer thread.
+ *
+ * @return
+ *     A newly-allocated queue socket.
+ */
+static guac_socket* guac_socket_queue_alloc(guac_socket* socket,
+        size_t capacity, int owns_socket, const char* thread_name) {
+
+    /* Allocate socket and associated data */
+    guac_socket* queue = guac_socket_alloc();
+    guac_socket_queue_data* data = guac_mem_zalloc(sizeof(guac_socket_queue_data));
+
+    data->socket = socket;
+    data->state = GUAC_SOCKET_QUEUE_SENDING;
+    data->capacity = capacity;
+    data->owns_socket = owns_socket;
+    data->thread_name = thread_name;
+    queue->data = data;
+
+    pthread_mutex_init(&data->socket_lock, NULL);
+    pthread_mutex_init(&data->lock, NULL);
+    pthread_cond_init(&data->modified, NULL);
+    /* Deadlines for draining the queue are measured with the monotonic
+     * clock */
+    pthread_condattr_t drained_attr;
+    pthread_condattr_init(&drained_attr);
+    pthread_condattr_setclock(&drained_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&data->drained, &drained_attr);
+    pthread_condattr_destroy(&drained_attr);
+
+    /* Set read/write handlers */
+    queue->read_handler   = guac_socket_queue_read_handler;
+    queue->write_handler  = guac_socket_queue_write_handler;
+    queue->select_handler = guac_socket_queue_select_handler;
+    queue->flush_handler  = guac_socket_queue_flush_handler;
+    queue->lock_handler   = guac_socket_queue_lock_handler;
+    queue->unlock_handler = guac_socket_queue_unlock_handler;
+    queue->free_handler   = guac_socket_queue_free_handler;
+
+    pthread_create(&data->writer, NULL, guac_socket_queue_writer_thread, queue);
+
+    return queue;
+
+}
+
+guac_socket* guac_socket_queue(guac_socket* socket) {
+
+    /* Thread name user-output: writes all output queued for a single user
+     * to that user's connection. */
+    return guac_socket_queue_alloc(socket, 0, 0, "user-output");
+
+}
+
+guac_socket* guac_socket_queue_bounded(guac_socket* socket, size_t capacity) {
+
+    /* Thread name recording-output: writes all output queued for a session
+     * recording to storage. */
+    return guac_socket_queue_alloc(socket, capacity, 1, "recording-output");
+
+}
+
+int guac_socket_queue_write_parsed_instruction(guac_socket* socket,
+        const guac_socket_queue_instruction* instruction, int skippable) {
+
+    /* Write normally if not a queue socket */
+    if (socket->free_handler != guac_socket_queue_free_handler) {
+        guac_socket_instruction_begin(socket);
+        int retval = guac_socket_write(socket, instruction->data,
+                instruction->length);
+        guac_socket_instruction_end(socket);
+        return retval;
+    }
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+    int retval = guac_socket_queue_enqueue(data, instruction, skippable);
+
+    pthread_mutex_unlock(&data->lock);
+    return retval;
+
+}
+
+int guac_socket_queue_write_instruction(guac_socket* socket,
+        const void* buf, size_t count, int skippable) {
+
+    guac_socket_queue_instruction instruction;
+    guac_socket_queue_instruction_init(&instruction, buf, count);
+
+    return guac_socket_queue_write_parsed_instruction(socket, &instruction,
+            skippable);
+
+}
+
+int guac_socket_queue_resync(guac_socket* socket) {
+
+    /* Only queue sockets ever skip frames */
+    if (socket->free_handler != guac_socket_queue_free_handler)
+        return 0;
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+
+    int resync = (data->state == GUAC_SOCKET_QUEUE_RESYNC);
+    if (resync) {
+        data->state = GUAC_SOCKET_QUEUE_SENDING;
+        data->resyncing = 1;
+    }
+
+    pthread_mutex_unlock(&data->lock);
+    return resync;
+
+}
+
+void guac_socket_queue_resync_complete(guac_socket* socket) {
+
+    /* Only queue sockets are ever resynchronized */
+    if (socket->free_handler != guac_socket_queue_free_handler)
+        return;
+
+    guac_socket_queue_data* data = (guac_socket_queue_data*) socket->data;
+
+    pthread_mutex_lock(&data->lock);
+    data->resyncing = 0;
+    pthread_mutex_unlock(&data->lock);
+
+}
@@ -0,0 +1,325 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_SOCKET_QUEUE_H
+#define GUAC_SOCKET_QUEUE_H
+
+/**
+ * Provides a guac_socket implementation which decouples the threads writing
+ * to a socket from the speed of the underlying connection, queueing all
+ * written data for transmission by a dedicated writer thread.
+ *
+ * @file socket-queue.h
+ */
+
+#include "guacamole/socket.h"
+
+#include <stddef.h>
+
+/**
+ * The number of queued bytes beyond which a queue socket will begin skipping
+ * frames. Once this many bytes are awaiting transmission at the end of a
+ * frame, all further skippable instructions that only draw to layers are
+ * dropped until the queue has drained and the recipient has been
+ * resynchronized. Instructions affecting layers in any other way, and
+ * instructions affecting streams other than the image streams of dropped
+ * "img" instructions, are never dropped.
+ */
+#define GUAC_SOCKET_QUEUE_HIGH_WATER_MARK 8388608
+
+/**
+ * The number of queued bytes that a queue socket which is skipping frames
+ * must drain to before the recipient will be resynchronized.
+ */
+#define GUAC_SOCKET_QUEUE_LOW_WATER_MARK 524288
+
+/**
+ * The maximum number of queued bytes that a queue socket created with
+ * guac_socket_queue() will hold. Instructions which are never skipped, such
+ * as stream data and changes to layers, continue to be queued while frames
+ * are skipped. If a recipient cannot keep up even with those instructions,
+ * the queue socket fails once this limit would be exceeded, discarding all
+ * queued data, rather than buffering without limit.
+ */
+#define GUAC_SOCKET_QUEUE_MAX_LENGTH 33554432
+
+/**
+ * The maximum number of milliseconds that freeing a queue socket created
+ * with guac_socket_queue() will wait for queued data to be written. Any data
+ * not yet written when this time elapses is discarded.
+ */
+#define GUAC_SOCKET_QUEUE_FREE_TIMEOUT 1000
+
+/**
+ * The largest buffer that the writer thread of a queue socket will retain
+ * after transmitting its contents. Larger buffers, which are only needed
+ * during bursts of output, are freed once they have been transmitted.
+ */
+#define GUAC_SOCKET_QUEUE_RETAINED_CAPACITY 65536
+
+/**
+ * The types of instruction that a queue socket distinguishes when deciding
+ * which instructions may be dropped for a recipient that has fallen behind.
+ */
+typedef enum guac_socket_queue_instruction_type {
+
+    /**
+     * Any instruction not covered by another type. Such instructions are
+     * never dropped.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_OTHER,
+
+    /**
+     * An instruction other than "img" which only draws to a layer.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_DRAW,
+
+    /**
+     * An "img" instruction, which draws to a layer using the contents of an
+     * image stream.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_IMG,
+
+    /**
+     * A "blob" instruction, sending data along a stream.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_BLOB,
+
+    /**
+     * An "end" instruction, closing a stream.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_END,
+
+    /**
+     * An instruction opening an audio, video, file, pipe, or argument value
+     * stream, any of which may remain open across resynchronization.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_OPEN,
+
+    /**
+     * A "sync" instruction, marking the end of a frame.
+     */
+    GUAC_SOCKET_QUEUE_INSTRUCTION_SYNC
+
+} guac_socket_queue_instruction_type;
+
+/**
+ * A single, complete Guacamole instruction, along with the details that a
+ * queue socket needs to decide whether that instruction may be dropped. An
+ * instruction written to many queue sockets, such as an instruction being
+ * broadcast to all users, need only be parsed once.
+ */
+typedef struct guac_socket_queue_instruction {
+
+    /**
+     * The entire instruction, including its terminating semicolon.
+     */
+    const char* data;
+
+    /**
+     * The length of the instruction, in bytes.
+     */
+    size_t length;
+
+    /**
+     * The type of the instruction, as determined by its opcode.
+     */
+    guac_socket_queue_instruction_type type;
+
+    /**
+     * The index of the stream given by the first argument of the instruction,
+     * or -1 if the instruction does not refer to a tracked stream.
+     */
+    int stream;
+
+} guac_socket_queue_instruction;
+
+/**
+ * Allocates a new guac_socket which queues all data written to it for
+ * transmission along the given socket by a dedicated writer thread. Writes to
+ * the returned socket never block on the given socket, and instructions are
+ * only ever added to the queue in their entirety, thus data written by
+ * different threads is interleaved only at instruction boundaries. Reads are
+ * passed through directly to the given socket. If more than
+ * GUAC_SOCKET_QUEUE_MAX_LENGTH bytes would await transmission, the returned
+ * socket fails, and all further writes to it fail.
+ *
+ * The given socket is not freed when the returned socket is freed. Freeing the
+ * returned socket waits up to GUAC_SOCKET_QUEUE_FREE_TIMEOUT milliseconds for
+ * queued data to be transmitted, discarding anything that remains.
+ *
+ * @param socket
+ *     The socket that all data written to the returned socket should
+ *     ultimately be written to.
+ *
+ * @return
+ *     A newly-allocated guac_socket which queues all written data for
+ *     transmission along the given socket.
+ */
+guac_socket* guac_socket_queue(guac_socket* socket);
+
+/**
+ * Allocates a new guac_socket which queues all data written to it for
+ * transmission along the given socket by a dedicated writer thread, as with
+ * guac_socket_queue(), but which holds no more than approximately the given
+ * number of bytes. Once that many bytes await transmission, any thread
+ * completing an instruction blocks until the writer thread has made room.
+ * Instructions are never dropped, regardless of whether they are written as
+ * skippable.
+ *
+ * Unlike guac_socket_queue(), the given socket IS freed when the returned
+ * socket is freed, after all queued data has been written.
+ *
+ * @param socket
+ *     The socket that all data written to the returned socket should
+ *     ultimately be written to.
+ *
+ * @param capacity
+ *     The number of queued bytes at which further instructions will block.
+ *     This must be greater than zero.
+ *
+ * @return
+ *     A newly-allocated guac_socket which queues all written data for
+ *     transmission along the given socket.
+ */
+guac_socket* guac_socket_queue_bounded(guac_socket* socket, size_t capacity);
+
+/**
+ * Writes a single, complete Guacamole instruction to the given socket, noting
+ * whether the instruction may be skipped if the recipient has fallen too far
+ * behind. Skippable instructions must describe state that will be fully
+ * restored when the recipient is resynchronized, such as drawing operations
+ * against layers whose final contents will be sent again. Even then, only
+ * instructions that draw to layers are dropped (along with any "blob" and
+ * "end" instructions of the image streams of dropped "img" instructions),
+ * while the instructions marking the end of each frame are dropped so that
+ * everything else is applied together with the resynchronized state.
+ *
+ * Regardless of whether they are skippable, instructions which would reopen
+ * an audio, video, file, pipe, or argument value stream that the recipient
+ * already has open are dropped while the recipient is being resynchronized,
+ * such that resynchronization does not duplicate streams that remained open
+ * while frames were skipped.
+ *
+ * If the given socket is a queue socket created with guac_socket_queue(), the
+ * instruction is added to the queue without blocking, unless skipped. Only
+ * the opcode and first argument of the instruction are parsed. Callers
+ * writing the same instruction to many sockets should instead parse it once
+ * with guac_socket_queue_instruction_init() and write it to each socket with
+ * guac_socket_queue_write_parsed_instruction(). If the
+ * given socket is any other kind of socket, the instruction is written
+ * normally and is never skipped.
+ *
+ * @param socket
+ *     The socket to write the instruction to.
+ *
+ * @param buf
+ *     A buffer containing the entire instruction.
+ *
+ * @param count
+ *     The number of bytes in the buffer.
+ *
+ * @param skippable
+ *     Non-zero if the instruction may be dropped while the recipient is
+ *     skipping frames, zero if the instruction must always be sent.
+ *
+ * @return
+ *     Zero if the instruction was written, queued, or skipped successfully,
+ *     non-zero if an error occurs or has previously occurred while writing
+ *     to the underlying socket.
+ */
+int guac_socket_queue_write_instruction(guac_socket* socket,
+        const void* buf, size_t count, int skippable);
+
+/**
+ * Initializes the given guac_socket_queue_instruction from the given buffer,
+ * which must contain a single, complete Guacamole instruction. Only the
+ * opcode and first argument of the instruction are parsed.
+ *
+ * @param instruction
+ *     The guac_socket_queue_instruction to initialize.
+ *
+ * @param buf
+ *     A buffer containing the entire instruction. This buffer must remain
+ *     valid for as long as the initialized instruction is in use.
+ *
+ * @param count
+ *     The number of bytes in the buffer.
+ */
+void guac_socket_queue_instruction_init(
+        guac_socket_queue_instruction* instruction,
+        const void* buf, size_t count);
+
+/**
+ * Writes the given instruction, which was previously initialized with
+ * guac_socket_queue_instruction_init(), to the given socket, exactly as
+ * guac_socket_queue_write_instruction() would, but without parsing the
+ * instruction again.
+ *
+ * @param socket
+ *     The socket to write the instruction to.
+ *
+ * @param instruction
+ *     The instruction to write.
+ *
+ * @param skippable
+ *     Non-zero if the instruction may be dropped while the recipient is
+ *     skipping frames, zero if the instruction must always be sent.
+ *
+ * @return
+ *     Zero if the instruction was written, queued, or skipped successfully,
+ *     non-zero if an error occurs or has previously occurred while writing
+ *     to the underlying socket.
+ */
+int guac_socket_queue_write_parsed_instruction(guac_socket* socket,
+        const guac_socket_queue_instruction* instruction, int skippable);
+
+/**
+ * Returns whether the recipient of the given socket has fallen behind, has
+ * since skipped to the end of the queued frames, and must now be
+ * resynchronized with the current state of the connection. If this function
+ * returns non-zero, the socket resumes sending skippable instructions, and
+ * the caller is responsible for ensuring that the recipient receives the full
+ * current state before any further skippable instructions, calling
+ * guac_socket_queue_resync_complete() once that state has been written.
+ *
+ * @param socket
+ *     The socket to check. This need not be a queue socket, in which case
+ *     resynchronization is never required.
+ *
+ * @return
+ *     Non-zero if the recipient of the given socket must now be
+ *     resynchronized, zero otherwise.
+ */
+int guac_socket_queue_resync(guac_socket* socket);
+
+/**
+ * Notes that the recipient of the given socket, for which
+ * guac_socket_queue_resync() previously returned non-zero, has now been sent
+ * the full current state of the connection. Streams opened after this point
+ * are no longer considered possible duplicates of streams that remained open
+ * while the recipient was skipping frames.
+ *
+ * @param socket
+ *     The socket whose recipient has been resynchronized. This need not be a
+ *     queue socket, in which case this function has no effect.
+ */
+void guac_socket_queue_resync_complete(guac_socket* socket);
+
+#endif
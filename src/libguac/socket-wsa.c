@@ -239,6 +239,17 @@ static ssize_t guac_socket_wsa_write_buffered(guac_socket* socket,
         int chunk_size;
         int remaining = sizeof(data->out_buf) - data->written;
 
+        /* Write directly to the socket if the buffer is empty and would only
+         * be filled and flushed again anyway */
+        if (data->written == 0 && count >= sizeof(data->out_buf)) {
+
+            if (guac_socket_wsa_write(socket, current, count))
+                return -1;
+
+            break;
+
+        }
+
         /* If no space left in buffer, flush and retry */
         if (remaining == 0) {
 
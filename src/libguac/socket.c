@@ -17,6 +17,8 @@
  * under the License.
  */
 
+#include "base64.h"
+
 #include "guacamole/mem.h"
 #include "guacamole/error.h"
 #include "guacamole/proctitle.h"
@@ -35,14 +37,6 @@
 #include <time.h>
 #include <unistd.h>
 
-char __guac_socket_BASE64_CHARACTERS[64] = {
-    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
-    'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd',
-    'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's',
-    't', 'u', 'v', 'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7',
-    '8', '9', '+', '/'
-};
-
 static void* __guac_socket_keep_alive_thread(void* data) {
 
     /* Thread name keep-alive: periodically sends keep-alive NOPs on an
@@ -244,107 +238,14 @@ ssize_t guac_socket_write_string(guac_socket* socket, const char* str) {
 
 }
 
-/**
- * Encodes one to three bytes of data as four characters in base64 encoding.
- *
- * This function takes int arguments even though it's working with bytes to
- * allow -1 to be used as distinct sentinel value for missing data.
- *
- * @param a An int holding the first byte of data to encode. Only the
- *          least-significant byte will be used. This will always be inserted
- *          into the output.
- *
- * @param b An int holding the second byte of data to encode. Only the
- *          least-significant byte will be used. If this is less than zero,
- *          the second and third bytes will be ignored and the last two
- *          characters of the output will be '=' padding characters.
- *
- * @param c An int holding the third byte of data to encode. Only the
- *          least-significant byte will be used. If this is less than zero,
- *          the third byte will be ignored and the last character of the
- *          output will be a '=' padding character.
- *
- * @param output Character buffer to hold the output. Exactly four characters
- *               will be written to the buffer starting at this location.
- *
- * @return Returns zero.
- */
-ssize_t __guac_socket_encode_base64(int a, int b, int c, char* output) {
-
-    /* Byte 0:[AAAAAA] AABBBB BBBBCC CCCCCC */
-    output[0] = __guac_socket_BASE64_CHARACTERS[(a & 0xFC) >> 2];
-
-    if (b >= 0) {
-
-        /* Byte 1: AAAAAA [AABBBB] BBBBCC CCCCCC */
-        output[1] = __guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4) | ((b & 0xF0) >> 4)];
-
-        /*
-         * Bytes 2 and 3, zero characters of padding:
-         *
-         * AAAAAA  AABBBB [BBBBCC] CCCCCC
-         * AAAAAA  AABBBB  BBBBCC [CCCCCC]
-         */
-        if (c >= 0) {
-            output[2] = __guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2) | ((c & 0xC0) >> 6)];
-            output[3] = __guac_socket_BASE64_CHARACTERS[c & 0x3F];
-        }
-
-        /*
-         * Bytes 2 and 3, one character of padding:
-         *
-         * AAAAAA  AABBBB [BBBB--] ------
-         * AAAAAA  AABBBB  BBBB-- [------]
-         */
-        else {
-            output[2] = __guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2)];
-            output[3] = '=';
-        }
-    }
-
-    /*
-     * Bytes 1, 2, and 3, two characters of padding:
-     *
-     * AAAAAA [AA----] ------  ------
-     * AAAAAA  AA---- [------] ------
-     * AAAAAA  AA----  ------ [------]
-     */
-    else {
-        output[1] = __guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4)];
-        output[2] = '=';
-        output[3] = '=';
-    }
-
-    return 0;
-}
-
 ssize_t guac_socket_flush_base64(guac_socket* socket) {
-    const unsigned char* src = socket->__ready_buf;
-
-    int encodedCount = 0;
-    int remaining = socket->__ready;
 
-    /* Encode bytes in groups of three */
-    while (remaining > 2) {
-        __guac_socket_encode_base64(src[0], src[1], src[2], socket->__encoded_buf + encodedCount);
-
-        remaining -= 3;
-        src += 3;
-        encodedCount += 4;
-    }
-
-    /* Take care of partial remnants */
-    if (remaining == 2) {
-        __guac_socket_encode_base64(src[0], src[1], -1, socket->__encoded_buf + encodedCount);
-        encodedCount += 4;
-    }
-    else if (remaining == 1) {
-        __guac_socket_encode_base64(src[0], -1, -1, socket->__encoded_buf + encodedCount);
-        encodedCount += 4;
-    }
+    /* Encode all data within ready buffer, including any padding */
+    size_t length = guac_base64_encode(socket->__ready_buf, socket->__ready,
+            socket->__encoded_buf);
 
     /* Write buffer to socket */
-    int retval = guac_socket_write(socket, socket->__encoded_buf, encodedCount);
+    int retval = guac_socket_write(socket, socket->__encoded_buf, length);
     if (retval < 0)
         return retval;
 
@@ -362,6 +263,25 @@ ssize_t guac_socket_write_base64(guac_socket* socket, const void* buf, size_t co
     int retval;
 
     while (remaining > 0) {
+
+        /* Encode directly from the provided buffer, bypassing the ready
+         * buffer, if doing so would produce the same output */
+        if (socket->__ready == 0
+                && remaining >= GUAC_SOCKET_BASE64_READY_BUFFER_SIZE) {
+
+            size_t length = guac_base64_encode(src,
+                    GUAC_SOCKET_BASE64_READY_BUFFER_SIZE, socket->__encoded_buf);
+
+            retval = guac_socket_write(socket, socket->__encoded_buf, length);
+            if (retval < 0)
+                return retval;
+
+            src += GUAC_SOCKET_BASE64_READY_BUFFER_SIZE;
+            remaining -= GUAC_SOCKET_BASE64_READY_BUFFER_SIZE;
+            continue;
+
+        }
+
         /* Fill ready buffer as much as possible */
         len = GUAC_SOCKET_BASE64_READY_BUFFER_SIZE - socket->__ready;
         if (remaining < len)
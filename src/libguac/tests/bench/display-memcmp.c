@@ -0,0 +1,238 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Microbenchmark of the per-frame dirty region detection pass performed by
+ * guac_display_plan_create(). Each simulated frame compares every 64-pixel
+ * row segment of a full-screen layer against the previous frame, exactly as
+ * guac_display_plan_create() does, using both the portable implementation of
+ * guac_display_memcmp() and the implementation selected for the current CPU.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_display_memcmp [FRAMES]
+ */
+
+#include "display-plan.h"
+#include "display-priv.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The number of frames to compare for each resolution if no number of frames
+ * is given on the command line.
+ */
+#define BENCH_DEFAULT_FRAMES 200
+
+/**
+ * Signature of the guac_display_memcmp() implementations being compared.
+ */
+typedef size_t bench_memcmp_function(const uint32_t* restrict buffer_a,
+        const uint32_t* restrict buffer_b, size_t count, size_t* pos);
+
+/**
+ * A screen resolution to benchmark.
+ */
+typedef struct bench_resolution {
+
+    /**
+     * Human-readable name of the resolution.
+     */
+    const char* name;
+
+    /**
+     * The width of the screen, in pixels.
+     */
+    int width;
+
+    /**
+     * The height of the screen, in pixels.
+     */
+    int height;
+
+} bench_resolution;
+
+/**
+ * All resolutions benchmarked.
+ */
+static const bench_resolution bench_resolutions[] = {
+    { "1080p", 1920, 1080 },
+    { "1440p", 2560, 1440 },
+    { "4K",    3840, 2160 }
+};
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Compares the given pair of frames in 64-pixel row segments, in the same
+ * manner as guac_display_plan_create(), returning the total number of pixels
+ * found to be different.
+ *
+ * @param impl
+ *     The guac_display_memcmp() implementation to use.
+ *
+ * @param last_frame
+ *     The image data of the previous frame.
+ *
+ * @param pending_frame
+ *     The image data of the pending frame.
+ *
+ * @param width
+ *     The width of both frames, in pixels.
+ *
+ * @param height
+ *     The height of both frames, in pixels.
+ *
+ * @return
+ *     The total number of pixels within the dirty row segments located.
+ */
+static size_t bench_diff_frame(bench_memcmp_function* impl,
+        const uint32_t* last_frame, const uint32_t* pending_frame,
+        int width, int height) {
+
+    size_t dirty = 0;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += GUAC_DISPLAY_CELL_SIZE) {
+
+            int segment = GUAC_DISPLAY_CELL_SIZE;
+            if (x + segment > width)
+                segment = width - x;
+
+            size_t pos;
+            dirty += impl(pending_frame + x, last_frame + x, segment, &pos);
+
+        }
+
+        last_frame += width;
+        pending_frame += width;
+
+    }
+
+    return dirty;
+
+}
+
+/**
+ * Runs the given implementation over the given number of frames, returning
+ * the average time taken per frame, in microseconds.
+ */
+static double bench_run(bench_memcmp_function* impl,
+        const uint32_t* last_frame, const uint32_t* pending_frame,
+        int width, int height, int frames, size_t* dirty) {
+
+    uint64_t start = bench_now();
+
+    for (int i = 0; i < frames; i++)
+        *dirty = bench_diff_frame(impl, last_frame, pending_frame, width, height);
+
+    return (bench_now() - start) / 1000.0 / frames;
+
+}
+
+int main(int argc, char** argv) {
+
+    int frames = BENCH_DEFAULT_FRAMES;
+    if (argc > 1)
+        frames = atoi(argv[1]);
+
+    if (frames <= 0) {
+        fprintf(stderr, "Usage: %s [FRAMES]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-6s %-10s %14s %14s %9s\n", "Res.", "Change", "Portable (us)",
+            "Dispatch (us)", "Speedup");
+
+    for (int i = 0; i < sizeof(bench_resolutions) / sizeof(bench_resolutions[0]); i++) {
+
+        const bench_resolution* res = &bench_resolutions[i];
+        size_t pixels = (size_t) res->width * res->height;
+
+        uint32_t* last_frame = malloc(pixels * sizeof(uint32_t));
+        uint32_t* pending_frame = malloc(pixels * sizeof(uint32_t));
+
+        for (size_t j = 0; j < pixels; j++)
+            last_frame[j] = 0xFF000000 | (j * 2654435761u);
+
+        /* Benchmark an unchanged frame (the common idle case), a frame where a
+         * sparse set of pixels changed (cursor blink, typing), and a frame
+         * where every pixel changed (video, full repaint) */
+        for (int scenario = 0; scenario < 3; scenario++) {
+
+            const char* name;
+            memcpy(pending_frame, last_frame, pixels * sizeof(uint32_t));
+
+            if (scenario == 0)
+                name = "none";
+
+            else if (scenario == 1) {
+                name = "sparse";
+                for (size_t j = 0; j < pixels; j += 4099)
+                    pending_frame[j] ^= 0x00FFFFFF;
+            }
+
+            else {
+                name = "full";
+                for (size_t j = 0; j < pixels; j++)
+                    pending_frame[j] ^= 0x00FFFFFF;
+            }
+
+            size_t dirty_portable, dirty_dispatch;
+            double portable = bench_run(guac_display_memcmp_portable,
+                    last_frame, pending_frame, res->width, res->height,
+                    frames, &dirty_portable);
+            double dispatch = bench_run(guac_display_memcmp,
+                    last_frame, pending_frame, res->width, res->height,
+                    frames, &dirty_dispatch);
+
+            if (dirty_portable != dirty_dispatch) {
+                fprintf(stderr, "Implementations disagree (%zu != %zu)!\n",
+                        dirty_portable, dirty_dispatch);
+                return 1;
+            }
+
+            printf("%-6s %-10s %14.1f %14.1f %8.2fx\n", res->name, name,
+                    portable, dispatch, portable / dispatch);
+
+        }
+
+        free(last_frame);
+        free(pending_frame);
+
+    }
+
+    return 0;
+
+}
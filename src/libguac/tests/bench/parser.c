@@ -0,0 +1,333 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Microbenchmark of guac_parser_read(). Each given session recording (as
+ * written by guac_recording_create() or guacd's "recording-path" parameter) is
+ * loaded into memory and parsed repeatedly through a guac_socket which reads
+ * from that memory in 64 KB pieces, such that only the cost of parsing is
+ * measured. If no recordings are given, synthetic streams are parsed instead:
+ * one resembling a typical recording, with image data split into blobs small
+ * enough for any parser, and one consisting of the large blobs produced by
+ * file uploads or audio input from clients that do not split their data.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_parser [RECORDING...]
+ */
+
+#include <guacamole/error.h>
+#include <guacamole/parser.h>
+#include <guacamole/socket.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The approximate number of megabytes of data to parse for each stream.
+ */
+#define BENCH_MEGABYTES 512
+
+/**
+ * The maximum number of bytes returned by each read from the memory socket.
+ */
+#define BENCH_READ_SIZE 65536
+
+/**
+ * The number of characters of base64 data within each blob of the synthetic
+ * recording, matching the blobs written by guac_protocol_send_blob().
+ */
+#define BENCH_BLOB_LENGTH 8064
+
+/**
+ * The number of characters of base64 data within each blob of the synthetic
+ * upload.
+ */
+#define BENCH_LARGE_BLOB_LENGTH 262144
+
+/**
+ * The state of a guac_socket which reads from a fixed buffer in memory.
+ */
+typedef struct bench_memory_socket {
+
+    /**
+     * The data remaining to be read.
+     */
+    const char* data;
+
+    /**
+     * The number of bytes remaining to be read.
+     */
+    size_t length;
+
+} bench_memory_socket;
+
+/**
+ * A growable buffer holding the data of a stream to be parsed.
+ */
+typedef struct bench_stream {
+
+    /**
+     * The contents of the stream.
+     */
+    char* data;
+
+    /**
+     * The number of bytes within the stream.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes allocated for the stream.
+     */
+    size_t size;
+
+} bench_stream;
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Read handler for a memory socket, which reads up to BENCH_READ_SIZE bytes
+ * of the remaining data.
+ */
+static ssize_t bench_memory_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    bench_memory_socket* memory = (bench_memory_socket*) socket->data;
+
+    if (count > memory->length)
+        count = memory->length;
+
+    if (count > BENCH_READ_SIZE)
+        count = BENCH_READ_SIZE;
+
+    memcpy(buf, memory->data, count);
+    memory->data += count;
+    memory->length -= count;
+
+    return count;
+
+}
+
+/**
+ * Select handler for a memory socket, which always reports that data is
+ * available.
+ */
+static int bench_memory_select_handler(guac_socket* socket, int usec_timeout) {
+    return 1;
+}
+
+/**
+ * Appends the given data to the given stream.
+ */
+static void bench_stream_append(bench_stream* stream, const char* data,
+        size_t length) {
+
+    if (stream->length + length > stream->size) {
+        stream->size = (stream->length + length) * 2;
+        stream->data = realloc(stream->data, stream->size);
+    }
+
+    memcpy(stream->data + stream->length, data, length);
+    stream->length += length;
+
+}
+
+/**
+ * Appends a blob instruction containing the given number of characters of
+ * arbitrary base64 data to the given stream.
+ */
+static void bench_stream_append_blob(bench_stream* stream, int length) {
+
+    static const char base64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    char prefix[32];
+    bench_stream_append(stream, prefix,
+            sprintf(prefix, "4.blob,1.1,%i.", length));
+
+    for (int i = 0; i < length; i++) {
+        char c = base64[(i * 2654435761u) >> 26];
+        bench_stream_append(stream, &c, 1);
+    }
+
+    bench_stream_append(stream, ";", 1);
+
+}
+
+/**
+ * Generates a stream resembling a typical session recording: frames of
+ * drawing instructions and image streams, interleaved with mouse and key
+ * events and the occasional instruction containing multibyte characters.
+ */
+static void bench_generate_recording(bench_stream* stream) {
+
+    for (int frame = 0; frame < 1000; frame++) {
+
+        const char* drawing =
+            "3.img,1.1,2.14,1.0,10.image/webp,3.128,3.256;"
+            "4.rect,1.0,2.64,3.128,2.64,2.64;"
+            "5.cfill,2.14,1.0,3.255,3.255,3.255,3.255;"
+            "4.copy,2.-1,1.0,1.0,2.64,2.64,2.14,1.0,3.640,3.480;"
+            "5.mouse,3.512,3.384,1.0,13.1700000000000;"
+            "3.key,5.65507,1.1,13.1700000000000;"
+            "4.name,5.h\xc3\xa9llo;";
+
+        bench_stream_append(stream, drawing, strlen(drawing));
+
+        for (int blob = 0; blob < 3; blob++)
+            bench_stream_append_blob(stream, BENCH_BLOB_LENGTH);
+
+        const char* end =
+            "3.end,1.1;"
+            "4.sync,13.1700000000000,1.0;";
+
+        bench_stream_append(stream, end, strlen(end));
+
+    }
+
+}
+
+/**
+ * Generates a stream consisting of the large blobs of a file upload.
+ */
+static void bench_generate_upload(bench_stream* stream) {
+    for (int blob = 0; blob < 64; blob++)
+        bench_stream_append_blob(stream, BENCH_LARGE_BLOB_LENGTH);
+}
+
+/**
+ * Loads the contents of the given file into the given stream.
+ *
+ * @return
+ *     Zero if the file was loaded successfully, non-zero otherwise.
+ */
+static int bench_load(bench_stream* stream, const char* path) {
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        bench_stream_append(stream, buffer, length);
+
+    fclose(file);
+    return 0;
+
+}
+
+/**
+ * Parses the given stream repeatedly until approximately BENCH_MEGABYTES
+ * megabytes have been parsed, printing the resulting throughput.
+ */
+static void bench_parse(const char* name, const bench_stream* stream) {
+
+    int passes = (size_t) BENCH_MEGABYTES * 1048576 / stream->length + 1;
+    size_t instructions = 0;
+    size_t bytes = 0;
+
+    uint64_t start = bench_now();
+
+    for (int pass = 0; pass < passes; pass++) {
+
+        bench_memory_socket memory = {
+            .data = stream->data,
+            .length = stream->length
+        };
+
+        guac_socket* socket = guac_socket_alloc();
+        socket->data = &memory;
+        socket->read_handler = bench_memory_read_handler;
+        socket->select_handler = bench_memory_select_handler;
+
+        guac_parser* parser = guac_parser_alloc();
+        while (guac_parser_read(parser, socket, 0) == 0)
+            instructions++;
+
+        /* Recordings are expected to end with a complete instruction */
+        if (guac_error != GUAC_STATUS_CLOSED || memory.length > 0)
+            fprintf(stderr, "%s: Parse failed after %zu bytes: %s\n", name,
+                    stream->length - memory.length, guac_error_message);
+
+        bytes += stream->length - memory.length;
+
+        guac_parser_free(parser);
+        guac_socket_free(socket);
+
+    }
+
+    double seconds = (bench_now() - start) / 1000000000.0;
+
+    printf("%-24s %10.0f %14.0f\n", name, bytes / 1048576.0 / seconds,
+            instructions / seconds);
+
+}
+
+int main(int argc, char** argv) {
+
+    printf("%-24s %10s %14s\n", "Stream", "MB/s", "Instr/s");
+
+    /* Parse synthetic streams if no recordings are given */
+    if (argc < 2) {
+
+        bench_stream recording = { 0 };
+        bench_generate_recording(&recording);
+        bench_parse("(synthetic recording)", &recording);
+        free(recording.data);
+
+        bench_stream upload = { 0 };
+        bench_generate_upload(&upload);
+        bench_parse("(synthetic upload)", &upload);
+        free(upload.data);
+
+        return 0;
+
+    }
+
+    for (int i = 1; i < argc; i++) {
+
+        bench_stream stream = { 0 };
+        if (bench_load(&stream, argv[i]) == 0 && stream.length > 0)
+            bench_parse(argv[i], &stream);
+
+        free(stream.data);
+
+    }
+
+    return 0;
+
+}
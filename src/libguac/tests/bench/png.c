@@ -0,0 +1,612 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Benchmark of the PNG encoding performed by guac_client_stream_png() and
+ * guac_user_stream_png(). Each frame is encoded both by guac_png_write(), at
+ * the lowest and highest compression levels it will use, and by a model of
+ * the previous encoder, which built a palette using a 4096-bucket hash table,
+ * located each pixel within that palette a second time while copying the
+ * image, compressed using libpng's defaults, and used Cairo's own PNG writer
+ * for any image with more than 256 colors. All output is written as blobs to
+ * a file descriptor socket (writing to /dev/null).
+ *
+ * Synthetic frames representative of typical remote desktop content are
+ * always benchmarked. Captured frames may additionally be benchmarked by
+ * providing the paths of PNG files on the command line.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_png [FILE.png ...]
+ */
+
+#include "encode-png.h"
+
+#include <cairo/cairo.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/stream.h>
+#include <png.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The minimum amount of time to spend encoding each frame with each
+ * encoder, in nanoseconds.
+ */
+#define BENCH_MIN_DURATION 500000000
+
+/**
+ * The width of the synthetic frames, in pixels.
+ */
+#define BENCH_WIDTH 1920
+
+/**
+ * The height of the synthetic frames, in pixels.
+ */
+#define BENCH_HEIGHT 1080
+
+/**
+ * The state of a socket which discards all data written to it, counting the
+ * number of bytes written.
+ */
+typedef struct bench_sink {
+
+    /**
+     * The file descriptor of /dev/null.
+     */
+    int fd;
+
+    /**
+     * The number of bytes written.
+     */
+    size_t written;
+
+} bench_sink;
+
+/**
+ * Signature of the PNG encoders being compared.
+ */
+typedef int bench_png_function(guac_socket* socket, guac_stream* stream,
+        cairo_surface_t* surface);
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Write handler for a guac_socket which writes to /dev/null, counting the
+ * number of bytes written.
+ */
+static ssize_t bench_sink_write_handler(guac_socket* socket,
+        const void* data, size_t count) {
+    bench_sink* sink = (bench_sink*) socket->data;
+    sink->written += count;
+    return write(sink->fd, data, count);
+}
+
+/**
+ * The palette built by the previous encoder, mapping 24-bit colors to
+ * palette indices using a 4096-bucket open-addressing hash table.
+ */
+typedef struct bench_legacy_palette {
+
+    /**
+     * Hash table entries, each holding a color and its index plus one (zero
+     * if unused).
+     */
+    struct { int index; int color; } entries[0x1000];
+
+    /**
+     * All colors within the palette.
+     */
+    png_color colors[256];
+
+    /**
+     * The number of colors within the palette.
+     */
+    int size;
+
+} bench_legacy_palette;
+
+/**
+ * Builds a palette of all colors within the given surface in the same manner
+ * as the previous encoder, returning NULL if there are more than 256.
+ */
+static bench_legacy_palette* bench_legacy_palette_alloc(cairo_surface_t* surface) {
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char* data = cairo_image_surface_get_data(surface);
+
+    bench_legacy_palette* palette = calloc(1, sizeof(bench_legacy_palette));
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            int color = ((uint32_t*) data)[x] & 0xFFFFFF;
+            int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+
+            for (;;) {
+
+                if (palette->entries[hash].index == 0) {
+
+                    if (palette->size == 256) {
+                        free(palette);
+                        return NULL;
+                    }
+
+                    png_color* c = &(palette->colors[palette->size]);
+                    c->blue  = (color      ) & 0xFF;
+                    c->green = (color >> 8 ) & 0xFF;
+                    c->red   = (color >> 16) & 0xFF;
+
+                    palette->entries[hash].index = ++palette->size;
+                    palette->entries[hash].color = color;
+                    break;
+
+                }
+
+                if (palette->entries[hash].color == color)
+                    break;
+
+                hash = (hash + 1) & 0xFFF;
+
+            }
+
+        }
+
+        data += stride;
+
+    }
+
+    return palette;
+
+}
+
+/**
+ * Locates the given color within a palette built by
+ * bench_legacy_palette_alloc(), in the same manner as the previous encoder.
+ */
+static int bench_legacy_palette_find(bench_legacy_palette* palette, int color) {
+
+    int hash = ((color & 0xFFF000) >> 12) ^ (color & 0xFFF);
+
+    for (;;) {
+
+        if (palette->entries[hash].index == 0)
+            return -1;
+
+        if (palette->entries[hash].color == color)
+            return palette->entries[hash].index - 1;
+
+        hash = (hash + 1) & 0xFFF;
+
+    }
+
+}
+
+/**
+ * Buffer of pending PNG data written by the model of the previous encoder,
+ * sent as blobs in the same manner as guac_png_write().
+ */
+typedef struct bench_legacy_write_state {
+
+    /**
+     * The socket over which all PNG blobs will be written.
+     */
+    guac_socket* socket;
+
+    /**
+     * The Guacamole stream to associate with each PNG blob.
+     */
+    guac_stream* stream;
+
+    /**
+     * Buffer of pending PNG data.
+     */
+    char buffer[GUAC_PROTOCOL_BLOB_MAX_LENGTH];
+
+    /**
+     * The number of bytes currently stored in the buffer.
+     */
+    int buffer_size;
+
+} bench_legacy_write_state;
+
+/**
+ * Appends the given PNG data to the given write state, sending blobs as the
+ * buffer fills.
+ */
+static void bench_legacy_write_data(bench_legacy_write_state* state,
+        const unsigned char* data, size_t length) {
+
+    while (length > 0) {
+
+        size_t block = sizeof(state->buffer) - state->buffer_size;
+        if (block > length)
+            block = length;
+
+        memcpy(state->buffer + state->buffer_size, data, block);
+        state->buffer_size += block;
+        data += block;
+        length -= block;
+
+        if (state->buffer_size == sizeof(state->buffer)) {
+            guac_protocol_send_blob(state->socket, state->stream,
+                    state->buffer, state->buffer_size);
+            state->buffer_size = 0;
+        }
+
+    }
+
+}
+
+/**
+ * libpng write function for the model of the previous encoder.
+ */
+static void bench_legacy_png_write(png_structp png, png_bytep data,
+        png_size_t length) {
+    bench_legacy_write_data((bench_legacy_write_state*) png_get_io_ptr(png),
+            data, length);
+}
+
+/**
+ * libpng flush function for the model of the previous encoder, which does
+ * nothing, as the buffer is flushed once encoding completes.
+ */
+static void bench_legacy_png_flush(png_structp png) {
+}
+
+/**
+ * Cairo write function for the model of the previous encoder.
+ */
+static cairo_status_t bench_legacy_cairo_write(void* closure,
+        const unsigned char* data, unsigned int length) {
+    bench_legacy_write_data((bench_legacy_write_state*) closure, data, length);
+    return CAIRO_STATUS_SUCCESS;
+}
+
+/**
+ * Writes the given surface as a palette image in the same manner as the
+ * previous encoder.
+ */
+static void bench_legacy_write_palette(bench_legacy_write_state* state,
+        cairo_surface_t* surface, bench_legacy_palette* palette) {
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char* data = cairo_image_surface_get_data(surface);
+
+    int bpp;
+    if      (palette->size <= 2)  bpp = 1;
+    else if (palette->size <= 4)  bpp = 2;
+    else if (palette->size <= 16) bpp = 4;
+    else                          bpp = 8;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+            NULL, NULL, NULL);
+    png_infop png_info = png_create_info_struct(png);
+
+    png_set_write_fn(png, state, bench_legacy_png_write,
+            bench_legacy_png_flush);
+
+    /* Copy indices of all pixels into separately-allocated rows */
+    png_byte** rows = malloc(sizeof(png_byte*) * height);
+    for (int y = 0; y < height; y++) {
+        rows[y] = malloc(width);
+        for (int x = 0; x < width; x++)
+            rows[y][x] = bench_legacy_palette_find(palette,
+                    ((uint32_t*) data)[x] & 0xFFFFFF);
+        data += stride;
+    }
+
+    png_set_IHDR(png, png_info, width, height, bpp, PNG_COLOR_TYPE_PALETTE,
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+            PNG_FILTER_TYPE_DEFAULT);
+
+    png_set_PLTE(png, png_info, palette->colors, palette->size);
+    png_set_rows(png, png_info, rows);
+    png_write_png(png, png_info, PNG_TRANSFORM_PACKING, NULL);
+    png_destroy_write_struct(&png, &png_info);
+
+    for (int y = 0; y < height; y++)
+        free(rows[y]);
+    free(rows);
+
+}
+
+/**
+ * Model of the previous implementation of guac_png_write().
+ */
+static int bench_png_write_legacy(guac_socket* socket, guac_stream* stream,
+        cairo_surface_t* surface) {
+
+    static bench_legacy_write_state state;
+    state.socket = socket;
+    state.stream = stream;
+    state.buffer_size = 0;
+
+    bench_legacy_palette* palette = NULL;
+    if (cairo_image_surface_get_format(surface) == CAIRO_FORMAT_RGB24)
+        palette = bench_legacy_palette_alloc(surface);
+
+    /* Use Cairo's own writer for everything that cannot be palettized */
+    if (palette == NULL)
+        cairo_surface_write_to_png_stream(surface, bench_legacy_cairo_write,
+                &state);
+
+    else {
+        bench_legacy_write_palette(&state, surface, palette);
+        free(palette);
+    }
+
+    guac_protocol_send_blob(socket, stream, state.buffer, state.buffer_size);
+    return 0;
+
+}
+
+/**
+ * Encodes the given surface using guac_png_write() at the lowest compression
+ * level it will use.
+ */
+static int bench_png_write_fast(guac_socket* socket, guac_stream* stream,
+        cairo_surface_t* surface) {
+    return guac_png_write(socket, stream, surface, GUAC_PNG_MIN_LEVEL);
+}
+
+/**
+ * Encodes the given surface using guac_png_write() at the highest compression
+ * level it will use.
+ */
+static int bench_png_write_max(guac_socket* socket, guac_stream* stream,
+        cairo_surface_t* surface) {
+    return guac_png_write(socket, stream, surface, GUAC_PNG_MAX_LEVEL);
+}
+
+/**
+ * Repeatedly encodes the given surface using the given encoder for at least
+ * BENCH_MIN_DURATION nanoseconds, printing the average time taken and the
+ * size of the encoded result.
+ */
+static void bench_png(bench_png_function* encode, guac_socket* socket,
+        bench_sink* sink, cairo_surface_t* surface) {
+
+    guac_stream stream = { .index = 1 };
+
+    int frames = 0;
+    uint64_t start = bench_now();
+    uint64_t elapsed;
+
+    sink->written = 0;
+
+    do {
+        encode(socket, &stream, surface);
+        guac_socket_flush(socket);
+        frames++;
+    } while ((elapsed = bench_now() - start) < BENCH_MIN_DURATION);
+
+    printf(" %9.2f %9zu", elapsed / 1000000.0 / frames,
+            sink->written / frames / 1024);
+
+}
+
+/**
+ * Returns a pseudo-random number, using a generator whose sequence is the
+ * same on every run.
+ */
+static uint32_t bench_random(void) {
+    static uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * Allocates a synthetic RGB24 frame resembling a desktop of windows
+ * containing anti-aliased text, which uses well under 256 colors.
+ */
+static cairo_surface_t* bench_create_text_frame(void) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            BENCH_WIDTH, BENCH_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < BENCH_HEIGHT; y++) {
+
+        uint32_t* row = (uint32_t*) (data + y * stride);
+
+        /* Title bar, then lines of text on a white background */
+        if (y < 32) {
+            for (int x = 0; x < BENCH_WIDTH; x++)
+                row[x] = 0x2B5797;
+            continue;
+        }
+
+        int text_line = (y % 18) < 13;
+        int x = 0;
+        while (x < BENCH_WIDTH) {
+
+            int length = 1 + bench_random() % 6;
+            if (x + length > BENCH_WIDTH)
+                length = BENCH_WIDTH - x;
+
+            /* Glyph strokes are one of 16 anti-aliased shades of grey */
+            uint32_t color = 0xFFFFFF;
+            if (text_line && x > 40 && x < 1400 && bench_random() % 3 == 0)
+                color = 0x111111 * (bench_random() % 16);
+
+            for (int i = 0; i < length; i++)
+                row[x++] = color;
+
+        }
+
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+
+}
+
+/**
+ * Allocates a synthetic RGB24 frame resembling a photographic desktop
+ * background, which uses far more than 256 colors.
+ */
+static cairo_surface_t* bench_create_photo_frame(void) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            BENCH_WIDTH, BENCH_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < BENCH_HEIGHT; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (int x = 0; x < BENCH_WIDTH; x++) {
+            uint32_t noise = bench_random() % 8;
+            row[x] = (((x * 255 / BENCH_WIDTH) + noise) << 16)
+                   | (((y * 255 / BENCH_HEIGHT) + noise) << 8)
+                   | ((128 + noise) & 0xFF);
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+
+}
+
+/**
+ * Allocates a copy of the given region of the given RGB24 surface.
+ */
+static cairo_surface_t* bench_create_region(cairo_surface_t* source,
+        int x, int y, int width, int height) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            width, height);
+
+    unsigned char* src = cairo_image_surface_get_data(source);
+    int src_stride = cairo_image_surface_get_stride(source);
+    unsigned char* dst = cairo_image_surface_get_data(surface);
+    int dst_stride = cairo_image_surface_get_stride(surface);
+
+    for (int row = 0; row < height; row++)
+        memcpy(dst + row * dst_stride, src + (y + row) * src_stride + x * 4,
+                width * 4);
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+
+}
+
+/**
+ * Benchmarks all encoders against the given frame, printing one line of
+ * results.
+ */
+static void bench_frame(const char* name, cairo_surface_t* surface,
+        guac_socket* socket, bench_sink* sink) {
+
+    printf("%-24.24s %5ix%-5i", name,
+            cairo_image_surface_get_width(surface),
+            cairo_image_surface_get_height(surface));
+
+    bench_png(bench_png_write_legacy, socket, sink, surface);
+    bench_png(bench_png_write_fast, socket, sink, surface);
+    bench_png(bench_png_write_max, socket, sink, surface);
+
+    printf("\n");
+    fflush(stdout);
+
+}
+
+int main(int argc, char** argv) {
+
+    bench_sink sink = { .fd = open("/dev/null", O_WRONLY) };
+    if (sink.fd < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &sink;
+    socket->write_handler = bench_sink_write_handler;
+
+    char fast[16], max[16];
+    snprintf(fast, sizeof(fast), "Level %i", GUAC_PNG_MIN_LEVEL);
+    snprintf(max, sizeof(max), "Level %i", GUAC_PNG_MAX_LEVEL);
+
+    printf("%-36s %19s %19s %19s\n", "", "Previous", fast, max);
+    printf("%-36s", "Frame");
+    for (int i = 0; i < 3; i++)
+        printf(" %9s %9s", "ms", "KiB");
+    printf("\n");
+
+    cairo_surface_t* text = bench_create_text_frame();
+    cairo_surface_t* photo = bench_create_photo_frame();
+    cairo_surface_t* region = bench_create_region(text, 100, 200, 320, 64);
+
+    bench_frame("synthetic text", text, socket, &sink);
+    bench_frame("synthetic text region", region, socket, &sink);
+    bench_frame("synthetic photo", photo, socket, &sink);
+
+    cairo_surface_destroy(region);
+    cairo_surface_destroy(photo);
+    cairo_surface_destroy(text);
+
+    /* Benchmark any captured frames */
+    for (int i = 1; i < argc; i++) {
+
+        cairo_surface_t* frame = cairo_image_surface_create_from_png(argv[i]);
+        if (cairo_surface_status(frame) != CAIRO_STATUS_SUCCESS) {
+            fprintf(stderr, "%s: cannot read PNG\n", argv[i]);
+            cairo_surface_destroy(frame);
+            continue;
+        }
+
+        const char* name = strrchr(argv[i], '/');
+        bench_frame(name != NULL ? name + 1 : argv[i], frame, socket, &sink);
+        cairo_surface_destroy(frame);
+
+    }
+
+    guac_socket_free(socket);
+    close(sink.fd);
+    return 0;
+
+}
+
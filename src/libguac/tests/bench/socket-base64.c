@@ -0,0 +1,220 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Microbenchmark of the base64 encoding performed for every blob, image, and
+ * audio packet sent by guac_protocol_send_blob(). Blobs of several sizes are
+ * encoded using both the portable implementation of guac_base64_encode() and
+ * the implementation selected for the current CPU, and are then written to a
+ * file descriptor socket (writing to /dev/null) both through
+ * guac_socket_write_base64() and through a model of the previous 768-byte
+ * staging buffer, which encoded one group at a time and took the socket lock
+ * for every 1 KB of output.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_socket_base64 [MEGABYTES]
+ */
+
+#include "base64.h"
+
+#include <guacamole/socket.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The number of megabytes of data to encode for each blob size if no amount
+ * is given on the command line.
+ */
+#define BENCH_DEFAULT_MEGABYTES 256
+
+/**
+ * The size of the staging buffer used by the previous implementation of
+ * guac_socket_write_base64(), in bytes.
+ */
+#define BENCH_LEGACY_READY_SIZE 768
+
+/**
+ * All blob sizes benchmarked, in bytes. The smallest is typical of audio
+ * packets, while the largest are typical of image updates.
+ */
+static const size_t bench_blob_sizes[] = { 1024, 6144, 65536, 1048576 };
+
+/**
+ * Signature of the guac_base64_encode() implementations being compared.
+ */
+typedef size_t bench_encode_function(const void* restrict data, size_t length,
+        char* restrict encoded);
+
+/**
+ * Signature of the functions which write blobs as base64 to a socket.
+ */
+typedef void bench_write_function(guac_socket* socket,
+        const unsigned char* data, size_t length);
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Writes the given blob to the given socket as base64 using
+ * guac_socket_write_base64().
+ */
+static void bench_write_current(guac_socket* socket,
+        const unsigned char* data, size_t length) {
+    guac_socket_write_base64(socket, data, length);
+    guac_socket_flush_base64(socket);
+}
+
+/**
+ * Writes the given blob to the given socket as base64 in the same manner as
+ * the previous implementation of guac_socket_write_base64(), copying the blob
+ * through a 768-byte staging buffer, encoding each staged block one group at
+ * a time, and writing the encoded result of each block separately.
+ */
+static void bench_write_legacy(guac_socket* socket,
+        const unsigned char* data, size_t length) {
+
+    unsigned char ready[BENCH_LEGACY_READY_SIZE];
+    char encoded[GUAC_BASE64_ENCODED_LENGTH(BENCH_LEGACY_READY_SIZE)];
+
+    while (length > 0) {
+
+        size_t block = length;
+        if (block > sizeof(ready))
+            block = sizeof(ready);
+
+        for (size_t i = 0; i < block; i++)
+            ready[i] = data[i];
+
+        guac_socket_write(socket, encoded,
+                guac_base64_encode_portable(ready, block, encoded));
+
+        data += block;
+        length -= block;
+
+    }
+
+}
+
+/**
+ * Encodes the given blob repeatedly using the given implementation until the
+ * given total number of bytes have been encoded, returning the throughput
+ * achieved in megabytes of input per second.
+ */
+static double bench_encode(bench_encode_function* impl,
+        const unsigned char* data, size_t length, char* encoded,
+        size_t total) {
+
+    uint64_t start = bench_now();
+
+    for (size_t done = 0; done < total; done += length)
+        impl(data, length, encoded);
+
+    return total / 1048576.0 / ((bench_now() - start) / 1000000000.0);
+
+}
+
+/**
+ * Writes the given blob repeatedly to the given socket using the given
+ * function until the given total number of bytes have been written,
+ * returning the throughput achieved in megabytes of input per second.
+ */
+static double bench_write(bench_write_function* write, guac_socket* socket,
+        const unsigned char* data, size_t length, size_t total) {
+
+    uint64_t start = bench_now();
+
+    for (size_t done = 0; done < total; done += length)
+        write(socket, data, length);
+
+    guac_socket_flush(socket);
+
+    return total / 1048576.0 / ((bench_now() - start) / 1000000000.0);
+
+}
+
+int main(int argc, char** argv) {
+
+    int megabytes = BENCH_DEFAULT_MEGABYTES;
+    if (argc > 1)
+        megabytes = atoi(argv[1]);
+
+    if (megabytes <= 0) {
+        fprintf(stderr, "Usage: %s [MEGABYTES]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    guac_socket* socket = guac_socket_open(fd);
+    size_t total = (size_t) megabytes * 1048576;
+
+    printf("%-8s %14s %14s %14s %14s\n", "Blob", "Portable MB/s",
+            "Dispatch MB/s", "Legacy write", "Socket write");
+
+    for (int i = 0; i < sizeof(bench_blob_sizes) / sizeof(bench_blob_sizes[0]); i++) {
+
+        size_t length = bench_blob_sizes[i];
+
+        unsigned char* data = malloc(length);
+        char* encoded = malloc(GUAC_BASE64_ENCODED_LENGTH(length));
+
+        for (size_t j = 0; j < length; j++)
+            data[j] = j * 2654435761u >> 24;
+
+        double portable = bench_encode(guac_base64_encode_portable,
+                data, length, encoded, total);
+        double dispatch = bench_encode(guac_base64_encode,
+                data, length, encoded, total);
+        double legacy = bench_write(bench_write_legacy, socket,
+                data, length, total);
+        double current = bench_write(bench_write_current, socket,
+                data, length, total);
+
+        printf("%-8zu %14.0f %14.0f %14.0f %14.0f\n", length,
+                portable, dispatch, legacy, current);
+
+        free(encoded);
+        free(data);
+
+    }
+
+    guac_socket_free(socket);
+    return 0;
+
+}
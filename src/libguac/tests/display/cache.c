@@ -0,0 +1,166 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-cache.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/rect.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The number of bytes in each row of the tiles used by these tests.
+ */
+#define TEST_TILE_STRIDE (GUAC_DISPLAY_CACHE_TILE_SIZE * 4)
+
+/**
+ * Fills the given 64x64 tile of 32-bit image data with a pattern that is
+ * unique to the given seed.
+ *
+ * @param tile
+ *     The tile to fill.
+ *
+ * @param seed
+ *     The value determining the pattern.
+ */
+static void test_cache_fill_tile(uint32_t* tile, uint32_t seed) {
+    for (int i = 0; i < GUAC_DISPLAY_CACHE_TILE_SIZE * GUAC_DISPLAY_CACHE_TILE_SIZE; i++)
+        tile[i] = (seed * 2654435761u) ^ (i * 40503u);
+}
+
+/**
+ * Test which verifies that tiles stored within a guac_display_cache can be
+ * located by guac_display_cache_lookup(), that tiles with the same hash but
+ * different contents are not confused with each other, and that storing an
+ * identical tile twice does not duplicate it.
+ */
+void test_display__cache_lookup(void) {
+
+    static guac_display_cache cache;
+    static uint32_t tile[GUAC_DISPLAY_CACHE_TILE_SIZE * GUAC_DISPLAY_CACHE_TILE_SIZE];
+
+    guac_display_cache_init(&cache, NULL);
+    guac_display_cache_begin_frame(&cache);
+
+    test_cache_fill_tile(tile, 1);
+
+    /* Nothing is cached initially */
+    CU_ASSERT_PTR_NULL(guac_display_cache_lookup(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE));
+
+    const guac_display_cache_entry* stored = guac_display_cache_store(&cache,
+            1234, (unsigned char*) tile, TEST_TILE_STRIDE);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(stored);
+
+    /* The first tile stored occupies the upper-left corner of the buffer */
+    guac_rect rect;
+    guac_display_cache_entry_rect(&cache, stored, &rect);
+    CU_ASSERT_EQUAL(rect.left, 0);
+    CU_ASSERT_EQUAL(rect.top, 0);
+    CU_ASSERT_EQUAL(rect.right, GUAC_DISPLAY_CACHE_TILE_SIZE);
+    CU_ASSERT_EQUAL(rect.bottom, GUAC_DISPLAY_CACHE_TILE_SIZE);
+
+    /* Storing the same tile again must not require a new copy */
+    CU_ASSERT_PTR_NULL(guac_display_cache_store(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE));
+
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE), stored);
+
+    /* A tile with the same hash but different contents is a collision, not
+     * a match */
+    test_cache_fill_tile(tile, 2);
+    CU_ASSERT_PTR_NULL(guac_display_cache_lookup(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE));
+
+    /* Both colliding tiles may be cached at once */
+    const guac_display_cache_entry* collision = guac_display_cache_store(&cache,
+            1234, (unsigned char*) tile, TEST_TILE_STRIDE);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(collision);
+    CU_ASSERT_PTR_NOT_EQUAL(collision, stored);
+
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE), collision);
+
+    test_cache_fill_tile(tile, 1);
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache, 1234,
+                (unsigned char*) tile, TEST_TILE_STRIDE), stored);
+
+    CU_ASSERT_EQUAL(cache.lookups, 5);
+    CU_ASSERT_EQUAL(cache.hits, 3);
+    CU_ASSERT_EQUAL(cache.stores, 2);
+
+    guac_display_cache_destroy(&cache);
+
+}
+
+/**
+ * Test which verifies that a full guac_display_cache replaces its least
+ * recently used tile, and that tiles used during the current frame are never
+ * replaced during that same frame.
+ */
+void test_display__cache_lru(void) {
+
+    static guac_display_cache cache;
+    static uint32_t tile[GUAC_DISPLAY_CACHE_TILE_SIZE * GUAC_DISPLAY_CACHE_TILE_SIZE];
+
+    guac_display_cache_init(&cache, NULL);
+    guac_display_cache_begin_frame(&cache);
+
+    /* Fill the cache within a single frame */
+    for (int i = 0; i < GUAC_DISPLAY_CACHE_SIZE; i++) {
+        test_cache_fill_tile(tile, i);
+        CU_ASSERT_PTR_EQUAL(guac_display_cache_store(&cache, i,
+                    (unsigned char*) tile, TEST_TILE_STRIDE),
+                &cache.entries[i]);
+    }
+
+    /* All tiles were stored during the current frame, and so the cache is
+     * effectively full until the next frame */
+    test_cache_fill_tile(tile, GUAC_DISPLAY_CACHE_SIZE);
+    CU_ASSERT_PTR_NULL(guac_display_cache_store(&cache, GUAC_DISPLAY_CACHE_SIZE,
+                (unsigned char*) tile, TEST_TILE_STRIDE));
+
+    /* Use the oldest tile, such that the second-oldest tile is now the least
+     * recently used */
+    guac_display_cache_begin_frame(&cache);
+    test_cache_fill_tile(tile, 0);
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache, 0,
+                (unsigned char*) tile, TEST_TILE_STRIDE), &cache.entries[0]);
+
+    /* The second-oldest tile is replaced by the next tile stored */
+    test_cache_fill_tile(tile, GUAC_DISPLAY_CACHE_SIZE);
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_store(&cache, GUAC_DISPLAY_CACHE_SIZE,
+                (unsigned char*) tile, TEST_TILE_STRIDE), &cache.entries[1]);
+
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache,
+                GUAC_DISPLAY_CACHE_SIZE, (unsigned char*) tile,
+                TEST_TILE_STRIDE), &cache.entries[1]);
+
+    test_cache_fill_tile(tile, 1);
+    CU_ASSERT_PTR_NULL(guac_display_cache_lookup(&cache, 1,
+                (unsigned char*) tile, TEST_TILE_STRIDE));
+
+    test_cache_fill_tile(tile, 0);
+    CU_ASSERT_PTR_EQUAL(guac_display_cache_lookup(&cache, 0,
+                (unsigned char*) tile, TEST_TILE_STRIDE), &cache.entries[0]);
+
+    guac_display_cache_destroy(&cache);
+
+}
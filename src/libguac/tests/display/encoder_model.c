@@ -0,0 +1,141 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-encoder.h"
+
+#include <CUnit/CUnit.h>
+#include <stdint.h>
+
+/**
+ * Bitwise OR of all encoders, for tests where every encoder is a candidate.
+ */
+#define TEST_ALL_ENCODERS (                  \
+        (1 << GUAC_DISPLAY_ENCODER_PNG)      \
+      | (1 << GUAC_DISPLAY_ENCODER_JPEG)     \
+      | (1 << GUAC_DISPLAY_ENCODER_WEBP))
+
+/**
+ * Test which verifies that guac_display_encoder_model_select() uses the
+ * preferred encoder when the frame budget allows, and falls back to the
+ * fastest acceptable encoder (at reduced quality, if lossy) when it does not.
+ */
+void test_display__encoder_model_budget(void) {
+
+    guac_display_encoder_model model;
+    guac_display_encoder_model_init(&model);
+
+    guac_display_encoder_choice choice;
+    size_t pixels = 1920 * 1080;
+
+    /* Frames arriving one second apart leave plenty of time for PNG */
+    guac_display_encoder_model_begin_frame(&model, 1000, pixels, 1);
+    guac_display_encoder_model_begin_frame(&model, 2000, pixels, 1);
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_PNG);
+    CU_ASSERT_EQUAL(choice.quality, 90);
+    CU_ASSERT_EQUAL(choice.budget, GUAC_DISPLAY_ENCODER_MAX_FRAME_BUDGET);
+
+    /* Frames arriving 10ms apart leave time only for the fastest encoder,
+     * which must also sacrifice quality */
+    guac_display_encoder_model_begin_frame(&model, 2010, pixels, 1);
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 0,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_JPEG);
+    CU_ASSERT(choice.quality < 90);
+    CU_ASSERT(choice.quality >= GUAC_DISPLAY_ENCODER_MIN_QUALITY);
+    CU_ASSERT_EQUAL(choice.budget, 10000000);
+
+    /* The fallback must remain lossless if lossless encoding is preferred */
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_PNG);
+    CU_ASSERT_EQUAL(choice.quality, 90);
+
+    /* ... or if the content is flat, even if lossy encoding is preferred */
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 0,
+            GUAC_DISPLAY_CONTENT_FLAT, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_PNG);
+
+    /* ... though the fastest lossless encoder is used if there are several */
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS,
+            1 << GUAC_DISPLAY_ENCODER_WEBP, 1,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_WEBP);
+
+    /* Lossless encoding must still be possible if JPEG is not a candidate */
+    guac_display_encoder_model_select(&model, 0, 0, 1,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_PNG);
+
+    /* Operations receive a share of the budget proportional to their number
+     * of changed pixels */
+    guac_display_encoder_model_begin_frame(&model, 2110, 4000, 1);
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_FLAT, 4096, 1000, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.budget, 25000000);
+
+    guac_display_encoder_model_destroy(&model);
+
+}
+
+/**
+ * Test which verifies that guac_display_encoder_model_record() updates the
+ * predicted cost of an encoder toward the timings actually observed.
+ */
+void test_display__encoder_model_learning(void) {
+
+    guac_display_encoder_model model;
+    guac_display_encoder_model_init(&model);
+
+    guac_display_encoder_choice choice;
+    size_t pixels = 64 * 64;
+
+    guac_display_encoder_model_begin_frame(&model, 1000, pixels, 1);
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_FLAT, pixels, pixels, 90, &choice);
+
+    CU_ASSERT_EQUAL(choice.encoder, GUAC_DISPLAY_ENCODER_PNG);
+
+    /* Report PNG as costing exactly 100ns per pixel, many times over */
+    for (int i = 0; i < 100; i++)
+        guac_display_encoder_model_record(&model, &choice, pixels * 100);
+
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_FLAT, pixels, pixels, 90, &choice);
+
+    CU_ASSERT(choice.predicted[GUAC_DISPLAY_ENCODER_PNG] >= pixels * 99);
+    CU_ASSERT(choice.predicted[GUAC_DISPLAY_ENCODER_PNG] <= pixels * 101);
+
+    /* Other encoders and content classes must be unaffected */
+    guac_display_encoder_model_select(&model, TEST_ALL_ENCODERS, 0, 1,
+            GUAC_DISPLAY_CONTENT_PHOTO, pixels, pixels, 90, &choice);
+
+    CU_ASSERT(choice.predicted[GUAC_DISPLAY_ENCODER_PNG] < pixels * 99);
+
+    guac_display_encoder_model_destroy(&model);
+
+}
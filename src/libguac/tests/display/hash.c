@@ -0,0 +1,405 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-plan.h"
+#include "display-priv.h"
+#include "guacamole/mem.h"
+
+#include <CUnit/CUnit.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The width of each test image, in pixels. This is deliberately neither a
+ * multiple of the cell size nor of any SIMD vector width.
+ */
+#define TEST_HASH_WIDTH (GUAC_DISPLAY_CELL_SIZE * 4 + 21)
+
+/**
+ * The height of each test image, in pixels.
+ */
+#define TEST_HASH_HEIGHT (GUAC_DISPLAY_CELL_SIZE * 2 + 13)
+
+/**
+ * The number of rows by which the scrolled test image is scrolled.
+ */
+#define TEST_HASH_SCROLL 23
+
+/**
+ * The number of horizontal positions of a 64x64 window within a test image.
+ */
+#define TEST_HASH_WINDOWS_X (TEST_HASH_WIDTH - GUAC_DISPLAY_CELL_SIZE + 1)
+
+/**
+ * The number of vertical positions of a 64x64 window within a test image.
+ */
+#define TEST_HASH_WINDOWS_Y (TEST_HASH_HEIGHT - GUAC_DISPLAY_CELL_SIZE + 1)
+
+/**
+ * Returns a pseudo-random 32-bit pixel value, covering all 32 bits
+ * regardless of RAND_MAX.
+ *
+ * @return
+ *     A pseudo-random 32-bit value.
+ */
+static uint32_t test_hash_random_pixel(void) {
+    return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+
+/**
+ * Fills the given image with pseudo-random pixels.
+ *
+ * @param image
+ *     The image to fill, which must be TEST_HASH_WIDTH x TEST_HASH_HEIGHT
+ *     pixels with no padding between rows.
+ */
+static void test_hash_fill_random(uint32_t* image) {
+    for (int i = 0; i < TEST_HASH_WIDTH * TEST_HASH_HEIGHT; i++)
+        image[i] = test_hash_random_pixel();
+}
+
+/**
+ * Hashes every 64x64 window of the given image using the original
+ * sliding-window algorithm, in which each row segment hash is updated one
+ * pixel at a time as it slides across the row, and each column hash is
+ * updated one row segment hash at a time as it slides down the image. Only
+ * GUAC_DISPLAY_HASH_STEP() is used, such that the result does not depend on
+ * any of the optimizations being tested.
+ *
+ * @param image
+ *     The image to hash, which must be TEST_HASH_WIDTH x TEST_HASH_HEIGHT
+ *     pixels with no padding between rows.
+ *
+ * @param hashes
+ *     Storage for the hash of each window, indexed as
+ *     hashes[y][x] for the window whose upper-left corner is at (x, y).
+ */
+static void test_hash_sliding_window(const uint32_t* image,
+        uint64_t hashes[TEST_HASH_WINDOWS_Y][TEST_HASH_WINDOWS_X]) {
+
+    uint64_t column_hash[TEST_HASH_WINDOWS_X] = { 0 };
+
+    for (int y = 0; y < TEST_HASH_HEIGHT; y++) {
+
+        const uint32_t* row = image + y * TEST_HASH_WIDTH;
+
+        uint64_t row_hash = 0;
+        for (int x = 0; x < TEST_HASH_WIDTH; x++) {
+
+            row_hash = GUAC_DISPLAY_HASH_STEP(row_hash, row[x]);
+
+            int window_x = x - GUAC_DISPLAY_CELL_SIZE + 1;
+            if (window_x >= 0)
+                column_hash[window_x] = GUAC_DISPLAY_HASH_STEP(
+                        column_hash[window_x], row_hash);
+
+        }
+
+        int window_y = y - GUAC_DISPLAY_CELL_SIZE + 1;
+        if (window_y >= 0)
+            memcpy(hashes[window_y], column_hash, sizeof(column_hash));
+
+    }
+
+}
+
+/**
+ * Returns the hash of the 64-pixel row segment starting at the given pixel,
+ * computed one pixel at a time using GUAC_DISPLAY_HASH_STEP().
+ *
+ * @param row
+ *     The first of the 64 pixels to hash.
+ *
+ * @return
+ *     The hash of the given row segment.
+ */
+static uint64_t test_hash_row_segment(const uint32_t* row) {
+
+    uint64_t hash = 0;
+    for (int x = 0; x < GUAC_DISPLAY_CELL_SIZE; x++)
+        hash = GUAC_DISPLAY_HASH_STEP(hash, row[x]);
+
+    return hash;
+
+}
+
+/**
+ * Initializes the given layer such that its last frame is the given image,
+ * with no cached row segment hashes.
+ *
+ * @param layer
+ *     The layer to initialize.
+ *
+ * @param image
+ *     The image to use as the last frame of the layer, which must be
+ *     TEST_HASH_WIDTH x TEST_HASH_HEIGHT pixels with no padding between rows.
+ */
+static void test_hash_init_layer(guac_display_layer* layer, uint32_t* image) {
+    memset(layer, 0, sizeof(guac_display_layer));
+    layer->last_frame.buffer = (unsigned char*) image;
+    layer->last_frame.buffer_width = TEST_HASH_WIDTH;
+    layer->last_frame.buffer_height = TEST_HASH_HEIGHT;
+    layer->last_frame.buffer_stride = TEST_HASH_WIDTH * sizeof(uint32_t);
+}
+
+/**
+ * Verifies that every cached row segment hash of the given layer matches the
+ * hash of the corresponding row segment computed one pixel at a time.
+ *
+ * @param layer
+ *     The layer whose cached row segment hashes should be verified.
+ *
+ * @param image
+ *     The image that is the last frame of the layer.
+ */
+static void test_hash_verify_row_cache(const guac_display_layer* layer,
+        const uint32_t* image) {
+
+    int cells_width = TEST_HASH_WIDTH / GUAC_DISPLAY_CELL_SIZE;
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(layer->last_frame_row_hashes);
+    CU_ASSERT_EQUAL_FATAL(layer->last_frame_row_hashes_width, cells_width);
+    CU_ASSERT_EQUAL_FATAL(layer->last_frame_row_hashes_height, TEST_HASH_HEIGHT);
+
+    for (int y = 0; y < TEST_HASH_HEIGHT; y++) {
+        for (int cell = 0; cell < cells_width; cell++) {
+            const uint32_t* segment = image + y * TEST_HASH_WIDTH
+                + cell * GUAC_DISPLAY_CELL_SIZE;
+            CU_ASSERT_EQUAL(layer->last_frame_row_hashes[y * cells_width + cell],
+                    test_hash_row_segment(segment));
+        }
+    }
+
+}
+
+/**
+ * Verifies that combining the cached row segment hashes of the given layer
+ * using guac_display_hash_update_columns(), as is done when searching for
+ * vertically-scrolled content, produces the same hash for every cell-aligned
+ * 64x64 window as the given reference hashes.
+ *
+ * @param layer
+ *     The layer whose cached row segment hashes should be combined.
+ *
+ * @param hashes
+ *     The reference hash of each 64x64 window of the layer's last frame, as
+ *     produced by test_hash_sliding_window().
+ */
+static void test_hash_verify_aligned_windows(const guac_display_layer* layer,
+        uint64_t hashes[TEST_HASH_WINDOWS_Y][TEST_HASH_WINDOWS_X]) {
+
+    int cells_width = layer->last_frame_row_hashes_width;
+    uint64_t column_hash[TEST_HASH_WIDTH / GUAC_DISPLAY_CELL_SIZE] = { 0 };
+
+    for (int y = 0; y < TEST_HASH_HEIGHT; y++) {
+
+        guac_display_hash_update_columns(column_hash,
+                layer->last_frame_row_hashes + y * cells_width, cells_width);
+
+        int window_y = y - GUAC_DISPLAY_CELL_SIZE + 1;
+        if (window_y < 0)
+            continue;
+
+        for (int cell = 0; cell < cells_width; cell++)
+            CU_ASSERT_EQUAL(column_hash[cell],
+                    hashes[window_y][cell * GUAC_DISPLAY_CELL_SIZE]);
+
+    }
+
+}
+
+/**
+ * Test which verifies that GUAC_DISPLAY_HASH_FACTOR_16 is 62^16 modulo 2^64,
+ * and that 62^64 modulo 2^64 is zero, such that the influence of a value on
+ * the hash vanishes after exactly 64 steps.
+ */
+void test_display__hash_factor(void) {
+
+    uint64_t factor = 1;
+    for (int i = 0; i < 16; i++)
+        factor *= 62;
+
+    CU_ASSERT_EQUAL(factor, GUAC_DISPLAY_HASH_FACTOR_16);
+    CU_ASSERT_EQUAL(factor, UINT64_C(0xE83050A9DE010000));
+
+    /* Sixteen steps of a hash starting at 1 must match the factor */
+    uint64_t hash = 1;
+    for (int i = 0; i < 16; i++)
+        hash = GUAC_DISPLAY_HASH_STEP(hash, 0);
+
+    CU_ASSERT_EQUAL(hash, GUAC_DISPLAY_HASH_FACTOR_16);
+
+    /* 62^64 = (62^16)^4 */
+    CU_ASSERT_EQUAL(factor * factor * factor * factor, 0);
+
+}
+
+/**
+ * Test which verifies that guac_display_hash_cell(), which hashes each row
+ * segment as four independent runs of 16 pixels, produces the same hash as
+ * the original sliding-window algorithm for every possible position of a
+ * 64x64 window within a random image, aligned or not.
+ */
+void test_display__hash_cell(void) {
+
+    uint32_t* image = guac_mem_alloc(sizeof(uint32_t),
+            TEST_HASH_WIDTH, TEST_HASH_HEIGHT);
+
+    uint64_t (*hashes)[TEST_HASH_WINDOWS_X] = guac_mem_alloc(sizeof(uint64_t),
+            TEST_HASH_WINDOWS_X, TEST_HASH_WINDOWS_Y);
+
+    srand(0x5EED);
+    test_hash_fill_random(image);
+    test_hash_sliding_window(image, hashes);
+
+    size_t stride = TEST_HASH_WIDTH * sizeof(uint32_t);
+    for (int y = 0; y < TEST_HASH_WINDOWS_Y; y++) {
+        for (int x = 0; x < TEST_HASH_WINDOWS_X; x++) {
+            const unsigned char* data = (const unsigned char*)
+                (image + y * TEST_HASH_WIDTH + x);
+            CU_ASSERT_EQUAL(guac_display_hash_cell(data, stride), hashes[y][x]);
+        }
+    }
+
+    guac_mem_free(hashes);
+    guac_mem_free(image);
+
+}
+
+/**
+ * Test which verifies that guac_display_hash_update_columns(), which may use
+ * AVX2 instructions, produces identical results to the portable
+ * implementation and to GUAC_DISPLAY_HASH_STEP() for all lengths, including
+ * lengths that are not a multiple of the vector width.
+ */
+void test_display__hash_update_columns(void) {
+
+    uint64_t row_hash[37];
+    uint64_t column_hash[37];
+    uint64_t portable_hash[37];
+    uint64_t expected_hash[37];
+
+    srand(0x5EED);
+
+    for (int length = 0; length <= 37; length++) {
+
+        for (int i = 0; i < 37; i++) {
+            row_hash[i] = ((uint64_t) test_hash_random_pixel() << 32)
+                | test_hash_random_pixel();
+            column_hash[i] = portable_hash[i] = expected_hash[i] =
+                ((uint64_t) test_hash_random_pixel() << 32)
+                | test_hash_random_pixel();
+        }
+
+        for (int i = 0; i < length; i++)
+            expected_hash[i] = GUAC_DISPLAY_HASH_STEP(expected_hash[i], row_hash[i]);
+
+        guac_display_hash_update_columns(column_hash, row_hash, length);
+        guac_display_hash_update_columns_portable(portable_hash, row_hash, length);
+
+        /* Entries beyond the given length must not be touched */
+        for (int i = 0; i < 37; i++) {
+            CU_ASSERT_EQUAL(column_hash[i], expected_hash[i]);
+            CU_ASSERT_EQUAL(portable_hash[i], expected_hash[i]);
+        }
+
+    }
+
+}
+
+/**
+ * Test which verifies that the cached row segment hashes of a layer match the
+ * original sliding-window hashes, both when first computed and after only a
+ * stale region is rehashed, and that combining those cached hashes detects
+ * content that has been scrolled vertically.
+ */
+void test_display__hash_row_cache(void) {
+
+    uint32_t* image = guac_mem_alloc(sizeof(uint32_t),
+            TEST_HASH_WIDTH, TEST_HASH_HEIGHT);
+
+    uint32_t* original = guac_mem_alloc(sizeof(uint32_t),
+            TEST_HASH_WIDTH, TEST_HASH_HEIGHT);
+
+    uint64_t (*hashes)[TEST_HASH_WINDOWS_X] = guac_mem_alloc(sizeof(uint64_t),
+            TEST_HASH_WINDOWS_X, TEST_HASH_WINDOWS_Y);
+
+    guac_display_layer* layer = guac_mem_alloc(sizeof(guac_display_layer));
+    test_hash_init_layer(layer, image);
+
+    srand(0x5EED);
+    test_hash_fill_random(image);
+
+    /* Initial population of the cache rehashes everything */
+    LFW_guac_display_layer_update_row_hashes(layer);
+    test_hash_verify_row_cache(layer, image);
+
+    test_hash_sliding_window(image, hashes);
+    test_hash_verify_aligned_windows(layer, hashes);
+
+    /* Only the stale region (which spans a cell boundary) is rehashed */
+    guac_rect modified;
+    guac_rect_init(&modified, GUAC_DISPLAY_CELL_SIZE - 5, 30, 10, 7);
+    for (int y = modified.top; y < modified.bottom; y++) {
+        for (int x = modified.left; x < modified.right; x++)
+            image[y * TEST_HASH_WIDTH + x] = test_hash_random_pixel();
+    }
+
+    layer->last_frame_row_hashes_stale = modified;
+    LFW_guac_display_layer_update_row_hashes(layer);
+    test_hash_verify_row_cache(layer, image);
+    CU_ASSERT_TRUE(guac_rect_is_empty(&layer->last_frame_row_hashes_stale));
+
+    /* Scroll the image up, exposing new random content at the bottom */
+    memcpy(original, image, sizeof(uint32_t) * TEST_HASH_WIDTH * TEST_HASH_HEIGHT);
+    memmove(image, image + TEST_HASH_SCROLL * TEST_HASH_WIDTH, sizeof(uint32_t)
+            * TEST_HASH_WIDTH * (TEST_HASH_HEIGHT - TEST_HASH_SCROLL));
+
+    for (int i = (TEST_HASH_HEIGHT - TEST_HASH_SCROLL) * TEST_HASH_WIDTH;
+            i < TEST_HASH_WIDTH * TEST_HASH_HEIGHT; i++)
+        image[i] = test_hash_random_pixel();
+
+    guac_rect_init(&layer->last_frame_row_hashes_stale, 0, 0,
+            TEST_HASH_WIDTH, TEST_HASH_HEIGHT);
+    LFW_guac_display_layer_update_row_hashes(layer);
+    test_hash_verify_row_cache(layer, image);
+
+    test_hash_sliding_window(image, hashes);
+    test_hash_verify_aligned_windows(layer, hashes);
+
+    /* Every aligned window of the scrolled image that does not include the
+     * newly-exposed rows has the same hash as the corresponding window of the
+     * original image, which is how the scroll is detected */
+    size_t stride = TEST_HASH_WIDTH * sizeof(uint32_t);
+    for (int y = 0; y < TEST_HASH_WINDOWS_Y - TEST_HASH_SCROLL; y++) {
+        for (int x = 0; x < TEST_HASH_WINDOWS_X; x += GUAC_DISPLAY_CELL_SIZE) {
+            const unsigned char* data = (const unsigned char*)
+                (original + (y + TEST_HASH_SCROLL) * TEST_HASH_WIDTH + x);
+            CU_ASSERT_EQUAL(hashes[y][x], guac_display_hash_cell(data, stride));
+        }
+    }
+
+    guac_mem_free(layer->last_frame_row_hashes);
+    guac_mem_free(layer);
+    guac_mem_free(hashes);
+    guac_mem_free(original);
+    guac_mem_free(image);
+
+}
@@ -0,0 +1,116 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-plan.h"
+
+#include <CUnit/CUnit.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The number of 32-bit quantities in each buffer compared by these tests.
+ * This is deliberately not a multiple of any SIMD vector width, such that
+ * trailing quantities are also exercised.
+ */
+#define TEST_MEMCMP_LENGTH 75
+
+/**
+ * Test which verifies that guac_display_memcmp() reports no differences for
+ * identical buffers of any length, including zero.
+ */
+void test_display__memcmp_identical(void) {
+
+    uint32_t a[TEST_MEMCMP_LENGTH];
+    uint32_t b[TEST_MEMCMP_LENGTH];
+
+    for (int i = 0; i < TEST_MEMCMP_LENGTH; i++)
+        a[i] = b[i] = 0xFF000000 | (i * 0x010203);
+
+    for (int count = 0; count <= TEST_MEMCMP_LENGTH; count++) {
+        size_t pos = 12345;
+        CU_ASSERT_EQUAL(guac_display_memcmp(a, b, count, &pos), 0);
+        CU_ASSERT_EQUAL(pos, 12345);
+    }
+
+}
+
+/**
+ * Test which verifies that guac_display_memcmp() reports the exact location
+ * and length of the differences between two buffers for every possible pair
+ * of first/last differing positions.
+ */
+void test_display__memcmp_range(void) {
+
+    uint32_t a[TEST_MEMCMP_LENGTH];
+    uint32_t b[TEST_MEMCMP_LENGTH];
+
+    for (int first = 0; first < TEST_MEMCMP_LENGTH; first++) {
+        for (int last = first; last < TEST_MEMCMP_LENGTH; last++) {
+
+            for (int i = 0; i < TEST_MEMCMP_LENGTH; i++)
+                a[i] = b[i] = 0xFF000000 | i;
+
+            /* Differences only at the endpoints of the range */
+            b[first] ^= 0x1;
+            b[last] ^= 0x100;
+
+            size_t pos = 0;
+            size_t length = guac_display_memcmp(a, b, TEST_MEMCMP_LENGTH, &pos);
+            CU_ASSERT_EQUAL(pos, first);
+            CU_ASSERT_EQUAL(length, last - first + 1);
+
+        }
+    }
+
+}
+
+/**
+ * Test which verifies that guac_display_memcmp() produces exactly the same
+ * results as the portable implementation for randomly-modified buffers of
+ * varying length.
+ */
+void test_display__memcmp_portable(void) {
+
+    uint32_t a[TEST_MEMCMP_LENGTH];
+    uint32_t b[TEST_MEMCMP_LENGTH];
+
+    srand(0x5EED);
+
+    for (int i = 0; i < 10000; i++) {
+
+        int count = rand() % (TEST_MEMCMP_LENGTH + 1);
+        for (int j = 0; j < count; j++)
+            a[j] = b[j] = rand();
+
+        /* Introduce zero or more random differences */
+        int changes = count ? rand() % 4 : 0;
+        for (int j = 0; j < changes; j++)
+            b[rand() % count] ^= 0x00FFFFFF;
+
+        size_t expected_pos = 0, pos = 0;
+        size_t expected = guac_display_memcmp_portable(a, b, count, &expected_pos);
+        size_t length = guac_display_memcmp(a, b, count, &pos);
+
+        CU_ASSERT_EQUAL(length, expected);
+        if (expected)
+            CU_ASSERT_EQUAL(pos, expected_pos);
+
+    }
+
+}
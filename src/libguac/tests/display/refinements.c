@@ -0,0 +1,505 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "display-plan.h"
+#include "display-priv.h"
+#include "guacamole/mem.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/fifo.h>
+#include <guacamole/layer.h>
+#include <guacamole/rect.h>
+#include <stdlib.h>
+
+/**
+ * Asserts that the two given rectangles have identical bounds.
+ *
+ * @param actual
+ *     The rectangle produced by the code under test.
+ *
+ * @param left
+ *     The expected left edge.
+ *
+ * @param top
+ *     The expected top edge.
+ *
+ * @param right
+ *     The expected right edge.
+ *
+ * @param bottom
+ *     The expected bottom edge.
+ */
+static void test_refinements_assert_rect(const guac_rect* actual,
+        int left, int top, int right, int bottom) {
+    CU_ASSERT_EQUAL(actual->left, left);
+    CU_ASSERT_EQUAL(actual->top, top);
+    CU_ASSERT_EQUAL(actual->right, right);
+    CU_ASSERT_EQUAL(actual->bottom, bottom);
+}
+
+/**
+ * Returns the area of the given rectangle, in pixels.
+ *
+ * @param rect
+ *     The rectangle whose area should be returned.
+ *
+ * @return
+ *     The area of the given rectangle.
+ */
+static int test_refinements_area(const guac_rect* rect) {
+    return guac_rect_width(rect) * guac_rect_height(rect);
+}
+
+/**
+ * Asserts that the given parts are exactly the portion of the given
+ * rectangle that lies outside the given hole: each part is non-empty, lies
+ * within the rectangle, does not intersect the hole or any other part, and
+ * the parts together cover the area of the rectangle that the hole does not.
+ *
+ * @param rect
+ *     The rectangle that was divided.
+ *
+ * @param hole
+ *     The rectangle that was removed.
+ *
+ * @param parts
+ *     The parts produced by guac_display_rect_subtract().
+ *
+ * @param count
+ *     The number of parts.
+ */
+static void test_refinements_assert_parts(const guac_rect* rect,
+        const guac_rect* hole, const guac_rect* parts, int count) {
+
+    guac_rect overlap = *hole;
+    guac_rect_constrain(&overlap, rect);
+
+    int expected_area = test_refinements_area(rect);
+    if (!guac_rect_is_empty(&overlap))
+        expected_area -= test_refinements_area(&overlap);
+
+    int area = 0;
+    for (int i = 0; i < count; i++) {
+
+        CU_ASSERT_FALSE(guac_rect_is_empty(&parts[i]));
+        CU_ASSERT_TRUE(parts[i].left >= rect->left && parts[i].right <= rect->right);
+        CU_ASSERT_TRUE(parts[i].top >= rect->top && parts[i].bottom <= rect->bottom);
+        CU_ASSERT_FALSE(guac_rect_intersects(&parts[i], hole));
+
+        for (int j = i + 1; j < count; j++)
+            CU_ASSERT_FALSE(guac_rect_intersects(&parts[i], &parts[j]));
+
+        area += test_refinements_area(&parts[i]);
+
+    }
+
+    CU_ASSERT_EQUAL(area, expected_area);
+
+}
+
+/**
+ * Allocates a display containing only what PFR_LFW_guac_display_preempt_refinements()
+ * requires: the operation FIFO (for its lock) and the list of pending
+ * refinements, initially empty.
+ *
+ * @return
+ *     A newly-allocated display, which must be freed with
+ *     test_refinements_free_display().
+ */
+static guac_display* test_refinements_alloc_display(void) {
+    guac_display* display = guac_mem_zalloc(sizeof(guac_display));
+    guac_fifo_init(&display->ops, display->ops_items,
+            GUAC_DISPLAY_WORKER_FIFO_SIZE, sizeof(guac_display_plan_operation));
+    return display;
+}
+
+/**
+ * Frees a display allocated by test_refinements_alloc_display().
+ *
+ * @param display
+ *     The display to free.
+ */
+static void test_refinements_free_display(guac_display* display) {
+    guac_fifo_destroy(&display->ops);
+    guac_mem_free(display);
+}
+
+/**
+ * Appends a refinement of the given region of the given layer to the
+ * pending refinements of the given display.
+ *
+ * @param display
+ *     The display to add the refinement to.
+ *
+ * @param layer
+ *     The layer that the refinement applies to.
+ *
+ * @param x
+ *     The X coordinate of the upper-left corner of the refined region.
+ *
+ * @param y
+ *     The Y coordinate of the upper-left corner of the refined region.
+ *
+ * @param width
+ *     The width of the refined region.
+ *
+ * @param height
+ *     The height of the refined region.
+ */
+static void test_refinements_add(guac_display* display,
+        guac_display_layer* layer, int x, int y, int width, int height) {
+
+    guac_display_plan_operation* refinement =
+        &display->refinements[display->refinement_count++];
+
+    *refinement = (guac_display_plan_operation) {
+        .layer = layer,
+        .type = GUAC_DISPLAY_PLAN_OPERATION_IMG,
+        .dirty_size = (size_t) width * height
+    };
+
+    guac_rect_init(&refinement->dest, x, y, width, height);
+
+}
+
+/**
+ * Initializes the given plan such that it contains only the given
+ * operations.
+ *
+ * @param plan
+ *     The plan to initialize.
+ *
+ * @param ops
+ *     The operations of the plan.
+ *
+ * @param length
+ *     The number of operations.
+ */
+static void test_refinements_init_plan(guac_display_plan* plan,
+        guac_display_plan_operation* ops, size_t length) {
+    plan->ops = ops;
+    plan->length = length;
+}
+
+/**
+ * Test which verifies that guac_display_rect_subtract() produces no parts
+ * when the hole covers the rectangle entirely, and the entire rectangle when
+ * the hole does not intersect it at all.
+ */
+void test_display__rect_subtract_cover(void) {
+
+    guac_rect rect, hole;
+    guac_rect parts[4];
+    guac_rect_init(&rect, 64, 64, 128, 64);
+
+    /* Identical */
+    CU_ASSERT_EQUAL(guac_display_rect_subtract(&rect, &rect, parts), 0);
+
+    /* Larger on all sides */
+    guac_rect_init(&hole, 0, 0, 256, 256);
+    CU_ASSERT_EQUAL(guac_display_rect_subtract(&rect, &hole, parts), 0);
+
+    /* Disjoint, including merely touching */
+    guac_rect_init(&hole, 192, 64, 64, 64);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 1);
+    test_refinements_assert_rect(&parts[0], 64, 64, 192, 128);
+
+}
+
+/**
+ * Test which verifies that guac_display_rect_subtract() produces exactly the
+ * expected parts for a hole overlapping each side of the rectangle, and for a
+ * hole entirely within the rectangle.
+ */
+void test_display__rect_subtract_partial(void) {
+
+    guac_rect rect, hole;
+    guac_rect parts[4];
+    guac_rect_init(&rect, 0, 0, 100, 100);
+
+    /* Overlapping the top */
+    guac_rect_init(&hole, -10, -10, 120, 40);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 1);
+    test_refinements_assert_rect(&parts[0], 0, 30, 100, 100);
+
+    /* Overlapping the bottom */
+    guac_rect_init(&hole, -10, 70, 120, 40);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 1);
+    test_refinements_assert_rect(&parts[0], 0, 0, 100, 70);
+
+    /* Overlapping the left */
+    guac_rect_init(&hole, -10, -10, 40, 120);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 1);
+    test_refinements_assert_rect(&parts[0], 30, 0, 100, 100);
+
+    /* Overlapping the right */
+    guac_rect_init(&hole, 70, -10, 40, 120);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 1);
+    test_refinements_assert_rect(&parts[0], 0, 0, 70, 100);
+
+    /* Overlapping a corner, leaving a band below and a part to the right */
+    guac_rect_init(&hole, -10, -10, 50, 50);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 2);
+    test_refinements_assert_rect(&parts[0], 0, 40, 100, 100);
+    test_refinements_assert_rect(&parts[1], 40, 0, 100, 40);
+
+    /* Within, leaving full-width bands above and below, and the parts to the
+     * left and right between those bands */
+    guac_rect_init(&hole, 30, 30, 40, 40);
+    CU_ASSERT_EQUAL_FATAL(guac_display_rect_subtract(&rect, &hole, parts), 4);
+    test_refinements_assert_rect(&parts[0], 0, 0, 100, 30);
+    test_refinements_assert_rect(&parts[1], 0, 70, 100, 100);
+    test_refinements_assert_rect(&parts[2], 0, 30, 30, 70);
+    test_refinements_assert_rect(&parts[3], 70, 30, 100, 70);
+
+    /* Any hole leaves disjoint parts covering exactly what the hole does
+     * not */
+    srand(0x5EED);
+    for (int i = 0; i < 1000; i++) {
+        guac_rect_init(&hole, rand() % 140 - 20, rand() % 140 - 20,
+                rand() % 80 + 1, rand() % 80 + 1);
+        int count = guac_display_rect_subtract(&rect, &hole, parts);
+        CU_ASSERT_TRUE(count >= 0 && count <= 4);
+        test_refinements_assert_parts(&rect, &hole, parts, count);
+    }
+
+}
+
+/**
+ * Test which verifies that PFR_LFW_guac_display_preempt_refinements()
+ * discards refinements that are entirely replaced by the plan, and retains
+ * only the parts of partially-replaced refinements that the plan does not
+ * replace, with their dirty sizes updated accordingly.
+ */
+void test_display__preempt_refinements_overlap(void) {
+
+    guac_display* display = test_refinements_alloc_display();
+    guac_display_plan* plan = guac_mem_zalloc(sizeof(guac_display_plan));
+    guac_display_layer* layer = guac_mem_zalloc(sizeof(guac_display_layer));
+    guac_display_layer* other = guac_mem_zalloc(sizeof(guac_display_layer));
+
+    test_refinements_add(display, layer, 0, 0, 128, 128);
+    test_refinements_add(display, layer, 256, 0, 128, 128);
+    test_refinements_add(display, other, 0, 0, 128, 128);
+
+    guac_display_plan_operation ops[3] = {
+
+        /* Covers the first refinement entirely */
+        { .layer = layer, .type = GUAC_DISPLAY_PLAN_OPERATION_IMG },
+
+        /* Replaces the middle of the second refinement */
+        { .layer = layer, .type = GUAC_DISPLAY_PLAN_OPERATION_RECT },
+
+        /* Would cover the third refinement, but does nothing */
+        { .layer = other, .type = GUAC_DISPLAY_PLAN_OPERATION_NOP }
+
+    };
+
+    guac_rect_init(&ops[0].dest, 0, 0, 128, 128);
+    guac_rect_init(&ops[1].dest, 288, 32, 64, 64);
+    guac_rect_init(&ops[2].dest, 0, 0, 128, 128);
+    test_refinements_init_plan(plan, ops, 3);
+
+    PFR_LFW_guac_display_preempt_refinements(display, plan);
+
+    /* The untouched refinement of the other layer and the four parts of the
+     * second refinement remain */
+    CU_ASSERT_EQUAL_FATAL(display->refinement_count, 5);
+
+    guac_rect hole = ops[1].dest;
+    guac_rect second;
+    guac_rect_init(&second, 256, 0, 128, 128);
+
+    guac_rect parts[4];
+    int part_count = 0;
+    int other_count = 0;
+
+    for (unsigned int i = 0; i < display->refinement_count; i++) {
+
+        guac_display_plan_operation* refinement = &display->refinements[i];
+        CU_ASSERT_EQUAL(refinement->dirty_size,
+                (size_t) test_refinements_area(&refinement->dest));
+
+        if (refinement->layer == other) {
+            test_refinements_assert_rect(&refinement->dest, 0, 0, 128, 128);
+            other_count++;
+        }
+        else if (part_count < 4)
+            parts[part_count++] = refinement->dest;
+
+    }
+
+    CU_ASSERT_EQUAL(other_count, 1);
+    CU_ASSERT_EQUAL_FATAL(part_count, 4);
+    test_refinements_assert_parts(&second, &hole, parts, part_count);
+
+    guac_mem_free(other);
+    guac_mem_free(layer);
+    guac_mem_free(plan);
+    test_refinements_free_display(display);
+
+}
+
+/**
+ * Test which verifies that PFR_LFW_guac_display_preempt_refinements()
+ * retains a partially-replaced refinement in its entirety if the list of
+ * refinements has no room for its parts.
+ */
+void test_display__preempt_refinements_overflow(void) {
+
+    guac_display* display = test_refinements_alloc_display();
+    guac_display_plan* plan = guac_mem_zalloc(sizeof(guac_display_plan));
+    guac_display_layer* layer = guac_mem_zalloc(sizeof(guac_display_layer));
+    guac_display_layer* other = guac_mem_zalloc(sizeof(guac_display_layer));
+
+    /* Fill the list such that the refinement cannot be split */
+    test_refinements_add(display, layer, 0, 0, 128, 128);
+    while (display->refinement_count < GUAC_DISPLAY_MAX_REFINEMENTS)
+        test_refinements_add(display, other, 0, 0, 64, 64);
+
+    guac_display_plan_operation op = {
+        .layer = layer,
+        .type = GUAC_DISPLAY_PLAN_OPERATION_IMG
+    };
+
+    guac_rect_init(&op.dest, 32, 32, 64, 64);
+    test_refinements_init_plan(plan, &op, 1);
+
+    PFR_LFW_guac_display_preempt_refinements(display, plan);
+
+    CU_ASSERT_EQUAL(display->refinement_count, GUAC_DISPLAY_MAX_REFINEMENTS);
+    CU_ASSERT_PTR_EQUAL(display->refinements[0].layer, layer);
+    test_refinements_assert_rect(&display->refinements[0].dest, 0, 0, 128, 128);
+    CU_ASSERT_EQUAL(display->refinements[0].dirty_size, 128 * 128);
+
+    /* With room for only the parts produced by a hole overlapping one side,
+     * the refinement is split after all */
+    display->refinement_count = GUAC_DISPLAY_MAX_REFINEMENTS - 1;
+    guac_rect_init(&op.dest, 0, 0, 128, 64);
+
+    PFR_LFW_guac_display_preempt_refinements(display, plan);
+
+    CU_ASSERT_EQUAL(display->refinement_count, GUAC_DISPLAY_MAX_REFINEMENTS - 1);
+    test_refinements_assert_rect(&display->refinements[0].dest, 0, 64, 128, 128);
+    CU_ASSERT_EQUAL(display->refinements[0].dirty_size, 128 * 64);
+
+    guac_mem_free(other);
+    guac_mem_free(layer);
+    guac_mem_free(plan);
+    test_refinements_free_display(display);
+
+}
+
+/**
+ * Test which verifies that PFR_LFW_guac_display_preempt_refinements()
+ * discards all refinements of layers that have been removed, regardless of
+ * whether there is a plan, while retaining those of other layers.
+ */
+void test_display__preempt_refinements_removed_layers(void) {
+
+    guac_display* display = test_refinements_alloc_display();
+    guac_display_layer* removed_a = guac_mem_zalloc(sizeof(guac_display_layer));
+    guac_display_layer* removed_b = guac_mem_zalloc(sizeof(guac_display_layer));
+    guac_display_layer* kept = guac_mem_zalloc(sizeof(guac_display_layer));
+
+    removed_a->next_removed = removed_b;
+    display->pending_frame_removed_layers = removed_a;
+
+    test_refinements_add(display, removed_a, 0, 0, 64, 64);
+    test_refinements_add(display, kept, 0, 0, 64, 64);
+    test_refinements_add(display, removed_b, 64, 0, 64, 64);
+    test_refinements_add(display, removed_a, 128, 0, 64, 64);
+
+    PFR_LFW_guac_display_preempt_refinements(display, NULL);
+
+    CU_ASSERT_EQUAL_FATAL(display->refinement_count, 1);
+    CU_ASSERT_PTR_EQUAL(display->refinements[0].layer, kept);
+    test_refinements_assert_rect(&display->refinements[0].dest, 0, 0, 64, 64);
+
+    guac_mem_free(kept);
+    guac_mem_free(removed_b);
+    guac_mem_free(removed_a);
+    test_refinements_free_display(display);
+
+}
+
+/**
+ * Test which verifies that PFR_LFW_guac_display_preempt_refinements() turns
+ * copies whose source has not yet been refined back into image operations,
+ * such that reduced-resolution image data is never copied elsewhere, while
+ * leaving all other copies untouched.
+ */
+void test_display__preempt_refinements_copy(void) {
+
+    guac_display* display = test_refinements_alloc_display();
+    guac_display_plan* plan = guac_mem_zalloc(sizeof(guac_display_plan));
+    guac_display_layer* layer = guac_mem_zalloc(sizeof(guac_display_layer));
+    guac_display_layer* other = guac_mem_zalloc(sizeof(guac_display_layer));
+
+    guac_layer layer_buffer = { .index = -1 };
+    guac_layer other_buffer = { .index = -2 };
+    layer->last_frame_buffer = &layer_buffer;
+    other->last_frame_buffer = &other_buffer;
+
+    test_refinements_add(display, layer, 0, 0, 128, 128);
+
+    guac_display_plan_operation ops[3] = {
+
+        /* Copies from within the unrefined region */
+        { .layer = other, .type = GUAC_DISPLAY_PLAN_OPERATION_COPY },
+
+        /* Copies from a refined part of the same layer */
+        { .layer = other, .type = GUAC_DISPLAY_PLAN_OPERATION_COPY },
+
+        /* Copies from the same region of a different layer */
+        { .layer = other, .type = GUAC_DISPLAY_PLAN_OPERATION_COPY }
+
+    };
+
+    guac_rect_init(&ops[0].dest, 512, 512, 64, 32);
+    guac_rect_init(&ops[0].src.layer_rect.rect, 96, 96, 64, 32);
+    ops[0].src.layer_rect.layer = &layer_buffer;
+
+    guac_rect_init(&ops[1].dest, 512, 0, 64, 64);
+    guac_rect_init(&ops[1].src.layer_rect.rect, 128, 0, 64, 64);
+    ops[1].src.layer_rect.layer = &layer_buffer;
+
+    guac_rect_init(&ops[2].dest, 0, 512, 64, 64);
+    guac_rect_init(&ops[2].src.layer_rect.rect, 0, 0, 64, 64);
+    ops[2].src.layer_rect.layer = &other_buffer;
+
+    test_refinements_init_plan(plan, ops, 3);
+
+    PFR_LFW_guac_display_preempt_refinements(display, plan);
+
+    CU_ASSERT_EQUAL(ops[0].type, GUAC_DISPLAY_PLAN_OPERATION_IMG);
+    CU_ASSERT_EQUAL(ops[0].dirty_size, 64 * 32);
+    CU_ASSERT_EQUAL(ops[1].type, GUAC_DISPLAY_PLAN_OPERATION_COPY);
+    CU_ASSERT_EQUAL(ops[2].type, GUAC_DISPLAY_PLAN_OPERATION_COPY);
+
+    /* None of the copies draw to the refined layer */
+    CU_ASSERT_EQUAL_FATAL(display->refinement_count, 1);
+    test_refinements_assert_rect(&display->refinements[0].dest, 0, 0, 128, 128);
+
+    guac_mem_free(other);
+    guac_mem_free(layer);
+    guac_mem_free(plan);
+    test_refinements_free_display(display);
+
+}
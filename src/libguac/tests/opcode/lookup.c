@@ -0,0 +1,117 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <CUnit/CUnit.h>
+#include <guacamole/opcode.h>
+#include <guacamole/parser.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Test which verifies that every opcode defined by guac_opcode can be
+ * translated to its string form and back again using guac_opcode_name() and
+ * guac_opcode_lookup().
+ */
+void test_opcode__lookup(void) {
+
+    for (int i = GUAC_OPCODE_UNKNOWN + 1; i < GUAC_OPCODE_COUNT; i++) {
+        const char* name = guac_opcode_name(i);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(name);
+        CU_ASSERT_EQUAL(guac_opcode_lookup(name), i);
+    }
+
+    /* Spot-check a few specific opcodes */
+    CU_ASSERT_EQUAL(guac_opcode_lookup("sync"), GUAC_OPCODE_SYNC);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("img"), GUAC_OPCODE_IMG);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("image"), GUAC_OPCODE_IMAGE);
+    CU_ASSERT_STRING_EQUAL(guac_opcode_name(GUAC_OPCODE_CONNECT), "connect");
+    CU_ASSERT_STRING_EQUAL(guac_opcode_name(GUAC_OPCODE_USBDISCONNECT),
+            "usbdisconnect");
+
+}
+
+/**
+ * Test which verifies that guac_opcode_lookup() and guac_opcode_name() reject
+ * opcodes and identifiers that are not part of the Guacamole protocol,
+ * including strings that differ from a known opcode by only a prefix or
+ * suffix.
+ */
+void test_opcode__lookup_unknown(void) {
+
+    CU_ASSERT_EQUAL(guac_opcode_lookup(""), GUAC_OPCODE_UNKNOWN);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("test"), GUAC_OPCODE_UNKNOWN);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("syn"), GUAC_OPCODE_UNKNOWN);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("syncs"), GUAC_OPCODE_UNKNOWN);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("SYNC"), GUAC_OPCODE_UNKNOWN);
+    CU_ASSERT_EQUAL(guac_opcode_lookup("usbdisconnectx"), GUAC_OPCODE_UNKNOWN);
+
+    CU_ASSERT_PTR_NULL(guac_opcode_name(GUAC_OPCODE_UNKNOWN));
+    CU_ASSERT_PTR_NULL(guac_opcode_name(GUAC_OPCODE_COUNT));
+
+}
+
+/**
+ * Test which verifies that guac_parser assigns the numeric ID of each
+ * instruction's opcode once that instruction has been completely parsed.
+ */
+void test_opcode__parsed(void) {
+
+    char buffer[] = "4.sync,4.1234;7.unknown;5.mouse,1.1,1.2;";
+    char* current = buffer;
+    int remaining = sizeof(buffer) - 1;
+
+    guac_opcode expected[] = {
+        GUAC_OPCODE_SYNC,
+        GUAC_OPCODE_UNKNOWN,
+        GUAC_OPCODE_MOUSE
+    };
+
+    for (int i = 0; i < 3; i++) {
+
+        guac_parser* parser = guac_parser_alloc();
+        CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+        /* No opcode is known until the instruction has been parsed */
+        CU_ASSERT_EQUAL(parser->opcode_id, GUAC_OPCODE_UNKNOWN);
+
+        /* Parse exactly one instruction */
+        while (parser->state != GUAC_PARSE_COMPLETE) {
+
+            int parsed = guac_parser_append(parser, current, remaining);
+            if (parsed == 0)
+                break;
+
+            current += parsed;
+            remaining -= parsed;
+
+        }
+
+        CU_ASSERT_EQUAL(parser->state, GUAC_PARSE_COMPLETE);
+        CU_ASSERT_EQUAL(parser->opcode_id, expected[i]);
+        CU_ASSERT_EQUAL(parser->opcode_id, guac_opcode_lookup(parser->opcode));
+
+        guac_parser_free(parser);
+
+    }
+
+    CU_ASSERT_EQUAL(remaining, 0);
+
+}
+
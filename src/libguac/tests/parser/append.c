@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 /**
@@ -75,3 +76,133 @@ void test_parser__append(void) {
 
 }
 
+/**
+ * Test string which contains exactly four Unicode characters encoded in UTF-8.
+ * This particular test string uses several characters which encode to multiple
+ * bytes in UTF-8.
+ */
+#define UTF8_4 "\xe7\x8a\xac\xf0\x90\xac\x80z\xc3\xa1"
+
+/**
+ * Test which verifies that guac_parser correctly parses Guacamole instructions
+ * containing a mix of long runs of ASCII characters and multibyte UTF-8
+ * characters, regardless of where the data is split between calls to
+ * guac_parser_append().
+ */
+void test_parser__append_split(void) {
+
+    const char instruction[] =
+        "4.test,"
+        "44.abcdefghijklmnopqrstuvwxyz0123456789" UTF8_4 "abcd,"
+        "40." UTF8_4 "abcdefghijklmnopqrstuvwxyz0123456789,"
+        "8." UTF8_4 UTF8_4 ";";
+
+    /* Attempt every possible chunk size */
+    for (int chunk = 1; chunk < sizeof(instruction); chunk++) {
+
+        guac_parser* parser = guac_parser_alloc();
+        CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+        char buffer[sizeof(instruction)];
+        memcpy(buffer, instruction, sizeof(instruction));
+
+        /* Make data available in chunks of the current size, retaining any
+         * data that could not yet be parsed for the next call */
+        char* current = buffer;
+        char* available_end = buffer;
+        char* end = buffer + sizeof(instruction) - 1;
+        while (parser->state != GUAC_PARSE_COMPLETE
+                && parser->state != GUAC_PARSE_ERROR) {
+
+            int parsed = guac_parser_append(parser, current,
+                    available_end - current);
+            current += parsed;
+
+            /* Provide more data only once all available data is parsed */
+            if (parsed == 0) {
+
+                if (available_end == end)
+                    break;
+
+                available_end += chunk;
+                if (available_end > end)
+                    available_end = end;
+
+            }
+
+        }
+
+        CU_ASSERT_EQUAL_FATAL(parser->state, GUAC_PARSE_COMPLETE);
+        CU_ASSERT_PTR_EQUAL(current, end);
+        CU_ASSERT_EQUAL_FATAL(parser->argc, 3);
+        CU_ASSERT_STRING_EQUAL(parser->opcode, "test");
+        CU_ASSERT_STRING_EQUAL(parser->argv[0],
+                "abcdefghijklmnopqrstuvwxyz0123456789" UTF8_4 "abcd");
+        CU_ASSERT_STRING_EQUAL(parser->argv[1],
+                UTF8_4 "abcdefghijklmnopqrstuvwxyz0123456789");
+        CU_ASSERT_STRING_EQUAL(parser->argv[2], UTF8_4 UTF8_4);
+
+        guac_parser_free(parser);
+
+    }
+
+}
+
+/**
+ * Test which verifies that guac_parser rejects elements whose length prefix
+ * exceeds GUAC_INSTRUCTION_MAX_LENGTH, including length prefixes that would
+ * overflow an int, as well as length prefixes having more than
+ * GUAC_INSTRUCTION_MAX_DIGITS digits, while accepting padded length prefixes
+ * within that limit.
+ */
+void test_parser__append_too_long(void) {
+
+    char too_long[] = "1048577.x;";
+    char overflow[] = "99999999999999999999.x;";
+    char too_many_digits[] = "00000001.x;";
+    char padded[] = "0000004.test,0000001.x;";
+
+    guac_parser* parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+    /* Each element's length prefix is limited separately */
+    char* current = padded;
+    int remaining = sizeof(padded) - 1;
+    while (remaining > 0) {
+
+        int parsed = guac_parser_append(parser, current, remaining);
+        if (parsed == 0)
+            break;
+
+        current += parsed;
+        remaining -= parsed;
+
+    }
+
+    CU_ASSERT_EQUAL(remaining, 0);
+    CU_ASSERT_EQUAL_FATAL(parser->state, GUAC_PARSE_COMPLETE);
+    CU_ASSERT_STRING_EQUAL(parser->opcode, "test");
+    CU_ASSERT_EQUAL_FATAL(parser->argc, 1);
+    CU_ASSERT_STRING_EQUAL(parser->argv[0], "x");
+    guac_parser_free(parser);
+
+    parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+    CU_ASSERT_EQUAL(guac_parser_append(parser, too_many_digits,
+                sizeof(too_many_digits) - 1), 0);
+    CU_ASSERT_EQUAL(parser->state, GUAC_PARSE_ERROR);
+    guac_parser_free(parser);
+
+    parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+    CU_ASSERT_EQUAL(guac_parser_append(parser, too_long, sizeof(too_long) - 1), 0);
+    CU_ASSERT_EQUAL(parser->state, GUAC_PARSE_ERROR);
+    guac_parser_free(parser);
+
+    parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+    CU_ASSERT_EQUAL(guac_parser_append(parser, overflow, sizeof(overflow) - 1), 0);
+    CU_ASSERT_EQUAL(parser->state, GUAC_PARSE_ERROR);
+    guac_parser_free(parser);
+
+}
@@ -0,0 +1,272 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <CUnit/CUnit.h>
+#include <guacamole/error.h>
+#include <guacamole/mem.h>
+#include <guacamole/parser.h>
+#include <guacamole/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The number of characters within the large elements read by these tests,
+ * which is far larger than the buffer within the guac_parser itself.
+ */
+#define TEST_LARGE_LENGTH 200000
+
+/**
+ * The maximum number of bytes returned by each read from the sockets used by
+ * these tests, such that large instructions must be read piecewise.
+ */
+#define TEST_READ_SIZE 4096
+
+/**
+ * The state of a guac_socket which reads from a fixed buffer in memory.
+ */
+typedef struct test_memory_socket {
+
+    /**
+     * The data remaining to be read.
+     */
+    const char* data;
+
+    /**
+     * The number of bytes remaining to be read.
+     */
+    size_t length;
+
+} test_memory_socket;
+
+/**
+ * Read handler for a memory socket, which reads up to TEST_READ_SIZE bytes
+ * of the remaining data.
+ *
+ * @param socket
+ *     The memory socket being read from.
+ *
+ * @param buf
+ *     The buffer to read into.
+ *
+ * @param count
+ *     The maximum number of bytes to read.
+ *
+ * @return
+ *     The number of bytes read, or zero if no data remains.
+ */
+static ssize_t test_memory_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    test_memory_socket* memory = (test_memory_socket*) socket->data;
+
+    if (count > memory->length)
+        count = memory->length;
+
+    if (count > TEST_READ_SIZE)
+        count = TEST_READ_SIZE;
+
+    memcpy(buf, memory->data, count);
+    memory->data += count;
+    memory->length -= count;
+
+    return count;
+
+}
+
+/**
+ * Select handler for a memory socket, which always reports that data is
+ * available, as reads from a memory socket never block.
+ *
+ * @param socket
+ *     The memory socket being checked.
+ *
+ * @param usec_timeout
+ *     Ignored.
+ *
+ * @return
+ *     Always 1.
+ */
+static int test_memory_select_handler(guac_socket* socket, int usec_timeout) {
+    return 1;
+}
+
+/**
+ * Allocates a new guac_socket which reads from the given memory socket.
+ *
+ * @param memory
+ *     The memory socket to read from.
+ *
+ * @return
+ *     A newly-allocated guac_socket which reads from the given memory socket.
+ */
+static guac_socket* test_memory_socket_alloc(test_memory_socket* memory) {
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = memory;
+    socket->read_handler = test_memory_read_handler;
+    socket->select_handler = test_memory_select_handler;
+
+    return socket;
+
+}
+
+/**
+ * Tests that guac_parser_read() correctly reads instructions containing
+ * elements far larger than the parser's own buffer, interleaved with ordinary
+ * instructions, and that such elements may contain multibyte characters.
+ */
+void test_parser__read_large(void) {
+
+    /* Build a large element of ASCII with a few multibyte characters, each
+     * counted as a single character */
+    char* large = guac_mem_alloc(TEST_LARGE_LENGTH * 2 + 1);
+    size_t large_length = 0;
+    for (int i = 0; i < TEST_LARGE_LENGTH; i++) {
+        if (i % 50000 == 49999) {
+            memcpy(large + large_length, "\xc3\xa1", 2);
+            large_length += 2;
+        }
+        else
+            large[large_length++] = 'A' + (i % 26);
+    }
+    large[large_length] = '\0';
+
+    char* stream = guac_mem_alloc(large_length * 2 + 256);
+    int stream_length = sprintf(stream,
+            "4.blob,1.0,%i.%s;"
+            "4.sync,3.123;"
+            "3.ack,1.1,%i.%s,1.0;"
+            "3.end;",
+            TEST_LARGE_LENGTH, large, TEST_LARGE_LENGTH, large);
+
+    test_memory_socket memory = { .data = stream, .length = stream_length };
+    guac_socket* socket = test_memory_socket_alloc(&memory);
+
+    guac_parser* parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+    CU_ASSERT_EQUAL_FATAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_STRING_EQUAL(parser->opcode, "blob");
+    CU_ASSERT_EQUAL_FATAL(parser->argc, 2);
+    CU_ASSERT_STRING_EQUAL(parser->argv[0], "0");
+    CU_ASSERT_STRING_EQUAL(parser->argv[1], large);
+
+    CU_ASSERT_EQUAL_FATAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_STRING_EQUAL(parser->opcode, "sync");
+    CU_ASSERT_EQUAL_FATAL(parser->argc, 1);
+    CU_ASSERT_STRING_EQUAL(parser->argv[0], "123");
+
+    CU_ASSERT_EQUAL_FATAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_STRING_EQUAL(parser->opcode, "ack");
+    CU_ASSERT_EQUAL_FATAL(parser->argc, 3);
+    CU_ASSERT_STRING_EQUAL(parser->argv[0], "1");
+    CU_ASSERT_STRING_EQUAL(parser->argv[1], large);
+    CU_ASSERT_STRING_EQUAL(parser->argv[2], "0");
+
+    CU_ASSERT_EQUAL_FATAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_STRING_EQUAL(parser->opcode, "end");
+    CU_ASSERT_EQUAL(parser->argc, 0);
+
+    /* No further data should remain */
+    CU_ASSERT_NOT_EQUAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_CLOSED);
+
+    guac_parser_free(parser);
+    guac_socket_free(socket);
+    guac_mem_free(stream);
+    guac_mem_free(large);
+
+}
+
+/**
+ * Tests that guac_parser_read() rejects instructions which would not fit
+ * within the largest buffer the parser may allocate, without first reading
+ * the entire instruction.
+ */
+void test_parser__read_too_long(void) {
+
+    /* Build an instruction of elements which are each within the maximum
+     * length but, together, exceed the maximum buffer size */
+    int elements = GUAC_PARSER_MAX_BUFFER_SIZE / GUAC_INSTRUCTION_MAX_LENGTH + 1;
+    size_t element_length = GUAC_INSTRUCTION_MAX_LENGTH;
+    char* stream = guac_mem_alloc(elements * (element_length + 16) + 16);
+
+    int stream_length = sprintf(stream, "4.blob");
+    for (int i = 0; i < elements; i++) {
+        stream_length += sprintf(stream + stream_length, ",%zu.", element_length);
+        memset(stream + stream_length, 'A', element_length);
+        stream_length += element_length;
+    }
+    stream_length += sprintf(stream + stream_length, ";");
+
+    test_memory_socket memory = { .data = stream, .length = stream_length };
+    guac_socket* socket = test_memory_socket_alloc(&memory);
+
+    guac_parser* parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+    CU_ASSERT_NOT_EQUAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_NO_MEMORY);
+
+    /* The final element should have been rejected from its length prefix
+     * alone */
+    CU_ASSERT(memory.length > element_length / 2);
+
+    guac_parser_free(parser);
+    guac_socket_free(socket);
+    guac_mem_free(stream);
+
+}
+
+/**
+ * Tests that guac_parser_read() grows its buffer only as data actually
+ * arrives, rather than allocating space for an entire element based on its
+ * length prefix alone.
+ */
+void test_parser__read_incremental_growth(void) {
+
+    /* Declare an element of the maximum length, but send only a little more
+     * than fits within the parser's own buffer */
+    size_t sent_length = GUAC_PARSER_BUFFER_SIZE + 1024;
+    char* stream = guac_mem_alloc(sent_length + 32);
+
+    int stream_length = sprintf(stream, "4.blob,1.0,%i.",
+            GUAC_INSTRUCTION_MAX_LENGTH);
+    memset(stream + stream_length, 'A', sent_length);
+    stream_length += sent_length;
+
+    test_memory_socket memory = { .data = stream, .length = stream_length };
+    guac_socket* socket = test_memory_socket_alloc(&memory);
+
+    guac_parser* parser = guac_parser_alloc();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(parser);
+
+    CU_ASSERT_NOT_EQUAL(guac_parser_read(parser, socket, 1000000), 0);
+    CU_ASSERT_EQUAL(guac_error, GUAC_STATUS_CLOSED);
+
+    /* The buffer should have doubled only once to hold the data received */
+    CU_ASSERT_EQUAL(parser->__buffer_size, GUAC_PARSER_BUFFER_SIZE * 2);
+
+    guac_parser_free(parser);
+    guac_socket_free(socket);
+    guac_mem_free(stream);
+
+}
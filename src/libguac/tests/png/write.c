@@ -0,0 +1,481 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "encode-png.h"
+#include "palette.h"
+
+#include <CUnit/CUnit.h>
+#include <cairo/cairo.h>
+#include <guacamole/mem.h>
+#include <guacamole/opcode.h>
+#include <guacamole/parser.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/stream.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The width of the images encoded by these tests, which is deliberately not
+ * a multiple of any SIMD vector width.
+ */
+#define TEST_WIDTH 301
+
+/**
+ * The height of the images encoded by these tests.
+ */
+#define TEST_HEIGHT 37
+
+/**
+ * A growable buffer of data in memory.
+ */
+typedef struct test_png_buffer {
+
+    /**
+     * The data within the buffer.
+     */
+    unsigned char* data;
+
+    /**
+     * The number of bytes of data within the buffer.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes of data that have been read from the buffer.
+     */
+    size_t offset;
+
+} test_png_buffer;
+
+/**
+ * Appends the given data to the given buffer.
+ *
+ * @param buffer
+ *     The buffer to append to.
+ *
+ * @param data
+ *     The data to append.
+ *
+ * @param length
+ *     The number of bytes of data to append.
+ */
+static void test_png_buffer_append(test_png_buffer* buffer, const void* data,
+        size_t length) {
+    buffer->data = guac_mem_realloc(buffer->data, buffer->length + length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+/**
+ * Write handler for a guac_socket that stores all written data in the
+ * test_png_buffer associated with the socket.
+ */
+static ssize_t test_png_write_handler(guac_socket* socket,
+        const void* data, size_t count) {
+    test_png_buffer_append((test_png_buffer*) socket->data, data, count);
+    return count;
+}
+
+/**
+ * Read handler for a guac_socket that reads back all data previously written
+ * to the test_png_buffer associated with the socket.
+ */
+static ssize_t test_png_read_handler(guac_socket* socket,
+        void* data, size_t count) {
+
+    test_png_buffer* buffer = (test_png_buffer*) socket->data;
+
+    if (count > buffer->length - buffer->offset)
+        count = buffer->length - buffer->offset;
+
+    memcpy(data, buffer->data + buffer->offset, count);
+    buffer->offset += count;
+
+    return count;
+
+}
+
+/**
+ * Select handler for a guac_socket that reads from a test_png_buffer, which
+ * never blocks.
+ */
+static int test_png_select_handler(guac_socket* socket, int usec_timeout) {
+    return 1;
+}
+
+/**
+ * Cairo read function which reads from a test_png_buffer.
+ */
+static cairo_status_t test_png_cairo_read(void* closure, unsigned char* data,
+        unsigned int length) {
+
+    test_png_buffer* buffer = (test_png_buffer*) closure;
+
+    if (length > buffer->length - buffer->offset)
+        return CAIRO_STATUS_READ_ERROR;
+
+    memcpy(data, buffer->data + buffer->offset, length);
+    buffer->offset += length;
+
+    return CAIRO_STATUS_SUCCESS;
+
+}
+
+/**
+ * Encodes the given surface with guac_png_write(), decodes the blobs sent
+ * over the socket, and decodes the resulting PNG with Cairo.
+ *
+ * @param surface
+ *     The surface to encode.
+ *
+ * @param level
+ *     The compression level to pass to guac_png_write().
+ *
+ * @return
+ *     A newly-allocated surface containing the decoded PNG, or NULL if the
+ *     PNG could not be encoded or decoded.
+ */
+static cairo_surface_t* test_png_round_trip(cairo_surface_t* surface,
+        int level) {
+
+    test_png_buffer protocol = { 0 };
+    test_png_buffer png = { 0 };
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &protocol;
+    socket->write_handler = test_png_write_handler;
+    socket->read_handler = test_png_read_handler;
+    socket->select_handler = test_png_select_handler;
+
+    /* Encode surface as blobs */
+    guac_stream stream = { .index = 1 };
+    int result = guac_png_write(socket, &stream, surface, level);
+    guac_socket_flush(socket);
+
+    /* Reassemble PNG from blobs */
+    guac_parser* parser = guac_parser_alloc();
+    while (guac_parser_read(parser, socket, 0) == 0) {
+        if (parser->opcode_id == GUAC_OPCODE_BLOB && parser->argc == 2) {
+            int length = guac_protocol_decode_base64(parser->argv[1]);
+            test_png_buffer_append(&png, parser->argv[1], length);
+        }
+    }
+
+    guac_parser_free(parser);
+    guac_socket_free(socket);
+    guac_mem_free(protocol.data);
+
+    /* Decode PNG */
+    cairo_surface_t* decoded = NULL;
+    if (result == 0 && png.length > 0) {
+        decoded = cairo_image_surface_create_from_png_stream(
+                test_png_cairo_read, &png);
+        if (cairo_surface_status(decoded) != CAIRO_STATUS_SUCCESS) {
+            cairo_surface_destroy(decoded);
+            decoded = NULL;
+        }
+    }
+
+    guac_mem_free(png.data);
+    return decoded;
+
+}
+
+/**
+ * Returns the pixel at the given coordinates within the given image surface.
+ *
+ * @param surface
+ *     The surface to read from, which must be RGB24 or ARGB32.
+ *
+ * @param x
+ *     The X coordinate of the pixel.
+ *
+ * @param y
+ *     The Y coordinate of the pixel.
+ *
+ * @return
+ *     The pixel at the given coordinates.
+ */
+static uint32_t test_png_pixel(cairo_surface_t* surface, int x, int y) {
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    return ((uint32_t*) (data + y * stride))[x];
+}
+
+/**
+ * Returns whether the given surfaces have identical dimensions and identical
+ * pixels, with each color component allowed to differ by the given amount.
+ *
+ * @param a
+ *     The first surface to compare.
+ *
+ * @param b
+ *     The second surface to compare.
+ *
+ * @param mask
+ *     A mask to apply to each pixel prior to comparison.
+ *
+ * @param tolerance
+ *     The maximum difference allowed for each color component.
+ *
+ * @return
+ *     Non-zero if the surfaces match, zero otherwise.
+ */
+static int test_png_surfaces_match(cairo_surface_t* a, cairo_surface_t* b,
+        uint32_t mask, int tolerance) {
+
+    int width = cairo_image_surface_get_width(a);
+    int height = cairo_image_surface_get_height(a);
+
+    if (cairo_image_surface_get_width(b) != width
+            || cairo_image_surface_get_height(b) != height)
+        return 0;
+
+    cairo_surface_flush(a);
+    cairo_surface_flush(b);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+
+            uint32_t pixel_a = test_png_pixel(a, x, y) & mask;
+            uint32_t pixel_b = test_png_pixel(b, x, y) & mask;
+
+            for (int shift = 0; shift < 32; shift += 8) {
+                int diff = (int) ((pixel_a >> shift) & 0xFF)
+                         - (int) ((pixel_b >> shift) & 0xFF);
+                if (abs(diff) > tolerance)
+                    return 0;
+            }
+
+        }
+    }
+
+    return 1;
+
+}
+
+/**
+ * Allocates a new RGB24 surface consisting of runs of pixels, each run being
+ * one of the given number of distinct colors.
+ *
+ * @param colors
+ *     The number of distinct colors to use.
+ *
+ * @return
+ *     A newly-allocated RGB24 surface.
+ */
+static cairo_surface_t* test_png_create_palette_surface(int colors) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_WIDTH, TEST_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (int x = 0; x < TEST_WIDTH; x++) {
+
+            /* Runs of varying length, including single pixels */
+            int color = ((x * x) / 97 + y * 7) % colors;
+
+            /* Alpha bits must be ignored for RGB24 surfaces */
+            row[x] = 0xAB000000 | (color * 0x010305);
+
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+
+}
+
+/**
+ * Verifies that guac_palette_alloc() locates every distinct color within a
+ * surface, producing the correct palette index for each pixel, and that
+ * building a palette is abandoned for surfaces with too many colors.
+ */
+void test_png__palette(void) {
+
+    int sizes[] = { 1, 2, 5, 16, 200, 256, 257 };
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        cairo_surface_t* surface = test_png_create_palette_surface(sizes[i]);
+        unsigned char* indices = guac_mem_alloc(TEST_WIDTH, TEST_HEIGHT);
+
+        guac_palette* palette = guac_palette_alloc(surface, indices);
+
+        if (sizes[i] > GUAC_PALETTE_MAX_SIZE)
+            CU_ASSERT_PTR_NULL(palette);
+
+        else {
+
+            CU_ASSERT_PTR_NOT_NULL_FATAL(palette);
+            CU_ASSERT_EQUAL(palette->size, sizes[i]);
+
+            /* Each index must refer to the color of its pixel */
+            int mismatches = 0;
+            for (int y = 0; y < TEST_HEIGHT; y++) {
+                for (int x = 0; x < TEST_WIDTH; x++) {
+
+                    uint32_t pixel = test_png_pixel(surface, x, y) & 0xFFFFFF;
+                    int index = indices[y * TEST_WIDTH + x];
+
+                    png_color* color = &palette->colors[index];
+                    uint32_t expected = (color->red << 16)
+                        | (color->green << 8) | color->blue;
+
+                    if (expected != pixel
+                            || guac_palette_find(palette, pixel) != index)
+                        mismatches++;
+
+                }
+            }
+
+            CU_ASSERT_EQUAL(mismatches, 0);
+            guac_palette_free(palette);
+
+        }
+
+        guac_mem_free(indices);
+        cairo_surface_destroy(surface);
+
+    }
+
+}
+
+/**
+ * Verifies that RGB24 surfaces with few enough colors to be encoded as
+ * palette images survive encoding and decoding unchanged at all compression
+ * levels.
+ */
+void test_png__write_palette(void) {
+
+    int sizes[] = { 1, 2, 4, 16, 256 };
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        cairo_surface_t* surface = test_png_create_palette_surface(sizes[i]);
+
+        for (int level = GUAC_PNG_MIN_LEVEL; level <= GUAC_PNG_MAX_LEVEL; level++) {
+            cairo_surface_t* decoded = test_png_round_trip(surface, level);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+            CU_ASSERT(test_png_surfaces_match(surface, decoded, 0xFFFFFF, 0));
+            cairo_surface_destroy(decoded);
+        }
+
+        cairo_surface_destroy(surface);
+
+    }
+
+}
+
+/**
+ * Verifies that RGB24 surfaces with too many colors to be encoded as palette
+ * images survive encoding and decoding unchanged.
+ */
+void test_png__write_truecolor(void) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            TEST_WIDTH, TEST_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (int x = 0; x < TEST_WIDTH; x++)
+            row[x] = ((x & 0xFF) << 16) | ((y * 6) << 8) | ((x ^ y) & 0xFF);
+    }
+
+    cairo_surface_mark_dirty(surface);
+
+    for (int level = GUAC_PNG_MIN_LEVEL; level <= GUAC_PNG_MAX_LEVEL; level++) {
+        cairo_surface_t* decoded = test_png_round_trip(surface, level);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+        CU_ASSERT(test_png_surfaces_match(surface, decoded, 0xFFFFFF, 0));
+        cairo_surface_destroy(decoded);
+    }
+
+    cairo_surface_destroy(surface);
+
+}
+
+/**
+ * Verifies that ARGB32 surfaces, whose color components are premultiplied
+ * by alpha, survive encoding and decoding with no more than rounding error.
+ */
+void test_png__write_alpha(void) {
+
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            TEST_WIDTH, TEST_HEIGHT);
+
+    unsigned char* data = cairo_image_surface_get_data(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+
+    for (int y = 0; y < TEST_HEIGHT; y++) {
+        uint32_t* row = (uint32_t*) (data + y * stride);
+        for (int x = 0; x < TEST_WIDTH; x++) {
+
+            uint32_t alpha = (x * 7 + y) & 0xFF;
+            uint32_t red   = ((x & 0xFF) * alpha) / 0xFF;
+            uint32_t green = ((y * 6) * alpha) / 0xFF;
+            uint32_t blue  = (((x ^ y) & 0xFF) * alpha) / 0xFF;
+
+            row[x] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+
+    cairo_surface_t* decoded = test_png_round_trip(surface, GUAC_PNG_MIN_LEVEL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(decoded);
+    CU_ASSERT_EQUAL(cairo_image_surface_get_format(decoded), CAIRO_FORMAT_ARGB32);
+    CU_ASSERT(test_png_surfaces_match(surface, decoded, 0xFFFFFFFF, 1));
+    cairo_surface_destroy(decoded);
+
+    cairo_surface_destroy(surface);
+
+}
+
+/**
+ * Verifies that guac_png_suggest_level() increases the compression level
+ * with processing lag, remaining within the defined bounds.
+ */
+void test_png__suggest_level(void) {
+
+    CU_ASSERT_EQUAL(guac_png_suggest_level(0), GUAC_PNG_MIN_LEVEL);
+    CU_ASSERT_EQUAL(guac_png_suggest_level(20), GUAC_PNG_MIN_LEVEL);
+    CU_ASSERT_EQUAL(guac_png_suggest_level(80), GUAC_PNG_MAX_LEVEL);
+    CU_ASSERT_EQUAL(guac_png_suggest_level(10000), GUAC_PNG_MAX_LEVEL);
+
+    int previous = GUAC_PNG_MIN_LEVEL;
+    for (int lag = 0; lag <= 100; lag++) {
+        int level = guac_png_suggest_level(lag);
+        CU_ASSERT(level >= previous);
+        previous = level;
+    }
+
+}
+
@@ -0,0 +1,97 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "base64.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/protocol.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The length of the longest data encoded by these tests. This is deliberately
+ * not a multiple of any SIMD vector width, such that trailing groups and
+ * padding are also exercised.
+ */
+#define TEST_BASE64_LENGTH 203
+
+/**
+ * Tests that libguac's base64 encoding function properly encodes data with
+ * zero, one, and two characters of padding.
+ */
+void test_protocol__encode_base64(void) {
+
+    char encoded[16];
+
+    /* Test one character of padding */
+    CU_ASSERT_EQUAL(guac_base64_encode("HELLO", 5, encoded), 8);
+    CU_ASSERT_NSTRING_EQUAL(encoded, "SEVMTE8=", 8);
+
+    /* Test two characters of padding */
+    CU_ASSERT_EQUAL(guac_base64_encode("AVOCADO", 7, encoded), 12);
+    CU_ASSERT_NSTRING_EQUAL(encoded, "QVZPQ0FETw==", 12);
+
+    /* Test no padding */
+    CU_ASSERT_EQUAL(guac_base64_encode("GUACAMOLE", 9, encoded), 12);
+    CU_ASSERT_NSTRING_EQUAL(encoded, "R1VBQ0FNT0xF", 12);
+
+    /* Test empty data */
+    CU_ASSERT_EQUAL(guac_base64_encode("", 0, encoded), 0);
+
+}
+
+/**
+ * Tests that libguac's base64 encoding function produces exactly the same
+ * output as the portable implementation for every possible 6-bit value at
+ * every position, and for random data of varying length, and that this output
+ * decodes back to the original data.
+ */
+void test_protocol__encode_base64_portable(void) {
+
+    unsigned char data[TEST_BASE64_LENGTH];
+    char expected[GUAC_BASE64_ENCODED_LENGTH(TEST_BASE64_LENGTH) + 1];
+    char encoded[GUAC_BASE64_ENCODED_LENGTH(TEST_BASE64_LENGTH) + 1];
+
+    /* Every byte value at every position within a group */
+    for (int i = 0; i < TEST_BASE64_LENGTH; i++)
+        data[i] = i * 85 + (i / 3);
+
+    srand(0xBA5E);
+
+    for (int i = 0; i < 10000; i++) {
+
+        size_t length = i % (TEST_BASE64_LENGTH + 1);
+        size_t expected_length = guac_base64_encode_portable(data, length, expected);
+
+        CU_ASSERT_EQUAL_FATAL(guac_base64_encode(data, length, encoded),
+                expected_length);
+        CU_ASSERT_NSTRING_EQUAL(encoded, expected, expected_length);
+
+        /* Verify that the encoded data decodes to the original data */
+        encoded[expected_length] = '\0';
+        CU_ASSERT_EQUAL(guac_protocol_decode_base64(encoded), length);
+        CU_ASSERT(memcmp(encoded, data, length) == 0);
+
+        /* Randomize data for the next iteration */
+        for (int j = 0; j < TEST_BASE64_LENGTH; j++)
+            data[j] = rand();
+
+    }
+
+}
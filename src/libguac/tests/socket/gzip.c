@@ -0,0 +1,219 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "socket-gzip.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/mem.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * The number of "sync" instructions written by each compressed stream
+ * produced by these tests.
+ */
+#define TEST_SYNC_COUNT 1000
+
+/**
+ * The maximum number of bytes returned by each read of a test_memory_socket,
+ * chosen to be small enough that each compressed stream must be read in many
+ * separate pieces.
+ */
+#define TEST_READ_SIZE 7
+
+/**
+ * An in-memory buffer which can be written to and then read back through a
+ * guac_socket.
+ */
+typedef struct test_memory_socket {
+
+    /**
+     * All data written to the socket.
+     */
+    char* data;
+
+    /**
+     * The number of bytes of data written to the socket.
+     */
+    size_t length;
+
+    /**
+     * The number of bytes of data that have been read back from the socket.
+     */
+    size_t offset;
+
+} test_memory_socket;
+
+/**
+ * Write handler for a guac_socket backed by a test_memory_socket, appending
+ * all data written to the in-memory buffer.
+ */
+static ssize_t test_memory_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_memory_socket* memory = (test_memory_socket*) socket->data;
+
+    memory->data = guac_mem_realloc(memory->data, memory->length + count);
+    memcpy(memory->data + memory->length, buf, count);
+    memory->length += count;
+
+    return count;
+
+}
+
+/**
+ * Read handler for a guac_socket backed by a test_memory_socket, returning
+ * at most TEST_READ_SIZE bytes of the in-memory buffer at a time.
+ */
+static ssize_t test_memory_read_handler(guac_socket* socket,
+        void* buf, size_t count) {
+
+    test_memory_socket* memory = (test_memory_socket*) socket->data;
+
+    size_t remaining = memory->length - memory->offset;
+    if (count > remaining)
+        count = remaining;
+
+    if (count > TEST_READ_SIZE)
+        count = TEST_READ_SIZE;
+
+    memcpy(buf, memory->data + memory->offset, count);
+    memory->offset += count;
+
+    return count;
+
+}
+
+/**
+ * Allocates a new guac_socket backed by the given test_memory_socket.
+ *
+ * @param memory
+ *     The test_memory_socket that the socket should read from and write to.
+ *
+ * @return
+ *     A newly-allocated guac_socket backed by the given memory.
+ */
+static guac_socket* test_memory_socket_alloc(test_memory_socket* memory) {
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = memory;
+    socket->read_handler = test_memory_read_handler;
+    socket->write_handler = test_memory_write_handler;
+
+    return socket;
+
+}
+
+/**
+ * Writes TEST_SYNC_COUNT "sync" instructions as a single compressed stream
+ * to the given test_memory_socket, returning the total number of bytes of
+ * uncompressed data written.
+ *
+ * @param memory
+ *     The test_memory_socket to write the compressed stream to.
+ *
+ * @return
+ *     The number of bytes of uncompressed data written.
+ */
+static size_t test_gzip_write_syncs(test_memory_socket* memory) {
+
+    guac_socket* gzip = guac_socket_gzip(test_memory_socket_alloc(memory),
+            GUAC_SOCKET_GZIP_LEVEL);
+    CU_ASSERT_PTR_NOT_NULL(gzip);
+    if (gzip == NULL)
+        return 0;
+
+    for (int i = 0; i < TEST_SYNC_COUNT; i++)
+        guac_protocol_send_sync(gzip, i, 1);
+
+    CU_ASSERT_EQUAL(guac_socket_flush(gzip), 0);
+
+    /* Freeing the compressing socket finishes the stream */
+    guac_socket_free(gzip);
+
+    /* Every "sync" instruction is "4.sync,L.TIMESTAMP,1.1;" */
+    size_t length = 0;
+    for (int i = 0; i < TEST_SYNC_COUNT; i++)
+        length += strlen("4.sync,") + (i < 10 ? 1 : i < 100 ? 2 : 3) + 2
+            + strlen(",1.1;");
+
+    return length;
+
+}
+
+/**
+ * Tests that data written through guac_socket_gzip() is compressed as gzip
+ * and can be read back, instruction by instruction, through
+ * guac_socket_gunzip(), including where several compressed streams have been
+ * concatenated.
+ */
+void test_socket__gzip_round_trip(void) {
+
+    test_memory_socket memory = { 0 };
+
+    size_t length = test_gzip_write_syncs(&memory);
+    size_t compressed_length = memory.length;
+
+    /* Output must be gzip and must actually be compressed */
+    CU_ASSERT_FATAL(memory.length >= 2);
+    CU_ASSERT_EQUAL((unsigned char) memory.data[0], 0x1F);
+    CU_ASSERT_EQUAL((unsigned char) memory.data[1], 0x8B);
+    CU_ASSERT(compressed_length < length);
+
+    /* Append a second stream, as when a recording is resumed */
+    CU_ASSERT_EQUAL(test_gzip_write_syncs(&memory), length);
+    CU_ASSERT((unsigned char) memory.data[compressed_length] == 0x1F);
+
+    guac_socket* gunzip = guac_socket_gunzip(test_memory_socket_alloc(&memory));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(gunzip);
+
+    /* All instructions of both streams must be read back in order */
+    char buffer[64];
+    for (int i = 0; i < TEST_SYNC_COUNT * 2; i++) {
+
+        int timestamp = i % TEST_SYNC_COUNT;
+        int digits = timestamp < 10 ? 1 : timestamp < 100 ? 2 : 3;
+
+        char expected[64];
+        int expected_length = snprintf(expected, sizeof(expected),
+                "4.sync,%i.%i,1.1;", digits, timestamp);
+
+        size_t read = 0;
+        while (read < expected_length) {
+            ssize_t result = guac_socket_read(gunzip, buffer + read,
+                    expected_length - read);
+            CU_ASSERT_FATAL(result > 0);
+            read += result;
+        }
+
+        CU_ASSERT_NSTRING_EQUAL(buffer, expected, expected_length);
+
+    }
+
+    /* No data may follow the end of both streams */
+    CU_ASSERT_EQUAL(guac_socket_read(gunzip, buffer, sizeof(buffer)), 0);
+
+    guac_socket_free(gunzip);
+    guac_mem_free(memory.data);
+
+}
+
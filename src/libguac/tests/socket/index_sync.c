@@ -0,0 +1,150 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "socket-index.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/mem.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Test string which contains exactly four Unicode characters encoded in UTF-8,
+ * several of which encode to multiple bytes.
+ */
+#define UTF8_4 "\xe7\x8a\xac\xf0\x90\xac\x80z\xc3\xa1"
+
+/**
+ * Everything written to a socket allocated by test_index_buffer_socket().
+ */
+typedef struct test_index_buffer {
+
+    /**
+     * The data written so far.
+     */
+    char* data;
+
+    /**
+     * The number of bytes written so far.
+     */
+    size_t length;
+
+} test_index_buffer;
+
+/**
+ * Write handler which appends all written data to the test_index_buffer
+ * associated with the socket.
+ *
+ * @param socket
+ *     The socket being written to.
+ *
+ * @param buf
+ *     The data to write.
+ *
+ * @param count
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Always the number of bytes requested.
+ */
+static ssize_t test_index_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_index_buffer* buffer = (test_index_buffer*) socket->data;
+
+    buffer->data = guac_mem_realloc(buffer->data, buffer->length + count + 1);
+    memcpy(buffer->data + buffer->length, buf, count);
+    buffer->length += count;
+    buffer->data[buffer->length] = '\0';
+
+    return count;
+
+}
+
+/**
+ * Allocates a new guac_socket which appends everything written to it to the
+ * given buffer.
+ *
+ * @param buffer
+ *     The buffer that should receive all data written.
+ *
+ * @return
+ *     A newly-allocated guac_socket.
+ */
+static guac_socket* test_index_buffer_socket(test_index_buffer* buffer) {
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = buffer;
+    socket->write_handler = test_index_write_handler;
+    return socket;
+}
+
+/**
+ * Tests that an index socket writes everything to the recording unmodified,
+ * and indexes the offsets of only those "sync" instructions that are at least
+ * the index interval apart, regardless of the presence of multibyte
+ * characters in the preceding instructions.
+ */
+void test_socket__index_sync(void) {
+
+    test_index_buffer recording = { 0 };
+    test_index_buffer index = { 0 };
+
+    guac_socket* socket = guac_socket_index(
+            test_index_buffer_socket(&recording),
+            test_index_buffer_socket(&index), 1000);
+
+    guac_protocol_send_name(socket, "a" UTF8_4 "b");
+    guac_protocol_send_sync(socket, 5000, 1);
+    guac_protocol_send_name(socket, "sync");
+    guac_protocol_send_sync(socket, 5500, 1);
+    guac_protocol_send_sync(socket, 6000, 1);
+    guac_socket_flush(socket);
+
+    const char first[] =
+        "4.name,6.a" UTF8_4 "b;"
+        "4.sync,4.5000,1.1;";
+
+    const char second[] =
+        "4.name,4.sync;"
+        "4.sync,4.5500,1.1;"
+        "4.sync,4.6000,1.1;";
+
+    char expected_recording[sizeof(first) + sizeof(second)];
+    snprintf(expected_recording, sizeof(expected_recording), "%s%s",
+            first, second);
+
+    char expected_index[64];
+    snprintf(expected_index, sizeof(expected_index),
+            "sync 5000 %zu\nsync 6000 %zu\n",
+            strlen(first), strlen(expected_recording));
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(recording.data);
+    CU_ASSERT_STRING_EQUAL(recording.data, expected_recording);
+
+    CU_ASSERT_PTR_NOT_NULL_FATAL(index.data);
+    CU_ASSERT_STRING_EQUAL(index.data, expected_index);
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    guac_mem_free(index.data);
+
+}
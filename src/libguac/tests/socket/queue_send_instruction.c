@@ -0,0 +1,686 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "socket-queue.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/mem.h>
+#include <guacamole/protocol.h>
+#include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The "sync" instruction written by these tests to mark the end of a frame.
+ */
+#define TEST_SYNC "4.sync,1.1,1.1;"
+
+/**
+ * A skippable drawing instruction written by these tests after the end of a
+ * frame.
+ */
+#define TEST_SKIPPABLE "4.rect,1.0,1.0,1.0,1.1,1.1;"
+
+/**
+ * A skippable instruction affecting the existence of a layer, which must
+ * never be dropped.
+ */
+#define TEST_DISPOSE "7.dispose,1.1;"
+
+/**
+ * An instruction opening an audio stream which may remain open while frames
+ * are skipped.
+ */
+#define TEST_AUDIO "5.audio,1.1,9.audio/L16;"
+
+/**
+ * An instruction sending data along the audio stream opened by TEST_AUDIO.
+ */
+#define TEST_AUDIO_BLOB "4.blob,1.1,4.AAAA;"
+
+/**
+ * An instruction closing the audio stream opened by TEST_AUDIO.
+ */
+#define TEST_AUDIO_END "3.end,1.1;"
+
+/**
+ * The maximum number of milliseconds to wait for queued data to be written.
+ */
+#define TEST_TIMEOUT 5000
+
+/**
+ * The state of a guac_socket which records everything written to it, blocking
+ * all writes until released.
+ */
+typedef struct test_recording_socket {
+
+    /**
+     * Lock which guards all other members of this structure.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled when writes are released.
+     */
+    pthread_cond_t released_cond;
+
+    /**
+     * Non-zero if writes may proceed, zero if writes must block.
+     */
+    int released;
+
+    /**
+     * Everything written to the socket so far.
+     */
+    char* data;
+
+    /**
+     * The number of bytes written to the socket so far.
+     */
+    size_t length;
+
+} test_recording_socket;
+
+/**
+ * Write handler for a recording socket, which waits for writes to be
+ * released before appending the written data to the recording.
+ *
+ * @param socket
+ *     The recording socket being written to.
+ *
+ * @param buf
+ *     The data to write.
+ *
+ * @param count
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Always the number of bytes requested.
+ */
+static ssize_t test_recording_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_recording_socket* recording = (test_recording_socket*) socket->data;
+
+    pthread_mutex_lock(&recording->lock);
+
+    while (!recording->released)
+        pthread_cond_wait(&recording->released_cond, &recording->lock);
+
+    recording->data = guac_mem_realloc(recording->data, recording->length + count);
+    memcpy(recording->data + recording->length, buf, count);
+    recording->length += count;
+
+    pthread_mutex_unlock(&recording->lock);
+
+    return count;
+
+}
+
+/**
+ * Allows all pending and future writes to the given recording socket to
+ * proceed.
+ *
+ * @param recording
+ *     The recording socket to release.
+ */
+static void test_recording_release(test_recording_socket* recording) {
+    pthread_mutex_lock(&recording->lock);
+    recording->released = 1;
+    pthread_cond_broadcast(&recording->released_cond);
+    pthread_mutex_unlock(&recording->lock);
+}
+
+/**
+ * Verifies that the given recording socket has received exactly the given
+ * data.
+ *
+ * @param recording
+ *     The recording socket to check.
+ *
+ * @param expected
+ *     The data that should have been received.
+ *
+ * @param length
+ *     The number of bytes that should have been received.
+ */
+static void test_recording_verify(test_recording_socket* recording,
+        const char* expected, size_t length) {
+
+    pthread_mutex_lock(&recording->lock);
+
+    CU_ASSERT_EQUAL_FATAL(recording->length, length);
+    CU_ASSERT(memcmp(recording->data, expected, length) == 0);
+
+    pthread_mutex_unlock(&recording->lock);
+
+}
+
+/**
+ * Tests that a queue socket writes all instructions to the underlying socket
+ * in the order they were written, regardless of whether those instructions
+ * were written via the normal guac_socket functions or as single complete
+ * instructions.
+ */
+void test_socket__queue_send_instruction(void) {
+
+    test_recording_socket recording = { .released = 1 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue(socket);
+
+    guac_protocol_send_name(queue, "queued");
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SYNC, strlen(TEST_SYNC), 1), 0);
+    guac_protocol_send_name(queue, "last");
+    guac_socket_flush(queue);
+
+    /* Freeing the queue must wait for all queued data */
+    guac_socket_free(queue);
+
+    const char expected[] =
+        "4.name,6.queued;"
+        TEST_SYNC
+        "4.name,4.last;";
+
+    test_recording_verify(&recording, expected, strlen(expected));
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
+
+/**
+ * Queues a single frame exceeding the high water mark along the given queue
+ * socket, such that all further frames will be skipped until the queue
+ * drains.
+ *
+ * @param queue
+ *     The queue socket to write to.
+ *
+ * @param frame_length
+ *     Receives the length of the returned frame data, in bytes.
+ *
+ * @return
+ *     The data that was queued prior to the final "sync" instruction of the
+ *     frame. This must be freed with guac_mem_free().
+ */
+static char* test_queue_large_frame(guac_socket* queue, size_t* frame_length) {
+
+    *frame_length = GUAC_SOCKET_QUEUE_HIGH_WATER_MARK + 1;
+    char* frame = guac_mem_alloc(*frame_length);
+    memset(frame, 'x', *frame_length);
+
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                frame, *frame_length, 1), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SYNC, strlen(TEST_SYNC), 1), 0);
+
+    return frame;
+
+}
+
+/**
+ * Waits for the given queue socket to request resynchronization, which
+ * should happen only after its queue has drained.
+ *
+ * @param queue
+ *     The queue socket to wait for.
+ *
+ * @return
+ *     Non-zero if resynchronization was requested, zero if the wait timed
+ *     out.
+ */
+static int test_queue_wait_resync(guac_socket* queue) {
+
+    int resync = 0;
+    for (int waited = 0; !resync && waited < TEST_TIMEOUT; waited += 10) {
+        guac_timestamp_msleep(10);
+        resync = guac_socket_queue_resync(queue);
+    }
+
+    return resync;
+
+}
+
+/**
+ * Tests that a queue socket whose underlying socket cannot keep up skips
+ * skippable drawing instructions beginning at the end of the current frame,
+ * never skips other instructions, and requests resynchronization only after
+ * the frames queued before skipping began have been written.
+ */
+void test_socket__queue_skip_frames(void) {
+
+    test_recording_socket recording = { .released = 0 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue(socket);
+
+    /* Queue a frame exceeding the high water mark while the underlying
+     * socket is blocked */
+    size_t frame_length;
+    char* frame = test_queue_large_frame(queue, &frame_length);
+
+    /* Skippable drawing instructions and frame boundaries after the end of
+     * the frame must be dropped, while all other instructions are still
+     * sent */
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SKIPPABLE, strlen(TEST_SKIPPABLE), 1), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_DISPOSE, strlen(TEST_DISPOSE), 1), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SYNC, strlen(TEST_SYNC), 1), 0);
+    guac_protocol_send_name(queue, "kept");
+    guac_socket_flush(queue);
+
+    /* Resynchronization must not be requested until the queue drains */
+    CU_ASSERT_FALSE(guac_socket_queue_resync(queue));
+
+    test_recording_release(&recording);
+    CU_ASSERT_TRUE(test_queue_wait_resync(queue));
+
+    /* Skippable instructions must be sent again once resynchronized */
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SKIPPABLE, strlen(TEST_SKIPPABLE), 1), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SYNC, strlen(TEST_SYNC), 1), 0);
+
+    guac_socket_free(queue);
+
+    const char trailer[] =
+        TEST_SYNC
+        TEST_DISPOSE
+        "4.name,4.kept;"
+        TEST_SKIPPABLE
+        TEST_SYNC;
+
+    size_t expected_length = frame_length + strlen(trailer);
+    char* expected = guac_mem_alloc(expected_length);
+    memcpy(expected, frame, frame_length);
+    memcpy(expected + frame_length, trailer, strlen(trailer));
+
+    test_recording_verify(&recording, expected, expected_length);
+
+    guac_mem_free(expected);
+    guac_mem_free(frame);
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
+
+/**
+ * Tests that a queue socket which is skipping frames drops the entire image
+ * stream of any dropped "img" instruction while leaving other streams intact,
+ * and that streams which remained open while skipping are not opened a second
+ * time while the recipient is resynchronized.
+ */
+void test_socket__queue_skip_streams(void) {
+
+    test_recording_socket recording = { .released = 0 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue(socket);
+
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_AUDIO, strlen(TEST_AUDIO), 0), 0);
+
+    size_t frame_length;
+    char* frame = test_queue_large_frame(queue, &frame_length);
+
+    /* The image stream of a dropped "img" must be dropped in its entirety */
+    const char img[] = "3.img,1.2,2.14,1.0,9.image/png,1.0,1.0;";
+    const char img_blob[] = "4.blob,1.2,4.AAAA;";
+    const char img_end[] = "3.end,1.2;";
+
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                img, strlen(img), 1), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                img_blob, strlen(img_blob), 0), 0);
+
+    /* Data for streams that were not dropped must still be sent */
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_AUDIO_BLOB, strlen(TEST_AUDIO_BLOB), 0), 0);
+
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                img_end, strlen(img_end), 0), 0);
+
+    test_recording_release(&recording);
+    CU_ASSERT_TRUE(test_queue_wait_resync(queue));
+
+    /* The audio stream remained open and must not be opened again while
+     * resynchronizing */
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_AUDIO, strlen(TEST_AUDIO), 0), 0);
+
+    guac_socket_queue_resync_complete(queue);
+
+    /* Streams may be closed and opened normally once resynchronized */
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_AUDIO_END, strlen(TEST_AUDIO_END), 0), 0);
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_AUDIO, strlen(TEST_AUDIO), 0), 0);
+
+    guac_socket_free(queue);
+
+    const char trailer[] =
+        TEST_SYNC
+        TEST_AUDIO_BLOB
+        TEST_AUDIO_END
+        TEST_AUDIO;
+
+    size_t expected_length = strlen(TEST_AUDIO) + frame_length
+        + strlen(trailer);
+    char* expected = guac_mem_alloc(expected_length);
+    memcpy(expected, TEST_AUDIO, strlen(TEST_AUDIO));
+    memcpy(expected + strlen(TEST_AUDIO), frame, frame_length);
+    memcpy(expected + strlen(TEST_AUDIO) + frame_length, trailer,
+            strlen(trailer));
+
+    test_recording_verify(&recording, expected, expected_length);
+
+    guac_mem_free(expected);
+    guac_mem_free(frame);
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
+
+/**
+ * Allocates a "blob" instruction sending the given number of bytes of
+ * arbitrary data along stream 1.
+ *
+ * @param length
+ *     The number of characters of data within the instruction.
+ *
+ * @param instruction_length
+ *     Receives the length of the returned instruction, in bytes.
+ *
+ * @return
+ *     A newly-allocated instruction, which must be freed with
+ *     guac_mem_free().
+ */
+static char* test_alloc_blob(size_t length, size_t* instruction_length) {
+
+    char* blob = guac_mem_alloc(length + 32);
+
+    int prefix_length = sprintf(blob, "4.blob,1.1,%zu.", length);
+    memset(blob + prefix_length, 'A', length);
+    blob[prefix_length + length] = ';';
+
+    *instruction_length = prefix_length + length + 1;
+    return blob;
+
+}
+
+/**
+ * Tests that a queue socket fails, rather than queueing without limit, once
+ * instructions that are never skipped would exceed the maximum length of the
+ * queue.
+ */
+void test_socket__queue_max_length(void) {
+
+    test_recording_socket recording = { .released = 0 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue(socket);
+
+    size_t blob_length;
+    char* blob = test_alloc_blob(1048576, &blob_length);
+
+    /* Queue stream data until the queue fails */
+    size_t queued = 0;
+    while (queued <= GUAC_SOCKET_QUEUE_MAX_LENGTH) {
+        if (guac_socket_queue_write_instruction(queue, blob, blob_length, 0))
+            break;
+        queued += blob_length;
+    }
+
+    CU_ASSERT(queued <= GUAC_SOCKET_QUEUE_MAX_LENGTH);
+    CU_ASSERT(queued + blob_length > GUAC_SOCKET_QUEUE_MAX_LENGTH);
+
+    /* All further writes must fail */
+    CU_ASSERT_NOT_EQUAL(guac_socket_queue_write_instruction(queue,
+                TEST_SYNC, strlen(TEST_SYNC), 0), 0);
+
+    /* Queued data must be discarded, leaving at most the data that the
+     * writer thread had already taken */
+    test_recording_release(&recording);
+    guac_socket_free(queue);
+
+    pthread_mutex_lock(&recording.lock);
+    CU_ASSERT(recording.length < queued);
+    pthread_mutex_unlock(&recording.lock);
+
+    guac_mem_free(blob);
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
+
+/**
+ * Thread which releases a recording socket only after the timeout for
+ * freeing a queue socket has elapsed.
+ *
+ * @param arg
+ *     The test_recording_socket to release.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* test_delayed_release_thread(void* arg) {
+    guac_timestamp_msleep(GUAC_SOCKET_QUEUE_FREE_TIMEOUT * 2);
+    test_recording_release((test_recording_socket*) arg);
+    return NULL;
+}
+
+/**
+ * Tests that freeing a queue socket whose recipient is not reading discards
+ * queued data after a timeout, rather than waiting for all queued data to be
+ * written.
+ */
+void test_socket__queue_free_discards(void) {
+
+    test_recording_socket recording = { .released = 0 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue(socket);
+
+    /* Queue one instruction for the writer thread to block on, and another
+     * which remains queued behind it */
+    guac_protocol_send_name(queue, "sent");
+    guac_timestamp_msleep(100);
+    guac_protocol_send_name(queue, "discarded");
+
+    pthread_t thread;
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&thread, NULL,
+                test_delayed_release_thread, &recording), 0);
+
+    guac_socket_free(queue);
+    pthread_join(thread, NULL);
+
+    const char expected[] = "4.name,4.sent;";
+    test_recording_verify(&recording, expected, strlen(expected));
+
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
+
+/**
+ * The capacity of the bounded queue sockets used by these tests, in bytes.
+ */
+#define TEST_CAPACITY 64
+
+/**
+ * Tracks whether an instruction written by a separate thread has finished
+ * being written.
+ */
+typedef struct test_bounded_writer {
+
+    /**
+     * The bounded queue socket to write to.
+     */
+    guac_socket* queue;
+
+    /**
+     * Lock which guards access to done.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Non-zero if the instruction has been completely written, zero
+     * otherwise.
+     */
+    int done;
+
+} test_bounded_writer;
+
+/**
+ * Thread which writes a single instruction to a bounded queue socket,
+ * recording when that write has completed.
+ *
+ * @param arg
+ *     The test_bounded_writer describing the socket to write to.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* test_bounded_writer_thread(void* arg) {
+
+    test_bounded_writer* writer = (test_bounded_writer*) arg;
+
+    guac_protocol_send_name(writer->queue, "blocked");
+
+    pthread_mutex_lock(&writer->lock);
+    writer->done = 1;
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+
+}
+
+/**
+ * Tests that a bounded queue socket blocks instructions while its capacity
+ * is exceeded, never skips instructions, and writes everything in order once
+ * the underlying socket catches up.
+ */
+void test_socket__queue_bounded(void) {
+
+    test_recording_socket recording = { .released = 0 };
+    pthread_mutex_init(&recording.lock, NULL);
+    pthread_cond_init(&recording.released_cond, NULL);
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    guac_socket* queue = guac_socket_queue_bounded(socket, TEST_CAPACITY);
+
+    /* A frame exceeding the capacity is still queued if the queue is empty,
+     * and is never skipped */
+    size_t frame_length = TEST_CAPACITY * 2;
+    char* frame = guac_mem_alloc(frame_length);
+    memset(frame, 'x', frame_length);
+
+    CU_ASSERT_EQUAL(guac_socket_queue_write_instruction(queue,
+                frame, frame_length, 1), 0);
+
+    /* Further instructions must block while the underlying socket is
+     * blocked */
+    test_bounded_writer writer = { .queue = queue };
+    pthread_mutex_init(&writer.lock, NULL);
+
+    pthread_t thread;
+    CU_ASSERT_EQUAL_FATAL(pthread_create(&thread, NULL,
+                test_bounded_writer_thread, &writer), 0);
+
+    guac_timestamp_msleep(100);
+
+    pthread_mutex_lock(&writer.lock);
+    CU_ASSERT_FALSE(writer.done);
+    pthread_mutex_unlock(&writer.lock);
+
+    test_recording_release(&recording);
+    pthread_join(thread, NULL);
+
+    CU_ASSERT_TRUE(writer.done);
+
+    /* Freeing a bounded queue also frees the underlying socket */
+    guac_socket_free(queue);
+
+    const char trailer[] = "4.name,7.blocked;";
+
+    size_t expected_length = frame_length + strlen(trailer);
+    char* expected = guac_mem_alloc(expected_length);
+    memcpy(expected, frame, frame_length);
+    memcpy(expected + frame_length, trailer, strlen(trailer));
+
+    test_recording_verify(&recording, expected, expected_length);
+
+    guac_mem_free(expected);
+    guac_mem_free(frame);
+
+    pthread_mutex_destroy(&writer.lock);
+    guac_mem_free(recording.data);
+    pthread_cond_destroy(&recording.released_cond);
+    pthread_mutex_destroy(&recording.lock);
+
+}
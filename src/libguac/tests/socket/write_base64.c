@@ -0,0 +1,168 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "base64.h"
+
+#include <CUnit/CUnit.h>
+#include <guacamole/mem.h>
+#include <guacamole/socket.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The total number of bytes written as base64 by each test. This spans
+ * several base64 buffers of the socket and is not a multiple of three.
+ */
+#define TEST_WRITE_BASE64_LENGTH 100000
+
+/**
+ * The state of a guac_socket which records everything written to it.
+ */
+typedef struct test_recording_socket {
+
+    /**
+     * Everything written to the socket so far.
+     */
+    char* data;
+
+    /**
+     * The number of bytes written to the socket so far.
+     */
+    size_t length;
+
+    /**
+     * The number of times the write handler has been invoked.
+     */
+    int writes;
+
+} test_recording_socket;
+
+/**
+ * Write handler for a recording socket, which appends the written data to the
+ * recording.
+ *
+ * @param socket
+ *     The recording socket being written to.
+ *
+ * @param buf
+ *     The data to write.
+ *
+ * @param count
+ *     The number of bytes to write.
+ *
+ * @return
+ *     Always the number of bytes requested.
+ */
+static ssize_t test_recording_write_handler(guac_socket* socket,
+        const void* buf, size_t count) {
+
+    test_recording_socket* recording = (test_recording_socket*) socket->data;
+
+    recording->data = guac_mem_realloc(recording->data, recording->length + count);
+    memcpy(recording->data + recording->length, buf, count);
+    recording->length += count;
+    recording->writes++;
+
+    return count;
+
+}
+
+/**
+ * Writes the given data as base64 to a new recording socket in chunks of the
+ * given sizes, verifying that the socket receives exactly the base64
+ * encoding of that data.
+ *
+ * @param data
+ *     The data to write.
+ *
+ * @param chunk_sizes
+ *     The sizes of the chunks to write, repeating from the beginning as
+ *     necessary. The last size must be zero.
+ */
+static void test_write_base64_chunked(const unsigned char* data,
+        const size_t* chunk_sizes) {
+
+    test_recording_socket recording = { 0 };
+
+    guac_socket* socket = guac_socket_alloc();
+    socket->data = &recording;
+    socket->write_handler = test_recording_write_handler;
+
+    const size_t* chunk_size = chunk_sizes;
+    for (size_t offset = 0; offset < TEST_WRITE_BASE64_LENGTH;) {
+
+        size_t length = *chunk_size;
+        if (length > TEST_WRITE_BASE64_LENGTH - offset)
+            length = TEST_WRITE_BASE64_LENGTH - offset;
+
+        CU_ASSERT_EQUAL(guac_socket_write_base64(socket, data + offset, length), 0);
+        offset += length;
+
+        if (*(++chunk_size) == 0)
+            chunk_size = chunk_sizes;
+
+    }
+
+    CU_ASSERT_EQUAL(guac_socket_flush_base64(socket), 0);
+
+    char* expected = guac_mem_alloc(GUAC_BASE64_ENCODED_LENGTH(TEST_WRITE_BASE64_LENGTH));
+    size_t expected_length = guac_base64_encode_portable(data,
+            TEST_WRITE_BASE64_LENGTH, expected);
+
+    CU_ASSERT_EQUAL_FATAL(recording.length, expected_length);
+    CU_ASSERT(memcmp(recording.data, expected, expected_length) == 0);
+
+    /* Data is written at most one full base64 buffer at a time, never one
+     * group at a time */
+    CU_ASSERT(recording.writes <= (int) (expected_length
+                / GUAC_SOCKET_BASE64_ENCODED_BUFFER_SIZE) * 2 + 2);
+
+    guac_mem_free(expected);
+    guac_socket_free(socket);
+    guac_mem_free(recording.data);
+
+}
+
+/**
+ * Tests that guac_socket_write_base64() produces exactly the base64 encoding
+ * of the data written, regardless of how that data is split across calls,
+ * including splits which leave partial groups or a partially-filled buffer
+ * between calls and writes large enough to bypass buffering.
+ */
+void test_socket__write_base64(void) {
+
+    const size_t single[] = { TEST_WRITE_BASE64_LENGTH, 0 };
+    const size_t small[] = { 1, 2, 7, 64, 0 };
+    const size_t mixed[] = { 5, GUAC_SOCKET_BASE64_READY_BUFFER_SIZE * 2 + 1, 0 };
+    const size_t aligned[] = { GUAC_SOCKET_BASE64_READY_BUFFER_SIZE, 0 };
+
+    unsigned char* data = guac_mem_alloc(TEST_WRITE_BASE64_LENGTH);
+
+    srand(0x50C7);
+    for (int i = 0; i < TEST_WRITE_BASE64_LENGTH; i++)
+        data[i] = rand();
+
+    test_write_base64_chunked(data, single);
+    test_write_base64_chunked(data, small);
+    test_write_base64_chunked(data, mixed);
+    test_write_base64_chunked(data, aligned);
+
+    guac_mem_free(data);
+
+}
@@ -35,40 +35,38 @@
 
 /* Guacamole instruction handler map */
 
-__guac_instruction_handler_mapping __guac_instruction_handler_map[] = {
-   {"sync",          __guac_handle_sync},
-   {"touch",         __guac_handle_touch},
-   {"mouse",         __guac_handle_mouse},
-   {"key",           __guac_handle_key},
-   {"clipboard",     __guac_handle_clipboard},
-   {"disconnect",    __guac_handle_disconnect},
-   {"size",          __guac_handle_size},
-   {"file",          __guac_handle_file},
-   {"pipe",          __guac_handle_pipe},
-   {"ack",           __guac_handle_ack},
-   {"blob",          __guac_handle_blob},
-   {"end",           __guac_handle_end},
-   {"get",           __guac_handle_get},
-   {"put",           __guac_handle_put},
-   {"audio",         __guac_handle_audio},
-   {"argv",          __guac_handle_argv},
-   {"nop",           __guac_handle_nop},
-   {"usbconnect",    __guac_handle_usbconnect},
-   {"usbdata",       __guac_handle_usbdata},
-   {"usbdisconnect", __guac_handle_usbdisconnect},
-   {NULL,            NULL}
+__guac_instruction_handler* __guac_instruction_handler_map[GUAC_OPCODE_COUNT] = {
+   [GUAC_OPCODE_SYNC]          = __guac_handle_sync,
+   [GUAC_OPCODE_TOUCH]         = __guac_handle_touch,
+   [GUAC_OPCODE_MOUSE]         = __guac_handle_mouse,
+   [GUAC_OPCODE_KEY]           = __guac_handle_key,
+   [GUAC_OPCODE_CLIPBOARD]     = __guac_handle_clipboard,
+   [GUAC_OPCODE_DISCONNECT]    = __guac_handle_disconnect,
+   [GUAC_OPCODE_SIZE]          = __guac_handle_size,
+   [GUAC_OPCODE_FILE]          = __guac_handle_file,
+   [GUAC_OPCODE_PIPE]          = __guac_handle_pipe,
+   [GUAC_OPCODE_ACK]           = __guac_handle_ack,
+   [GUAC_OPCODE_BLOB]          = __guac_handle_blob,
+   [GUAC_OPCODE_END]           = __guac_handle_end,
+   [GUAC_OPCODE_GET]           = __guac_handle_get,
+   [GUAC_OPCODE_PUT]           = __guac_handle_put,
+   [GUAC_OPCODE_AUDIO]         = __guac_handle_audio,
+   [GUAC_OPCODE_ARGV]          = __guac_handle_argv,
+   [GUAC_OPCODE_NOP]           = __guac_handle_nop,
+   [GUAC_OPCODE_USBCONNECT]    = __guac_handle_usbconnect,
+   [GUAC_OPCODE_USBDATA]       = __guac_handle_usbdata,
+   [GUAC_OPCODE_USBDISCONNECT] = __guac_handle_usbdisconnect
 };
 
 /* Guacamole handshake handler map */
 
-__guac_instruction_handler_mapping __guac_handshake_handler_map[] = {
-    {"size",     __guac_handshake_size_handler},
-    {"audio",    __guac_handshake_audio_handler},
-    {"video",    __guac_handshake_video_handler},
-    {"image",    __guac_handshake_image_handler},
-    {"timezone", __guac_handshake_timezone_handler},
-    {"name",     __guac_handshake_name_handler},
-    {NULL,       NULL}
+__guac_instruction_handler* __guac_handshake_handler_map[GUAC_OPCODE_COUNT] = {
+    [GUAC_OPCODE_SIZE]     = __guac_handshake_size_handler,
+    [GUAC_OPCODE_AUDIO]    = __guac_handshake_audio_handler,
+    [GUAC_OPCODE_VIDEO]    = __guac_handshake_video_handler,
+    [GUAC_OPCODE_IMAGE]    = __guac_handshake_image_handler,
+    [GUAC_OPCODE_TIMEZONE] = __guac_handshake_timezone_handler,
+    [GUAC_OPCODE_NAME]     = __guac_handshake_name_handler
 };
 
 /**
@@ -835,19 +833,14 @@ void guac_free_mimetypes(char** mimetypes) {
 
 }
 
-int __guac_user_call_opcode_handler(__guac_instruction_handler_mapping* map,
-        guac_user* user, const char* opcode, int argc, char** argv) {
+int __guac_user_call_opcode_handler(__guac_instruction_handler** map,
+        guac_user* user, guac_opcode opcode_id, const char* opcode,
+        int argc, char** argv) {
 
-    /* For each defined instruction */
-    __guac_instruction_handler_mapping* current = map;
-    while (current->opcode != NULL) {
-
-        /* If recognized, call handler */
-        if (strcmp(opcode, current->opcode) == 0)
-            return current->handler(user, argc, argv);
-
-        current++;
-    }
+    /* If recognized, call handler */
+    __guac_instruction_handler* handler = map[opcode_id];
+    if (handler != NULL)
+        return handler(user, argc, argv);
 
     /* If unrecognized, log and ignore */
     guac_user_log(user, GUAC_LOG_DEBUG, "Handler not found for \"%s\"",
@@ -29,6 +29,7 @@
  */
 
 #include "guacamole/client.h"
+#include "guacamole/opcode-types.h"
 #include "guacamole/timestamp.h"
 
 /**
@@ -51,23 +52,6 @@
  */
 typedef int __guac_instruction_handler(guac_user* user, int argc, char** argv);
 
-/**
- * Structure mapping an instruction opcode to an instruction handler.
- */
-typedef struct __guac_instruction_handler_mapping {
-
-    /**
-     * The instruction opcode which maps to a specific handler.
-     */
-    char* opcode;
-
-    /**
-     * The handler which maps to a specific opcode.
-     */
-    __guac_instruction_handler* handler;
-
-} __guac_instruction_handler_mapping;
-
 /**
  * Internal initial handler for the sync instruction. When a sync instruction
  * is received, this handler will be called. Sync instructions are automatically
@@ -251,22 +235,20 @@ __guac_instruction_handler __guac_handle_usbdata;
 __guac_instruction_handler __guac_handle_usbdisconnect;
 
 /**
- * Instruction handler mapping table. This is a NULL-terminated array of
- * __guac_instruction_handler_mapping structures, each mapping an opcode
- * to a __guac_instruction_handler. The end of the array must be marked
- * with a __guac_instruction_handler_mapping with the opcode set to
- * NULL (the NULL terminator).
+ * Instruction handler mapping table. This array is indexed by the numeric
+ * opcode IDs assigned by the Guacamole parser, with each element being the
+ * __guac_instruction_handler for the corresponding opcode, or NULL if
+ * instructions with that opcode are to be ignored.
  */
-extern __guac_instruction_handler_mapping __guac_instruction_handler_map[];
+extern __guac_instruction_handler* __guac_instruction_handler_map[GUAC_OPCODE_COUNT];
 
 /**
  * Handler mapping table for instructions (opcodes) specifically for the
- * handshake portion of the connection.  Each
- * __guac_instruction_handler_mapping structure within this NULL-terminated
- * array maps an opcode to a __guac_instruction_handler.  The end of the array
- * must be marked with a mapping with the opcode set to NULL.
+ * handshake portion of the connection. Like __guac_instruction_handler_map,
+ * this array is indexed by numeric opcode ID, with NULL elements for any
+ * opcodes that are not handled during the handshake.
  */
-extern __guac_instruction_handler_mapping __guac_handshake_handler_map[];
+extern __guac_instruction_handler* __guac_handshake_handler_map[GUAC_OPCODE_COUNT];
 
 /**
  * Frees the given array of mimetypes, including the space allocated to each
@@ -299,21 +281,26 @@ char** guac_copy_mimetypes(char** mimetypes, int count);
 
 /**
  * Call the appropriate handler defined by the given user for the given
- * instruction. A comparison is made between the instruction opcode and the
- * initial handler lookup table defined in the map that is provided to this
- * function. If an entry for the instruction is found in the provided map,
- * the handler defined in that map will be called and the value returned.  If
- * no match is found, it is silently ignored.
+ * instruction. The numeric ID of the instruction opcode is used to index the
+ * initial handler lookup table that is provided to this function. If the
+ * table defines a handler for the instruction, that handler will be called
+ * and the value returned. If no handler is defined, the instruction is
+ * silently ignored.
  *
  * @param map
- *     The array that holds the opcode to handler mappings.
+ *     The array that holds the opcode to handler mappings, indexed by
+ *     numeric opcode ID.
  * 
  * @param user
  *     The user whose handlers should be called.
  *
+ * @param opcode_id
+ *     The numeric ID of the opcode of the instruction, as assigned by the
+ *     Guacamole parser or guac_opcode_lookup().
+ *
  * @param opcode
  *     The opcode of the instruction to pass to the user via the appropriate
- *     handler.
+ *     handler. This is used only for logging.
  *
  * @param argc
  *     The number of arguments which are part of the instruction.
@@ -324,7 +311,8 @@ char** guac_copy_mimetypes(char** mimetypes, int count);
  * @return
  *     Zero if the instruction was handled successfully, or non-zero otherwise.
  */
-int __guac_user_call_opcode_handler(__guac_instruction_handler_mapping* map,
-        guac_user* user, const char* opcode, int argc, char** argv);
+int __guac_user_call_opcode_handler(__guac_instruction_handler** map,
+        guac_user* user, guac_opcode opcode_id, const char* opcode,
+        int argc, char** argv);
 
 #endif
@@ -25,6 +25,7 @@
 #include "guacamole/protocol.h"
 #include "guacamole/socket.h"
 #include "guacamole/user.h"
+#include "socket-queue.h"
 #include "user-handlers.h"
 
 #include <pthread.h>
@@ -166,8 +167,9 @@ static void* guac_user_input_thread(void* data) {
         guac_error_message = NULL;
 
         /* Call handler, stop on error */
-        if (__guac_user_call_opcode_handler(__guac_instruction_handler_map, 
-                user, parser->opcode, parser->argc, parser->argv)) {
+        if (__guac_user_call_opcode_handler(__guac_instruction_handler_map,
+                user, parser->opcode_id, parser->opcode, parser->argc,
+                parser->argv)) {
 
             /* Log error */
             guac_user_log_guac_error(user, GUAC_LOG_WARNING,
@@ -263,7 +265,7 @@ static int __guac_user_handshake(guac_user* user, guac_parser* parser,
     while (guac_parser_read(parser, socket, usec_timeout) == 0) {
         
         /* If we receive the connect opcode, we're done. */
-        if (strcmp(parser->opcode, "connect") == 0)
+        if (parser->opcode_id == GUAC_OPCODE_CONNECT)
             return 0;
         
         guac_user_log(user, GUAC_LOG_DEBUG, "Processing instruction: %s",
@@ -271,7 +273,8 @@ static int __guac_user_handshake(guac_user* user, guac_parser* parser,
         
         /* Run instruction handler for opcode with arguments. */
         if (__guac_user_call_opcode_handler(__guac_handshake_handler_map, user,
-                parser->opcode, parser->argc, parser->argv)) {
+                parser->opcode_id, parser->opcode, parser->argc,
+                parser->argv)) {
             
             guac_user_log_handshake_failure(user);
             guac_user_log_guac_error(user, GUAC_LOG_DEBUG,
@@ -338,6 +341,10 @@ int guac_user_handle_connection(guac_user* user, int usec_timeout) {
         return 1;
     }
     
+    /* Queue all further output to this user for transmission by a dedicated
+     * thread, such that a slow user cannot stall output to other users */
+    user->socket = guac_socket_queue(socket);
+
     /* Attempt to join user to connection. */
     if (guac_client_add_user(client, user, (parser->argc - 1), parser->argv + 1))
         guac_client_log(client, GUAC_LOG_ERROR, "User \"%s\" could NOT "
@@ -369,6 +376,11 @@ int guac_user_handle_connection(guac_user* user, int usec_timeout) {
                 "users remain)", user->user_id, client->connected_users);
 
     }
+
+    /* Send any remaining queued output (unless the user has stopped reading)
+     * before restoring the original socket */
+    guac_socket_free(user->socket);
+    user->socket = socket;
     
     /* Free mimetype character arrays. */
     guac_free_mimetypes((char **) user->info.audio_mimetypes);
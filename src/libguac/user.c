@@ -23,6 +23,7 @@
 #include "guacamole/mem.h"
 #include "guacamole/client.h"
 #include "guacamole/object.h"
+#include "guacamole/opcode.h"
 #include "guacamole/pool.h"
 #include "guacamole/protocol.h"
 #include "guacamole/socket.h"
@@ -171,7 +172,7 @@ void guac_user_free_object(guac_user* user, guac_object* object) {
 int guac_user_handle_instruction(guac_user* user, const char* opcode, int argc, char** argv) {
 
     return __guac_user_call_opcode_handler(__guac_instruction_handler_map,
-            user, opcode, argc, argv);
+            user, guac_opcode_lookup(opcode), opcode, argc, argv);
 
 }
 
@@ -260,8 +261,9 @@ void guac_user_stream_png(guac_user* user, guac_socket* socket,
     /* Declare stream as containing image data */
     guac_protocol_send_img(socket, stream, mode, layer, "image/png", x, y);
 
-    /* Write PNG data */
-    guac_png_write(socket, stream, surface);
+    /* Write PNG data, compressing more heavily as the user falls behind */
+    guac_png_write(socket, stream, surface,
+            guac_png_suggest_level(user->processing_lag));
 
     /* Terminate stream */
     guac_protocol_send_end(socket, stream);
@@ -1205,7 +1205,9 @@ void* guac_rdp_client_thread(void* data) {
                 !settings->recording_exclude_touch,
                 settings->recording_include_keys,
                 settings->recording_write_existing,
-                settings->recording_include_clipboard);
+                settings->recording_include_clipboard,
+                settings->recording_index,
+                settings->recording_compress);
     }
 
     /* Continue handling connections until error or client disconnect */
@@ -125,6 +125,8 @@ const char* GUAC_RDP_CLIENT_ARGS[] = {
     "recording-exclude-touch",
     "recording-include-keys",
     "recording-include-clipboard",
+    "recording-index",
+    "recording-compress",
     "create-recording-path",
     "recording-write-existing",
     "resize-method",
@@ -591,6 +593,21 @@ enum RDP_ARGS_IDX {
      */
     IDX_RECORDING_INCLUDE_CLIPBOARD,
 
+    /**
+     * Whether an index of the session recording should be written alongside
+     * the recording, allowing playback and conversion of the recording to
+     * seek directly to any point within the recording. The index is NOT
+     * written by default.
+     */
+    IDX_RECORDING_INDEX,
+
+    /**
+     * Whether the session recording should be compressed using gzip as it is
+     * written. Compressed recordings are detected automatically by guacenc
+     * and guaclog. Recordings are NOT compressed by default.
+     */
+    IDX_RECORDING_COMPRESS,
+
     /**
      * Whether the specified screen recording path should automatically be
      * created if it does not yet exist.
@@ -1221,6 +1238,16 @@ guac_rdp_settings* guac_rdp_parse_args(guac_user* user,
         guac_user_parse_args_boolean(user, GUAC_RDP_CLIENT_ARGS, argv,
                 IDX_RECORDING_INCLUDE_CLIPBOARD, false);
 
+    /* Parse recording index flag */
+    settings->recording_index =
+        guac_user_parse_args_boolean(user, GUAC_RDP_CLIENT_ARGS, argv,
+                IDX_RECORDING_INDEX, false);
+
+    /* Parse recording compression flag */
+    settings->recording_compress =
+        guac_user_parse_args_boolean(user, GUAC_RDP_CLIENT_ARGS, argv,
+                IDX_RECORDING_COMPRESS, false);
+
     /* Parse path creation flag */
     settings->create_recording_path =
         guac_user_parse_args_boolean(user, GUAC_RDP_CLIENT_ARGS, argv,
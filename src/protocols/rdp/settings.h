@@ -605,6 +605,19 @@ typedef struct guac_rdp_settings {
      */
     bool recording_include_clipboard;
 
+    /**
+     * Whether an index of the session recording should be written alongside
+     * the recording, allowing playback and conversion of the recording to
+     * seek directly to any point within the recording.
+     */
+    bool recording_index;
+
+    /**
+     * Whether the session recording should be compressed using gzip as it is
+     * written.
+     */
+    bool recording_compress;
+
     /**
      * Non-zero if existing files should be appended to when creating a new 
      * recording. Disabled by default.
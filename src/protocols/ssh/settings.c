@@ -60,12 +60,15 @@ const char* GUAC_SSH_CLIENT_ARGS[] = {
     "typescript-name",
     "create-typescript-path",
     "typescript-write-existing",
+    "typescript-compress",
     "recording-path",
     "recording-name",
     "recording-exclude-output",
     "recording-exclude-mouse",
     "recording-include-keys",
     "recording-include-clipboard",
+    "recording-index",
+    "recording-compress",
     "create-recording-path",
     "recording-write-existing",
     "read-only",
@@ -215,6 +218,12 @@ enum SSH_ARGS_IDX {
      */
     IDX_TYPESCRIPT_WRITE_EXISTING,
 
+    /**
+     * Whether the typescript should be compressed using gzip as it is
+     * written. Typescripts are NOT compressed by default.
+     */
+    IDX_TYPESCRIPT_COMPRESS,
+
     /**
      * The full absolute path to the directory in which screen recordings
      * should be written.
@@ -263,6 +272,21 @@ enum SSH_ARGS_IDX {
      */
     IDX_RECORDING_INCLUDE_CLIPBOARD,
 
+    /**
+     * Whether an index of the session recording should be written alongside
+     * the recording, allowing playback and conversion of the recording to
+     * seek directly to any point within the recording. The index is NOT
+     * written by default.
+     */
+    IDX_RECORDING_INDEX,
+
+    /**
+     * Whether the session recording should be compressed using gzip as it is
+     * written. Compressed recordings are detected automatically by guacenc
+     * and guaclog. Recordings are NOT compressed by default.
+     */
+    IDX_RECORDING_COMPRESS,
+
     /**
      * Whether the specified screen recording path should automatically be
      * created if it does not yet exist.
@@ -520,6 +544,11 @@ guac_ssh_settings* guac_ssh_parse_args(guac_user* user,
         guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
                 IDX_TYPESCRIPT_WRITE_EXISTING, false);
 
+    /* Parse typescript compression flag */
+    settings->typescript_compress =
+        guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
+                IDX_TYPESCRIPT_COMPRESS, false);
+
     /* Read recording path */
     settings->recording_path =
         guac_user_parse_args_string(user, GUAC_SSH_CLIENT_ARGS, argv,
@@ -550,6 +579,16 @@ guac_ssh_settings* guac_ssh_parse_args(guac_user* user,
         guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
                 IDX_RECORDING_INCLUDE_CLIPBOARD, false);
 
+    /* Parse recording index flag */
+    settings->recording_index =
+        guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
+                IDX_RECORDING_INDEX, false);
+
+    /* Parse recording compression flag */
+    settings->recording_compress =
+        guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
+                IDX_RECORDING_COMPRESS, false);
+
     /* Parse path creation flag */
     settings->create_recording_path =
         guac_user_parse_args_boolean(user, GUAC_SSH_CLIENT_ARGS, argv,
@@ -235,6 +235,12 @@ typedef struct guac_ssh_settings {
      */
     bool typescript_write_existing;
 
+    /**
+     * Whether the typescript should be compressed using gzip as it is
+     * written.
+     */
+    bool typescript_compress;
+
     /**
      * The path in which the screen recording should be saved, if enabled. If
      * no screen recording should be saved, this will be NULL.
@@ -288,6 +294,19 @@ typedef struct guac_ssh_settings {
      */
     bool recording_include_clipboard;
 
+    /**
+     * Whether an index of the session recording should be written alongside
+     * the recording, allowing playback and conversion of the recording to
+     * seek directly to any point within the recording.
+     */
+    bool recording_index;
+
+    /**
+     * Whether the session recording should be compressed using gzip as it is
+     * written.
+     */
+    bool recording_compress;
+
     /**
      * Whether existing files should be appended to when creating a new recording.
      * Disabled by default.
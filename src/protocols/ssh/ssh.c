@@ -300,7 +300,9 @@ void* ssh_client_thread(void* data) {
                 0, /* Touch events not supported */
                 settings->recording_include_keys,
                 settings->recording_write_existing,
-                settings->recording_include_clipboard);
+                settings->recording_include_clipboard,
+                settings->recording_index,
+                settings->recording_compress);
     }
 
     /* Create terminal options with required parameters */
@@ -340,7 +342,8 @@ void* ssh_client_thread(void* data) {
                 settings->typescript_path,
                 settings->typescript_name,
                 settings->create_typescript_path,
-                settings->typescript_write_existing);
+                settings->typescript_write_existing,
+                settings->typescript_compress);
     }
 
     /* Get user and credentials */
@@ -0,0 +1,425 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "convert.h"
+
+#include <guacamole/cpu.h>
+#include <guacamole/mem.h>
+#include <rfb/rfbproto.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Converts a single pixel value of the given pixel format to an opaque
+ * 32-bit ARGB pixel, scaling each component from the range defined by the
+ * format to 0-255.
+ *
+ * @param format
+ *     The pixel format of the value.
+ *
+ * @param swap_red_blue
+ *     Non-zero if the red and blue components of the pixel should be
+ *     swapped, zero otherwise.
+ *
+ * @param v
+ *     The pixel value to convert.
+ *
+ * @return
+ *     The corresponding opaque 32-bit ARGB pixel.
+ */
+static uint32_t guac_vnc_convert_pixel(const rfbPixelFormat* format,
+        int swap_red_blue, uint32_t v) {
+
+    uint8_t red   = (v >> format->redShift)   * 0x100 / (format->redMax   + 1);
+    uint8_t green = (v >> format->greenShift) * 0x100 / (format->greenMax + 1);
+    uint8_t blue  = (v >> format->blueShift)  * 0x100 / (format->blueMax  + 1);
+
+    if (swap_red_blue)
+        return 0xFF000000 | (blue << 16) | (green << 8) | red;
+
+    return 0xFF000000 | (red << 16) | (green << 8) | blue;
+
+}
+
+/**
+ * Reads the pixel value at the given location, which occupies the given
+ * number of bytes.
+ *
+ * @param pixel
+ *     The location of the pixel value.
+ *
+ * @param bpp
+ *     The number of bytes occupied by the pixel value.
+ *
+ * @return
+ *     The pixel value read.
+ */
+static uint32_t guac_vnc_read_pixel(const unsigned char* pixel, int bpp) {
+
+    switch (bpp) {
+
+        case 4:
+            return *((uint32_t*) pixel);
+
+        case 2:
+            return *((uint16_t*) pixel);
+
+        default:
+            return *((uint8_t*) pixel);
+
+    }
+
+}
+
+/**
+ * Converts a row of pixels of any format, calculating each pixel directly
+ * using guac_vnc_convert_pixel().
+ */
+static void guac_vnc_convert_row_direct(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    for (int x = 0; x < width; x++) {
+        dst[x] = guac_vnc_convert_pixel(&converter->format,
+                converter->swap_red_blue,
+                guac_vnc_read_pixel(src, converter->bpp));
+        src += converter->bpp;
+    }
+
+}
+
+/**
+ * Converts a row of 8-bit pixels using the lookup table of the converter.
+ */
+static void guac_vnc_convert_row_table8(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const uint32_t* table = converter->table;
+
+    for (int x = 0; x < width; x++)
+        dst[x] = table[src[x]];
+
+}
+
+/**
+ * Converts a row of 16-bit pixels using the lookup table of the converter.
+ */
+static void guac_vnc_convert_row_table16(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const uint32_t* table = converter->table;
+    const uint16_t* pixels = (const uint16_t*) src;
+
+    for (int x = 0; x < width; x++)
+        dst[x] = table[pixels[x]];
+
+}
+
+/**
+ * Converts a row of 32-bit pixels of any format whose components are at most
+ * 8 bits wide, combining the per-component lookup tables of the converter.
+ */
+static void guac_vnc_convert_row_components32(
+        const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const rfbPixelFormat* format = &converter->format;
+    const uint32_t* pixels = (const uint32_t*) src;
+
+    for (int x = 0; x < width; x++) {
+        uint32_t v = pixels[x];
+        dst[x] = 0xFF000000
+            | converter->components[0][(v >> format->redShift)   & format->redMax]
+            | converter->components[1][(v >> format->greenShift) & format->greenMax]
+            | converter->components[2][(v >> format->blueShift)  & format->blueMax];
+    }
+
+}
+
+/**
+ * Converts a row of 32-bit pixels having red, green, and blue components
+ * within bits 16-23, 8-15, and 0-7 respectively, which requires only that
+ * each pixel be made opaque.
+ */
+static void guac_vnc_convert_row_rgb32(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const uint32_t* pixels = (const uint32_t*) src;
+
+    for (int x = 0; x < width; x++)
+        dst[x] = 0xFF000000 | pixels[x];
+
+}
+
+/**
+ * Converts a row of 32-bit pixels having red, green, and blue components
+ * within bits 16-23, 8-15, and 0-7 respectively, swapping the red and blue
+ * components. This is the portable implementation of the conversion, which
+ * converts one pixel at a time.
+ */
+static void guac_vnc_convert_row_swap32(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const uint32_t* pixels = (const uint32_t*) src;
+
+    for (int x = 0; x < width; x++) {
+        uint32_t v = pixels[x];
+        dst[x] = 0xFF000000
+            | ((v & 0x0000FF) << 16)
+            |  (v & 0x00FF00)
+            | ((v & 0xFF0000) >> 16);
+    }
+
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * SSSE3 implementation of guac_vnc_convert_row_swap32(), which reorders the
+ * bytes of four pixels at a time with a single shuffle. Any final pixels
+ * that do not form a complete group of four are converted by the portable
+ * implementation.
+ */
+__attribute__((target("ssse3")))
+static void guac_vnc_convert_row_swap32_ssse3(
+        const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    /* Stored in memory as [B G R X], each pixel becomes [R G B X], with the
+     * X byte zeroed such that it can be replaced with full opacity */
+    const __m128i shuffle = _mm_setr_epi8(
+             2,  1,  0, -1,
+             6,  5,  4, -1,
+            10,  9,  8, -1,
+            14, 13, 12, -1);
+
+    const __m128i opaque = _mm_set1_epi32(0xFF000000);
+
+    for (; width >= 4; width -= 4) {
+
+        __m128i pixels = _mm_loadu_si128((const __m128i*) src);
+        _mm_storeu_si128((__m128i*) dst, _mm_or_si128(
+                    _mm_shuffle_epi8(pixels, shuffle), opaque));
+
+        src += 16;
+        dst += 4;
+
+    }
+
+    guac_vnc_convert_row_swap32(converter, src, dst, width);
+
+}
+
+/**
+ * AVX2 implementation of guac_vnc_convert_row_swap32(), which reorders the
+ * bytes of eight pixels at a time using the same approach as
+ * guac_vnc_convert_row_swap32_ssse3(). Any final pixels that do not form a
+ * complete group of eight are converted by the SSSE3 implementation.
+ */
+__attribute__((target("avx2")))
+static void guac_vnc_convert_row_swap32_avx2(
+        const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width) {
+
+    const __m256i shuffle = _mm256_setr_epi8(
+             2,  1,  0, -1,
+             6,  5,  4, -1,
+            10,  9,  8, -1,
+            14, 13, 12, -1,
+             2,  1,  0, -1,
+             6,  5,  4, -1,
+            10,  9,  8, -1,
+            14, 13, 12, -1);
+
+    const __m256i opaque = _mm256_set1_epi32(0xFF000000);
+
+    for (; width >= 8; width -= 8) {
+
+        __m256i pixels = _mm256_loadu_si256((const __m256i*) src);
+        _mm256_storeu_si256((__m256i*) dst, _mm256_or_si256(
+                    _mm256_shuffle_epi8(pixels, shuffle), opaque));
+
+        src += 32;
+        dst += 8;
+
+    }
+
+    guac_vnc_convert_row_swap32_ssse3(converter, src, dst, width);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest implementation of guac_vnc_convert_row_swap32() that
+ * is supported by the current CPU.
+ *
+ * @return
+ *     The implementation of guac_vnc_convert_row_swap32() that should be
+ *     used.
+ */
+static guac_vnc_convert_row_function* guac_vnc_convert_row_swap32_select_impl(void) {
+
+#ifdef HAVE_X86_SIMD
+    if (guac_cpu_supports(GUAC_CPU_AVX2))
+        return guac_vnc_convert_row_swap32_avx2;
+
+    if (guac_cpu_supports(GUAC_CPU_SSSE3))
+        return guac_vnc_convert_row_swap32_ssse3;
+#endif
+
+    return guac_vnc_convert_row_swap32;
+
+}
+
+/**
+ * Returns whether the given maximum value of a pixel component describes a
+ * component that is at most 8 bits wide and whose range is a power of two,
+ * such that masking the component with this value and scaling it with a
+ * lookup table is equivalent to guac_vnc_convert_pixel().
+ *
+ * @param max
+ *     The maximum value of the pixel component.
+ *
+ * @return
+ *     Non-zero if the component can be converted with a 256-entry lookup
+ *     table, zero otherwise.
+ */
+static int guac_vnc_convert_component_is_simple(int max) {
+    return max <= 0xFF && (max & (max + 1)) == 0;
+}
+
+void guac_vnc_converter_prepare(guac_vnc_converter* converter,
+        const rfbPixelFormat* format, int swap_red_blue) {
+
+    /* Nothing to do if already prepared for this format */
+    if (converter->prepared && converter->swap_red_blue == swap_red_blue
+            && memcmp(&converter->format, format, sizeof(rfbPixelFormat)) == 0)
+        return;
+
+    guac_vnc_converter_free(converter);
+
+    converter->format = *format;
+    converter->swap_red_blue = swap_red_blue;
+    converter->bpp = format->bitsPerPixel / 8;
+    converter->convert_row = guac_vnc_convert_row_direct;
+    converter->prepared = 1;
+
+    /* Formats of 8 or 16 bits per pixel can be converted entirely with a
+     * lookup table of every possible pixel value */
+    if (converter->bpp == 1 || converter->bpp == 2) {
+
+        uint32_t values = 1 << format->bitsPerPixel;
+        converter->table = guac_mem_alloc(sizeof(uint32_t), values);
+
+        for (uint32_t v = 0; v < values; v++)
+            converter->table[v] = guac_vnc_convert_pixel(format,
+                    swap_red_blue, v);
+
+        converter->convert_row = (converter->bpp == 1)
+            ? guac_vnc_convert_row_table8
+            : guac_vnc_convert_row_table16;
+
+    }
+
+    /* The standard 32-bit format requires only a reordering of bytes */
+    else if (converter->bpp == 4
+            && format->redShift == 16 && format->redMax == 0xFF
+            && format->greenShift == 8 && format->greenMax == 0xFF
+            && format->blueShift == 0 && format->blueMax == 0xFF) {
+
+        converter->convert_row = swap_red_blue
+            ? guac_vnc_convert_row_swap32_select_impl()
+            : guac_vnc_convert_row_rgb32;
+
+    }
+
+    /* Other 32-bit formats can be converted by combining lookup tables for
+     * each component if the components are simple enough */
+    else if (converter->bpp == 4
+            && guac_vnc_convert_component_is_simple(format->redMax)
+            && guac_vnc_convert_component_is_simple(format->greenMax)
+            && guac_vnc_convert_component_is_simple(format->blueMax)) {
+
+        int red_shift = swap_red_blue ? 0 : 16;
+        int blue_shift = swap_red_blue ? 16 : 0;
+
+        for (int value = 0; value < 256; value++) {
+            converter->components[0][value] = (uint32_t)
+                (uint8_t) (value * 0x100 / (format->redMax + 1)) << red_shift;
+            converter->components[1][value] = (uint32_t)
+                (uint8_t) (value * 0x100 / (format->greenMax + 1)) << 8;
+            converter->components[2][value] = (uint32_t)
+                (uint8_t) (value * 0x100 / (format->blueMax + 1)) << blue_shift;
+        }
+
+        converter->convert_row = guac_vnc_convert_row_components32;
+
+    }
+
+}
+
+void guac_vnc_converter_convert(const guac_vnc_converter* converter,
+        const unsigned char* src, size_t src_stride,
+        unsigned char* dst, size_t dst_stride, int width, int height) {
+
+    for (int y = 0; y < height; y++) {
+        converter->convert_row(converter, src, (uint32_t*) dst, width);
+        src += src_stride;
+        dst += dst_stride;
+    }
+
+}
+
+void guac_vnc_convert_portable(const rfbPixelFormat* format, int swap_red_blue,
+        const unsigned char* src, size_t src_stride,
+        unsigned char* dst, size_t dst_stride, int width, int height) {
+
+    int bpp = format->bitsPerPixel / 8;
+
+    for (int y = 0; y < height; y++) {
+
+        const unsigned char* src_pixel = src;
+        uint32_t* dst_pixel = (uint32_t*) dst;
+
+        for (int x = 0; x < width; x++) {
+            *(dst_pixel++) = guac_vnc_convert_pixel(format, swap_red_blue,
+                    guac_vnc_read_pixel(src_pixel, bpp));
+            src_pixel += bpp;
+        }
+
+        src += src_stride;
+        dst += dst_stride;
+
+    }
+
+}
+
+void guac_vnc_converter_free(guac_vnc_converter* converter) {
+
+    guac_mem_free(converter->table);
+    converter->prepared = 0;
+
+}
+
@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_VNC_CONVERT_H
+#define GUAC_VNC_CONVERT_H
+
+#include <rfb/rfbproto.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Converts rows of pixels from the pixel format of a VNC framebuffer to the
+ * 32-bit ARGB format expected by guac_display.
+ *
+ * @file convert.h
+ */
+
+typedef struct guac_vnc_converter guac_vnc_converter;
+
+/**
+ * Signature shared by all implementations of the conversion of a single row
+ * of pixels performed by guac_vnc_converter_convert().
+ *
+ * @param converter
+ *     The converter describing the pixel format of the source row.
+ *
+ * @param src
+ *     The first pixel of the row to convert, in the pixel format of the
+ *     converter.
+ *
+ * @param dst
+ *     The buffer that should receive exactly one 32-bit ARGB pixel for each
+ *     pixel converted.
+ *
+ * @param width
+ *     The number of pixels to convert.
+ */
+typedef void guac_vnc_convert_row_function(const guac_vnc_converter* converter,
+        const unsigned char* restrict src, uint32_t* restrict dst, int width);
+
+/**
+ * The state required to convert pixels from the pixel format of a VNC
+ * framebuffer to the 32-bit ARGB format expected by guac_display. Lookup
+ * tables are computed once for each pixel format, such that converting each
+ * pixel requires no arithmetic beyond table lookups (8 and 16 bpp) or
+ * byte shuffles (32 bpp).
+ */
+struct guac_vnc_converter {
+
+    /**
+     * The pixel format that this converter was most recently prepared for
+     * via guac_vnc_converter_prepare().
+     */
+    rfbPixelFormat format;
+
+    /**
+     * Non-zero if the red and blue components of each pixel are swapped
+     * during conversion, zero otherwise.
+     */
+    int swap_red_blue;
+
+    /**
+     * Non-zero if this converter has been prepared for a pixel format via
+     * guac_vnc_converter_prepare(), zero otherwise.
+     */
+    int prepared;
+
+    /**
+     * The bytes occupied by each pixel in the pixel format of this converter.
+     */
+    int bpp;
+
+    /**
+     * The function which converts each row of pixels.
+     */
+    guac_vnc_convert_row_function* convert_row;
+
+    /**
+     * The ARGB pixel corresponding to every possible pixel value for pixel
+     * formats of 8 or 16 bits per pixel, or NULL if the pixel format of this
+     * converter is not such a format.
+     */
+    uint32_t* table;
+
+    /**
+     * The ARGB contribution of every possible value of each of the red, green,
+     * and blue components (in that order) of 32-bit pixels, used only for
+     * 32-bit pixel formats which cannot be converted by reordering bytes.
+     */
+    uint32_t components[3][256];
+
+};
+
+/**
+ * Prepares the given converter for converting pixels of the given format,
+ * computing any lookup tables required. If the converter has already been
+ * prepared for the same format, this function has no effect, and thus may
+ * safely be invoked prior to each conversion. A converter that has not yet
+ * been prepared must be zeroed.
+ *
+ * @param converter
+ *     The converter to prepare.
+ *
+ * @param format
+ *     The pixel format of the VNC framebuffer.
+ *
+ * @param swap_red_blue
+ *     Non-zero if the red and blue components of each pixel should be
+ *     swapped, zero otherwise.
+ */
+void guac_vnc_converter_prepare(guac_vnc_converter* converter,
+        const rfbPixelFormat* format, int swap_red_blue);
+
+/**
+ * Converts the given rectangle of pixels from the pixel format that the
+ * given converter was prepared for to opaque 32-bit ARGB pixels.
+ *
+ * Where supported by the current CPU, 32-bit pixels having the standard
+ * red/green/blue layout are converted using SSSE3 or AVX2 instructions. The
+ * implementation used is selected once, at runtime.
+ *
+ * @param converter
+ *     The converter to use, which must have been prepared using
+ *     guac_vnc_converter_prepare().
+ *
+ * @param src
+ *     The first pixel of the first row to convert.
+ *
+ * @param src_stride
+ *     The number of bytes between the start of each source row.
+ *
+ * @param dst
+ *     The buffer that should receive the converted pixels.
+ *
+ * @param dst_stride
+ *     The number of bytes between the start of each destination row.
+ *
+ * @param width
+ *     The width of the rectangle to convert, in pixels.
+ *
+ * @param height
+ *     The height of the rectangle to convert, in pixels.
+ */
+void guac_vnc_converter_convert(const guac_vnc_converter* converter,
+        const unsigned char* src, size_t src_stride,
+        unsigned char* dst, size_t dst_stride, int width, int height);
+
+/**
+ * Portable implementation of guac_vnc_converter_convert() that converts each
+ * pixel directly from the given pixel format, without lookup tables or SIMD
+ * instructions. This function produces identical results to
+ * guac_vnc_converter_convert() and is exposed primarily for the sake of
+ * testing and benchmarking.
+ *
+ * @param format
+ *     The pixel format of the VNC framebuffer.
+ *
+ * @param swap_red_blue
+ *     Non-zero if the red and blue components of each pixel should be
+ *     swapped, zero otherwise.
+ *
+ * @see guac_vnc_converter_convert()
+ */
+void guac_vnc_convert_portable(const rfbPixelFormat* format, int swap_red_blue,
+        const unsigned char* src, size_t src_stride,
+        unsigned char* dst, size_t dst_stride, int width, int height);
+
+/**
+ * Frees any lookup tables allocated for the given converter, returning the
+ * converter to its unprepared state. The converter itself is not freed.
+ *
+ * @param converter
+ *     The converter whose lookup tables should be freed.
+ */
+void guac_vnc_converter_free(guac_vnc_converter* converter);
+
+#endif
+
@@ -58,53 +58,31 @@ void guac_vnc_cursor(rfbClient* client, int x, int y, int w, int h, int vnc_bpp)
     unsigned char* vnc_mask        = client->rcMask;
     size_t         vnc_stride      = guac_mem_ckd_mul_or_die(vnc_bpp, w);
 
+    /* Update conversion tables if the pixel format has changed */
+    guac_vnc_converter* converter = &vnc_client->converter;
+    guac_vnc_converter_prepare(converter, &client->format,
+            vnc_client->settings->swap_red_blue);
+
     /* Copy image data from VNC client to RGBA buffer */
     unsigned char* layer_current_row = GUAC_RECT_MUTABLE_BUFFER(op_bounds, context->buffer, context->stride, GUAC_DISPLAY_LAYER_RAW_BPP);
     for (int dy = 0; dy < h; dy++) {
 
-        /* Get current Guacamole buffer row, advance to next */
+        /* Convert current row to opaque ARGB */
         uint32_t* layer_current_pixel = (uint32_t*) layer_current_row;
-        layer_current_row += context->stride;
+        guac_vnc_converter_convert(converter, vnc_current_row, vnc_stride,
+                layer_current_row, context->stride, w, 1);
 
-        /* Get current VNC framebuffer row, advance to next */
-        const unsigned char* vnc_current_pixel = vnc_current_row;
+        /* Advance to next row of both buffers */
+        layer_current_row += context->stride;
         vnc_current_row += vnc_stride;
 
+        /* Translate mask to alpha */
         for (int dx = 0; dx < w; dx++) {
-
-            /* Read current pixel value */
-            uint32_t v;
-            switch (vnc_bpp) {
-                case 4:
-                    v = *((uint32_t*) vnc_current_pixel);
-                    break;
-
-                case 2:
-                    v = *((uint16_t*) vnc_current_pixel);
-                    break;
-
-                default:
-                    v = *((uint8_t*)  vnc_current_pixel);
-            }
-
-            /* Translate mask to alpha */
-            uint8_t alpha = *(vnc_mask++) ? 0xFF : 0x00;
-
-            /* Translate value to RGB */
-            uint8_t red   = (v >> client->format.redShift)   * 0x100 / (client->format.redMax   + 1);
-            uint8_t green = (v >> client->format.greenShift) * 0x100 / (client->format.greenMax + 1);
-            uint8_t blue  = (v >> client->format.blueShift)  * 0x100 / (client->format.blueMax  + 1);
-
-            /* Output ARGB */
-            if (vnc_client->settings->swap_red_blue)
-                *(layer_current_pixel++) = (alpha << 24) | (blue << 16) | (green << 8) | red;
-            else
-                *(layer_current_pixel++) = (alpha << 24) | (red  << 16) | (green << 8) | blue;
-
-            /* Advance to next pixel in VNC framebuffer */
-            vnc_current_pixel += vnc_bpp;
-
+            if (!*(vnc_mask++))
+                *layer_current_pixel &= 0x00FFFFFF;
+            layer_current_pixel++;
         }
+
     }
 
     /* Mark modified region as dirty */
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Microbenchmark of the conversion of VNC framebuffer updates to the 32-bit
+ * ARGB format expected by guac_display. Full 1920x1080 frames in each of
+ * several pixel formats are converted using both the portable, per-pixel
+ * implementation of guac_vnc_converter_convert() and the lookup tables and
+ * SIMD implementations selected by guac_vnc_converter_prepare() for the
+ * current CPU.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_vnc_convert [FRAMES]
+ */
+
+#include "convert.h"
+
+#include <rfb/rfbproto.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * The number of frames to convert for each pixel format if no number is given
+ * on the command line.
+ */
+#define BENCH_DEFAULT_FRAMES 200
+
+/**
+ * The width of each frame, in pixels.
+ */
+#define BENCH_WIDTH 1920
+
+/**
+ * The height of each frame, in pixels.
+ */
+#define BENCH_HEIGHT 1080
+
+/**
+ * A pixel format to benchmark, along with a human-readable description.
+ */
+typedef struct bench_format {
+
+    /**
+     * A human-readable description of the pixel format.
+     */
+    const char* label;
+
+    /**
+     * Non-zero if the red and blue components of each pixel should be
+     * swapped, zero otherwise.
+     */
+    int swap_red_blue;
+
+    /**
+     * The pixel format.
+     */
+    rfbPixelFormat format;
+
+} bench_format;
+
+/**
+ * All pixel formats benchmarked, including each format that may be requested
+ * by the VNC support via the "color-depth" parameter.
+ */
+static const bench_format bench_formats[] = {
+    { "8bpp BGR233", 0, { .bitsPerPixel = 8, .depth = 8, .trueColour = 1,
+        .redMax = 7, .greenMax = 7, .blueMax = 3,
+        .redShift = 0, .greenShift = 3, .blueShift = 6 } },
+    { "16bpp RGB565", 0, { .bitsPerPixel = 16, .depth = 16, .trueColour = 1,
+        .redMax = 31, .greenMax = 63, .blueMax = 31,
+        .redShift = 11, .greenShift = 5, .blueShift = 0 } },
+    { "16bpp RGB555", 0, { .bitsPerPixel = 16, .depth = 15, .trueColour = 1,
+        .redMax = 31, .greenMax = 31, .blueMax = 31,
+        .redShift = 10, .greenShift = 5, .blueShift = 0 } },
+    { "32bpp RGB", 0, { .bitsPerPixel = 32, .depth = 24, .trueColour = 1,
+        .redMax = 255, .greenMax = 255, .blueMax = 255,
+        .redShift = 16, .greenShift = 8, .blueShift = 0 } },
+    { "32bpp RGB (swap)", 1, { .bitsPerPixel = 32, .depth = 24, .trueColour = 1,
+        .redMax = 255, .greenMax = 255, .blueMax = 255,
+        .redShift = 16, .greenShift = 8, .blueShift = 0 } },
+    { "32bpp BGR", 0, { .bitsPerPixel = 32, .depth = 24, .trueColour = 1,
+        .redMax = 255, .greenMax = 255, .blueMax = 255,
+        .redShift = 0, .greenShift = 8, .blueShift = 16 } }
+};
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+
+    int frames = BENCH_DEFAULT_FRAMES;
+    if (argc > 1)
+        frames = atoi(argv[1]);
+
+    if (frames <= 0) {
+        fprintf(stderr, "Usage: %s [FRAMES]\n", argv[0]);
+        return 1;
+    }
+
+    size_t dst_stride = BENCH_WIDTH * 4;
+    unsigned char* dst = malloc(dst_stride * BENCH_HEIGHT);
+
+    printf("%-18s %16s %16s %10s\n", "Format", "Portable Mpx/s",
+            "Converter Mpx/s", "Speedup");
+
+    for (int i = 0; i < sizeof(bench_formats) / sizeof(bench_formats[0]); i++) {
+
+        const bench_format* bench = &bench_formats[i];
+
+        size_t src_stride = BENCH_WIDTH * (bench->format.bitsPerPixel / 8);
+        unsigned char* src = malloc(src_stride * BENCH_HEIGHT);
+
+        for (size_t j = 0; j < src_stride * BENCH_HEIGHT; j++)
+            src[j] = j * 2654435761u >> 24;
+
+        uint64_t start = bench_now();
+        for (int frame = 0; frame < frames; frame++)
+            guac_vnc_convert_portable(&bench->format, bench->swap_red_blue,
+                    src, src_stride, dst, dst_stride,
+                    BENCH_WIDTH, BENCH_HEIGHT);
+        uint64_t portable = bench_now() - start;
+
+        guac_vnc_converter converter = { 0 };
+
+        start = bench_now();
+        for (int frame = 0; frame < frames; frame++) {
+            guac_vnc_converter_prepare(&converter, &bench->format,
+                    bench->swap_red_blue);
+            guac_vnc_converter_convert(&converter, src, src_stride,
+                    dst, dst_stride, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+        uint64_t converted = bench_now() - start;
+
+        guac_vnc_converter_free(&converter);
+
+        double pixels = (double) BENCH_WIDTH * BENCH_HEIGHT * frames;
+        printf("%-18s %16.0f %16.0f %9.1fx\n", bench->label,
+                pixels * 1000.0 / portable, pixels * 1000.0 / converted,
+                (double) portable / converted);
+
+        free(src);
+
+    }
+
+    free(dst);
+    return 0;
+
+}
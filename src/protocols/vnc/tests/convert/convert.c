@@ -0,0 +1,194 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "convert.h"
+
+#include <CUnit/CUnit.h>
+#include <rfb/rfbproto.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The maximum width of the rectangles converted by each test, in pixels.
+ * Every width up to this maximum is tested, such that every combination of
+ * full SIMD iterations and remaining pixels is exercised.
+ */
+#define TEST_MAX_WIDTH 40
+
+/**
+ * The height of the rectangles converted by each test, in pixels.
+ */
+#define TEST_HEIGHT 3
+
+/**
+ * The number of bytes of padding at the end of each source and destination
+ * row, verifying that the stride of each is respected.
+ */
+#define TEST_ROW_PADDING 12
+
+/**
+ * Converts rectangles of pseudo-random pixels of every width up to
+ * TEST_MAX_WIDTH using both guac_vnc_converter_convert() and
+ * guac_vnc_convert_portable(), verifying that the results are identical and
+ * that nothing beyond the bounds of each destination row is written.
+ *
+ * @param format
+ *     The pixel format of the source pixels.
+ *
+ * @param swap_red_blue
+ *     Non-zero if the red and blue components of each pixel should be
+ *     swapped, zero otherwise.
+ */
+static void verify_conversion(const rfbPixelFormat* format, int swap_red_blue) {
+
+    int bpp = format->bitsPerPixel / 8;
+
+    size_t src_stride = TEST_MAX_WIDTH * bpp + TEST_ROW_PADDING;
+    size_t dst_stride = TEST_MAX_WIDTH * 4 + TEST_ROW_PADDING;
+
+    unsigned char* src = malloc(src_stride * TEST_HEIGHT);
+    unsigned char* expected = malloc(dst_stride * TEST_HEIGHT);
+    unsigned char* actual = malloc(dst_stride * TEST_HEIGHT);
+
+    /* Fill source with deterministic, pseudo-random pixel values */
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < src_stride * TEST_HEIGHT; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        src[i] = state >> 24;
+    }
+
+    guac_vnc_converter converter = { 0 };
+    guac_vnc_converter_prepare(&converter, format, swap_red_blue);
+
+    for (int width = 1; width <= TEST_MAX_WIDTH; width++) {
+
+        memset(expected, 0xA5, dst_stride * TEST_HEIGHT);
+        memset(actual, 0xA5, dst_stride * TEST_HEIGHT);
+
+        guac_vnc_convert_portable(format, swap_red_blue, src, src_stride,
+                expected, dst_stride, width, TEST_HEIGHT);
+
+        guac_vnc_converter_convert(&converter, src, src_stride,
+                actual, dst_stride, width, TEST_HEIGHT);
+
+        CU_ASSERT(memcmp(expected, actual, dst_stride * TEST_HEIGHT) == 0);
+
+        /* Every converted pixel must be opaque */
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel;
+            memcpy(&pixel, actual + x * 4, sizeof(pixel));
+            CU_ASSERT_EQUAL(pixel & 0xFF000000, 0xFF000000);
+        }
+
+    }
+
+    /* Preparing for the same format again must be a no-op */
+    uint32_t* table = converter.table;
+    guac_vnc_converter_prepare(&converter, format, swap_red_blue);
+    CU_ASSERT_PTR_EQUAL(converter.table, table);
+
+    guac_vnc_converter_free(&converter);
+    CU_ASSERT_PTR_NULL(converter.table);
+
+    free(actual);
+    free(expected);
+    free(src);
+
+}
+
+/**
+ * Test which verifies that 8-bit pixels in the format requested by the VNC
+ * support when a color depth of 8 is chosen are converted correctly.
+ */
+void test_convert__8bpp(void) {
+
+    rfbPixelFormat format = {
+        .bitsPerPixel = 8, .depth = 8, .trueColour = 1,
+        .redMax = 7, .greenMax = 7, .blueMax = 3,
+        .redShift = 0, .greenShift = 3, .blueShift = 6
+    };
+
+    verify_conversion(&format, 0);
+    verify_conversion(&format, 1);
+
+}
+
+/**
+ * Test which verifies that 16-bit pixels in both the RGB565 and RGB555 formats
+ * are converted correctly.
+ */
+void test_convert__16bpp(void) {
+
+    rfbPixelFormat rgb565 = {
+        .bitsPerPixel = 16, .depth = 16, .trueColour = 1,
+        .redMax = 31, .greenMax = 63, .blueMax = 31,
+        .redShift = 11, .greenShift = 5, .blueShift = 0
+    };
+
+    rfbPixelFormat rgb555 = {
+        .bitsPerPixel = 16, .depth = 15, .trueColour = 1,
+        .redMax = 31, .greenMax = 31, .blueMax = 31,
+        .redShift = 10, .greenShift = 5, .blueShift = 0
+    };
+
+    verify_conversion(&rgb565, 0);
+    verify_conversion(&rgb565, 1);
+    verify_conversion(&rgb555, 0);
+    verify_conversion(&rgb555, 1);
+
+}
+
+/**
+ * Test which verifies that 32-bit pixels are converted correctly, both for
+ * the standard format (which may be converted using SIMD instructions) and
+ * for formats whose components are in other positions or have other depths.
+ */
+void test_convert__32bpp(void) {
+
+    rfbPixelFormat standard = {
+        .bitsPerPixel = 32, .depth = 24, .trueColour = 1,
+        .redMax = 255, .greenMax = 255, .blueMax = 255,
+        .redShift = 16, .greenShift = 8, .blueShift = 0
+    };
+
+    rfbPixelFormat bgr = {
+        .bitsPerPixel = 32, .depth = 24, .trueColour = 1,
+        .redMax = 255, .greenMax = 255, .blueMax = 255,
+        .redShift = 0, .greenShift = 8, .blueShift = 16
+    };
+
+    rfbPixelFormat rgb101010 = {
+        .bitsPerPixel = 32, .depth = 30, .trueColour = 1,
+        .redMax = 1023, .greenMax = 1023, .blueMax = 1023,
+        .redShift = 20, .greenShift = 10, .blueShift = 0
+    };
+
+    verify_conversion(&standard, 0);
+    verify_conversion(&standard, 1);
+    verify_conversion(&bgr, 0);
+    verify_conversion(&bgr, 1);
+    verify_conversion(&rgb101010, 0);
+    verify_conversion(&rgb101010, 1);
+
+}
+
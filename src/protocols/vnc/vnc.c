@@ -712,7 +712,9 @@ void* guac_vnc_client_thread(void* data) {
                 0, /* Touch events not supported */
                 settings->recording_include_keys,
                 settings->recording_write_existing,
-                settings->recording_include_clipboard);
+                settings->recording_include_clipboard,
+                settings->recording_index,
+                settings->recording_compress);
     }
 
     /* Create display */
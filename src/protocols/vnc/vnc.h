@@ -22,6 +22,7 @@
 
 #include "common/clipboard.h"
 #include "common/iconv.h"
+#include "convert.h"
 #include "display.h"
 #include "settings.h"
 
@@ -123,6 +124,14 @@ typedef struct guac_vnc_client {
      */
     guac_display_layer_raw_context* current_context;
 
+    /**
+     * Converter which translates pixels from the pixel format of the VNC
+     * framebuffer (and cursor images) to the format of the guac_display, if
+     * those formats differ. This converter is accessed only by the VNC client
+     * thread.
+     */
+    guac_vnc_converter converter;
+
     /**
      * The current instance of the guac_display render thread. If the thread
      * has not yet been started, this will be NULL.
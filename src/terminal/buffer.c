@@ -25,6 +25,7 @@
 #include <guacamole/mem.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -36,15 +37,84 @@
 #define GUAC_TERMINAL_BUFFER_ROW_MIN_SIZE 256
 
 /**
- * A single variable-length row of terminal data.
+ * The value stored for GUAC_CHAR_CONTINUATION within the codepoints of a
+ * compact row whose codepoints are each stored in a single byte.
+ */
+#define GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION 0xFF
+
+/**
+ * A run of consecutive columns within a compact row which all share the same
+ * attributes.
+ */
+typedef struct guac_terminal_buffer_span {
+
+    /**
+     * The attributes shared by all columns of this span.
+     */
+    guac_terminal_attributes attributes;
+
+    /**
+     * The number of columns within this span.
+     */
+    unsigned int length;
+
+} guac_terminal_buffer_span;
+
+/**
+ * The compact representation of a row that has scrolled into the scrollback
+ * region of the buffer. Attributes are run-length encoded as a series of
+ * spans, separate from the codepoints of each column. Widths are not stored,
+ * as the width of each character is implied by the number of
+ * GUAC_CHAR_CONTINUATION columns that follow it. Any columns beyond those
+ * stored are copies of the default character of the buffer.
+ *
+ * The spans are stored immediately after this structure within the same
+ * allocation, followed by the codepoints of all stored columns.
+ */
+typedef struct guac_terminal_buffer_compact_row {
+
+    /**
+     * The number of columns stored, not counting any trailing columns which
+     * are copies of the default character.
+     */
+    unsigned int columns;
+
+    /**
+     * The number of spans stored.
+     */
+    unsigned int span_count;
+
+    /**
+     * Whether each codepoint is stored as an int32_t (true) or as a single
+     * byte (false). Single bytes are used only if all codepoints of the row
+     * are less than GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION, with
+     * GUAC_CHAR_CONTINUATION stored as
+     * GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION.
+     */
+    bool wide;
+
+} guac_terminal_buffer_compact_row;
+
+/**
+ * A single variable-length row of terminal data. Rows are allocated only once
+ * they are first used, and are stored compactly while within the scrollback
+ * region of the buffer.
  */
 typedef struct guac_terminal_buffer_row {
 
     /**
-     * Array of guac_terminal_char representing the contents of the row.
+     * Array of guac_terminal_char representing the contents of the row. This
+     * will be NULL if the row has never been used or is currently stored in
+     * compact form.
      */
     guac_terminal_char* characters;
 
+    /**
+     * The compact form of this row, or NULL if the row is not currently
+     * stored in compact form. If non-NULL, characters is NULL.
+     */
+    guac_terminal_buffer_compact_row* compact;
+
     /**
      * The length of this row in characters. This is the number of initialized
      * characters in the buffer, usually equal to the number of characters
@@ -99,6 +169,13 @@ struct guac_terminal_buffer {
      */
     unsigned int available;
 
+    /**
+     * The lowest (most negative) index of any row within the scrollback
+     * region that has been expanded from compact form (or allocated) since
+     * the scrollback was last compacted, or zero if there is no such row.
+     */
+    int expanded_top;
+
 };
 
 guac_terminal_buffer* guac_terminal_buffer_alloc(int rows,
@@ -108,30 +185,16 @@ guac_terminal_buffer* guac_terminal_buffer_alloc(int rows,
     guac_terminal_buffer* buffer =
         guac_mem_alloc(sizeof(guac_terminal_buffer));
 
-    int i;
-    guac_terminal_buffer_row* row;
-
     /* Init scrollback data */
     buffer->default_character = *default_character;
     buffer->available = rows;
     buffer->top = 0;
     buffer->length = 0;
-    buffer->rows = guac_mem_alloc(sizeof(guac_terminal_buffer_row), buffer->available);
-
-    /* Init scrollback rows */
-    row = buffer->rows;
-    for (i=0; i<rows; i++) {
+    buffer->expanded_top = 0;
 
-        /* Allocate row  */
-        row->available = GUAC_TERMINAL_BUFFER_ROW_MIN_SIZE;
-        row->length = 0;
-        row->wrapped_row = false;
-        row->characters = guac_mem_alloc(sizeof(guac_terminal_char), row->available);
-
-        /* Next row */
-        row++;
-
-    }
+    /* Init scrollback rows, deferring allocation of each row's contents
+     * until that row is first used */
+    buffer->rows = guac_mem_zalloc(sizeof(guac_terminal_buffer_row), buffer->available);
 
     return buffer;
 
@@ -145,6 +208,7 @@ void guac_terminal_buffer_free(guac_terminal_buffer* buffer) {
     /* Free all rows */
     for (i=0; i<buffer->available; i++) {
         guac_mem_free(row->characters);
+        guac_mem_free(row->compact);
         row++;
     }
 
@@ -157,11 +221,310 @@ void guac_terminal_buffer_free(guac_terminal_buffer* buffer) {
 void guac_terminal_buffer_reset(guac_terminal_buffer* buffer) {
     buffer->top = 0;
     buffer->length = 0;
+    buffer->expanded_top = 0;
+}
+
+/**
+ * Rounds the given value up to the nearest possible row length. To avoid
+ * unnecessary, repeated resizing of rows, each row length is rounded up to the
+ * nearest power of two.
+ *
+ * @param value
+ *     The value to round.
+ *
+ * @return
+ *     The power of two that is closest to the given value without exceeding
+ *     that value.
+ */
+static unsigned int guac_terminal_buffer_row_length(int value) {
+
+    GUAC_ASSERT(value >= 0);
+    GUAC_ASSERT(value <= GUAC_TERMINAL_MAX_COLUMNS);
+
+    unsigned int rounded = GUAC_TERMINAL_BUFFER_ROW_MIN_SIZE;
+    while (rounded < value)
+        rounded <<= 1;
+
+    return rounded;
+
+}
+
+/**
+ * Returns whether the given attributes are identical.
+ *
+ * @param a
+ *     The first set of attributes to compare.
+ *
+ * @param b
+ *     The second set of attributes to compare.
+ *
+ * @return
+ *     true if the attributes are identical, false otherwise.
+ */
+static bool guac_terminal_buffer_attributes_equal(
+        const guac_terminal_attributes* a, const guac_terminal_attributes* b) {
+
+    return a->bold == b->bold
+        && a->half_bright == b->half_bright
+        && a->cursor == b->cursor
+        && a->reverse == b->reverse
+        && a->underscore == b->underscore
+        && a->foreground.palette_index == b->foreground.palette_index
+        && a->foreground.red == b->foreground.red
+        && a->foreground.green == b->foreground.green
+        && a->foreground.blue == b->foreground.blue
+        && a->background.palette_index == b->background.palette_index
+        && a->background.red == b->background.red
+        && a->background.green == b->background.green
+        && a->background.blue == b->background.blue;
+
+}
+
+/**
+ * Returns whether the given characters are identical.
+ *
+ * @param a
+ *     The first character to compare.
+ *
+ * @param b
+ *     The second character to compare.
+ *
+ * @return
+ *     true if the characters are identical, false otherwise.
+ */
+static bool guac_terminal_buffer_char_equal(const guac_terminal_char* a,
+        const guac_terminal_char* b) {
+
+    return a->value == b->value
+        && a->width == b->width
+        && guac_terminal_buffer_attributes_equal(&a->attributes, &b->attributes);
+
+}
+
+/**
+ * Returns the spans of the given compact row.
+ *
+ * @param compact
+ *     The compact row to retrieve the spans of.
+ *
+ * @return
+ *     The array of spans stored within the given compact row.
+ */
+static guac_terminal_buffer_span* guac_terminal_buffer_compact_spans(
+        guac_terminal_buffer_compact_row* compact) {
+    return (guac_terminal_buffer_span*) (compact + 1);
+}
+
+/**
+ * Returns the codepoints of the given compact row, which are stored either as
+ * single bytes or as int32_t values depending on the "wide" flag of the
+ * row.
+ *
+ * @param compact
+ *     The compact row to retrieve the codepoints of.
+ *
+ * @return
+ *     The codepoints stored within the given compact row.
+ */
+static void* guac_terminal_buffer_compact_codepoints(
+        guac_terminal_buffer_compact_row* compact) {
+    return guac_terminal_buffer_compact_spans(compact) + compact->span_count;
+}
+
+/**
+ * Converts the given row to compact form, freeing its array of characters. If
+ * the row cannot be represented in compact form (its character widths are not
+ * consistent with its continuation characters), the row is left untouched.
+ * Rows which are not currently allocated are likewise left untouched.
+ *
+ * @param buffer
+ *     The buffer containing the row.
+ *
+ * @param row
+ *     The row to convert to compact form.
+ */
+static void guac_terminal_buffer_row_pack(guac_terminal_buffer* buffer,
+        guac_terminal_buffer_row* row) {
+
+    guac_terminal_char* characters = row->characters;
+    if (characters == NULL)
+        return;
+
+    /* Trailing copies of the default character need not be stored */
+    unsigned int columns = row->length;
+    while (columns > 0 && guac_terminal_buffer_char_equal(
+                &characters[columns - 1], &buffer->default_character))
+        columns--;
+
+    bool wide = false;
+    unsigned int span_count = 0;
+    bool span_start[GUAC_TERMINAL_MAX_COLUMNS];
+
+    for (unsigned int i = 0; i < columns; i++) {
+
+        int value = characters[i].value;
+
+        /* Verify that each width is implied by the continuation characters
+         * that follow, as widths are not stored */
+        if (value != GUAC_CHAR_CONTINUATION) {
+
+            int width = 1;
+            while (i + width < columns
+                    && characters[i + width].value == GUAC_CHAR_CONTINUATION)
+                width++;
+
+            if (characters[i].width != width)
+                return;
+
+        }
+
+        if (value < GUAC_CHAR_CONTINUATION
+                || value >= GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION)
+            wide = true;
+
+        span_start[i] = (i == 0 || !guac_terminal_buffer_attributes_equal(
+                    &characters[i].attributes, &characters[i - 1].attributes));
+
+        if (span_start[i])
+            span_count++;
+
+    }
+
+    /* Rows consisting only of default characters need no storage */
+    guac_terminal_buffer_compact_row* compact = NULL;
+    if (columns > 0) {
+
+        size_t size = guac_mem_ckd_add_or_die(
+                sizeof(guac_terminal_buffer_compact_row),
+                guac_mem_ckd_mul_or_die(span_count, sizeof(guac_terminal_buffer_span)),
+                guac_mem_ckd_mul_or_die(columns, wide ? sizeof(int32_t) : 1));
+
+        compact = guac_mem_alloc(size);
+        compact->columns = columns;
+        compact->span_count = span_count;
+        compact->wide = wide;
+
+        guac_terminal_buffer_span* span = guac_terminal_buffer_compact_spans(compact) - 1;
+        int32_t* wide_codepoints = guac_terminal_buffer_compact_codepoints(compact);
+        unsigned char* narrow_codepoints = guac_terminal_buffer_compact_codepoints(compact);
+
+        for (unsigned int i = 0; i < columns; i++) {
+
+            /* Start a new span whenever attributes change */
+            if (span_start[i]) {
+                span++;
+                span->attributes = characters[i].attributes;
+                span->length = 0;
+            }
+
+            span->length++;
+
+            int value = characters[i].value;
+            if (wide)
+                wide_codepoints[i] = value;
+            else if (value == GUAC_CHAR_CONTINUATION)
+                narrow_codepoints[i] = GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION;
+            else
+                narrow_codepoints[i] = value;
+
+        }
+
+    }
+
+    guac_mem_free(row->characters);
+    row->characters = NULL;
+    row->compact = compact;
+    row->available = 0;
+
 }
 
 /**
- * Returns the row at the given location. The row returned is guaranteed to be at least the given
- * width.
+ * Allocates the array of characters for the given row, restoring its
+ * contents from compact form if necessary. Rows which have never been used
+ * are filled with the default character. The array of characters of rows
+ * which are already allocated is left untouched.
+ *
+ * @param buffer
+ *     The buffer containing the row.
+ *
+ * @param row
+ *     The row to allocate.
+ *
+ * @param index
+ *     The index of the row to allocate, where zero is the top-most row and
+ *     negative indices represent rows in the scrollback buffer.
+ */
+static void guac_terminal_buffer_row_unpack(guac_terminal_buffer* buffer,
+        guac_terminal_buffer_row* row, int index) {
+
+    if (row->characters != NULL)
+        return;
+
+    /* Note the extent of any scrollback rows that will need to be compacted
+     * again */
+    if (index < buffer->expanded_top)
+        buffer->expanded_top = index;
+
+    row->available = guac_terminal_buffer_row_length(row->length);
+    row->characters = guac_mem_alloc(sizeof(guac_terminal_char), row->available);
+
+    guac_terminal_char* characters = row->characters;
+    guac_terminal_buffer_compact_row* compact = row->compact;
+
+    unsigned int columns = 0;
+    if (compact != NULL) {
+
+        guac_terminal_buffer_span* span = guac_terminal_buffer_compact_spans(compact);
+        int32_t* wide_codepoints = guac_terminal_buffer_compact_codepoints(compact);
+        unsigned char* narrow_codepoints = guac_terminal_buffer_compact_codepoints(compact);
+
+        /* Restore codepoints and attributes, deriving the width of each
+         * character from the continuation characters that follow it */
+        guac_terminal_char* previous = NULL;
+        for (unsigned int i = 0; i < compact->span_count; i++, span++) {
+            for (unsigned int j = 0; j < span->length; j++, columns++) {
+
+                guac_terminal_char* current = &characters[columns];
+
+                int value;
+                if (compact->wide)
+                    value = wide_codepoints[columns];
+                else if (narrow_codepoints[columns] == GUAC_TERMINAL_BUFFER_NARROW_CONTINUATION)
+                    value = GUAC_CHAR_CONTINUATION;
+                else
+                    value = narrow_codepoints[columns];
+
+                current->value = value;
+                current->attributes = span->attributes;
+
+                if (value == GUAC_CHAR_CONTINUATION) {
+                    current->width = 0;
+                    if (previous != NULL)
+                        previous->width++;
+                }
+                else {
+                    current->width = 1;
+                    previous = current;
+                }
+
+            }
+        }
+
+        guac_mem_free(compact);
+        row->compact = NULL;
+
+    }
+
+    /* All remaining columns are the default character */
+    for (unsigned int i = columns; i < row->available; i++)
+        characters[i] = buffer->default_character;
+
+}
+
+/**
+ * Returns the row at the given location without allocating or expanding that
+ * row. The contents of the returned row may not be accessible, as the row
+ * may not yet be allocated or may be stored in compact form.
  *
  * @param buffer
  *     The buffer to retrieve a row from.
@@ -174,7 +537,7 @@ void guac_terminal_buffer_reset(guac_terminal_buffer* buffer) {
  * @return
  *     The buffer row at the given location, or NULL if there is no such row.
  */
-static guac_terminal_buffer_row* guac_terminal_buffer_get_row(guac_terminal_buffer* buffer, int row) {
+static guac_terminal_buffer_row* guac_terminal_buffer_locate_row(guac_terminal_buffer* buffer, int row) {
 
     if (abs(row) >= buffer->available)
         return NULL;
@@ -186,27 +549,52 @@ static guac_terminal_buffer_row* guac_terminal_buffer_get_row(guac_terminal_buff
 }
 
 /**
- * Rounds the given value up to the nearest possible row length. To avoid
- * unnecessary, repeated resizing of rows, each row length is rounded up to the
- * nearest power of two.
+ * Returns the row at the given location, allocating that row or expanding it
+ * from compact form as necessary such that its characters may be accessed
+ * directly.
  *
- * @param value
- *     The value to round.
+ * @param buffer
+ *     The buffer to retrieve a row from.
+ *
+ * @param row
+ *     The index of the row to retrieve, where zero is the top-most row.
+ *     Negative indices represent rows in the scrollback buffer, above the
+ *     top-most row.
  *
  * @return
- *     The power of two that is closest to the given value without exceeding
- *     that value.
+ *     The buffer row at the given location, or NULL if there is no such row.
  */
-static unsigned int guac_terminal_buffer_row_length(int value) {
+static guac_terminal_buffer_row* guac_terminal_buffer_get_row(guac_terminal_buffer* buffer, int row) {
 
-    GUAC_ASSERT(value >= 0);
-    GUAC_ASSERT(value <= GUAC_TERMINAL_MAX_COLUMNS);
+    guac_terminal_buffer_row* buffer_row = guac_terminal_buffer_locate_row(buffer, row);
+    if (buffer_row != NULL && buffer_row->characters == NULL)
+        guac_terminal_buffer_row_unpack(buffer, buffer_row, row);
 
-    unsigned int rounded = GUAC_TERMINAL_BUFFER_ROW_MIN_SIZE;
-    while (rounded < value)
-        rounded <<= 1;
+    return buffer_row;
 
-    return rounded;
+}
+
+/**
+ * Converts all rows within the given range of rows to compact form. Rows
+ * which are already in compact form or have never been used are unaffected.
+ *
+ * @param buffer
+ *     The buffer containing the rows.
+ *
+ * @param start_row
+ *     The first row to convert.
+ *
+ * @param end_row
+ *     The last row to convert, inclusive.
+ */
+static void guac_terminal_buffer_pack_rows(guac_terminal_buffer* buffer,
+        int start_row, int end_row) {
+
+    for (int row = start_row; row <= end_row; row++) {
+        guac_terminal_buffer_row* buffer_row = guac_terminal_buffer_locate_row(buffer, row);
+        if (buffer_row != NULL)
+            guac_terminal_buffer_row_pack(buffer, buffer_row);
+    }
 
 }
 
@@ -435,6 +823,19 @@ void guac_terminal_buffer_scroll_up(guac_terminal_buffer* buffer, int amount,
 
     buffer->top = (buffer->top + amount) % buffer->available;
 
+    /* Rows which were scrolled into the scrollback region, as well as any
+     * scrollback rows that were expanded while viewed, are unlikely to be
+     * modified and are stored in compact form */
+    int scrollback_top = -amount;
+    if (buffer->expanded_top != 0)
+        scrollback_top = buffer->expanded_top - amount;
+
+    if (scrollback_top <= -(int) buffer->available)
+        scrollback_top = -(int) buffer->available + 1;
+
+    guac_terminal_buffer_pack_rows(buffer, scrollback_top, -1);
+    buffer->expanded_top = 0;
+
     /* Increase buffer length only if new row is added */
     if (increase_length) {
         buffer->length += amount;
@@ -451,6 +852,12 @@ void guac_terminal_buffer_scroll_down(guac_terminal_buffer* buffer, int amount)
 
     buffer->top = (buffer->top - amount) % buffer->available;
 
+    /* Track any expanded scrollback rows that remain within the scrollback
+     * region */
+    buffer->expanded_top += amount;
+    if (buffer->expanded_top > 0)
+        buffer->expanded_top = 0;
+
 }
 
 unsigned int guac_terminal_buffer_get_columns(guac_terminal_buffer* buffer,
@@ -523,6 +930,46 @@ void guac_terminal_buffer_set_columns(guac_terminal_buffer* buffer, int row,
 
 }
 
+void guac_terminal_buffer_set_characters(guac_terminal_buffer* buffer, int row,
+        int start_column, const guac_terminal_char* characters, int length) {
+
+    if (length <= 0 || row >= GUAC_TERMINAL_MAX_ROWS || row <= -GUAC_TERMINAL_MAX_ROWS)
+        return;
+
+    /* Ignore any characters which would extend beyond the maximum row size */
+    if (start_column < 0 || start_column >= GUAC_TERMINAL_MAX_COLUMNS)
+        return;
+
+    if (length > GUAC_TERMINAL_MAX_COLUMNS - start_column)
+        length = GUAC_TERMINAL_MAX_COLUMNS - start_column;
+
+    guac_terminal_buffer_row* buffer_row = guac_terminal_buffer_get_row(buffer, row);
+    if (buffer_row == NULL)
+        return;
+
+    int end_column = start_column + length - 1;
+    guac_terminal_buffer_row_expand(buffer_row, end_column + 1, &buffer->default_character);
+    GUAC_ASSERT(buffer_row->length >= end_column + 1);
+
+    memcpy(&buffer_row->characters[start_column], characters,
+            guac_mem_ckd_mul_or_die(sizeof(guac_terminal_char), length));
+
+    /* Update length depending on row written */
+    if (row >= buffer->length) {
+        for (int i = 0; i < length; i++) {
+            if (characters[i].value != 0) {
+                buffer->length = row + 1;
+                break;
+            }
+        }
+    }
+
+    /* Force breaks around destination region */
+    guac_terminal_buffer_force_break(buffer, row, start_column);
+    guac_terminal_buffer_force_break(buffer, row, end_column + 1);
+
+}
+
 void guac_terminal_buffer_set_cursor(guac_terminal_buffer* buffer, int row,
         int column, bool is_cursor) {
 
@@ -560,7 +1007,7 @@ unsigned int guac_terminal_buffer_effective_length(guac_terminal_buffer* buffer,
 
 void guac_terminal_buffer_set_wrapped(guac_terminal_buffer* buffer, int row, bool wrapped) {
 
-    guac_terminal_buffer_row* buffer_row = guac_terminal_buffer_get_row(buffer, row);
+    guac_terminal_buffer_row* buffer_row = guac_terminal_buffer_locate_row(buffer, row);
     if (buffer_row == NULL)
         return;
 
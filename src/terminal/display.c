@@ -17,25 +17,25 @@
  * under the License.
  */
 
-#include "common/surface.h"
 #include "terminal/common.h"
 #include "terminal/display.h"
+#include "terminal/glyph-cache.h"
 #include "terminal/palette.h"
 #include "terminal/terminal.h"
 #include "terminal/terminal-priv.h"
 #include "terminal/types.h"
 
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
 
 #include <cairo/cairo.h>
-#include <glib-object.h>
 #include <guacamole/assert.h>
 #include <guacamole/client.h>
+#include <guacamole/display.h>
 #include <guacamole/mem.h>
 #include <guacamole/protocol.h>
+#include <guacamole/rect.h>
 #include <guacamole/socket.h>
 #include <pango/pangocairo.h>
 
@@ -99,33 +99,52 @@ int __guac_terminal_set_colors(guac_terminal_display* display,
 }
 
 /**
- * Sends the given character to the terminal at the given row and column,
- * rendering the character immediately. This bypasses the guac_terminal_display
- * mechanism and is intended for flushing of updates only.
+ * Initializes the given rectangle such that it covers the given region of the
+ * display, in pixels, excluding any part of that region which lies outside
+ * the current bounds of the display.
+ *
+ * @param display
+ *     The display containing the region.
+ *
+ * @param rect
+ *     The rectangle to initialize.
+ *
+ * @param x
+ *     The X coordinate of the upper-left corner of the region, in pixels.
+ *
+ * @param y
+ *     The Y coordinate of the upper-left corner of the region, in pixels.
+ *
+ * @param width
+ *     The width of the region, in pixels.
+ *
+ * @param height
+ *     The height of the region, in pixels.
  */
-int __guac_terminal_set(guac_terminal_display* display, int row, int col, int codepoint) {
-
-    int width;
+static void guac_terminal_display_init_rect(guac_terminal_display* display,
+        guac_rect* rect, int x, int y, int width, int height) {
 
-    int bytes;
-    char utf8[4];
+    guac_rect bounds;
+    guac_rect_init(&bounds, 0, 0,
+            display->width  * display->char_width,
+            display->height * display->char_height);
 
-    /* Use foreground color */
-    const guac_terminal_color* color = &display->glyph_foreground;
+    guac_rect_init(rect, x, y, width, height);
+    guac_rect_constrain(rect, &bounds);
 
-    /* Use background color */
-    const guac_terminal_color* background = &display->glyph_background;
+}
 
-    cairo_surface_t* surface;
-    cairo_t* cairo;
-    int surface_width, surface_height;
-   
-    PangoLayout* layout;
-    int layout_width, layout_height;
-    int ideal_layout_width, ideal_layout_height;
+/**
+ * Sends the given character to the terminal at the given row and column,
+ * rendering the character immediately. This bypasses the guac_terminal_display
+ * mechanism and is intended for flushing of updates only, while the display
+ * layer is open for drawing. The character is drawn from the glyph cache, and
+ * is rendered with Pango only if not already cached.
+ */
+int __guac_terminal_set(guac_terminal_display* display, int row, int col, int codepoint) {
 
     /* Calculate width in columns */
-    width = wcwidth(codepoint);
+    int width = wcwidth(codepoint);
     if (width < 0)
         width = 1;
 
@@ -133,71 +152,30 @@ int __guac_terminal_set(guac_terminal_display* display, int row, int col, int co
     if (width == 0)
         return 0;
 
-    /* Convert to UTF-8 */
-    bytes = guac_terminal_encode_utf8(codepoint, utf8);
+    /* Characters wider than the atlas allows are drawn scaled down */
+    if (width > GUAC_TERMINAL_MAX_CHAR_WIDTH)
+        width = GUAC_TERMINAL_MAX_CHAR_WIDTH;
 
-    surface_width = width * display->char_width;
-    surface_height = display->char_height;
+    cairo_surface_t* glyph = guac_terminal_glyph_cache_get(
+            display->glyph_cache, codepoint, width,
+            &display->glyph_foreground, &display->glyph_background);
 
-    ideal_layout_width = surface_width * PANGO_SCALE;
-    ideal_layout_height = surface_height * PANGO_SCALE;
-
-    /* Prepare surface */
-    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
-                                         surface_width, surface_height);
-    cairo = cairo_create(surface);
-
-    /* Fill background */
-    cairo_set_source_rgb(cairo,
-            background->red   / 255.0,
-            background->green / 255.0,
-            background->blue  / 255.0);
-
-    cairo_rectangle(cairo, 0, 0, surface_width, surface_height); 
-    cairo_fill(cairo);
-
-    /* Get layout */
-    layout = pango_cairo_create_layout(cairo);
-    pango_layout_set_font_description(layout, display->font_desc);
-    pango_layout_set_text(layout, utf8, bytes);
-    pango_layout_set_alignment(layout, PANGO_ALIGN_CENTER);
-
-    pango_layout_get_size(layout, &layout_width, &layout_height);
-
-    /* If layout bigger than available space, scale it back */
-    if (layout_width > ideal_layout_width || layout_height > ideal_layout_height) {
-
-        double scale = fmin(ideal_layout_width  / (double) layout_width,
-                            ideal_layout_height / (double) layout_height);
-
-        cairo_scale(cairo, scale, scale);
-
-        /* Update layout to reflect scaled surface */
-        pango_layout_set_width(layout, ideal_layout_width / scale);
-        pango_layout_set_height(layout, ideal_layout_height / scale);
-        pango_cairo_update_layout(cairo, layout);
-
-    }
-
-    /* Draw */
-    cairo_set_source_rgb(cairo,
-            color->red   / 255.0,
-            color->green / 255.0,
-            color->blue  / 255.0);
-
-    cairo_move_to(cairo, 0.0, 0.0);
-    pango_cairo_show_layout(cairo, layout);
+    /* Do nothing if the glyph could not be rendered */
+    if (glyph == NULL)
+        return 0;
 
-    /* Draw */
-    guac_common_surface_draw(display->display_surface,
-        display->char_width * col,
-        display->char_height * row,
-        surface);
+    /* Draw, clipping any part of the glyph beyond the edge of the display */
+    guac_rect dst;
+    guac_terminal_display_init_rect(display, &dst,
+            display->char_width * col,
+            display->char_height * row,
+            cairo_image_surface_get_width(glyph),
+            cairo_image_surface_get_height(glyph));
 
-    /* Free all */
-    g_object_unref(layout);
-    cairo_destroy(cairo);
-    cairo_surface_destroy(surface);
+    if (!guac_rect_is_empty(&dst))
+        guac_display_layer_raw_context_put(display->context, &dst,
+                cairo_image_surface_get_data(glyph),
+                cairo_image_surface_get_stride(glyph));
 
     return 0;
 
@@ -227,28 +205,36 @@ guac_terminal_display* guac_terminal_display_alloc(guac_client* client,
 
     /* Initially no font loaded */
     display->font_desc = NULL;
+    display->glyph_cache = NULL;
     display->char_width = 0;
     display->char_height = 0;
 
-    /* Create default surface */
-    display->display_layer = guac_client_alloc_layer(client);
-    display->select_layer = guac_client_alloc_layer(client);
-    display->display_surface = guac_common_surface_alloc(client,
-            client->socket, display->display_layer, 0, 0);
+    /* Render all layers through a guac_display, sending each frame once
+     * complete */
+    display->graphical_display = guac_display_alloc(client);
+    display->render_thread = guac_display_render_thread_create(
+            display->graphical_display);
+
+    /* Create layers (no drawing in progress) */
+    display->display_layer = guac_display_alloc_layer(display->graphical_display, 1);
+    display->select_layer = guac_display_alloc_layer(display->graphical_display, 0);
+    display->context = NULL;
 
     /* Never use lossy compression for terminal contents */
-    guac_common_surface_set_lossless(display->display_surface, 1);
+    guac_display_layer_set_lossless(
+            guac_display_default_layer(display->graphical_display), 1);
+    guac_display_layer_set_lossless(display->display_layer, 1);
+    guac_display_layer_set_lossless(display->select_layer, 1);
 
     /* Select layer is a child of the display layer */
-    guac_protocol_send_move(client->socket, display->select_layer,
-            display->display_layer, 0, 0, 0);
+    guac_display_layer_set_parent(display->select_layer, display->display_layer);
 
     /* Calculate margin size by DPI */
     display->margin = get_margin_by_dpi(dpi);
 
     /* Offset the Default Layer to make margins even on all sides */
-    guac_protocol_send_move(client->socket, display->display_layer,
-        GUAC_DEFAULT_LAYER, display->margin, display->margin, 0);
+    guac_display_layer_move(display->display_layer,
+            display->margin, display->margin);
 
     display->default_foreground = display->glyph_foreground = *foreground;
     display->default_background = display->glyph_background = *background;
@@ -267,9 +253,8 @@ guac_terminal_display* guac_terminal_display_alloc(guac_client* client,
     if (guac_terminal_display_set_font(display, font_name, font_size, dpi)) {
         guac_client_abort(display->client, GUAC_PROTOCOL_STATUS_SERVER_ERROR,
                 "Unable to set initial font \"%s\"", font_name);
-        guac_common_surface_free(display->display_surface);
-        guac_client_free_layer(client, display->display_layer);
-        guac_client_free_layer(client, display->select_layer);
+        guac_display_render_thread_destroy(display->render_thread);
+        guac_display_free(display->graphical_display);
         guac_mem_free(display->default_palette);
         guac_mem_free(display);
         return NULL;
@@ -281,8 +266,13 @@ guac_terminal_display* guac_terminal_display_alloc(guac_client* client,
 
 void guac_terminal_display_free(guac_terminal_display* display) {
 
-    /* Free font description */
+    /* Stop rendering frames, freeing all layers */
+    guac_display_render_thread_destroy(display->render_thread);
+    guac_display_free(display->graphical_display);
+
+    /* Free font description and all glyphs rendered with that font */
     pango_font_description_free(display->font_desc);
+    guac_terminal_glyph_cache_free(display->glyph_cache);
 
     /* Free default palette. */
     guac_mem_free(display->default_palette);
@@ -519,6 +509,49 @@ void guac_terminal_display_set_columns(guac_terminal_display* display, int row,
 
 }
 
+void guac_terminal_display_set_characters(guac_terminal_display* display,
+        int row, int start_column, const guac_terminal_char* characters,
+        int length) {
+
+    /* Ignore operations outside display bounds */
+    if (row < 0 || row >= display->height)
+        return;
+
+    /* Fit range within bounds */
+    if (start_column < 0 || start_column >= display->width)
+        return;
+
+    if (length > display->width - start_column)
+        length = display->width - start_column;
+
+    size_t start_offset = guac_mem_ckd_add_or_die(guac_mem_ckd_mul_or_die(row, display->width), start_column);
+    guac_terminal_operation* current = &(display->operations[start_offset]);
+
+    for (int i = 0; i < length; i++, current++) {
+
+        /* Continuation characters are drawn as part of the character they
+         * continue, and empty glyphs are not drawn at all */
+        const guac_terminal_char* character = &characters[i];
+        if (character->value == GUAC_CHAR_CONTINUATION || character->width == 0)
+            continue;
+
+        /* Flush pending copy operation before adding new SET operation. This
+         * avoid operation conflicts that cause inconsistent display. */
+        if (current->type == GUAC_CHAR_COPY)
+            guac_terminal_display_flush_operations(display);
+
+        current->type      = GUAC_CHAR_SET;
+        current->character = *character;
+
+    }
+
+    /* Track unflushed GUAC_CHAR_SET operations exactly as
+     * guac_terminal_display_set_columns() does */
+    if (row > 0 && row < display->height - 1)
+        display->unflushed_set = true;
+
+}
+
 void guac_terminal_display_resize(guac_terminal_display* display, int width, int height) {
 
     /* Resize display only if dimensions have changed */
@@ -573,19 +606,88 @@ void guac_terminal_display_resize(guac_terminal_display* display, int width, int
     display->width = width;
     display->height = height;
 
-    /* Send display size */
-    guac_common_surface_resize(
-            display->display_surface,
+    /* Resize layers to match */
+    guac_display_layer_resize(display->display_layer,
             display->char_width  * width,
             display->char_height * height);
 
-    guac_protocol_send_size(display->client->socket,
-            display->select_layer,
+    guac_display_layer_resize(display->select_layer,
             display->char_width  * width,
             display->char_height * height);
 
 }
 
+/**
+ * Copies a rectangle of pixels from one location within the display layer to
+ * another while the display layer is open for drawing. The source and
+ * destination may overlap. Copying pixels within the layer is sufficient for
+ * the resulting update to be sent as a copy, as guac_display automatically
+ * detects any content which has moved since the previous frame.
+ *
+ * @param display
+ *     The display whose layer is being drawn to.
+ *
+ * @param src_x
+ *     The X coordinate of the upper-left corner of the source rectangle.
+ *
+ * @param src_y
+ *     The Y coordinate of the upper-left corner of the source rectangle.
+ *
+ * @param width
+ *     The width of the rectangle, in pixels.
+ *
+ * @param height
+ *     The height of the rectangle, in pixels.
+ *
+ * @param dst_x
+ *     The X coordinate of the upper-left corner of the destination.
+ *
+ * @param dst_y
+ *     The Y coordinate of the upper-left corner of the destination.
+ */
+static void guac_terminal_display_copy_rect(guac_terminal_display* display,
+        int src_x, int src_y, int width, int height, int dst_x, int dst_y) {
+
+    guac_display_layer_raw_context* context = display->context;
+
+    /* Clip copy such that both source and destination are in bounds */
+    guac_rect src, dst;
+    guac_terminal_display_init_rect(display, &src, src_x, src_y, width, height);
+    guac_terminal_display_init_rect(display, &dst, dst_x, dst_y,
+            guac_rect_width(&src), guac_rect_height(&src));
+
+    if (guac_rect_is_empty(&dst))
+        return;
+
+    size_t stride = context->stride;
+    size_t length = guac_mem_ckd_mul_or_die(guac_rect_width(&dst),
+            GUAC_DISPLAY_LAYER_RAW_BPP);
+
+    unsigned char* src_row = GUAC_DISPLAY_LAYER_RAW_BUFFER(context, src);
+    unsigned char* dst_row = GUAC_DISPLAY_LAYER_RAW_BUFFER(context, dst);
+
+    /* Copy from the bottom up if copying downward, such that rows are not
+     * overwritten before they are copied */
+    if (dst.top > src.top) {
+        size_t offset = guac_mem_ckd_mul_or_die(guac_rect_height(&dst) - 1, stride);
+        for (int y = dst.bottom - 1; y >= dst.top; y--) {
+            memmove(dst_row + offset, src_row + offset, length);
+            offset -= stride;
+        }
+    }
+
+    else {
+        for (int y = dst.top; y < dst.bottom; y++) {
+            memmove(dst_row, src_row, length);
+            src_row += stride;
+            dst_row += stride;
+        }
+    }
+
+    guac_rect_extend(&context->dirty, &dst);
+
+}
+
 void __guac_terminal_display_flush_copy(guac_terminal_display* display) {
 
     guac_terminal_operation* current = display->operations;
@@ -688,16 +790,12 @@ void __guac_terminal_display_flush_copy(guac_terminal_display* display) {
 
                 }
 
-                /* Send copy */
-                guac_common_surface_copy(
-
-                        display->display_surface,
+                /* Copy */
+                guac_terminal_display_copy_rect(display,
                         current->column * display->char_width,
                         current->row * display->char_height,
                         rect_width * display->char_width,
                         rect_height * display->char_height,
-
-                        display->display_surface,
                         col * display->char_width,
                         row * display->char_height);
 
@@ -825,15 +923,20 @@ void __guac_terminal_display_flush_clear(guac_terminal_display* display) {
 
                 }
 
-                /* Send rect */
-                guac_common_surface_set(
-                        display->display_surface,
+                /* Fill rect */
+                guac_rect dst;
+                guac_terminal_display_init_rect(display, &dst,
                         col * display->char_width,
                         row * display->char_height,
                         rect_width * display->char_width,
-                        rect_height * display->char_height,
-                        color.red, color.green, color.blue,
-                        0xFF);
+                        rect_height * display->char_height);
+
+                if (!guac_rect_is_empty(&dst))
+                    guac_display_layer_raw_context_set(display->context, &dst,
+                            0xFF000000
+                            | (color.red   << 16)
+                            | (color.green << 8)
+                            |  color.blue);
 
             } /* end if clear operation */
 
@@ -887,11 +990,16 @@ void __guac_terminal_display_flush_set(guac_terminal_display* display) {
 }
 void guac_terminal_display_flush_operations(guac_terminal_display* display) {
 
+    display->context = guac_display_layer_open_raw(display->display_layer);
+
     /* Flush operations, copies first, then clears, then sets. */
     __guac_terminal_display_flush_copy(display);
     __guac_terminal_display_flush_clear(display);
     __guac_terminal_display_flush_set(display);
 
+    guac_display_layer_close_raw(display->display_layer, display->context);
+    display->context = NULL;
+
 }
 
 void guac_terminal_display_flush(guac_terminal_display* display) {
@@ -899,38 +1007,83 @@ void guac_terminal_display_flush(guac_terminal_display* display) {
     /* Flush operations */
     guac_terminal_display_flush_operations(display);
 
-    /* Flush surface */
-    guac_common_surface_flush(display->display_surface);
+    /* The frame is now complete */
+    guac_display_render_thread_notify_frame(display->render_thread);
 
 }
 
 void guac_terminal_display_dup(
         guac_terminal_display* display, guac_client* client, guac_socket* socket) {
 
-    /* Create default surface */
-    guac_common_surface_dup(display->display_surface, client, socket);
+    /* Sync all layers, including the mouse cursor */
+    guac_display_dup(display->graphical_display, socket);
 
-    /* Select layer is a child of the display layer */
-    guac_protocol_send_move(socket, display->select_layer,
-            display->display_layer, 0, 0, 0);
+}
 
-    /* Offset the Default Layer to make margins even on all sides */
-    guac_protocol_send_move(socket, display->display_layer,
-        GUAC_DEFAULT_LAYER, display->margin, display->margin, 0);
+/**
+ * Erases the entire select layer, making it fully transparent.
+ *
+ * @param display
+ *     The display whose select layer is open for drawing.
+ *
+ * @param context
+ *     The context of the select layer.
+ */
+static void guac_terminal_display_erase_select(guac_terminal_display* display,
+        guac_display_layer_raw_context* context) {
+
+    guac_rect dst;
+    guac_terminal_display_init_rect(display, &dst, 0, 0,
+            display->width  * display->char_width,
+            display->height * display->char_height);
+
+    if (!guac_rect_is_empty(&dst))
+        guac_display_layer_raw_context_set(context, &dst, 0x00000000);
+
+}
+
+/**
+ * Fills the given rectangle of character cells within the select layer with
+ * the color used to highlight selected text.
+ *
+ * @param display
+ *     The display whose select layer is open for drawing.
+ *
+ * @param context
+ *     The context of the select layer.
+ *
+ * @param row
+ *     The first row of the rectangle.
+ *
+ * @param column
+ *     The first column of the rectangle.
+ *
+ * @param rows
+ *     The height of the rectangle, in rows.
+ *
+ * @param columns
+ *     The width of the rectangle, in columns.
+ */
+static void guac_terminal_display_fill_select(guac_terminal_display* display,
+        guac_display_layer_raw_context* context, int row, int column,
+        int rows, int columns) {
+
+    guac_rect dst;
+    guac_terminal_display_init_rect(display, &dst,
+            column * display->char_width,
+            row * display->char_height,
+            columns * display->char_width,
+            rows * display->char_height);
 
-    /* Send select layer size */
-    guac_protocol_send_size(socket, display->select_layer,
-            display->char_width  * display->width,
-            display->char_height * display->height);
+    if (!guac_rect_is_empty(&dst))
+        guac_display_layer_raw_context_set(context, &dst,
+                GUAC_TERMINAL_SELECTION_COLOR);
 
 }
 
 void guac_terminal_display_select(guac_terminal_display* display,
         int start_row, int start_col, int end_row, int end_col, bool rectangle) {
 
-    guac_socket* socket = display->client->socket;
-    guac_layer* select_layer = display->select_layer;
-
     /* Do nothing if selection is unchanged */
     if (display->text_selected
             && display->selection_start_row    == start_row
@@ -947,6 +1100,12 @@ void guac_terminal_display_select(guac_terminal_display* display,
     display->selection_end_row = end_row;
     display->selection_end_column = end_col;
 
+    guac_display_layer_raw_context* context =
+        guac_display_layer_open_raw(display->select_layer);
+
+    /* Erase old selection */
+    guac_terminal_display_erase_select(display, context);
+
     /* If single row, just need one rectangle */
     if (start_row == end_row) {
 
@@ -958,11 +1117,8 @@ void guac_terminal_display_select(guac_terminal_display* display,
         }
 
         /* Select characters between columns */
-        guac_protocol_send_rect(socket, select_layer,
-                start_col * display->char_width,
-                start_row * display->char_height,
-                (end_col - start_col + 1) * display->char_width,
-                display->char_height);
+        guac_terminal_display_fill_select(display, context,
+                start_row, start_col, 1, end_col - start_col + 1);
 
     }
 
@@ -971,42 +1127,32 @@ void guac_terminal_display_select(guac_terminal_display* display,
 
         /* Multilines rectangular selection */
         if (rectangle) {
-            guac_protocol_send_rect(socket, select_layer,
-                    start_col * display->char_width,
-                    start_row * display->char_height,
-                    (end_col - start_col + 1) * display->char_width,
-                    (end_row - start_row + 1) * display->char_height);
+            guac_terminal_display_fill_select(display, context,
+                    start_row, start_col,
+                    end_row - start_row + 1,
+                    end_col - start_col + 1);
         }
 
         /* Multilines standard selection */
         else {
+
             /* First row */
-            guac_protocol_send_rect(socket, select_layer,
-                    start_col * display->char_width,
-                    start_row * display->char_height,
-                    display->width * display->char_width,
-                    display->char_height);
+            guac_terminal_display_fill_select(display, context,
+                    start_row, start_col, 1, display->width);
 
             /* Middle */
-            guac_protocol_send_rect(socket, select_layer,
-                    0,
-                    (start_row + 1) * display->char_height,
-                    display->width * display->char_width,
-                    (end_row - start_row - 1) * display->char_height);
+            guac_terminal_display_fill_select(display, context,
+                    start_row + 1, 0, end_row - start_row - 1, display->width);
 
             /* Last row */
-            guac_protocol_send_rect(socket, select_layer,
-                    0,
-                    end_row * display->char_height,
-                    (end_col + 1) * display->char_width,
-                    display->char_height);
+            guac_terminal_display_fill_select(display, context,
+                    end_row, 0, 1, end_col + 1);
+
         }
 
     }
 
-    /* Draw new selection, erasing old */
-    guac_protocol_send_cfill(socket, GUAC_COMP_SRC, select_layer,
-            0x00, 0x80, 0xFF, 0x60);
+    guac_display_layer_close_raw(display->select_layer, context);
 
 }
 
@@ -1016,12 +1162,12 @@ void guac_terminal_display_clear_select(guac_terminal_display* display) {
     if (!display->text_selected)
         return;
 
-    guac_socket* socket = display->client->socket;
-    guac_layer* select_layer = display->select_layer;
+    guac_display_layer_raw_context* context =
+        guac_display_layer_open_raw(display->select_layer);
+
+    guac_terminal_display_erase_select(display, context);
 
-    guac_protocol_send_rect(socket, select_layer, 0, 0, 1, 1);
-    guac_protocol_send_cfill(socket, GUAC_COMP_SRC, select_layer,
-            0x00, 0x00, 0x00, 0x00);
+    guac_display_layer_close_raw(display->select_layer, context);
 
     /* Text is no longer selected */
     display->text_selected = false;
@@ -1087,6 +1233,11 @@ int guac_terminal_display_set_font(guac_terminal_display* display,
     display->font_desc = font_desc;
     pango_font_description_free(old_font_desc);
 
+    /* Glyphs rendered with the old font can no longer be used */
+    guac_terminal_glyph_cache_free(display->glyph_cache);
+    display->glyph_cache = guac_terminal_glyph_cache_alloc(font_desc,
+            display->char_width, display->char_height);
+
     return 0;
 
 }
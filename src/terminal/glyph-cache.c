@@ -0,0 +1,354 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "terminal/common.h"
+#include "terminal/display.h"
+#include "terminal/glyph-cache.h"
+#include "terminal/palette.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#include <cairo/cairo.h>
+#include <glib-object.h>
+#include <guacamole/mem.h>
+#include <pango/pangocairo.h>
+
+/**
+ * Returns whether the given colors have identical red, green, and blue
+ * components. Palette indices are ignored, as distinct palette entries may
+ * define the same color.
+ *
+ * @param a
+ *     The first color to compare.
+ *
+ * @param b
+ *     The second color to compare.
+ *
+ * @return
+ *     Non-zero if the colors are identical, zero otherwise.
+ */
+static int guac_terminal_glyph_color_equal(const guac_terminal_color* a,
+        const guac_terminal_color* b) {
+    return a->red == b->red && a->green == b->green && a->blue == b->blue;
+}
+
+/**
+ * Returns the set of the glyph cache which would contain the glyph having
+ * the given codepoint, width, and colors.
+ *
+ * @param codepoint
+ *     The Unicode codepoint of the character.
+ *
+ * @param width
+ *     The width of the character, in columns.
+ *
+ * @param foreground
+ *     The foreground color of the glyph.
+ *
+ * @param background
+ *     The background color of the glyph.
+ *
+ * @return
+ *     The index of the set which would contain the glyph, between 0 and
+ *     GUAC_TERMINAL_GLYPH_CACHE_SETS - 1 inclusive.
+ */
+static int guac_terminal_glyph_cache_hash(int codepoint, int width,
+        const guac_terminal_color* foreground,
+        const guac_terminal_color* background) {
+
+    uint32_t fg = (foreground->red << 16) | (foreground->green << 8)
+        | foreground->blue;
+
+    uint32_t bg = (background->red << 16) | (background->green << 8)
+        | background->blue;
+
+    /* Mix all components such that runs of consecutive codepoints in the
+     * same colors are spread across consecutive sets */
+    uint32_t hash = (uint32_t) codepoint + width * 0x9E3779B9u;
+    hash += (fg * 0x85EBCA6Bu) ^ (bg * 0xC2B2AE35u);
+    hash ^= hash >> 16;
+
+    return hash % GUAC_TERMINAL_GLYPH_CACHE_SETS;
+
+}
+
+/**
+ * Creates a new surface for the given glyph, exactly as wide as a character
+ * of the given width. If the glyph cache has an atlas, the surface
+ * references the glyph's slot within the atlas. Otherwise, the glyph must be
+ * the uncached glyph of the glyph cache, and the surface is allocated
+ * independently.
+ *
+ * @param cache
+ *     The glyph cache containing the glyph.
+ *
+ * @param glyph
+ *     The glyph that the surface is for.
+ *
+ * @param width
+ *     The width of the character, in columns.
+ *
+ * @return
+ *     A newly-created surface for the glyph, which must eventually be
+ *     destroyed with cairo_surface_destroy(). This surface may be in an error
+ *     state if it could not be allocated.
+ */
+static cairo_surface_t* guac_terminal_glyph_surface_create(
+        guac_terminal_glyph_cache* cache, guac_terminal_glyph* glyph,
+        int width) {
+
+    int surface_width = width * cache->char_width;
+    int surface_height = cache->char_height;
+
+    if (cache->atlas == NULL)
+        return cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                surface_width, surface_height);
+
+    /* Locate this slot within the grid of the atlas (RGB24 pixels are four
+     * bytes each) */
+    int slot = glyph - cache->glyphs;
+    int x = (slot % GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS)
+        * GUAC_TERMINAL_MAX_CHAR_WIDTH * cache->char_width;
+    int y = (slot / GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS) * surface_height;
+
+    int stride = cairo_image_surface_get_stride(cache->atlas);
+    unsigned char* data = cairo_image_surface_get_data(cache->atlas)
+        + y * stride + x * 4;
+
+    return cairo_image_surface_create_for_data(data, CAIRO_FORMAT_RGB24,
+            surface_width, surface_height, stride);
+
+}
+
+/**
+ * Renders the given character with the given colors into the given slot of
+ * the glyph cache, replacing any glyph previously stored there. If a surface
+ * cannot be allocated for the glyph, the surface of the glyph is left NULL.
+ *
+ * @param cache
+ *     The glyph cache containing the slot.
+ *
+ * @param glyph
+ *     The slot of the glyph cache to render into.
+ *
+ * @param codepoint
+ *     The Unicode codepoint of the character to render.
+ *
+ * @param width
+ *     The width of the character, in columns.
+ *
+ * @param foreground
+ *     The color to use for the character itself.
+ *
+ * @param background
+ *     The color to use for the area surrounding the character.
+ */
+static void guac_terminal_glyph_render(guac_terminal_glyph_cache* cache,
+        guac_terminal_glyph* glyph, int codepoint, int width,
+        const guac_terminal_color* foreground,
+        const guac_terminal_color* background) {
+
+    int bytes;
+    char utf8[4];
+
+    PangoLayout* layout;
+    int layout_width, layout_height;
+
+    int surface_width = width * cache->char_width;
+    int surface_height = cache->char_height;
+
+    int ideal_layout_width = surface_width * PANGO_SCALE;
+    int ideal_layout_height = surface_height * PANGO_SCALE;
+
+    /* Reference only the portion of the atlas owned by this slot, sized
+     * exactly to the glyph being rendered */
+    if (glyph->surface == NULL || glyph->width != width) {
+
+        cairo_surface_destroy(glyph->surface);
+        glyph->surface = guac_terminal_glyph_surface_create(cache, glyph,
+                width);
+
+        if (cairo_surface_status(glyph->surface) != CAIRO_STATUS_SUCCESS) {
+            cairo_surface_destroy(glyph->surface);
+            glyph->surface = NULL;
+            return;
+        }
+
+    }
+
+    glyph->codepoint = codepoint;
+    glyph->width = width;
+    glyph->foreground = *foreground;
+    glyph->background = *background;
+
+    /* Convert to UTF-8 */
+    bytes = guac_terminal_encode_utf8(codepoint, utf8);
+
+    cairo_t* cairo = cairo_create(glyph->surface);
+
+    /* Fill background */
+    cairo_set_source_rgb(cairo,
+            background->red   / 255.0,
+            background->green / 255.0,
+            background->blue  / 255.0);
+
+    cairo_rectangle(cairo, 0, 0, surface_width, surface_height);
+    cairo_fill(cairo);
+
+    /* Get layout */
+    layout = pango_cairo_create_layout(cairo);
+    pango_layout_set_font_description(layout, cache->font_desc);
+    pango_layout_set_text(layout, utf8, bytes);
+    pango_layout_set_alignment(layout, PANGO_ALIGN_CENTER);
+
+    pango_layout_get_size(layout, &layout_width, &layout_height);
+
+    /* If layout bigger than available space, scale it back */
+    if (layout_width > ideal_layout_width || layout_height > ideal_layout_height) {
+
+        double scale = fmin(ideal_layout_width  / (double) layout_width,
+                            ideal_layout_height / (double) layout_height);
+
+        cairo_scale(cairo, scale, scale);
+
+        /* Update layout to reflect scaled surface */
+        pango_layout_set_width(layout, ideal_layout_width / scale);
+        pango_layout_set_height(layout, ideal_layout_height / scale);
+        pango_cairo_update_layout(cairo, layout);
+
+    }
+
+    /* Draw */
+    cairo_set_source_rgb(cairo,
+            foreground->red   / 255.0,
+            foreground->green / 255.0,
+            foreground->blue  / 255.0);
+
+    cairo_move_to(cairo, 0.0, 0.0);
+    pango_cairo_show_layout(cairo, layout);
+
+    g_object_unref(layout);
+    cairo_destroy(cairo);
+
+    /* Ensure rendered pixels are visible when reading the atlas directly */
+    cairo_surface_flush(glyph->surface);
+
+}
+
+guac_terminal_glyph_cache* guac_terminal_glyph_cache_alloc(
+        const PangoFontDescription* font_desc, int char_width,
+        int char_height) {
+
+    guac_terminal_glyph_cache* cache =
+        guac_mem_zalloc(sizeof(guac_terminal_glyph_cache));
+
+    cache->font_desc = pango_font_description_copy(font_desc);
+    cache->char_width = char_width;
+    cache->char_height = char_height;
+
+    /* Each slot of the atlas must hold a character of the maximum width */
+    cache->atlas = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS * GUAC_TERMINAL_MAX_CHAR_WIDTH
+                * char_width,
+            GUAC_TERMINAL_GLYPH_ATLAS_ROWS * char_height);
+
+    /* Render glyphs directly, without caching, if the atlas is too large for
+     * Cairo or cannot be allocated */
+    if (cairo_surface_status(cache->atlas) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(cache->atlas);
+        cache->atlas = NULL;
+    }
+
+    return cache;
+
+}
+
+void guac_terminal_glyph_cache_free(guac_terminal_glyph_cache* cache) {
+
+    /* Ignore NULL caches */
+    if (cache == NULL)
+        return;
+
+    for (int i = 0; i < GUAC_TERMINAL_GLYPH_CACHE_SIZE; i++)
+        cairo_surface_destroy(cache->glyphs[i].surface);
+
+    cairo_surface_destroy(cache->uncached.surface);
+
+    cairo_surface_destroy(cache->atlas);
+    pango_font_description_free(cache->font_desc);
+    guac_mem_free(cache);
+
+}
+
+cairo_surface_t* guac_terminal_glyph_cache_get(guac_terminal_glyph_cache* cache,
+        int codepoint, int width, const guac_terminal_color* foreground,
+        const guac_terminal_color* background) {
+
+    /* Without an atlas, every glyph must be rendered */
+    if (cache->atlas == NULL) {
+        guac_terminal_glyph_render(cache, &cache->uncached, codepoint, width,
+                foreground, background);
+        cache->misses++;
+        return cache->uncached.surface;
+    }
+
+    int set = guac_terminal_glyph_cache_hash(codepoint, width,
+            foreground, background);
+
+    guac_terminal_glyph* glyph = &cache->glyphs[set * GUAC_TERMINAL_GLYPH_CACHE_WAYS];
+    guac_terminal_glyph* oldest = glyph;
+
+    cache->clock++;
+
+    /* Search set for the requested glyph, noting the least-recently-used
+     * glyph in case the requested glyph must be rendered */
+    for (int i = 0; i < GUAC_TERMINAL_GLYPH_CACHE_WAYS; i++, glyph++) {
+
+        if (glyph->last_used != 0
+                && glyph->codepoint == codepoint
+                && glyph->width == width
+                && guac_terminal_glyph_color_equal(&glyph->foreground, foreground)
+                && guac_terminal_glyph_color_equal(&glyph->background, background)) {
+            glyph->last_used = cache->clock;
+            cache->hits++;
+            return glyph->surface;
+        }
+
+        if (glyph->last_used < oldest->last_used)
+            oldest = glyph;
+
+    }
+
+    /* Replace least-recently-used glyph of the set */
+    guac_terminal_glyph_render(cache, oldest, codepoint, width,
+            foreground, background);
+
+    /* Leave the slot unused if the glyph could not be rendered */
+    if (oldest->surface == NULL) {
+        oldest->last_used = 0;
+        return NULL;
+    }
+
+    oldest->last_used = cache->clock;
+    cache->misses++;
+    return oldest->surface;
+
+}
+
@@ -231,12 +231,86 @@ static void guac_terminal_move_cursor(guac_terminal* term, int row, int col) {
 
 }
 
+/**
+ * Decodes the printable character at the beginning of the given UTF-8 text,
+ * if any. Only characters which guac_terminal_echo() would simply draw at the
+ * cursor position are decoded. Control characters (including C1 controls),
+ * DEL, invalid or overlong sequences, and sequences which are not yet
+ * complete are left to guac_terminal_echo().
+ *
+ * @param text
+ *     The UTF-8 text to decode.
+ *
+ * @param length
+ *     The number of bytes of text available.
+ *
+ * @param codepoint
+ *     Pointer to an int which receives the decoded codepoint, if any.
+ *
+ * @return
+ *     The number of bytes occupied by the decoded character, or zero if the
+ *     text does not begin with a complete, printable character.
+ */
+static int guac_terminal_decode_printable(const char* text, int length,
+        int* codepoint) {
+
+    unsigned char c = text[0];
+
+    /* Printable ASCII */
+    if (c >= 0x20 && c < 0x7F) {
+        *codepoint = c;
+        return 1;
+    }
+
+    int bytes;
+    int value;
+
+    if ((c & 0xE0) == 0xC0) { /* 110xxxxx */
+        value = c & 0x1F;
+        bytes = 2;
+    }
+
+    else if ((c & 0xF0) == 0xE0) { /* 1110xxxx */
+        value = c & 0x0F;
+        bytes = 3;
+    }
+
+    else if ((c & 0xF8) == 0xF0) { /* 11110xxx */
+        value = c & 0x07;
+        bytes = 4;
+    }
+
+    else
+        return 0;
+
+    if (bytes > length)
+        return 0;
+
+    for (int i = 1; i < bytes; i++) {
+
+        c = text[i];
+        if ((c & 0xC0) != 0x80) /* 10xxxxxx */
+            return 0;
+
+        value = (value << 6) | (c & 0x3F);
+
+    }
+
+    /* C1 controls and overlong encodings of ASCII are not simply drawn */
+    if (value < 0xA0)
+        return 0;
+
+    *codepoint = value;
+    return bytes;
+
+}
+
 int guac_terminal_echo(guac_terminal* term, unsigned char c) {
 
     int width;
 
-    static int bytes_remaining = 0;
-    static int codepoint = 0;
+    int bytes_remaining = term->echo_bytes_remaining;
+    int codepoint = term->echo_codepoint;
 
     const int* char_mapping = term->char_mapping[term->active_char_set];
 
@@ -294,6 +368,9 @@ int guac_terminal_echo(guac_terminal* term, unsigned char c) {
         bytes_remaining = 0;
     }
 
+    term->echo_bytes_remaining = bytes_remaining;
+    term->echo_codepoint = codepoint;
+
     /* If we need more bytes, wait for more bytes */
     if (bytes_remaining != 0)
         return 0;
@@ -405,6 +482,88 @@ int guac_terminal_echo(guac_terminal* term, unsigned char c) {
 
 }
 
+int guac_terminal_echo_text(guac_terminal* term, const char* text,
+        int length) {
+
+    if (term->char_handler != guac_terminal_echo
+            || term->echo_bytes_remaining != 0
+            || term->pipe_stream != NULL
+            || term->insert_mode
+            || term->char_mapping[term->active_char_set] != NULL)
+        return 0;
+
+    /* A wide character in the last column may extend one column beyond the
+     * terminal width */
+    guac_terminal_char run[GUAC_TERMINAL_MAX_COLUMNS + 1];
+
+    int consumed = 0;
+    int codepoint;
+    int bytes;
+
+    while (consumed < length && (bytes = guac_terminal_decode_printable(
+                    text + consumed, length - consumed, &codepoint)) != 0) {
+
+        /* Wrap if necessary */
+        if (term->cursor_col >= term->term_width) {
+
+            /* New line */
+            term->cursor_col = 0;
+            guac_terminal_linefeed(term, true);
+        }
+
+        /* Gather all characters that fit within the current row */
+        int start_column = term->cursor_col;
+        int column = start_column;
+        int count = 0;
+
+        do {
+
+            consumed += bytes;
+
+            int width = wcwidth(codepoint);
+            if (width < 0)
+                width = 1;
+
+            /* Glyphs which are empty are not drawn */
+            if (width > 0) {
+
+                run[count++] = (guac_terminal_char) {
+                    .value      = codepoint,
+                    .attributes = term->current_attributes,
+                    .width      = width
+                };
+
+                for (int i = 1; i < width; i++) {
+                    run[count++] = (guac_terminal_char) {
+                        .value      = GUAC_CHAR_CONTINUATION,
+                        .attributes = term->current_attributes,
+                        .width      = 0 /* Not applicable for GUAC_CHAR_CONTINUATION */
+                    };
+                }
+
+                column += width;
+
+            }
+
+            if (column >= term->term_width || consumed >= length)
+                break;
+
+        } while ((bytes = guac_terminal_decode_printable(text + consumed,
+                        length - consumed, &codepoint)) != 0);
+
+        if (count > 0)
+            guac_terminal_set_characters(term, term->cursor_row, start_column,
+                    run, count);
+
+        /* Advance cursor */
+        term->cursor_col = column;
+
+    }
+
+    return consumed;
+
+}
+
 int guac_terminal_escape(guac_terminal* term, unsigned char c) {
 
     switch (c) {
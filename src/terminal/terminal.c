@@ -18,7 +18,6 @@
  */
 
 #include "common/clipboard.h"
-#include "common/cursor.h"
 #include "common/iconv.h"
 #include "terminal/buffer.h"
 #include "terminal/color-scheme.h"
@@ -44,11 +43,13 @@
 #include <wchar.h>
 
 #include <guacamole/client.h>
+#include <guacamole/display.h>
 #include <guacamole/error.h>
 #include <guacamole/flag.h>
 #include <guacamole/mem.h>
 #include <guacamole/proctitle.h>
 #include <guacamole/protocol.h>
+#include <guacamole/rect.h>
 #include <guacamole/socket.h>
 #include <guacamole/string.h>
 #include <guacamole/timestamp.h>
@@ -266,6 +267,8 @@ void guac_terminal_reset(guac_terminal* term) {
 
     /* Set current state */
     term->char_handler = guac_terminal_echo;
+    term->echo_bytes_remaining = 0;
+    term->echo_codepoint = 0;
     term->active_char_set = 0;
     term->char_mapping[0] =
     term->char_mapping[1] = NULL;
@@ -319,13 +322,8 @@ void guac_terminal_reset(guac_terminal* term) {
  *
  * @param terminal
  *     The terminal whose background should be painted or repainted.
- *
- * @param socket
- *     The socket over which instructions required to paint / repaint the
- *     terminal background should be send.
  */
-static void guac_terminal_repaint_default_layer(guac_terminal* terminal,
-        guac_socket* socket) {
+static void guac_terminal_repaint_default_layer(guac_terminal* terminal) {
 
     int width = terminal->width;
     int height = terminal->height;
@@ -335,12 +333,23 @@ static void guac_terminal_repaint_default_layer(guac_terminal* terminal,
     const guac_terminal_color* color = &display->default_background;
 
     /* Reset size */
-    guac_protocol_send_size(socket, GUAC_DEFAULT_LAYER, width, height);
+    guac_display_layer* default_layer =
+        guac_display_default_layer(display->graphical_display);
+    guac_display_layer_resize(default_layer, width, height);
 
     /* Paint background color */
-    guac_protocol_send_rect(socket, GUAC_DEFAULT_LAYER, 0, 0, width, height);
-    guac_protocol_send_cfill(socket, GUAC_COMP_OVER, GUAC_DEFAULT_LAYER,
-            color->red, color->green, color->blue, 0xFF);
+    guac_display_layer_raw_context* context =
+        guac_display_layer_open_raw(default_layer);
+
+    guac_rect rect;
+    guac_rect_init(&rect, 0, 0, width, height);
+    guac_rect_constrain(&rect, &context->bounds);
+
+    if (!guac_rect_is_empty(&rect))
+        guac_display_layer_raw_context_set(context, &rect, 0xFF000000
+                | (color->red << 16) | (color->green << 8) | color->blue);
+
+    guac_display_layer_close_raw(default_layer, context);
 
 }
 
@@ -371,8 +380,9 @@ void* guac_terminal_thread(void* data) {
         if (guac_terminal_render_frame(terminal))
             break;
 
-        /* Signal end of frame */
-        guac_client_end_frame(client);
+        /* Frame boundaries are signalled by the display's render thread,
+         * but any other instructions (pipe streams, clipboard, etc.) must
+         * still be flushed */
         guac_socket_flush(client->socket);
 
     }
@@ -570,9 +580,6 @@ guac_terminal* guac_terminal_create(guac_client* client,
         return NULL;
     }
 
-    /* Init common cursor */
-    term->cursor = guac_common_cursor_alloc(client);
-
     /* Init terminal state */
     term->current_attributes = default_char.attributes;
     term->default_char = default_char;
@@ -623,13 +630,14 @@ guac_terminal* guac_terminal_create(guac_client* client,
     pthread_mutex_init(&(term->lock), NULL);
 
     /* Repaint and resize overall display */
-    guac_terminal_repaint_default_layer(term, term->client->socket);
+    guac_terminal_repaint_default_layer(term);
     guac_terminal_display_resize(term->display,
             term->term_width, term->term_height);
 
     /* Allocate scrollbar */
-    term->scrollbar = guac_terminal_scrollbar_alloc(term->client, GUAC_DEFAULT_LAYER,
-            term->outer_width, term->outer_height, term->term_height);
+    guac_display* graphical_display = term->display->graphical_display;
+    term->scrollbar = guac_terminal_scrollbar_alloc(graphical_display,
+            guac_display_default_layer(graphical_display), term->outer_width, term->outer_height, term->term_height);
 
     /* Associate scrollbar with this terminal */
     term->scrollbar->data = term;
@@ -649,7 +657,8 @@ guac_terminal* guac_terminal_create(guac_client* client,
 
     /* Initialize mouse cursor */
     term->current_cursor = GUAC_TERMINAL_CURSOR_BLANK;
-    guac_common_cursor_set_blank(term->cursor);
+    guac_display_set_cursor(term->display->graphical_display,
+            GUAC_DISPLAY_CURSOR_NONE);
 
     /* Start terminal thread */
     if (pthread_create(&(term->thread), NULL,
@@ -970,17 +979,22 @@ void guac_terminal_commit_cursor(guac_terminal* term) {
 int guac_terminal_write(guac_terminal* term, const char* buffer, int length) {
 
     guac_terminal_lock(term);
-    for (int written = 0; written < length; written++) {
-
-        /* Read and advance to next character */
-        char current = *(buffer++);
+    for (int written = 0; written < length;) {
+
+        /* Draw runs of printable text in bulk, falling back to handling a
+         * single byte at a time */
+        int handled = guac_terminal_echo_text(term, buffer, length - written);
+        if (handled == 0) {
+            term->char_handler(term, *buffer);
+            handled = 1;
+        }
 
-        /* Write character to typescript, if any */
+        /* Write handled data to typescript, if any */
         if (term->typescript != NULL)
-            guac_terminal_typescript_write(term->typescript, current);
+            guac_terminal_typescript_write(term->typescript, buffer, handled);
 
-        /* Handle character and its meaning */
-        term->char_handler(term, current);
+        buffer += handled;
+        written += handled;
 
     }
     guac_terminal_unlock(term);
@@ -1313,24 +1327,74 @@ void guac_terminal_copy_rows(guac_terminal* terminal,
 
 }
 
-void guac_terminal_set_columns(guac_terminal* terminal, int row,
-        int start_column, int end_column, guac_terminal_char* character) {
+/**
+ * Restores the cursor attribute of the character at the location of the
+ * visible cursor, if that location is within the given range of columns of
+ * the given row. This must be invoked after the given range has been
+ * overwritten, as doing so also overwrites the cursor attribute. Only the
+ * column of the visible cursor is updated, exactly as done by
+ * guac_terminal_commit_cursor().
+ *
+ * @param terminal
+ *     The terminal that was modified.
+ *
+ * @param row
+ *     The row that was modified.
+ *
+ * @param start_column
+ *     The first column of the range that was overwritten.
+ *
+ * @param end_column
+ *     The last column of the range that was overwritten, inclusive.
+ */
+static void guac_terminal_preserve_cursor(guac_terminal* terminal, int row,
+        int start_column, int end_column) {
 
-    __guac_terminal_set_columns(terminal, row, start_column, end_column, character);
+    if (row != terminal->visible_cursor_row
+            || terminal->visible_cursor_col < start_column
+            || terminal->visible_cursor_col > end_column)
+        return;
+
+    int column = terminal->visible_cursor_col;
+    guac_terminal_buffer_set_cursor(terminal->current_buffer, row, column, true);
+
+    guac_terminal_char* characters;
+    int length = guac_terminal_buffer_get_columns(terminal->current_buffer,
+            &characters, NULL, row);
+
+    if (column < length)
+        guac_terminal_display_set_columns(terminal->display,
+                row + terminal->scroll_offset, column, column,
+                &characters[column]);
+
+}
+
+void guac_terminal_set_characters(guac_terminal* terminal, int row,
+        int start_column, const guac_terminal_char* characters, int length) {
+
+    guac_terminal_display_set_characters(terminal->display,
+            row + terminal->scroll_offset, start_column, characters, length);
+
+    guac_terminal_buffer_set_characters(terminal->current_buffer, row,
+            start_column, characters, length);
+
+    /* Clear selection if region is modified */
+    guac_terminal_select_touch(terminal, row, start_column,
+            row, start_column + length - 1);
 
     /* If visible cursor in current row, preserve state */
-    if (row == terminal->visible_cursor_row
-            && terminal->visible_cursor_col >= start_column
-            && terminal->visible_cursor_col <= end_column) {
+    guac_terminal_preserve_cursor(terminal, row, start_column,
+            start_column + length - 1);
 
-        /* Create copy of character with cursor attribute set */
-        guac_terminal_char cursor_character = *character;
-        cursor_character.attributes.cursor = true;
+}
+
+void guac_terminal_set_columns(guac_terminal* terminal, int row,
+        int start_column, int end_column, guac_terminal_char* character) {
 
-        __guac_terminal_set_columns(terminal, row,
-                terminal->visible_cursor_col, terminal->visible_cursor_col, &cursor_character);
+    __guac_terminal_set_columns(terminal, row, start_column, end_column, character);
 
-    }
+    /* If visible cursor in current row, preserve state */
+    guac_terminal_preserve_cursor(terminal, row, start_column, end_column);
 
 }
 
@@ -1408,8 +1472,9 @@ static void __guac_terminal_resize(guac_terminal* term, int width, int height) {
 
     }
 
-    /* Resize display */
-    guac_terminal_display_flush(term->display);
+    /* Resize display, applying any pending operations at the old size
+     * without yet ending the frame */
+    guac_terminal_display_flush_operations(term->display);
     guac_terminal_display_resize(term->display, width, height);
 
     /* Redraw any characters on right if widening */
@@ -1493,9 +1558,6 @@ static void __guac_terminal_resize(guac_terminal* term, int width, int height) {
 
 int guac_terminal_resize(guac_terminal* terminal, int width, int height) {
 
-    guac_terminal_display* display = terminal->display;
-    guac_client* client = display->client;
-
     /* Acquire exclusive access to terminal */
     guac_terminal_lock(terminal);
 
@@ -1518,7 +1580,7 @@ int guac_terminal_resize(guac_terminal* terminal, int width, int height) {
     terminal->width = adjusted_width;
 
     /* Resize default layer to given pixel dimensions */
-    guac_terminal_repaint_default_layer(terminal, client->socket);
+    guac_terminal_repaint_default_layer(terminal);
 
     /* Resize terminal if row/column dimensions have changed */
     if (columns != terminal->term_width || rows != terminal->term_height) {
@@ -1556,8 +1618,8 @@ void guac_terminal_flush(guac_terminal* terminal) {
     /* Flush display state */
     guac_terminal_select_redraw(terminal);
     guac_terminal_commit_cursor(terminal);
-    guac_terminal_display_flush(terminal->display);
     guac_terminal_scrollbar_flush(terminal->scrollbar);
+    guac_terminal_display_flush(terminal->display);
 
 }
 
@@ -1851,7 +1913,8 @@ static int __guac_terminal_send_key(guac_terminal* term, int keysym, int pressed
     /* Hide mouse cursor if not already hidden */
     if (term->current_cursor != GUAC_TERMINAL_CURSOR_BLANK) {
         term->current_cursor = GUAC_TERMINAL_CURSOR_BLANK;
-        guac_common_cursor_set_blank(term->cursor);
+        guac_display_set_cursor(term->display->graphical_display,
+                GUAC_DISPLAY_CURSOR_NONE);
         guac_terminal_notify(term);
     }
 
@@ -2730,7 +2793,8 @@ static int __guac_terminal_send_mouse(guac_terminal* term, guac_user* user,
     int pressed_mask  = ~term->mouse_mask &  mask;
 
     /* Store current mouse location/state */
-    guac_common_cursor_update(term->cursor, user, x, y, mask);
+    guac_display_render_thread_notify_user_moved_mouse(
+            term->display->render_thread, user, x, y, mask);
 
     /* Notify scrollbar, do not handle anything handled by scrollbar */
     if (guac_terminal_scrollbar_handle_mouse(term->scrollbar, x, y, mask)) {
@@ -2738,7 +2802,8 @@ static int __guac_terminal_send_mouse(guac_terminal* term, guac_user* user,
         /* Set pointer cursor if mouse is over scrollbar */
         if (term->current_cursor != GUAC_TERMINAL_CURSOR_POINTER) {
             term->current_cursor = GUAC_TERMINAL_CURSOR_POINTER;
-            guac_common_cursor_set_pointer(term->cursor);
+            guac_display_set_cursor(term->display->graphical_display,
+                    GUAC_DISPLAY_CURSOR_POINTER);
             guac_terminal_notify(term);
         }
 
@@ -2756,7 +2821,8 @@ static int __guac_terminal_send_mouse(guac_terminal* term, guac_user* user,
     /* Show mouse cursor if not already shown */
     if (term->current_cursor != GUAC_TERMINAL_CURSOR_IBAR) {
         term->current_cursor = GUAC_TERMINAL_CURSOR_IBAR;
-        guac_common_cursor_set_ibar(term->cursor);
+        guac_display_set_cursor(term->display->graphical_display,
+                GUAC_DISPLAY_CURSOR_IBAR);
         guac_terminal_notify(term);
     }
 
@@ -3050,11 +3116,12 @@ void guac_terminal_pipe_stream_close(guac_terminal* term) {
 }
 
 int guac_terminal_create_typescript(guac_terminal* term, const char* path,
-        const char* name, int create_path, int allow_write_existing) {
+        const char* name, int create_path, int allow_write_existing,
+        int compress) {
 
     /* Create typescript */
     term->typescript = guac_terminal_typescript_alloc(
-            path, name, create_path, allow_write_existing);
+            path, name, create_path, allow_write_existing, compress);
 
     /* Log failure */
     if (term->typescript == NULL) {
@@ -3070,6 +3137,17 @@ int guac_terminal_create_typescript(guac_terminal* term, const char* path,
             "timing file is \"%s\".", path, term->typescript->data_filename,
             term->typescript->timing_filename);
 
+    /* Warn if compression was requested but is not available */
+    if (compress && !term->typescript->compress) {
+#ifdef ENABLE_ZLIB
+        guac_client_log(term->client, GUAC_LOG_WARNING, "Typescript will not "
+                "be compressed, as the compressor could not be initialized.");
+#else
+        guac_client_log(term->client, GUAC_LOG_WARNING, "Typescript will not "
+                "be compressed, as guacamole-server was built without zlib.");
+#endif
+    }
+
     /* Typescript creation succeeded */
     return 0;
 
@@ -3091,16 +3169,10 @@ int guac_terminal_create_typescript(guac_terminal* term, const char* path,
 static void __guac_terminal_sync_socket(
         guac_client* client, guac_terminal* term, guac_socket* socket) {
 
-    /* Synchronize display state with new user */
-    guac_terminal_repaint_default_layer(term, socket);
+    /* Synchronize display state (including the terminal background,
+     * scrollbar, and mouse cursor) with new user */
     guac_terminal_display_dup(term->display, client, socket);
 
-    /* Synchronize mouse cursor */
-    guac_common_cursor_dup(term->cursor, client, socket);
-
-    /* Paint scrollbar for joining users */
-    guac_terminal_scrollbar_dup(term->scrollbar, client, socket);
-
 }
 
 void guac_terminal_dup(guac_terminal* term, guac_user* user,
@@ -3240,14 +3312,14 @@ void guac_terminal_clipboard_append(guac_terminal* terminal,
 
 void guac_terminal_remove_user(guac_terminal* terminal, guac_user* user) {
 
-    /* Remove the user from the terminal cursor */
-    guac_common_cursor_remove_user(terminal->cursor, user);
+    /* Remove the user from the terminal's display */
+    guac_display_notify_user_left(terminal->display->graphical_display, user);
 }
 
 void guac_terminal_redraw_default_layer(guac_terminal* terminal) {
 
     /* Redraw terminal text and background */
-    guac_terminal_repaint_default_layer(terminal, terminal->client->socket);
+    guac_terminal_repaint_default_layer(terminal);
     __guac_terminal_redraw_rect(terminal, 0, 0,
             terminal->term_height - 1,
             terminal->term_width - 1);
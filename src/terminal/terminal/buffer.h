@@ -44,7 +44,9 @@ typedef struct guac_terminal_buffer guac_terminal_buffer;
 
 /**
  * Allocates a new buffer having the given maximum number of rows. New character cells will
- * be initialized to the given character.
+ * be initialized to the given character. Storage for each row is allocated
+ * only once that row is first used, and rows which scroll into the scrollback
+ * region are stored in a compact form until they are next accessed.
  */
 guac_terminal_buffer* guac_terminal_buffer_alloc(int rows,
         const guac_terminal_char* default_character);
@@ -121,6 +123,31 @@ void guac_terminal_buffer_scroll_down(guac_terminal_buffer* buffer, int amount);
 void guac_terminal_buffer_set_columns(guac_terminal_buffer* buffer, int row,
         int start_column, int end_column, guac_terminal_char* character);
 
+/**
+ * Sets the columns within the given row, beginning at the given column, to
+ * the given characters, as if guac_terminal_buffer_set_columns() were invoked
+ * for each character in turn. Each character spanning multiple columns must
+ * be followed by the corresponding number of GUAC_CHAR_CONTINUATION
+ * characters.
+ *
+ * @param buffer
+ *     The buffer to modify.
+ *
+ * @param row
+ *     The row to modify.
+ *
+ * @param start_column
+ *     The column receiving the first of the given characters.
+ *
+ * @param characters
+ *     The characters to store, one per column.
+ *
+ * @param length
+ *     The number of columns being set.
+ */
+void guac_terminal_buffer_set_characters(guac_terminal_buffer* buffer, int row,
+        int start_column, const guac_terminal_char* characters, int length);
+
 /**
  * Get the char (int ASCII code) at a specific row/col of the display.
  *
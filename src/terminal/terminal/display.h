@@ -26,12 +26,12 @@
  * @file display.h
  */
 
-#include "common/surface.h"
+#include "glyph-cache.h"
 #include "palette.h"
 #include "types.h"
 
 #include <guacamole/client.h>
-#include <guacamole/layer.h>
+#include <guacamole/display.h>
 #include <pango/pangocairo.h>
 
 #include <stdbool.h>
@@ -53,6 +53,12 @@
  */
 #define GUAC_TERMINAL_MM_PER_INCH 25.4
 
+/**
+ * The color used to highlight selected text, as a 32-bit ARGB value with
+ * premultiplied alpha (0x0080FF at 0x60 opacity).
+ */
+#define GUAC_TERMINAL_SELECTION_COLOR 0x60003060
+
 /**
  * All available terminal operations which affect character cells.
  */
@@ -152,6 +158,11 @@ typedef struct guac_terminal_display {
      */
     int char_height;
 
+    /**
+     * Cache of all glyphs recently rendered using the current font.
+     */
+    guac_terminal_glyph_cache* glyph_cache;
+
     /**
      * The current palette.
      */
@@ -186,19 +197,35 @@ typedef struct guac_terminal_display {
     guac_terminal_color glyph_background;
 
     /**
-     * The surface containing the actual terminal.
+     * The guac_display which renders the terminal for all connected users.
+     * The terminal text, text selection, scrollbar, and mouse cursor are all
+     * drawn to layers of this display, which takes care of detecting scrolls
+     * and encoding updates.
      */
-    guac_common_surface* display_surface;
+    guac_display* graphical_display;
+
+    /**
+     * The thread which completes frames of graphical_display and sends them
+     * to connected users, compensating for any lag in processing those
+     * frames client-side.
+     */
+    guac_display_render_thread* render_thread;
 
     /**
      * Layer which contains the actual terminal.
      */
-    guac_layer* display_layer;
+    guac_display_layer* display_layer;
 
     /**
      * Sub-layer of display layer which highlights selected text.
      */
-    guac_layer* select_layer;
+    guac_display_layer* select_layer;
+
+    /**
+     * The context used to draw to display_layer while pending operations are
+     * being flushed, or NULL if no flush is in progress.
+     */
+    guac_display_layer_raw_context* context;
 
     /**
      * Whether text is currently selected.
@@ -317,13 +344,40 @@ void guac_terminal_display_copy_rows(guac_terminal_display* display,
 void guac_terminal_display_set_columns(guac_terminal_display* display, int row,
         int start_column, int end_column, guac_terminal_char* character);
 
+/**
+ * Sets the columns within the given row, beginning at the given column, to
+ * the given characters, as if guac_terminal_display_set_columns() were
+ * invoked for each character in turn. Each character spanning multiple
+ * columns must be followed by the corresponding number of
+ * GUAC_CHAR_CONTINUATION characters, which are not themselves drawn.
+ *
+ * @param display
+ *     The display to modify.
+ *
+ * @param row
+ *     The row to modify.
+ *
+ * @param start_column
+ *     The column receiving the first of the given characters.
+ *
+ * @param characters
+ *     The characters to draw, one per column.
+ *
+ * @param length
+ *     The number of columns being set.
+ */
+void guac_terminal_display_set_characters(guac_terminal_display* display,
+        int row, int start_column, const guac_terminal_char* characters,
+        int length);
+
 /**
  * Resize the terminal to the given dimensions.
  */
 void guac_terminal_display_resize(guac_terminal_display* display, int width, int height);
 
 /**
- * Flushes all pending operations within the given guac_terminal_display.
+ * Flushes all pending operations within the given guac_terminal_display,
+ * drawing their results to the display layer as part of the pending frame.
  *
  * @param display
  *     The terminal display whose pending operations are being flushed.
@@ -332,7 +386,8 @@ void guac_terminal_display_flush_operations(guac_terminal_display* display);
 
 /**
  * Flushes all pending operations within the given guac_terminal_display,
- * then flushes the display surface.
+ * then notifies the render thread of the display that the current frame is
+ * complete and may be sent to connected users.
  *
  * @param display
  *     The terminal display to flush.
@@ -0,0 +1,238 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef GUAC_TERMINAL_GLYPH_CACHE_H
+#define GUAC_TERMINAL_GLYPH_CACHE_H
+
+/**
+ * A cache of pre-rendered glyphs, allowing characters to be drawn to the
+ * terminal display without repeatedly laying out text with Pango.
+ *
+ * @file glyph-cache.h
+ */
+
+#include "palette.h"
+
+#include <cairo/cairo.h>
+#include <pango/pangocairo.h>
+
+#include <stdint.h>
+
+/**
+ * The number of sets within the glyph cache. Each glyph may be stored only
+ * within the set selected by the hash of its codepoint, width, and colors.
+ */
+#define GUAC_TERMINAL_GLYPH_CACHE_SETS 128
+
+/**
+ * The number of glyphs that may be stored within each set of the glyph
+ * cache. When a set is full, the least-recently-used glyph of that set is
+ * replaced.
+ */
+#define GUAC_TERMINAL_GLYPH_CACHE_WAYS 4
+
+/**
+ * The total number of glyphs that may be stored within the glyph cache.
+ */
+#define GUAC_TERMINAL_GLYPH_CACHE_SIZE \
+    (GUAC_TERMINAL_GLYPH_CACHE_SETS * GUAC_TERMINAL_GLYPH_CACHE_WAYS)
+
+/**
+ * The number of slots within each row of the atlas of the glyph cache. Slots
+ * are arranged in a grid, rather than a single column, such that the atlas
+ * remains within the dimensions supported by Cairo even for large fonts.
+ */
+#define GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS 32
+
+/**
+ * The number of rows of slots within the atlas of the glyph cache.
+ */
+#define GUAC_TERMINAL_GLYPH_ATLAS_ROWS \
+    (GUAC_TERMINAL_GLYPH_CACHE_SIZE / GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS)
+
+/**
+ * A single glyph, pre-rendered within the atlas of a glyph cache.
+ */
+typedef struct guac_terminal_glyph {
+
+    /**
+     * The Unicode codepoint of the character rendered.
+     */
+    int codepoint;
+
+    /**
+     * The width of the character rendered, in columns.
+     */
+    int width;
+
+    /**
+     * The foreground color of the rendered glyph. Only the red, green, and
+     * blue components are significant.
+     */
+    guac_terminal_color foreground;
+
+    /**
+     * The background color of the rendered glyph. Only the red, green, and
+     * blue components are significant.
+     */
+    guac_terminal_color background;
+
+    /**
+     * The value of the glyph cache clock when this glyph was last used, or
+     * zero if this slot of the glyph cache has never been used.
+     */
+    uint64_t last_used;
+
+    /**
+     * Cairo surface referencing this glyph's region of the atlas, exactly as
+     * wide as the glyph. This will be NULL if this slot of the glyph cache
+     * has never been used, or if the glyph could not be rendered.
+     */
+    cairo_surface_t* surface;
+
+} guac_terminal_glyph;
+
+/**
+ * A fixed-size, set-associative cache of glyphs rendered using a single font
+ * and character size. All glyphs are rendered into a single image (the
+ * atlas), with each slot of the cache owning a fixed region of the atlas
+ * large enough for a character of the maximum width. If the atlas cannot be
+ * allocated, glyphs are instead rendered directly with Pango each time they
+ * are requested, without caching.
+ */
+typedef struct guac_terminal_glyph_cache {
+
+    /**
+     * The description of the font used to render all glyphs.
+     */
+    PangoFontDescription* font_desc;
+
+    /**
+     * The width of each character, in pixels.
+     */
+    int char_width;
+
+    /**
+     * The height of each character, in pixels.
+     */
+    int char_height;
+
+    /**
+     * The image containing all rendered glyphs, arranged as a grid of
+     * GUAC_TERMINAL_GLYPH_ATLAS_COLUMNS by GUAC_TERMINAL_GLYPH_ATLAS_ROWS
+     * slots, or NULL if the atlas could not be allocated.
+     */
+    cairo_surface_t* atlas;
+
+    /**
+     * The glyph that is rendered each time a glyph is requested if the atlas
+     * could not be allocated. The surface of this glyph is independent of
+     * the atlas.
+     */
+    guac_terminal_glyph uncached;
+
+    /**
+     * Counter incremented each time a glyph is retrieved, used to determine
+     * which glyph of a set was least recently used.
+     */
+    uint64_t clock;
+
+    /**
+     * The number of glyphs retrieved which had already been rendered.
+     */
+    uint64_t hits;
+
+    /**
+     * The number of glyphs retrieved which had to be rendered.
+     */
+    uint64_t misses;
+
+    /**
+     * All slots of the cache, grouped by set.
+     */
+    guac_terminal_glyph glyphs[GUAC_TERMINAL_GLYPH_CACHE_SIZE];
+
+} guac_terminal_glyph_cache;
+
+/**
+ * Allocates a new, empty glyph cache which renders glyphs using the given
+ * font and character size. The glyph cache must be replaced if the font or
+ * character size changes.
+ *
+ * @param font_desc
+ *     The description of the font to use to render all glyphs. A copy of
+ *     this description is kept by the glyph cache.
+ *
+ * @param char_width
+ *     The width of each character, in pixels.
+ *
+ * @param char_height
+ *     The height of each character, in pixels.
+ *
+ * @return
+ *     A newly-allocated glyph cache, which must eventually be freed with
+ *     guac_terminal_glyph_cache_free().
+ */
+guac_terminal_glyph_cache* guac_terminal_glyph_cache_alloc(
+        const PangoFontDescription* font_desc, int char_width,
+        int char_height);
+
+/**
+ * Frees the given glyph cache, including all rendered glyphs. Surfaces
+ * previously returned by guac_terminal_glyph_cache_get() are no longer valid
+ * once the glyph cache has been freed.
+ *
+ * @param cache
+ *     The glyph cache to free. If NULL, this function has no effect.
+ */
+void guac_terminal_glyph_cache_free(guac_terminal_glyph_cache* cache);
+
+/**
+ * Returns a surface containing the given character rendered with the given
+ * colors, rendering that character only if it is not already present within
+ * the glyph cache. The returned surface is owned by the glyph cache and
+ * remains valid only until the next call to this function.
+ *
+ * @param cache
+ *     The glyph cache to retrieve the glyph from.
+ *
+ * @param codepoint
+ *     The Unicode codepoint of the character to render.
+ *
+ * @param width
+ *     The width of the character, in columns. This must be between 1 and
+ *     GUAC_TERMINAL_MAX_CHAR_WIDTH inclusive.
+ *
+ * @param foreground
+ *     The color to use for the character itself.
+ *
+ * @param background
+ *     The color to use for the area surrounding the character.
+ *
+ * @return
+ *     An RGB24 surface which is exactly width columns wide and one row
+ *     high, containing the rendered character, or NULL if the character
+ *     could not be rendered.
+ */
+cairo_surface_t* guac_terminal_glyph_cache_get(guac_terminal_glyph_cache* cache,
+        int codepoint, int width, const guac_terminal_color* foreground,
+        const guac_terminal_color* background);
+
+#endif
+
@@ -26,8 +26,7 @@
  * @file scrollbar.h
  */
 
-#include <guacamole/client.h>
-#include <guacamole/layer.h>
+#include <guacamole/display.h>
 
 /**
  * The width of the scrollbar, in pixels.
@@ -45,6 +44,18 @@
  */
 #define GUAC_TERMINAL_SCROLLBAR_MIN_HEIGHT 64
 
+/**
+ * The color of the scrollbar's containing layer, as a 32-bit ARGB value with
+ * premultiplied alpha (0x808080 at 0x40 opacity).
+ */
+#define GUAC_TERMINAL_SCROLLBAR_CONTAINER_COLOR 0x40202020
+
+/**
+ * The color of the scrollbar's draggable handle, as a 32-bit ARGB value with
+ * premultiplied alpha (0xA0A0A0 at 0x8F opacity).
+ */
+#define GUAC_TERMINAL_SCROLLBAR_HANDLE_COLOR 0x8F595959
+
 /**
  * The state of all scrollbar components, describing all variable aspects of
  * the scrollbar's appearance.
@@ -114,14 +125,14 @@ typedef void guac_terminal_scrollbar_scroll_handler(
 struct guac_terminal_scrollbar {
 
     /**
-     * The client associated with this scrollbar.
+     * The display containing this scrollbar.
      */
-    guac_client* client;
+    guac_display* display;
 
     /**
      * The layer containing the scrollbar.
      */
-    const guac_layer* parent;
+    const guac_display_layer* parent;
 
     /**
      * The width of the parent layer, in pixels.
@@ -136,13 +147,13 @@ struct guac_terminal_scrollbar {
     /**
      * The scrollbar itself.
      */
-    guac_layer* container;
+    guac_display_layer* container;
 
     /**
      * The draggable handle within the scrollbar, representing the current
      * scroll value.
      */
-    guac_layer* handle;
+    guac_display_layer* handle;
 
     /**
      * The minimum scroll value.
@@ -201,16 +212,13 @@ struct guac_terminal_scrollbar {
 };
 
 /**
- * Allocates a new scrollbar, associating that scrollbar with the given client
- * and parent layer. The dimensions of the parent layer dictate the initial
- * position of the scrollbar. Currently, the scrollbar is always anchored to
- * the right edge of the parent layer.
- *
- * This will cause instructions to be written to the client's socket, but the
- * client's socket will not be automatically flushed.
+ * Allocates a new scrollbar, associating that scrollbar with the given
+ * display and parent layer. The dimensions of the parent layer dictate the
+ * initial position of the scrollbar. Currently, the scrollbar is always
+ * anchored to the right edge of the parent layer.
  *
- * @param client
- *     The client to associate with the new scrollbar.
+ * @param display
+ *     The display which should contain the layers of the new scrollbar.
  *
  * @param parent
  *     The layer which will contain the newly-allocated scrollbar.
@@ -229,8 +237,8 @@ struct guac_terminal_scrollbar {
  * @return
  *     A newly allocated scrollbar.
  */
-guac_terminal_scrollbar* guac_terminal_scrollbar_alloc(guac_client* client,
-        const guac_layer* parent, int parent_width, int parent_height,
+guac_terminal_scrollbar* guac_terminal_scrollbar_alloc(guac_display* display,
+        const guac_display_layer* parent, int parent_width, int parent_height,
         int visible_area);
 
 /**
@@ -245,39 +253,21 @@ void guac_terminal_scrollbar_free(guac_terminal_scrollbar* scrollbar);
  * Flushes the render state of the given scrollbar, updating the remote display
  * accordingly.
  *
- * This may cause instructions to be written to the client's socket, but the
- * client's socket will not be automatically flushed.
+ * Any changes are drawn to the layers of the scrollbar as part of the pending
+ * frame of the associated guac_display.
  *
  * @param scrollbar
  *     The scrollbar whose render state is to be flushed.
  */
 void guac_terminal_scrollbar_flush(guac_terminal_scrollbar* scrollbar);
 
-/**
- * Forces a complete redraw / resync of scrollbar state for all joining users
- * associated with the provided socket, sending the necessary instructions to
- * completely recreate and redraw the scrollbar rendering over the given
- * socket.
- *
- * @param scrollbar
- *     The scrollbar to sync to the given users.
- *
- * @param client
- *     The client associated with the joining users.
- *
- * @param socket
- *     The socket over which any necessary instructions should be sent.
- */
-void guac_terminal_scrollbar_dup(guac_terminal_scrollbar* scrollbar,
-        guac_client* client, guac_socket* socket);
-
 /**
  * Sets the minimum and maximum allowed scroll values of the given scrollbar
  * to the given values. If necessary, the current value of the scrollbar will
  * be adjusted to fit within the new bounds.
  *
- * This may cause instructions to be written to the client's socket, but the
- * client's socket will not be automatically flushed.
+ * The change will not be visible until the scrollbar is next flushed with
+ * guac_terminal_scrollbar_flush().
  *
  * @param scrollbar
  *     The scrollbar whose bounds are changing.
@@ -296,8 +286,8 @@ void guac_terminal_scrollbar_set_bounds(guac_terminal_scrollbar* scrollbar,
  * not fall within the scrollbar's defined minimum and maximum values, the
  * value will be adjusted to fit.
  *
- * This may cause instructions to be written to the client's socket, but the
- * client's socket will not be automatically flushed.
+ * The change will not be visible until the scrollbar is next flushed with
+ * guac_terminal_scrollbar_flush().
  *
  * @param scrollbar
  *     The scrollbar whose value is changing.
@@ -313,8 +303,8 @@ void guac_terminal_scrollbar_set_value(guac_terminal_scrollbar* scrollbar,
  * Notifies the scrollbar that the parent layer has been resized, and that the
  * scrollbar may need to be repositioned or resized accordingly.
  *
- * This may cause instructions to be written to the client's socket, but the
- * client's socket will not be automatically flushed.
+ * The change will not be visible until the scrollbar is next flushed with
+ * guac_terminal_scrollbar_flush().
  *
  * @param scrollbar
  *     The scrollbar whose parent layer has been resized.
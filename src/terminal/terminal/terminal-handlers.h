@@ -42,6 +42,32 @@
  */
 int guac_terminal_echo(guac_terminal* term, unsigned char c);
 
+/**
+ * Draws the run of printable characters at the beginning of the given UTF-8
+ * text, if any, exactly as guac_terminal_echo() would draw those characters
+ * one byte at a time, but storing the characters destined for each row with
+ * a single call to guac_terminal_set_characters(). Nothing is drawn unless
+ * the terminal is in a state where guac_terminal_echo() would draw the
+ * characters without further interpretation (not within an escape sequence
+ * or partial UTF-8 sequence, not in insert mode, not redirected to a pipe
+ * stream, and using UTF-8 rather than a mapped character set).
+ *
+ * @param term
+ *     The terminal that received the given text.
+ *
+ * @param text
+ *     The UTF-8 text received by the given terminal.
+ *
+ * @param length
+ *     The number of bytes of text available.
+ *
+ * @return
+ *     The number of bytes of text that were drawn, which may be zero. Any
+ *     remaining bytes must be handled by the terminal's current character
+ *     handler.
+ */
+int guac_terminal_echo_text(guac_terminal* term, const char* text, int length);
+
 /**
  * Handles any characters which follow an ANSI ESC (0x1B) character.
  *
@@ -21,7 +21,6 @@
 #define GUAC_TERMINAL_PRIV_H
 
 #include "common/clipboard.h"
-#include "common/cursor.h"
 #include "buffer.h"
 #include "display.h"
 #include "scrollbar.h"
@@ -152,11 +151,6 @@ struct guac_terminal {
      */
     guac_terminal_typescript* typescript;
 
-    /**
-     * Terminal-wide mouse cursor, synchronized across all users.
-     */
-    guac_common_cursor* cursor;
-
     /**
      * Graphical representation of the current scroll state.
      */
@@ -294,6 +288,20 @@ struct guac_terminal {
      */
     guac_terminal_char_handler* char_handler;
 
+    /**
+     * The codepoint currently being decoded from UTF-8 by
+     * guac_terminal_echo(), if only part of a multibyte sequence has been
+     * received.
+     */
+    int echo_codepoint;
+
+    /**
+     * The number of bytes remaining in the UTF-8 sequence currently being
+     * decoded by guac_terminal_echo(), or zero if no sequence has been
+     * partially received.
+     */
+    int echo_bytes_remaining;
+
     /**
      * The difference between the currently-rendered screen and the current
      * state of the terminal, and the contextual information necessary to
@@ -547,6 +555,30 @@ void guac_terminal_scroll_handler(guac_terminal_scrollbar* scrollbar, int value)
 void guac_terminal_set_columns(guac_terminal* terminal, int row,
         int start_column, int end_column, guac_terminal_char* character);
 
+/**
+ * Sets the columns within the given row, beginning at the given column, to
+ * the given characters. Each character spanning multiple columns must be
+ * followed by the corresponding number of GUAC_CHAR_CONTINUATION characters,
+ * exactly as the characters would be stored within the terminal buffer.
+ *
+ * @param terminal
+ *     The terminal to modify.
+ *
+ * @param row
+ *     The row to modify.
+ *
+ * @param start_column
+ *     The column receiving the first of the given characters.
+ *
+ * @param characters
+ *     The characters to store, one per column.
+ *
+ * @param length
+ *     The number of columns being set.
+ */
+void guac_terminal_set_characters(guac_terminal* terminal, int row,
+        int start_column, const guac_terminal_char* characters, int length);
+
 /**
  * Acquires exclusive access to the terminal. Note that enforcing this
  * exclusive access requires that ALL users of the terminal call this
@@ -1216,6 +1216,12 @@ void guac_terminal_remove_user(guac_terminal* terminal, guac_user* user);
  * written. The typescript will automatically be closed once the terminal is
  * freed.
  *
+ * The typescript files are written by a dedicated thread, such that slow
+ * storage does not stall terminal output unless the typescript falls
+ * significantly behind. If compress is non-zero and guacamole-server was
+ * built with zlib, both files are compressed using gzip as they are
+ * written.
+ *
  * @param term
  *     The terminal whose output should be written to a typescript.
  *
@@ -1236,12 +1242,17 @@ void guac_terminal_remove_user(guac_terminal* terminal, guac_user* user);
  *     Non-zero if writing to existing files should be allowed, or zero
  *     otherwise.
  *
+ * @param compress
+ *     Non-zero if the typescript files should be compressed using gzip as
+ *     they are written, zero otherwise.
+ *
  * @return
  *     Zero if the typescript files have been successfully created and a
  *     typescript will be written, non-zero otherwise.
  */
 int guac_terminal_create_typescript(guac_terminal* term, const char* path,
-        const char* name, int create_path, int allow_write_existing);
+        const char* name, int create_path, int allow_write_existing,
+        int compress);
 
 /**
  * Immediately applies the given color scheme to the given terminal, overriding
@@ -29,6 +29,9 @@
 
 #include <guacamole/timestamp.h>
 
+#include <pthread.h>
+#include <stddef.h>
+
 /**
  * A NULL-terminated string of raw bytes which should be written at the
  * beginning of any typescript.
@@ -75,21 +78,91 @@
 #define GUAC_TERMINAL_TYPESCRIPT_TIMING_SUFFIX "timing"
 
 /**
- * An active typescript, consisting of a data file (raw terminal output) and
- * timing file (related timestamps and byte counts).
+ * The number of bytes of raw terminal output that may await writing to the
+ * data file before further terminal output is blocked. Once half of this
+ * space is in use, the typescript's writer thread is woken regardless of
+ * whether the typescript has been flushed.
  */
-typedef struct guac_terminal_typescript {
+#define GUAC_TERMINAL_TYPESCRIPT_BUFFER_SIZE 1048576
+
+/**
+ * The number of bytes of timing information that may await writing to the
+ * timing file before further flushes of the typescript are blocked. Each
+ * flush produces a single line of timing information of at most a few dozen
+ * bytes.
+ */
+#define GUAC_TERMINAL_TYPESCRIPT_TIMING_BUFFER_SIZE 65536
+
+/**
+ * The zlib compression level used for compressed typescripts. Terminal
+ * output is highly repetitive and compresses well even at the fastest level.
+ */
+#define GUAC_TERMINAL_TYPESCRIPT_COMPRESSION_LEVEL 1
+
+/**
+ * The minimum number of milliseconds between flushes of the compressor of a
+ * compressed typescript. Flushing the compressor after every write would
+ * greatly reduce the effectiveness of compression, while never flushing
+ * would leave an in-progress typescript unreadable.
+ */
+#define GUAC_TERMINAL_TYPESCRIPT_COMPRESSION_FLUSH_INTERVAL 1000
+
+/**
+ * A single file of an active typescript, receiving data written by the
+ * typescript's writer thread and optionally compressing that data. The
+ * contents of this structure are private to the typescript implementation.
+ */
+typedef struct guac_terminal_typescript_output guac_terminal_typescript_output;
+
+/**
+ * A fixed-size circular buffer of bytes awaiting writing by the writer
+ * thread of a typescript.
+ */
+typedef struct guac_terminal_typescript_ring {
 
     /**
-     * Buffer of raw terminal output which has not yet been written to the
-     * data file.
+     * The contents of this buffer, which is exactly size bytes long.
      */
-    char buffer[4096];
+    char* data;
 
     /**
-     * The number of bytes currently stored in the buffer.
+     * The total number of bytes allocated for this buffer.
      */
-    int length;
+    size_t size;
+
+    /**
+     * The offset of the first byte within this buffer that has not yet been
+     * written.
+     */
+    size_t start;
+
+    /**
+     * The number of bytes currently stored within this buffer, beginning at
+     * the start offset and wrapping around to the beginning of the buffer as
+     * necessary.
+     */
+    size_t length;
+
+} guac_terminal_typescript_ring;
+
+/**
+ * An active typescript, consisting of a data file (raw terminal output) and
+ * timing file (related timestamps and byte counts).
+ *
+ * Terminal output is never written to either file directly. Output is
+ * instead copied into a pair of circular buffers and written by a dedicated
+ * writer thread, such that slow storage affects terminal output only once
+ * those buffers are full. If the buffers are full, further terminal output
+ * blocks until space is available, as a typescript with gaps would be worse
+ * than a briefly stalled session.
+ */
+typedef struct guac_terminal_typescript {
+
+    /**
+     * The number of bytes of raw terminal output written to this typescript
+     * since the typescript was last flushed.
+     */
+    size_t length;
 
     /**
      * The filename of the file (excluding path) which will contain the raw
@@ -122,6 +195,77 @@ typedef struct guac_terminal_typescript {
      */
     guac_timestamp last_flush;
 
+    /**
+     * Non-zero if the data and timing files of this typescript are being
+     * compressed using gzip as they are written, zero otherwise.
+     */
+    int compress;
+
+    /**
+     * The data file of this typescript, as written by the writer thread.
+     */
+    guac_terminal_typescript_output* data_output;
+
+    /**
+     * The timing file of this typescript, as written by the writer thread.
+     */
+    guac_terminal_typescript_output* timing_output;
+
+    /**
+     * Raw terminal output which has not yet been written to the data file.
+     */
+    guac_terminal_typescript_ring data;
+
+    /**
+     * Timing information which has not yet been written to the timing file.
+     */
+    guac_terminal_typescript_ring timing;
+
+    /**
+     * Lock which guards the contents of both circular buffers and all flags
+     * shared with the writer thread. This lock is held only while copying
+     * data into or out of the bookkeeping of those buffers, and never while
+     * writing to either file.
+     */
+    pthread_mutex_t lock;
+
+    /**
+     * Condition which is signalled whenever the writer thread should write
+     * queued data, either because the typescript has been flushed, the data
+     * buffer is at least half full, or the typescript is being freed.
+     */
+    pthread_cond_t modified;
+
+    /**
+     * Condition which is signalled whenever the writer thread finishes
+     * writing a batch of queued data, allowing any output blocked by a full
+     * buffer to proceed.
+     */
+    pthread_cond_t drained;
+
+    /**
+     * Non-zero if the writer thread has been asked to write all queued data,
+     * zero otherwise.
+     */
+    int flush_requested;
+
+    /**
+     * Non-zero if writing either file has failed. Once set, all further
+     * output is discarded rather than queued.
+     */
+    int failed;
+
+    /**
+     * Non-zero if the writer thread should stop once all queued data has been
+     * written, zero otherwise.
+     */
+    int stopping;
+
+    /**
+     * The thread which writes all queued data to the data and timing files.
+     */
+    pthread_t writer;
+
 } guac_terminal_typescript;
 
 /**
@@ -131,7 +275,10 @@ typedef struct guac_terminal_typescript {
  * information. If the create_path flag is non-zero, the given path will be
  * created if it does not yet exist. If allow_write_existing is non-zero,
  * these may be existing files; otherwise, any existing file will cause this
- * function to fail, returning NULL.
+ * function to fail, returning NULL. If the compress flag is non-zero and
+ * compression is supported, both files will be compressed using gzip as they
+ * are written, and the compress member of the returned typescript will be
+ * set.
  *
  * @param path
  *     The full absolute path to a directory in which the typescript files
@@ -150,30 +297,40 @@ typedef struct guac_terminal_typescript {
  *     Non-zero if writing to existing files should be allowed, or zero
  *     otherwise.
  *
+ * @param compress
+ *     Non-zero if the typescript files should be compressed using gzip as
+ *     they are written, zero otherwise.
+ *
  * @return
  *     A new guac_terminal_typescript representing the typescript files
  *     requested, or NULL if creation of the typescript files failed.
  */
 guac_terminal_typescript* guac_terminal_typescript_alloc(const char* path,
-        const char* name, int create_path, int allow_write_existing);
+        const char* name, int create_path, int allow_write_existing,
+        int compress);
 
 /**
- * Writes a single byte of terminal data to the typescript, flushing and
- * writing a new timestamp if necessary.
+ * Writes the given raw terminal data to the typescript. The data is copied
+ * into the typescript's buffer and written to the data file asynchronously.
+ * If the buffer is full, this function blocks until the writer thread has
+ * made sufficient space.
  *
  * @param typescript
- *     The typescript that the given byte of raw terminal data should be
- *     written to.
+ *     The typescript that the given raw terminal data should be written to.
+ *
+ * @param buffer
+ *     The raw terminal data to write to the typescript.
  *
- * @param c
- *     The single byte of raw terminal data to write to the typescript.
+ * @param length
+ *     The number of bytes of raw terminal data to write.
  */
 void guac_terminal_typescript_write(guac_terminal_typescript* typescript,
-        char c);
+        const char* buffer, int length);
 
 /**
  * Flushes any pending data to the typescript, writing a new timestamp to the
- * timing file if any data was flushed.
+ * timing file if any data was flushed. The data and timing files are written
+ * asynchronously by the typescript's writer thread.
  *
  * @param typescript
  *     The typescript which should be flushed.
@@ -182,8 +339,10 @@ void guac_terminal_typescript_flush(guac_terminal_typescript* typescript);
 
 /**
  * Frees all resources associated with the given typescript, flushing and
- * closing the data and timing files and freeing all related memory. If the
- * provided typescript is NULL, this function has no effect.
+ * closing the data and timing files and freeing all related memory. This
+ * function blocks until all data written to the typescript has been written
+ * to the data and timing files. If the provided typescript is NULL, this
+ * function has no effect.
  *
  * @param typescript
  *     The typescript to free.
@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Benchmark of the memory consumed by terminal scrollback. Two buffers are
+ * allocated exactly as a terminal with the default scrollback allocates its
+ * normal and alternate buffers, and synthetic output resembling colorized
+ * "ls -l" output is written to the normal buffer one 80-column line at a
+ * time, scrolling each line into the scrollback region as a 24-row terminal
+ * would. The heap usage measured after allocation and after filling the
+ * scrollback is compared against the memory required by the previous storage
+ * of the buffer, which allocated space for 256 characters per row up front.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_terminal_scrollback [LINES]
+ */
+
+#include "terminal/buffer.h"
+#include "terminal/terminal.h"
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * The number of lines written if no number of lines is given on the command
+ * line.
+ */
+#define BENCH_DEFAULT_LINES 100000
+
+/**
+ * The number of rows visible within the simulated terminal.
+ */
+#define BENCH_TERMINAL_HEIGHT 24
+
+/**
+ * The number of columns within each line written.
+ */
+#define BENCH_TERMINAL_WIDTH 80
+
+/**
+ * The number of characters allocated for each row by the previous storage of
+ * the buffer.
+ */
+#define BENCH_LEGACY_ROW_SIZE 256
+
+/**
+ * The character used to fill new character cells, matching the default
+ * character of a terminal using the default color scheme.
+ */
+static const guac_terminal_char bench_default_char = {
+    .value = 0,
+    .attributes = {
+        .foreground = { .palette_index = 7, .red = 0x80, .green = 0x80, .blue = 0x80 },
+        .background = { .palette_index = 0 }
+    },
+    .width = 1
+};
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Returns the number of bytes currently allocated from the heap.
+ *
+ * @return
+ *     The number of bytes currently allocated from the heap.
+ */
+static size_t bench_heap_usage(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+/**
+ * Writes a single line of synthetic output to the given row of the given
+ * buffer, consisting of a plain file mode, owner, and size followed by a
+ * colorized filename and trailing blank space.
+ *
+ * @param buffer
+ *     The buffer to write to.
+ *
+ * @param row
+ *     The row to write to.
+ *
+ * @param line
+ *     The number of the line being written.
+ */
+static void bench_write_line(guac_terminal_buffer* buffer, int row, int line) {
+
+    char text[BENCH_TERMINAL_WIDTH + 1];
+    int length = snprintf(text, sizeof(text),
+            "-rw-r--r-- 1 guacd guacd %8i Oct 16 12:00 file-%i.c",
+            line * 37 % 100000, line);
+
+    guac_terminal_char character = bench_default_char;
+    guac_terminal_char colored = bench_default_char;
+    colored.attributes.bold = true;
+    colored.attributes.foreground = (guac_terminal_color) {
+        .palette_index = 2 + line % 5, .green = 0xFF
+    };
+
+    for (int column = 0; column < BENCH_TERMINAL_WIDTH; column++) {
+
+        guac_terminal_char* current = (column >= 45) ? &colored : &character;
+        current->value = (column < length) ? text[column] : 0;
+
+        guac_terminal_buffer_set_columns(buffer, row, column, column, current);
+
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    int lines = BENCH_DEFAULT_LINES;
+    if (argc > 1)
+        lines = atoi(argv[1]);
+
+    if (lines <= 0) {
+        fprintf(stderr, "Usage: %s [LINES]\n", argv[0]);
+        return 1;
+    }
+
+    int rows = GUAC_TERMINAL_DEFAULT_MAX_SCROLLBACK;
+    if (rows < GUAC_TERMINAL_MAX_ROWS)
+        rows = GUAC_TERMINAL_MAX_ROWS;
+
+    size_t initial = bench_heap_usage();
+
+    guac_terminal_buffer* normal = guac_terminal_buffer_alloc(rows, &bench_default_char);
+    guac_terminal_buffer* alternate = guac_terminal_buffer_alloc(GUAC_TERMINAL_MAX_ROWS, &bench_default_char);
+
+    size_t allocated = bench_heap_usage() - initial;
+
+    uint64_t start = bench_now();
+
+    for (int line = 0; line < lines; line++) {
+
+        int row = line;
+        if (row >= BENCH_TERMINAL_HEIGHT) {
+            guac_terminal_buffer_scroll_up(normal, 1, true);
+            row = BENCH_TERMINAL_HEIGHT - 1;
+        }
+
+        bench_write_line(normal, row, line);
+
+    }
+
+    double seconds = (bench_now() - start) / 1000000000.0;
+    size_t filled = bench_heap_usage() - initial;
+
+    size_t legacy = (size_t) (rows + GUAC_TERMINAL_MAX_ROWS)
+        * BENCH_LEGACY_ROW_SIZE * sizeof(guac_terminal_char);
+
+    printf("%i lines in %.3f s (%.0f lines/s)\n", lines, seconds,
+            lines / seconds);
+    printf("Previous storage: %zu KB per session\n", legacy / 1024);
+    printf("After allocation: %zu KB per session\n", allocated / 1024);
+    printf("After filling:    %zu KB per session\n", filled / 1024);
+
+    guac_terminal_buffer_free(alternate);
+    guac_terminal_buffer_free(normal);
+    return 0;
+
+}
+
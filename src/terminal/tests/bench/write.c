@@ -0,0 +1,269 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Benchmark of terminal rendering. The given file (or, if no file is given,
+ * both synthetic output resembling colorized "ls -l" or compiler output and
+ * synthetic plain text resembling a build log or "cat" of a large file) is
+ * piped through guac_terminal_write() in 4 KB pieces, flushing the terminal
+ * display after each piece as the terminal's render thread would at the end
+ * of each frame. The overall throughput achieved is printed along with the
+ * throughput of guac_terminal_write() alone (interpreting output and updating
+ * the terminal buffer and pending display operations, but not flushing those
+ * operations) and the number of glyphs drawn from the glyph cache versus
+ * rendered with Pango.
+ *
+ * This program is built by "make check" but is not run as part of the test
+ * suite. Run it manually:
+ *
+ *     ./bench_terminal_write [FILE]
+ */
+
+#include "terminal/display.h"
+#include "terminal/glyph-cache.h"
+#include "terminal/terminal.h"
+#include "terminal/terminal-priv.h"
+
+#include <guacamole/client.h>
+#include <guacamole/mem.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * The number of bytes passed to each call to guac_terminal_write(),
+ * mirroring the size of the reads performed by the SSH and telnet protocol
+ * support.
+ */
+#define BENCH_CHUNK_SIZE 4096
+
+/**
+ * The number of bytes of synthetic output generated if no file is given.
+ */
+#define BENCH_SYNTHETIC_LENGTH (16 * 1048576)
+
+/**
+ * The width of the simulated display, in pixels.
+ */
+#define BENCH_WIDTH 1920
+
+/**
+ * The height of the simulated display, in pixels.
+ */
+#define BENCH_HEIGHT 1080
+
+/**
+ * The resolution of the simulated display, in DPI.
+ */
+#define BENCH_DPI 96
+
+/**
+ * Returns the current value of a monotonic clock, in nanoseconds.
+ *
+ * @return
+ *     The current value of a monotonic clock, in nanoseconds.
+ */
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Generates synthetic terminal output consisting of lines of words, returning
+ * the number of bytes generated. If colored, each word is given a different
+ * foreground color using an escape sequence.
+ */
+static size_t bench_generate(char** data, bool colored) {
+
+    static const char* words[] = {
+        "drwxr-xr-x", "guacd", "4096", "Oct", "src", "libguac", "terminal",
+        "display.c", "warning:", "unused", "variable", "0x7f3a", "make[2]:"
+    };
+
+    size_t length = 0;
+    char* buffer = malloc(BENCH_SYNTHETIC_LENGTH + 256);
+
+    for (unsigned int i = 0; length < BENCH_SYNTHETIC_LENGTH; i++) {
+
+        const char* word = words[(i * 7) % (sizeof(words) / sizeof(words[0]))];
+
+        /* Vary foreground color if requested, ending lines every 12 words */
+        if (colored)
+            length += sprintf(buffer + length, "\x1B[3%im%s\x1B[0m%s",
+                    i % 8, word, (i % 12 == 11) ? "\r\n" : " ");
+        else
+            length += sprintf(buffer + length, "%s%s",
+                    word, (i % 12 == 11) ? "\r\n" : " ");
+
+    }
+
+    *data = buffer;
+    return length;
+
+}
+
+/**
+ * Reads the entire contents of the file at the given path, returning the
+ * number of bytes read, or zero if the file cannot be read.
+ */
+static size_t bench_load(const char* path, char** data) {
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    size_t length = 0;
+    size_t size = 1048576;
+    char* buffer = malloc(size);
+
+    size_t result;
+    while ((result = fread(buffer + length, 1, size - length, file)) > 0) {
+        length += result;
+        if (length == size)
+            buffer = realloc(buffer, size *= 2);
+    }
+
+    fclose(file);
+
+    *data = buffer;
+    return length;
+
+}
+
+/**
+ * Pipes the given terminal output through a new terminal, printing the
+ * throughput achieved.
+ *
+ * @param label
+ *     A human-readable description of the output.
+ *
+ * @param data
+ *     The terminal output to write.
+ *
+ * @param length
+ *     The number of bytes of terminal output.
+ *
+ * @return
+ *     Zero if the benchmark ran successfully, non-zero otherwise.
+ */
+static int bench_run(const char* label, const char* data, size_t length) {
+
+    guac_client* client = guac_client_alloc();
+
+    guac_terminal_options* options = guac_terminal_options_create(
+            BENCH_WIDTH, BENCH_HEIGHT, BENCH_DPI);
+
+    guac_terminal* term = guac_terminal_create(client, options);
+    guac_mem_free(options);
+
+    if (term == NULL) {
+        fprintf(stderr, "Unable to create terminal.\n");
+        guac_client_free(client);
+        return 1;
+    }
+
+    int frames = 0;
+    uint64_t writing = 0;
+    uint64_t start = bench_now();
+
+    for (size_t offset = 0; offset < length; offset += BENCH_CHUNK_SIZE) {
+
+        size_t chunk = length - offset;
+        if (chunk > BENCH_CHUNK_SIZE)
+            chunk = BENCH_CHUNK_SIZE;
+
+        uint64_t write_start = bench_now();
+        guac_terminal_write(term, data + offset, chunk);
+        writing += bench_now() - write_start;
+
+        guac_terminal_lock(term);
+        guac_terminal_flush(term);
+        guac_terminal_unlock(term);
+
+        frames++;
+
+    }
+
+    double seconds = (bench_now() - start) / 1000000000.0;
+
+    guac_terminal_lock(term);
+    guac_terminal_glyph_cache* cache = term->display->glyph_cache;
+    uint64_t hits = cache->hits;
+    uint64_t misses = cache->misses;
+    guac_terminal_unlock(term);
+
+    printf("%s: %zu bytes in %.3f s (%.2f MB/s, %i frames)\n", label,
+            length, seconds, length / 1048576.0 / seconds, frames);
+    printf("    guac_terminal_write(): %.2f MB/s\n",
+            length / 1048576.0 / (writing / 1000000000.0));
+    printf("    Glyphs: %" PRIu64 " cached, %" PRIu64 " rendered\n",
+            hits, misses);
+
+    guac_client_stop(client);
+    guac_terminal_free(term);
+    guac_client_free(client);
+
+    return 0;
+
+}
+
+int main(int argc, char** argv) {
+
+    char* data;
+    size_t length;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [FILE]\n", argv[0]);
+        return 1;
+    }
+
+    /* Benchmark the given file only, if any */
+    if (argc == 2) {
+
+        length = bench_load(argv[1], &data);
+        if (length == 0)
+            return 1;
+
+        int result = bench_run(argv[1], data, length);
+        free(data);
+        return result;
+
+    }
+
+    length = bench_generate(&data, true);
+    int result = bench_run("Colorized", data, length);
+    free(data);
+
+    if (result != 0)
+        return result;
+
+    length = bench_generate(&data, false);
+    result = bench_run("Plain text", data, length);
+    free(data);
+
+    return result;
+
+}
@@ -0,0 +1,285 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "terminal/buffer.h"
+
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+
+/**
+ * The number of rows within each buffer allocated by these tests.
+ */
+#define TEST_BUFFER_ROWS 16
+
+/**
+ * The character used to fill new character cells within each buffer
+ * allocated by these tests.
+ */
+static const guac_terminal_char test_default_char = {
+    .value = 0,
+    .attributes = {
+        .foreground = { .palette_index = 7, .red = 0x80, .green = 0x80, .blue = 0x80 },
+        .background = { .palette_index = 0 }
+    },
+    .width = 1
+};
+
+/**
+ * Writes the given codepoints to consecutive columns of the given row,
+ * starting at the given column and using the given attributes.
+ *
+ * @param buffer
+ *     The buffer to write to.
+ *
+ * @param row
+ *     The row to write to.
+ *
+ * @param column
+ *     The column of the first codepoint.
+ *
+ * @param codepoints
+ *     The codepoints to write, terminated by a zero.
+ *
+ * @param width
+ *     The number of columns occupied by each codepoint.
+ *
+ * @param attributes
+ *     The attributes to assign to each codepoint.
+ *
+ * @return
+ *     The column immediately following the last codepoint written.
+ */
+static int test_write(guac_terminal_buffer* buffer, int row, int column,
+        const int* codepoints, int width,
+        const guac_terminal_attributes* attributes) {
+
+    for (; *codepoints != 0; codepoints++) {
+
+        guac_terminal_char character = {
+            .value = *codepoints,
+            .attributes = *attributes,
+            .width = width
+        };
+
+        guac_terminal_buffer_set_columns(buffer, row, column,
+                column + width - 1, &character);
+
+        column += width;
+
+    }
+
+    return column;
+
+}
+
+/**
+ * Verifies that the given row of the given buffer contains exactly the
+ * content written by test_fill_row().
+ *
+ * @param buffer
+ *     The buffer to verify.
+ *
+ * @param row
+ *     The row to verify.
+ *
+ * @param seed
+ *     The value that was provided to test_fill_row() for the row.
+ */
+static void test_verify_row(guac_terminal_buffer* buffer, int row, int seed) {
+
+    guac_terminal_char* characters;
+    bool is_wrapped;
+    unsigned int length = guac_terminal_buffer_get_columns(buffer,
+            &characters, &is_wrapped, row);
+
+    CU_ASSERT_EQUAL_FATAL(length, 9);
+    CU_ASSERT_EQUAL(is_wrapped, seed % 2 == 0);
+
+    /* Narrow, plain text */
+    for (int i = 0; i < 3; i++) {
+        CU_ASSERT_EQUAL(characters[i].value, 'a' + seed + i);
+        CU_ASSERT_EQUAL(characters[i].width, 1);
+        CU_ASSERT_FALSE(characters[i].attributes.bold);
+        CU_ASSERT_EQUAL(characters[i].attributes.foreground.red, 0x80);
+    }
+
+    /* Wide, bold text */
+    CU_ASSERT_EQUAL(characters[3].value, 0x4E2D);
+    CU_ASSERT_EQUAL(characters[3].width, 2);
+    CU_ASSERT_EQUAL(characters[4].value, GUAC_CHAR_CONTINUATION);
+    CU_ASSERT_EQUAL(characters[5].value, 0x1F600 + seed);
+    CU_ASSERT_EQUAL(characters[5].width, 2);
+    CU_ASSERT_EQUAL(characters[6].value, GUAC_CHAR_CONTINUATION);
+
+    for (int i = 3; i < 7; i++) {
+        CU_ASSERT_TRUE(characters[i].attributes.bold);
+        CU_ASSERT_EQUAL(characters[i].attributes.foreground.palette_index, 1);
+        CU_ASSERT_EQUAL(characters[i].attributes.foreground.red, 0xFF);
+    }
+
+    /* Explicitly-written default characters */
+    CU_ASSERT_EQUAL(characters[7].value, 0);
+    CU_ASSERT_EQUAL(characters[7].width, 1);
+    CU_ASSERT_EQUAL(characters[8].value, 0);
+
+    /* Space beyond the end of the row is filled with the default character */
+    CU_ASSERT_EQUAL(characters[9].value, 0);
+    CU_ASSERT_EQUAL(characters[9].attributes.foreground.red, 0x80);
+
+}
+
+/**
+ * Writes a mixture of narrow and wide characters having differing attributes
+ * to the given row, followed by two default characters, such that the row
+ * may be verified with test_verify_row().
+ *
+ * @param buffer
+ *     The buffer to write to.
+ *
+ * @param row
+ *     The row to write to.
+ *
+ * @param seed
+ *     An arbitrary value which varies the content written.
+ */
+static void test_fill_row(guac_terminal_buffer* buffer, int row, int seed) {
+
+    guac_terminal_attributes bold = test_default_char.attributes;
+    bold.bold = true;
+    bold.foreground = (guac_terminal_color) {
+        .palette_index = 1, .red = 0xFF
+    };
+
+    const int narrow[] = { 'a' + seed, 'b' + seed, 'c' + seed, 0 };
+    const int wide[] = { 0x4E2D, 0x1F600 + seed, 0 };
+
+    int column = test_write(buffer, row, 0, narrow, 1, &test_default_char.attributes);
+    column = test_write(buffer, row, column, wide, 2, &bold);
+
+    guac_terminal_char blank = test_default_char;
+    guac_terminal_buffer_set_columns(buffer, row, column, column + 1, &blank);
+
+    guac_terminal_buffer_set_wrapped(buffer, row, seed % 2 == 0);
+
+}
+
+/**
+ * Verifies that rows scrolled into the scrollback region retain their exact
+ * contents, including wide characters, attributes, and trailing default
+ * characters.
+ */
+void test_buffer__compact_round_trip(void) {
+
+    guac_terminal_buffer* buffer = guac_terminal_buffer_alloc(TEST_BUFFER_ROWS,
+            &test_default_char);
+
+    for (int row = 0; row < 4; row++)
+        test_fill_row(buffer, row, row);
+
+    guac_terminal_buffer_scroll_up(buffer, 4, true);
+
+    for (int row = 0; row < 4; row++)
+        test_verify_row(buffer, row - 4, row);
+
+    /* Rows expanded from scrollback must survive being compacted again */
+    guac_terminal_buffer_scroll_up(buffer, 3, true);
+
+    for (int row = 0; row < 4; row++)
+        test_verify_row(buffer, row - 7, row);
+
+    guac_terminal_buffer_free(buffer);
+
+}
+
+/**
+ * Verifies that rows which have never been written read as empty rows whose
+ * available space is filled with the default character, whether or not those
+ * rows have been scrolled into the scrollback region.
+ */
+void test_buffer__compact_unused_rows(void) {
+
+    guac_terminal_buffer* buffer = guac_terminal_buffer_alloc(TEST_BUFFER_ROWS,
+            &test_default_char);
+
+    guac_terminal_char* characters;
+    bool is_wrapped;
+
+    CU_ASSERT_EQUAL(guac_terminal_buffer_get_columns(buffer, &characters,
+                &is_wrapped, 3), 0);
+    CU_ASSERT_FALSE(is_wrapped);
+    CU_ASSERT_EQUAL(characters[0].value, 0);
+    CU_ASSERT_EQUAL(characters[0].attributes.foreground.red, 0x80);
+
+    guac_terminal_buffer_scroll_up(buffer, 5, true);
+
+    CU_ASSERT_EQUAL(guac_terminal_buffer_get_columns(buffer, &characters,
+                &is_wrapped, -2), 0);
+    CU_ASSERT_EQUAL(characters[0].value, 0);
+
+    /* Rows of only default characters retain their length */
+    guac_terminal_char blank = test_default_char;
+    guac_terminal_buffer_set_columns(buffer, 0, 0, 79, &blank);
+    guac_terminal_buffer_scroll_up(buffer, 1, true);
+
+    CU_ASSERT_EQUAL(guac_terminal_buffer_get_columns(buffer, &characters,
+                NULL, -1), 80);
+    CU_ASSERT_EQUAL(characters[79].value, 0);
+    CU_ASSERT_EQUAL(characters[79].width, 1);
+
+    guac_terminal_buffer_free(buffer);
+
+}
+
+/**
+ * Verifies that rows within the scrollback region may be modified after
+ * having been compacted, and that those modifications persist after the
+ * rows are compacted again.
+ */
+void test_buffer__compact_modify_scrollback(void) {
+
+    guac_terminal_buffer* buffer = guac_terminal_buffer_alloc(TEST_BUFFER_ROWS,
+            &test_default_char);
+
+    test_fill_row(buffer, 0, 0);
+    guac_terminal_buffer_scroll_up(buffer, 1, true);
+
+    /* Overwrite the first wide character of the compacted row */
+    guac_terminal_char character = test_default_char;
+    character.value = 'z';
+    guac_terminal_buffer_set_columns(buffer, -1, 3, 3, &character);
+
+    guac_terminal_buffer_scroll_up(buffer, 1, true);
+
+    guac_terminal_char* characters;
+    unsigned int length = guac_terminal_buffer_get_columns(buffer,
+            &characters, NULL, -2);
+
+    CU_ASSERT_EQUAL_FATAL(length, 9);
+    CU_ASSERT_EQUAL(characters[2].value, 'c');
+    CU_ASSERT_EQUAL(characters[3].value, 'z');
+    CU_ASSERT_EQUAL(characters[3].width, 1);
+    CU_ASSERT_NOT_EQUAL(characters[4].value, GUAC_CHAR_CONTINUATION);
+    CU_ASSERT_EQUAL(characters[4].width, 1);
+    CU_ASSERT_EQUAL(characters[5].value, 0x1F600);
+    CU_ASSERT_EQUAL(characters[5].width, 2);
+
+    guac_terminal_buffer_free(buffer);
+
+}
+
@@ -0,0 +1,114 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "terminal/buffer.h"
+
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+
+/**
+ * The character used to fill new character cells within each buffer
+ * allocated by these tests.
+ */
+static const guac_terminal_char test_default_char = {
+    .value = 0,
+    .width = 1
+};
+
+/**
+ * Verifies that guac_terminal_buffer_set_characters() stores a run of
+ * narrow and wide characters exactly as repeated calls to
+ * guac_terminal_buffer_set_columns() would.
+ */
+void test_buffer__set_characters(void) {
+
+    guac_terminal_buffer* bulk = guac_terminal_buffer_alloc(8, &test_default_char);
+    guac_terminal_buffer* single = guac_terminal_buffer_alloc(8, &test_default_char);
+
+    guac_terminal_char run[] = {
+        { .value = 'a', .width = 1 },
+        { .value = 0x4E2D, .width = 2 },
+        { .value = GUAC_CHAR_CONTINUATION, .width = 0 },
+        { .value = 'b', .width = 1 }
+    };
+
+    guac_terminal_buffer_set_characters(bulk, 2, 3, run, 4);
+
+    guac_terminal_buffer_set_columns(single, 2, 3, 3, &run[0]);
+    guac_terminal_buffer_set_columns(single, 2, 4, 5, &run[1]);
+    guac_terminal_buffer_set_columns(single, 2, 6, 6, &run[3]);
+
+    guac_terminal_char* expected;
+    guac_terminal_char* actual;
+
+    int length = guac_terminal_buffer_get_columns(single, &expected, NULL, 2);
+    CU_ASSERT_EQUAL(length, 7);
+    CU_ASSERT_EQUAL(guac_terminal_buffer_get_columns(bulk, &actual, NULL, 2), length);
+
+    for (int i = 0; i < length; i++) {
+        CU_ASSERT_EQUAL(actual[i].value, expected[i].value);
+        CU_ASSERT_EQUAL(actual[i].width, expected[i].width);
+    }
+
+    /* The written row is counted within the length of the buffer */
+    CU_ASSERT_EQUAL(guac_terminal_buffer_effective_length(bulk, 8), 3);
+
+    guac_terminal_buffer_free(single);
+    guac_terminal_buffer_free(bulk);
+
+}
+
+/**
+ * Verifies that guac_terminal_buffer_set_characters() breaks any wide
+ * characters which are only partially overwritten.
+ */
+void test_buffer__set_characters_break(void) {
+
+    guac_terminal_buffer* buffer = guac_terminal_buffer_alloc(8, &test_default_char);
+
+    guac_terminal_char wide = { .value = 0x4E2D, .width = 2 };
+    guac_terminal_buffer_set_columns(buffer, 0, 0, 1, &wide);
+    guac_terminal_buffer_set_columns(buffer, 0, 4, 5, &wide);
+
+    /* Overwrite the second half of the first wide character and the first
+     * half of the second */
+    guac_terminal_char run[] = {
+        { .value = 'x', .width = 1 },
+        { .value = 'y', .width = 1 },
+        { .value = 'z', .width = 1 },
+        { .value = 'w', .width = 1 }
+    };
+
+    guac_terminal_buffer_set_characters(buffer, 0, 1, run, 4);
+
+    guac_terminal_char* characters;
+    int length = guac_terminal_buffer_get_columns(buffer, &characters, NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(length, 6);
+
+    CU_ASSERT_EQUAL(characters[0].value, ' ');
+    CU_ASSERT_EQUAL(characters[0].width, 1);
+    CU_ASSERT_EQUAL(characters[1].value, 'x');
+    CU_ASSERT_EQUAL(characters[4].value, 'w');
+    CU_ASSERT_EQUAL(characters[5].value, ' ');
+    CU_ASSERT_EQUAL(characters[5].width, 1);
+
+    guac_terminal_buffer_free(buffer);
+
+}
+
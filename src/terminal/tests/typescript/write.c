@@ -0,0 +1,167 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "terminal/typescript.h"
+
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The number of bytes of terminal output written to each typescript by
+ * these tests. This is deliberately several times larger than the buffer of
+ * the typescript, such that the buffer repeatedly wraps and fills.
+ */
+#define TEST_OUTPUT_LENGTH (3 * GUAC_TERMINAL_TYPESCRIPT_BUFFER_SIZE + 12345)
+
+/**
+ * The number of bytes passed to each call to guac_terminal_typescript_write().
+ */
+#define TEST_CHUNK_SIZE 4000
+
+/**
+ * Reads the entire contents of the file having the given name within the
+ * given directory, returning a newly-allocated, null-terminated buffer which
+ * must be freed with free().
+ *
+ * @param path
+ *     The directory containing the file.
+ *
+ * @param filename
+ *     The name of the file to read.
+ *
+ * @param length
+ *     Pointer to a size_t that should receive the number of bytes read.
+ *
+ * @return
+ *     The contents of the file, or NULL if the file cannot be read.
+ */
+static char* read_file(const char* path, const char* filename, size_t* length) {
+
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s/%s", path, filename);
+
+    int fd = open(full_path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    size_t size = 65536;
+    char* buffer = malloc(size);
+    *length = 0;
+
+    ssize_t result;
+    while ((result = read(fd, buffer + *length, size - *length - 1)) > 0) {
+        *length += result;
+        if (*length == size - 1)
+            buffer = realloc(buffer, size *= 2);
+    }
+
+    buffer[*length] = '\0';
+    close(fd);
+    return buffer;
+
+}
+
+/**
+ * Verify that all output written to a typescript, including output written
+ * while the typescript's buffer is full, reaches the data file in order and
+ * is accounted for by the timing file.
+ */
+void test_typescript__write(void) {
+
+    char temp_dir[64] = "/tmp/guacamole-server-test_typescript__write.XXXXXX";
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(temp_dir));
+
+    guac_terminal_typescript* typescript =
+        guac_terminal_typescript_alloc(temp_dir, "typescript", 0, 0, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(typescript);
+
+    char data_filename[sizeof(typescript->data_filename)];
+    char timing_filename[sizeof(typescript->timing_filename)];
+    strcpy(data_filename, typescript->data_filename);
+    strcpy(timing_filename, typescript->timing_filename);
+
+    /* Write output consisting of a repeating pattern that is not a multiple
+     * of the chunk size, flushing only occasionally */
+    char* output = malloc(TEST_OUTPUT_LENGTH);
+    for (int i = 0; i < TEST_OUTPUT_LENGTH; i++)
+        output[i] = 'a' + i % 23;
+
+    int chunks = 0;
+    for (int offset = 0; offset < TEST_OUTPUT_LENGTH; offset += TEST_CHUNK_SIZE) {
+
+        int length = TEST_OUTPUT_LENGTH - offset;
+        if (length > TEST_CHUNK_SIZE)
+            length = TEST_CHUNK_SIZE;
+
+        guac_terminal_typescript_write(typescript, output + offset, length);
+
+        if (++chunks % 100 == 0)
+            guac_terminal_typescript_flush(typescript);
+
+    }
+
+    guac_terminal_typescript_free(typescript);
+
+    /* Data file must contain exactly the header, output, and footer */
+    size_t data_length;
+    char* data = read_file(temp_dir, data_filename, &data_length);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    size_t header_length = sizeof(GUAC_TERMINAL_TYPESCRIPT_HEADER) - 1;
+    size_t footer_length = sizeof(GUAC_TERMINAL_TYPESCRIPT_FOOTER) - 1;
+
+    CU_ASSERT_EQUAL_FATAL(data_length,
+            header_length + TEST_OUTPUT_LENGTH + footer_length);
+    CU_ASSERT_NSTRING_EQUAL(data, GUAC_TERMINAL_TYPESCRIPT_HEADER,
+            header_length);
+    CU_ASSERT(memcmp(data + header_length, output, TEST_OUTPUT_LENGTH) == 0);
+    CU_ASSERT_STRING_EQUAL(data + header_length + TEST_OUTPUT_LENGTH,
+            GUAC_TERMINAL_TYPESCRIPT_FOOTER);
+
+    /* Byte counts within timing file must account for all output */
+    size_t timing_length;
+    char* timing = read_file(temp_dir, timing_filename, &timing_length);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(timing);
+
+    int entries = 0;
+    long total = 0;
+    double delay;
+    long bytes;
+    int consumed;
+
+    for (char* line = timing;
+            sscanf(line, "%lf %ld\n%n", &delay, &bytes, &consumed) == 2;
+            line += consumed) {
+        total += bytes;
+        entries++;
+    }
+
+    CU_ASSERT_EQUAL(total, TEST_OUTPUT_LENGTH);
+    CU_ASSERT_EQUAL(entries, (chunks + 99) / 100);
+
+    free(timing);
+    free(data);
+    free(output);
+
+}
+
@@ -22,23 +22,452 @@
 
 #include <guacamole/file.h>
 #include <guacamole/mem.h>
+#include <guacamole/proctitle.h>
 #include <guacamole/timestamp.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * The size of the buffer used to hold compressed data before it is written
+ * to a typescript file, in bytes.
+ */
+#define GUAC_TERMINAL_TYPESCRIPT_OUTPUT_BUFFER_SIZE 65536
+
+struct guac_terminal_typescript_output {
+
+    /**
+     * The file descriptor of the file being written.
+     */
+    int fd;
+
+#ifdef ENABLE_ZLIB
+    /**
+     * Non-zero if data written to the file is being compressed using gzip,
+     * zero otherwise.
+     */
+    int compress;
+
+    /**
+     * The state of the compressor, valid only if compress is non-zero.
+     */
+    z_stream stream;
+
+    /**
+     * The last time that the compressor was flushed.
+     */
+    guac_timestamp last_flush;
+
+    /**
+     * Buffer receiving compressed data prior to that data being written to
+     * the file.
+     */
+    unsigned char out[GUAC_TERMINAL_TYPESCRIPT_OUTPUT_BUFFER_SIZE];
+#endif
+
+};
+
+/**
+ * Allocates a new guac_terminal_typescript_output which writes to the given
+ * file descriptor, optionally compressing all data written using gzip.
+ *
+ * @param fd
+ *     The file descriptor of the file to write.
+ *
+ * @param compress
+ *     Non-zero if data should be compressed using gzip if compression is
+ *     supported, zero otherwise.
+ *
+ * @return
+ *     A newly-allocated guac_terminal_typescript_output.
+ */
+static guac_terminal_typescript_output* guac_terminal_typescript_output_alloc(
+        int fd, int compress) {
+
+    guac_terminal_typescript_output* output =
+        guac_mem_zalloc(sizeof(guac_terminal_typescript_output));
+
+    output->fd = fd;
+
+#ifdef ENABLE_ZLIB
+    /* Window bits of 15 + 16 produce a gzip (rather than zlib) stream */
+    if (compress && deflateInit2(&output->stream,
+                GUAC_TERMINAL_TYPESCRIPT_COMPRESSION_LEVEL, Z_DEFLATED,
+                15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        output->compress = 1;
+        output->last_flush = guac_timestamp_current();
+    }
+#endif
+
+    return output;
+
+}
+
+/**
+ * Returns whether data written to the given output is being compressed.
+ *
+ * @param output
+ *     The output to test.
+ *
+ * @return
+ *     Non-zero if data written to the given output is being compressed,
+ *     zero otherwise.
+ */
+static int guac_terminal_typescript_output_compressed(
+        guac_terminal_typescript_output* output) {
+
+#ifdef ENABLE_ZLIB
+    return output->compress;
+#else
+    return 0;
+#endif
+
+}
+
+#ifdef ENABLE_ZLIB
+/**
+ * Compresses the given data, writing all compressed data produced to the
+ * file of the given output.
+ *
+ * @param output
+ *     The output whose compressor and file should be used.
+ *
+ * @param buffer
+ *     The data to compress, which may be NULL if length is zero.
+ *
+ * @param length
+ *     The number of bytes to compress.
+ *
+ * @param flush
+ *     The zlib flush mode to use, such as Z_NO_FLUSH, Z_SYNC_FLUSH, or
+ *     Z_FINISH.
+ *
+ * @return
+ *     Zero if the data was compressed and written successfully, non-zero
+ *     otherwise.
+ */
+static int guac_terminal_typescript_output_deflate(
+        guac_terminal_typescript_output* output, const char* buffer,
+        size_t length, int flush) {
+
+    z_stream* stream = &output->stream;
+    stream->next_in = (Bytef*) buffer;
+    stream->avail_in = length;
+
+    for (;;) {
+
+        stream->next_out = output->out;
+        stream->avail_out = sizeof(output->out);
+
+        int result = deflate(stream, flush);
+        if (result == Z_STREAM_ERROR)
+            return 1;
+
+        int compressed = sizeof(output->out) - stream->avail_out;
+        if (compressed > 0
+                && guac_common_write(output->fd, output->out, compressed) < 0)
+            return 1;
+
+        /* Finishing is complete only once the end of the stream is written,
+         * while all other modes are complete once output space remains */
+        if (flush == Z_FINISH) {
+            if (result == Z_STREAM_END)
+                break;
+        }
+        else if (stream->avail_out != 0)
+            break;
+
+    }
+
+    return 0;
+
+}
+#endif
+
+/**
+ * Writes the given data to the file of the given output, compressing that
+ * data if the output is compressed.
+ *
+ * @param output
+ *     The output to write to.
+ *
+ * @param buffer
+ *     The data to write.
+ *
+ * @param length
+ *     The number of bytes to write. This must not exceed INT_MAX.
+ *
+ * @return
+ *     Zero if the data was written successfully, non-zero otherwise.
+ */
+static int guac_terminal_typescript_output_write(
+        guac_terminal_typescript_output* output, const char* buffer,
+        size_t length) {
+
+    if (length == 0)
+        return 0;
+
+#ifdef ENABLE_ZLIB
+    if (output->compress)
+        return guac_terminal_typescript_output_deflate(output, buffer,
+                length, Z_NO_FLUSH);
+#endif
+
+    return guac_common_write(output->fd, (void*) buffer, length) < 0;
+
+}
+
+/**
+ * Flushes the compressor of the given output if the output is compressed and
+ * GUAC_TERMINAL_TYPESCRIPT_COMPRESSION_FLUSH_INTERVAL has elapsed since the
+ * compressor was last flushed, such that all data written thus far can be
+ * read back. If the output is not compressed, this function has no effect.
+ *
+ * @param output
+ *     The output to flush.
+ *
+ * @return
+ *     Zero if the flush succeeded, non-zero otherwise.
+ */
+static int guac_terminal_typescript_output_flush(
+        guac_terminal_typescript_output* output) {
+
+#ifdef ENABLE_ZLIB
+    if (output->compress) {
+
+        guac_timestamp now = guac_timestamp_current();
+        if (now - output->last_flush >= GUAC_TERMINAL_TYPESCRIPT_COMPRESSION_FLUSH_INTERVAL) {
+            output->last_flush = now;
+            return guac_terminal_typescript_output_deflate(output, NULL, 0,
+                    Z_SYNC_FLUSH);
+        }
+
+    }
+#endif
+
+    return 0;
+
+}
+
+/**
+ * Finishes and frees the given output, writing the end of the compressed
+ * stream if the output is compressed, and closing the file of the output.
+ *
+ * @param output
+ *     The output to free.
+ */
+static void guac_terminal_typescript_output_free(
+        guac_terminal_typescript_output* output) {
+
+#ifdef ENABLE_ZLIB
+    if (output->compress) {
+        guac_terminal_typescript_output_deflate(output, NULL, 0, Z_FINISH);
+        deflateEnd(&output->stream);
+    }
+#endif
+
+    close(output->fd);
+    guac_mem_free(output);
+
+}
+
+/**
+ * Writes the given number of bytes from the beginning of the given circular
+ * buffer to the given output. The contents of the buffer are not modified.
+ * As the writer thread is the only thread which removes data from the
+ * buffer, and other threads only ever append data beyond the bytes already
+ * stored, the lock of the typescript need not be held.
+ *
+ * @param output
+ *     The output to write to.
+ *
+ * @param ring
+ *     The circular buffer containing the data to write.
+ *
+ * @param length
+ *     The number of bytes to write, which must not exceed the number of bytes
+ *     stored within the buffer.
+ *
+ * @return
+ *     Zero if the data was written successfully, non-zero otherwise.
+ */
+static int guac_terminal_typescript_ring_write(
+        guac_terminal_typescript_output* output,
+        guac_terminal_typescript_ring* ring, size_t length) {
+
+    /* Write up to the end of the buffer, followed by any data which has
+     * wrapped around to the beginning */
+    size_t first = ring->size - ring->start;
+    if (first > length)
+        first = length;
+
+    return guac_terminal_typescript_output_write(output,
+                ring->data + ring->start, first)
+        || guac_terminal_typescript_output_write(output,
+                ring->data, length - first);
+
+}
+
+/**
+ * Removes the given number of bytes from the beginning of the given circular
+ * buffer. The lock of the typescript owning the buffer must be held.
+ *
+ * @param ring
+ *     The circular buffer to remove data from.
+ *
+ * @param length
+ *     The number of bytes to remove, which must not exceed the number of
+ *     bytes stored within the buffer.
+ */
+static void guac_terminal_typescript_ring_consume(
+        guac_terminal_typescript_ring* ring, size_t length) {
+    ring->start = (ring->start + length) % ring->size;
+    ring->length -= length;
+}
+
+/**
+ * Appends the given data to the end of the given circular buffer of the
+ * given typescript. If the buffer is full, this function waits until the
+ * writer thread has made space available. If writing the typescript has
+ * failed, the data is discarded. The lock of the typescript must be held.
+ *
+ * @param typescript
+ *     The typescript owning the circular buffer.
+ *
+ * @param ring
+ *     The circular buffer to append to.
+ *
+ * @param buffer
+ *     The data to append.
+ *
+ * @param length
+ *     The number of bytes to append.
+ */
+static void guac_terminal_typescript_ring_append(
+        guac_terminal_typescript* typescript,
+        guac_terminal_typescript_ring* ring, const char* buffer,
+        size_t length) {
+
+    while (length > 0 && !typescript->failed) {
+
+        /* Wait for the writer thread to make space if the buffer is full */
+        size_t available = ring->size - ring->length;
+        if (available == 0) {
+            typescript->flush_requested = 1;
+            pthread_cond_signal(&typescript->modified);
+            pthread_cond_wait(&typescript->drained, &typescript->lock);
+            continue;
+        }
+
+        size_t chunk = length;
+        if (chunk > available)
+            chunk = available;
+
+        /* Copy up to the end of the buffer, wrapping around to the beginning
+         * of the buffer for any remaining data */
+        size_t end = (ring->start + ring->length) % ring->size;
+        size_t first = ring->size - end;
+        if (first > chunk)
+            first = chunk;
+
+        memcpy(ring->data + end, buffer, first);
+        memcpy(ring->data, buffer + first, chunk - first);
+
+        ring->length += chunk;
+        buffer += chunk;
+        length -= chunk;
+
+    }
+
+}
+
+/**
+ * Writes all data queued within the circular buffers of the given
+ * typescript to the data and timing files as it becomes available, until
+ * the typescript is being freed and no queued data remains.
+ *
+ * @param data
+ *     The guac_terminal_typescript whose files should be written.
+ *
+ * @return
+ *     Always NULL.
+ */
+static void* guac_terminal_typescript_writer_thread(void* data) {
+
+    guac_thread_name_set("term-typescript");
+
+    guac_terminal_typescript* typescript = (guac_terminal_typescript*) data;
+
+    pthread_mutex_lock(&typescript->lock);
+
+    for (;;) {
+
+        /* Wait until data should be written, allowing output to accumulate
+         * between flushes such that each file is written in batches */
+        while (!typescript->flush_requested && !typescript->stopping
+                && typescript->data.length < typescript->data.size / 2)
+            pthread_cond_wait(&typescript->modified, &typescript->lock);
+
+        size_t data_length = typescript->data.length;
+        size_t timing_length = typescript->timing.length;
+
+        /* Stop only once all queued data has been written */
+        if (typescript->stopping && data_length == 0 && timing_length == 0)
+            break;
+
+        typescript->flush_requested = 0;
+        int failed = typescript->failed;
+        pthread_mutex_unlock(&typescript->lock);
+
+        /* Write queued data without holding the lock, such that terminal
+         * output can continue to be queued while the files are written */
+        if (!failed) {
+            failed =
+                   guac_terminal_typescript_ring_write(typescript->data_output,
+                        &typescript->data, data_length)
+                || guac_terminal_typescript_ring_write(typescript->timing_output,
+                        &typescript->timing, timing_length)
+                || guac_terminal_typescript_output_flush(typescript->data_output)
+                || guac_terminal_typescript_output_flush(typescript->timing_output);
+        }
+
+        pthread_mutex_lock(&typescript->lock);
+
+        /* Data which could not be written is discarded, as is any further
+         * output, such that the terminal is never blocked indefinitely */
+        if (failed)
+            typescript->failed = 1;
+
+        guac_terminal_typescript_ring_consume(&typescript->data, data_length);
+        guac_terminal_typescript_ring_consume(&typescript->timing, timing_length);
+        pthread_cond_broadcast(&typescript->drained);
+
+    }
+
+    pthread_mutex_unlock(&typescript->lock);
+    return NULL;
+
+}
+
 guac_terminal_typescript* guac_terminal_typescript_alloc(const char* path,
-        const char* name, int create_path, int allow_write_existing) {
+        const char* name, int create_path, int allow_write_existing,
+        int compress) {
 
     /* Allocate space for new typescript */
     guac_terminal_typescript* typescript =
-        guac_mem_alloc(sizeof(guac_terminal_typescript));
+        guac_mem_zalloc(sizeof(guac_terminal_typescript));
 
     guac_open_how data_how = {
         .oflags = O_CREAT | O_WRONLY,
@@ -82,27 +511,71 @@ guac_terminal_typescript* guac_terminal_typescript_alloc(const char* path,
         return NULL;
     }
 
+    /* Prepare both files for writing, compressing if requested and
+     * supported */
+    typescript->data_output = guac_terminal_typescript_output_alloc(
+            typescript->data_fd, compress);
+    typescript->compress =
+        guac_terminal_typescript_output_compressed(typescript->data_output);
+    typescript->timing_output = guac_terminal_typescript_output_alloc(
+            typescript->timing_fd, typescript->compress);
+
+    /* Allocate buffers for output awaiting the writer thread */
+    typescript->data.size = GUAC_TERMINAL_TYPESCRIPT_BUFFER_SIZE;
+    typescript->data.data = guac_mem_alloc(typescript->data.size);
+    typescript->timing.size = GUAC_TERMINAL_TYPESCRIPT_TIMING_BUFFER_SIZE;
+    typescript->timing.data = guac_mem_alloc(typescript->timing.size);
+
+    pthread_mutex_init(&typescript->lock, NULL);
+    pthread_cond_init(&typescript->modified, NULL);
+    pthread_cond_init(&typescript->drained, NULL);
+
     /* Typescript starts out flushed */
     typescript->length = 0;
     typescript->last_flush = guac_timestamp_current();
 
     /* Write header */
-    guac_common_write(typescript->data_fd, GUAC_TERMINAL_TYPESCRIPT_HEADER,
+    guac_terminal_typescript_ring_append(typescript, &typescript->data,
+            GUAC_TERMINAL_TYPESCRIPT_HEADER,
             sizeof(GUAC_TERMINAL_TYPESCRIPT_HEADER) - 1);
 
+    /* Begin writing files */
+    if (pthread_create(&typescript->writer, NULL,
+                guac_terminal_typescript_writer_thread, typescript)) {
+        pthread_cond_destroy(&typescript->drained);
+        pthread_cond_destroy(&typescript->modified);
+        pthread_mutex_destroy(&typescript->lock);
+        guac_mem_free(typescript->timing.data);
+        guac_mem_free(typescript->data.data);
+        guac_terminal_typescript_output_free(typescript->timing_output);
+        guac_terminal_typescript_output_free(typescript->data_output);
+        guac_mem_free(typescript);
+        return NULL;
+    }
+
     return typescript;
 
 }
 
 void guac_terminal_typescript_write(guac_terminal_typescript* typescript,
-        char c) {
+        const char* buffer, int length) {
 
-    /* Flush buffer if no space is available */
-    if (typescript->length == sizeof(typescript->buffer))
-        guac_terminal_typescript_flush(typescript);
+    if (length <= 0)
+        return;
+
+    pthread_mutex_lock(&typescript->lock);
+
+    guac_terminal_typescript_ring_append(typescript, &typescript->data,
+            buffer, length);
+
+    /* Wake the writer thread early if output is accumulating faster than
+     * the typescript is being flushed */
+    if (typescript->data.length >= typescript->data.size / 2)
+        pthread_cond_signal(&typescript->modified);
 
-    /* Append single byte to buffer */
-    typescript->buffer[typescript->length++] = c;
+    pthread_mutex_unlock(&typescript->lock);
+
+    typescript->length += length;
 
 }
 
@@ -124,19 +597,20 @@ void guac_terminal_typescript_flush(guac_terminal_typescript* typescript) {
     /* Produce single line of timestamp output */
     char timestamp_buffer[32];
     int timestamp_length = snprintf(timestamp_buffer, sizeof(timestamp_buffer),
-            "%0.6f %i\n", elapsed_time / 1000.0, typescript->length);
+            "%0.6f %zu\n", elapsed_time / 1000.0, typescript->length);
 
     /* Calculate actual length of timestamp line */
     if (timestamp_length > sizeof(timestamp_buffer))
         timestamp_length = sizeof(timestamp_buffer);
 
-    /* Write timestamp to timing file */
-    guac_common_write(typescript->timing_fd,
+    /* Queue timestamp for writing to timing file, waking the writer thread
+     * to write all output queued thus far */
+    pthread_mutex_lock(&typescript->lock);
+    guac_terminal_typescript_ring_append(typescript, &typescript->timing,
             timestamp_buffer, timestamp_length);
-
-    /* Empty buffer into data file */
-    guac_common_write(typescript->data_fd,
-            typescript->buffer, typescript->length);
+    typescript->flush_requested = 1;
+    pthread_cond_signal(&typescript->modified);
+    pthread_mutex_unlock(&typescript->lock);
 
     /* Buffer is now flushed */
     typescript->length = 0;
@@ -153,16 +627,27 @@ void guac_terminal_typescript_free(guac_terminal_typescript* typescript) {
     /* Flush any pending data */
     guac_terminal_typescript_flush(typescript);
 
-    /* Write footer */
-    guac_common_write(typescript->data_fd, GUAC_TERMINAL_TYPESCRIPT_FOOTER,
+    /* Write footer and wait for all queued data to be written */
+    pthread_mutex_lock(&typescript->lock);
+    guac_terminal_typescript_ring_append(typescript, &typescript->data,
+            GUAC_TERMINAL_TYPESCRIPT_FOOTER,
             sizeof(GUAC_TERMINAL_TYPESCRIPT_FOOTER) - 1);
+    typescript->stopping = 1;
+    pthread_cond_signal(&typescript->modified);
+    pthread_mutex_unlock(&typescript->lock);
 
-    /* Close file descriptors */
-    close(typescript->data_fd);
-    close(typescript->timing_fd);
+    pthread_join(typescript->writer, NULL);
+
+    /* Finish and close both files */
+    guac_terminal_typescript_output_free(typescript->data_output);
+    guac_terminal_typescript_output_free(typescript->timing_output);
 
     /* Free allocated typescript data */
+    pthread_cond_destroy(&typescript->drained);
+    pthread_cond_destroy(&typescript->modified);
+    pthread_mutex_destroy(&typescript->lock);
+    guac_mem_free(typescript->timing.data);
+    guac_mem_free(typescript->data.data);
     guac_mem_free(typescript);
 
 }
-
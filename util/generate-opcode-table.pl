@@ -0,0 +1,197 @@
+#!/usr/bin/env perl
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+#
+# generate-opcode-table.pl
+#
+# Generates the C source implementing guac_opcode_lookup() and
+# guac_opcode_name() from the guac_opcode enum declared within the header
+# given on the command line (guacamole/opcode-types.h). Each value of that
+# enum must be declared on its own line in the following form:
+#
+#     GUAC_OPCODE_NAME,
+#
+# where NAME is the uppercase form of the opcode. The GUAC_OPCODE_UNKNOWN and
+# GUAC_OPCODE_COUNT values are not opcodes and are ignored.
+#
+# Opcodes are located using a perfect hash: the 32-bit FNV-1a
+# hash of each opcode, starting from a seed, is used to index a table having
+# GUAC_OPCODE_TABLE_SIZE entries. This script searches for the first seed for
+# which no two opcodes share an entry, such that a lookup requires only one
+# hash, one table access, and one string comparison to verify the match.
+#
+
+use strict;
+use warnings;
+
+#
+# The base-2 logarithm of the number of entries in the generated table. This
+# must be large enough for a seed to be found in reasonable time.
+#
+my $table_bits = 9;
+my $table_size = 1 << $table_bits;
+
+#
+# Read all opcodes from the given header
+#
+
+my @opcodes;
+while (my $line = <>) {
+    if ($line =~ m/^\s*GUAC_OPCODE_([A-Z0-9_]+)\s*(?:=\s*\d+\s*)?,?\s*$/) {
+        my $name = $1;
+        next if $name eq 'UNKNOWN' || $name eq 'COUNT';
+        push @opcodes, $name;
+    }
+}
+
+die "No opcodes found\n" unless @opcodes;
+die "Too many opcodes for table\n" unless scalar(@opcodes) * 4 <= $table_size;
+
+#
+# Returns the FNV-1a hash of the given string, starting from the given seed,
+# reduced to an index within the table.
+#
+
+sub opcode_hash {
+    my ($seed, $string) = @_;
+    my $hash = $seed;
+    foreach my $c (unpack('C*', $string)) {
+        $hash = (($hash ^ $c) * 16777619) & 0xFFFFFFFF;
+    }
+    return $hash >> (32 - $table_bits);
+}
+
+#
+# Search for a seed which maps each opcode to a distinct table entry
+#
+
+my $seed;
+my %table;
+SEED: for (my $candidate = 2166136261; ; $candidate = ($candidate + 1) & 0xFFFFFFFF) {
+
+    %table = ();
+    foreach my $name (@opcodes) {
+        my $index = opcode_hash($candidate, lc $name);
+        next SEED if exists $table{$index};
+        $table{$index} = $name;
+    }
+
+    $seed = $candidate;
+    last;
+
+}
+
+#
+# Generated source
+#
+
+print <<"END";
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Automatically generated by generate-opcode-table.pl. DO NOT EDIT.
+ */
+
+#include "guacamole/opcode.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The seed of the hash used to index guac_opcode_table.
+ */
+#define GUAC_OPCODE_HASH_SEED ${seed}u
+
+/**
+ * The number of bits of the hash used to index guac_opcode_table.
+ */
+#define GUAC_OPCODE_TABLE_BITS $table_bits
+
+/**
+ * The string forms of all opcodes, indexed by numeric identifier.
+ */
+static const char* const guac_opcode_names[GUAC_OPCODE_COUNT] = {
+END
+
+foreach my $name (sort @opcodes) {
+    printf "    [GUAC_OPCODE_%s] = \"%s\",\n", $name, lc $name;
+}
+
+print <<"END";
+};
+
+/**
+ * The numeric identifiers of all opcodes, indexed by hash. Entries which do
+ * not correspond to the hash of any opcode are GUAC_OPCODE_UNKNOWN.
+ */
+static const unsigned char guac_opcode_table[1 << GUAC_OPCODE_TABLE_BITS] = {
+END
+
+foreach my $index (sort { $a <=> $b } keys %table) {
+    printf "    [%d] = GUAC_OPCODE_%s,\n", $index, $table{$index};
+}
+
+print <<'END';
+};
+
+guac_opcode guac_opcode_lookup(const char* opcode) {
+
+    /* Hash opcode using FNV-1a */
+    uint32_t hash = GUAC_OPCODE_HASH_SEED;
+    for (const unsigned char* current = (const unsigned char*) opcode;
+            *current != '\0'; current++)
+        hash = (hash ^ *current) * 16777619u;
+
+    /* The opcode is known only if it matches the opcode having its hash */
+    guac_opcode id = guac_opcode_table[hash >> (32 - GUAC_OPCODE_TABLE_BITS)];
+    if (id != GUAC_OPCODE_UNKNOWN && strcmp(guac_opcode_names[id], opcode) == 0)
+        return id;
+
+    return GUAC_OPCODE_UNKNOWN;
+
+}
+
+const char* guac_opcode_name(guac_opcode opcode) {
+
+    if (opcode <= GUAC_OPCODE_UNKNOWN || opcode >= GUAC_OPCODE_COUNT)
+        return NULL;
+
+    return guac_opcode_names[opcode];
+
+}
+END
+